@@ -21,6 +21,12 @@
 # Debug message behaviour: Edit `INIT_DBG_MODES` in kernel/util/debug.c to set
 # which messages are shown.
 
+# Assertion behaviour: Edit `KASSERT_LEVEL` in kernel/include/config.h.
+# Level 2 (the default) compiles every assertion; level 1 drops the
+# expensive whole-structure checks (KASSERT_EXPENSIVE, the scheduler
+# queue sanity walks) while keeping the cheap invariants, and is what
+# release/benchmark builds should use; level 0 drops them all.
+
 # Switches for non-required components. If you wish to try implementing
 # some extra features in Weenix, there are some pre-designed features
 # you can add. Turn on one of these flags and re-compile Weenix. Please
@@ -35,7 +41,7 @@
 # go breaking it, which we promise you will happen.
 
          SHADOWD=0 # shadow page cleanup
-        MOUNTING=0 # be able to mount multiple file systems
+        MOUNTING=1 # be able to mount multiple file systems
           GETCWD=0 # getcwd(3) syscall-like functionality
         UPREEMPT=0 # userland preemption
         KPREEMPT=0 # kernel space preemption
@@ -45,6 +51,10 @@
           VGABUF=0 # Use a rudimentary VGA buffers instead of VT support.
 	KPREEMPT=0
         RENAMEDIR=0
+       BENCHMODE=0 # headless CI benchmarking: boot straight into the kbench
+                   # suite with no shell, write CSV results to /kbench.out on
+                   # the root fs, and power the VM off. Needs VFS. The python/
+                   # tooling can then diff medians across commits.
 
 # Set the number of terminals that we should be launching.
         NTERMS=3
@@ -68,6 +78,6 @@
 
 # Boolean options specified in this specified in this file that should be
 # included as definitions at compile time
-        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP GETCWD RENAMEDIR UPREEMPT PIPES SMP KPREEMPT"
+        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP GETCWD RENAMEDIR UPREEMPT PIPES SMP KPREEMPT BENCHMODE"
 # As above, but not booleans
         COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE "
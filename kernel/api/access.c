@@ -7,10 +7,20 @@
 
 #include "mm/kmalloc.h"
 #include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/pagetable.h"
 
 #include "api/access.h"
 #include "api/syscall.h"
 
+/* Upper bound on the combined size of an argument vector and its strings
+ * (our ARG_MAX, roughly); anything larger gets -E2BIG. */
+#define ARG_TOTAL_MAX (1UL << 16)
+
+/* Extra padding tolerated between argv strings before user_vecdup gives
+ * up on bulk staging and falls back to copying them one at a time. */
+#define ARG_STAGE_SLACK PAGE_SIZE
+
 static inline long userland_address(const void *addr)
 {
     return addr >= (void *)USER_MEM_LOW && addr < (void *)USER_MEM_HIGH;
@@ -24,11 +34,26 @@ static inline long userland_address(const void *addr)
  */
 long copy_from_user(void *kaddr, const void *uaddr, size_t nbytes)
 {
+    KASSERT(userland_address(uaddr) && !userland_address(kaddr));
+
+    /*
+     * Fast path: if every source page is already present in the live page
+     * tables, copy straight through them and skip the vmarea walk and mobj
+     * lookups. A present user PTE implies read permission, and nothing can
+     * pull the mappings out from under the memcpy: we are running in the
+     * owning process's address space and the kernel is not preemptible.
+     */
+    if (userland_address((const char *)uaddr + nbytes - 1) &&
+        pt_range_mapped(curproc->p_pml4, (uintptr_t)uaddr, nbytes, 0))
+    {
+        memcpy(kaddr, uaddr, nbytes);
+        return 0;
+    }
+
     if (!range_perm(curproc, uaddr, nbytes, PROT_READ))
     {
         return -EFAULT;
     }
-    KASSERT(userland_address(uaddr) && !userland_address(kaddr));
     return vmmap_read(curproc->p_vmmap, uaddr, kaddr, nbytes);
 }
 
@@ -40,11 +65,25 @@ long copy_from_user(void *kaddr, const void *uaddr, size_t nbytes)
  */
 long copy_to_user(void *uaddr, const void *kaddr, size_t nbytes)
 {
+    KASSERT(userland_address(uaddr) && !userland_address(kaddr));
+
+    /*
+     * Fast path (see copy_from_user). A leaf PTE only gains PT_WRITE once
+     * a write fault has gone through mobj_get_pframe(forwrite = 1), which
+     * breaks any copy-on-write sharing and dirties the pframe - so storing
+     * directly into a writable-mapped page is equivalent to vmmap_write.
+     */
+    if (userland_address((const char *)uaddr + nbytes - 1) &&
+        pt_range_mapped(curproc->p_pml4, (uintptr_t)uaddr, nbytes, 1))
+    {
+        memcpy(uaddr, kaddr, nbytes);
+        return 0;
+    }
+
     if (!range_perm(curproc, uaddr, nbytes, PROT_WRITE))
     {
         return -EFAULT;
     }
-    KASSERT(userland_address(uaddr) && !userland_address(kaddr));
     return vmmap_write(curproc->p_vmmap, uaddr, kaddr, nbytes);
 }
 
@@ -71,41 +110,110 @@ long user_strdup(argstr_t *ustr, char **kstrp)
 
 /*
  * Duplicate the string of vectors identified by uvec into kernel memory.
- * The vector itself (char**) and each string (char*) should be allocated
- * using kmalloc.
+ * The result is a single kmalloc'd block: the (av_len + 1) pointers come
+ * first, immediately followed by the strings they point to, so the caller
+ * frees everything with one kfree of the vector.
  */
 long user_vecdup(argvec_t *uvec, char ***kvecp)
 {
     KASSERT(!userland_address(uvec));
     KASSERT(userland_address(uvec->av_vec));
 
-    char **kvec = kmalloc((uvec->av_len + 1) * sizeof(char *));
-    *kvecp = kvec;
+    *kvecp = NULL;
+
+    /* Stage the descriptor array with a single bulk copy rather than one
+     * copy_from_user (and its vmmap walk) per entry. */
+    argstr_t *uargs = kmalloc(uvec->av_len * sizeof(argstr_t));
+    if (!uargs)
+    {
+        return -ENOMEM;
+    }
+    long ret =
+        copy_from_user(uargs, uvec->av_vec, uvec->av_len * sizeof(argstr_t));
+    if (ret)
+    {
+        kfree(uargs);
+        return ret;
+    }
+
+    /* Size the output block, and find the span of userland memory the
+     * strings occupy. */
+    size_t strbytes = 0;
+    const char *lo = (const char *)USER_MEM_HIGH;
+    const char *hi = (const char *)USER_MEM_LOW;
+    for (size_t i = 0; i < uvec->av_len; i++)
+    {
+        strbytes += uargs[i].as_len + 1;
+        if (uargs[i].as_str < lo)
+        {
+            lo = uargs[i].as_str;
+        }
+        if (uargs[i].as_str + uargs[i].as_len + 1 > hi)
+        {
+            hi = uargs[i].as_str + uargs[i].as_len + 1;
+        }
+    }
+
+    size_t vecbytes = (uvec->av_len + 1) * sizeof(char *);
+    if (vecbytes + strbytes > ARG_TOTAL_MAX)
+    {
+        kfree(uargs);
+        return -E2BIG;
+    }
 
+    char **kvec = kmalloc(vecbytes + strbytes);
     if (!kvec)
     {
+        kfree(uargs);
         return -ENOMEM;
     }
-    memset(kvec, 0, (uvec->av_len + 1) * sizeof(char *));
 
-    long ret = 0;
+    /* The strings are almost always packed together (the caller built the
+     * vector on its stack), so validate and copy the whole span with one
+     * bulk operation and carve the strings out in kernel space. If they
+     * are too scattered for staging to pay off, fall back to one
+     * copy_from_user per string. */
+    char *staging = NULL;
+    if (uvec->av_len && (size_t)(hi - lo) <= strbytes + ARG_STAGE_SLACK)
+    {
+        staging = kmalloc(hi - lo);
+        if (staging && copy_from_user(staging, lo, hi - lo))
+        {
+            kfree(staging);
+            staging = NULL;
+        }
+    }
+
+    char *dst = (char *)(kvec + uvec->av_len + 1);
     for (size_t i = 0; i < uvec->av_len && !ret; i++)
     {
-        argstr_t argstr;
-        copy_from_user(&argstr, uvec->av_vec + i, sizeof(argstr_t));
-        ret = user_strdup(&argstr, kvec + i);
+        kvec[i] = dst;
+        if (staging)
+        {
+            memcpy(dst, staging + (uargs[i].as_str - lo), uargs[i].as_len);
+        }
+        else
+        {
+            ret = copy_from_user(dst, uargs[i].as_str, uargs[i].as_len);
+        }
+        dst[uargs[i].as_len] = '\0';
+        dst += uargs[i].as_len + 1;
     }
+    kvec[uvec->av_len] = NULL;
+
+    if (staging)
+    {
+        kfree(staging);
+    }
+    kfree(uargs);
 
     if (ret)
     {
-        for (size_t i = 0; i < uvec->av_len; i++)
-            if (kvec[i])
-                kfree(kvec[i]);
         kfree(kvec);
-        *kvecp = NULL;
+        return ret;
     }
-
-    return ret;
+    *kvecp = kvec;
+    return 0;
 }
 
 /*
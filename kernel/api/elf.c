@@ -27,6 +27,8 @@
 #include "mm/kmalloc.h"
 #include "mm/mm.h"
 #include "mm/mman.h"
+#include "mm/mobj.h"
+#include "mm/pframe.h"
 #include "mm/tlb.h"
 
 #include "api/binfmt.h"
@@ -40,6 +42,8 @@
 #include "fs/lseek.h"
 #include "fs/vfs_syscall.h"
 
+#include "vm/timepage.h"
+
 static long _elf64_platform_check(const Elf64_Ehdr *header)
 {
     return (EM_X86_64 == header->e_machine)              // machine
@@ -448,21 +452,64 @@ static size_t _elf64_calc_argsize(char *const argv[], char *const envp[],
     return size;
 }
 
-/* Copies the arguments that must be on the stack prior to execution onto the
- * user stack. This should never fail.
- * arglow:   low address on the user stack where we should start the copying
- * argsize:  total size of everything to go on the stack
- * buf:      a kernel buffer at least as big as argsize (for convenience)
+/* Cursor for writing the initial stack image straight into the pframes
+ * backing the new stack, one frame at a time. arglow is page-aligned
+ * (see _elf64_load), so the image starts on a frame boundary and each
+ * frame is filled front to back exactly once. */
+typedef struct argframe
+{
+    mobj_t *af_obj;    /* the stack vmarea's backing object (locked) */
+    size_t af_pagenum; /* object page number of the next frame to fill */
+    pframe_t *af_pf;   /* frame currently being filled, or NULL */
+    char *af_pos;      /* next byte to write within af_pf */
+    size_t af_left;    /* bytes remaining in af_pf */
+} argframe_t;
+
+/* Appends len bytes from the kernel buffer src to the stack image,
+ * crossing into the next frame as needed. The frames are fresh anonymous
+ * pages of an address space nothing else can see yet, so this should
+ * never fail. */
+static void _argframe_emit(argframe_t *af, const void *src, size_t len)
+{
+    while (len)
+    {
+        if (!af->af_left)
+        {
+            if (af->af_pf)
+            {
+                pframe_release(&af->af_pf);
+            }
+            long ret =
+                mobj_get_pframe(af->af_obj, af->af_pagenum++, 1, &af->af_pf);
+            KASSERT(!ret && af->af_pf);
+            af->af_pf->pf_dirty = 1;
+            af->af_pos = (char *)af->af_pf->pf_addr;
+            af->af_left = PAGE_SIZE;
+        }
+        size_t n = MIN(len, af->af_left);
+        memcpy(af->af_pos, src, n);
+        af->af_pos += n;
+        af->af_left -= n;
+        src = (const char *)src + n;
+        len -= n;
+    }
+}
+
+/* Builds the arguments that must be on the stack prior to execution
+ * directly in the frames of the new stack: the image is laid out exactly
+ * once, with no intermediate kernel staging buffer and no second copy
+ * through vmmap_write. This should never fail.
+ * arglow:   low (page-aligned) address on the user stack of the image
  * argv, envp, auxv: various vectors of stuff (to go on the stack)
  * argc, envc, auxc: number of non-NULL entries in argv, envp, auxv,
  *                   respectively (to avoid recomputing them)
  * phtsize: the size of the program header table (to avoid recomputing)
  * c.f. Intel i386 ELF supplement pp 54-59 and AMD64 ABI Draft 0.99.6 page 29
  */
-static void _elf64_load_args(vmmap_t *map, void *arglow, size_t argsize,
-                             char *buf, char *const argv[], char *const envp[],
-                             Elf64_auxv_t *auxv, size_t argc, size_t envc,
-                             size_t auxc, size_t phtsize)
+static void _elf64_load_args(vmmap_t *map, void *arglow, char *const argv[],
+                             char *const envp[], Elf64_auxv_t *auxv,
+                             size_t argc, size_t envc, size_t auxc,
+                             size_t phtsize)
 {
     dbg(DBG_ELF,
         "Loading initial stack contents at 0x%p, argc = %lu, envc = %lu, auxc "
@@ -471,28 +518,36 @@ static void _elf64_load_args(vmmap_t *map, void *arglow, size_t argsize,
 
     size_t i;
 
-    /* Copy argc: in x86-64, this is an eight-byte value, despite being treated
-     * as an int in a C main() function. See AMD64 ABI Draft 0.99.6 page 29 */
-    *((int64_t *)buf) = (int64_t)argc;
+    KASSERT(PAGE_ALIGNED(arglow));
+    vmarea_t *vma = vmmap_lookup(map, ADDR_TO_PN(arglow));
+    /* If this is missing, we must have set up the address space wrong... */
+    KASSERT(vma);
+
+    argframe_t af;
+    af.af_obj = vma->vma_obj;
+    af.af_pagenum = ADDR_TO_PN(arglow) - vma->vma_start + vma->vma_off;
+    af.af_pf = NULL;
+    af.af_pos = NULL;
+    af.af_left = 0;
 
     /* Calculate where the strings / tables pointed to by the vectors start */
     size_t veclen = (argc + 1 + envc + 1) * sizeof(char *) +
                     (auxc + 1) * sizeof(Elf64_auxv_t);
 
-    char *vecstart =
-        buf + sizeof(int64_t) +
-        3 * sizeof(void *); /* Beginning of argv (in kernel buffer) */
-
     char *vvecstart =
         ((char *)arglow) + sizeof(int64_t) +
         3 * sizeof(void *); /* Beginning of argv (in user space) */
 
-    char *strstart = vecstart + veclen; /* Beginning of first string pointed to
-                                           by argv (in kernel buffer) */
-
     /* Beginning of first string pointed to by argv (in user space) */
     char *vstrstart = vvecstart + veclen;
 
+    mobj_lock(af.af_obj);
+
+    /* Copy argc: in x86-64, this is an eight-byte value, despite being treated
+     * as an int in a C main() function. See AMD64 ABI Draft 0.99.6 page 29 */
+    int64_t argc64 = (int64_t)argc;
+    _argframe_emit(&af, &argc64, sizeof(argc64));
+
     /*
      * cjm5: since the first 6 arguments that can fit in registers are placed
      * there in x86-64, __libc_static_entry (and ld-weenix, if it is ever ported
@@ -500,66 +555,73 @@ static void _elf64_load_args(vmmap_t *map, void *arglow, size_t argsize,
      * them and argc into the first 4 argument registers before calling main().
      */
 
-    /* Copy over pointer to argv */
-    *(char **)(buf + 8) = vvecstart;
-    /* Copy over pointer to envp */
-    *(char **)(buf + 16) = vvecstart + (argc + 1) * sizeof(char *);
-    /* Copy over pointer to auxv */
-    *(char **)(buf + 24) = vvecstart + (argc + 1 + envc + 1) * sizeof(char *);
+    /* Pointers to argv, envp, and auxv */
+    char *vptr = vvecstart;
+    _argframe_emit(&af, &vptr, sizeof(vptr));
+    vptr = vvecstart + (argc + 1) * sizeof(char *);
+    _argframe_emit(&af, &vptr, sizeof(vptr));
+    vptr = vvecstart + (argc + 1 + envc + 1) * sizeof(char *);
+    _argframe_emit(&af, &vptr, sizeof(vptr));
 
-    /* Copy over argv along with every string in it */
+    /* Emit argv, walking the user addresses the strings will land at */
+    char *vstr = vstrstart;
     for (i = 0; i < argc; i++)
     {
-        size_t len = strlen(argv[i]) + 1;
-        strcpy(strstart, argv[i]);
-        /* Remember that we need to use the virtual address of the string */
-        *(char **)vecstart = vstrstart;
-        strstart += len;
-        vstrstart += len;
-        vecstart += sizeof(char *);
+        _argframe_emit(&af, &vstr, sizeof(vstr));
+        vstr += strlen(argv[i]) + 1;
     }
     /* null terminator of argv */
-    *(char **)vecstart = NULL;
-    vecstart += sizeof(char *);
+    vptr = NULL;
+    _argframe_emit(&af, &vptr, sizeof(vptr));
 
-    /* Copy over envp along with every string in it */
+    /* Emit envp the same way */
     for (i = 0; i < envc; i++)
     {
-        size_t len = strlen(envp[i]) + 1;
-        strcpy(strstart, envp[i]);
-        /* Remember that we need to use the virtual address of the string */
-        *(char **)vecstart = vstrstart;
-        strstart += len;
-        vstrstart += len;
-        vecstart += sizeof(char *);
+        _argframe_emit(&af, &vstr, sizeof(vstr));
+        vstr += strlen(envp[i]) + 1;
     }
     /* null terminator of envp */
-    *(char **)vecstart = NULL;
-    vecstart += sizeof(char *);
+    _argframe_emit(&af, &vptr, sizeof(vptr));
 
-    /* Copy over auxv along with the program header (if we find it) */
+    /* Emit auxv; the program header table goes after the strings */
     for (i = 0; i < auxc; i++)
     {
-        /* Copy over the auxv entry */
-        memcpy(vecstart, &auxv[i], sizeof(Elf64_auxv_t));
-        /* Check if it points to the program header */
-        if (auxv[i].a_type == AT_PHDR)
+        Elf64_auxv_t ent = auxv[i];
+        if (ent.a_type == AT_PHDR)
         {
-            /* Copy over the program header table */
-            memcpy(strstart, auxv[i].a_un.a_ptr, (size_t)phtsize);
-            /* And modify the address */
-            ((Elf64_auxv_t *)vecstart)->a_un.a_ptr = vstrstart;
+            ent.a_un.a_ptr = vstr;
         }
-        vecstart += sizeof(Elf64_auxv_t);
+        _argframe_emit(&af, &ent, sizeof(ent));
     }
     /* null terminator of auxv */
-    ((Elf64_auxv_t *)vecstart)->a_type = NULL;
+    Elf64_auxv_t nullent;
+    memset(&nullent, 0, sizeof(nullent));
+    nullent.a_type = AT_NULL;
+    _argframe_emit(&af, &nullent, sizeof(nullent));
 
-    /* Finally, we're done copying into the kernel buffer. Now just copy the
-     * kernel buffer into user space */
-    long ret = vmmap_write(map, arglow, buf, argsize);
-    /* If this failed, we must have set up the address space wrong... */
-    KASSERT(!ret);
+    /* Now the strings themselves, in the order the vectors named them */
+    for (i = 0; i < argc; i++)
+    {
+        _argframe_emit(&af, argv[i], strlen(argv[i]) + 1);
+    }
+    for (i = 0; i < envc; i++)
+    {
+        _argframe_emit(&af, envp[i], strlen(envp[i]) + 1);
+    }
+    /* And finally the program header table (if auxv points to it) */
+    for (i = 0; i < auxc; i++)
+    {
+        if (auxv[i].a_type == AT_PHDR)
+        {
+            _argframe_emit(&af, auxv[i].a_un.a_ptr, phtsize);
+        }
+    }
+
+    if (af.af_pf)
+    {
+        pframe_release(&af.af_pf);
+    }
+    mobj_unlock(af.af_obj);
 }
 
 static long _elf64_load(const char *filename, int fd, char *const argv[],
@@ -578,7 +640,6 @@ static long _elf64_load(const char *filename, int fd, char *const argv[],
     file_t *interpfile = NULL;
     char *interppht = NULL;
     Elf64_auxv_t *auxv = NULL;
-    char *argbuf = NULL;
 
     uintptr_t entry;
 
@@ -784,6 +845,15 @@ static long _elf64_load(const char *filename, int fd, char *const argv[],
         auxv->a_type = AT_NULL;
     }
 
+    /* Map the shared time page at its fixed address before placing the
+     * stack, so userland can read the time without a syscall (see
+     * vm/timepage.c). */
+    ret = timepage_map(map);
+    if (ret)
+    {
+        goto done;
+    }
+
     /* Allocate stack at the top of the address space */
     uint64_t stack_lopage = (uint64_t)vmmap_find_range(
         map, (DEFAULT_STACK_SIZE / PAGE_SIZE) + 1, VMMAP_DIR_HILO);
@@ -809,25 +879,19 @@ static long _elf64_load(const char *filename, int fd, char *const argv[],
         ret = -E2BIG;
         goto done;
     }
-    /* Allocate kernel buffer for temporarily storing arguments */
-    argbuf = (char *)kmalloc(argsize);
-    if (!argbuf)
-    {
-        ret = -ENOMEM;
-        goto done;
-    }
     /* Calculate where in user space we start putting the args. */
-    // the args go at the beginning (top) of the stack
-    void *arglow =
+    // the args go at the beginning (top) of the stack; align the image
+    // down to a page boundary so it starts exactly on a frame boundary
+    // (the few bytes of padding above it are just unused stack)
+    void *arglow = PAGE_ALIGN_DOWN(
         (char *)PN_TO_ADDR(stack_lopage) +
         (uint64_t)(
             ((uint64_t)PN_TO_ADDR((DEFAULT_STACK_SIZE / PAGE_SIZE) + 1)) -
-            argsize);
+            argsize));
 
-    /* Copy everything into the user address space, modifying addresses in
-     * argv, envp, and auxv to be user addresses as we go. */
-    _elf64_load_args(map, arglow, argsize, argbuf, argv, envp, auxv, argc, envc,
-                     auxc, phtsize);
+    /* Build everything directly in the stack's frames, modifying addresses
+     * in argv, envp, and auxv to be user addresses as we go. */
+    _elf64_load_args(map, arglow, argv, envp, auxv, argc, envc, auxc, phtsize);
 
     dbg(DBG_ELF,
         "Past the point of no return. Swapping to map at 0x%p, setting brk to "
@@ -837,7 +901,17 @@ static long _elf64_load(const char *filename, int fd, char *const argv[],
      * the point of no return ... */
 
     /* Give the process the new mappings. */
-    vmmap_destroy(&curproc->p_vmmap);
+    if (curproc->p_vforked)
+    {
+        /* The old address space was borrowed from a vfork parent: switch
+         * onto our own page tables, hand it back and wake the parent
+         * rather than destroying it. */
+        proc_vfork_done();
+    }
+    else
+    {
+        vmmap_destroy(&curproc->p_vmmap);
+    }
     map->vmm_proc = curproc;
     curproc->p_vmmap = map;
     map = NULL; /* So it doesn't get cleaned up at the end */
@@ -853,6 +927,10 @@ static long _elf64_load(const char *filename, int fd, char *const argv[],
 
     strncpy(curproc->p_name, filename, PROC_NAME_LEN);
 
+    /* Count the exec so frequently-run binaries get pinned in the vnode
+     * cache (keeping their text pframes warm for the next exec). */
+    vnode_record_exec(file->f_vnode);
+
     /* Tell the caller the correct stack pointer and instruction
      * pointer to begin execution in user space */
     *rip = (uint64_t)entry;
@@ -895,10 +973,6 @@ done:
     {
         kfree(auxv);
     }
-    if (argbuf)
-    {
-        kfree(argbuf);
-    }
     return ret;
 }
 
@@ -1,8 +1,19 @@
+#include "errno.h"
+#include "globals.h"
+
 #include "util/debug.h"
 #include <util/string.h>
 
 #include "main/gdt.h"
 
+#include "mm/kmalloc.h"
+
+#include "proc/sched.h"
+
+#include "fs/fcntl.h"
+#include "fs/file.h"
+#include "fs/vfs_syscall.h"
+
 #include "api/binfmt.h"
 #include "api/exec.h"
 #include "api/syscall.h"
@@ -19,6 +30,10 @@ void userland_entry(const regs_t regs)
 
     dbg(DBG_ELF, ">>>>>>>>>>>>>>> pid: %d\n", curproc->p_pid);
 
+    /* Everything from here on is billed as user time (see
+     * sched_acct_mark). */
+    sched_acct_mark(1);
+
     intr_disable();
     dbg(DBG_ELF, ">>>>>>>>>>>>>>>> intr_disable()\n");
     intr_setipl(IPL_LOW);
@@ -62,6 +77,9 @@ long do_execve(const char *filename, char *const *argv, char *const *envp,
     {
         return ret;
     }
+    /* The load succeeded, so descriptors marked FD_CLOEXEC go away now
+     * (a failed exec leaves them open, per POSIX). */
+    fdtable_close_exec();
     /* Make sure we "return" into the start of the newly loaded binary */
     dbg(DBG_EXEC, "Executing binary with rip 0x%p, rsp 0x%p\n", (void *)rip,
         (void *)rsp);
@@ -107,4 +125,115 @@ void kernel_execve(const char *filename, char *const *argv, char *const *envp)
 
     regs.r_rflags = 0x202; // see 32-bit version
     userland_entry(regs);
+}
+
+/* The already-kernel-staged arguments of a spawn, handed from the parent
+ * to the child's first thread, which frees them once the loader has laid
+ * them out on the new user stack. */
+typedef struct spawn_kargs
+{
+    char *sk_filename;
+    char **sk_argv;
+    char **sk_envp;
+} spawn_kargs_t;
+
+/* First thread of a spawned process: loads the binary into the (empty)
+ * address space and enters userland, exactly as kernel_execve does for
+ * the init process. */
+static void *spawn_child_run(long arg1, void *arg2)
+{
+    spawn_kargs_t *ka = arg2;
+    char *const empty[] = {NULL};
+
+    uint64_t rip, rsp;
+    long ret = binfmt_load(ka->sk_filename,
+                           ka->sk_argv ? ka->sk_argv : empty,
+                           ka->sk_envp ? ka->sk_envp : empty, &rip, &rsp);
+
+    kfree(ka->sk_filename);
+    if (ka->sk_argv)
+    {
+        kfree(ka->sk_argv);
+    }
+    if (ka->sk_envp)
+    {
+        kfree(ka->sk_envp);
+    }
+    kfree(ka);
+
+    if (ret)
+    {
+        /* The parent already got our pid back; all we can do with a load
+         * failure now is make it the exit status for waitpid to find. */
+        dbg(DBG_EXEC, "spawn: load failed with %ld\n", ret);
+        do_exit(ret);
+    }
+
+    /* A spawned child counts as having exec'd: shed the descriptors the
+     * parent marked close-on-exec before entering userland. */
+    fdtable_close_exec();
+
+    dbg(DBG_EXEC, "Entering userland with rip 0x%p, rsp 0x%p\n", (void *)rip,
+        (void *)rsp);
+    regs_t regs;
+    memset(&regs, 0, sizeof(regs_t));
+    regs.r_cs = GDT_USER_TEXT | 0x3;
+    regs.r_ss = GDT_USER_DATA | 0x3;
+    regs.r_rip = rip;
+    regs.r_rsp = rsp;
+    regs.r_rflags = 0x202;
+    userland_entry(regs);
+    return NULL;
+}
+
+/*
+ * spawn(2): creates a new process running filename, as fork + execve
+ * would, without ever cloning or borrowing the parent's address space.
+ * filename, argv, and envp have already been staged into kernel memory
+ * (see user_vecdup); on success ownership of all three passes to the
+ * child, whose loader writes the staged vectors straight into the frames
+ * of the new user stack (see _elf64_load_args in elf.c) - so the
+ * arguments are copied exactly once on each side of the user/kernel
+ * boundary. On failure nothing is consumed and the caller cleans up.
+ *
+ * Returns the child's pid, or a negative errno. Load failures after the
+ * binary has been opened successfully here (e.g. a corrupt ELF header)
+ * are reported through the child's exit status instead.
+ */
+long do_spawn(char *filename, char **argv, char **envp)
+{
+    /* Catch the common failure - a missing or unopenable binary - while
+     * there is still a caller to return it to. */
+    long fd = do_open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return fd;
+    }
+    do_close((int)fd);
+
+    spawn_kargs_t *ka = kmalloc(sizeof(spawn_kargs_t));
+    if (!ka)
+    {
+        return -ENOMEM;
+    }
+    ka->sk_filename = filename;
+    ka->sk_argv = argv;
+    ka->sk_envp = envp;
+
+    /* The loader renames the process once the binary is in. */
+    proc_t *proc = proc_create_spawn(curproc->p_name);
+    if (!proc)
+    {
+        kfree(ka);
+        return -ENOMEM;
+    }
+    kthread_t *thr = kthread_create(proc, spawn_child_run, 0, ka);
+    if (!thr)
+    {
+        proc_destroy(proc);
+        kfree(ka);
+        return -ENOMEM;
+    }
+    sched_make_runnable(thr);
+    return proc->p_pid;
 }
\ No newline at end of file
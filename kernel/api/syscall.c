@@ -4,12 +4,17 @@
 #include <fs/vfs.h>
 #include <util/time.h>
 
+#include "main/apic.h"
 #include "main/inits.h"
 #include "main/interrupt.h"
 
+#include "util/printf.h"
+
 #include "mm/kmalloc.h"
 #include "mm/mman.h"
+#include "mm/page.h"
 
+#include "fs/aio.h"
 #include "fs/vfs_syscall.h"
 #include "fs/vnode.h"
 
@@ -18,6 +23,10 @@
 
 #include "vm/brk.h"
 #include "vm/mmap.h"
+#include "vm/shm.h"
+
+#include "proc/futex.h"
+#include "proc/sched.h"
 
 #include "api/access.h"
 #include "api/exec.h"
@@ -28,9 +37,11 @@ static long syscall_handler(regs_t *regs);
 
 static long syscall_dispatch(size_t sysnum, uintptr_t args, regs_t *regs);
 
+static long syscall_route(size_t sysnum, uintptr_t args, regs_t *regs);
+
 extern size_t active_tty;
 
-static const char *syscall_strings[49] = {
+static const char *syscall_strings[73] = {
     "syscall", "exit", "fork", "read", "write", "open",
     "close", "waitpid", "link", "unlink", "execve", "chdir",
     "sleep", "unknown", "lseek", "sync", "nuke", "dup",
@@ -38,10 +49,104 @@ static const char *syscall_strings[49] = {
     "mmap", "mprotect", "munmap", "rename", "uname", "thr_create",
     "thr_cancel", "thr_exit", "thr_yield", "thr_join", "gettid", "getpid",
     "unknown", "unkown", "unknown", "errno", "halt", "get_free_mem",
-    "set_errno", "dup2", "brk", "mount", "umount", "stat", "usleep"};
+    "set_errno", "dup2", "brk", "mount", "umount", "stat",
+    "time", "usleep", "readv", "writev", "pread", "pwrite",
+    "fsync", "fdatasync", "sendfile", "fadvise", "vfork", "batch",
+    "shmget", "shmat", "shmrm", "futex", "poll", "mlock",
+    "munlock", "symlink", "getrusage", "aio_setup", "aio_submit",
+    "aio_wait", "spawn"};
 
 void syscall_init(void) { intr_register(INTR_SYSCALL, syscall_handler); }
 
+/*
+ * Syscall dispatch instrumentation: for every syscall number, each core
+ * keeps a call count and a log2-bucket histogram, in TSC cycles, of the
+ * time spent inside syscall_dispatch(). Batch sub-calls dispatch through
+ * the same path, so they are counted individually. One rdtsc pair and a
+ * bucket increment per call keeps this cheap enough to stay enabled;
+ * exported through the stats devices (see syscall_stats_info).
+ *
+ * The tables are plain arrays indexed by core id rather than CSD - they
+ * are far too large to share the CSD page - and each core only ever
+ * writes its own row, so there is no cross-core contention to speak of.
+ */
+#define SYSCALL_STAT_OTHER (SYS_spawn + 1)
+#define SYSCALL_STAT_SLOTS (SYS_spawn + 2)
+#define SYSCALL_LAT_BUCKETS 32
+
+static uint64_t syscall_counts[MAX_LAPICS][SYSCALL_STAT_SLOTS];
+static uint64_t syscall_lat_hist[MAX_LAPICS][SYSCALL_STAT_SLOTS]
+                                [SYSCALL_LAT_BUCKETS];
+
+static inline uint64_t syscall_tsc()
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Out-of-range numbers (SYS_debug, SYS_kshell, garbage) share one slot. */
+static void syscall_stat_record(size_t sysnum, uint64_t cycles)
+{
+    size_t slot = sysnum <= SYS_spawn ? sysnum : SYSCALL_STAT_OTHER;
+    long bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    if (bucket >= SYSCALL_LAT_BUCKETS)
+    {
+        bucket = SYSCALL_LAT_BUCKETS - 1;
+    }
+    syscall_counts[curcore.kc_id][slot]++;
+    syscall_lat_hist[curcore.kc_id][slot][bucket]++;
+}
+
+/*
+ * Formats the per-core syscall tables: one "C<core> <num> <name> <count>"
+ * line per (core, syscall) pair with a nonzero count, followed on the
+ * same line by one "bucket:count" pair per nonzero latency bucket
+ * (bucket b covers [2^b, 2^(b+1)) TSC cycles in syscall_dispatch).
+ */
+size_t syscall_stats_info(char *buf, size_t size)
+{
+    size_t off = 0;
+    for (long core = 0; core <= apic_max_id(); core++)
+    {
+        for (size_t s = 0; s < SYSCALL_STAT_SLOTS; s++)
+        {
+            if (!syscall_counts[core][s])
+            {
+                continue;
+            }
+            /*
+             * snprintf returns the would-be length, so off can pass size
+             * once the tables outgrow the buffer. Truncate before
+             * buf + off walks past the allocation and size - off
+             * underflows.
+             */
+            if (off >= size)
+            {
+                return size;
+            }
+            const char *name =
+                s == SYSCALL_STAT_OTHER ? "other" : syscall_strings[s];
+            off += snprintf(buf + off, size - off, "C%ld %lu %s %lu", core,
+                            s, name, syscall_counts[core][s]);
+            for (long b = 0; b < SYSCALL_LAT_BUCKETS && off < size; b++)
+            {
+                if (syscall_lat_hist[core][s][b])
+                {
+                    off += snprintf(buf + off, size - off, " %ld:%lu", b,
+                                    syscall_lat_hist[core][s][b]);
+                }
+            }
+            if (off >= size)
+            {
+                return size;
+            }
+            off += snprintf(buf + off, size - off, "\n");
+        }
+    }
+    return off;
+}
+
 // if condition, set errno to err and return -1
 #define ERROR_OUT(condition, err) \
     if (condition)                \
@@ -125,13 +230,225 @@ static long sys_write(write_args_t *args)
 }
 
 /*
- * This similar to the other system calls that you have implemented above. 
- * 
- * The general steps are as follows: 
- *  - Copy the arguments from user memory 
+ * Vectored read. The segments of the user's iovec are backed by one
+ * contiguous kernel buffer, so the vnode layer is entered (and the vnode
+ * locked) exactly once per syscall; the data is then scattered back out
+ * with one copy_to_user per segment.
+ */
+static long sys_readv(readv_args_t *args)
+{
+    readv_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+    ERROR_OUT(!kargs.iovcnt || kargs.iovcnt > IOV_MAX, EINVAL);
+
+    iovec_t uiov[IOV_MAX];
+    ret = copy_from_user(uiov, kargs.iov, kargs.iovcnt * sizeof(iovec_t));
+    ERROR_OUT_RET(ret);
+
+    size_t total = 0;
+    for (size_t i = 0; i < kargs.iovcnt; i++) {
+        total += uiov[i].iov_len;
+    }
+    size_t npages = 1;
+    while (npages * PAGE_SIZE < total) {
+        npages += 1;
+    }
+    char* buffer = page_alloc_n(npages);
+    if (!buffer) {
+        ret = -ENOMEM;
+        ERROR_OUT_RET(ret);
+    }
+
+    iovec_t kiov[IOV_MAX];
+    size_t offset = 0;
+    for (size_t i = 0; i < kargs.iovcnt; i++) {
+        kiov[i].iov_base = buffer + offset;
+        kiov[i].iov_len = uiov[i].iov_len;
+        offset += uiov[i].iov_len;
+    }
+
+    ret = do_readv(kargs.fd, kiov, kargs.iovcnt);
+    ssize_t bytes_read = ret;
+    if (ret < 0) {
+        page_free_n(buffer, npages);
+        ERROR_OUT_RET(ret);
+    }
+
+    offset = 0;
+    for (size_t i = 0; i < kargs.iovcnt && offset < (size_t)bytes_read; i++) {
+        size_t chunk = MIN(uiov[i].iov_len, (size_t)bytes_read - offset);
+        ret = copy_to_user(uiov[i].iov_base, buffer + offset, chunk);
+        if (ret < 0) {
+            page_free_n(buffer, npages);
+            ERROR_OUT_RET(ret);
+        }
+        offset += chunk;
+    }
+    page_free_n(buffer, npages);
+    return bytes_read;
+}
+
+/*
+ * Vectored write. The segments of the user's iovec are gathered into one
+ * contiguous kernel buffer (one copy_from_user per segment), and the vnode
+ * layer is entered (and the vnode locked) exactly once per syscall.
+ */
+static long sys_writev(writev_args_t *args)
+{
+    writev_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+    ERROR_OUT(!kargs.iovcnt || kargs.iovcnt > IOV_MAX, EINVAL);
+
+    iovec_t uiov[IOV_MAX];
+    ret = copy_from_user(uiov, kargs.iov, kargs.iovcnt * sizeof(iovec_t));
+    ERROR_OUT_RET(ret);
+
+    size_t total = 0;
+    for (size_t i = 0; i < kargs.iovcnt; i++) {
+        total += uiov[i].iov_len;
+    }
+    size_t npages = 1;
+    while (npages * PAGE_SIZE < total) {
+        npages += 1;
+    }
+    char* buffer = page_alloc_n(npages);
+    if (!buffer) {
+        ret = -ENOMEM;
+        ERROR_OUT_RET(ret);
+    }
+
+    iovec_t kiov[IOV_MAX];
+    size_t offset = 0;
+    for (size_t i = 0; i < kargs.iovcnt; i++) {
+        kiov[i].iov_base = buffer + offset;
+        kiov[i].iov_len = uiov[i].iov_len;
+        ret = copy_from_user(buffer + offset, uiov[i].iov_base, uiov[i].iov_len);
+        if (ret < 0) {
+            page_free_n(buffer, npages);
+            ERROR_OUT_RET(ret);
+        }
+        offset += uiov[i].iov_len;
+    }
+
+    ret = do_writev(kargs.fd, kiov, kargs.iovcnt);
+    ssize_t bytes_written = ret;
+    page_free_n(buffer, npages);
+    ERROR_OUT_RET(ret);
+    return bytes_written;
+}
+
+/*
+ * Positional read. Identical to sys_read except the offset comes from the
+ * arguments rather than the file's position, which is left untouched.
+ */
+static long sys_pread(pread_args_t *args)
+{
+    pread_args_t arguments;
+    long ret = copy_from_user(&arguments, args, sizeof(arguments));
+    ERROR_OUT_RET(ret);
+    size_t npages = 1;
+    while (npages * PAGE_SIZE < arguments.nbytes) {
+        npages += 1;
+    }
+    char* buffer = page_alloc_n(npages);
+    if (!buffer) {
+        ret = -ENOMEM;
+        ERROR_OUT_RET(ret);
+    }
+    ret = do_pread(arguments.fd, buffer, arguments.nbytes, arguments.offset);
+    ssize_t bytes_read = ret;
+    if (bytes_read == 0) {
+        page_free_n(buffer, npages);
+        return 0;
+    }
+    if (ret < 0) {
+        page_free_n(buffer, npages);
+        ERROR_OUT_RET(ret);
+    }
+    ret = copy_to_user(arguments.buf, buffer, (size_t)bytes_read);
+    page_free_n(buffer, npages);
+    ERROR_OUT_RET(ret);
+    return bytes_read;
+}
+
+/*
+ * Positional write. Identical to sys_write except the offset comes from the
+ * arguments rather than the file's position, which is left untouched.
+ */
+static long sys_pwrite(pwrite_args_t *args)
+{
+    pwrite_args_t arguments;
+    long ret = copy_from_user(&arguments, args, sizeof(arguments));
+    ERROR_OUT_RET(ret);
+    size_t npages = 1;
+    while (npages * PAGE_SIZE < arguments.nbytes) {
+        npages += 1;
+    }
+    char* buffer = page_alloc_n(npages);
+    if (!buffer) {
+        ret = -ENOMEM;
+        ERROR_OUT_RET(ret);
+    }
+    ret = copy_from_user(buffer, arguments.buf, arguments.nbytes);
+    if (ret < 0) {
+        page_free_n(buffer, npages);
+        ERROR_OUT_RET(ret);
+    }
+    ret = do_pwrite(arguments.fd, buffer, arguments.nbytes, arguments.offset);
+    ssize_t bytes_written = ret;
+    page_free_n(buffer, npages);
+    ERROR_OUT_RET(ret);
+    return bytes_written;
+}
+
+/*
+ * In-kernel file copy. There is no user buffer at all; the data never
+ * leaves the kernel, which is the point of the call.
+ */
+static long sys_sendfile(sendfile_args_t *args)
+{
+    sendfile_args_t arguments;
+    long ret = copy_from_user(&arguments, args, sizeof(arguments));
+    ERROR_OUT_RET(ret);
+    ret = do_sendfile(arguments.out_fd, arguments.in_fd, arguments.count);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_fadvise(fadvise_args_t *args)
+{
+    fadvise_args_t arguments;
+    long ret = copy_from_user(&arguments, args, sizeof(arguments));
+    ERROR_OUT_RET(ret);
+    ret = do_fadvise(arguments.fd, arguments.advice);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_fsync(int fd)
+{
+    long ret = do_fsync(fd);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_fdatasync(int fd)
+{
+    long ret = do_fdatasync(fd);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+/*
+ * This similar to the other system calls that you have implemented above.
+ *
+ * The general steps are as follows:
+ *  - Copy the arguments from user memory
  *  - Check that the count field is at least the size of a dirent_t
- *  - Use a while loop to read count / sizeof(dirent_t) directory entries into 
- *    the provided dirp and call do_getdent
+ *  - Read entries a page-sized batch at a time with do_getdents, copying
+ *    each batch out in one bulk copy_to_user
  *  - Return the number of bytes read
  */
 static long sys_getdents(getdents_args_t *args)
@@ -142,50 +459,60 @@ static long sys_getdents(getdents_args_t *args)
     if (arguments.count < sizeof(dirent_t)) {
         ERROR_OUT_RET(-EINVAL); // What error message here?
     }
-    size_t num_read = 0;
-    while(arguments.count > (num_read * sizeof(dirent_t))) {
-        dirent_t dirp;
-        ssize_t read = do_getdent(arguments.fd, &dirp);
-        ERROR_OUT_RET(read);
-        if (read != sizeof(dirent_t)) {
-            return num_read * sizeof(dirent_t);
+    dirent_t *buf = page_alloc();
+    if (!buf) {
+        ERROR_OUT_RET(-ENOMEM);
+    }
+    size_t total = 0;
+    while (total + sizeof(dirent_t) <= arguments.count) {
+        size_t chunk = MIN(arguments.count - total, PAGE_SIZE);
+        chunk -= chunk % sizeof(dirent_t);
+        ssize_t read = do_getdents(arguments.fd, buf, chunk);
+        if (read < 0) {
+            page_free(buf);
+            ERROR_OUT_RET(read);
+        }
+        if (read == 0) {
+            break;
+        }
+        ret = copy_to_user((char *)arguments.dirp + total, buf, read);
+        if (ret) {
+            page_free(buf);
+            ERROR_OUT_RET(ret);
+        }
+        total += read;
+        if ((size_t)read < chunk) {
+            break;
         }
-        ret = copy_to_user(arguments.dirp + num_read, &dirp, sizeof(dirent_t));
-        num_read += 1;
-        ERROR_OUT_RET(ret);
     }
-    return num_read * sizeof(dirent_t);
+    page_free(buf);
+    return total;
 }
 
 #ifdef __MOUNTING__
 static long sys_mount(mount_args_t *arg)
 {
-    mount_args_t kern_args;
-    char *source;
-    char *target;
-    char *type;
-    long ret;
+    mount_args_t kargs;
+    long ret = copy_from_user(&kargs, arg, sizeof(kargs));
+    ERROR_OUT_RET(ret);
 
-    if (copy_from_user(&kern_args, arg, sizeof(kern_args)) < 0)
-    {
-        curthr->kt_errno = EFAULT;
-        return -1;
-    }
+    char *source, *target, *type;
+    ret = user_strdup(&kargs.spec, &source);
+    ERROR_OUT_RET(ret);
 
-    /* null is okay only for the source */
-    source = user_strdup(&kern_args.spec);
-    if (NULL == (target = user_strdup(&kern_args.dir)))
+    ret = user_strdup(&kargs.dir, &target);
+    if (ret)
     {
         kfree(source);
-        curthr->kt_errno = EINVAL;
-        return -1;
+        ERROR_OUT_RET(ret);
     }
-    if (NULL == (type = user_strdup(&kern_args.fstype)))
+
+    ret = user_strdup(&kargs.fstype, &type);
+    if (ret)
     {
         kfree(source);
         kfree(target);
-        curthr->kt_errno = EINVAL;
-        return -1;
+        ERROR_OUT_RET(ret);
     }
 
     ret = do_mount(source, target, type);
@@ -206,19 +533,11 @@ static long sys_umount(argstr_t *input)
 {
     argstr_t kstr;
     char *target;
-    long ret;
-
-    if (copy_from_user(&kstr, input, sizeof(kstr)) < 0)
-    {
-        curthr->kt_errno = EFAULT;
-        return -1;
-    }
+    long ret = copy_from_user(&kstr, input, sizeof(kstr));
+    ERROR_OUT_RET(ret);
 
-    if (NULL == (target = user_strdup(&kstr)))
-    {
-        curthr->kt_errno = EINVAL;
-        return -1;
-    }
+    ret = user_strdup(&kstr, &target);
+    ERROR_OUT_RET(ret);
 
     ret = do_umount(target);
     kfree(target);
@@ -333,6 +652,31 @@ static long sys_link(link_args_t *args)
     return ret;
 }
 
+static long sys_symlink(symlink_args_t *args)
+{
+    symlink_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    char *target, *linkpath;
+    ret = user_strdup(&kargs.target, &target);
+    ERROR_OUT_RET(ret);
+
+    ret = user_strdup(&kargs.linkpath, &linkpath);
+    if (ret)
+    {
+        kfree(target);
+        ERROR_OUT_RET(ret);
+    }
+
+    ret = do_symlink(target, linkpath);
+    kfree(target);
+    kfree(linkpath);
+
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
 static long sys_rename(rename_args_t *args)
 {
     rename_args_t kargs;
@@ -404,6 +748,141 @@ static long sys_open(open_args_t *args)
     return ret;
 }
 
+static long sys_shmget(shmget_args_t *args)
+{
+    shmget_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    char *name;
+    ret = user_strdup(&kargs.name, &name);
+    ERROR_OUT_RET(ret);
+
+    ret = do_shmget(name, kargs.size);
+    kfree(name);
+
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_shmat(shmat_args_t *args)
+{
+    shmat_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    void *addr = NULL;
+    ret = do_shmat(kargs.id, kargs.addr, kargs.prot, &addr);
+    ERROR_OUT_RET(ret);
+    return (long)addr;
+}
+
+static long sys_shmrm(long id)
+{
+    long ret = do_shmrm(id);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_futex(futex_args_t *args)
+{
+    futex_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    switch (kargs.op)
+    {
+    case FUTEX_WAIT:
+        ret = futex_wait(kargs.addr, kargs.val);
+        break;
+    case FUTEX_WAKE:
+        ret = futex_wake(kargs.addr, kargs.val);
+        break;
+    case FUTEX_REQUEUE:
+        ret = futex_requeue(kargs.addr, kargs.val, kargs.addr2);
+        break;
+    default:
+        ret = -EINVAL;
+        break;
+    }
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_poll(poll_args_t *args)
+{
+    poll_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    if (kargs.nfds > POLL_MAX_NFDS) {
+        ret = -EINVAL;
+        ERROR_OUT_RET(ret);
+    }
+    size_t bytes = kargs.nfds * sizeof(struct pollfd);
+    struct pollfd *fds = NULL;
+    if (bytes) {
+        /* POLL_MAX_NFDS keeps the array within a single page */
+        fds = page_alloc();
+        if (!fds) {
+            ret = -ENOMEM;
+            ERROR_OUT_RET(ret);
+        }
+        ret = copy_from_user(fds, kargs.fds, bytes);
+        if (ret) {
+            page_free(fds);
+            ERROR_OUT_RET(ret);
+        }
+    }
+    ret = do_poll(fds, kargs.nfds, kargs.timeout);
+    if (ret >= 0 && bytes) {
+        long err = copy_to_user(kargs.fds, fds, bytes);
+        if (err) {
+            ret = err;
+        }
+    }
+    if (fds) {
+        page_free(fds);
+    }
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_aio_setup()
+{
+    void *addr = NULL;
+    long ret = do_aio_setup(&addr);
+    ERROR_OUT_RET(ret);
+    return (long)addr;
+}
+
+static long sys_aio_submit(aio_submit_args_t *args)
+{
+    aio_submit_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    if (!kargs.nr || kargs.nr > AIO_MAX_SUBMIT)
+    {
+        ret = -EINVAL;
+        ERROR_OUT_RET(ret);
+    }
+    aio_iocb_t iocbs[AIO_MAX_SUBMIT];
+    ret = copy_from_user(iocbs, kargs.iocbs, kargs.nr * sizeof(aio_iocb_t));
+    ERROR_OUT_RET(ret);
+
+    ret = do_aio_submit(iocbs, kargs.nr);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_aio_wait(long min)
+{
+    long ret = do_aio_wait(min);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
 static long sys_munmap(munmap_args_t *args)
 {
     munmap_args_t kargs;
@@ -416,6 +895,30 @@ static long sys_munmap(munmap_args_t *args)
     return ret;
 }
 
+static long sys_mlock(mlock_args_t *args)
+{
+    mlock_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    ret = do_mlock(kargs.addr, kargs.len);
+
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_munlock(mlock_args_t *args)
+{
+    mlock_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    ret = do_munlock(kargs.addr, kargs.len);
+
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
 static void *sys_mmap(mmap_args_t *arg)
 {
     mmap_args_t kargs;
@@ -544,13 +1047,28 @@ static long sys_fork(regs_t *regs)
     return ret;
 }
 
+static long sys_vfork(regs_t *regs)
+{
+    long ret = do_vfork(regs);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
+static long sys_thr_create(thr_create_args_t *args, regs_t *regs)
+{
+    thr_create_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    ret = do_thr_create(regs, kargs.tca_entry, kargs.tca_stack, kargs.tca_arg);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
 static void free_vector(char **vect)
 {
-    char **temp;
-    for (temp = vect; *temp; temp++)
-    {
-        kfree(*temp);
-    }
+    /* user_vecdup packs the strings into the same allocation as the
+     * pointer vector, so one kfree releases everything. */
     kfree(vect);
 }
 
@@ -587,6 +1105,44 @@ cleanup:
     return ret;
 }
 
+/* Takes the same argument block as execve, but on success the staged
+ * filename and vectors are handed off to the spawned child (which frees
+ * them once they are on its stack) instead of being freed here. */
+static long sys_spawn(execve_args_t *args)
+{
+    execve_args_t kargs;
+    char *filename = NULL;
+    char **argv = NULL;
+    char **envp = NULL;
+
+    long ret;
+    if ((ret = copy_from_user(&kargs, args, sizeof(kargs))))
+        goto cleanup;
+
+    if ((ret = user_strdup(&kargs.filename, &filename)))
+        goto cleanup;
+
+    if (kargs.argv.av_vec && (ret = user_vecdup(&kargs.argv, &argv)))
+        goto cleanup;
+
+    if (kargs.envp.av_vec && (ret = user_vecdup(&kargs.envp, &envp)))
+        goto cleanup;
+
+    ret = do_spawn(filename, argv, envp);
+    if (ret >= 0)
+        return ret;
+
+cleanup:
+    if (filename)
+        kfree(filename);
+    if (argv)
+        free_vector(argv);
+    if (envp)
+        free_vector(envp);
+    ERROR_OUT_RET(ret);
+    return ret;
+}
+
 static long sys_debug(argstr_t *args)
 {
     argstr_t kargs;
@@ -638,13 +1194,97 @@ static inline void check_curthr_cancelled()
     }
 }
 
+/*
+ * Executes up to BATCH_MAX_CALLS system calls in a single kernel
+ * crossing: the descriptor array is copied in once, each entry is
+ * dispatched exactly as if it had trapped on its own, and the per-call
+ * return values and errnos are written back in bulk with one
+ * copy_to_user. The whole array always runs, in order - callers inspect
+ * the per-entry results. Calls that transfer control (fork, execve,
+ * exit, ...) or nest another batch are refused individually with
+ * ENOTSUP.
+ */
+static long sys_batch(batch_args_t *args, regs_t *regs)
+{
+    batch_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+    ERROR_OUT(!kargs.ba_ncalls || kargs.ba_ncalls > BATCH_MAX_CALLS, EINVAL);
+
+    batch_call_t *calls = kmalloc(kargs.ba_ncalls * sizeof(batch_call_t));
+    ERROR_OUT(!calls, ENOMEM);
+    ret = copy_from_user(calls, kargs.ba_calls,
+                         kargs.ba_ncalls * sizeof(batch_call_t));
+    if (ret < 0)
+    {
+        kfree(calls);
+        ERROR_OUT_RET(ret);
+    }
+
+    long saved_errno = curthr->kt_errno;
+    for (size_t i = 0; i < kargs.ba_ncalls; i++)
+    {
+        batch_call_t *call = calls + i;
+        switch (call->bc_sysnum)
+        {
+        case SYS_batch:
+        case SYS_fork:
+        case SYS_vfork:
+        case SYS_execve:
+        case SYS_exit:
+        case SYS_thr_exit:
+        case SYS_halt:
+            call->bc_ret = -1;
+            call->bc_errno = ENOTSUP;
+            continue;
+        default:
+            break;
+        }
+        curthr->kt_errno = 0;
+        call->bc_ret = syscall_dispatch(call->bc_sysnum, call->bc_arg, regs);
+        call->bc_errno = curthr->kt_errno;
+        check_curthr_cancelled();
+    }
+    /* kt_errno reflects the last failing entry, or is untouched if every
+     * entry succeeded */
+    if (!curthr->kt_errno)
+    {
+        curthr->kt_errno = saved_errno;
+    }
+
+    ret = copy_to_user(kargs.ba_calls, calls,
+                       kargs.ba_ncalls * sizeof(batch_call_t));
+    kfree(calls);
+    ERROR_OUT_RET(ret);
+    return (long)kargs.ba_ncalls;
+}
+
+static long sys_getrusage(rusage_args_t *args)
+{
+    rusage_args_t kargs;
+    long ret = copy_from_user(&kargs, args, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+
+    ret = do_getrusage(kargs.ru_who, &kargs.ru_utime, &kargs.ru_stime);
+    ERROR_OUT_RET(ret);
+
+    ret = copy_to_user(args, &kargs, sizeof(kargs));
+    ERROR_OUT_RET(ret);
+    return 0;
+}
+
 static long syscall_handler(regs_t *regs)
 {
+    /* CPU-time accounting boundary: everything since the last boundary
+     * ran in userland, everything until the closing mark is system time
+     * (see sched_acct_mark). */
+    sched_acct_mark(0);
+
     size_t sysnum = (size_t)regs->r_rax;
     uintptr_t args = (uintptr_t)regs->r_rdx;
 
     const char *syscall_string;
-    if (sysnum <= 47)
+    if (sysnum <= SYS_spawn)
     {
         syscall_string = syscall_strings[sysnum];
     }
@@ -677,10 +1317,23 @@ static long syscall_handler(regs_t *regs)
             curproc->p_pid, sysnum, syscall_string, ret, ret);
 
     regs->r_rax = (uint64_t)ret;
+    sched_acct_mark(1);
     return 0;
 }
 
+/*
+ * Times each dispatch and records it against the syscall's number. Calls
+ * that never return (exit, thr_exit) simply go unrecorded.
+ */
 static long syscall_dispatch(size_t sysnum, uintptr_t args, regs_t *regs)
+{
+    uint64_t start = syscall_tsc();
+    long ret = syscall_route(sysnum, args, regs);
+    syscall_stat_record(sysnum, syscall_tsc() - start);
+    return ret;
+}
+
+static long syscall_route(size_t sysnum, uintptr_t args, regs_t *regs)
 {
     switch (sysnum)
     {
@@ -702,6 +1355,42 @@ static long syscall_dispatch(size_t sysnum, uintptr_t args, regs_t *regs)
     case SYS_fork:
         return sys_fork(regs);
 
+    case SYS_vfork:
+        return sys_vfork(regs);
+
+    case SYS_thr_create:
+        return sys_thr_create((thr_create_args_t *)args, regs);
+
+    case SYS_batch:
+        return sys_batch((batch_args_t *)args, regs);
+
+    case SYS_shmget:
+        return sys_shmget((shmget_args_t *)args);
+
+    case SYS_shmat:
+        return sys_shmat((shmat_args_t *)args);
+
+    case SYS_shmrm:
+        return sys_shmrm((long)args);
+
+    case SYS_futex:
+        return sys_futex((futex_args_t *)args);
+
+    case SYS_poll:
+        return sys_poll((poll_args_t *)args);
+
+    case SYS_aio_setup:
+        return sys_aio_setup();
+
+    case SYS_aio_submit:
+        return sys_aio_submit((aio_submit_args_t *)args);
+
+    case SYS_aio_wait:
+        return sys_aio_wait((long)args);
+
+    case SYS_spawn:
+        return sys_spawn((execve_args_t *)args);
+
     case SYS_getpid:
         return curproc->p_pid;
 
@@ -723,6 +1412,12 @@ static long syscall_dispatch(size_t sysnum, uintptr_t args, regs_t *regs)
     case SYS_munmap:
         return sys_munmap((munmap_args_t *)args);
 
+    case SYS_mlock:
+        return sys_mlock((mlock_args_t *)args);
+
+    case SYS_munlock:
+        return sys_munlock((mlock_args_t *)args);
+
     case SYS_open:
         return sys_open((open_args_t *)args);
 
@@ -735,6 +1430,30 @@ static long syscall_dispatch(size_t sysnum, uintptr_t args, regs_t *regs)
     case SYS_write:
         return sys_write((write_args_t *)args);
 
+    case SYS_readv:
+        return sys_readv((readv_args_t *)args);
+
+    case SYS_writev:
+        return sys_writev((writev_args_t *)args);
+
+    case SYS_pread:
+        return sys_pread((pread_args_t *)args);
+
+    case SYS_pwrite:
+        return sys_pwrite((pwrite_args_t *)args);
+
+    case SYS_fsync:
+        return sys_fsync((int)args);
+
+    case SYS_fdatasync:
+        return sys_fdatasync((int)args);
+
+    case SYS_sendfile:
+        return sys_sendfile((sendfile_args_t *)args);
+
+    case SYS_fadvise:
+        return sys_fadvise((fadvise_args_t *)args);
+
     case SYS_dup:
         return sys_dup((int)args);
 
@@ -753,6 +1472,12 @@ static long syscall_dispatch(size_t sysnum, uintptr_t args, regs_t *regs)
     case SYS_link:
         return sys_link((link_args_t *)args);
 
+    case SYS_symlink:
+        return sys_symlink((symlink_args_t *)args);
+
+    case SYS_getrusage:
+        return sys_getrusage((rusage_args_t *)args);
+
     case SYS_rename:
         return sys_rename((rename_args_t *)args);
 
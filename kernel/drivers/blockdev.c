@@ -1,3 +1,4 @@
+#include "errno.h"
 #include "kernel.h"
 #include "util/debug.h"
 #include <drivers/disk/sata.h>
@@ -6,10 +7,33 @@
 
 #include "mm/pframe.h"
 
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "util/time.h"
+
 static long blockdev_fill_pframe(mobj_t *mobj, pframe_t *pf);
 
 static long blockdev_flush_pframe(mobj_t *mobj, pframe_t *pf);
 
+static long blockdev_elevator_read(blockdev_t *bdev, char *buf, blocknum_t loc,
+                                   size_t count);
+
+static long blockdev_elevator_write(blockdev_t *bdev, const char *buf,
+                                    blocknum_t loc, size_t count);
+
+/*
+ * The ops installed on every registered device; read_vector/write_vector are
+ * left NULL so the blockdev_*_vector helpers decompose vectored callers into
+ * per-segment requests, which the elevator re-merges below.
+ */
+static blockdev_ops_t blockdev_elevator_ops = {
+    .read_block = blockdev_elevator_read,
+    .write_block = blockdev_elevator_write,
+};
+
 static mobj_ops_t blockdev_mobj_ops = {.get_pframe = NULL,
                                        .fill_pframe = blockdev_fill_pframe,
                                        .flush_pframe = blockdev_flush_pframe,
@@ -35,11 +59,86 @@ long blockdev_register(blockdev_t *dev)
     }
 
     mobj_init(&dev->bd_mobj, MOBJ_BLOCKDEV, &blockdev_mobj_ops);
+    /* The block cache lives forever and is never mapped into page tables,
+     * so the pageout daemon may reclaim its cold pages. */
+    dev->bd_mobj.mo_evictable = 1;
+    /* A block read is self-contained (the elevator and driver do their own
+     * locking), so fills may run with the cache's mutex dropped and reads
+     * of different blocks overlap instead of queueing behind one disk
+     * access; see mobj_materialize_pframe. */
+    dev->bd_mobj.mo_concurrent_fill = 1;
+
+    /* Interpose the elevator between callers and the driver: everything
+     * issued through bd_ops goes through the request queue (or straight
+     * through to bd_driver_ops until the dispatcher is started). */
+    dev->bd_driver_ops = dev->bd_ops;
+    dev->bd_ops = &blockdev_elevator_ops;
+    list_init(&dev->bd_elev_pending);
+    dev->bd_elev_pos = 0;
+    spinlock_init(&dev->bd_elev_lock);
+    sched_queue_init(&dev->bd_elev_waitq);
 
     list_insert_tail(&blockdevs, &dev->bd_link);
     return 0;
 }
 
+long blockdev_read_vector(blockdev_t *bdev, blockdev_iovec_t *iov,
+                          size_t iovcnt)
+{
+    if (bdev->bd_ops->read_vector)
+    {
+        return bdev->bd_ops->read_vector(bdev, iov, iovcnt);
+    }
+    for (size_t i = 0; i < iovcnt; i++)
+    {
+        long ret = bdev->bd_ops->read_block(bdev, iov[i].biov_buf,
+                                            iov[i].biov_block,
+                                            iov[i].biov_count);
+        if (ret)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+long blockdev_read_poll(blockdev_t *bdev, char *buf, blocknum_t block)
+{
+    /* Polling goes straight to the driver; queueing behind the elevator
+     * would defeat the point. */
+    blockdev_ops_t *driver =
+        bdev->bd_driver_ops ? bdev->bd_driver_ops : bdev->bd_ops;
+    if (driver->read_block_poll)
+    {
+        long ret = driver->read_block_poll(bdev, buf, block);
+        if (ret != -ENOTSUP && ret != -EBUSY)
+        {
+            return ret;
+        }
+    }
+    return bdev->bd_ops->read_block(bdev, buf, block, 1);
+}
+
+long blockdev_write_vector(blockdev_t *bdev, blockdev_iovec_t *iov,
+                           size_t iovcnt)
+{
+    if (bdev->bd_ops->write_vector)
+    {
+        return bdev->bd_ops->write_vector(bdev, iov, iovcnt);
+    }
+    for (size_t i = 0; i < iovcnt; i++)
+    {
+        long ret = bdev->bd_ops->write_block(bdev, iov[i].biov_buf,
+                                             iov[i].biov_block,
+                                             iov[i].biov_count);
+        if (ret)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
 blockdev_t *blockdev_lookup(devid_t id)
 {
     list_iterate(&blockdevs, bd, blockdev_t, bd_link)
@@ -52,6 +151,335 @@ blockdev_t *blockdev_lookup(devid_t id)
     return NULL;
 }
 
+/*
+ * Readahead worker: a small ring of (device, block) requests serviced by a
+ * dedicated kernel thread, which brings the requested blocks into the block
+ * cache via the normal mobj_get_pframe path. Enqueueing never blocks; the
+ * ring simply drops requests when full, since readahead is only a hint.
+ */
+#define BLOCKDEV_RA_RING_SIZE 64
+
+typedef struct blockdev_ra_request
+{
+    blockdev_t *ra_bdev;
+    blocknum_t ra_block;
+} blockdev_ra_request_t;
+
+static blockdev_ra_request_t blockdev_ra_ring[BLOCKDEV_RA_RING_SIZE];
+static size_t blockdev_ra_head = 0; /* next slot to service */
+static size_t blockdev_ra_count = 0;
+static spinlock_t blockdev_ra_lock = SPINLOCK_INITIALIZER(blockdev_ra_lock);
+static ktqueue_t blockdev_ra_queue;
+static long blockdev_ra_ready = 0;
+
+void blockdev_readahead(blockdev_t *bdev, blocknum_t block)
+{
+    if (!blockdev_ra_ready)
+    {
+        return;
+    }
+    spinlock_lock(&blockdev_ra_lock);
+    if (blockdev_ra_count == BLOCKDEV_RA_RING_SIZE)
+    {
+        spinlock_unlock(&blockdev_ra_lock);
+        return;
+    }
+    blockdev_ra_request_t *req =
+        &blockdev_ra_ring[(blockdev_ra_head + blockdev_ra_count) %
+                          BLOCKDEV_RA_RING_SIZE];
+    req->ra_bdev = bdev;
+    req->ra_block = block;
+    blockdev_ra_count++;
+    sched_broadcast_on(&blockdev_ra_queue);
+    spinlock_unlock(&blockdev_ra_lock);
+}
+
+static void *blockdev_readahead_run(long arg1, void *arg2)
+{
+    dbg(DBG_DISK, "blockdev readahead worker running\n");
+    for (;;)
+    {
+        spinlock_lock(&blockdev_ra_lock);
+        while (!blockdev_ra_count)
+        {
+            /* sched_sleep_on releases the lock; retake it to recheck */
+            sched_sleep_on(&blockdev_ra_queue, &blockdev_ra_lock);
+            spinlock_lock(&blockdev_ra_lock);
+        }
+        blockdev_ra_request_t req = blockdev_ra_ring[blockdev_ra_head];
+        blockdev_ra_head = (blockdev_ra_head + 1) % BLOCKDEV_RA_RING_SIZE;
+        blockdev_ra_count--;
+        spinlock_unlock(&blockdev_ra_lock);
+
+        /* Getting the pframe fills it from disk if it isn't already
+         * resident; a failure just means the block isn't cached. A
+         * block that was already resident isn't ours to mark - only a
+         * freshly materialized frame carries pf_readahead, so the first
+         * real lookup (or an eviction that beats one) reports whether
+         * the prefetch paid off. */
+        mobj_t *o = &req.ra_bdev->bd_mobj;
+        mobj_lock(o);
+        pframe_t *pf;
+        mobj_find_pframe(o, req.ra_block, &pf);
+        if (pf)
+        {
+            pframe_release(&pf);
+        }
+        else if (!mobj_get_pframe(o, req.ra_block, 0, &pf))
+        {
+            pf->pf_readahead = 1;
+            pframe_release(&pf);
+        }
+        mobj_unlock(o);
+    }
+    return NULL;
+}
+
+void blockdev_readahead_start()
+{
+    sched_queue_init(&blockdev_ra_queue);
+
+    proc_t *proc = proc_create("blockdev_ra");
+    KASSERT(proc && "couldn't create the readahead worker");
+    kthread_t *thr = kthread_create(proc, blockdev_readahead_run, 0, NULL);
+    KASSERT(thr && "couldn't create the readahead worker's thread");
+
+    /* A larger share than the writeback daemon's: stalled readahead
+     * turns future cache hits into misses (see sched_set_deadline). */
+    sched_set_deadline(thr, 8, 64);
+
+    blockdev_ra_ready = 1;
+    sched_make_runnable(thr);
+}
+
+/*
+ * Deadline elevator: a per-device request queue between the block cache and
+ * the driver. Once write-behind and readahead are running, the driver would
+ * otherwise see an arbitrary interleave of block numbers; instead, each
+ * caller parks its request on a queue kept sorted by block number and a
+ * per-device dispatcher thread services the queue with a C-SCAN sweep,
+ * merging runs of contiguous same-direction requests into a single vectored
+ * driver command. Each request also carries a deadline -- much tighter for
+ * reads, which a pure elevator would starve behind streaming writes -- and
+ * once the oldest deadline expires the sweep restarts at that request.
+ */
+#define BLOCKDEV_ELEV_BATCH 16           /* max requests merged per dispatch */
+#define BLOCKDEV_ELEV_READ_DEADLINE 50   /* ticks until a read jumps the sweep */
+#define BLOCKDEV_ELEV_WRITE_DEADLINE 500 /* same, for writes */
+
+typedef struct blockdev_request
+{
+    list_link_t br_link;  /* position on bd_elev_pending */
+    blocknum_t br_block;  /* starting block number */
+    size_t br_count;      /* number of blocks */
+    char *br_buf;         /* page-aligned caller buffer */
+    long br_write;        /* nonzero for a write */
+    uint64_t br_deadline; /* jiffies value at which this jumps the sweep */
+    long br_err;          /* completion status from the driver */
+    long br_done;         /* set under bd_elev_lock when complete */
+    ktqueue_t br_waitq;   /* where the submitter waits */
+} blockdev_request_t;
+
+static long blockdev_elev_ready = 0;
+
+/*
+ * Queue a request on bdev's elevator and wait for the dispatcher to complete
+ * it. Requests live on the submitter's stack; the dispatcher only touches
+ * one between dequeueing it and broadcasting on its waitqueue.
+ */
+static long blockdev_elevator_submit(blockdev_t *bdev, char *buf,
+                                     blocknum_t loc, size_t count, long write)
+{
+    if (!blockdev_elev_ready)
+    {
+        return write ? bdev->bd_driver_ops->write_block(bdev, buf, loc, count)
+                     : bdev->bd_driver_ops->read_block(bdev, buf, loc, count);
+    }
+
+    blockdev_request_t req;
+    list_link_init(&req.br_link);
+    req.br_block = loc;
+    req.br_count = count;
+    req.br_buf = buf;
+    req.br_write = write;
+    req.br_deadline = jiffies + (write ? BLOCKDEV_ELEV_WRITE_DEADLINE
+                                       : BLOCKDEV_ELEV_READ_DEADLINE);
+    req.br_err = 0;
+    req.br_done = 0;
+    sched_queue_init(&req.br_waitq);
+
+    spinlock_lock(&bdev->bd_elev_lock);
+    /* Keep the queue sorted by block number; the sweep and the merge pass
+     * both depend on it. */
+    blockdev_request_t *successor = NULL;
+    list_iterate(&bdev->bd_elev_pending, r, blockdev_request_t, br_link)
+    {
+        if (r->br_block > req.br_block)
+        {
+            successor = r;
+            break;
+        }
+    }
+    if (successor)
+    {
+        list_insert_before(&successor->br_link, &req.br_link);
+    }
+    else
+    {
+        list_insert_tail(&bdev->bd_elev_pending, &req.br_link);
+    }
+    sched_broadcast_on(&bdev->bd_elev_waitq);
+    while (!req.br_done)
+    {
+        sched_sleep_on(&req.br_waitq, &bdev->bd_elev_lock);
+        spinlock_lock(&bdev->bd_elev_lock);
+    }
+    spinlock_unlock(&bdev->bd_elev_lock);
+    return req.br_err;
+}
+
+static long blockdev_elevator_read(blockdev_t *bdev, char *buf, blocknum_t loc,
+                                   size_t count)
+{
+    return blockdev_elevator_submit(bdev, buf, loc, count, 0);
+}
+
+static long blockdev_elevator_write(blockdev_t *bdev, const char *buf,
+                                    blocknum_t loc, size_t count)
+{
+    return blockdev_elevator_submit(bdev, (char *)buf, loc, count, 1);
+}
+
+static void *blockdev_elevator_run(long arg1, void *arg2)
+{
+    blockdev_t *bdev = arg2;
+    dbg(DBG_DISK, "elevator dispatcher running for device %u\n", bdev->bd_id);
+    for (;;)
+    {
+        spinlock_lock(&bdev->bd_elev_lock);
+        while (list_empty(&bdev->bd_elev_pending))
+        {
+            sched_sleep_on(&bdev->bd_elev_waitq, &bdev->bd_elev_lock);
+            spinlock_lock(&bdev->bd_elev_lock);
+        }
+
+        /* Deadline promotion: if any request is overdue, start the batch
+         * at the most overdue one rather than continuing the sweep. */
+        blockdev_request_t *start = NULL;
+        list_iterate(&bdev->bd_elev_pending, r, blockdev_request_t, br_link)
+        {
+            if (r->br_deadline <= jiffies &&
+                (!start || r->br_deadline < start->br_deadline))
+            {
+                start = r;
+            }
+        }
+        /* Otherwise C-SCAN: the first request at or past the sweep
+         * position, wrapping back to the lowest block at the end. */
+        if (!start)
+        {
+            list_iterate(&bdev->bd_elev_pending, r, blockdev_request_t,
+                         br_link)
+            {
+                if (r->br_block >= bdev->bd_elev_pos)
+                {
+                    start = r;
+                    break;
+                }
+            }
+        }
+        if (!start)
+        {
+            start = list_head(&bdev->bd_elev_pending, blockdev_request_t,
+                              br_link);
+        }
+
+        /* Merge: take requests after start for as long as they stay
+         * contiguous and keep the same direction, so the whole batch can
+         * go to the driver as one command. */
+        blockdev_request_t *batch[BLOCKDEV_ELEV_BATCH];
+        size_t batch_max = BLOCKDEV_ELEV_BATCH;
+        if (!(start->br_write ? bdev->bd_driver_ops->write_vector
+                              : bdev->bd_driver_ops->read_vector))
+        {
+            /* No scatter/gather path in this driver; dispatch singly. */
+            batch_max = 1;
+        }
+        size_t nbatch = 0;
+        blocknum_t next = start->br_block;
+        blockdev_request_t *r = start;
+        while (nbatch < batch_max &&
+               &r->br_link != &bdev->bd_elev_pending &&
+               r->br_block == next && r->br_write == start->br_write)
+        {
+            batch[nbatch++] = r;
+            next = r->br_block + (blocknum_t)r->br_count;
+            r = list_next(r, blockdev_request_t, br_link);
+        }
+        for (size_t i = 0; i < nbatch; i++)
+        {
+            list_remove(&batch[i]->br_link);
+        }
+        bdev->bd_elev_pos = next;
+        spinlock_unlock(&bdev->bd_elev_lock);
+
+        long err;
+        if (nbatch == 1)
+        {
+            err = start->br_write
+                      ? bdev->bd_driver_ops->write_block(
+                            bdev, start->br_buf, start->br_block,
+                            start->br_count)
+                      : bdev->bd_driver_ops->read_block(
+                            bdev, start->br_buf, start->br_block,
+                            start->br_count);
+        }
+        else
+        {
+            /* The segments are contiguous, but the buffers are not, so
+             * this still needs the driver's scatter/gather path. */
+            blockdev_iovec_t iov[BLOCKDEV_ELEV_BATCH];
+            for (size_t i = 0; i < nbatch; i++)
+            {
+                iov[i].biov_block = batch[i]->br_block;
+                iov[i].biov_buf = batch[i]->br_buf;
+                iov[i].biov_count = batch[i]->br_count;
+            }
+            err = start->br_write
+                      ? bdev->bd_driver_ops->write_vector(bdev, iov, nbatch)
+                      : bdev->bd_driver_ops->read_vector(bdev, iov, nbatch);
+        }
+
+        spinlock_lock(&bdev->bd_elev_lock);
+        for (size_t i = 0; i < nbatch; i++)
+        {
+            batch[i]->br_err = err;
+            batch[i]->br_done = 1;
+            sched_broadcast_on(&batch[i]->br_waitq);
+        }
+        spinlock_unlock(&bdev->bd_elev_lock);
+    }
+    return NULL;
+}
+
+void blockdev_elevator_start()
+{
+    list_iterate(&blockdevs, bdev, blockdev_t, bd_link)
+    {
+        proc_t *proc = proc_create("blockdev_elev");
+        KASSERT(proc && "couldn't create the elevator dispatcher");
+        kthread_t *thr = kthread_create(proc, blockdev_elevator_run, 0, bdev);
+        KASSERT(thr && "couldn't create the elevator dispatcher's thread");
+        /* Keep the dispatcher on the core that takes the disk's completion
+         * interrupts (the AHCI MSI targets core 0 by default; see
+         * sata_set_interrupt_affinity), so the pending queue and per-port
+         * command state stay cache-local to completion processing. */
+        kthread_set_affinity(thr, 1UL << 0);
+        sched_make_runnable(thr);
+    }
+    blockdev_elev_ready = 1;
+}
+
 static long blockdev_fill_pframe(mobj_t *mobj, pframe_t *pf)
 {
     KASSERT(mobj && pf);
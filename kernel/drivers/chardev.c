@@ -1,5 +1,7 @@
 #include "drivers/chardev.h"
+#include "drivers/lodev.h"
 #include "drivers/memdevs.h"
+#include "drivers/statdev.h"
 #include "drivers/tty/tty.h"
 #include "kernel.h"
 #include "util/debug.h"
@@ -10,6 +12,8 @@ void chardev_init()
 {
     tty_init();
     memdevs_init();
+    statdev_init();
+    lodev_init();
 }
 
 long chardev_register(chardev_t *dev)
@@ -3,13 +3,44 @@
 #include <drivers/disk/sata.h>
 #include <drivers/pcie.h>
 #include <errno.h>
+#include <main/apic.h>
+#include <main/interrupt.h>
 #include <mm/kmalloc.h>
 #include <mm/page.h>
 #include <util/debug.h>
+#include <util/printf.h>
 #include <util/string.h>
+#include <util/time.h>
+#include <util/trace.h>
 
 #define ENABLE_NATIVE_COMMAND_QUEUING 1
 
+/* AHCI_PARALLEL_NCQ - Allow up to AHCI_COMMAND_HEADERS_PER_LIST tagged
+ * commands to be in flight per port at once, instead of serializing every
+ * operation behind a global mutex. QEMU's AHCI model mishandles concurrent
+ * NCQ commands, so this defaults to off; set to 1 when running on real
+ * hardware (the sncq capability bit is still checked at runtime). */
+#define AHCI_PARALLEL_NCQ 0
+
+/* AHCI_INTERRUPT_COALESCING - Program the HBA's command completion
+ * coalescing unit so that completions are batched: an interrupt fires
+ * after AHCI_CCC_THRESHOLD completions accumulate, or AHCI_CCC_TIMEOUT_MS
+ * after the first unreported one, whichever comes first. At high IOPS
+ * this trades a bounded amount of completion latency for far fewer
+ * interrupts. QEMU's AHCI model does not implement CCC (cap.cccs reads
+ * 0 there), so this only takes effect on hardware that reports the
+ * capability. */
+#define AHCI_INTERRUPT_COALESCING 1
+#define AHCI_CCC_THRESHOLD 8
+#define AHCI_CCC_TIMEOUT_MS 1
+
+/* Watchdog for lost completion interrupts: how long a submitted command may
+ * sit without a completion before the waiting thread re-checks the port's
+ * hardware state, and how many times it re-rings the doorbell for a command
+ * the hardware still shows active before failing it with EIO. */
+#define SATA_CMD_TIMEOUT_MS 100
+#define SATA_CMD_MAX_RESUBMITS 3
+
 #define bdev_to_ata_disk(bd) (CONTAINER_OF((bd), ata_disk_t, bdev))
 #define SATA_SECTORS_PER_BLOCK (SATA_BLOCK_SIZE / ATA_SECTOR_SIZE)
 
@@ -19,6 +50,13 @@
 
 static hba_t *hba; /* host bus adapter */
 
+static msi_capability_t *ahci_msi_cap; /* for re-steering the MSI */
+
+/* Set at initialization iff AHCI_PARALLEL_NCQ is configured and the HBA
+ * reports NCQ support; when clear, operations serialize on
+ * because_qemu_doesnt_emulate_ahci_ncq_correctly (queue depth 1). */
+static long ahci_parallel_ncq = 0;
+
 /* If NCQ, this is an outstanding tag bitmap.
  * If standard, this is an outstanding command slot bitmap. */
 static uint32_t outstanding_requests[AHCI_MAX_NUM_PORTS] = {0};
@@ -35,17 +73,61 @@ static ktqueue_t command_slot_queues[AHCI_MAX_NUM_PORTS];
 /* SMP: Protect access to ports. */
 static spinlock_t port_locks[AHCI_MAX_NUM_PORTS];
 
+/* Completions observed by the interrupt top half but not yet turned into
+ * wakeups by the deferred bottom half (protected by the port lock). */
+static uint32_t ahci_pending_completions[AHCI_MAX_NUM_PORTS] = {0};
+
+/* Ports Implemented, latched at init for the interrupt handler. */
+static uint32_t ahci_ports_implemented;
+
+/* Nonzero iff command completion coalescing was enabled: the ghc.is bit
+ * the HBA asserts for a coalesced completion event. Ports enrolled in
+ * coalescing no longer raise per-command interrupts. */
+static uint32_t ahci_ccc_interrupt_mask;
+
+/*
+ * DMA staging pool: a fixed set of pre-mapped, physically contiguous
+ * buffers allocated below 4 GiB at init and recycled for the life of the
+ * system. The disk path uses them to stage transfers whose buffers live
+ * outside the physmap (where physical contiguity isn't guaranteed, which
+ * the scatter-gather path assumes per segment) without going back to the
+ * page allocator per transfer. Threads block when the pool runs dry.
+ */
+#define SATA_DMA_BUF_PAGES 16
+#define SATA_DMA_BUF_SIZE (SATA_DMA_BUF_PAGES * PAGE_SIZE)
+#define SATA_DMA_POOL_BUFS 16
+#define SATA_DMA_MAX_PADDR ((void *)0xffffffffUL)
+
+static void *sata_dma_pool[SATA_DMA_POOL_BUFS];
+static size_t sata_dma_count; /* buffers currently in the pool */
+static spinlock_t sata_dma_lock = SPINLOCK_INITIALIZER(sata_dma_lock);
+static ktqueue_t sata_dma_queue;
+
 long sata_read_block(blockdev_t *bdev, char *buf, blocknum_t block,
                      size_t block_count);
 long sata_write_block(blockdev_t *bdev, const char *buf, blocknum_t block,
                       size_t block_count);
+long sata_read_vector(blockdev_t *bdev, blockdev_iovec_t *iov, size_t iovcnt);
+long sata_write_vector(blockdev_t *bdev, blockdev_iovec_t *iov, size_t iovcnt);
 
 /* sata_disk_ops - Block device operations for SATA devices. */
 static blockdev_ops_t sata_disk_ops = {
     .read_block = sata_read_block,
+    .read_block_poll = sata_read_poll,
     .write_block = sata_write_block,
+    .read_vector = sata_read_vector,
+    .write_vector = sata_write_vector,
 };
 
+/* ahci_sg_t - One memory segment of a scatter-gather disk operation. The
+ * segments of an operation cover one contiguous run of LBAs but may point at
+ * arbitrary (page-aligned) buffers; each becomes one or more PRDT entries. */
+typedef struct ahci_sg
+{
+    void *sg_buf;      /* virtual (physmap) address of the segment */
+    uint16_t sg_count; /* length of the segment in sectors */
+} ahci_sg_t;
+
 /* find_cmdslot - Checks various bitmaps to find the lowest index command slot
  * that is free for a given port. */
 inline long find_cmdslot(hba_port_t *port)
@@ -70,13 +152,75 @@ void ensure_mapped(void *addr, size_t size)
 
 kmutex_t because_qemu_doesnt_emulate_ahci_ncq_correctly;
 
-/* ahci_do_operation - Sends a command to the HBA to initiate a disk operation.
+/*
+ * Command submission and completion sites. sata_submit carries the
+ * starting LBA and the sector count; sata_queue fires alongside it with
+ * the queue depth at submission and the cycles the thread spent waiting
+ * for a tag (and, serialized mode, the mutex); sata_complete carries the
+ * LBA again and the cycles from doorbell to completion wakeup. Together
+ * the three split every command's latency into queueing and device time.
  */
-long ahci_do_operation(hba_port_t *port, ssize_t lba, uint16_t count, void *buf,
-                       int write)
+TRACEPOINT(sata_submit);
+TRACEPOINT(sata_queue);
+TRACEPOINT(sata_complete);
+
+/*
+ * Aggregate per-phase latency histograms (log2 buckets, in TSC cycles)
+ * over every command since boot, split the same way: cycles spent
+ * waiting to submit versus cycles the device took. Kept even while
+ * tracing is off, so a regression can be attributed after the fact;
+ * increments are unlocked (stats only). Reported by the kshell 'disklat'
+ * command via sata_latency_info().
+ */
+#define SATA_LAT_BUCKETS 32
+
+static uint64_t sata_queue_hist[SATA_LAT_BUCKETS];
+static uint64_t sata_device_hist[SATA_LAT_BUCKETS];
+
+static inline uint64_t sata_tsc()
 {
-    kmutex_lock(&because_qemu_doesnt_emulate_ahci_ncq_correctly);
-    KASSERT(count && buf);
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void sata_hist_record(uint64_t *hist, uint64_t cycles)
+{
+    long bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    if (bucket >= SATA_LAT_BUCKETS)
+    {
+        bucket = SATA_LAT_BUCKETS - 1;
+    }
+    hist[bucket]++;
+}
+
+/* ahci_do_operation_sg - Sends a single command to the HBA covering one
+ * contiguous run of LBAs whose data is scattered across (gathered from) the
+ * given memory segments. Each segment is turned into as many PRDT entries as
+ * its size requires.
+ */
+static long ahci_do_operation_sg(hba_port_t *port, ssize_t lba, ahci_sg_t *sgl,
+                                 size_t sgcnt, int write)
+{
+    KASSERT(sgcnt && sgcnt <= ACHI_NUM_PRDTS_PER_COMMAND_TABLE);
+    uint32_t count = 0;
+    for (size_t seg = 0; seg < sgcnt; seg++)
+    {
+        KASSERT(sgl[seg].sg_count && sgl[seg].sg_buf);
+        count += sgl[seg].sg_count;
+    }
+    KASSERT(count <= AHCI_MAX_SECTORS_PER_COMMAND);
+
+    /* Everything from here to the doorbell is queueing, not the device. */
+    uint64_t t_enter = sata_tsc();
+
+    /* With parallel NCQ, the per-port command slots provide all the mutual
+     * exclusion we need; each thread claims its own tag under the port lock
+     * below and sleeps on that tag's queue. */
+    if (!ahci_parallel_ncq)
+    {
+        kmutex_lock(&because_qemu_doesnt_emulate_ahci_ncq_correctly);
+    }
     KASSERT(lba >= 0 && lba < 1L << 23);
 
     /* Obtain the port and the physical system memory in question. */
@@ -85,8 +229,6 @@ long ahci_do_operation(hba_port_t *port, ssize_t lba, uint16_t count, void *buf,
     uint8_t ipl = intr_setipl(IPL_HIGH);
     spinlock_lock(port_locks + port_index);
 
-    uint64_t physbuf = pt_virt_to_phys((uintptr_t)buf);
-
     /* Get an available command slot. */
     long command_slot;
     while ((command_slot = find_cmdslot(port)) == -1)
@@ -108,30 +250,37 @@ long ahci_do_operation(hba_port_t *port, ssize_t lba, uint16_t count, void *buf,
     /* Command setup: Header. */
     command_header->cfl = sizeof(h2d_register_fis_t) / sizeof(uint32_t);
     command_header->write = (uint8_t)write;
-    command_header->prdtl = (uint16_t)(
-        ALIGN_UP_POW_2(count, AHCI_SECTORS_PER_PRDT) / AHCI_SECTORS_PER_PRDT);
-    KASSERT(command_header->prdtl);
 
     /* Command setup: Table. */
     command_table_t *command_table =
         (command_table_t *)(command_header->ctba + PHYS_OFFSET);
     memset(command_table, 0, sizeof(command_table_t));
 
-    /* Command setup: Physical region descriptor table. */
+    /* Command setup: Physical region descriptor table. Each memory segment
+     * contributes one PRD per AHCI_MAX_PRDT_SIZE chunk (a single chunk for
+     * anything that isn't a REALLY big transfer). */
     prd_t *prdt = command_table->prdt;
-    /* Note that this loop is only called when the size of the data transfer is
-     * REALLY big. */
-    for (unsigned i = 0; i < command_header->prdtl - 1U; i++)
+    size_t nprds = 0;
+    for (size_t seg = 0; seg < sgcnt; seg++)
     {
-        prdt->dbc = AHCI_MAX_PRDT_SIZE - 1;
-        prdt->dba = physbuf; /* Data from physical buffer. */
-        prdt->i = 1;         /* Set interrupt on completion. */
-        physbuf +=
-            AHCI_MAX_PRDT_SIZE; /* Advance physical buffer for next prd. */
-        prdt++;
+        uint64_t physbuf = pt_virt_to_phys((uintptr_t)sgl[seg].sg_buf);
+        size_t bytes = (size_t)sgl[seg].sg_count * ATA_SECTOR_SIZE;
+        while (bytes)
+        {
+            size_t chunk =
+                bytes < AHCI_MAX_PRDT_SIZE ? bytes : AHCI_MAX_PRDT_SIZE;
+            KASSERT(nprds < ACHI_NUM_PRDTS_PER_COMMAND_TABLE);
+            prdt[nprds].dbc = (uint32_t)chunk - 1;
+            prdt[nprds].dba = physbuf; /* Data from physical buffer. */
+            prdt[nprds].i = 1;         /* Set interrupt on completion. */
+            physbuf += chunk; /* Advance physical buffer for next prd. */
+            bytes -= chunk;
+            nprds++;
+        }
     }
-    prdt->dbc = (uint32_t)(count % AHCI_SECTORS_PER_PRDT) * ATA_SECTOR_SIZE - 1;
-    prdt->dba = (uint64_t)physbuf;
+    prdt[nprds - 1].i = 0; /* Final PRD relies on the command completion. */
+    command_header->prdtl = (uint16_t)nprds;
+    KASSERT(command_header->prdtl);
 
     /* Set up the particular h2d_register_fis command (the only one we use). */
     h2d_register_fis_t *command_fis = &command_table->cfis.h2d_register_fis;
@@ -180,6 +329,10 @@ long ahci_do_operation(hba_port_t *port, ssize_t lba, uint16_t count, void *buf,
     outstanding_requests[port_index] |= (1 << command_slot);
 
     /* Explicitly notify the port that a command is available for execution. */
+    uint64_t t_submit = sata_tsc();
+    sata_hist_record(sata_queue_hist, t_submit - t_enter);
+    TRACE(sata_submit, lba, count);
+    TRACE(sata_queue, sata_queue_depth(), t_submit - t_enter);
     port->px_sact |= (1 << command_slot);
     port->px_ci |= (1 << command_slot);
 
@@ -190,19 +343,161 @@ long ahci_do_operation(hba_port_t *port, ssize_t lba, uint16_t count, void *buf,
     dbg(DBG_DISK,
         "initiating request on slot %ld to %s sectors [%lu, %lu)...sleeping\n",
         command_slot, write ? "write" : "read", lba, lba + count);
-    sched_sleep_on(outstanding_request_queues[port_index] + command_slot,
-                   port_locks + port_index);
+
+    /*
+     * Wait with a deadline rather than unconditionally: if the HBA's
+     * completion interrupt is lost (the hangs the NCQ workaround above
+     * hints at), the wakeup never comes and the command blocks forever.
+     * On a timeout, compare our bookkeeping against the port's hardware
+     * state to tell a lost interrupt - harvest the completion ourselves -
+     * from a genuinely stuck command, which is resubmitted and eventually
+     * failed with EIO.
+     */
+    long err = 0;
+    long resubmits = 0;
+    for (;;)
+    {
+        if (!sched_sleep_on_timeout(
+                outstanding_request_queues[port_index] + command_slot,
+                port_locks + port_index,
+                time_usec_to_ticks(SATA_CMD_TIMEOUT_MS * 1000)))
+        {
+            /* Woken by the completion bottom half. */
+            break;
+        }
+
+        spinlock_lock(port_locks + port_index);
+        if (!(outstanding_requests[port_index] & (1 << command_slot)))
+        {
+            /* Completed while we were timing out; the bottom half's
+             * wakeup found the queue already empty. */
+            spinlock_unlock(port_locks + port_index);
+            break;
+        }
+#if ENABLE_NATIVE_COMMAND_QUEUING
+        uint32_t still_active =
+            hba->ghc.cap.sncq ? port->px_sact : port->px_ci;
+#else
+        uint32_t still_active = port->px_ci;
+#endif
+        if (!(still_active & (1 << command_slot)))
+        {
+            /* The device finished but the interrupt never arrived:
+             * harvest the completion ourselves, as the bottom half
+             * would have. */
+            dbg(DBG_DISK,
+                "lost completion on slot %ld, sectors [%lu, %lu)\n",
+                command_slot, lba, lba + count);
+            outstanding_requests[port_index] &= ~(1 << command_slot);
+            sched_wakeup_on(command_slot_queues + port_index, NULL);
+            spinlock_unlock(port_locks + port_index);
+            break;
+        }
+        if (resubmits++ < SATA_CMD_MAX_RESUBMITS)
+        {
+            /* Still marked active after a full timeout: assume the
+             * command was dropped and ring the doorbell again. The port
+             * lock is released by the next sleep. */
+            dbg(DBG_DISK,
+                "resubmitting stalled slot %ld, sectors [%lu, %lu)\n",
+                command_slot, lba, lba + count);
+            TRACE(sata_submit, lba, count);
+            port->px_sact |= (1 << command_slot);
+            port->px_ci |= (1 << command_slot);
+            continue;
+        }
+        /* Out of retries: fail the command and free the slot. */
+        dbg(DBG_DISK, "giving up on slot %ld, sectors [%lu, %lu)\n",
+            command_slot, lba, lba + count);
+        outstanding_requests[port_index] &= ~(1 << command_slot);
+        sched_wakeup_on(command_slot_queues + port_index, NULL);
+        spinlock_unlock(port_locks + port_index);
+        err = -EIO;
+        break;
+    }
     intr_setipl(ipl);
+    uint64_t t_done = sata_tsc();
+    sata_hist_record(sata_device_hist, t_done - t_submit);
+    TRACE(sata_complete, lba, t_done - t_submit);
     dbg(DBG_DISK, "completed request on slot %ld to %s sectors [%lu, %lu)\n",
         command_slot, write ? "write" : "read", lba, lba + count);
-    kmutex_unlock(&because_qemu_doesnt_emulate_ahci_ncq_correctly);
+    if (!ahci_parallel_ncq)
+    {
+        kmutex_unlock(&because_qemu_doesnt_emulate_ahci_ncq_correctly);
+    }
 
-    long ret = (long)curthr->kt_retval;
+    long ret = err ? err : (long)curthr->kt_retval;
     spinlock_unlock(&curthr->kt_lock);
 
     return ret;
 }
 
+/* sata_dma_alloc - Takes a pre-mapped, physically contiguous
+ * SATA_DMA_BUF_SIZE staging buffer from the pool, sleeping until one is
+ * returned if the pool is empty.
+ */
+void *sata_dma_alloc()
+{
+    spinlock_lock(&sata_dma_lock);
+    while (!sata_dma_count)
+    {
+        sched_sleep_on(&sata_dma_queue, &sata_dma_lock);
+        /* sched_sleep_on releases the lock; retake it to recheck */
+        spinlock_lock(&sata_dma_lock);
+    }
+    void *buf = sata_dma_pool[--sata_dma_count];
+    spinlock_unlock(&sata_dma_lock);
+    return buf;
+}
+
+/* sata_dma_free - Returns a buffer obtained from sata_dma_alloc to the
+ * pool and wakes any waiters.
+ */
+void sata_dma_free(void *buf)
+{
+    KASSERT(buf);
+    spinlock_lock(&sata_dma_lock);
+    KASSERT(sata_dma_count < SATA_DMA_POOL_BUFS);
+    sata_dma_pool[sata_dma_count++] = buf;
+    sched_broadcast_on(&sata_dma_queue);
+    spinlock_unlock(&sata_dma_lock);
+}
+
+/* ahci_do_operation - Sends a command to the HBA to initiate a disk operation
+ * on a single contiguous buffer.
+ */
+long ahci_do_operation(hba_port_t *port, ssize_t lba, uint16_t count, void *buf,
+                       int write)
+{
+    size_t bytes = (size_t)count * ATA_SECTOR_SIZE;
+
+    /* Buffers outside the physmap (stack, vmapped regions) carry no
+     * guarantee that their physical pages are contiguous, which the
+     * scatter-gather path assumes within a segment; stage those through
+     * the DMA pool. Physmap buffers (page_alloc memory, pframes) go to
+     * the hardware directly, copy-free. */
+    if (bytes <= SATA_DMA_BUF_SIZE &&
+        (buf < physmap_start() || buf >= physmap_end()))
+    {
+        void *staging = sata_dma_alloc();
+        if (write)
+        {
+            memcpy(staging, buf, bytes);
+        }
+        ahci_sg_t sg = {.sg_buf = staging, .sg_count = count};
+        long ret = ahci_do_operation_sg(port, lba, &sg, 1, write);
+        if (!ret && !write)
+        {
+            memcpy(buf, staging, bytes);
+        }
+        sata_dma_free(staging);
+        return ret;
+    }
+
+    ahci_sg_t sg = {.sg_buf = buf, .sg_count = count};
+    return ahci_do_operation_sg(port, lba, &sg, 1, write);
+}
+
 /* start_cmd - Start a port's DMA engines. See 10.3 of 1.3.1. */
 static inline void start_cmd(hba_port_t *port)
 {
@@ -212,15 +507,39 @@ static inline void start_cmd(hba_port_t *port)
     port->px_cmd.st = 1;  /* Enable processing the command list. */
 }
 
-/* stop_cmd - Stop a port's DMA engines. See 10.3 of 1.3.1. */
-static inline void stop_cmd(hba_port_t *port)
+/* stop_cmd_all - Stop the DMA engines of every port in ports, overlapping
+ * the per-port engine wind-down instead of spinning each one down serially
+ * (see 10.3 of 1.3.1 for the single-port sequence). The stop requests are
+ * all posted first, so every engine winds down while we wait on the first
+ * one; likewise for the FIS receive engines. */
+static void stop_cmd_all(uint32_t ports)
 {
-    port->px_cmd.st = 0; /* Stop processing the command list. */
-    while (port->px_cmd.cr)
-        ;                 /* Wait for command list DMA to stop running. */
-    port->px_cmd.fre = 0; /* Stop posting received FIS. */
-    while (port->px_cmd.fr)
-        ; /* Wait for FIS receive DMA to stop running. */
+    uint32_t mask = ports;
+    while (mask)
+    {
+        unsigned port_number = __builtin_ctz(mask);
+        mask &= ~(1 << port_number);
+        hba->ports[port_number].px_cmd.st = 0; /* Stop processing the
+                                                * command list. */
+    }
+    mask = ports;
+    while (mask)
+    {
+        unsigned port_number = __builtin_ctz(mask);
+        mask &= ~(1 << port_number);
+        while (hba->ports[port_number].px_cmd.cr)
+            ; /* Wait for command list DMA to stop running. */
+        hba->ports[port_number].px_cmd.fre = 0; /* Stop posting received
+                                                 * FIS. */
+    }
+    mask = ports;
+    while (mask)
+    {
+        unsigned port_number = __builtin_ctz(mask);
+        mask &= ~(1 << port_number);
+        while (hba->ports[port_number].px_cmd.fr)
+            ; /* Wait for FIS receive DMA to stop running. */
+    }
 }
 
 /* ahci_initialize_port */
@@ -232,8 +551,8 @@ static void ahci_initialize_port(hba_port_t *port, unsigned int port_number,
     /* Pretty sure this is unnecessary. */
     // port->px_serr = port->px_serr;
 
-    /* Make sure the port is not doing any DMA. */
-    stop_cmd(port);
+    /* The port is not doing any DMA; ahci_initialize_hba already stopped
+     * every port's engines (stop_cmd_all) before the setup pass. */
 
     /* Pretty sure this is unnecessary. */
     // port->px_serr = (unsigned) -1;
@@ -272,7 +591,9 @@ static void ahci_initialize_port(hba_port_t *port, unsigned int port_number,
     /* Start the queue to wait for an open command slot. */
     sched_queue_init(command_slot_queues + port_number);
 
-    spinlock_init(port_locks + port_number);
+    /* Port locks are hammered by every I/O submission and completion, so
+     * use the queued (MCS) mode to keep contended handoff FIFO and cheap. */
+    spinlock_init_mcs(port_locks + port_number);
 
     /* For SATA disks, allocate, setup, and register the disk / block device. */
     if (port->px_sig == SATA_SIG_ATA)
@@ -328,6 +649,7 @@ void ahci_initialize_hba()
                                    (cap->next_cap & PCI_CAPABILITY_PTR_MASK));
     }
     msi_capability_t *msi_cap = (msi_capability_t *)cap;
+    ahci_msi_cap = msi_cap;
 
     /* Set MSI Enable to turn on MSI. */
     msi_cap->control.msie = 1;
@@ -335,9 +657,9 @@ void ahci_initialize_hba()
     /* For more info on MSI, consult Intel 3A 10.11.1, and also 2.3 of the 1.3.1
      * spec. */
 
-    /* Set up MSI for processor 1, with interrupt vector INTR_DISK_PRIMARY.
-     * TODO: Check MSI setup details to determine if MSI can be handled more
-     * efficiently in SMP.
+    /* Set up MSI to target core 0 (logical destination 1), with interrupt
+     * vector INTR_DISK_PRIMARY; sata_set_interrupt_affinity() can re-steer
+     * it later.
      */
     if (msi_cap->control.c64)
     {
@@ -364,12 +686,6 @@ void ahci_initialize_hba()
      * is set. */
     // intr_map(dev->standard.interrupt_line, INTR_DISK_PRIMARY);
 
-    /* Allocate space for what will become the command lists and received FISs
-     * for each port. */
-    uintptr_t ahci_base = (uintptr_t)page_alloc_n(AHCI_SIZE_PAGES);
-    memset((void *)ahci_base, 0, AHCI_SIZE_PAGES * PAGE_SIZE);
-
-    KASSERT(ahci_base);
     /* Set AHCI Enable bit.
      * Actually this bit appears to be read-only (see 3.1.2 AE and 3.1.1 SAM).
      * I do get a "mis-aligned write" complaint when I try to manually set it.
@@ -379,19 +695,78 @@ void ahci_initialize_hba()
     /* Temporarily clear Interrupt Enable bit before setting up ports. */
     hba->ghc.ghc.ie = 0;
 
+    /* Stop every implemented port's DMA engines before anything else, so
+     * the engines wind down while the allocations below run; boot does not
+     * sit idle behind the hardware. */
+    uint32_t ports_implemented = hba->ghc.pi;
+    KASSERT(ports_implemented);
+    stop_cmd_all(ports_implemented);
+
+    /* Allocate space for what will become the command lists and received FISs
+     * for each port. */
+    uintptr_t ahci_base = (uintptr_t)page_alloc_n(AHCI_SIZE_PAGES);
+    memset((void *)ahci_base, 0, AHCI_SIZE_PAGES * PAGE_SIZE);
+
+    KASSERT(ahci_base);
+
+    /* Pre-allocate the DMA staging pool: physically contiguous, below
+     * 4 GiB, and mapped once up front so the I/O path never touches the
+     * page allocator or the page tables again. */
+    sched_queue_init(&sata_dma_queue);
+    for (size_t i = 0; i < SATA_DMA_POOL_BUFS; i++)
+    {
+        void *buf =
+            page_alloc_n_bounded(SATA_DMA_BUF_PAGES, SATA_DMA_MAX_PADDR);
+        KASSERT(buf && "couldn't allocate the AHCI DMA staging pool");
+        ensure_mapped(buf, SATA_DMA_BUF_SIZE);
+        sata_dma_pool[i] = buf;
+    }
+    sata_dma_count = SATA_DMA_POOL_BUFS;
+
     dbg(DBG_DISK, "ahci ncq supported: %s\n",
         hba->ghc.cap.sncq ? "true" : "false");
 
+#if AHCI_PARALLEL_NCQ
+    ahci_parallel_ncq = hba->ghc.cap.sncq;
+    dbg(DBG_DISK, "ahci parallel ncq: %s\n",
+        ahci_parallel_ncq ? "enabled" : "unsupported by hba");
+#endif
+
     /* Initialize each of the available ports. */
-    uint32_t ports_implemented = hba->ghc.pi;
-    KASSERT(ports_implemented);
-    while (ports_implemented)
+    uint32_t setup_mask = ports_implemented;
+    while (setup_mask)
     {
-        unsigned port_number = __builtin_ctz(ports_implemented);
-        ports_implemented &= ~(1 << port_number);
+        unsigned port_number = __builtin_ctz(setup_mask);
+        setup_mask &= ~(1 << port_number);
         ahci_initialize_port(hba->ports + port_number, port_number, ahci_base);
     }
 
+    ahci_ports_implemented = ports_implemented;
+
+#if AHCI_INTERRUPT_COALESCING
+    if (hba->ghc.cap.cccs)
+    {
+        /* Program the coalescing unit. Everything but EN may only be
+         * written while EN is clear (3.1.5), so disable, configure,
+         * re-enable. The INT field is read-only and tells us which ghc.is
+         * bit the coalesced event will arrive on. */
+        hba->ghc.ccc_ctl.en = 0;
+        hba->ghc.ccc_ctl.cc = AHCI_CCC_THRESHOLD;
+        hba->ghc.ccc_ctl.tv = AHCI_CCC_TIMEOUT_MS;
+        hba->ghc.ccc_ports = ports_implemented;
+        hba->ghc.ccc_ctl.en = 1;
+        ahci_ccc_interrupt_mask = 1U << hba->ghc.ccc_ctl.intr;
+        dbg(DBG_DISK,
+            "ahci interrupt coalescing: threshold %d, timer %dms (is bit "
+            "%d)\n",
+            AHCI_CCC_THRESHOLD, AHCI_CCC_TIMEOUT_MS, hba->ghc.ccc_ctl.intr);
+    }
+    else
+    {
+        dbg(DBG_DISK, "ahci interrupt coalescing: unsupported by hba\n");
+    }
+#endif
+
     /* Clear any outstanding interrupts from any ports. */
     hba->ghc.is = (uint32_t)-1;
 
@@ -399,29 +774,74 @@ void ahci_initialize_hba()
     hba->ghc.ghc.ie = 1;
 }
 
-/* ahci_interrupt_handler - Service an interrupt that was raised by the HBA.
+/* ahci_complete_work - Bottom half of the HBA interrupt: wakes the threads
+ * whose commands completed and anyone waiting for a free command slot. Runs
+ * from the deferred work queue on interrupt exit (see intr_defer), so the
+ * scheduler traffic here no longer happens with all interrupts masked; the
+ * IPL is raised only around the wakeups themselves, which race with the
+ * submit path and the top half for the port's state.
  */
-static long ahci_interrupt_handler(regs_t *regs)
+static void ahci_complete_work(void *arg)
 {
-    /* Check interrupt status bitmap for ports to service. */
-    while (hba->ghc.is)
+    size_t port_index = (size_t)arg;
+
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    spinlock_lock(port_locks + port_index);
+
+    uint32_t completed = ahci_pending_completions[port_index];
+    ahci_pending_completions[port_index] = 0;
+
+    /* Handle each completed command: */
+    while (completed)
     {
-        /* Get a port from the global interrupt status bitmap. */
-        unsigned port_index = __builtin_ctz(hba->ghc.is);
+        uint32_t slot = __builtin_ctz(completed);
 
-        /* Get the port descriptor from the HBA's ports array. */
-        hba_port_t *port = hba->ports + port_index;
-        spinlock_lock(port_locks + port_index);
+        /* Wake up the thread that was waiting on that command. */
+        kthread_t *thr;
+        sched_wakeup_on(&outstanding_request_queues[port_index][slot], &thr);
 
-        /* Beware: If a register is marked "RWC" in the spec, you must clear it
-         * by writing 1. This is rather understated in the specification. */
+        /* Mark the command as available. */
+        completed &= ~(1 << slot);
 
-        /* Clear the cause of the interrupt.
-         * See 5.6.2 and 5.6.4 in the 1.3.1 spec for confirmation of the FIS and
-         * corresponding interrupt that are used depending on the type of
-         * command.
-         */
+        /* A tag just freed up; one freed tag admits one waiter, so wake the
+         * oldest rather than the whole queue (the rest would lose the race
+         * for the slot and re-block). Each completion wakes another. */
+        sched_wakeup_on(command_slot_queues + port_index, NULL);
+    }
+
+    spinlock_unlock(port_locks + port_index);
+    intr_setipl(ipl);
+}
 
+/* ahci_service_port - Ack a port's interrupt status and record which of its
+ * commands finished, deferring the wakeups to the bottom half. 'coalesced'
+ * is set when we got here from a coalesced completion event rather than a
+ * per-port interrupt: the port-level cause bits for the batched completions
+ * are not guaranteed to be in any particular state then, so the whole status
+ * register is cleared instead of asserting a specific cause (a port swept
+ * with nothing completed is simply a no-op).
+ */
+static void ahci_service_port(unsigned port_index, long coalesced)
+{
+    /* Get the port descriptor from the HBA's ports array. */
+    hba_port_t *port = hba->ports + port_index;
+    spinlock_lock(port_locks + port_index);
+
+    /* Beware: If a register is marked "RWC" in the spec, you must clear it
+     * by writing 1. This is rather understated in the specification. */
+
+    /* Clear the cause of the interrupt.
+     * See 5.6.2 and 5.6.4 in the 1.3.1 spec for confirmation of the FIS and
+     * corresponding interrupt that are used depending on the type of
+     * command.
+     */
+
+    if (coalesced)
+    {
+        port->px_is = px_interrupt_status_clear;
+    }
+    else
+    {
 #if ENABLE_NATIVE_COMMAND_QUEUING
         if (hba->ghc.cap.sncq)
         {
@@ -442,39 +862,65 @@ static long ahci_interrupt_handler(regs_t *regs)
          * indicate we have handled it. */
         /* Note: Changed from ~ to regular, because this register is RWC. */
         hba->ghc.is &= (1 << port_index);
+    }
 
-        /* Get the list of commands still outstanding. */
+    /* Get the list of commands still outstanding. */
 #if ENABLE_NATIVE_COMMAND_QUEUING
-        /* If NCQ, use SACT register. */
-        uint32_t active = hba->ghc.cap.sncq ? port->px_sact : port->px_ci;
+    /* If NCQ, use SACT register. */
+    uint32_t active = hba->ghc.cap.sncq ? port->px_sact : port->px_ci;
 #else
-        /* If not NCQ, use CI register. */
-        uint32_t active = port->px_ci;
+    /* If not NCQ, use CI register. */
+    uint32_t active = port->px_ci;
 #endif
 
-        /* Compare the active commands against those we actually sent out to get
-         * completed commands. */
-        uint32_t completed = outstanding_requests[port_index] &
-                             ~(outstanding_requests[port_index] & active);
-        /* Handle each completed command: */
-        while (completed)
+    /* Compare the active commands against those we actually sent out to get
+     * completed commands, and leave the wakeups to the bottom half. Only
+     * defer when this interrupt found new completions; an earlier,
+     * not-yet-drained deferral already covers the rest. */
+    uint32_t completed = outstanding_requests[port_index] &
+                         ~(outstanding_requests[port_index] & active);
+    outstanding_requests[port_index] &= ~completed;
+    if (completed)
+    {
+        if (!ahci_pending_completions[port_index])
         {
-            uint32_t slot = __builtin_ctz(completed);
+            intr_defer(ahci_complete_work, (void *)(size_t)port_index);
+        }
+        ahci_pending_completions[port_index] |= completed;
+    }
 
-            /* Wake up the thread that was waiting on that command. */
-            kthread_t *thr;
-            sched_wakeup_on(&outstanding_request_queues[port_index][slot],
-                            &thr);
+    spinlock_unlock(port_locks + port_index);
+}
 
-            /* Mark the command as available. */
-            completed &= ~(1 << slot);
-            outstanding_requests[port_index] &= ~(1 << slot);
+/* ahci_interrupt_handler - Service an interrupt that was raised by the HBA.
+ * This top half only acks the hardware and records which commands finished;
+ * the wakeups are deferred to ahci_complete_work() on interrupt exit.
+ */
+static long ahci_interrupt_handler(regs_t *regs)
+{
+    /* Check interrupt status bitmap for ports to service. */
+    while (hba->ghc.is)
+    {
+        uint32_t is = hba->ghc.is;
 
-            /* TODO: Wake up threads that were waiting for a command slot to
-             * free up on the port. */
+        if (is & ahci_ccc_interrupt_mask)
+        {
+            /* Coalesced completion event: one interrupt stands in for a
+             * batch of completions, and the event does not say which ports
+             * they landed on, so ack it and sweep every implemented port,
+             * draining all completed tags in one pass. */
+            hba->ghc.is = ahci_ccc_interrupt_mask; /* RWC */
+            uint32_t scan = ahci_ports_implemented;
+            while (scan)
+            {
+                unsigned port_index = __builtin_ctz(scan);
+                scan &= ~(1U << port_index);
+                ahci_service_port(port_index, 1);
+            }
+            continue;
         }
 
-        spinlock_unlock(port_locks + port_index);
+        ahci_service_port(__builtin_ctz(is), 0);
     }
     return 0;
 }
@@ -485,6 +931,30 @@ void sata_init()
     ahci_initialize_hba();
 }
 
+/* sata_set_interrupt_affinity - Re-targets the AHCI MSI at the given core,
+ * so completion interrupts (and the wakeups they perform) land on the core
+ * running the submitting I/O threads, keeping the per-port command state
+ * cache-local to completion processing.
+ */
+void sata_set_interrupt_affinity(long core)
+{
+    KASSERT(core >= 0 && core <= apic_max_id());
+    KASSERT(ahci_msi_cap && "AHCI MSI not set up yet");
+
+    /* The MSI address uses logical destination mode (see MSI_ADDRESS_FOR),
+     * and core n's logical id is (1 << n). */
+    uint32_t addr = MSI_ADDRESS_FOR(1 << core);
+    if (ahci_msi_cap->control.c64)
+    {
+        ahci_msi_cap->address_data.ad64.addr = addr;
+    }
+    else
+    {
+        ahci_msi_cap->address_data.ad32.addr = addr;
+    }
+    dbg(DBG_DISK, "steering AHCI MSI to C%ld\n", core);
+}
+
 /**
  * Read the given number of blocks from a block device starting at
  * a given block number into a buffer.
@@ -525,3 +995,275 @@ long sata_write_block(blockdev_t *bdev, const char *buf, blocknum_t block,
     long status = ahci_do_operation(bdev_to_ata_disk(bdev)->port, block * SATA_SECTORS_PER_BLOCK, block_count * SATA_SECTORS_PER_BLOCK, (void*) buf, 1);
     return status;
 }
+
+/**
+ * Services a vectored request by coalescing runs of segments that are
+ * contiguous on disk into single scatter-gather commands, so that e.g. a
+ * flush of many discontiguous pframes covering adjacent blocks costs one
+ * command rather than one command per block.
+ *
+ * @param  bdev   block device to operate on
+ * @param  iov    segments to transfer, sorted by block number
+ * @param  iovcnt the number of segments
+ * @param  write  nonzero to write, zero to read
+ * @return        0 on success and <0 on error
+ */
+static long sata_rw_vector(blockdev_t *bdev, blockdev_iovec_t *iov,
+                           size_t iovcnt, int write)
+{
+    ata_disk_t *disk = bdev_to_ata_disk(bdev);
+    size_t i = 0;
+    while (i < iovcnt)
+    {
+        ahci_sg_t sgl[ACHI_NUM_PRDTS_PER_COMMAND_TABLE];
+        size_t nsegs = 0;
+        ssize_t lba = (ssize_t)iov[i].biov_block * SATA_SECTORS_PER_BLOCK;
+        blocknum_t next_block = iov[i].biov_block;
+        while (i < iovcnt && nsegs < ACHI_NUM_PRDTS_PER_COMMAND_TABLE &&
+               iov[i].biov_block == next_block)
+        {
+            sgl[nsegs].sg_buf = iov[i].biov_buf;
+            sgl[nsegs].sg_count =
+                (uint16_t)(iov[i].biov_count * SATA_SECTORS_PER_BLOCK);
+            next_block += iov[i].biov_count;
+            nsegs++;
+            i++;
+        }
+        long status = ahci_do_operation_sg(disk->port, lba, sgl, nsegs, write);
+        if (status)
+        {
+            return status;
+        }
+    }
+    return 0;
+}
+
+long sata_read_vector(blockdev_t *bdev, blockdev_iovec_t *iov, size_t iovcnt)
+{
+    return sata_rw_vector(bdev, iov, iovcnt, 0);
+}
+
+long sata_write_vector(blockdev_t *bdev, blockdev_iovec_t *iov, size_t iovcnt)
+{
+    return sata_rw_vector(bdev, iov, iovcnt, 1);
+}
+
+/* Bound on the busy-wait loops in sata_write_poll: generous enough to
+ * cover a slow device flush, finite so a wedged device cannot hang the
+ * panic path forever. */
+#define SATA_POLL_SPINS 100000000UL
+
+/*
+ * Writes one block with no interrupts, no sleeping, and no locks: the
+ * command is built against the port's hardware state alone, the doorbell
+ * is rung, and we spin until the device retires it. This is the panic
+ * path's only way onto the disk (see util/crashdump.c) - mid-panic the
+ * completion interrupt, the scheduler, and whoever holds the port locks
+ * can no longer be trusted. The port is first drained (the hardware
+ * clears px_ci/px_sact on completion even with interrupts dead), then a
+ * plain non-NCQ WRITE DMA EXT is issued on slot 0, since mixing it with
+ * in-flight NCQ commands would be a protocol violation. The buffer must
+ * be one page-aligned block, so it forms a single physically contiguous
+ * PRD.
+ */
+long sata_write_poll(blockdev_t *bdev, const char *buf, blocknum_t block)
+{
+    hba_port_t *port = bdev_to_ata_disk(bdev)->port;
+    ssize_t lba = (ssize_t)block * SATA_SECTORS_PER_BLOCK;
+
+    size_t spins = 0;
+    while (port->px_sact | port->px_ci)
+    {
+        if (++spins == SATA_POLL_SPINS)
+        {
+            return -EBUSY;
+        }
+    }
+
+    command_list_t *command_list =
+        (command_list_t *)(port->px_clb + PHYS_OFFSET);
+    command_header_t *command_header = command_list->command_headers;
+    memset(command_header, 0, sizeof(command_header_t));
+    command_header->cfl = sizeof(h2d_register_fis_t) / sizeof(uint32_t);
+    command_header->write = 1;
+    command_header->prdtl = 1;
+
+    command_table_t *command_table =
+        (command_table_t *)(command_header->ctba + PHYS_OFFSET);
+    memset(command_table, 0, sizeof(command_table_t));
+    command_table->prdt[0].dba = pt_virt_to_phys((uintptr_t)buf);
+    command_table->prdt[0].dbc = SATA_BLOCK_SIZE - 1;
+
+    h2d_register_fis_t *command_fis = &command_table->cfis.h2d_register_fis;
+    command_fis->fis_type = fis_type_h2d_register;
+    command_fis->c = 1;
+    command_fis->device = ATA_DEVICE_LBA_MODE;
+    command_fis->lba = (uint32_t)lba;
+    command_fis->lba_exp = (uint32_t)(lba >> 24);
+    command_fis->sector_count = SATA_SECTORS_PER_BLOCK;
+    command_fis->command = ATA_WRITE_DMA_EXT_COMMAND;
+
+    port->px_ci |= 1;
+    spins = 0;
+    while (port->px_ci & 1)
+    {
+        if (++spins == SATA_POLL_SPINS)
+        {
+            return -EIO;
+        }
+    }
+    /* Swallow the completion; nobody is left to service the interrupt. */
+    port->px_is = px_interrupt_status_clear;
+    return 0;
+}
+
+/* How long sata_read_poll waits for a port to go idle before giving up
+ * and deferring to the interrupt path: short, because a command already
+ * in flight means a full device access is ahead of us and the latency
+ * win is gone anyway. */
+#define SATA_READ_POLL_DRAIN_SPINS 1000
+
+/*
+ * Opt-in polled completion for a latency-critical single-block read
+ * (reached through blockdev_read_poll): when the port is idle, a plain
+ * READ DMA EXT is issued with the port's interrupts masked and retired
+ * by spinning on px_ci, skipping the interrupt round trip, the deferred
+ * bottom half, and two scheduler hops. Preemption is disabled across
+ * the spin so the expected few-microsecond completion is not stretched
+ * by a context switch.
+ *
+ * Only available in serialized mode: holding the NCQ workaround mutex
+ * then makes this thread the port's only user, and mixing a non-NCQ
+ * command with in-flight tagged commands would be a protocol violation
+ * (-ENOTSUP under parallel NCQ; -EBUSY if the port will not drain).
+ * Callers fall back to the interrupt path on either. The buffer must be
+ * one page-aligned block in the physmap, so it forms a single
+ * physically contiguous PRD.
+ */
+long sata_read_poll(blockdev_t *bdev, char *buf, blocknum_t block)
+{
+    if (ahci_parallel_ncq)
+    {
+        return -ENOTSUP;
+    }
+
+    hba_port_t *port = bdev_to_ata_disk(bdev)->port;
+    ssize_t lba = (ssize_t)block * SATA_SECTORS_PER_BLOCK;
+
+    kmutex_lock(&because_qemu_doesnt_emulate_ahci_ncq_correctly);
+
+    /* The engines can be busy briefly even with the mutex held (e.g. a
+     * lost-interrupt harvest just reissued a command); give them a
+     * moment, then defer rather than wait out a whole device access. */
+    size_t spins = 0;
+    while (port->px_sact | port->px_ci)
+    {
+        if (++spins == SATA_READ_POLL_DRAIN_SPINS)
+        {
+            kmutex_unlock(&because_qemu_doesnt_emulate_ahci_ncq_correctly);
+            return -EBUSY;
+        }
+    }
+
+    preemption_disable();
+
+    /* Mask the port's interrupts: the completion is consumed right here,
+     * and the handler must not race us for px_is (it has no record of a
+     * command on slot 0 anyway). */
+    port->px_ie.value = 0;
+
+    command_list_t *command_list =
+        (command_list_t *)(port->px_clb + PHYS_OFFSET);
+    command_header_t *command_header = command_list->command_headers;
+    memset(command_header, 0, sizeof(command_header_t));
+    command_header->cfl = sizeof(h2d_register_fis_t) / sizeof(uint32_t);
+    command_header->prdtl = 1;
+
+    command_table_t *command_table =
+        (command_table_t *)(command_header->ctba + PHYS_OFFSET);
+    memset(command_table, 0, sizeof(command_table_t));
+    command_table->prdt[0].dba = pt_virt_to_phys((uintptr_t)buf);
+    command_table->prdt[0].dbc = SATA_BLOCK_SIZE - 1;
+
+    h2d_register_fis_t *command_fis = &command_table->cfis.h2d_register_fis;
+    command_fis->fis_type = fis_type_h2d_register;
+    command_fis->c = 1;
+    command_fis->device = ATA_DEVICE_LBA_MODE;
+    command_fis->lba = (uint32_t)lba;
+    command_fis->lba_exp = (uint32_t)(lba >> 24);
+    command_fis->sector_count = SATA_SECTORS_PER_BLOCK;
+    command_fis->command = ATA_READ_DMA_EXT_COMMAND;
+
+    port->px_ci |= 1;
+    spins = 0;
+    while (port->px_ci & 1)
+    {
+        if (++spins == SATA_POLL_SPINS)
+        {
+            /* The device sat on a read for on the order of seconds; it
+             * is effectively gone. Interrupts stay masked so that a
+             * late completion cannot confuse the handler. */
+            preemption_enable();
+            kmutex_unlock(&because_qemu_doesnt_emulate_ahci_ncq_correctly);
+            return -EIO;
+        }
+    }
+
+    /* Consume the completion and rearm the port. */
+    port->px_is = px_interrupt_status_clear;
+    port->px_ie = px_interrupt_enable_all_enabled;
+
+    preemption_enable();
+    kmutex_unlock(&because_qemu_doesnt_emulate_ahci_ncq_correctly);
+    return 0;
+}
+
+/*
+ * Returns the number of SATA commands currently in flight across all
+ * ports (the popcount of the outstanding tag/slot bitmaps). Unlocked
+ * snapshot; used by the stats devices (see drivers/statdev.c).
+ */
+size_t sata_queue_depth()
+{
+    size_t depth = 0;
+    for (unsigned i = 0; i < AHCI_MAX_NUM_PORTS; i++)
+    {
+        /* no libgcc, so count bits by hand (Kernighan's method) */
+        for (uint32_t bits = outstanding_requests[i]; bits; bits &= bits - 1)
+        {
+            depth++;
+        }
+    }
+    return depth;
+}
+
+/*
+ * Formats the per-phase command latency histograms: one "bucket:count"
+ * pair per nonzero log2 bucket (bucket b covers [2^b, 2^(b+1)) TSC
+ * cycles) for time spent waiting to submit ("queue") and time the device
+ * took from doorbell to completion wakeup ("device"). For the kshell
+ * 'disklat' command.
+ */
+size_t sata_latency_info(char *buf, size_t size)
+{
+    size_t off = (size_t)snprintf(buf, size, "queue");
+    for (long b = 0; b < SATA_LAT_BUCKETS; b++)
+    {
+        if (sata_queue_hist[b])
+        {
+            off += snprintf(buf + off, size - off, " %ld:%lu", b,
+                            sata_queue_hist[b]);
+        }
+    }
+    off += snprintf(buf + off, size - off, "\ndevice");
+    for (long b = 0; b < SATA_LAT_BUCKETS; b++)
+    {
+        if (sata_device_hist[b])
+        {
+            off += snprintf(buf + off, size - off, " %ld:%lu", b,
+                            sata_device_hist[b]);
+        }
+    }
+    off += snprintf(buf + off, size - off, "\n");
+    return off;
+}
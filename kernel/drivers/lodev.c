@@ -0,0 +1,295 @@
+#include "errno.h"
+#include "globals.h"
+
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+
+#include "drivers/chardev.h"
+#include "drivers/lodev.h"
+
+#include "main/apic.h"
+#include "main/interrupt.h"
+
+#include "proc/sched.h"
+
+#include "fs/poll.h"
+
+/*
+ * Loopback packet device.
+ *
+ * The data path is deliberately shaped like interrupt-driven network
+ * receive, so the scheduler and wakeup machinery see the same load a NIC
+ * driver would generate:
+ *
+ *   - write() stages the packet in a submit ring and raises a self-IPI on
+ *     INTR_NET_SOFTIRQ; the sender returns without touching the receive
+ *     side, just as a transmitting thread never runs the rx path inline.
+ *
+ *   - the interrupt handler only defers lo_softirq_run via intr_defer, so
+ *     packet processing runs to completion on the interrupt exit path with
+ *     interrupts enabled - the softirq discipline. It drains the whole
+ *     submit backlog in one pass and wakes readers once per burst.
+ *
+ *   - packets travel submit ring -> softirq -> receive ring by pointer
+ *     only: each packet lives in one page from a fixed pool, the payload
+ *     is copied exactly once in (from the writer) and once out (to the
+ *     reader), and the page goes back to the pool when the reader is done.
+ *
+ * When the submit ring or the pool is exhausted, write() drops the packet
+ * and returns -EAGAIN rather than blocking - high offered load should
+ * translate into drops and back-pressure through poll(), not into
+ * convoying submitters, which is the behavior network servers tune for.
+ *
+ * Thread-context critical sections raise the IPL to INTR_NET_SOFTIRQ
+ * before taking lo_lock: the deferred closure takes the same lock on the
+ * interrupt exit path, so a core that fielded the self-IPI while one of
+ * its own threads held the lock would otherwise spin against itself.
+ */
+
+#define LO_RING_SLOTS 64 /* must be a power of two */
+#define LO_RING_MASK (LO_RING_SLOTS - 1)
+#define LO_POOL_PAGES (2 * LO_RING_SLOTS)
+
+typedef struct lo_pkt
+{
+    void *lp_buf;
+    size_t lp_len;
+} lo_pkt_t;
+
+/* Submit and receive rings; head/tail are free-running counters, so the
+ * ring is full when head - tail == LO_RING_SLOTS and empty when they are
+ * equal. */
+static lo_pkt_t lo_txring[LO_RING_SLOTS];
+static size_t lo_tx_head;
+static size_t lo_tx_tail;
+
+static lo_pkt_t lo_rxring[LO_RING_SLOTS];
+static size_t lo_rx_head;
+static size_t lo_rx_tail;
+
+/* Fixed pool of packet pages, managed as a stack. */
+static void *lo_pool[LO_POOL_PAGES];
+static size_t lo_pool_count;
+
+static spinlock_t lo_lock = SPINLOCK_INITIALIZER(lo_lock);
+static ktqueue_t lo_read_queue;
+
+static size_t lo_submitted;
+static size_t lo_delivered;
+static size_t lo_dropped;
+
+static ssize_t lo_read(chardev_t *dev, size_t pos, void *buf, size_t count);
+
+static ssize_t lo_write(chardev_t *dev, size_t pos, const void *buf,
+                        size_t count);
+
+static long lo_poll(chardev_t *dev, int events);
+
+chardev_ops_t lo_dev_ops = {.read = lo_read,
+                            .write = lo_write,
+                            .poll = lo_poll,
+                            .mmap = NULL,
+                            .fill_pframe = NULL,
+                            .flush_pframe = NULL};
+
+/*
+ * Deferred bottom half of the loopback softirq: moves every staged packet
+ * to the receive ring and wakes readers once for the whole burst. Runs on
+ * the interrupt exit path of whichever core fielded the self-IPI.
+ */
+static void lo_softirq_run(void *arg)
+{
+    spinlock_lock(&lo_lock);
+    size_t moved = 0;
+    while (lo_tx_head != lo_tx_tail &&
+           lo_rx_head - lo_rx_tail < LO_RING_SLOTS)
+    {
+        lo_rxring[lo_rx_head & LO_RING_MASK] =
+            lo_txring[lo_tx_tail & LO_RING_MASK];
+        lo_rx_head++;
+        lo_tx_tail++;
+        moved++;
+    }
+    lo_delivered += moved;
+    spinlock_unlock(&lo_lock);
+
+    if (moved)
+    {
+        uint8_t ipl = intr_setipl(IPL_HIGH);
+        sched_broadcast_on(&lo_read_queue);
+        intr_setipl(ipl);
+        poll_notify(); /* pollers waiting on the device now see POLLIN */
+    }
+}
+
+static long lo_intr_handler(regs_t *regs)
+{
+    intr_defer(lo_softirq_run, NULL);
+    return 0;
+}
+
+/*
+ * Registers the loopback packet device (node created in make_devices())
+ * and claims the softirq vector it delivers packets on.
+ */
+void lodev_init()
+{
+    for (size_t i = 0; i < LO_POOL_PAGES; i++)
+    {
+        lo_pool[i] = page_alloc();
+        KASSERT(lo_pool[i]);
+    }
+    lo_pool_count = LO_POOL_PAGES;
+
+    sched_queue_init(&lo_read_queue);
+
+    intr_handler_t old = intr_register(INTR_NET_SOFTIRQ, lo_intr_handler);
+    KASSERT(old == NULL);
+
+    chardev_t *dev = kmalloc(sizeof(chardev_t));
+    KASSERT(dev);
+    dev->cd_id = MKDEVID(LO_MAJOR, 0);
+    dev->cd_ops = &lo_dev_ops;
+    long status = chardev_register(dev);
+    KASSERT(!status);
+}
+
+/**
+ * Receives one packet: blocks until the receive ring is non-empty, then
+ * copies the packet (truncated to count bytes) out and recycles its page.
+ * If packets are still staged in the submit ring because the receive ring
+ * was full, re-raises the softirq now that a slot has been freed.
+ *
+ * @param  dev   the loopback device
+ * @param  pos   ignored
+ * @param  buf   the buffer to receive into
+ * @param  count the maximum number of bytes to receive
+ * @return       the packet length (possibly truncated to count), or
+ *               -EINTR if the wait was cancelled
+ */
+static ssize_t lo_read(chardev_t *dev, size_t pos, void *buf, size_t count)
+{
+    uint8_t ipl = intr_setipl(INTR_NET_SOFTIRQ);
+    spinlock_lock(&lo_lock);
+
+    while (lo_rx_head == lo_rx_tail)
+    {
+        long status = sched_cancellable_sleep_on(&lo_read_queue, &lo_lock);
+        if (status < 0)
+        {
+            spinlock_unlock(&lo_lock);
+            intr_setipl(ipl);
+            return status;
+        }
+    }
+
+    lo_pkt_t pkt = lo_rxring[lo_rx_tail & LO_RING_MASK];
+    lo_rx_tail++;
+
+    ssize_t ret = (ssize_t)MIN(count, pkt.lp_len);
+    memcpy(buf, pkt.lp_buf, (size_t)ret);
+
+    KASSERT(lo_pool_count < LO_POOL_PAGES);
+    lo_pool[lo_pool_count++] = pkt.lp_buf;
+    long backlog = lo_tx_head != lo_tx_tail;
+
+    spinlock_unlock(&lo_lock);
+    intr_setipl(ipl);
+
+    if (backlog)
+    {
+        apic_send_ipi((uint8_t)apic_current_id(), DESTINATION_MODE_FIXED,
+                      INTR_NET_SOFTIRQ);
+    }
+    poll_notify(); /* a submit slot and a pool page opened up */
+    return ret;
+}
+
+/**
+ * Submits one packet of up to LO_MAX_PACKET bytes and raises the softirq
+ * that will deliver it. Never blocks: if the submit ring or the packet
+ * pool is exhausted the packet is dropped, as a saturated NIC would.
+ *
+ * @param  dev   the loopback device
+ * @param  pos   ignored
+ * @param  buf   the packet payload
+ * @param  count the payload length (truncated to LO_MAX_PACKET)
+ * @return       the number of bytes accepted, or -EAGAIN on a drop
+ */
+static ssize_t lo_write(chardev_t *dev, size_t pos, const void *buf,
+                        size_t count)
+{
+    count = MIN(count, (size_t)LO_MAX_PACKET);
+
+    uint8_t ipl = intr_setipl(INTR_NET_SOFTIRQ);
+    spinlock_lock(&lo_lock);
+
+    if (lo_tx_head - lo_tx_tail == LO_RING_SLOTS || !lo_pool_count)
+    {
+        lo_dropped++;
+        spinlock_unlock(&lo_lock);
+        intr_setipl(ipl);
+        return -EAGAIN;
+    }
+
+    void *page = lo_pool[--lo_pool_count];
+    memcpy(page, buf, count);
+
+    lo_pkt_t *slot = &lo_txring[lo_tx_head & LO_RING_MASK];
+    slot->lp_buf = page;
+    slot->lp_len = count;
+    lo_tx_head++;
+    lo_submitted++;
+
+    spinlock_unlock(&lo_lock);
+    intr_setipl(ipl);
+
+    apic_send_ipi((uint8_t)apic_current_id(), DESTINATION_MODE_FIXED,
+                  INTR_NET_SOFTIRQ);
+    return (ssize_t)count;
+}
+
+/*
+ * POLLIN when a packet is waiting in the receive ring; POLLOUT when a
+ * submit would be accepted (a ring slot and a pool page are both free).
+ */
+static long lo_poll(chardev_t *dev, int events)
+{
+    uint8_t ipl = intr_setipl(INTR_NET_SOFTIRQ);
+    spinlock_lock(&lo_lock);
+
+    long ready = 0;
+    if (lo_rx_head != lo_rx_tail)
+    {
+        ready |= POLLIN;
+    }
+    if (lo_tx_head - lo_tx_tail < LO_RING_SLOTS && lo_pool_count)
+    {
+        ready |= POLLOUT;
+    }
+
+    spinlock_unlock(&lo_lock);
+    intr_setipl(ipl);
+    return ready & events;
+}
+
+size_t lodev_info(char *buf, size_t size)
+{
+    uint8_t ipl = intr_setipl(INTR_NET_SOFTIRQ);
+    spinlock_lock(&lo_lock);
+    size_t submitted = lo_submitted;
+    size_t delivered = lo_delivered;
+    size_t dropped = lo_dropped;
+    size_t queued = lo_rx_head - lo_rx_tail;
+    spinlock_unlock(&lo_lock);
+    intr_setipl(ipl);
+
+    return (size_t)snprintf(buf, size,
+                            "submitted %lu\ndelivered %lu\ndropped %lu\n"
+                            "queued %lu\n",
+                            submitted, delivered, dropped, queued);
+}
@@ -495,6 +495,28 @@ void vga_write_char_at(size_t row, size_t col, uint16_t v)
     vga_textbuffer[(row * VGA_WIDTH) + col] = v;
 }
 
+/*
+ * Scrolls the text buffer up by the given number of lines with a single
+ * buffer move instead of rewriting every cell, blanking the rows that come
+ * in at the bottom.
+ */
+void vga_scroll_up(size_t lines)
+{
+    if (lines > VGA_HEIGHT)
+    {
+        lines = VGA_HEIGHT;
+    }
+    for (size_t i = 0; i < VGA_HEIGHT - lines; i++)
+    {
+        memcpy(vga_textbuffer + (i * VGA_WIDTH),
+               vga_textbuffer + ((i + lines) * VGA_WIDTH), VGA_LINE_SIZE);
+    }
+    for (size_t i = VGA_HEIGHT - lines; i < VGA_HEIGHT; i++)
+    {
+        memcpy(vga_textbuffer + (i * VGA_WIDTH), vga_blank_row, VGA_LINE_SIZE);
+    }
+}
+
 static char *shutdown_message = "Weenix has halted cleanly!";
 void screen_print_shutdown()
 {
@@ -0,0 +1,198 @@
+#include "errno.h"
+#include "globals.h"
+
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pageoutd.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+#include "mm/swap.h"
+#include "mm/swapcomp.h"
+
+#include "drivers/chardev.h"
+#include "drivers/disk/sata.h"
+#include "drivers/lodev.h"
+#include "drivers/statdev.h"
+
+#include "main/apic.h"
+
+#include "proc/balanced.h"
+#include "proc/sched.h"
+
+#include "api/syscall.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+
+#ifdef __S5FS__
+#include "fs/s5fs/s5fs.h"
+#endif
+
+static ssize_t stat_read(chardev_t *dev, size_t pos, void *buf, size_t count);
+
+static ssize_t stat_write(chardev_t *dev, size_t pos, const void *buf,
+                          size_t count);
+
+chardev_ops_t stat_dev_ops = {.read = stat_read,
+                              .write = stat_write,
+                              .mmap = NULL,
+                              .fill_pframe = NULL,
+                              .flush_pframe = NULL};
+
+/*
+ * Create and register one chardev per statistic. The minor number selects
+ * the metric (see dev.h); the nodes themselves are created in
+ * make_devices() under /dev/stats.
+ */
+void statdev_init()
+{
+    for (long i = 0; i < STAT_NUM_MINORS; i++)
+    {
+        chardev_t *dev = kmalloc(sizeof(chardev_t));
+        KASSERT(dev);
+        dev->cd_id = MKDEVID(STAT_MAJOR, i);
+        dev->cd_ops = &stat_dev_ops;
+        long status = chardev_register(dev);
+        KASSERT(!status);
+    }
+}
+
+/**
+ * Reads a text snapshot of the statistic selected by the device's minor
+ * number. The snapshot is formatted in full on every call and the
+ * [pos, pos + count) window is copied out, so sequential reads through
+ * do_read() (which advances f_pos) see one consistent document per open.
+ *
+ * @param  dev   the stats device
+ * @param  pos   offset into the formatted snapshot
+ * @param  buf   the buffer to read into
+ * @param  count the maximum number of bytes to read
+ * @return       the number of bytes read, 0 at end-of-file, or -ENXIO for
+ *               an unknown minor
+ */
+static ssize_t stat_read(chardev_t *dev, size_t pos, void *buf, size_t count)
+{
+    char *scratch = page_alloc();
+    if (!scratch)
+    {
+        return -ENOMEM;
+    }
+
+    size_t len = 0;
+    switch (MINOR(dev->cd_id))
+    {
+    case STAT_RUNQ_MINOR:
+        for (long core = 0; core <= apic_max_id(); core++)
+        {
+            len += snprintf(scratch + len, PAGE_SIZE - len, "C%ld %lu\n",
+                            core, sched_runq_depth(core));
+        }
+        break;
+    case STAT_CTXSWITCH_MINOR:
+        for (long core = 0; core <= apic_max_id(); core++)
+        {
+            len += snprintf(scratch + len, PAGE_SIZE - len, "C%ld %lu\n",
+                            core, sched_context_switches(core));
+        }
+        break;
+    case STAT_PAGEFREE_MINOR:
+        len = (size_t)snprintf(scratch, PAGE_SIZE, "%lu\n", page_free_count());
+        break;
+    case STAT_SLAB_MINOR:
+        len = slab_allocators_info(scratch, PAGE_SIZE);
+        break;
+    case STAT_SATA_MINOR:
+        len = (size_t)snprintf(scratch, PAGE_SIZE, "%lu\n", sata_queue_depth());
+        break;
+    case STAT_KMALLOC_MINOR:
+        len = kmalloc_info(scratch, PAGE_SIZE);
+        break;
+    case STAT_SCHEDLAT_MINOR:
+        len = sched_latency_info(scratch, PAGE_SIZE);
+        len += balanced_info(scratch + len, PAGE_SIZE - len);
+        break;
+    case STAT_SYSCALL_MINOR:
+        len = syscall_stats_info(scratch, PAGE_SIZE);
+        break;
+    case STAT_MOUNT_MINOR:
+        len = vfs_mount_info(scratch, PAGE_SIZE);
+        break;
+    case STAT_SWAP_MINOR:
+        len = swap_info(scratch, PAGE_SIZE);
+        len += swapcomp_info(scratch + len, PAGE_SIZE - len);
+        break;
+    case STAT_LODEV_MINOR:
+        len = lodev_info(scratch, PAGE_SIZE);
+        break;
+    case STAT_READAHEAD_MINOR:
+        len = (size_t)snprintf(scratch, PAGE_SIZE, "used %lu wasted %lu\n",
+                               pframe_ra_used, pframe_ra_wasted);
+#ifdef __S5FS__
+        len += s5_readahead_info(scratch + len, PAGE_SIZE - len);
+#endif
+        break;
+    case STAT_RESIDENT_MINOR:
+        len = (size_t)snprintf(scratch, PAGE_SIZE, "quota %lu\n",
+                               pageoutd_get_proc_quota());
+        len += proc_resident_info(scratch + len, PAGE_SIZE - len);
+        break;
+    default:
+        page_free(scratch);
+        return -ENXIO;
+    }
+
+    /*
+     * The formatters report the would-be length when the snapshot outgrows
+     * the page; clamp so the copy-out window stays inside the allocation.
+     */
+    if (len > PAGE_SIZE)
+    {
+        len = PAGE_SIZE;
+    }
+    if (pos >= len)
+    {
+        page_free(scratch);
+        return 0;
+    }
+    if (count > len - pos)
+    {
+        count = len - pos;
+    }
+    memcpy(buf, scratch + pos, count);
+    page_free(scratch);
+    return (ssize_t)count;
+}
+
+/**
+ * The stats devices are read-only, except for the resident-pages device:
+ * writing a decimal page count to it sets the per-process resident quota
+ * (0 disables the quota; see mm/pageoutd.c).
+ *
+ * @return the number of bytes consumed, or -EINVAL for a read-only minor
+ *         or an unparsable write
+ */
+static ssize_t stat_write(chardev_t *dev, size_t pos, const void *buf,
+                          size_t count)
+{
+    if (MINOR(dev->cd_id) != STAT_RESIDENT_MINOR)
+    {
+        return -EINVAL;
+    }
+    const char *s = buf;
+    size_t quota = 0;
+    size_t i = 0;
+    for (; i < count && s[i] >= '0' && s[i] <= '9'; i++)
+    {
+        quota = quota * 10 + (size_t)(s[i] - '0');
+    }
+    if (!i)
+    {
+        return -EINVAL;
+    }
+    pageoutd_set_proc_quota(quota);
+    return (ssize_t)count;
+}
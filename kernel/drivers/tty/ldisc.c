@@ -2,6 +2,7 @@
 #include <drivers/keyboard.h>
 #include <drivers/tty/tty.h>
 #include <errno.h>
+#include <fs/poll.h>
 #include <util/bits.h>
 #include <util/debug.h>
 #include <util/string.h>
@@ -24,6 +25,50 @@ void ldisc_init(ldisc_t *ldisc)
     for (int i = 0; i < LDISC_BUFFER_SIZE; i++) {
         ldisc->ldisc_buffer[i] = '\0';
     }
+    ldisc->ldisc_echo_len = 0;
+    ldisc->ldisc_wakeup_pending = 0;
+}
+
+/**
+ * Stages a byte to be echoed to the vterminal on the next flush, flushing
+ * early if the staging buffer is full.
+ *
+ * @param ldisc the line discipline
+ * @param c     the byte to echo
+ */
+static void ldisc_echo(ldisc_t *ldisc, char c)
+{
+    if (ldisc->ldisc_echo_len == LDISC_BUFFER_SIZE) {
+        vterminal_write(&ldisc_to_tty(ldisc)->tty_vterminal,
+                        ldisc->ldisc_echo_buffer, ldisc->ldisc_echo_len);
+        ldisc->ldisc_echo_len = 0;
+    }
+    ldisc->ldisc_echo_buffer[ldisc->ldisc_echo_len] = c;
+    ldisc->ldisc_echo_len = ldisc->ldisc_echo_len + 1;
+}
+
+/**
+ * Emits everything ldisc_key_pressed staged since the last flush: the echo
+ * bytes go to the vterminal in a single write, and sleeping readers are
+ * woken once if any line was cooked. Called once per burst of input rather
+ * than once per keystroke (see the tty input worker in tty.c).
+ *
+ * @param ldisc the line discipline
+ */
+void ldisc_flush_batch(ldisc_t *ldisc)
+{
+    if (ldisc->ldisc_echo_len) {
+        vterminal_write(&ldisc_to_tty(ldisc)->tty_vterminal,
+                        ldisc->ldisc_echo_buffer, ldisc->ldisc_echo_len);
+        ldisc->ldisc_echo_len = 0;
+    }
+    if (ldisc->ldisc_wakeup_pending) {
+        ldisc->ldisc_wakeup_pending = 0;
+        /* Broadcast rather than wake one: a burst may have cooked several
+         * lines, and ldisc_wait_read re-checks before reading anyway. */
+        sched_broadcast_on(&ldisc->ldisc_read_queue);
+        poll_notify(); /* pollers waiting on the tty now see POLLIN */
+    }
 }
 
 /**
@@ -166,6 +211,10 @@ size_t ldisc_read(ldisc_t *ldisc, char *buf, size_t count)
  * Don't forget to write the corresponding characters to the virtual terminal
  * when it applies!
  *
+ * Note that echo bytes and reader wakeups are not performed inline: they are
+ * staged on the ldisc and emitted by ldisc_flush_batch, which the tty input
+ * worker calls once per burst of keystrokes.
+ *
  * @param ldisc the line discipline
  * @param c     the new character
  */
@@ -187,15 +236,15 @@ void ldisc_key_pressed(ldisc_t *ldisc, char c)
         ldisc->ldisc_buffer[ldisc->ldisc_head] = c;
         ldisc->ldisc_head = ldisc_increment(ldisc->ldisc_head);
         ldisc->ldisc_cooked = ldisc->ldisc_head;
-        sched_wakeup_on(&ldisc->ldisc_read_queue, NULL);
-        vterminal_write(&ldisc_to_tty(ldisc)->tty_vterminal, "\n", 1);
+        ldisc->ldisc_wakeup_pending = 1;
+        ldisc_echo(ldisc, '\n');
         return;
     }
     if (c == EOT) {
         ldisc->ldisc_buffer[ldisc->ldisc_head] = c;
         ldisc->ldisc_head = ldisc_increment(ldisc->ldisc_head);
         ldisc->ldisc_cooked = ldisc->ldisc_head;
-        sched_wakeup_on(&ldisc->ldisc_read_queue, NULL);
+        ldisc->ldisc_wakeup_pending = 1;
         return;
     }
     if (c == ETX) {
@@ -210,12 +259,12 @@ void ldisc_key_pressed(ldisc_t *ldisc, char c)
             return;
         }
         ldisc->ldisc_head = ldisc_decrement(ldisc->ldisc_head);
-        vterminal_write(&ldisc_to_tty(ldisc)->tty_vterminal, "\b", 1);
+        ldisc_echo(ldisc, BS);
         return;
     }
     ldisc->ldisc_buffer[ldisc->ldisc_head] = c;
     ldisc->ldisc_head = ldisc_increment(ldisc->ldisc_head);
-    vterminal_key_pressed(&ldisc_to_tty(ldisc)->tty_vterminal);
+    ldisc_echo(ldisc, c);
 }
 
 /**
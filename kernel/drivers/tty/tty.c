@@ -2,9 +2,16 @@
 #include "drivers/chardev.h"
 #include "drivers/dev.h"
 #include "drivers/keyboard.h"
+#include "fs/poll.h"
 #include "kernel.h"
+#include "main/apic.h"
+#include "main/interrupt.h"
 #include "mm/kmalloc.h"
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
 #include "util/debug.h"
+#include "util/string.h"
 #include <errno.h>
 
 #ifndef NTERMS
@@ -13,9 +20,11 @@
 
 ssize_t tty_read(chardev_t *cdev, size_t pos, void *buf, size_t count);
 ssize_t tty_write(chardev_t *cdev, size_t pos, const void *buf, size_t count);
+long tty_poll(chardev_t *cdev, int events);
 
 chardev_ops_t tty_cdev_ops = {.read = tty_read,
                               .write = tty_write,
+                              .poll = tty_poll,
                               .mmap = NULL,
                               .fill_pframe = NULL,
                               .flush_pframe = NULL};
@@ -28,6 +37,109 @@ spinlock_t active_tty_lock = SPINLOCK_INITIALIZER(active_tty_lock);
 
 static void tty_receive_char_multiplexer(uint8_t c);
 
+/*
+ * Input ring between the keyboard interrupt and the tty input worker. The
+ * interrupt handler only appends a byte and (when the ring was empty) wakes
+ * the worker, so a paste-storm of keystrokes costs almost nothing per
+ * interrupt; the worker drains the whole burst in one pass, holding the tty
+ * lock once and doing echo and reader wakeups once per burst via
+ * ldisc_flush_batch. The ring is lock-free: the interrupt is the only
+ * writer of tty_input_head and the worker the only writer of tty_input_tail.
+ */
+#define TTY_INPUT_RING_SIZE 256
+
+static uint8_t tty_input_ring[TTY_INPUT_RING_SIZE];
+static volatile size_t tty_input_head = 0; /* next slot to fill (interrupt) */
+static volatile size_t tty_input_tail = 0; /* next slot to drain (worker) */
+static spinlock_t tty_input_lock = SPINLOCK_INITIALIZER(tty_input_lock);
+static ktqueue_t tty_input_queue;
+static long tty_input_ready = 0;
+
+/* Deferred bottom half of the keyboard interrupt: wakes the input worker
+ * once the interrupt has been acked. Runs with interrupts enabled, so the
+ * IPL is raised around the queue traffic it shares with interrupt context.
+ */
+static void tty_input_wake(void *arg)
+{
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    sched_broadcast_on(&tty_input_queue);
+    intr_setipl(ipl);
+}
+
+/*
+ * Most screen work (scrolling, repainting) one output drain pass does
+ * under the tty lock before handing the rest to a fresh closure; this is
+ * what bounds any single hold to a few microseconds.
+ */
+#define TTY_OUT_DRAIN_CHUNK 256
+
+/*
+ * Deferred output drain: moves at most TTY_OUT_DRAIN_CHUNK bytes from a
+ * tty's output ring to its vterminal per invocation, then re-raises the
+ * softirq if a backlog remains (the log-flood case), so neither the
+ * tty lock nor the interrupt exit path is held for an unbounded write.
+ * Runs on the interrupt exit path via intr_defer; thread-context users
+ * of tty_lock are safe against it because they raise the IPL to
+ * INTR_KEYBOARD (above INTR_TTY_SOFTIRQ) first.
+ */
+static void tty_output_drain(void *arg)
+{
+    long backlog = 0;
+
+    for (unsigned i = 0; i < NTERMS; i++)
+    {
+        tty_t *tty = ttys[i];
+        uint8_t ipl = intr_setipl(INTR_KEYBOARD);
+        spinlock_lock(&tty->tty_lock);
+        if (!tty->tty_out_sched)
+        {
+            spinlock_unlock(&tty->tty_lock);
+            intr_setipl(ipl);
+            continue;
+        }
+        size_t budget = TTY_OUT_DRAIN_CHUNK;
+        while (budget && tty->tty_out_tail != tty->tty_out_head)
+        {
+            /* Write one ring-contiguous run. */
+            size_t tail = tty->tty_out_tail & TTY_OUT_RING_MASK;
+            size_t avail = tty->tty_out_head - tty->tty_out_tail;
+            size_t run = MIN(avail, TTY_OUT_RING_SIZE - tail);
+            run = MIN(run, budget);
+            vterminal_write(&tty->tty_vterminal, tty->tty_out_ring + tail,
+                            run);
+            tty->tty_out_tail += run;
+            budget -= run;
+        }
+        if (tty->tty_out_tail != tty->tty_out_head)
+        {
+            backlog = 1;
+        }
+        else
+        {
+            tty->tty_out_sched = 0;
+        }
+        /* Ring space opened up; let stalled writers restock it. */
+        uint8_t wake_ipl = intr_setipl(IPL_HIGH);
+        sched_broadcast_on(&tty->tty_out_waitq);
+        intr_setipl(wake_ipl);
+        spinlock_unlock(&tty->tty_lock);
+        intr_setipl(ipl);
+        poll_notify(); /* pollers may now see POLLOUT again */
+    }
+
+    if (backlog)
+    {
+        apic_send_ipi((uint8_t)apic_current_id(), DESTINATION_MODE_FIXED,
+                      INTR_TTY_SOFTIRQ);
+    }
+}
+
+static long tty_output_intr(regs_t *regs)
+{
+    intr_defer(tty_output_drain, NULL);
+    return 0;
+}
+
 void tty_init()
 {
     for (unsigned i = 0; i < NTERMS; i++)
@@ -44,6 +156,11 @@ void tty_init()
         kmutex_init(&tty->tty_read_mutex);
         spinlock_init(&tty->tty_lock);
 
+        tty->tty_out_head = 0;
+        tty->tty_out_tail = 0;
+        tty->tty_out_sched = 0;
+        sched_queue_init(&tty->tty_out_waitq);
+
         long ret = chardev_register(&tty->tty_cdev);
         KASSERT(!ret);
     }
@@ -51,6 +168,9 @@ void tty_init()
     vterminal_make_active(&ttys[active_tty]->tty_vterminal);
     KASSERT(ttys[active_tty]);
 
+    intr_handler_t old = intr_register(INTR_TTY_SOFTIRQ, tty_output_intr);
+    KASSERT(old == NULL);
+
     keyboard_init(tty_receive_char_multiplexer);
 }
 
@@ -93,9 +213,13 @@ ssize_t tty_read(chardev_t *cdev, size_t pos, void *buf, size_t count)
 /**
  * Writes to the tty from the buffer.
  *
- * You should first lock the write mutex of the tty. Then you can use 
- * `vterminal_write` to write to the terminal. Don't forget to use IPL to 
- * guard this from preemption!
+ * The bytes are only staged into the tty's output ring here; the actual
+ * screen work happens in tty_output_drain, in bounded chunks. The write
+ * mutex keeps concurrent writers' bytes from interleaving, but no lock
+ * is ever held across more than one ring refill, so even a huge write
+ * (a log flood) cannot stall the console: echo and other writers slip
+ * in between chunks. If the ring is full, the writer sleeps until the
+ * drain makes room.
  *
  * @param  cdev  the character device that represents tty
  * @param  pos   the position to start reading from; should be ignored
@@ -105,58 +229,199 @@ ssize_t tty_read(chardev_t *cdev, size_t pos, void *buf, size_t count)
  */
 ssize_t tty_write(chardev_t *cdev, size_t pos, const void *buf, size_t count)
 {
-    tty_t* tty = cd_to_tty(cdev);
-    uint8_t current_ipl = intr_getipl();
-    intr_setipl(INTR_KEYBOARD);
+    tty_t *tty = cd_to_tty(cdev);
+    const char *src = buf;
+    size_t written = 0;
+
     kmutex_lock(&tty->tty_write_mutex);
-    size_t written = vterminal_write(&tty->tty_vterminal, buf, count);
+    while (written < count)
+    {
+        uint8_t ipl = intr_setipl(INTR_KEYBOARD);
+        spinlock_lock(&tty->tty_lock);
+        size_t space;
+        while (!(space = TTY_OUT_RING_SIZE -
+                         (tty->tty_out_head - tty->tty_out_tail)))
+        {
+            /* sched_sleep_on releases the lock; retake it to recheck */
+            sched_sleep_on(&tty->tty_out_waitq, &tty->tty_lock);
+            spinlock_lock(&tty->tty_lock);
+        }
+        size_t chunk = MIN(space, count - written);
+        /* Stage the chunk, in up to two ring-contiguous runs. */
+        size_t staged = 0;
+        while (staged < chunk)
+        {
+            size_t head = tty->tty_out_head & TTY_OUT_RING_MASK;
+            size_t run = MIN(chunk - staged, TTY_OUT_RING_SIZE - head);
+            memcpy(tty->tty_out_ring + head, src + written + staged, run);
+            tty->tty_out_head += run;
+            staged += run;
+        }
+        long kick = !tty->tty_out_sched;
+        tty->tty_out_sched = 1;
+        spinlock_unlock(&tty->tty_lock);
+        intr_setipl(ipl);
+        if (kick)
+        {
+            apic_send_ipi((uint8_t)apic_current_id(), DESTINATION_MODE_FIXED,
+                          INTR_TTY_SOFTIRQ);
+        }
+        written += chunk;
+    }
     kmutex_unlock(&tty->tty_write_mutex);
-    intr_setipl(current_ipl);
-    return written;
+    return (ssize_t)written;
 }
 
-static void tty_receive_char_multiplexer(uint8_t c)
+/*
+ * Reports the tty's current readiness without blocking: readable when the
+ * line discipline has a cooked line (or is full, in which case tty_read
+ * returns immediately anyway), and writable while the output ring has
+ * room (tty_write only sleeps when it is full). A snapshot only --
+ * do_poll rescans after every notification (see ldisc_flush_batch and
+ * tty_output_drain).
+ */
+long tty_poll(chardev_t *cdev, int events)
 {
-    tty_t *tty = ttys[active_tty];
+    tty_t *tty = cd_to_tty(cdev);
+    long revents = 0;
+    spinlock_lock(&tty->tty_lock);
+    ldisc_t *ldisc = &tty->tty_ldisc;
+    if ((events & POLLIN) &&
+        (ldisc->ldisc_cooked != ldisc->ldisc_tail || ldisc->ldisc_full))
+    {
+        revents |= POLLIN;
+    }
+    if ((events & POLLOUT) &&
+        tty->tty_out_head - tty->tty_out_tail < TTY_OUT_RING_SIZE)
+    {
+        revents |= POLLOUT;
+    }
+    spinlock_unlock(&tty->tty_lock);
+    return revents;
+}
 
+/*
+ * Processes one input character against the current tty. Called with
+ * tty->tty_lock held; returns the tty that is current afterward (an F-key
+ * switches terminals, in which case the old tty's batch is flushed, its lock
+ * dropped, and the new tty's lock taken).
+ */
+static tty_t *tty_process_char(tty_t *tty, uint8_t c)
+{
     if (c >= F1 && c <= F12)
     {
-        if (c - F1 < NTERMS)
+        if (c - F1 < NTERMS && (size_t)(c - F1) != active_tty)
         {
-            /* TODO: this is totally unsafe... Fix it */
+            /* The old terminal may have staged echo; emit it before
+             * switching away. */
+            ldisc_flush_batch(&tty->tty_ldisc);
+            spinlock_unlock(&tty->tty_lock);
             active_tty = (unsigned)c - F1;
             tty = ttys[active_tty];
             spinlock_lock(&tty->tty_lock);
             vterminal_make_active(&tty->tty_vterminal);
-            spinlock_unlock(&tty->tty_lock);
         }
-        return;
+        return tty;
     }
     if (c == CR)
         c = LF;
     else if (c == DEL)
         c = BS;
 
-    spinlock_lock(&tty->tty_lock);
     vterminal_t *vt = &tty->tty_vterminal;
     switch ((unsigned)c)
     {
     case SCROLL_DOWN:
     case SCROLL_UP:
-        // vterminal_scroll(vt, c == SCROLL_DOWN ? 1 : -1);
+        vterminal_scroll(vt, c == SCROLL_DOWN ? 1 : -1);
         break;
     case SCROLL_DOWN_PAGE:
     case SCROLL_UP_PAGE:
-        // vterminal_scroll(vt, c == SCROLL_DOWN_PAGE ? vt->vt_height :
-        // -vt->vt_height);
+        vterminal_scroll(vt, c == SCROLL_DOWN_PAGE ? vt->height : -vt->height);
         break;
     case ESC:
-        // vterminal_scroll_to_bottom(vt);
+        vterminal_scroll_to_bottom(vt);
         break;
     default:
         ldisc_key_pressed(&tty->tty_ldisc, c);
         // vterminal_key_pressed(vt);
         break;
     }
-    spinlock_unlock(&tty->tty_lock);
+    return tty;
+}
+
+static void tty_receive_char_multiplexer(uint8_t c)
+{
+    if (!tty_input_ready)
+    {
+        /* The worker has not started yet (early boot); process the
+         * character synchronously, flushing its batch right away. */
+        tty_t *tty = ttys[active_tty];
+        spinlock_lock(&tty->tty_lock);
+        tty = tty_process_char(tty, c);
+        ldisc_flush_batch(&tty->tty_ldisc);
+        spinlock_unlock(&tty->tty_lock);
+        return;
+    }
+
+    size_t head = tty_input_head;
+    size_t next = (head + 1) % TTY_INPUT_RING_SIZE;
+    if (next == tty_input_tail)
+    {
+        /* Ring full; drop the keystroke, as the ldisc would anyway. */
+        return;
+    }
+    tty_input_ring[head] = c;
+    tty_input_head = next;
+    /* Wake the worker only when the ring goes non-empty; keystrokes
+     * arriving mid-burst are picked up by the drain already in progress.
+     * The wakeup itself is deferred to interrupt exit so the keyboard
+     * handler only touches the ring. */
+    if (head == tty_input_tail)
+    {
+        intr_defer(tty_input_wake, NULL);
+    }
+}
+
+static void *tty_input_run(long arg1, void *arg2)
+{
+    dbg(DBG_TERM, "tty input worker running\n");
+    for (;;)
+    {
+        spinlock_lock(&tty_input_lock);
+        while (tty_input_head == tty_input_tail)
+        {
+            /* sched_sleep_on releases the lock; retake it to recheck */
+            sched_sleep_on(&tty_input_queue, &tty_input_lock);
+            spinlock_lock(&tty_input_lock);
+        }
+        spinlock_unlock(&tty_input_lock);
+
+        /* Drain the whole burst with the tty locked once, then do the
+         * echo and the reader wakeups in one go. */
+        tty_t *tty = ttys[active_tty];
+        spinlock_lock(&tty->tty_lock);
+        while (tty_input_tail != tty_input_head)
+        {
+            uint8_t c = tty_input_ring[tty_input_tail];
+            tty_input_tail = (tty_input_tail + 1) % TTY_INPUT_RING_SIZE;
+            tty = tty_process_char(tty, c);
+        }
+        ldisc_flush_batch(&tty->tty_ldisc);
+        spinlock_unlock(&tty->tty_lock);
+    }
+    return NULL;
+}
+
+void tty_input_start()
+{
+    sched_queue_init(&tty_input_queue);
+
+    proc_t *proc = proc_create("tty_input");
+    KASSERT(proc && "couldn't create the tty input worker");
+    kthread_t *thr = kthread_create(proc, tty_input_run, 0, NULL);
+    KASSERT(thr && "couldn't create the tty input worker's thread");
+
+    tty_input_ready = 1;
+    sched_make_runnable(thr);
 }
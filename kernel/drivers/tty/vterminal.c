@@ -639,6 +639,67 @@ void vterminal_key_pressed(vterminal_t *vt)
 #define VGACOLOR_LIGHT_YELLOW 0XE
 #define VGACOLOR_WHITE 0XF
 
+static vterminal_t *active_vt = NULL;
+
+/* --- Damage tracking ------------------------------------------------------ */
+
+// Marks a single row as needing a repaint on the next flush.
+static void vtconsole_damage(vtconsole_t *vtc, int row)
+{
+    if (row >= 0 && row < vtc->height)
+    {
+        vtc->damage |= (uint32_t)1 << row;
+    }
+}
+
+// Marks every row as needing a repaint on the next flush.
+static void vtconsole_damage_all(vtconsole_t *vtc)
+{
+    vtc->damage = ((uint32_t)1 << vtc->height) - 1;
+}
+
+// Returns the cell visible at (x, y) given the current scrollback view:
+// the top sb_view rows come out of the scrollback ring, the rest out of
+// the live cell buffer shifted down by the same amount.
+static vtcell_t *vtconsole_visible_cell(vtconsole_t *vtc, int x, int y)
+{
+    if (y < vtc->sb_view)
+    {
+        int slot = vtc->sb_next - (vtc->sb_view - y);
+        if (slot < 0)
+        {
+            slot += VTC_SCROLLBACK_LINES;
+        }
+        return &vtc->scrollback[(slot * vtc->width) + x];
+    }
+    return &vtc->buffer[((y - vtc->sb_view) * vtc->width) + x];
+}
+
+// Repaints the rows marked dirty since the last flush, and nothing else.
+// Called once per batch of console activity (a whole vtconsole_write, a
+// scroll of the view, a redraw) rather than once per cell mutation, so
+// streaming dbg output only repaints the rows it actually touched.
+void vtconsole_flush_damage(vtconsole_t *vtc)
+{
+    if (!vtc->damage || !vtc->on_paint)
+    {
+        vtc->damage = 0;
+        return;
+    }
+    for (int y = 0; y < vtc->height; y++)
+    {
+        if (!(vtc->damage & ((uint32_t)1 << y)))
+        {
+            continue;
+        }
+        for (int x = 0; x < vtc->width; x++)
+        {
+            vtc->on_paint(vtc, vtconsole_visible_cell(vtc, x, y), x, y);
+        }
+    }
+    vtc->damage = 0;
+}
+
 /* --- Constructor/Destructor ----------------------------------------------- */
 
 // vtconsole contructor/init function
@@ -657,6 +718,13 @@ vtconsole_t *vtconsole(vtconsole_t *vtc, int width, int height,
     vtc->tabs = kmalloc(LDISC_BUFFER_SIZE * sizeof(int));
     vtc->tab_index = 0;
 
+    KASSERT(height <= 32 && "damage bitmap only covers 32 rows");
+    vtc->damage = 0;
+    vtc->scrollback = kmalloc(VTC_SCROLLBACK_LINES * width * sizeof(vtcell_t));
+    vtc->sb_next = 0;
+    vtc->sb_count = 0;
+    vtc->sb_view = 0;
+
     vtc->cursor = (vtcursor_t){0, 0};
 
     vtc->on_paint = on_paint;
@@ -672,6 +740,7 @@ void vtconsole_delete(vtconsole_t *vtc)
 {
     kfree(vtc->buffer);
     kfree(vtc->tabs);
+    kfree(vtc->scrollback);
     kfree(vtc);
 }
 
@@ -687,10 +756,7 @@ void vtconsole_clear(vtconsole_t *vtc, int fromx, int fromy, int tox, int toy)
         cell->attr = VTC_DEFAULT_ATTR;
         cell->c = ' ';
 
-        if (vtc->on_paint)
-        {
-            vtc->on_paint(vtc, cell, i % vtc->width, i / vtc->width);
-        }
+        vtconsole_damage(vtc, i / vtc->width);
     }
 }
 
@@ -702,16 +768,23 @@ void vtconsole_scroll(vtconsole_t *vtc, int lines)
 
     lines = lines > vtc->height ? vtc->height : lines;
 
+    // Save the rows about to fall off the top into the scrollback ring.
+    for (int i = 0; i < lines; i++)
+    {
+        memcpy(&vtc->scrollback[vtc->sb_next * vtc->width],
+               &vtc->buffer[i * vtc->width], vtc->width * sizeof(vtcell_t));
+        vtc->sb_next = (vtc->sb_next + 1) % VTC_SCROLLBACK_LINES;
+        if (vtc->sb_count < VTC_SCROLLBACK_LINES)
+        {
+            vtc->sb_count++;
+        }
+    }
+
     // Scroll the screen by number of $lines.
     for (int i = 0; i < ((vtc->width * vtc->height) - (vtc->width * lines));
          i++)
     {
         vtc->buffer[i] = vtc->buffer[i + (vtc->width * lines)];
-
-        if (vtc->on_paint)
-        {
-            vtc->on_paint(vtc, &vtc->buffer[i], i % vtc->width, i / vtc->width);
-        }
     }
 
     // Clear the last $lines.
@@ -721,11 +794,19 @@ void vtconsole_scroll(vtconsole_t *vtc, int lines)
         vtcell_t *cell = &vtc->buffer[i];
         cell->attr = VTC_DEFAULT_ATTR;
         cell->c = ' ';
+    }
 
-        if (vtc->on_paint)
-        {
-            vtc->on_paint(vtc, &vtc->buffer[i], i % vtc->width, i / vtc->width);
-        }
+    // The hardware text buffer scrolls with one buffer move; pending
+    // damage moves up with the content, and only the blanked bottom rows
+    // need a repaint.
+    if (vtc == active_vt && !vtc->sb_view)
+    {
+        vga_scroll_up((size_t)lines);
+    }
+    vtc->damage >>= lines;
+    for (int y = vtc->height - lines; y < vtc->height; y++)
+    {
+        vtconsole_damage(vtc, y);
     }
 
     // Move the cursor up $lines
@@ -809,7 +890,7 @@ void vtconsole_append(vtconsole_t *vtc, char c)
         vtcell_t *cell = &vtc->buffer[i];
         cell->attr = VTC_DEFAULT_ATTR;
         cell->c = ' ';
-        vtc->on_paint(vtc, &vtc->buffer[i], i % vtc->width, i / vtc->width);
+        vtconsole_damage(vtc, vtc->cursor.y);
     }
     else
     {
@@ -821,10 +902,7 @@ void vtconsole_append(vtconsole_t *vtc, char c)
         cell->c = c;
         cell->attr = vtc->attr;
 
-        if (vtc->on_paint)
-        {
-            vtc->on_paint(vtc, cell, vtc->cursor.x, vtc->cursor.y);
-        }
+        vtconsole_damage(vtc, vtc->cursor.y);
 
         vtc->cursor.x++;
 
@@ -1223,11 +1301,25 @@ void vtconsole_process(vtconsole_t *vtc, char c)
 }
 
 // vtconosle_putchar is called from vterminal_key_pressed
-void vtconsole_putchar(vtconsole_t *vtc, char c) { vtconsole_process(vtc, c); }
+void vtconsole_putchar(vtconsole_t *vtc, char c)
+{
+    if (vtc->sb_view)
+    {
+        vterminal_scroll_to_bottom(vtc);
+    }
+    vtconsole_process(vtc, c);
+    vtconsole_flush_damage(vtc);
+}
 
 // vtconsole_write is called from vterminal_write
 void vtconsole_write(vtconsole_t *vtc, const char *buffer, uint32_t size)
 {
+    // New output snaps a scrolled-back view to the live screen.
+    if (vtc->sb_view)
+    {
+        vterminal_scroll_to_bottom(vtc);
+    }
+
     // looping through the whole size of the buffer
     for (uint32_t i = 0; i < size; i++)
     {
@@ -1250,18 +1342,15 @@ void vtconsole_write(vtconsole_t *vtc, const char *buffer, uint32_t size)
             vtconsole_process(vtc, buffer[i]);
         }
     }
+
+    vtconsole_flush_damage(vtc);
 }
 
 // called by vterminal_make_active to redraw the console.
 void vtconsole_redraw(vtconsole_t *vtc)
 {
-    for (int i = 0; i < (vtc->width * vtc->height); i++)
-    {
-        if (vtc->on_paint)
-        {
-            vtc->on_paint(vtc, &vtc->buffer[i], i % vtc->width, i / vtc->width);
-        }
-    }
+    vtconsole_damage_all(vtc);
+    vtconsole_flush_damage(vtc);
 }
 
 #define VGA_COLOR(__fg, __bg) (__bg << 4 | __fg)
@@ -1302,8 +1391,6 @@ static char brightcolors[] = {
     [VTCOLOR_GREY] = VGACOLOR_WHITE,
 };
 
-static vterminal_t *active_vt = NULL;
-
 // used for initializing the vtconsoles.
 void paint_callback(vtconsole_t *vtc, vtcell_t *cell, int x, int y)
 {
@@ -1360,7 +1447,39 @@ void vterminal_key_pressed(vterminal_t *vt)
     vtconsole_putchar(vt, buf[len - 1]);
 }
 
-void vterminal_scroll_to_bottom(vterminal_t *vt) { KASSERT(0); }
+// Moves the scrollback view by count rows (positive = toward newer output)
+// and repaints the screen once. The view is clamped between the live screen
+// and the oldest row still in the scrollback ring.
+void vterminal_scroll(vterminal_t *vt, long count)
+{
+    long view = (long)vt->sb_view - count;
+    if (view < 0)
+    {
+        view = 0;
+    }
+    if (view > vt->sb_count)
+    {
+        view = vt->sb_count;
+    }
+    if ((int)view == vt->sb_view)
+    {
+        return;
+    }
+    vt->sb_view = (int)view;
+    vtconsole_damage_all(vt);
+    vtconsole_flush_damage(vt);
+}
+
+void vterminal_scroll_to_bottom(vterminal_t *vt)
+{
+    if (!vt->sb_view)
+    {
+        return;
+    }
+    vt->sb_view = 0;
+    vtconsole_damage_all(vt);
+    vtconsole_flush_damage(vt);
+}
 
 // ldisc_key_pressed calls this vterminal_write if VGA_BUF is not specified.
 size_t vterminal_write(vterminal_t *vt, const char *buf, size_t len)
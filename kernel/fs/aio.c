@@ -0,0 +1,492 @@
+#include "fs/aio.h"
+
+#include "errno.h"
+#include "globals.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/string.h"
+
+#include "mm/kmalloc.h"
+#include "mm/mman.h"
+#include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/tlb.h"
+
+#include "fs/file.h"
+#include "fs/stat.h"
+#include "fs/vnode.h"
+
+#include "vm/anon.h"
+#include "vm/vmmap.h"
+
+#include "api/access.h"
+
+#include "proc/kthread.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+/*
+ * Asynchronous I/O worker pool and per-process contexts.
+ *
+ * Submission is a queue of kmalloc'd requests drained by AIO_WORKERS
+ * kernel threads, each holding its own bounce page. A worker performs
+ * the operation exactly the way do_pread/do_pwrite would - the same
+ * vnode locking and byte-range locking, and honoring FMODE_DIRECT - but
+ * moves user data through its bounce page with vmmap_read/vmmap_write
+ * against the submitter's address space, since the worker never runs in
+ * the submitter's context. Beneath the vnode layer the requests flow
+ * into the block cache and the blockdev elevator like any other I/O, so
+ * several outstanding requests keep the disk queue full.
+ *
+ * Each request pins its file with fref at submit time, so closing the
+ * fd does not invalidate in-flight I/O; the submitting process itself
+ * is kept valid by aio_proc_cleanup, which cancels queued requests and
+ * waits out in-flight ones before the exiting process tears anything
+ * down.
+ *
+ * One spinlock (aio_lock) covers the queue and all context state:
+ * completions are a handful of stores, and the heavyweight work happens
+ * outside it.
+ */
+
+#define AIO_WORKERS 2
+#define AIO_MAX_INFLIGHT 128
+
+typedef struct aio_context
+{
+    aio_ring_t *ac_ring; /* kernel view of the pinned ring frame */
+    size_t ac_inflight;  /* accepted but not yet completed */
+    ktqueue_t ac_waitq;  /* aio_wait sleepers and the exiting owner */
+} aio_context_t;
+
+typedef struct aio_request
+{
+    aio_context_t *ar_ctx;
+    proc_t *ar_proc; /* the submitter; valid while the request lives */
+    file_t *ar_file;
+    int ar_op;
+    long ar_id;
+    void *ar_buf;
+    size_t ar_count;
+    size_t ar_offset;
+    list_link_t ar_link;
+} aio_request_t;
+
+static list_t aio_queue = LIST_INITIALIZER(aio_queue);
+static spinlock_t aio_lock = SPINLOCK_INITIALIZER(aio_lock);
+static ktqueue_t aio_workq;
+
+/* Mirrors the do_pread/do_pwrite vnode call: byte-range locking for
+ * regular files, the plain vnode lock for everything else. */
+static ssize_t aio_rw(file_t *file, size_t pos, void *buf, size_t count,
+                      long forwrite)
+{
+    vnode_t *vn = file->f_vnode;
+    ssize_t ret;
+    if (S_ISREG(vn->vn_mode))
+    {
+        vnode_range_t range;
+        vnode_range_lock(vn, &range, pos, pos + count, forwrite);
+        long direct = (file->f_mode & FMODE_DIRECT) &&
+                      (forwrite ? vn->vn_ops->write_direct != NULL
+                                : vn->vn_ops->read_direct != NULL);
+        if (direct)
+        {
+            ret = forwrite ? vn->vn_ops->write_direct(vn, pos, buf, count)
+                           : vn->vn_ops->read_direct(vn, pos, buf, count);
+        }
+        else
+        {
+            ret = forwrite ? vn->vn_ops->write(vn, pos, buf, count)
+                           : vn->vn_ops->read(vn, pos, buf, count);
+        }
+        vnode_range_unlock(vn, &range);
+    }
+    else
+    {
+        vlock(vn);
+        ret = forwrite ? vn->vn_ops->write(vn, pos, buf, count)
+                       : vn->vn_ops->read(vn, pos, buf, count);
+        vunlock(vn);
+    }
+    return ret;
+}
+
+static ssize_t aio_execute(aio_request_t *req, void *bounce)
+{
+    vnode_t *vn = req->ar_file->f_vnode;
+    if (req->ar_op == AIO_FSYNC)
+    {
+        if (!vn->vn_ops->fsync)
+        {
+            return 0;
+        }
+        vlock(vn);
+        ssize_t ret = vn->vn_ops->fsync(vn, 0);
+        vunlock(vn);
+        return ret;
+    }
+
+    /* The buffer was checked at submit time, but the owner runs
+     * concurrently with us and could have unmapped it since. */
+    if (!range_perm(req->ar_proc, req->ar_buf, req->ar_count,
+                    req->ar_op == AIO_READ ? PROT_WRITE : PROT_READ))
+    {
+        return -EFAULT;
+    }
+
+    size_t done = 0;
+    while (done < req->ar_count)
+    {
+        size_t chunk = MIN((size_t)PAGE_SIZE, req->ar_count - done);
+        ssize_t n;
+        if (req->ar_op == AIO_WRITE)
+        {
+            long err = vmmap_read(req->ar_proc->p_vmmap,
+                                  (char *)req->ar_buf + done, bounce, chunk);
+            if (err)
+            {
+                return done ? (ssize_t)done : err;
+            }
+            n = aio_rw(req->ar_file, req->ar_offset + done, bounce, chunk, 1);
+        }
+        else
+        {
+            n = aio_rw(req->ar_file, req->ar_offset + done, bounce, chunk, 0);
+            if (n > 0)
+            {
+                long err = vmmap_write(req->ar_proc->p_vmmap,
+                                       (char *)req->ar_buf + done, bounce,
+                                       (size_t)n);
+                if (err)
+                {
+                    return done ? (ssize_t)done : err;
+                }
+            }
+        }
+        if (n < 0)
+        {
+            return done ? (ssize_t)done : n;
+        }
+        done += (size_t)n;
+        if ((size_t)n < chunk)
+        {
+            break; /* end of file or short transfer */
+        }
+    }
+    return (ssize_t)done;
+}
+
+/* Posts the completion event and retires the request. The ring can only
+ * be full if the consumer stopped advancing ar_head entirely (the
+ * in-flight cap is below the ring size), in which case the event is
+ * dropped - the consumer can only starve itself. */
+static void aio_complete(aio_request_t *req, ssize_t result)
+{
+    aio_context_t *ctx = req->ar_ctx;
+    fput(&req->ar_file);
+
+    spinlock_lock(&aio_lock);
+    aio_ring_t *ring = ctx->ac_ring;
+    if (ring->ar_tail - ring->ar_head < ring->ar_nr)
+    {
+        aio_event_t *ev = &ring->ar_events[ring->ar_tail % ring->ar_nr];
+        ev->ae_id = req->ar_id;
+        ev->ae_result = result;
+        /* the event must be visible before the tail that publishes it */
+        __sync_synchronize();
+        ring->ar_tail++;
+    }
+    else
+    {
+        dbg(DBG_VFS, "aio: completion ring of P%d full, dropping event\n",
+            req->ar_proc->p_pid);
+    }
+    ctx->ac_inflight--;
+    sched_broadcast_on(&ctx->ac_waitq);
+    spinlock_unlock(&aio_lock);
+
+    kfree(req);
+}
+
+static void *aio_worker_run(long arg1, void *arg2)
+{
+    void *bounce = page_alloc();
+    KASSERT(bounce && "couldn't allocate an aio worker's bounce page");
+    dbg(DBG_PROC, "aio worker %ld running\n", arg1);
+    for (;;)
+    {
+        spinlock_lock(&aio_lock);
+        while (list_empty(&aio_queue))
+        {
+            /* releases aio_lock once we are on the queue */
+            sched_sleep_on(&aio_workq, &aio_lock);
+            spinlock_lock(&aio_lock);
+        }
+        aio_request_t *req = list_head(&aio_queue, aio_request_t, ar_link);
+        list_remove(&req->ar_link);
+        spinlock_unlock(&aio_lock);
+
+        aio_complete(req, aio_execute(req, bounce));
+    }
+    return NULL;
+}
+
+void aio_start()
+{
+    sched_queue_init(&aio_workq);
+    for (long i = 0; i < AIO_WORKERS; i++)
+    {
+        proc_t *proc = proc_create("aiod");
+        KASSERT(proc && "couldn't create an aio worker");
+        kthread_t *thr = kthread_create(proc, aio_worker_run, i, NULL);
+        KASSERT(thr && "couldn't create an aio worker's thread");
+        sched_make_runnable(thr);
+    }
+}
+
+/*
+ * Creates the calling process's aio context: one page holding the
+ * completion ring, mapped shared into the address space (and pinned, as
+ * mlock would, since the kernel keeps a direct view of the frame for
+ * posting completions). Returns the ring's user address through ret.
+ */
+long do_aio_setup(void **ret)
+{
+    if (curproc->p_aio)
+    {
+        return -EBUSY;
+    }
+
+    aio_context_t *ctx = kmalloc(sizeof(aio_context_t));
+    if (!ctx)
+    {
+        return -ENOMEM;
+    }
+    memset(ctx, 0, sizeof(aio_context_t));
+    sched_queue_init(&ctx->ac_waitq);
+
+    mobj_t *obj = anon_create();
+    if (!obj)
+    {
+        kfree(ctx);
+        return -ENOMEM;
+    }
+    mobj_unlock(obj);
+
+    vmarea_t *vma = NULL;
+    long status = vmmap_map_mobj(curproc->p_vmmap, obj, 0, 1,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_ANON | MAP_SHARED, 0, VMMAP_DIR_HILO,
+                                 &vma);
+    if (status < 0)
+    {
+        mobj_put(&obj);
+        kfree(ctx);
+        return status;
+    }
+    vma->vma_flags |= MAP_PINNED;
+
+    /* materialize the ring frame, pin it, and keep the kernel view */
+    pframe_t *pf = NULL;
+    mobj_lock(obj);
+    status = mobj_get_pframe(obj, 0, 1, &pf);
+    mobj_unlock(obj);
+    if (status < 0)
+    {
+        vmmap_remove(curproc->p_vmmap, vma->vma_start, 1);
+        mobj_put(&obj);
+        kfree(ctx);
+        return status;
+    }
+    pf->pf_mapped = 1;
+    aio_ring_t *ring = pf->pf_addr;
+    pframe_release(&pf);
+    mobj_put(&obj); /* the mapping holds its own reference */
+
+    memset(ring, 0, PAGE_SIZE);
+    ring->ar_nr = AIO_RING_EVENTS;
+
+    ctx->ac_ring = ring;
+    curproc->p_aio = ctx;
+
+    void *addr = PN_TO_ADDR(vma->vma_start);
+    tlb_flush_range((uintptr_t)addr, 1);
+    if (ret)
+    {
+        *ret = addr;
+    }
+    dbg(DBG_VFS, "aio: P%d ring at 0x%p (%lu events)\n", curproc->p_pid,
+        addr, ring->ar_nr);
+    return 0;
+}
+
+/*
+ * Validates and enqueues up to nr operations (already copied into
+ * kernel memory by the syscall layer). Submission stops at the first
+ * rejected iocb: the count of accepted ones is returned if any were,
+ * the error otherwise, so the caller always knows which completions to
+ * expect.
+ */
+long do_aio_submit(aio_iocb_t *iocbs, size_t nr)
+{
+    aio_context_t *ctx = curproc->p_aio;
+    if (!ctx)
+    {
+        return -EINVAL;
+    }
+
+    size_t submitted = 0;
+    long err = 0;
+    for (; submitted < nr; submitted++)
+    {
+        aio_iocb_t *cb = iocbs + submitted;
+        if (cb->aio_op != AIO_READ && cb->aio_op != AIO_WRITE &&
+            cb->aio_op != AIO_FSYNC)
+        {
+            err = -EINVAL;
+            break;
+        }
+
+        file_t *file = fget(cb->aio_fd);
+        if (!file)
+        {
+            err = -EBADF;
+            break;
+        }
+        if (cb->aio_op != AIO_FSYNC)
+        {
+            if (S_ISDIR(file->f_vnode->vn_mode))
+            {
+                err = -EISDIR;
+            }
+            else if (!(file->f_mode &
+                       (cb->aio_op == AIO_READ ? FMODE_READ : FMODE_WRITE)))
+            {
+                err = -EBADF;
+            }
+            else if (cb->aio_count &&
+                     !range_perm(curproc, cb->aio_buf, cb->aio_count,
+                                 cb->aio_op == AIO_READ ? PROT_WRITE
+                                                        : PROT_READ))
+            {
+                err = -EFAULT;
+            }
+        }
+        if (err)
+        {
+            fput(&file);
+            break;
+        }
+
+        aio_request_t *req = kmalloc(sizeof(aio_request_t));
+        if (!req)
+        {
+            fput(&file);
+            err = -ENOMEM;
+            break;
+        }
+        req->ar_ctx = ctx;
+        req->ar_proc = curproc;
+        req->ar_file = file;
+        req->ar_op = cb->aio_op;
+        req->ar_id = cb->aio_id;
+        req->ar_buf = cb->aio_buf;
+        req->ar_count = cb->aio_count;
+        req->ar_offset = cb->aio_offset;
+        list_link_init(&req->ar_link);
+
+        spinlock_lock(&aio_lock);
+        if (ctx->ac_inflight >= AIO_MAX_INFLIGHT)
+        {
+            spinlock_unlock(&aio_lock);
+            fput(&file);
+            kfree(req);
+            err = -EAGAIN;
+            break;
+        }
+        ctx->ac_inflight++;
+        list_insert_tail(&aio_queue, &req->ar_link);
+        sched_wakeup_on(&aio_workq, NULL);
+        spinlock_unlock(&aio_lock);
+    }
+
+    return submitted ? (long)submitted : err;
+}
+
+/*
+ * Blocks until at least min completion events are readable in the ring
+ * (fewer if not that many operations are outstanding) and returns the
+ * number available. The wait is cancellable.
+ */
+long do_aio_wait(long min)
+{
+    aio_context_t *ctx = curproc->p_aio;
+    if (!ctx)
+    {
+        return -EINVAL;
+    }
+    if (min < 1)
+    {
+        min = 1;
+    }
+
+    spinlock_lock(&aio_lock);
+    for (;;)
+    {
+        aio_ring_t *ring = ctx->ac_ring;
+        long avail = (long)(ring->ar_tail - ring->ar_head);
+        if (avail >= min || !ctx->ac_inflight)
+        {
+            spinlock_unlock(&aio_lock);
+            return avail;
+        }
+        long status = sched_cancellable_sleep_on(&ctx->ac_waitq, &aio_lock);
+        if (status < 0)
+        {
+            return status;
+        }
+        spinlock_lock(&aio_lock);
+    }
+}
+
+void aio_proc_cleanup(proc_t *proc)
+{
+    aio_context_t *ctx = proc->p_aio;
+    if (!ctx)
+    {
+        return;
+    }
+    proc->p_aio = NULL;
+
+    /* pull this context's queued requests off the submission queue;
+     * their files are released outside the spinlock (fput can block) */
+    list_t cancelled;
+    list_init(&cancelled);
+    spinlock_lock(&aio_lock);
+    list_iterate(&aio_queue, req, aio_request_t, ar_link)
+    {
+        if (req->ar_ctx == ctx)
+        {
+            list_remove(&req->ar_link);
+            list_insert_tail(&cancelled, &req->ar_link);
+            ctx->ac_inflight--;
+        }
+    }
+    while (ctx->ac_inflight)
+    {
+        sched_sleep_on(&ctx->ac_waitq, &aio_lock);
+        spinlock_lock(&aio_lock);
+    }
+    spinlock_unlock(&aio_lock);
+
+    list_iterate(&cancelled, req, aio_request_t, ar_link)
+    {
+        list_remove(&req->ar_link);
+        fput(&req->ar_file);
+        kfree(req);
+    }
+    /* the ring page goes away with the address space */
+    kfree(ctx);
+}
@@ -0,0 +1,396 @@
+#include "errno.h"
+#include "globals.h"
+#include "kernel.h"
+
+#include "fs/dcache.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+
+#include "mm/slab.h"
+
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/string.h"
+
+/* Capacity of the cache; once full, the least recently used entry is
+ * recycled. Must comfortably exceed the working set of hot path components
+ * but is otherwise not sensitive. */
+#define DCACHE_CAPACITY 512
+
+/* Number of hash buckets; must be a power of two. */
+#define DCACHE_HASH_BUCKETS 128
+
+/* Capacity and bucket count (power of two) of the full-path cache, plus
+ * the longest path it will cache; longer paths just take the
+ * per-component walk. */
+#define DCACHE_PATH_CAPACITY 128
+#define DCACHE_PATH_BUCKETS 64
+#define DCACHE_PATH_LEN 120
+
+typedef struct dcache_entry
+{
+    struct fs *de_fs;          /* filesystem of the parent directory */
+    ino_t de_parent;           /* inode number of the parent directory */
+    ino_t de_child;            /* inode number of the child (positive only) */
+    long de_negative;          /* set if this caches a failed lookup */
+    size_t de_namelen;         /* length of the component name */
+    char de_name[NAME_LEN + 1]; /* the component name */
+    list_link_t de_hash_link;  /* link on its hash bucket */
+    list_link_t de_lru_link;   /* link on the LRU list (head == coldest) */
+} dcache_entry_t;
+
+/* A full-path cache entry: the result of resolving pe_path from the
+ * directory (pe_base_fs, pe_base), valid only while pe_generation matches
+ * the namespace generation below. */
+typedef struct dcache_path_entry
+{
+    struct fs *pe_base_fs; /* filesystem of the starting directory */
+    ino_t pe_base;         /* inode number of the starting directory */
+    struct fs *pe_fs;      /* filesystem of the resolved vnode */
+    ino_t pe_ino;          /* inode number of the resolved vnode */
+    uint64_t pe_generation;
+    size_t pe_pathlen;
+    char pe_path[DCACHE_PATH_LEN + 1];
+    list_link_t pe_hash_link;
+    list_link_t pe_lru_link;
+} dcache_path_entry_t;
+
+static slab_allocator_t *dcache_allocator = NULL;
+static slab_allocator_t *dcache_path_allocator = NULL;
+
+static list_t dcache_buckets[DCACHE_HASH_BUCKETS];
+static list_t dcache_lru = LIST_INITIALIZER(dcache_lru);
+static size_t dcache_count = 0;
+
+static list_t dcache_path_buckets[DCACHE_PATH_BUCKETS];
+static list_t dcache_path_lru = LIST_INITIALIZER(dcache_path_lru);
+static size_t dcache_path_count = 0;
+
+/* Bumped (under dcache_lock) by every namespace mutation - dcache_remove
+ * covers create/unlink/rename, dcache_path_invalidate covers mounts - so
+ * every full-path entry minted before the mutation goes stale at once.
+ * Cheap coarse invalidation is the price of caching whole paths: a
+ * single rename can change the meaning of any number of them. */
+static uint64_t dcache_generation = 1;
+
+static spinlock_t dcache_lock = SPINLOCK_INITIALIZER(dcache_lock);
+
+void dcache_init()
+{
+    for (size_t i = 0; i < DCACHE_HASH_BUCKETS; i++)
+    {
+        list_init(&dcache_buckets[i]);
+    }
+    for (size_t i = 0; i < DCACHE_PATH_BUCKETS; i++)
+    {
+        list_init(&dcache_path_buckets[i]);
+    }
+    dcache_allocator = slab_allocator_create("dcache", sizeof(dcache_entry_t));
+    KASSERT(dcache_allocator);
+    dcache_path_allocator =
+        slab_allocator_create("dcache_path", sizeof(dcache_path_entry_t));
+    KASSERT(dcache_path_allocator);
+}
+
+static size_t _dcache_hash(struct fs *fs, ino_t parent, const char *name,
+                           size_t namelen)
+{
+    size_t hash = (uintptr_t)fs ^ parent;
+    for (size_t i = 0; i < namelen; i++)
+    {
+        hash = hash * 31 + (unsigned char)name[i];
+    }
+    return hash & (DCACHE_HASH_BUCKETS - 1);
+}
+
+/*
+ * Find the entry for (dir, name) in its bucket, or NULL. dcache_lock must be
+ * held.
+ */
+static dcache_entry_t *_dcache_find(vnode_t *dir, const char *name,
+                                    size_t namelen)
+{
+    list_t *bucket =
+        &dcache_buckets[_dcache_hash(dir->vn_fs, dir->vn_vno, name, namelen)];
+    list_iterate(bucket, de, dcache_entry_t, de_hash_link)
+    {
+        if (de->de_fs == dir->vn_fs && de->de_parent == dir->vn_vno &&
+            de->de_namelen == namelen && !memcmp(de->de_name, name, namelen))
+        {
+            return de;
+        }
+    }
+    return NULL;
+}
+
+long dcache_lookup(vnode_t *dir, const char *name, size_t namelen,
+                   vnode_t **res_vnode)
+{
+    if (!dcache_allocator || namelen > NAME_LEN)
+    {
+        return 0;
+    }
+
+    spinlock_lock(&dcache_lock);
+    dcache_entry_t *de = _dcache_find(dir, name, namelen);
+    if (!de)
+    {
+        spinlock_unlock(&dcache_lock);
+        return 0;
+    }
+
+    /* Hit; move to the warm end of the LRU. */
+    list_remove(&de->de_lru_link);
+    list_insert_tail(&dcache_lru, &de->de_lru_link);
+
+    if (de->de_negative)
+    {
+        spinlock_unlock(&dcache_lock);
+        dbg(DBG_VFS, "dcache: negative hit for \"%.*s\" in %u\n", (int)namelen,
+            name, dir->vn_vno);
+        return -ENOENT;
+    }
+
+    ino_t child = de->de_child;
+    spinlock_unlock(&dcache_lock);
+
+    /* vget may block, so the cache lock must be dropped first. The entry may
+     * be recycled behind our back, but child remains a valid inode number as
+     * long as no unlink slipped in, and unlink invalidates the entry. */
+    *res_vnode = vget(dir->vn_fs, child);
+    dbg(DBG_VFS, "dcache: hit for \"%.*s\" in %u -> %u\n", (int)namelen, name,
+        dir->vn_vno, child);
+    return 1;
+}
+
+void dcache_insert(vnode_t *dir, const char *name, size_t namelen,
+                   vnode_t *child)
+{
+    if (!dcache_allocator || namelen > NAME_LEN)
+    {
+        return;
+    }
+
+    spinlock_lock(&dcache_lock);
+    dcache_entry_t *de = _dcache_find(dir, name, namelen);
+    if (!de)
+    {
+        if (dcache_count >= DCACHE_CAPACITY)
+        {
+            /* Recycle the coldest entry. */
+            de = list_head(&dcache_lru, dcache_entry_t, de_lru_link);
+            list_remove(&de->de_lru_link);
+            list_remove(&de->de_hash_link);
+        }
+        else
+        {
+            spinlock_unlock(&dcache_lock);
+            de = slab_obj_alloc(dcache_allocator);
+            if (!de)
+            {
+                return; /* caching is best-effort */
+            }
+            spinlock_lock(&dcache_lock);
+            dcache_count++;
+        }
+        de->de_fs = dir->vn_fs;
+        de->de_parent = dir->vn_vno;
+        de->de_namelen = namelen;
+        memcpy(de->de_name, name, namelen);
+        de->de_name[namelen] = '\0';
+        list_link_init(&de->de_hash_link);
+        list_link_init(&de->de_lru_link);
+        list_insert_tail(
+            &dcache_buckets[_dcache_hash(dir->vn_fs, dir->vn_vno, name,
+                                         namelen)],
+            &de->de_hash_link);
+        list_insert_tail(&dcache_lru, &de->de_lru_link);
+    }
+    de->de_negative = !child;
+    de->de_child = child ? child->vn_vno : 0;
+    spinlock_unlock(&dcache_lock);
+}
+
+void dcache_remove(vnode_t *dir, const char *name, size_t namelen)
+{
+    if (!dcache_allocator || namelen > NAME_LEN)
+    {
+        return;
+    }
+
+    spinlock_lock(&dcache_lock);
+    /* The namespace is changing whether or not the component was cached;
+     * age out every full-path entry minted before this point. */
+    dcache_generation++;
+    dcache_entry_t *de = _dcache_find(dir, name, namelen);
+    if (de)
+    {
+        list_remove(&de->de_hash_link);
+        list_remove(&de->de_lru_link);
+        dcache_count--;
+        spinlock_unlock(&dcache_lock);
+        slab_obj_free(dcache_allocator, de);
+        return;
+    }
+    spinlock_unlock(&dcache_lock);
+}
+
+static size_t _dcache_path_hash(struct fs *fs, ino_t base, const char *path,
+                                size_t pathlen)
+{
+    size_t hash = (uintptr_t)fs ^ base;
+    for (size_t i = 0; i < pathlen; i++)
+    {
+        hash = hash * 31 + (unsigned char)path[i];
+    }
+    return hash & (DCACHE_PATH_BUCKETS - 1);
+}
+
+/*
+ * Find the full-path entry for (base, path) in its bucket, or NULL.
+ * dcache_lock must be held.
+ */
+static dcache_path_entry_t *_dcache_path_find(vnode_t *base, const char *path,
+                                              size_t pathlen)
+{
+    list_t *bucket = &dcache_path_buckets[_dcache_path_hash(
+        base->vn_fs, base->vn_vno, path, pathlen)];
+    list_iterate(bucket, pe, dcache_path_entry_t, pe_hash_link)
+    {
+        if (pe->pe_base_fs == base->vn_fs && pe->pe_base == base->vn_vno &&
+            pe->pe_pathlen == pathlen && !memcmp(pe->pe_path, path, pathlen))
+        {
+            return pe;
+        }
+    }
+    return NULL;
+}
+
+/* An absolute path resolves from the root regardless of base, so cache it
+ * under the root and hits are shared by every process. */
+static vnode_t *_dcache_path_base(vnode_t *base, const char *path)
+{
+    return path[0] == '/' ? vfs_root_fs.fs_root : base;
+}
+
+uint64_t dcache_path_generation()
+{
+    return dcache_generation;
+}
+
+void dcache_path_invalidate()
+{
+    spinlock_lock(&dcache_lock);
+    dcache_generation++;
+    spinlock_unlock(&dcache_lock);
+}
+
+long dcache_path_lookup(vnode_t *base, const char *path, vnode_t **res_vnode)
+{
+    base = _dcache_path_base(base, path);
+    if (!dcache_path_allocator || !base)
+    {
+        return 0;
+    }
+    size_t pathlen = strlen(path);
+    if (!pathlen || pathlen > DCACHE_PATH_LEN)
+    {
+        return 0;
+    }
+
+    spinlock_lock(&dcache_lock);
+    dcache_path_entry_t *pe = _dcache_path_find(base, path, pathlen);
+    if (!pe)
+    {
+        spinlock_unlock(&dcache_lock);
+        return 0;
+    }
+    if (pe->pe_generation != dcache_generation)
+    {
+        /* Something in the namespace changed since this was cached; the
+         * entry may or may not still be right, so drop it. */
+        list_remove(&pe->pe_hash_link);
+        list_remove(&pe->pe_lru_link);
+        dcache_path_count--;
+        spinlock_unlock(&dcache_lock);
+        slab_obj_free(dcache_path_allocator, pe);
+        return 0;
+    }
+
+    list_remove(&pe->pe_lru_link);
+    list_insert_tail(&dcache_path_lru, &pe->pe_lru_link);
+
+    struct fs *fs = pe->pe_fs;
+    ino_t ino = pe->pe_ino;
+    spinlock_unlock(&dcache_lock);
+
+    /* As with dcache_lookup, the inode number stays valid as long as no
+     * namespace mutation slipped in, and any mutation would have bumped
+     * the generation we just checked. */
+    *res_vnode = vget(fs, ino);
+    dbg(DBG_VFS, "dcache: path hit for \"%s\" from %u -> %u\n", path,
+        base->vn_vno, ino);
+    return 1;
+}
+
+void dcache_path_insert(vnode_t *base, const char *path, vnode_t *res_vnode,
+                        uint64_t generation)
+{
+    base = _dcache_path_base(base, path);
+    if (!dcache_path_allocator || !base)
+    {
+        return;
+    }
+    size_t pathlen = strlen(path);
+    if (!pathlen || pathlen > DCACHE_PATH_LEN)
+    {
+        return;
+    }
+
+    spinlock_lock(&dcache_lock);
+    if (generation != dcache_generation)
+    {
+        /* The namespace changed while the resolution ran; the result may
+         * already be stale, so do not cache it. */
+        spinlock_unlock(&dcache_lock);
+        return;
+    }
+    dcache_path_entry_t *pe = _dcache_path_find(base, path, pathlen);
+    if (!pe)
+    {
+        if (dcache_path_count >= DCACHE_PATH_CAPACITY)
+        {
+            pe = list_head(&dcache_path_lru, dcache_path_entry_t, pe_lru_link);
+            list_remove(&pe->pe_lru_link);
+            list_remove(&pe->pe_hash_link);
+        }
+        else
+        {
+            spinlock_unlock(&dcache_lock);
+            pe = slab_obj_alloc(dcache_path_allocator);
+            if (!pe)
+            {
+                return; /* caching is best-effort */
+            }
+            spinlock_lock(&dcache_lock);
+            dcache_path_count++;
+        }
+        pe->pe_base_fs = base->vn_fs;
+        pe->pe_base = base->vn_vno;
+        pe->pe_pathlen = pathlen;
+        memcpy(pe->pe_path, path, pathlen);
+        pe->pe_path[pathlen] = '\0';
+        list_link_init(&pe->pe_hash_link);
+        list_link_init(&pe->pe_lru_link);
+        list_insert_tail(&dcache_path_buckets[_dcache_path_hash(
+                             base->vn_fs, base->vn_vno, path, pathlen)],
+                         &pe->pe_hash_link);
+        list_insert_tail(&dcache_path_lru, &pe->pe_lru_link);
+    }
+    pe->pe_fs = res_vnode->vn_fs;
+    pe->pe_ino = res_vnode->vn_vno;
+    pe->pe_generation = generation;
+    spinlock_unlock(&dcache_lock);
+}
@@ -1,3 +1,4 @@
+#include "errno.h"
 #include "fs/file.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
@@ -7,26 +8,128 @@
 #include "util/string.h"
 
 static slab_allocator_t *file_allocator;
+static slab_allocator_t *fdtable_allocator;
 
 void file_init(void)
 {
-    file_allocator = slab_allocator_create("file", sizeof(file_t));
+    /* Cacheline-aligned: f_refcount is bumped lock-free from every core
+     * doing fget. */
+    file_allocator = slab_allocator_create_aligned("file", sizeof(file_t), 64);
+    fdtable_allocator = slab_allocator_create("fdtable", sizeof(fdtable_t));
+}
+
+fdtable_t *fdtable_create(void)
+{
+    fdtable_t *table = slab_obj_alloc(fdtable_allocator);
+    if (!table)
+    {
+        return NULL;
+    }
+    memset(table, 0, sizeof(fdtable_t));
+    refcount_init(&table->fdt_refcount, 1);
+    return table;
+}
+
+fdtable_t *fdtable_clone(fdtable_t *table)
+{
+    refcount_inc(&table->fdt_refcount);
+    return table;
+}
+
+void fdtable_put(fdtable_t **tablep)
+{
+    fdtable_t *table = *tablep;
+    *tablep = NULL;
+
+    KASSERT(table);
+    if (!refcount_dec_and_test(&table->fdt_refcount))
+    {
+        return;
+    }
+    for (int fd = 0; fd < NFILES; fd++)
+    {
+        if (table->fdt_files[fd])
+        {
+            fput(table->fdt_files + fd);
+        }
+    }
+    slab_obj_free(fdtable_allocator, table);
+}
+
+long fdtable_unshare(void)
+{
+    fdtable_t *shared = curproc->p_fdtable;
+    if (shared->fdt_refcount == 1)
+    {
+        /* Not a race: the count can only grow when this process forks,
+         * and only this process can do that. */
+        return 0;
+    }
+
+    fdtable_t *table = fdtable_create();
+    if (!table)
+    {
+        return -ENOMEM;
+    }
+    /* The shared table is frozen while its refcount exceeds one, so the
+     * slots can be copied without any lock; only the refs are atomic. */
+    table->fdt_cloexec = shared->fdt_cloexec;
+    for (int fd = 0; fd < NFILES; fd++)
+    {
+        if ((table->fdt_files[fd] = shared->fdt_files[fd]))
+        {
+            fref(table->fdt_files[fd]);
+        }
+    }
+    curproc->p_fdtable = table;
+    curproc->p_files = table->fdt_files;
+    fdtable_put(&shared);
+    return 0;
+}
+
+void fdtable_close_exec(void)
+{
+    if (!curproc->p_fdtable->fdt_cloexec)
+    {
+        return;
+    }
+    if (fdtable_unshare())
+    {
+        dbg(DBG_VFS, "close-on-exec: no memory to unshare the descriptor "
+                     "table; leaving descriptors open\n");
+        return;
+    }
+    fdtable_t *table = curproc->p_fdtable;
+    for (int fd = 0; fd < NFILES; fd++)
+    {
+        if ((table->fdt_cloexec & (1UL << fd)) && table->fdt_files[fd])
+        {
+            fput(table->fdt_files + fd);
+        }
+    }
+    table->fdt_cloexec = 0;
+}
+
+/* Final-free callback for the epoch reclaimer (see fput). */
+static void file_reclaim(reclaim_node_t *node)
+{
+    slab_obj_free(file_allocator, CONTAINER_OF(node, file_t, f_reclaim));
 }
 
 void fref(file_t *f)
 {
     KASSERT(f->f_mode <= FMODE_MAX_VALUE && f->f_vnode);
 
-    f->f_refcount++;
+    refcount_inc(&f->f_refcount);
 
     if (f->f_vnode)
     {
-        dbg(DBG_FREF, "fref: 0x%p, 0x%p ino %u, up to %lu\n", f,
+        dbg(DBG_FREF, "fref: 0x%p, 0x%p ino %u, up to %d\n", f,
             f->f_vnode->vn_fs, f->f_vnode->vn_vno, f->f_refcount);
     }
     else
     {
-        dbg(DBG_FREF, "fref: 0x%p up to %lu\n", f, f->f_refcount);
+        dbg(DBG_FREF, "fref: 0x%p up to %d\n", f, f->f_refcount);
     }
 }
 
@@ -42,6 +145,10 @@ void fref(file_t *f)
 file_t *fcreate(int fd, vnode_t *vnode, unsigned int mode)
 {
     KASSERT(!curproc->p_files[fd]);
+    /* About to publish into a table slot, so the table must be ours
+     * alone (it may still be a snapshot shared with a fork parent). */
+    if (fdtable_unshare())
+        return NULL;
     file_t *file = slab_obj_alloc(file_allocator);
     if (!file)
         return NULL;
@@ -52,22 +159,37 @@ file_t *fcreate(int fd, vnode_t *vnode, unsigned int mode)
     if (vnode->vn_ops->acquire)
         vnode->vn_ops->acquire(vnode, file);
 
+    /* Mint the table's reference before publishing the pointer, so a
+     * lock-free fget can never observe a live entry with a zero count.
+     * This is the one place a file's count may leave zero, so it is an
+     * init rather than an fref (which asserts the object is alive). */
+    refcount_init(&file->f_refcount, 1);
+    curproc->p_fdtable->fdt_cloexec &= ~(1UL << fd);
     curproc->p_files[fd] = file;
-    fref(file);
     return file;
 }
 
 /*
  * Perform bounds checking on the fd, use curproc->p_files to get the file,
- * fref it if it exists, and return.
+ * take a reference if it exists, and return.
+ *
+ * The fd -> file translation is lock-free: a load of the table slot and
+ * one atomic increment, so threads sharing a process never contend here.
+ * This relies on a publish protocol rather than a table lock: fcreate
+ * raises the count before storing the pointer, and fput clears the table
+ * slot before dropping its reference, so the count can only reach zero
+ * once the file is unpublished. If the increment loses to a concurrent
+ * close (atomic_inc_not_zero sees zero), the slot was stale and the
+ * lookup fails exactly as if the close had come first.
  */
 file_t *fget(int fd)
 {
     if (fd < 0 || fd >= NFILES)
         return NULL;
     file_t *file = curproc->p_files[fd];
-    if (file)
-        fref(file);
+    if (!file || !refcount_inc_not_zero(&file->f_refcount))
+        return NULL;
+    dbg(DBG_FREF, "fget: 0x%p fd %d, up to %d\n", file, fd, file->f_refcount);
     return file;
 }
 
@@ -81,27 +203,29 @@ file_t *fget(int fd)
  */
 void fput(file_t **filep)
 {
+    /* Unpublish the caller's pointer before dropping the reference; when
+     * filep is a table slot, this is what keeps a concurrent lock-free
+     * fget from resurrecting a file whose count is about to hit zero. */
     file_t *file = *filep;
     *filep = NULL;
 
     KASSERT(file && file->f_mode <= FMODE_MAX_VALUE);
-    KASSERT(file->f_refcount > 0);
     if (file->f_refcount != 1)
         KASSERT(file->f_vnode);
 
-    file->f_refcount--;
+    long dead = refcount_dec_and_test(&file->f_refcount);
 
     if (file->f_vnode)
     {
-        dbg(DBG_FREF, "fput: 0x%p, 0x%p ino %u, down to %lu\n", file,
+        dbg(DBG_FREF, "fput: 0x%p, 0x%p ino %u, down to %d\n", file,
             file->f_vnode->vn_fs, file->f_vnode->vn_vno, file->f_refcount);
     }
     else
     {
-        dbg(DBG_FREF, "fput: 0x%p down to %lu\n", file, file->f_refcount);
+        dbg(DBG_FREF, "fput: 0x%p down to %d\n", file, file->f_refcount);
     }
 
-    if (!file->f_refcount)
+    if (dead)
     {
         if (file->f_vnode)
         {
@@ -110,6 +234,9 @@ void fput(file_t **filep)
                 file->f_vnode->vn_ops->release(file->f_vnode, file);
             vput_locked(&file->f_vnode);
         }
-        slab_obj_free(file_allocator, file);
+        /* fget may have loaded our table pointer just before we were
+         * unpublished; defer the free past a grace period so that stale
+         * load can never dereference freed memory. */
+        reclaim_defer(&file->f_reclaim, file_reclaim);
     }
 }
@@ -1,16 +1,49 @@
+#include "config.h"
 #include "errno.h"
 #include "globals.h"
 #include "kernel.h"
 #include <fs/dirent.h>
 
+#include "mm/kmalloc.h"
+
 #include "util/debug.h"
 #include "util/string.h"
 
+#include "fs/dcache.h"
 #include "fs/fcntl.h"
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 
+/* "." and ".." resolve within the directory itself and are never cached. */
+#define NAMEV_IS_DOT(name, namelen)                         \
+    (((namelen) == 1 && (name)[0] == '.') ||                \
+     ((namelen) == 2 && (name)[0] == '.' && (name)[1] == '.'))
+
+/* Bound on the number of symlinks followed while resolving one path; a
+ * resolution that exceeds it fails with -ELOOP. */
+#define NAMEV_MAX_SYMLINKS 8
+
+static long namev_open_depth(vnode_t *base, const char *path, int oflags,
+                             int mode, devid_t devid, vnode_t **res_vnode,
+                             long *depth);
+
+#ifdef __MOUNTING__
+/* If a file system is mounted on *res_vnode, descend to its root. The
+ * root holds no extra reference through vn_mount, so take one before
+ * letting go of the covered vnode. */
+static void namev_follow_mount(vnode_t **res_vnode)
+{
+    while ((*res_vnode)->vn_mount != *res_vnode)
+    {
+        vnode_t *mounted = (*res_vnode)->vn_mount;
+        vref(mounted);
+        vput(res_vnode);
+        *res_vnode = mounted;
+    }
+}
+#endif
+
 /*
  * Get the parent of a directory. dir must not be locked.
  */
@@ -97,7 +130,42 @@ long namev_lookup(vnode_t *dir, const char *name, size_t namelen,
         vref(dir);
         return 0;
     }
+    if (!NAMEV_IS_DOT(name, namelen))
+    {
+        long hit = dcache_lookup(dir, name, namelen, res_vnode);
+        if (hit > 0)
+        {
+#ifdef __MOUNTING__
+            if (*res_vnode != dir)
+            {
+                namev_follow_mount(res_vnode);
+            }
+#endif
+            return 0;
+        }
+        if (hit == -ENOENT)
+        {
+            return -ENOENT;
+        }
+    }
     long status = dir->vn_ops->lookup(dir, name, namelen, res_vnode);
+    if (!NAMEV_IS_DOT(name, namelen))
+    {
+        if (!status && *res_vnode != dir)
+        {
+            dcache_insert(dir, name, namelen, *res_vnode);
+        }
+        else if (status == -ENOENT)
+        {
+            dcache_insert(dir, name, namelen, NULL);
+        }
+    }
+#ifdef __MOUNTING__
+    if (!status && *res_vnode != dir)
+    {
+        namev_follow_mount(res_vnode);
+    }
+#endif
     return status;
 }
 
@@ -175,6 +243,52 @@ int oops_all_slashes(const char* path) {
     return 1;
 }
 
+/*
+ * Follow the symlink in *linkp, resolving its target relative to dir
+ * (unless the target is absolute). *linkp must be referenced and unlocked;
+ * on success it is replaced by the resolved vnode (referenced, unlocked),
+ * and on failure it is put away and an error is returned. dir must be
+ * referenced and unlocked; the caller keeps its reference either way.
+ *
+ * The target path is read from the link's file data the first time the
+ * link is followed and cached on the vnode (vn_link_target) after that,
+ * so repeat resolutions never touch the disk path. depth counts links
+ * followed so far for this resolution and bounds traversal at
+ * NAMEV_MAX_SYMLINKS (-ELOOP beyond that).
+ */
+static long namev_follow(vnode_t **linkp, vnode_t *dir, long *depth)
+{
+    vnode_t *lnk = *linkp;
+    *linkp = NULL;
+    if (++(*depth) > NAMEV_MAX_SYMLINKS) {
+        vput(&lnk);
+        return -ELOOP;
+    }
+    vlock(lnk);
+    if (!lnk->vn_link_target) {
+        char *target = kmalloc(MAXPATHLEN);
+        if (!target) {
+            vput_locked(&lnk);
+            return -ENOMEM;
+        }
+        size_t to_read = MIN(lnk->vn_len, (size_t)MAXPATHLEN - 1);
+        ssize_t nread = lnk->vn_ops->read(lnk, 0, target, to_read);
+        if (nread < 0) {
+            kfree(target);
+            vput_locked(&lnk);
+            return nread;
+        }
+        target[nread] = '\0';
+        /* immutable once set; safe to read without the lock below */
+        lnk->vn_link_target = target;
+    }
+    vunlock(lnk);
+    long status = namev_open_depth(dir, lnk->vn_link_target, O_RDONLY, 0, 0,
+                                   linkp, depth);
+    vput(&lnk);
+    return status;
+}
+
 
 /*
  * Parse path and return in `res_vnode` the vnode corresponding to the directory
@@ -217,8 +331,9 @@ int oops_all_slashes(const char* path) {
  * utilities `dirname` and `basename` on your virtual machine or a Brown
  * department machine.
  */
-long namev_dir(vnode_t *base, const char *path, vnode_t **res_vnode,
-               const char **name, size_t *namelen)
+static long namev_dir_depth(vnode_t *base, const char *path,
+                            vnode_t **res_vnode, const char **name,
+                            size_t *namelen, long *depth)
 {
     vnode_t* start = base;
     if (path[0] == '/') {
@@ -268,7 +383,18 @@ long namev_dir(vnode_t *base, const char *path, vnode_t **res_vnode,
             // }
             return status;
         }
-        vput_locked(&start);
+        if (S_ISLNK((*res_vnode)->vn_mode)) {
+            // an intermediate component is a symlink: swap it for whatever
+            // its target resolves to (relative to start) before descending
+            vunlock(start);
+            status = namev_follow(res_vnode, start, depth);
+            vput(&start);
+            if (status < 0) {
+                return status;
+            }
+        } else {
+            vput_locked(&start);
+        }
         start = *res_vnode;
         // 1. start = vnode for /dev, / is unlocked and not referenced, /dev is still referenced
         vlock(start);
@@ -278,6 +404,13 @@ long namev_dir(vnode_t *base, const char *path, vnode_t **res_vnode,
     return 0;
 }
 
+long namev_dir(vnode_t *base, const char *path, vnode_t **res_vnode,
+               const char **name, size_t *namelen)
+{
+    long depth = 0;
+    return namev_dir_depth(base, path, res_vnode, name, namelen, &depth);
+}
+
 /*
  * Open the file specified by `base` and `path`, or create it, if necessary.
  *  Return the file's vnode via `res_vnode`, which should be returned unlocked
@@ -301,8 +434,9 @@ long namev_dir(vnode_t *base, const char *path, vnode_t **res_vnode,
  *  - Use the macro NAME_LEN to check the basename length. Check out
  *    ramfs_mknod() to confirm that the name should be null-terminated.
  */
-long namev_open(vnode_t *base, const char *path, int oflags, int mode,
-                devid_t devid, struct vnode **res_vnode)
+static long namev_open_depth(vnode_t *base, const char *path, int oflags,
+                             int mode, devid_t devid, vnode_t **res_vnode,
+                             long *depth)
 {
     // if (path[strlen(path) - 1] == '/' && (oflags & O_CREAT)) {
     //     return -EINVAL;
@@ -315,7 +449,7 @@ long namev_open(vnode_t *base, const char *path, int oflags, int mode,
     const char* name;
     size_t name_len;
     vnode_t *container;
-    long status = namev_dir(base, path, &container, &name, &name_len);
+    long status = namev_dir_depth(base, path, &container, &name, &name_len, depth);
     if (status < 0) {
         return status;
     }
@@ -327,6 +461,10 @@ long namev_open(vnode_t *base, const char *path, int oflags, int mode,
     long lookup = namev_lookup(container, name, name_len, res_vnode);
     if (lookup == -ENOENT && (oflags & O_CREAT)) {
         ssize_t created = container->vn_ops->mknod(container, name, name_len, mode, devid, res_vnode);
+        if (created >= 0) {
+            /* drop the negative entry the failed lookup just cached */
+            dcache_remove(container, name, name_len);
+        }
         vput_locked(&container);
         return created;
     }
@@ -334,6 +472,20 @@ long namev_open(vnode_t *base, const char *path, int oflags, int mode,
         vput_locked(&container);
         return lookup;
     }
+    if (S_ISLNK((*res_vnode)->vn_mode)) {
+        // the basename itself is a symlink: hand back its target instead
+        vunlock(container);
+        lookup = namev_follow(res_vnode, container, depth);
+        vput(&container);
+        if (lookup < 0) {
+            return lookup;
+        }
+        if (!S_ISDIR((*res_vnode)->vn_mode) && path[strlen(path) - 1] == '/') {
+            vput(res_vnode);
+            return -ENOTDIR;
+        }
+        return 0;
+    }
     if (!S_ISDIR((*res_vnode)->vn_mode) && path[strlen(path) - 1] == '/') {
         vput(res_vnode);
         vput_locked(&container);
@@ -343,12 +495,31 @@ long namev_open(vnode_t *base, const char *path, int oflags, int mode,
     return lookup;
 }
 
+long namev_open(vnode_t *base, const char *path, int oflags, int mode,
+                devid_t devid, struct vnode **res_vnode)
+{
+    long depth = 0;
+    return namev_open_depth(base, path, oflags, mode, devid, res_vnode,
+                            &depth);
+}
+
 /*
- * Wrapper around namev_open with O_RDONLY and 0 mode/devid
+ * Wrapper around namev_open with O_RDONLY and 0 mode/devid. Consults the
+ * full-path cache first, so an exact repeat of a recent resolution skips
+ * the per-component walk; the generation sampled before the walk keeps a
+ * concurrent namespace change from caching a stale result.
  */
 long namev_resolve(vnode_t *base, const char *path, vnode_t **res_vnode)
 {
-    return namev_open(base, path, O_RDONLY, 0, 0, res_vnode);
+    uint64_t generation = dcache_path_generation();
+    if (dcache_path_lookup(base, path, res_vnode)) {
+        return 0;
+    }
+    long ret = namev_open(base, path, O_RDONLY, 0, 0, res_vnode);
+    if (!ret) {
+        dcache_path_insert(base, path, *res_vnode, generation);
+    }
+    return ret;
 }
 
 #ifdef __GETCWD__
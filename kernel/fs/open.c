@@ -106,6 +106,12 @@ long do_open(const char *filename, int oflags)
     if (oflags & O_APPEND) {
         mode = mode | FMODE_APPEND;
     }
+    if (oflags & O_DIRECT) {
+        mode = mode | FMODE_DIRECT;
+    }
+    if (oflags & O_NONBLOCK) {
+        mode = mode | FMODE_NONBLOCK;
+    }
     if ((oflags & O_TRUNC) && !S_ISDIR(res_vnode->vn_mode)) {
         res_vnode->vn_ops->truncate_file(res_vnode);
     }
@@ -114,5 +120,9 @@ long do_open(const char *filename, int oflags)
     if (!created) {
         return -ENOMEM;
     }
+    if (oflags & O_CLOEXEC) {
+        // fcreate unshared the table, so the bit is ours to set
+        curproc->p_fdtable->fdt_cloexec |= 1UL << fd;
+    }
     return fd;
 }
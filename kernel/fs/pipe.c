@@ -7,9 +7,11 @@
 
 #include "errno.h"
 #include "globals.h"
+#include "kernel.h"
 
 #include "fs/file.h"
 #include "fs/pipe.h"
+#include "fs/poll.h"
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vfs_syscall.h"
@@ -18,10 +20,32 @@
 #include "mm/kmalloc.h"
 #include "mm/slab.h"
 
+#include "proc/sched.h"
+
 #include "util/debug.h"
 #include "util/string.h"
 
+/* Initial capacity of a pipe's ring buffer. */
 #define PIPE_BUF_SIZE 4096
+/* Cap on how far a pipe's ring buffer may grow under write pressure. */
+#define PIPE_BUF_MAX (16 * PIPE_BUF_SIZE)
+/*
+ * Watermarks for wakeups. Readers only wake blocked writers once the buffer
+ * has drained below the low watermark, and writers only wake waiting readers
+ * once it has filled past the high watermark (or when they are done), so a
+ * bulk producer/consumer pair trades a few large copies per buffer rather
+ * than ping-ponging through sched_switch() on every chunk.
+ */
+#define PIPE_LOW_WATER(pipe) ((pipe)->pv_cap / 4)
+#define PIPE_HIGH_WATER(pipe) (3 * (pipe)->pv_cap / 4)
+/*
+ * Upper bound on the busy-wait iterations a reader (writer) spends at an
+ * empty (full) buffer while the peer is running on another core before
+ * falling back to sleeping. Same trade-off as KMUTEX_SPIN_LIMIT: a
+ * streaming peer acts within the budget, and the spin converts the
+ * sleep/wakeup round trip (two context switches) into a few loads.
+ */
+#define PIPE_SPIN_LIMIT 1024
 
 static void pipe_read_vnode(fs_t *fs, vnode_t *vnode);
 
@@ -44,6 +68,8 @@ static long pipe_write(vnode_t *vnode, size_t pos, const void *buf,
 
 static long pipe_stat(vnode_t *vnode, stat_t *ss);
 
+static long pipe_poll(vnode_t *vnode, file_t *file, int events);
+
 static long pipe_acquire(vnode_t *vnode, file_t *file);
 
 static long pipe_release(vnode_t *vnode, file_t *file);
@@ -60,6 +86,7 @@ static vnode_ops_t pipe_vops = {
     .rmdir = NULL,
     .readdir = NULL,
     .stat = pipe_stat,
+    .poll = pipe_poll,
     .acquire = pipe_acquire,
     .release = pipe_release,
     .get_pframe = NULL,
@@ -73,10 +100,16 @@ typedef struct pipe
 {
     /* Buffer for data in the pipe, which has been written but not yet read. */
     char *pv_buf;
+    /*
+     * Current capacity of pv_buf. Starts at PIPE_BUF_SIZE and doubles (up to
+     * PIPE_BUF_MAX) each time a writer finds the buffer full, so pipes
+     * carrying bulk traffic stop blocking the producer every 4K.
+     */
+    size_t pv_cap;
     /*
      * Position of the head and number of characters in the buffer. You can
      * write in characters at position head so long as size does not grow beyond
-     * the pipe buffer size.
+     * the pipe buffer capacity.
      */
     off_t pv_head;
     size_t pv_size;
@@ -93,12 +126,36 @@ typedef struct pipe
     kmutex_t pv_wrlock;
     /*
      * Waitqueues for threads attempting to read from an empty buffer, or
-     * write to a full buffer. When the pipe becomes non-empty (or non-full)
-     * then the corresponding waitq should be broadcasted on to make sure all
-     * of the threads get a chance to go.
+     * write to a full buffer. Because sleepers hold pv_rdlock/pv_wrlock
+     * while they wait, each queue holds at most one thread, so wake sites
+     * use sched_wakeup_on rather than broadcasting (the mutex already
+     * hands off FIFO-fairly to the threads queued behind it).
      */
     ktqueue_t pv_read_waitq;
     ktqueue_t pv_write_waitq;
+    /*
+     * Direct hand-off fast path. A reader that finds the buffer empty
+     * publishes the remainder of its destination buffer here before
+     * sleeping, and writers deposit straight into it, bypassing pv_buf
+     * entirely. Large transfers pay one copy instead of two and wake the
+     * reader once per write call rather than once per 4K of buffer space.
+     * Only the sleeping reader's buffer is ever published (readers are
+     * serialized by pv_rdlock), and the reader unpublishes it when it
+     * wakes.
+     */
+    char *pv_dst;
+    size_t pv_dst_count;  /* capacity of pv_dst */
+    size_t pv_dst_copied; /* bytes deposited into pv_dst so far */
+    /*
+     * The threads currently inside pipe_read/pipe_write (set under the
+     * respective mutex, so at most one each). The other side reads these
+     * without a lock to decide whether its peer is on another core
+     * (sched_thread_on_cpu) and worth spinning for; like km_holder in
+     * kmutex_lock's adaptive spin, a thread cannot exit while its pointer
+     * is published here, and a stale NULL just means we sleep as before.
+     */
+    kthread_t *pv_reader_thr;
+    kthread_t *pv_writer_thr;
 } pipe_t;
 
 #define VNODE_TO_PIPE(vn) ((pipe_t *)((vn)->vn_i))
@@ -110,6 +167,11 @@ void pipe_init(void)
 {
     pipe_allocator = slab_allocator_create("pipe", sizeof(pipe_t));
     KASSERT(pipe_allocator);
+    pipe_fs.fs_vnode_allocator =
+        slab_allocator_create("pipe_vnode", sizeof(vnode_t));
+    KASSERT(pipe_fs.fs_vnode_allocator);
+    list_init(&pipe_fs.vnode_list);
+    vnode_fs_init(&pipe_fs);
 }
 
 /*
@@ -120,8 +182,32 @@ void pipe_init(void)
  */
 static pipe_t *pipe_create(void)
 {
-    NOT_YET_IMPLEMENTED("PIPES: pipe_create");
-    return NULL;
+    pipe_t *pipe = slab_obj_alloc(pipe_allocator);
+    if (!pipe)
+    {
+        return NULL;
+    }
+    pipe->pv_buf = kmalloc(PIPE_BUF_SIZE);
+    if (!pipe->pv_buf)
+    {
+        slab_obj_free(pipe_allocator, pipe);
+        return NULL;
+    }
+    pipe->pv_cap = PIPE_BUF_SIZE;
+    pipe->pv_head = 0;
+    pipe->pv_size = 0;
+    pipe->pv_readers = 0;
+    pipe->pv_writers = 0;
+    pipe->pv_dst = NULL;
+    pipe->pv_dst_count = 0;
+    pipe->pv_dst_copied = 0;
+    pipe->pv_reader_thr = NULL;
+    pipe->pv_writer_thr = NULL;
+    kmutex_init(&pipe->pv_rdlock);
+    kmutex_init(&pipe->pv_wrlock);
+    sched_queue_init(&pipe->pv_read_waitq);
+    sched_queue_init(&pipe->pv_write_waitq);
+    return pipe;
 }
 
 /*
@@ -129,7 +215,8 @@ static pipe_t *pipe_create(void)
  */
 static void pipe_destroy(pipe_t *pipe)
 {
-    NOT_YET_IMPLEMENTED("PIPES: pipe_destroy");
+    kfree(pipe->pv_buf);
+    slab_obj_free(pipe_allocator, pipe);
 }
 
 /* pipefs vnode operations */
@@ -162,8 +249,19 @@ static void pipe_delete_vnode(fs_t *fs, vnode_t *vnode)
  */
 static vnode_t *pget(void)
 {
-    NOT_YET_IMPLEMENTED("PIPES: pget");
-    return NULL;
+    vnode_t *vn = vget(&pipe_fs, (ino_t)next_pno++);
+    if (!vn)
+    {
+        return NULL;
+    }
+    pipe_t *pipe = pipe_create();
+    if (!pipe)
+    {
+        vput(&vn);
+        return NULL;
+    }
+    vn->vn_i = pipe;
+    return vn;
 }
 
 /*
@@ -179,8 +277,43 @@ static vnode_t *pget(void)
  */
 int do_pipe(int pipefd[2])
 {
-    NOT_YET_IMPLEMENTED("PIPES: do_pipe");
-    return -ENOTSUP;
+    vnode_t *vn = pget();
+    if (!vn)
+    {
+        return -ENOMEM;
+    }
+
+    int rfd;
+    long ret = get_empty_fd(&rfd);
+    if (ret)
+    {
+        vput(&vn);
+        return (int)ret;
+    }
+    file_t *rfile = fcreate(rfd, vn, FMODE_READ);
+    if (!rfile)
+    {
+        vput(&vn);
+        return -ENOMEM;
+    }
+
+    int wfd;
+    ret = get_empty_fd(&wfd);
+    if (!ret && !fcreate(wfd, vn, FMODE_WRITE))
+    {
+        ret = -ENOMEM;
+    }
+    if (ret)
+    {
+        do_close(rfd);
+        vput(&vn);
+        return (int)ret;
+    }
+
+    vput(&vn);
+    pipefd[0] = rfd;
+    pipefd[1] = wfd;
+    return 0;
 }
 
 /*
@@ -199,8 +332,104 @@ int do_pipe(int pipefd[2])
  */
 static long pipe_read(vnode_t *vnode, size_t pos, void *buf, size_t count)
 {
-    NOT_YET_IMPLEMENTED("PIPES: pipe_read");
-    return -EINVAL;
+    pipe_t *pipe = VNODE_TO_PIPE(vnode);
+    char *dest = buf;
+    size_t nread = 0;
+
+    /* As with chardev reads, unlock the vnode while potentially blocking so
+     * that writers (who enter through the same vnode) can make progress. */
+    vunlock(vnode);
+    kmutex_lock(&pipe->pv_rdlock);
+    pipe->pv_reader_thr = curthr;
+    while (nread < count)
+    {
+        if (pipe->pv_size > 0)
+        {
+            size_t chunk = MIN(count - nread, pipe->pv_size);
+            size_t tail =
+                (pipe->pv_head + pipe->pv_cap - pipe->pv_size) % pipe->pv_cap;
+            size_t contig = MIN(chunk, pipe->pv_cap - tail);
+            memcpy(dest + nread, pipe->pv_buf + tail, contig);
+            memcpy(dest + nread + contig, pipe->pv_buf, chunk - contig);
+            pipe->pv_size -= chunk;
+            nread += chunk;
+            /* Only wake writers once we have drained below the low
+             * watermark, or if we are about to stop draining. */
+            if (pipe->pv_size <= PIPE_LOW_WATER(pipe) || nread == count)
+            {
+                sched_wakeup_on(&pipe->pv_write_waitq, NULL);
+            }
+            /* pollers care about any free space, not the watermark */
+            poll_notify();
+            continue;
+        }
+        if (!pipe->pv_writers)
+        {
+            break;
+        }
+#ifdef __SMP__
+        /* The buffer is empty, but if a writer is mid-call on another core
+         * it will likely deposit within microseconds; spin briefly for it
+         * before paying the two-switch sleep/wakeup round trip. */
+        long spins = PIPE_SPIN_LIMIT;
+        while (spins-- && !pipe->pv_size && pipe->pv_writer_thr &&
+               sched_thread_on_cpu(pipe->pv_writer_thr))
+        {
+            __asm__("pause;");
+        }
+        if (pipe->pv_size > 0)
+        {
+            continue;
+        }
+#endif
+        /* The buffer is empty; publish the rest of our destination so a
+         * writer can deposit into it directly while we sleep. */
+        pipe->pv_dst = dest + nread;
+        pipe->pv_dst_count = count - nread;
+        pipe->pv_dst_copied = 0;
+        long ret = sched_cancellable_sleep_on(&pipe->pv_read_waitq, NULL);
+        nread += pipe->pv_dst_copied;
+        pipe->pv_dst = NULL;
+        pipe->pv_dst_count = 0;
+        pipe->pv_dst_copied = 0;
+        if (ret)
+        {
+            pipe->pv_reader_thr = NULL;
+            kmutex_unlock(&pipe->pv_rdlock);
+            vlock(vnode);
+            return nread ? (long)nread : ret;
+        }
+    }
+    pipe->pv_reader_thr = NULL;
+    kmutex_unlock(&pipe->pv_rdlock);
+    vlock(vnode);
+    return (long)nread;
+}
+
+/*
+ * Double the pipe's buffer capacity (up to PIPE_BUF_MAX), linearizing the
+ * ring into the new buffer. Called when a writer finds the buffer full, so
+ * sustained pressure earns the pipe a bigger buffer instead of a context
+ * switch. If the allocation fails the pipe just keeps its current buffer
+ * and the writer falls back to sleeping.
+ */
+static void pipe_grow(pipe_t *pipe)
+{
+    size_t newcap = MIN(pipe->pv_cap * 2, (size_t)PIPE_BUF_MAX);
+    char *newbuf = kmalloc(newcap);
+    if (!newbuf)
+    {
+        return;
+    }
+    size_t tail =
+        (pipe->pv_head + pipe->pv_cap - pipe->pv_size) % pipe->pv_cap;
+    size_t contig = MIN(pipe->pv_size, pipe->pv_cap - tail);
+    memcpy(newbuf, pipe->pv_buf + tail, contig);
+    memcpy(newbuf + contig, pipe->pv_buf, pipe->pv_size - contig);
+    kfree(pipe->pv_buf);
+    pipe->pv_buf = newbuf;
+    pipe->pv_cap = newcap;
+    pipe->pv_head = (off_t)(pipe->pv_size % newcap);
 }
 
 /*
@@ -215,8 +444,93 @@ static long pipe_read(vnode_t *vnode, size_t pos, void *buf, size_t count)
 static long pipe_write(vnode_t *vnode, size_t pos, const void *buf,
                        size_t count)
 {
-    NOT_YET_IMPLEMENTED("PIPES: pipe_write");
-    return -EINVAL;
+    pipe_t *pipe = VNODE_TO_PIPE(vnode);
+    const char *src = buf;
+    size_t nwritten = 0;
+
+    /* See pipe_read for why we drop the vnode lock. */
+    vunlock(vnode);
+    kmutex_lock(&pipe->pv_wrlock);
+    pipe->pv_writer_thr = curthr;
+    while (nwritten < count)
+    {
+        if (!pipe->pv_readers)
+        {
+            pipe->pv_writer_thr = NULL;
+            kmutex_unlock(&pipe->pv_wrlock);
+            vlock(vnode);
+            return -EPIPE;
+        }
+        /* Fast path: a sleeping reader has published its destination, so
+         * deposit into it directly and skip pv_buf (one copy, one wakeup,
+         * no 4K-at-a-time round trips). The buffer is necessarily empty
+         * while a reader is waiting. */
+        if (pipe->pv_dst && pipe->pv_dst_copied < pipe->pv_dst_count)
+        {
+            size_t chunk =
+                MIN(count - nwritten, pipe->pv_dst_count - pipe->pv_dst_copied);
+            memcpy(pipe->pv_dst + pipe->pv_dst_copied, src + nwritten, chunk);
+            pipe->pv_dst_copied += chunk;
+            nwritten += chunk;
+            sched_wakeup_on(&pipe->pv_read_waitq, NULL);
+            continue;
+        }
+        if (pipe->pv_size == pipe->pv_cap && pipe->pv_cap < PIPE_BUF_MAX)
+        {
+            pipe_grow(pipe);
+        }
+        if (pipe->pv_size < pipe->pv_cap)
+        {
+            size_t chunk = MIN(count - nwritten, pipe->pv_cap - pipe->pv_size);
+            size_t contig =
+                MIN(chunk, (size_t)((off_t)pipe->pv_cap - pipe->pv_head));
+            memcpy(pipe->pv_buf + pipe->pv_head, src + nwritten, contig);
+            memcpy(pipe->pv_buf, src + nwritten + contig, chunk - contig);
+            pipe->pv_head = (pipe->pv_head + (off_t)chunk) % (off_t)pipe->pv_cap;
+            pipe->pv_size += chunk;
+            nwritten += chunk;
+            /* Only wake readers once the buffer has filled past the high
+             * watermark, or if we have nothing more to contribute. */
+            if (pipe->pv_size >= PIPE_HIGH_WATER(pipe) || nwritten == count)
+            {
+                sched_wakeup_on(&pipe->pv_read_waitq, NULL);
+            }
+            /* pollers care about any data, not the watermark */
+            poll_notify();
+            continue;
+        }
+#ifdef __SMP__
+        /* Full at max capacity, but a reader mid-call on another core will
+         * likely drain space within microseconds; spin briefly for it
+         * before paying the two-switch sleep/wakeup round trip. */
+        long spins = PIPE_SPIN_LIMIT;
+        while (spins-- && pipe->pv_size == pipe->pv_cap &&
+               pipe->pv_reader_thr &&
+               sched_thread_on_cpu(pipe->pv_reader_thr))
+        {
+            __asm__("pause;");
+        }
+        if (pipe->pv_size < pipe->pv_cap)
+        {
+            continue;
+        }
+#endif
+        /* Full at max capacity; make sure a reader will drain us, then
+         * wait for the buffer to fall below the low watermark. */
+        sched_wakeup_on(&pipe->pv_read_waitq, NULL);
+        long ret = sched_cancellable_sleep_on(&pipe->pv_write_waitq, NULL);
+        if (ret)
+        {
+            pipe->pv_writer_thr = NULL;
+            kmutex_unlock(&pipe->pv_wrlock);
+            vlock(vnode);
+            return nwritten ? (long)nwritten : ret;
+        }
+    }
+    pipe->pv_writer_thr = NULL;
+    kmutex_unlock(&pipe->pv_wrlock);
+    vlock(vnode);
+    return (long)nwritten;
 }
 
 /*
@@ -227,8 +541,47 @@ static long pipe_write(vnode_t *vnode, size_t pos, const void *buf,
  */
 static long pipe_stat(vnode_t *vnode, stat_t *ss)
 {
-    NOT_YET_IMPLEMENTED("PIPES: pipe_stat");
-    return -EINVAL;
+    memset(ss, 0, sizeof(stat_t));
+    ss->st_mode = S_IFIFO;
+    ss->st_ino = (int)vnode->vn_vno;
+    return 0;
+}
+
+/*
+ * Report the pipe's current readiness for do_poll. The read end is ready
+ * when there is buffered data (or no writers remain, so a read would
+ * return immediately); the write end is ready when the buffer has room
+ * (or no readers remain, so a write would fail immediately). This is a
+ * snapshot taken without the rd/wr mutexes -- do_poll rescans after
+ * every poll_notify(), so a stale answer only costs an extra scan.
+ */
+static long pipe_poll(vnode_t *vnode, file_t *file, int events)
+{
+    pipe_t *pipe = VNODE_TO_PIPE(vnode);
+    long revents = 0;
+    if (file->f_mode & FMODE_READ)
+    {
+        if ((events & POLLIN) && pipe->pv_size > 0)
+        {
+            revents |= POLLIN;
+        }
+        if (!pipe->pv_writers)
+        {
+            revents |= POLLHUP;
+        }
+    }
+    if (file->f_mode & FMODE_WRITE)
+    {
+        if ((events & POLLOUT) && pipe->pv_size < pipe->pv_cap)
+        {
+            revents |= POLLOUT;
+        }
+        if (!pipe->pv_readers)
+        {
+            revents |= POLLERR;
+        }
+    }
+    return revents;
 }
 
 /*
@@ -239,7 +592,15 @@ static long pipe_stat(vnode_t *vnode, stat_t *ss)
  */
 static long pipe_acquire(vnode_t *vnode, file_t *file)
 {
-    NOT_YET_IMPLEMENTED("PIPES: pipe_acquire");
+    pipe_t *pipe = VNODE_TO_PIPE(vnode);
+    if (file->f_mode & FMODE_READ)
+    {
+        pipe->pv_readers++;
+    }
+    if (file->f_mode & FMODE_WRITE)
+    {
+        pipe->pv_writers++;
+    }
     return 0;
 }
 
@@ -251,6 +612,22 @@ static long pipe_acquire(vnode_t *vnode, file_t *file)
  */
 static long pipe_release(vnode_t *vnode, file_t *file)
 {
-    NOT_YET_IMPLEMENTED("PIPES: pipe_release");
+    pipe_t *pipe = VNODE_TO_PIPE(vnode);
+    if (file->f_mode & FMODE_READ)
+    {
+        if (!--pipe->pv_readers)
+        {
+            sched_wakeup_on(&pipe->pv_write_waitq, NULL);
+            poll_notify(); /* write ends now see POLLERR */
+        }
+    }
+    if (file->f_mode & FMODE_WRITE)
+    {
+        if (!--pipe->pv_writers)
+        {
+            sched_wakeup_on(&pipe->pv_read_waitq, NULL);
+            poll_notify(); /* read ends now see POLLHUP */
+        }
+    }
     return 0;
 }
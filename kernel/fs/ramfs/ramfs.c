@@ -378,6 +378,7 @@ static ssize_t ramfs_create(vnode_t *dir, const char *name, size_t name_len,
     entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
 
     VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+    vnode_stat_dirty(dir);
 
     *result = vn;
 
@@ -418,6 +419,11 @@ static ssize_t ramfs_mknod(struct vnode *dir, const char *name, size_t name_len,
     {
         ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_DATA, devid);
     }
+    else if (S_ISLNK(mode))
+    {
+        /* symlinks are only supported on s5fs */
+        return -ENOTSUP;
+    }
     else
     {
         panic("Invalid mode!\n");
@@ -434,6 +440,7 @@ static ssize_t ramfs_mknod(struct vnode *dir, const char *name, size_t name_len,
     entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
 
     VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+    vnode_stat_dirty(dir);
 
     vnode_t *child = vget(dir->vn_fs, ino);
 
@@ -530,6 +537,9 @@ static ssize_t ramfs_append_dirent(vnode_t *dir, const char *name,
     /* Increase linkcount */
     VNODE_TO_RAMFSINODE(child)->rf_linkcount++;
 
+    vnode_stat_dirty(dir);
+    vnode_stat_dirty(child);
+
     return 0;
 }
 
@@ -556,6 +566,8 @@ static ssize_t ramfs_delete_dirent(vnode_t *dir, const char *name,
 
     VNODE_TO_RAMFSINODE(dir)->rf_size -= sizeof(ramfs_dirent_t);
     VNODE_TO_RAMFSINODE(child)->rf_linkcount--;
+    vnode_stat_dirty(dir);
+    vnode_stat_dirty(child);
 
     return 0;
 }
@@ -672,6 +684,7 @@ static ssize_t ramfs_mkdir(vnode_t *dir, const char *name, size_t name_len,
     entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
 
     VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+    vnode_stat_dirty(dir);
 
     /* Set up '.' and '..' in the directory */
     entry = (ramfs_dirent_t *)VNODE_TO_RAMFS(dir)->rfs_inodes[ino]->rf_mem;
@@ -739,8 +752,10 @@ static ssize_t ramfs_rmdir(vnode_t *dir, const char *name, size_t name_len)
         }
     }
     VNODE_TO_RAMFSINODE(dir)->rf_size -= sizeof(ramfs_dirent_t);
+    vnode_stat_dirty(dir);
 
     VNODE_TO_RAMFSINODE(child)->rf_linkcount--;
+    vnode_stat_dirty(child);
     vput_locked(&child);
 
     return 0;
@@ -785,6 +800,7 @@ static ssize_t ramfs_write(vnode_t *file, size_t offset, const void *buf,
     KASSERT(file->vn_len == inode->rf_size);
     file->vn_len = MAX(file->vn_len, offset + ret);
     inode->rf_size = file->vn_len;
+    vnode_stat_dirty(file);
 
     return ret;
 }
@@ -848,5 +864,6 @@ static void ramfs_truncate_file(vnode_t *file)
     ramfs_inode_t *i = VNODE_TO_RAMFSINODE(file);
     i->rf_size = 0;
     file->vn_len = 0;
+    vnode_stat_dirty(file);
     memset(i->rf_mem, 0, PAGE_SIZE);
 }
\ No newline at end of file
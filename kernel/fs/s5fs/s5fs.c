@@ -6,12 +6,19 @@
 #include "util/debug.h"
 #include "util/printf.h"
 #include "util/string.h"
+#include "util/time.h"
 
 #include "proc/kmutex.h"
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
 
 #include "fs/dirent.h"
+#include "fs/fcntl.h"
 #include "fs/file.h"
 #include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_journal.h"
 #include "fs/s5fs/s5fs_subr.h"
 #include "fs/stat.h"
 
@@ -34,6 +41,19 @@ static ssize_t s5fs_read(vnode_t *vnode, size_t pos, void *buf, size_t len);
 static ssize_t s5fs_write(vnode_t *vnode, size_t pos, const void *buf,
                           size_t len);
 
+static ssize_t s5fs_read_direct(vnode_t *vnode, size_t pos, void *buf,
+                                size_t len);
+
+static ssize_t s5fs_write_direct(vnode_t *vnode, size_t pos, const void *buf,
+                                 size_t len);
+
+static long s5fs_fsync(vnode_t *vnode, long datasync);
+
+static long s5fs_advise(vnode_t *vnode, int advice);
+
+static long s5fs_seek_sparse(vnode_t *vnode, size_t pos, long datawise,
+                             size_t *ret);
+
 static long s5fs_mmap(vnode_t *file, mobj_t **ret);
 
 static long s5fs_mknod(struct vnode *dir, const char *name, size_t namelen,
@@ -76,6 +96,7 @@ fs_ops_t s5fs_fsops = {.read_vnode = s5fs_read_vnode,
 
 static vnode_ops_t s5fs_dir_vops = {.read = NULL,
                                     .write = NULL,
+                                    .fsync = s5fs_fsync,
                                     .mmap = NULL,
                                     .mknod = s5fs_mknod,
                                     .lookup = s5fs_lookup,
@@ -95,6 +116,11 @@ static vnode_ops_t s5fs_dir_vops = {.read = NULL,
 
 static vnode_ops_t s5fs_file_vops = {.read = s5fs_read,
                                      .write = s5fs_write,
+                                     .read_direct = s5fs_read_direct,
+                                     .write_direct = s5fs_write_direct,
+                                     .fsync = s5fs_fsync,
+                                     .advise = s5fs_advise,
+                                     .seek_sparse = s5fs_seek_sparse,
                                      .mmap = s5fs_mmap,
                                      .mknod = NULL,
                                      .lookup = NULL,
@@ -111,6 +137,198 @@ static vnode_ops_t s5fs_file_vops = {.read = s5fs_read,
                                      .flush_pframe = NULL,
                                      .truncate_file = s5fs_truncate_file};
 
+/* Interval between write-behind passes, in timer ticks (~1ms each), and the
+ * number of dirty blocks flushed per LBA-sorted batch. */
+#define S5FS_WB_INTERVAL_TICKS 500
+#define S5FS_WB_BATCH 32
+
+static long s5fs_wb_ready = 0;
+
+/* Flush every dirty block of the mount's disk cache, in batches sorted by
+ * disk block number, so do_write returns once the page cache is dirtied and
+ * the disk sees elevator-ordered I/O. Must be called with the mount's
+ * s5f_wb_mutex held, which is what serializes passes against sync and
+ * unmount. */
+static void s5fs_writeback_pass(s5fs_t *s5fs)
+{
+    mobj_t *mobj = S5FS_TO_VMOBJ(s5fs);
+    long more = 1;
+    while (more)
+    {
+        blocknum_t batch[S5FS_WB_BATCH];
+        size_t count = 0;
+
+        mobj_lock(mobj);
+        list_iterate(&mobj->mo_dirty_pframes, pf, pframe_t, pf_dirty_link)
+        {
+            if (count == S5FS_WB_BATCH)
+            {
+                break;
+            }
+            batch[count++] = (blocknum_t)pf->pf_pagenum;
+        }
+        more = count == S5FS_WB_BATCH;
+
+        /* insertion sort by block number; the batch is small */
+        for (size_t i = 1; i < count; i++)
+        {
+            blocknum_t key = batch[i];
+            size_t j = i;
+            for (; j && batch[j - 1] > key; j--)
+            {
+                batch[j] = batch[j - 1];
+            }
+            batch[j] = key;
+        }
+
+        /* write-ahead: commit the batch's metadata blocks to the journal
+         * before they are written in place */
+        size_t journaled = s5_journal_log(s5fs, batch, count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            pframe_t *pf;
+            mobj_find_pframe(mobj, batch[i], &pf);
+            if (!pf)
+            {
+                continue;
+            }
+            if (pf->pf_addr)
+            {
+                mobj_flush_pframe(mobj, pf);
+            }
+            pframe_release(&pf);
+        }
+        mobj_unlock(mobj);
+
+        if (journaled)
+        {
+            s5_journal_checkpoint(s5fs);
+        }
+    }
+}
+
+/* Copy the inodes queued by s5_dirty_inode back into their disk blocks.
+ * Each batch is sorted by inode block, so every queued inode sharing a
+ * block is copied in while the block is held and the block is dirtied
+ * once, instead of once per inode update. Returns the number of inodes
+ * written; the caller should follow a nonzero return with another
+ * s5fs_writeback_pass so the updated inode blocks reach the disk only
+ * after the data blocks they describe. Must be called with the mount's
+ * s5f_wb_mutex held. */
+static size_t s5fs_writeback_inodes(s5fs_t *s5fs)
+{
+    size_t total = 0;
+    long more = 1;
+    while (more)
+    {
+        s5_node_t *batch[S5FS_WB_BATCH];
+        size_t count = 0;
+
+        list_iterate(&s5fs->s5f_dirty_nodes, sn, s5_node_t, s5n_dirty_link)
+        {
+            if (count == S5FS_WB_BATCH)
+            {
+                break;
+            }
+            list_remove(&sn->s5n_dirty_link);
+            sn->dirtied_inode = 0;
+            /* the queue's reference keeps sn alive until the vput below */
+            batch[count++] = sn;
+        }
+        more = count == S5FS_WB_BATCH;
+
+        /* insertion sort by inode block so inodes sharing one end up
+         * adjacent; the batch is small */
+        for (size_t i = 1; i < count; i++)
+        {
+            s5_node_t *key = batch[i];
+            size_t j = i;
+            for (; j && S5_INODE_BLOCK(batch[j - 1]->vnode.vn_vno) >
+                            S5_INODE_BLOCK(key->vnode.vn_vno);
+                 j--)
+            {
+                batch[j] = batch[j - 1];
+            }
+            batch[j] = key;
+        }
+
+        size_t i = 0;
+        while (i < count)
+        {
+            blocknum_t blocknum = S5_INODE_BLOCK(batch[i]->vnode.vn_vno);
+            pframe_t *pf;
+            s5_get_disk_block(s5fs, blocknum, 1, &pf);
+            do
+            {
+                s5_inode_t *slot = (s5_inode_t *)pf->pf_addr +
+                                   S5_INODE_OFFSET(batch[i]->vnode.vn_vno);
+                memcpy(slot, &batch[i]->inode, sizeof(s5_inode_t));
+                i++;
+            } while (i < count &&
+                     S5_INODE_BLOCK(batch[i]->vnode.vn_vno) == blocknum);
+            s5_release_disk_block(&pf);
+        }
+        total += count;
+
+        /* dropping the last reference may destroy the vnode, which is fine
+         * now that its inode has been written out */
+        for (size_t k = 0; k < count; k++)
+        {
+            vnode_t *vn = &batch[k]->vnode;
+            vput(&vn);
+        }
+    }
+    return total;
+}
+
+static void *s5fs_writeback_run(long arg1, void *arg2)
+{
+    s5fs_t *s5fs = arg2;
+    dbg(DBG_PROC, "s5fs writeback daemon for %s running\n",
+        s5fs->s5f_fs->fs_dev);
+    for (;;)
+    {
+        spinlock_lock(&s5fs->s5f_wb_spin);
+        if (s5fs->s5f_wb_exit)
+        {
+            break;
+        }
+        /* releases s5f_wb_spin once we are on the queue */
+        sched_sleep_on_timeout(&s5fs->s5f_wb_waitq, &s5fs->s5f_wb_spin,
+                               S5FS_WB_INTERVAL_TICKS);
+        spinlock_lock(&s5fs->s5f_wb_spin);
+        if (s5fs->s5f_wb_exit)
+        {
+            break;
+        }
+        spinlock_unlock(&s5fs->s5f_wb_spin);
+
+        kmutex_lock(&s5fs->s5f_wb_mutex);
+        /* data blocks first, then the inode blocks describing them */
+        s5fs_writeback_pass(s5fs);
+        if (s5fs_writeback_inodes(s5fs))
+        {
+            s5fs_writeback_pass(s5fs);
+        }
+        kmutex_unlock(&s5fs->s5f_wb_mutex);
+    }
+    /* still holding s5f_wb_spin: acknowledge the stop request so the
+     * unmount waiting in s5fs_umount can proceed */
+    s5fs->s5f_wb_exit = 2;
+    sched_wakeup_on(&s5fs->s5f_wb_waitq, NULL);
+    spinlock_unlock(&s5fs->s5f_wb_spin);
+    return NULL;
+}
+
+void s5fs_writeback_start()
+{
+    /* Daemons are per-mount and spawned by s5fs_mount; this just records
+     * that processes exist so mounts from here on can create them. The
+     * root file system is mounted later in boot than this call. */
+    s5fs_wb_ready = 1;
+}
+
 /*
  * Initialize the passed-in fs_t. The only members of fs_t that are initialized
  * before the call to s5fs_mount are fs_dev and fs_type ("s5fs"). You must
@@ -164,10 +382,55 @@ long s5fs_mount(fs_t *fs)
 
     kmutex_init(&s5fs->s5f_mutex);
 
+    /* replay any committed journal transaction before the free-block
+     * bitmap is built from (possibly just-repaired) metadata */
+    s5_journal_recover(s5fs);
+
+    s5_build_block_bitmap(s5fs);
+
+    list_init(&s5fs->s5f_dirty_nodes);
+    list_init(&s5fs->s5f_resv_nodes);
+    spinlock_init(&s5fs->s5f_resv_spin);
+    kmutex_init(&s5fs->s5f_wb_mutex);
+    spinlock_init(&s5fs->s5f_wb_spin);
+    sched_queue_init(&s5fs->s5f_wb_waitq);
+    s5fs->s5f_wb_exit = -1;
+
+    spinlock_init(&s5fs->s5f_txn_spin);
+    sched_queue_init(&s5fs->s5f_txn_waitq);
+    s5fs->s5f_txn_count = 0;
+    s5fs->s5f_txn_open = 1;
+    s5fs->s5f_txn_done = 0;
+    s5fs->s5f_txn_leader = 0;
+    s5fs->s5f_txn_err = 0;
+
+    s5fs->s5f_mount_epoch = do_time() - (time_t)(core_uptime() / 1000);
+
     s5fs->s5f_fs = fs;
 
     fs->fs_i = s5fs;
     fs->fs_ops = &s5fs_fsops;
+
+    if (s5_journal_init(s5fs))
+    {
+        /* a journal region was carved out of the free blocks; persist the
+         * shrunken free list before anything can allocate from it */
+        s5fs_sync(fs);
+    }
+
+    if (s5fs_wb_ready)
+    {
+        proc_t *proc = proc_create("s5fs_wb");
+        KASSERT(proc && "couldn't create the s5fs writeback daemon");
+        kthread_t *thr = kthread_create(proc, s5fs_writeback_run, 0, s5fs);
+        KASSERT(thr && "couldn't create the s5fs writeback daemon's thread");
+        s5fs->s5f_wb_exit = 0;
+        /* Steady background share: up to 4 of every 64 ticks at the top
+         * priority (see sched_set_deadline). */
+        sched_set_deadline(thr, 4, 64);
+        sched_make_runnable(thr);
+    }
+
     fs->fs_root = vget(fs, s5fs->s5f_super.s5s_root_inode);
     // vunlock(fs->fs_root);
 
@@ -209,6 +472,21 @@ static void s5fs_read_vnode(fs_t *fs, vnode_t *vn)
     memcpy(&s5n->inode, to_copy, sizeof(s5_inode_t));
     s5_release_disk_block(&pframe);
     s5n->dirtied_inode = 0;
+    list_link_init(&s5n->s5n_dirty_link);
+    s5n->s5n_ra_next = 0;
+    s5n->s5n_ra_streak = 0;
+    s5n->s5n_ra_window = S5_RA_WINDOW_MIN;
+    s5n->s5n_ra_advice = FADV_NORMAL;
+    s5n->s5n_alloc_hint = 0;
+    s5n->s5n_resv_start = 0;
+    s5n->s5n_resv_count = 0;
+    list_link_init(&s5n->s5n_resv_link);
+    s5n->s5n_dirhash = NULL;
+    s5n->s5n_dirhash_retry = 0;
+    s5n->s5n_leaf_cache_slot = 0;
+    s5n->s5n_leaf_cache_block = 0;
+    memset(s5n->s5n_dirty_blocks, 0, sizeof(s5n->s5n_dirty_blocks));
+    s5n->s5n_dirty_spill = 0;
     vn->vn_devid = s5n->inode.s5_indirect_block;
     vn->vn_len = s5n->inode.s5_un.s5_size;
     uint16_t t = s5n->inode.s5_type;
@@ -228,6 +506,12 @@ static void s5fs_read_vnode(fs_t *fs, vnode_t *vn)
         vn->vn_mode = S_IFBLK;
         vn->vn_ops = NULL;
     }
+    if (t == S5_TYPE_LNK) {
+        /* the target path is ordinary file data, so the file ops (read in
+         * particular, for namev_follow) work unchanged */
+        vn->vn_mode = S_IFLNK;
+        vn->vn_ops = &s5fs_file_vops;
+    }
 }
 
 /* Clean up the inode corresponding to the given vnode.
@@ -245,6 +529,10 @@ static void s5fs_delete_vnode(fs_t *fs, vnode_t *vn)
 {
     s5_node_t* s5n = VNODE_TO_S5NODE(vn);
     s5fs_t* s5f = FS_TO_S5FS(fs);
+    /* a queued node holds a reference, so it can never be destroyed */
+    KASSERT(!list_link_is_linked(&s5n->s5n_dirty_link));
+    s5_dirhash_destroy(s5n);
+    s5_resv_release(s5f, s5n);
     s5_inode_t inode = s5n->inode;
     if (inode.s5_linkcount == 0) {
         s5_free_inode(s5f, inode.s5_number);
@@ -276,6 +564,27 @@ static long s5fs_umount(fs_t *fs)
     s5fs_t *s5fs = FS_TO_S5FS(fs);
     blockdev_t *bd = s5fs->s5f_bdev;
 
+    /* stop this mount's write-behind daemon and write out any
+     * still-queued inodes; the queue's vnode references would otherwise
+     * trip the refcount check below. Taking the mutex afterwards waits
+     * out any pass the daemon was mid-way through. */
+    spinlock_lock(&s5fs->s5f_wb_spin);
+    if (s5fs->s5f_wb_exit == 0)
+    {
+        s5fs->s5f_wb_exit = 1;
+        sched_wakeup_on(&s5fs->s5f_wb_waitq, NULL);
+        while (s5fs->s5f_wb_exit != 2)
+        {
+            /* releases s5f_wb_spin once we are on the queue */
+            sched_sleep_on(&s5fs->s5f_wb_waitq, &s5fs->s5f_wb_spin);
+            spinlock_lock(&s5fs->s5f_wb_spin);
+        }
+    }
+    spinlock_unlock(&s5fs->s5f_wb_spin);
+    kmutex_lock(&s5fs->s5f_wb_mutex);
+    s5fs_writeback_inodes(s5fs);
+    kmutex_unlock(&s5fs->s5f_wb_mutex);
+
     if (s5fs_check_refcounts(fs))
     {
         panic(
@@ -296,6 +605,18 @@ static long s5fs_umount(fs_t *fs)
     vput(&fs->fs_root);
 
     s5fs_sync(fs);
+    kfree(s5fs->s5f_block_bitmap);
+    kfree(s5fs->s5f_group_nfree);
+    kfree(s5fs->s5f_group_ffree);
+    if (s5fs->s5f_group_loaded)
+    {
+        kfree(s5fs->s5f_group_loaded);
+    }
+    kfree(s5fs->s5f_meta_bitmap);
+    if (s5fs->s5f_journal_buf)
+    {
+        page_free(s5fs->s5f_journal_buf);
+    }
     kfree(s5fs);
     return 0;
 }
@@ -305,6 +626,19 @@ static void s5fs_sync(fs_t *fs)
     s5fs_t *s5fs = FS_TO_S5FS(fs);
     mobj_t *mobj = S5FS_TO_VMOBJ(s5fs);
 
+    /* write any queued dirty inodes into their blocks so the flush below
+     * covers them */
+    kmutex_lock(&s5fs->s5f_wb_mutex);
+    s5fs_writeback_inodes(s5fs);
+    kmutex_unlock(&s5fs->s5f_wb_mutex);
+
+    /* give back every file's unused reservation window, then rebuild the
+     * on-disk free list from the allocation bitmap before the super block
+     * is written out; reserved blocks must never hit the disk as
+     * allocated-but-unreferenced */
+    s5_resv_release_all(s5fs);
+    s5_sync_free_list(s5fs);
+
     mobj_lock(mobj);
 
     pframe_t *pf;
@@ -316,11 +650,45 @@ static void s5fs_sync(fs_t *fs)
     mobj_unlock(S5FS_TO_VMOBJ(s5fs));
 }
 
+/* Threshold past which a batched access-time update forces its own
+ * metadata write (see s5_touch_atime). */
+#define S5_ATIME_FLUSH_SECS 60
+
+/*
+ * Record an access to sn, relatime style: the access time is updated in
+ * the in-memory inode on every call, but the inode is only marked dirty
+ * when it already was (the new stamp rides along with the pending write)
+ * or when the recorded time has fallen S5_ATIME_FLUSH_SECS behind, so
+ * metadata write load does not scale with read traffic. At worst an
+ * unflushed stamp within the threshold is lost if the node is evicted.
+ * Called with the vnode locked.
+ */
+static void s5_touch_atime(s5_node_t *sn)
+{
+    s5fs_t *s5fs = VNODE_TO_S5FS(&sn->vnode);
+    uint32_t now = (uint32_t)(s5fs->s5f_mount_epoch + core_uptime() / 1000);
+    uint32_t old = sn->inode.s5_atime;
+    if (old == now)
+    {
+        return;
+    }
+    sn->inode.s5_atime = now;
+    if (sn->dirtied_inode)
+    {
+        return;
+    }
+    if (now - old >= S5_ATIME_FLUSH_SECS)
+    {
+        s5_dirty_inode(sn);
+    }
+}
+
 /* Wrapper around s5_read_file. */
 static ssize_t s5fs_read(vnode_t *vnode, size_t pos, void *buf, size_t len)
 {
     KASSERT(!S_ISDIR(vnode->vn_mode) && "should be handled at the VFS level");
     s5_node_t* s5n = VNODE_TO_S5NODE(vnode);
+    s5_touch_atime(s5n);
     long status = s5_read_file(s5n, pos, buf, len);
     return status;
 }
@@ -335,6 +703,162 @@ static ssize_t s5fs_write(vnode_t *vnode, size_t pos, const void *buf,
     return status;
 }
 
+/* Wrapper around s5_direct_read_file, for files opened with O_DIRECT. */
+static ssize_t s5fs_read_direct(vnode_t *vnode, size_t pos, void *buf,
+                                size_t len)
+{
+    KASSERT(S_ISREG(vnode->vn_mode) && "only the VFS regular-file path "
+                                       "dispatches to direct I/O");
+    s5_node_t *s5n = VNODE_TO_S5NODE(vnode);
+    return s5_direct_read_file(s5n, pos, buf, len);
+}
+
+/* Wrapper around s5_direct_write_file, for files opened with O_DIRECT. */
+static ssize_t s5fs_write_direct(vnode_t *vnode, size_t pos, const void *buf,
+                                 size_t len)
+{
+    KASSERT(S_ISREG(vnode->vn_mode) && "only the VFS regular-file path "
+                                       "dispatches to direct I/O");
+    s5_node_t *s5n = VNODE_TO_S5NODE(vnode);
+    return s5_direct_write_file(s5n, pos, buf, len);
+}
+
+/* Wrapper around s5_advise (access-pattern hints from do_fadvise). */
+static long s5fs_advise(vnode_t *vnode, int advice)
+{
+    KASSERT(!S_ISDIR(vnode->vn_mode) && "only wired up for regular files");
+    return s5_advise(VNODE_TO_S5NODE(vnode), advice);
+}
+
+/*
+ * seek_sparse for lseek's SEEK_DATA / SEEK_HOLE: walk the file's blocks
+ * from pos with non-allocating disk-block lookups. Any allocated block
+ * counts as data, even if it happens to contain zeros; the implicit hole
+ * at the end of the file means SEEK_HOLE always finds something. Called
+ * with the vnode locked; do_lseek has already checked pos < vn_len.
+ */
+static long s5fs_seek_sparse(vnode_t *vnode, size_t pos, long datawise,
+                             size_t *ret)
+{
+    s5_node_t *sn = VNODE_TO_S5NODE(vnode);
+    size_t last_block = S5_DATA_BLOCK(vnode->vn_len - 1);
+    for (size_t block = S5_DATA_BLOCK(pos); block <= last_block; block++)
+    {
+        long loc = s5_file_block_to_disk_block(sn, block, 0);
+        if (loc < 0)
+        {
+            return loc;
+        }
+        if (datawise ? loc != 0 : loc == 0)
+        {
+            *ret = MAX(pos, block * S5_BLOCK_SIZE);
+            return 0;
+        }
+    }
+    if (!datawise)
+    {
+        /* implicit hole at end of file */
+        *ret = vnode->vn_len;
+        return 0;
+    }
+    return -ENXIO;
+}
+
+/* Flush this file's dirty blocks, and the metadata needed to reach them, to
+ * disk (the fsync vnode operation). Only blocks marked in the node's dirty
+ * map are written, so the I/O is proportional to this file's dirty pages.
+ * Data goes first; then, unless datasync is set and the inode is unchanged,
+ * the inode's disk block and the file's indirect block are committed to the
+ * journal and flushed, mirroring the writeback daemon's data-before-metadata
+ * order; concurrent fsyncs share one journal transaction (group commit). Called with the vnode locked, which keeps the dirty map from
+ * growing under the scan.
+ */
+static long s5fs_fsync(vnode_t *vnode, long datasync)
+{
+    s5_node_t *sn = VNODE_TO_S5NODE(vnode);
+    s5fs_t *s5fs = VNODE_TO_S5FS(vnode);
+    mobj_t *mobj = S5FS_TO_VMOBJ(s5fs);
+
+    if (sn->s5n_dirty_spill)
+    {
+        /* A block past the dirty map's reach was dirtied; fall back to
+         * flushing the whole disk cache rather than scanning the file. */
+        mobj_lock(mobj);
+        long status = mobj_flush(mobj);
+        mobj_unlock(mobj);
+        if (status < 0)
+        {
+            return status;
+        }
+        sn->s5n_dirty_spill = 0;
+        memset(sn->s5n_dirty_blocks, 0, sizeof(sn->s5n_dirty_blocks));
+    }
+
+    for (size_t word = 0; word < S5_DIRTY_MAP_WORDS; word++)
+    {
+        while (sn->s5n_dirty_blocks[word])
+        {
+            size_t bit = __builtin_ctzl(sn->s5n_dirty_blocks[word]);
+            sn->s5n_dirty_blocks[word] &= ~(1ul << bit);
+            long loc = s5_file_block_to_disk_block(sn, word * 64 + bit, 0);
+            if (loc <= 0)
+            {
+                /* truncated away since it was dirtied */
+                continue;
+            }
+            long status = 0;
+            pframe_t *pf;
+            mobj_lock(mobj);
+            mobj_find_pframe(mobj, (blocknum_t)loc, &pf);
+            if (pf)
+            {
+                if (pf->pf_addr)
+                {
+                    status = mobj_flush_pframe(mobj, pf);
+                }
+                pframe_release(&pf);
+            }
+            mobj_unlock(mobj);
+            if (status < 0)
+            {
+                sn->s5n_dirty_blocks[word] |= 1ul << bit;
+                return status;
+            }
+        }
+    }
+
+    if (datasync && !sn->dirtied_inode)
+    {
+        return 0;
+    }
+
+    /* Copy the in-memory inode into its disk block, then journal and flush
+     * that block along with the indirect block, which may also have been
+     * dirtied on this file's behalf. */
+    pframe_t *pf;
+    s5_get_disk_block(s5fs, S5_INODE_BLOCK(vnode->vn_vno), 1, &pf);
+    memcpy((s5_inode_t *)pf->pf_addr + S5_INODE_OFFSET(vnode->vn_vno),
+           &sn->inode, sizeof(s5_inode_t));
+    s5_release_disk_block(&pf);
+    sn->dirtied_inode = 0;
+
+    blocknum_t batch[3];
+    size_t count = 0;
+    batch[count++] = S5_INODE_BLOCK(vnode->vn_vno);
+    if (sn->inode.s5_indirect_block)
+    {
+        batch[count++] = (blocknum_t)sn->inode.s5_indirect_block;
+    }
+    if (sn->inode.s5_dindirect_block)
+    {
+        batch[count++] = (blocknum_t)sn->inode.s5_dindirect_block;
+    }
+
+    /* group commit: merge with any concurrent fsyncs so a burst shares
+     * one journal transaction (see s5_journal_group_commit) */
+    return s5_journal_group_commit(s5fs, batch, count);
+}
+
 /*
  * Any error handling should have been done before this function was called.
  * Simply add a reference to the underlying mobj and return it through ret.
@@ -372,7 +896,8 @@ static long s5fs_mknod(struct vnode *dir, const char *name, size_t namelen,
                        int mode, devid_t devid, struct vnode **out)
 {
     KASSERT(S_ISDIR(dir->vn_mode) && "should be handled at the VFS level");
-    if (mode != S_IFCHR && mode != S_IFBLK && mode != S_IFREG) {
+    if (mode != S_IFCHR && mode != S_IFBLK && mode != S_IFREG &&
+        mode != S_IFLNK) {
         return -ENOTSUP;
     }
     s5fs_t* s5f = VNODE_TO_S5FS(dir);
@@ -387,6 +912,9 @@ static long s5fs_mknod(struct vnode *dir, const char *name, size_t namelen,
         case S_IFBLK:
             type = S5_TYPE_BLK;
             break;
+        case S_IFLNK:
+            type = S5_TYPE_LNK;
+            break;
     }
     long inode = s5_alloc_inode(s5f, type, devid);
     if (inode < 0) {
@@ -561,11 +1089,22 @@ static long s5fs_rename(vnode_t *olddir, const char *oldname, size_t oldnamelen,
             vput_locked(&old_vnode);
             return -EISDIR;
         }
-        s5_remove_dirent(new_s5n, newname, newnamelen, VNODE_TO_S5NODE(new_vnode));
-        vunlock(new_vnode);
+        // overwrite the existing entry in place: the displaced child loses
+        // its link and the renamed one gains it, with no window where
+        // newname is missing from the directory
+        s5_replace_dirent(new_s5n, newname, newnamelen,
+                          VNODE_TO_S5NODE(new_vnode),
+                          VNODE_TO_S5NODE(old_vnode));
+        vput_locked(&new_vnode);
+    } else {
+        long status = s5_link(new_s5n, newname, newnamelen, VNODE_TO_S5NODE(old_vnode));
+        if (status < 0) {
+            vput_locked(&old_vnode);
+            return status;
+        }
     }
-    s5_link(new_s5n, newname, newnamelen, VNODE_TO_S5NODE(old_vnode));
     s5_remove_dirent(old_s5n, oldname, oldnamelen, VNODE_TO_S5NODE(old_vnode));
+    vput_locked(&old_vnode);
     return 0;
 }
 
@@ -691,6 +1230,7 @@ static long s5fs_rmdir(vnode_t *parent, const char *name, size_t namelen)
 static long s5fs_readdir(vnode_t *vnode, size_t pos, struct dirent *d)
 {
     KASSERT(S_ISDIR(vnode->vn_mode) && "should be handled at the VFS level");
+    s5_touch_atime(VNODE_TO_S5NODE(vnode));
     s5_dirent_t dirent;
     ssize_t bytes_read = s5_read_file(VNODE_TO_S5NODE(vnode), pos, (char *) &dirent, sizeof(s5_dirent_t));
     if (bytes_read < 0) {
@@ -738,7 +1278,7 @@ static long s5fs_stat(vnode_t *vnode, stat_t *ss)
     ss->st_dev = s5fs->s5f_bdev->bd_id;
     ss->st_uid = 0;
     ss->st_gid = 0;
-    ss->st_atime = 0;
+    ss->st_atime = s5n->inode.s5_atime;
     ss->st_mtime = 0;
     ss->st_ctime = 0;
     return 0;
@@ -760,8 +1300,8 @@ static void s5fs_truncate_file(vnode_t *file)
     s5_node_t* s5_node = VNODE_TO_S5NODE(file); 
     s5_inode_t* s5_inode = &s5_node->inode; 
     // setting the size of the inode to be 0 as well 
-    s5_inode->s5_un.s5_size = 0; 
-    s5_node->dirtied_inode = 1; 
+    s5_inode->s5_un.s5_size = 0;
+    s5_dirty_inode(s5_node);
     
     // Call subroutine to free the blocks that were used 
     vlock(file); 
@@ -782,6 +1322,19 @@ inline void s5_get_disk_block(s5fs_t *s5fs, blocknum_t blocknum, long forwrite,
     KASSERT(!ret && *pfp);
 }
 
+/*
+ * Like s5_get_disk_block with forwrite set, but for a block the caller will
+ * overwrite in full: an uncached block is not read in from disk first.
+ */
+inline void s5_get_disk_block_overwrite(s5fs_t *s5fs, blocknum_t blocknum,
+                                        pframe_t **pfp)
+{
+    mobj_lock(S5FS_TO_VMOBJ(s5fs));
+    long ret = mobj_get_pframe_overwrite(S5FS_TO_VMOBJ(s5fs), blocknum, pfp);
+    mobj_unlock(S5FS_TO_VMOBJ(s5fs));
+    KASSERT(!ret && *pfp);
+}
+
 /* Wrapper around pframe_release.
  *
  * Note: All pframe_release does is unlock the pframe. Why aren't we actually
@@ -835,6 +1388,11 @@ static long s5fs_get_pframe(vnode_t *vnode, uint64_t pagenum, long forwrite,
             mobj_free_pframe(&vnode->vn_mobj, pfp);
         }
         s5_get_disk_block(VNODE_TO_S5FS(vnode), (blocknum_t)loc, forwrite, pfp);
+        if (forwrite)
+        {
+            /* remember which of this file's blocks are dirty, for fsync */
+            s5_dirty_data_block(VNODE_TO_S5NODE(vnode), pagenum);
+        }
         return 0;
     }
     else
@@ -0,0 +1,465 @@
+/*
+ * Write-ahead metadata journal for s5fs.
+ *
+ * The journal is a small region of disk blocks carved out of the free list
+ * on first mount and recorded in the super block. Each writeback pass
+ * copies the metadata blocks of its batch into the journal as one
+ * transaction -- a descriptor block naming the targets, a verbatim copy of
+ * each block, and a commit block repeating the descriptor's sequence
+ * number -- before writing them in place, and marks the transaction
+ * checkpointed afterwards. All journal I/O goes straight through the
+ * block device, which writes synchronously, so on disk the commit always
+ * lands after the copies and before any in-place write.
+ *
+ * Recovery at mount is therefore O(journal): if the journal head holds a
+ * committed transaction, its copies are replayed onto their home blocks;
+ * anything short of a commit is discarded and the old contents remain
+ * authoritative. Metadata is never half-written in place without a
+ * committed journal record to restore it, with one narrow exception:
+ * pageoutd may evict a dirty cache block in place under memory pressure
+ * before the next pass journals it. Clean paths (sync, umount) flush the
+ * cache directly and do not journal.
+ *
+ * "Metadata" is the fixed inode region plus blocks the write paths tag
+ * via s5_meta_mark: indirect blocks and directory contents. Plain file
+ * data is not journaled.
+ */
+
+#include "fs/s5fs/s5fs_journal.h"
+#include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_subr.h"
+#include "kernel.h"
+#include "mm/kmalloc.h"
+#include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "proc/kmutex.h"
+#include "proc/sched.h"
+#include "util/debug.h"
+#include "util/string.h"
+
+#define S5_JOURNAL_DESC_MAGIC 0x6a53355f
+#define S5_JOURNAL_COMMIT_MAGIC 0x6a5335c1
+
+/* Largest number of metadata blocks one transaction can carry. */
+#define S5_JOURNAL_MAX_TXN (S5_JOURNAL_BLOCKS - 2)
+
+/* Descriptor and commit blocks share this layout; a commit repeats the
+ * descriptor's sequence number under its own magic. */
+typedef struct s5_journal_rec
+{
+    uint32_t jr_magic;
+    uint32_t jr_seq;
+    uint32_t jr_nblocks;
+    uint32_t jr_blocks[S5_JOURNAL_MAX_TXN];
+} s5_journal_rec_t;
+
+static inline long s5_journal_ready(s5fs_t *s5fs)
+{
+    return s5fs->s5f_super.s5s_journal_block != 0;
+}
+
+/* Journal I/O bypasses the block cache so write ordering is the order the
+ * device sees; both calls are synchronous. Reads take the polled path -
+ * they are single metadata blocks on the commit/recovery path, where the
+ * interrupt round trip costs more than the device access. */
+static long s5_journal_read_raw(s5fs_t *s5fs, blocknum_t blockno, void *buf)
+{
+    return blockdev_read_poll(s5fs->s5f_bdev, buf, blockno);
+}
+
+static long s5_journal_write_raw(s5fs_t *s5fs, blocknum_t blockno,
+                                 const void *buf)
+{
+    return s5fs->s5f_bdev->bd_ops->write_block(s5fs->s5f_bdev, buf, blockno, 1);
+}
+
+/* Write an empty committed transaction at the journal head, marking
+ * everything before it checkpointed. */
+static void s5_journal_write_empty(s5fs_t *s5fs, void *buf)
+{
+    s5_journal_rec_t *rec = buf;
+    memset(buf, 0, S5_BLOCK_SIZE);
+    rec->jr_magic = S5_JOURNAL_DESC_MAGIC;
+    rec->jr_seq = s5fs->s5f_journal_seq++;
+    rec->jr_nblocks = 0;
+    s5_journal_write_raw(s5fs, s5fs->s5f_super.s5s_journal_block, buf);
+    rec->jr_magic = S5_JOURNAL_COMMIT_MAGIC;
+    s5_journal_write_raw(s5fs, s5fs->s5f_super.s5s_journal_block + 1, buf);
+}
+
+/* The inode region is metadata by its location: block 0 is the super block
+ * and the inode blocks follow it. */
+static long s5_is_inode_block(s5fs_t *s5fs, blocknum_t blockno)
+{
+    return blockno >= 1 &&
+           blockno <= S5_INODE_BLOCK(s5fs->s5f_super.s5s_num_inodes - 1);
+}
+
+static long s5_is_meta_block(s5fs_t *s5fs, blocknum_t blockno)
+{
+    if (s5_is_inode_block(s5fs, blockno))
+    {
+        return 1;
+    }
+    return (size_t)blockno < s5fs->s5f_meta_bitmap_size &&
+           (s5fs->s5f_meta_bitmap[blockno / 64] >> (blockno % 64)) & 1;
+}
+
+/* Tag blockno as holding metadata so the writeback pass journals it. The
+ * bitmap grows under the super lock; as with s5_bitmap_grow, lookups never
+ * block mid-scan, so installing the fully built copy is safe with the
+ * kernel non-preemptible. */
+void s5_meta_mark(s5fs_t *s5fs, blocknum_t blockno)
+{
+    if ((size_t)blockno >= s5fs->s5f_meta_bitmap_size)
+    {
+        kmutex_lock(&s5fs->s5f_mutex);
+        if ((size_t)blockno >= s5fs->s5f_meta_bitmap_size)
+        {
+            size_t size =
+                MAX(s5fs->s5f_meta_bitmap_size, (size_t)S5_ALLOC_GROUP_BLOCKS);
+            while (size <= (size_t)blockno)
+            {
+                size *= 2;
+            }
+            uint64_t *bitmap = kmalloc(size / 8);
+            KASSERT(bitmap);
+            memset(bitmap, 0, size / 8);
+            if (s5fs->s5f_meta_bitmap)
+            {
+                memcpy(bitmap, s5fs->s5f_meta_bitmap,
+                       s5fs->s5f_meta_bitmap_size / 8);
+                kfree(s5fs->s5f_meta_bitmap);
+            }
+            s5fs->s5f_meta_bitmap = bitmap;
+            s5fs->s5f_meta_bitmap_size = size;
+        }
+        kmutex_unlock(&s5fs->s5f_mutex);
+    }
+    s5fs->s5f_meta_bitmap[blockno / 64] |= 1UL << (blockno % 64);
+}
+
+/* Untag a freed block so that, if it is reused for plain file data, its
+ * contents are no longer journaled. */
+void s5_meta_clear(s5fs_t *s5fs, blocknum_t blockno)
+{
+    if ((size_t)blockno < s5fs->s5f_meta_bitmap_size)
+    {
+        s5fs->s5f_meta_bitmap[blockno / 64] &= ~(1UL << (blockno % 64));
+    }
+}
+
+/* Replay the journal, if there is one. Called from s5fs_mount after the
+ * super block has been read, before the free-block bitmap is built, while
+ * the block cache holds nothing but the super block -- replayed blocks are
+ * written raw, so nothing may have stale cached copies of them. */
+void s5_journal_recover(s5fs_t *s5fs)
+{
+    s5fs->s5f_journal_seq = 1;
+    s5fs->s5f_journal_buf = NULL;
+    s5fs->s5f_meta_bitmap = NULL;
+    s5fs->s5f_meta_bitmap_size = 0;
+
+    /* fsmaker may reserve a region larger than we need (the record layout
+     * is compiled for S5_JOURNAL_BLOCKS; we only ever use the first
+     * S5_JOURNAL_BLOCKS of whatever was set aside) */
+    blocknum_t jstart = s5fs->s5f_super.s5s_journal_block;
+    if (!jstart || s5fs->s5f_super.s5s_journal_size < S5_JOURNAL_BLOCKS)
+    {
+        /* no journal yet; s5_journal_init will create one */
+        s5fs->s5f_super.s5s_journal_block = 0;
+        return;
+    }
+
+    void *desc_buf = page_alloc();
+    void *copy_buf = page_alloc();
+    KASSERT(desc_buf && copy_buf);
+
+    s5_journal_rec_t *desc = desc_buf;
+    long err = s5_journal_read_raw(s5fs, jstart, desc_buf);
+    if (err || desc->jr_magic != S5_JOURNAL_DESC_MAGIC ||
+        desc->jr_nblocks > S5_JOURNAL_MAX_TXN)
+    {
+        /* not a journal this kernel wrote; have s5_journal_init lay down a
+         * fresh one rather than trusting the region */
+        s5fs->s5f_super.s5s_journal_block = 0;
+        page_free(desc_buf);
+        page_free(copy_buf);
+        return;
+    }
+
+    s5_journal_rec_t *commit = copy_buf;
+    err = s5_journal_read_raw(s5fs, jstart + 1 + desc->jr_nblocks, copy_buf);
+    if (!err && commit->jr_magic == S5_JOURNAL_COMMIT_MAGIC &&
+        commit->jr_seq == desc->jr_seq && desc->jr_nblocks)
+    {
+        dbg(DBG_S5FS, "replaying journal transaction %u (%u blocks)\n",
+            desc->jr_seq, desc->jr_nblocks);
+        for (uint32_t i = 0; i < desc->jr_nblocks; i++)
+        {
+            KASSERT(desc->jr_blocks[i] != 0);
+            s5_journal_read_raw(s5fs, jstart + 1 + i, copy_buf);
+            s5_journal_write_raw(s5fs, desc->jr_blocks[i], copy_buf);
+        }
+    }
+    s5fs->s5f_journal_seq = desc->jr_seq + 1;
+    s5_journal_write_empty(s5fs, desc_buf);
+
+    page_free(desc_buf);
+    page_free(copy_buf);
+}
+
+/* Set up the journal for this mount: allocate the record buffer and, on a
+ * disk without a journal, carve a region out of the free blocks and record
+ * it in the super block. Called from s5fs_mount after the bitmap is built,
+ * while the mount is still invisible to everyone else. Returns 1 when a
+ * new region was carved out (the caller must then sync so the shrunken
+ * free list reaches the disk), 0 otherwise. */
+long s5_journal_init(s5fs_t *s5fs)
+{
+    s5fs->s5f_journal_buf = page_alloc();
+    KASSERT(s5fs->s5f_journal_buf);
+
+    if (s5_journal_ready(s5fs))
+    {
+        return 0;
+    }
+
+    /* the scan below walks the whole bitmap, so a summaries-only mount
+     * must pull every group's slice in first */
+    s5_bitmap_load_all(s5fs);
+
+    /* find a free run of S5_JOURNAL_BLOCKS blocks, preferring the middle
+     * of the disk: every committed transaction is written once into the
+     * journal and once in place, so centering the journal halves the
+     * worst-case seek between the two (disks formatted by current fsmaker
+     * already carry a mid-disk journal and never reach this carve) */
+    size_t run = 0;
+    blocknum_t start = 0;
+    size_t mid = s5fs->s5f_bitmap_size / 2;
+    for (size_t i = 0; i < s5fs->s5f_bitmap_size && run < S5_JOURNAL_BLOCKS;
+         i++)
+    {
+        size_t b = (mid + i) % s5fs->s5f_bitmap_size;
+        if (b == 0)
+        {
+            /* wrapped; a run cannot span the end of the disk */
+            run = 0;
+        }
+        if (s5fs->s5f_block_bitmap[b / 64] & (1UL << (b % 64)))
+        {
+            if (!run)
+            {
+                start = (blocknum_t)b;
+            }
+            run++;
+        }
+        else
+        {
+            run = 0;
+        }
+    }
+    if (run < S5_JOURNAL_BLOCKS)
+    {
+        dbg(DBG_S5FS, "no free run for a journal; running unjournaled\n");
+        return 0;
+    }
+
+    for (blocknum_t b = start; b < start + S5_JOURNAL_BLOCKS; b++)
+    {
+        s5fs->s5f_block_bitmap[b / 64] &= ~(1UL << (b % 64));
+        s5fs->s5f_group_nfree[b / S5_ALLOC_GROUP_BLOCKS]--;
+    }
+    s5fs->s5f_super.s5s_journal_block = start;
+    s5fs->s5f_super.s5s_journal_size = S5_JOURNAL_BLOCKS;
+
+    /* persist the journal's location (and an empty head) before anything
+     * can reference it */
+    s5_journal_write_empty(s5fs, s5fs->s5f_journal_buf);
+    long err =
+        s5_journal_read_raw(s5fs, S5_SUPER_BLOCK, s5fs->s5f_journal_buf);
+    KASSERT(!err);
+    memcpy(s5fs->s5f_journal_buf, &s5fs->s5f_super, sizeof(s5_super_t));
+    err = s5_journal_write_raw(s5fs, S5_SUPER_BLOCK, s5fs->s5f_journal_buf);
+    KASSERT(!err);
+
+    dbg(DBG_S5FS, "created metadata journal at blocks %u..%u\n", start,
+        start + S5_JOURNAL_BLOCKS - 1);
+    return 1;
+}
+
+/* Copy the metadata blocks of a writeback batch into the journal as one
+ * committed transaction, before the caller writes the batch in place.
+ * Called from the writeback pass with the disk-cache mobj locked (the
+ * record buffer is serialized by the writeback mutex); returns the number
+ * of blocks journaled, 0 when the batch holds no metadata or there is no
+ * journal. Copies come from the cached frames, so blocks evicted since the
+ * batch was collected are skipped -- they are no longer dirty. */
+size_t s5_journal_log(s5fs_t *s5fs, const blocknum_t *blocks, size_t count)
+{
+    if (!s5_journal_ready(s5fs))
+    {
+        return 0;
+    }
+    KASSERT(count <= S5_JOURNAL_MAX_TXN);
+
+    mobj_t *mobj = S5FS_TO_VMOBJ(s5fs);
+    blocknum_t jstart = s5fs->s5f_super.s5s_journal_block;
+    s5_journal_rec_t *rec = s5fs->s5f_journal_buf;
+    memset(s5fs->s5f_journal_buf, 0, S5_BLOCK_SIZE);
+    rec->jr_seq = s5fs->s5f_journal_seq++;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!s5_is_meta_block(s5fs, blocks[i]))
+        {
+            continue;
+        }
+        pframe_t *pf;
+        mobj_find_pframe(mobj, blocks[i], &pf);
+        if (!pf)
+        {
+            continue;
+        }
+        if (pf->pf_addr)
+        {
+            s5_journal_write_raw(s5fs, jstart + 1 + rec->jr_nblocks,
+                                 pf->pf_addr);
+            rec->jr_blocks[rec->jr_nblocks++] = blocks[i];
+        }
+        pframe_release(&pf);
+    }
+    if (!rec->jr_nblocks)
+    {
+        return 0;
+    }
+
+    rec->jr_magic = S5_JOURNAL_DESC_MAGIC;
+    s5_journal_write_raw(s5fs, jstart, s5fs->s5f_journal_buf);
+    rec->jr_magic = S5_JOURNAL_COMMIT_MAGIC;
+    s5_journal_write_raw(s5fs, jstart + 1 + rec->jr_nblocks,
+                         s5fs->s5f_journal_buf);
+    return rec->jr_nblocks;
+}
+
+/* Mark the journal's current transaction checkpointed, once its blocks
+ * have been written in place. */
+void s5_journal_checkpoint(s5fs_t *s5fs)
+{
+    KASSERT(s5_journal_ready(s5fs));
+    s5_journal_write_empty(s5fs, s5fs->s5f_journal_buf);
+}
+
+/* Ticks (~1ms each) a group-commit leader holds its transaction open for
+ * late arrivals before writing it out. */
+#define S5_GROUP_COMMIT_TICKS 2
+
+/* Journal the given metadata blocks and flush them in place on behalf of
+ * an fsync, group-commit style: callers arriving close together merge
+ * their blocks into the mount's open transaction, the first of them
+ * becomes the leader, sleeps S5_GROUP_COMMIT_TICKS so the others can
+ * join, and then commits and flushes the merged batch once -- a burst of
+ * fsyncs costs one journal transaction instead of one each, and the
+ * joiners never touch the disk at all. The writeback daemon needs no such
+ * treatment; it already commits a whole pass per transaction.
+ *
+ * Returns 0 or the flush status of the transaction that covered the
+ * caller's blocks (a joiner can also see the status of a later
+ * transaction; erring toward reporting too much is fine for fsync).
+ * Callers may hold their vnode's lock: the leader blocks only on the
+ * writeback mutex and a bounded join window, never on another vnode. */
+long s5_journal_group_commit(s5fs_t *s5fs, const blocknum_t *blocks,
+                             size_t count)
+{
+    KASSERT(count <= S5_GROUP_COMMIT_BATCH);
+    mobj_t *mobj = S5FS_TO_VMOBJ(s5fs);
+
+    spinlock_lock(&s5fs->s5f_txn_spin);
+
+    /* merge into the open transaction, deduplicating; if the batch cannot
+     * take us, kick the leader out of its join window and wait for the
+     * next transaction to open */
+    while (s5fs->s5f_txn_count + count > S5_GROUP_COMMIT_BATCH)
+    {
+        sched_broadcast_on(&s5fs->s5f_txn_waitq);
+        sched_sleep_on(&s5fs->s5f_txn_waitq, &s5fs->s5f_txn_spin);
+        spinlock_lock(&s5fs->s5f_txn_spin);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t j = 0;
+        while (j < s5fs->s5f_txn_count && s5fs->s5f_txn_blocks[j] != blocks[i])
+        {
+            j++;
+        }
+        if (j == s5fs->s5f_txn_count)
+        {
+            s5fs->s5f_txn_blocks[s5fs->s5f_txn_count++] = blocks[i];
+        }
+    }
+    uint64_t my = s5fs->s5f_txn_open;
+
+    while (s5fs->s5f_txn_done < my)
+    {
+        if (s5fs->s5f_txn_leader)
+        {
+            /* someone else is committing; wait for our turn to come up */
+            sched_sleep_on(&s5fs->s5f_txn_waitq, &s5fs->s5f_txn_spin);
+            spinlock_lock(&s5fs->s5f_txn_spin);
+            continue;
+        }
+        s5fs->s5f_txn_leader = 1;
+        if (s5fs->s5f_txn_count < S5_GROUP_COMMIT_BATCH)
+        {
+            /* join window; a caller that fills the batch broadcasts to
+             * cut it short */
+            sched_sleep_on_timeout(&s5fs->s5f_txn_waitq, &s5fs->s5f_txn_spin,
+                                   S5_GROUP_COMMIT_TICKS);
+            spinlock_lock(&s5fs->s5f_txn_spin);
+        }
+        blocknum_t batch[S5_GROUP_COMMIT_BATCH];
+        size_t n = s5fs->s5f_txn_count;
+        memcpy(batch, s5fs->s5f_txn_blocks, n * sizeof(blocknum_t));
+        s5fs->s5f_txn_count = 0;
+        s5fs->s5f_txn_open++;
+        spinlock_unlock(&s5fs->s5f_txn_spin);
+
+        long status = 0;
+        kmutex_lock(&s5fs->s5f_wb_mutex);
+        mobj_lock(mobj);
+        size_t journaled = s5_journal_log(s5fs, batch, n);
+        for (size_t i = 0; i < n; i++)
+        {
+            pframe_t *pf;
+            mobj_find_pframe(mobj, batch[i], &pf);
+            if (pf)
+            {
+                if (pf->pf_addr)
+                {
+                    long err = mobj_flush_pframe(mobj, pf);
+                    if (err && !status)
+                    {
+                        status = err;
+                    }
+                }
+                pframe_release(&pf);
+            }
+        }
+        mobj_unlock(mobj);
+        if (journaled)
+        {
+            s5_journal_checkpoint(s5fs);
+        }
+        kmutex_unlock(&s5fs->s5f_wb_mutex);
+
+        spinlock_lock(&s5fs->s5f_txn_spin);
+        s5fs->s5f_txn_err = status;
+        s5fs->s5f_txn_done = my;
+        s5fs->s5f_txn_leader = 0;
+        sched_broadcast_on(&s5fs->s5f_txn_waitq);
+    }
+    long ret = s5fs->s5f_txn_err;
+    spinlock_unlock(&s5fs->s5f_txn_spin);
+    return ret;
+}
@@ -2,19 +2,29 @@
 #include "drivers/blockdev.h"
 #include "errno.h"
 #include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_journal.h"
+#include "fs/fcntl.h"
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 #include "kernel.h"
+#include "mm/kmalloc.h"
 #include "mm/pframe.h"
+#include "mm/slab.h"
 #include "proc/kmutex.h"
 #include "util/debug.h"
+#include "util/printf.h"
 #include "util/string.h"
+#include "util/time.h"
 #include <fs/s5fs/s5fs.h>
 
 static void s5_free_block(s5fs_t *s5fs, blocknum_t block);
 
-static long s5_alloc_block(s5fs_t *s5fs);
+static long s5_alloc_block(s5fs_t *s5fs, s5_node_t *sn);
+
+static long s5_claim_block(s5fs_t *s5fs, blocknum_t blockno);
+
+static long s5_resv_take(s5fs_t *s5fs, s5_node_t *sn, blocknum_t blockno);
 
 static inline void s5_lock_super(s5fs_t *s5fs)
 {
@@ -26,6 +36,18 @@ static inline void s5_unlock_super(s5fs_t *s5fs)
     kmutex_unlock(&s5fs->s5f_mutex);
 }
 
+/* The allocation groups share a small stripe of locks, so the group array
+ * can grow with the bitmap without ever having to move a mutex. */
+static inline void s5_lock_group(s5fs_t *s5fs, size_t group)
+{
+    kmutex_lock(&s5fs->s5f_group_mutex[group % S5_ALLOC_GROUP_LOCKS]);
+}
+
+static inline void s5_unlock_group(s5fs_t *s5fs, size_t group)
+{
+    kmutex_unlock(&s5fs->s5f_group_mutex[group % S5_ALLOC_GROUP_LOCKS]);
+}
+
 /* Helper function to obtain inode info from disk given an inode number.
  *
  *  s5fs     - The file system (it will usually be obvious what to pass for this
@@ -64,6 +86,26 @@ static inline void s5_release_inode(pframe_t **pfp, s5_inode_t **inodep)
     s5_release_disk_block(pfp);
 }
 
+/* Mark sn's in-memory inode as needing writeback and queue it for the
+ * writeback daemon's next inode pass, which copies every queued inode
+ * sharing a disk block into that block in one go rather than dirtying the
+ * block once per field change. The queue holds a reference on the vnode so
+ * the node cannot be destroyed (and its inode slot freed or reused) while
+ * queued; the daemon drops the reference after writing the inode out.
+ */
+void s5_dirty_inode(s5_node_t *sn)
+{
+    /* every stat-visible inode mutation comes through here */
+    vnode_stat_dirty(&sn->vnode);
+    sn->dirtied_inode = 1;
+    if (!list_link_is_linked(&sn->s5n_dirty_link))
+    {
+        vref(&sn->vnode);
+        list_insert_tail(&VNODE_TO_S5FS(&sn->vnode)->s5f_dirty_nodes,
+                         &sn->s5n_dirty_link);
+    }
+}
+
 /* Helper function to obtain a specific block of a file.
  *
  * sn       - The s5_node representing the file in question
@@ -124,59 +166,340 @@ static inline void s5_release_file_block(pframe_t **pfp)
  *       may have to allocate it.
  *    4) The indirect block has not been allocated and alloc is clear.
  */
+/* Resolve one level of indirection: return the block number stored at slot
+ * index of indirect block parent, allocating a block for the slot when
+ * alloc is set and the slot is sparse (s5_alloc_block zeroes new blocks,
+ * so a freshly allocated indirect block starts out all-sparse). meta is
+ * set when the slot's block is itself an indirect block, so it gets tagged
+ * for the metadata journal. Returns 0 for a sparse slot when alloc is
+ * clear, or a negative error from s5_alloc_block. */
+static long s5_indirect_entry(s5_node_t *sn, uint32_t parent, size_t index,
+                              int alloc, int meta)
+{
+    s5fs_t *s5fs = FS_TO_S5FS(sn->vnode.vn_fs);
+    pframe_t *pf;
+    if (alloc)
+    {
+        s5_meta_mark(s5fs, parent);
+    }
+    s5_get_disk_block(s5fs, parent, alloc, &pf);
+    uint32_t *slots = pf->pf_addr;
+    long ret = slots[index];
+    if (!ret && alloc)
+    {
+        ret = s5_alloc_block(s5fs, sn);
+        if (ret < 0)
+        {
+            s5_release_disk_block(&pf);
+            return ret;
+        }
+        if (meta)
+        {
+            s5_meta_mark(s5fs, (blocknum_t)ret);
+        }
+        slots[index] = (uint32_t)ret;
+    }
+    s5_release_disk_block(&pf);
+    return ret;
+}
+
+/* Translate file block file_blocknum of an extent-mapped inode (see
+ * S5_IFLAG_EXTENTS) to its disk block. When alloc is set and the block is
+ * sparse, the run that ends exactly at file_blocknum is grown in place
+ * whenever the next disk block is still free (s5_claim_block), so
+ * sequential writes keep extending one run instead of minting an entry per
+ * block; otherwise a fresh one-block run is started in a free entry slot,
+ * inline in the inode first and then in the overflow block, which is
+ * allocated on first spill. Returns 0 for a sparse block when alloc is
+ * clear, or -ENOSPC when the disk, or both entry tables, are full. Called
+ * with the vnode locked, via s5_file_block_to_disk_block. */
+static long s5_extent_map(s5_node_t *sn, size_t file_blocknum, int alloc)
+{
+    s5fs_t *s5fs = FS_TO_S5FS(sn->vnode.vn_fs);
+    s5_extent_t *grow = NULL;
+    s5_extent_t *empty = NULL;
+    long grow_inline = 0;
+    long empty_inline = 0;
+
+    s5_extent_t *ext = S5_INODE_EXTENT_ARRAY(&sn->inode);
+    for (size_t i = 0; i < S5_INODE_EXTENTS; i++)
+    {
+        if (!ext[i].s5e_nblocks)
+        {
+            if (!empty)
+            {
+                empty = &ext[i];
+                empty_inline = 1;
+            }
+            continue;
+        }
+        if (file_blocknum >= ext[i].s5e_file_block &&
+            file_blocknum < ext[i].s5e_file_block + ext[i].s5e_nblocks)
+        {
+            return ext[i].s5e_disk_block +
+                   (file_blocknum - ext[i].s5e_file_block);
+        }
+        if (file_blocknum == ext[i].s5e_file_block + ext[i].s5e_nblocks)
+        {
+            grow = &ext[i];
+            grow_inline = 1;
+        }
+    }
+
+    pframe_t *pf = NULL;
+    if (sn->inode.s5_indirect_block)
+    {
+        s5_get_disk_block(s5fs, sn->inode.s5_indirect_block, alloc, &pf);
+        ext = pf->pf_addr;
+        for (size_t i = 0; i < S5_EXTENTS_PER_BLOCK; i++)
+        {
+            if (!ext[i].s5e_nblocks)
+            {
+                if (!empty)
+                {
+                    empty = &ext[i];
+                }
+                continue;
+            }
+            if (file_blocknum >= ext[i].s5e_file_block &&
+                file_blocknum < ext[i].s5e_file_block + ext[i].s5e_nblocks)
+            {
+                long ret = ext[i].s5e_disk_block +
+                           (file_blocknum - ext[i].s5e_file_block);
+                s5_release_disk_block(&pf);
+                return ret;
+            }
+            if (!grow &&
+                file_blocknum == ext[i].s5e_file_block + ext[i].s5e_nblocks)
+            {
+                grow = &ext[i];
+            }
+        }
+    }
+
+    if (!alloc)
+    {
+        if (pf)
+        {
+            s5_release_disk_block(&pf);
+        }
+        return 0;
+    }
+
+    /* grow the run ending here if its next disk block is still ours to
+     * take -- from the file's own reservation window first, since those
+     * bits are already claimed in the bitmap; a claimed block cannot be
+     * part of any run, so runs stay disjoint */
+    if (grow &&
+        (s5_resv_take(s5fs, sn, grow->s5e_disk_block + grow->s5e_nblocks) ||
+         s5_claim_block(s5fs, grow->s5e_disk_block + grow->s5e_nblocks)))
+    {
+        long ret = grow->s5e_disk_block + grow->s5e_nblocks;
+        grow->s5e_nblocks++;
+        sn->s5n_alloc_hint = (blocknum_t)ret + 1;
+        if (grow_inline)
+        {
+            s5_dirty_inode(sn);
+        }
+        else
+        {
+            s5_meta_mark(s5fs, sn->inode.s5_indirect_block);
+        }
+        if (pf)
+        {
+            s5_release_disk_block(&pf);
+        }
+        return ret;
+    }
+
+    long ret = s5_alloc_block(s5fs, sn);
+    if (ret < 0)
+    {
+        if (pf)
+        {
+            s5_release_disk_block(&pf);
+        }
+        return ret;
+    }
+    if (!empty && !sn->inode.s5_indirect_block)
+    {
+        /* first spill out of the inline table: add the overflow block,
+         * which s5_alloc_block hands back zeroed, i.e. all entries unused */
+        long overflow = s5_alloc_block(s5fs, sn);
+        if (overflow < 0)
+        {
+            s5_free_block(s5fs, (blocknum_t)ret);
+            return overflow;
+        }
+        sn->inode.s5_indirect_block = (uint32_t)overflow;
+        s5_meta_mark(s5fs, (blocknum_t)overflow);
+        s5_dirty_inode(sn);
+        s5_get_disk_block(s5fs, (blocknum_t)overflow, 1, &pf);
+        empty = pf->pf_addr;
+    }
+    if (!empty)
+    {
+        /* both entry tables are full; the file is too fragmented to map
+         * another run */
+        s5_free_block(s5fs, (blocknum_t)ret);
+        s5_release_disk_block(&pf);
+        return -ENOSPC;
+    }
+    empty->s5e_file_block = (uint32_t)file_blocknum;
+    empty->s5e_disk_block = (uint32_t)ret;
+    empty->s5e_nblocks = 1;
+    if (empty_inline)
+    {
+        s5_dirty_inode(sn);
+    }
+    else
+    {
+        s5_meta_mark(s5fs, sn->inode.s5_indirect_block);
+    }
+    if (pf)
+    {
+        s5_release_disk_block(&pf);
+    }
+    return ret;
+}
+
 long s5_file_block_to_disk_block(s5_node_t *sn, size_t file_blocknum,
                                  int alloc)
 {
     if (file_blocknum >= S5_MAX_FILE_BLOCKS) {
         return -EINVAL;
     }
+    if (sn->inode.s5_flags & S5_IFLAG_EXTENTS) {
+        return s5_extent_map(sn, file_blocknum, alloc);
+    }
     s5_inode_t inode = sn->inode;
     if (file_blocknum < S5_NDIRECT_BLOCKS) { // checking direct blocks
         if (alloc && !sn->inode.s5_direct_blocks[file_blocknum]) {
-            long allocated = s5_alloc_block(FS_TO_S5FS(sn->vnode.vn_fs));
+            long allocated = s5_alloc_block(FS_TO_S5FS(sn->vnode.vn_fs), sn);
             if (allocated < 0) {
                 return allocated;
             }
             sn->inode.s5_direct_blocks[file_blocknum] = allocated;
-            sn->dirtied_inode = 1;
+            s5_dirty_inode(sn);
         }
         return sn->inode.s5_direct_blocks[file_blocknum];
     }
-    if (!sn->inode.s5_indirect_block) { // no indirect block
+    if (file_blocknum < S5_NDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS) {
+        if (!sn->inode.s5_indirect_block) { // no indirect block
+            if (!alloc) {
+                return 0;
+            }
+            long allocated = s5_alloc_block(FS_TO_S5FS(sn->vnode.vn_fs), sn);
+            if (allocated < 0) {
+                return allocated;
+            }
+            sn->inode.s5_indirect_block = allocated;
+            s5_meta_mark(FS_TO_S5FS(sn->vnode.vn_fs), allocated);
+            s5_dirty_inode(sn);
+        }
+        return s5_indirect_entry(sn, sn->inode.s5_indirect_block,
+                                 file_blocknum - S5_NDIRECT_BLOCKS, alloc, 0);
+    }
+    // double indirect range
+    size_t index = file_blocknum - S5_NDIRECT_BLOCKS - S5_NIDIRECT_BLOCKS;
+    size_t slot = index / S5_NIDIRECT_BLOCKS;
+    if (!sn->inode.s5_dindirect_block) {
         if (!alloc) {
             return 0;
         }
-        long allocated = s5_alloc_block(FS_TO_S5FS(sn->vnode.vn_fs));
+        long allocated = s5_alloc_block(FS_TO_S5FS(sn->vnode.vn_fs), sn);
         if (allocated < 0) {
             return allocated;
         }
-        sn->inode.s5_indirect_block = allocated;
-        pframe_t* pframe;
-        s5_get_disk_block(FS_TO_S5FS(sn->vnode.vn_fs), sn->inode.s5_indirect_block, 1, &pframe);
-        long block = s5_alloc_block(FS_TO_S5FS(sn->vnode.vn_fs));
-        if (block < 0) {
-            s5_release_disk_block(&pframe);
-            sn->inode.s5_indirect_block = 0;
-            s5_free_block(FS_TO_S5FS(sn->vnode.vn_fs), allocated);
-            return block;
+        sn->inode.s5_dindirect_block = allocated;
+        s5_meta_mark(FS_TO_S5FS(sn->vnode.vn_fs), allocated);
+        s5_dirty_inode(sn);
+    }
+    long leaf;
+    if (sn->s5n_leaf_cache_slot == slot + 1) {
+        // same leaf indirect block as last time; skip the top-level read
+        leaf = sn->s5n_leaf_cache_block;
+    } else {
+        leaf = s5_indirect_entry(sn, sn->inode.s5_dindirect_block, slot, alloc,
+                                 1);
+        if (leaf <= 0) {
+            return leaf;
         }
-        ((uint32_t *) pframe->pf_addr)[file_blocknum - S5_NDIRECT_BLOCKS] = block;
-        s5_release_disk_block(&pframe);
-        sn->dirtied_inode = 1;
+        sn->s5n_leaf_cache_slot = slot + 1;
+        sn->s5n_leaf_cache_block = (blocknum_t)leaf;
     }
-    pframe_t* pframe; // indirect block already allocated
-    s5_get_disk_block(FS_TO_S5FS(sn->vnode.vn_fs), sn->inode.s5_indirect_block, alloc, &pframe);
-    if (!((uint32_t *) pframe->pf_addr)[file_blocknum - S5_NDIRECT_BLOCKS] && alloc) {
-        long block = s5_alloc_block(FS_TO_S5FS(sn->vnode.vn_fs));
-        if (block < 0) {
-            s5_release_disk_block(&pframe);
-            return block;
+    return s5_indirect_entry(sn, (uint32_t)leaf, index % S5_NIDIRECT_BLOCKS,
+                             alloc, 0);
+}
+
+/* How many prefetch outcomes (consumed or evicted unused) to accumulate
+ * before re-deciding the global window ceiling. */
+#define S5_RA_ADAPT_SAMPLE 64
+
+/*
+ * Global ceiling on the per-file readahead window, steered by the
+ * system-wide prefetch hit rate (the pframe_ra_* counters; see
+ * pframe.h): when a sample period shows more prefetched frames evicted
+ * untouched than consumed, readahead is polluting the cache and the
+ * ceiling halves; a mostly-consumed sample earns it back one doubling
+ * at a time. Reads and updates are unlocked like the counters
+ * themselves - a racing caller at worst applies the previous ceiling.
+ */
+static size_t s5_ra_ceiling = S5_RA_WINDOW_MAX;
+static uint64_t s5_ra_sampled_used;
+static uint64_t s5_ra_sampled_wasted;
+
+static size_t _s5_ra_ceiling()
+{
+    uint64_t used = pframe_ra_used - s5_ra_sampled_used;
+    uint64_t wasted = pframe_ra_wasted - s5_ra_sampled_wasted;
+    if (used + wasted >= S5_RA_ADAPT_SAMPLE)
+    {
+        if (wasted > used)
+        {
+            s5_ra_ceiling = MAX(s5_ra_ceiling / 2, S5_RA_WINDOW_MIN);
+        }
+        else if (s5_ra_ceiling < S5_RA_WINDOW_MAX)
+        {
+            s5_ra_ceiling *= 2;
+        }
+        s5_ra_sampled_used = pframe_ra_used;
+        s5_ra_sampled_wasted = pframe_ra_wasted;
+    }
+    return s5_ra_ceiling;
+}
+
+/* One-line snapshot of the adaptive readahead state for /dev/stats. */
+size_t s5_readahead_info(char *buf, size_t size)
+{
+    return (size_t)snprintf(buf, size, "window min %u max %u ceiling %lu\n",
+                            S5_RA_WINDOW_MIN, S5_RA_WINDOW_MAX,
+                            s5_ra_ceiling);
+}
+
+/* Queue asynchronous prefetches for the file's current readahead window
+ * starting at blocknum, so the disk fetches the blocks while the current
+ * read is being copied out. Sparse blocks have nothing on disk to
+ * prefetch and are skipped. Must be called with sn's vnode locked (for
+ * the block translation).
+ */
+static void _s5_readahead(s5_node_t *sn, size_t blocknum)
+{
+    s5fs_t *s5fs = FS_TO_S5FS(sn->vnode.vn_fs);
+    for (size_t i = 0; i < sn->s5n_ra_window; i++)
+    {
+        size_t block = blocknum + i;
+        if (block * S5_BLOCK_SIZE >= (size_t)sn->vnode.vn_len)
+        {
+            break;
         }
-        ((uint32_t *) pframe->pf_addr)[file_blocknum - S5_NDIRECT_BLOCKS] = block;
+        long loc = s5_file_block_to_disk_block(sn, block, 0);
+        if (loc <= 0)
+        {
+            continue;
+        }
+        blockdev_readahead(s5fs->s5f_bdev, (blocknum_t)loc);
     }
-    long retval = ((uint32_t *) pframe->pf_addr)[file_blocknum - S5_NDIRECT_BLOCKS];
-    s5_release_disk_block(&pframe);
-    return retval;
 }
 
 /* Read from a file.
@@ -204,28 +527,117 @@ ssize_t s5_read_file(s5_node_t *sn, size_t pos, char *buf, size_t len)
     blocknum_t blocknum = S5_DATA_BLOCK(pos);
     size_t bytes_read = 0;
     pframe_t* pframe;
+    /* Directory helpers call in with the vnode mutex already held;
+     * regular-file I/O arrives under a byte-range lock instead (see
+     * do_read), in which case we take the mutex one block at a time so
+     * I/O to other ranges of the file can interleave with ours. */
+    long blockwise = !kmutex_owns_mutex(&sn->vnode.vn_mobj.mo_mutex);
+    if (blockwise) {
+        vlock(&sn->vnode);
+    }
     if (pos >= sn->vnode.vn_len) {
+        if (blockwise) {
+            vunlock(&sn->vnode);
+        }
         return 0;
     }
     len = MIN(len, sn->vnode.vn_len - pos);
+    /* Detect sequential access: a read starting at the block where the
+     * previous one left off extends the streak, and any streak kicks off
+     * readahead of the blocks just past this read. */
+    if (S5_DATA_BLOCK(pos) == sn->s5n_ra_next) {
+        sn->s5n_ra_streak++;
+        /* Each confirmed sequential read doubles the window, up to the
+         * hit-rate-driven global ceiling. */
+        sn->s5n_ra_window = MIN(sn->s5n_ra_window * 2, _s5_ra_ceiling());
+    } else {
+        sn->s5n_ra_streak = 0;
+        sn->s5n_ra_window = S5_RA_WINDOW_MIN;
+    }
+    sn->s5n_ra_next = S5_DATA_BLOCK(pos + len);
+    /* FADV_SEQUENTIAL prefetches without waiting for a streak, and
+     * FADV_RANDOM never prefetches (see s5_advise). */
+    if ((sn->s5n_ra_streak || sn->s5n_ra_advice == FADV_SEQUENTIAL) &&
+        sn->s5n_ra_advice != FADV_RANDOM) {
+        _s5_readahead(sn, S5_DATA_BLOCK(pos + len - 1) + 1);
+    }
     while (bytes_read < len) {
         blocknum = S5_DATA_BLOCK(pos);
         size_t to_read = MIN(S5_BLOCK_SIZE - S5_DATA_OFFSET(pos), len - bytes_read);
         if (to_read + pos > sn->vnode.vn_len) {
-            return bytes_read;
+            break;
         }
-        long status = s5_get_file_block(sn, blocknum, 0, &pframe);
+        /* A hole reads as zeros; serve it directly rather than going
+         * through the cache, which would materialize a zero-filled frame
+         * per hole block. A sparse block can only have a clean all-zero
+         * frame cached (writes allocate first), so nothing is missed. */
+        long status = s5_file_block_to_disk_block(sn, blocknum, 0);
         if (status < 0) {
+            if (blockwise) {
+                vunlock(&sn->vnode);
+            }
+            return status;
+        }
+        if (status == 0) {
+            memset(buf + bytes_read, 0, to_read);
+            bytes_read += to_read;
+            pos = pos + to_read;
+            if (blockwise && bytes_read < len) {
+                vunlock(&sn->vnode);
+                vlock(&sn->vnode);
+            }
+            continue;
+        }
+        status = s5_get_file_block(sn, blocknum, 0, &pframe);
+        if (status < 0) {
+            if (blockwise) {
+                vunlock(&sn->vnode);
+            }
             return status;
         }
         memcpy(buf + bytes_read, (char *) pframe->pf_addr + S5_DATA_OFFSET(pos), to_read);
         bytes_read += to_read;
         pos = pos + to_read;
         s5_release_file_block(&pframe);
+        if (blockwise && bytes_read < len) {
+            /* Give threads working on other ranges a turn at the vnode. */
+            vunlock(&sn->vnode);
+            vlock(&sn->vnode);
+        }
+    }
+    if (blockwise) {
+        vunlock(&sn->vnode);
     }
     return bytes_read;
 }
 
+/* Obtain the cache frame for file block blocknum of sn when the caller is
+ * about to overwrite the entire block: the disk block is allocated as
+ * necessary, but its current contents are never read in from disk. Mirrors
+ * the non-sparse path of s5fs_get_pframe; the caller must hold the vnode
+ * lock and must fill all S5_BLOCK_SIZE bytes before releasing the frame. */
+static long s5_get_file_block_overwrite(s5_node_t *sn, size_t blocknum,
+                                        pframe_t **pfp)
+{
+    long loc = s5_file_block_to_disk_block(sn, blocknum, 1);
+    if (loc < 0)
+    {
+        return loc;
+    }
+    KASSERT(loc && "allocating lookup cannot leave the block sparse");
+    /* drop any cached zero-fill frame from when the block was sparse */
+    mobj_find_pframe(&sn->vnode.vn_mobj, blocknum, pfp);
+    if (*pfp)
+    {
+        mobj_free_pframe(&sn->vnode.vn_mobj, pfp);
+    }
+    s5_get_disk_block_overwrite(FS_TO_S5FS(sn->vnode.vn_fs), (blocknum_t)loc,
+                                pfp);
+    /* remember which of this file's blocks are dirty, for fsync */
+    s5_dirty_data_block(sn, blocknum);
+    return 0;
+}
+
 /* Write to a file.
  *
  *  sn  - The s5_node representing the file to write to
@@ -258,128 +670,1043 @@ ssize_t s5_read_file(s5_node_t *sn, size_t pos, char *buf, size_t len)
  */
 ssize_t s5_write_file(s5_node_t *sn, size_t pos, const char *buf, size_t len)
 {
-    if (pos >= S5_MAX_FILE_SIZE) {
-        return -EFBIG;
+    if (pos >= S5_MAX_FILE_SIZE) {
+        return -EFBIG;
+    }
+    int offset = S5_INODE_OFFSET(sn->inode.s5_number);
+    blocknum_t blocknum = S5_DATA_BLOCK(pos);
+    size_t bytes_written = 0;
+    pframe_t* pframe;
+    if (pos + len > S5_MAX_FILE_SIZE) {
+        len = S5_MAX_FILE_SIZE - pos;
+    }
+    /* Same locking scheme as s5_read_file: take the vnode mutex per
+     * block unless the caller (a directory helper) already holds it. */
+    long blockwise = !kmutex_owns_mutex(&sn->vnode.vn_mobj.mo_mutex);
+    if (blockwise) {
+        vlock(&sn->vnode);
+    }
+    while (bytes_written < len) {
+        blocknum = S5_DATA_BLOCK(pos);
+        size_t to_write = MIN(S5_BLOCK_SIZE - S5_DATA_OFFSET(pos), len - bytes_written);
+        uint32_t previous_size = sn->vnode.vn_len;
+        if (to_write + pos > sn->vnode.vn_len) {
+            sn->vnode.vn_len = to_write + pos;
+            sn->inode.s5_un.s5_size = to_write + pos;
+            s5_dirty_inode(sn);
+        }
+        /* An aligned full-block write replaces the block's contents
+         * entirely, so skip reading the old contents from disk. */
+        long status;
+        if (S5_DATA_OFFSET(pos) == 0 && to_write == S5_BLOCK_SIZE) {
+            status = s5_get_file_block_overwrite(sn, blocknum, &pframe);
+        } else {
+            status = s5_get_file_block(sn, blocknum, 1, &pframe);
+        }
+        if (status < 0) {
+            sn->vnode.vn_len = previous_size;
+            sn->inode.s5_un.s5_size = previous_size;
+            if (blockwise) {
+                vunlock(&sn->vnode);
+            }
+            return status;
+        }
+        memcpy((char *) pframe->pf_addr + S5_DATA_OFFSET(pos), buf + bytes_written, to_write);
+        if (S_ISDIR(sn->vnode.vn_mode)) {
+            // directory contents are metadata; tag the block for the journal
+            s5_meta_mark(FS_TO_S5FS(sn->vnode.vn_fs), (blocknum_t) pframe->pf_pagenum);
+        }
+        bytes_written += to_write;
+        pos = pos + to_write;
+        s5_dirty_inode(sn);
+        s5_release_file_block(&pframe);
+        if (blockwise && bytes_written < len) {
+            /* Give threads working on other ranges a turn at the vnode. */
+            vunlock(&sn->vnode);
+            vlock(&sn->vnode);
+        }
+    }
+    if (blockwise) {
+        vunlock(&sn->vnode);
+    }
+    return bytes_written;
+}
+
+/* Read from a file without populating the block cache (O_DIRECT).
+ *
+ * Blocks that happen to be cached already are copied out of the cache,
+ * which may be newer than the disk; everything else is read from the
+ * block device into a staging page that is reused across blocks, so a
+ * large streaming read creates no pframes and evicts nothing. Block
+ * mapping still goes through the cached inode and indirect block.
+ *
+ * Only called from the VFS on regular files, under the byte-range lock;
+ * the vnode mutex is taken one block at a time, as in s5_read_file.
+ */
+ssize_t s5_direct_read_file(s5_node_t *sn, size_t pos, char *buf, size_t len)
+{
+    s5fs_t *s5fs = FS_TO_S5FS(sn->vnode.vn_fs);
+    mobj_t *mobj = S5FS_TO_VMOBJ(s5fs);
+
+    void *staging = page_alloc();
+    if (!staging)
+    {
+        return -ENOMEM;
+    }
+
+    size_t bytes_read = 0;
+    long status = 0;
+    vlock(&sn->vnode);
+    if (pos < sn->vnode.vn_len)
+    {
+        len = MIN(len, sn->vnode.vn_len - pos);
+    }
+    else
+    {
+        len = 0;
+    }
+    while (bytes_read < len)
+    {
+        size_t to_read =
+            MIN(S5_BLOCK_SIZE - S5_DATA_OFFSET(pos), len - bytes_read);
+        long loc = s5_file_block_to_disk_block(sn, S5_DATA_BLOCK(pos), 0);
+        if (loc < 0)
+        {
+            status = loc;
+            break;
+        }
+        if (!loc)
+        {
+            /* sparse block */
+            memset(buf + bytes_read, 0, to_read);
+        }
+        else
+        {
+            pframe_t *pf;
+            mobj_lock(mobj);
+            mobj_find_pframe(mobj, (blocknum_t)loc, &pf);
+            mobj_unlock(mobj);
+            if (pf)
+            {
+                memcpy(buf + bytes_read,
+                       (char *)pf->pf_addr + S5_DATA_OFFSET(pos), to_read);
+                pframe_release(&pf);
+            }
+            else
+            {
+                /* A single uncached block with the caller blocked on it:
+                 * worth the polled completion when the driver offers it. */
+                status = blockdev_read_poll(s5fs->s5f_bdev, staging,
+                                            (blocknum_t)loc);
+                if (status < 0)
+                {
+                    break;
+                }
+                memcpy(buf + bytes_read,
+                       (char *)staging + S5_DATA_OFFSET(pos), to_read);
+            }
+        }
+        bytes_read += to_read;
+        pos += to_read;
+        if (bytes_read < len)
+        {
+            /* Give threads working on other ranges a turn at the vnode. */
+            vunlock(&sn->vnode);
+            vlock(&sn->vnode);
+        }
+    }
+    vunlock(&sn->vnode);
+    page_free(staging);
+    return status < 0 ? status : (ssize_t)bytes_read;
+}
+
+/* Write to a file without populating the block cache (O_DIRECT).
+ *
+ * The common case, overwriting an allocated uncached block, goes straight
+ * to the block device through a staging page (read-modify-write for
+ * partial blocks). Two cases still touch the cache, for coherence rather
+ * than performance: a block that is already cached is updated through its
+ * cache frame, so cached readers never see stale data, and a newly
+ * allocated block arrives cached because s5_alloc_block zeroes it through
+ * the cache. If a reader caches the block while our device write is in
+ * flight, the frame it read may predate the write, so the cache is
+ * re-checked afterwards and any frame that appeared is patched up.
+ *
+ * Locking and the size/error contract match s5_write_file; like
+ * s5_direct_read_file, this is only called from the VFS, under the
+ * byte-range lock.
+ */
+ssize_t s5_direct_write_file(s5_node_t *sn, size_t pos, const char *buf,
+                             size_t len)
+{
+    if (pos >= S5_MAX_FILE_SIZE)
+    {
+        return -EFBIG;
+    }
+    if (pos + len > S5_MAX_FILE_SIZE)
+    {
+        len = S5_MAX_FILE_SIZE - pos;
+    }
+
+    s5fs_t *s5fs = FS_TO_S5FS(sn->vnode.vn_fs);
+    mobj_t *mobj = S5FS_TO_VMOBJ(s5fs);
+
+    void *staging = page_alloc();
+    if (!staging)
+    {
+        return -ENOMEM;
+    }
+
+    size_t bytes_written = 0;
+    long status = 0;
+    vlock(&sn->vnode);
+    while (bytes_written < len)
+    {
+        size_t to_write =
+            MIN(S5_BLOCK_SIZE - S5_DATA_OFFSET(pos), len - bytes_written);
+        uint32_t previous_size = sn->vnode.vn_len;
+        if (to_write + pos > sn->vnode.vn_len)
+        {
+            sn->vnode.vn_len = to_write + pos;
+            sn->inode.s5_un.s5_size = to_write + pos;
+            s5_dirty_inode(sn);
+        }
+        long loc = s5_file_block_to_disk_block(sn, S5_DATA_BLOCK(pos), 1);
+        if (loc <= 0)
+        {
+            /* alloc set, so 0 can only mean failure, not a sparse block */
+            sn->vnode.vn_len = previous_size;
+            sn->inode.s5_un.s5_size = previous_size;
+            status = loc ? loc : -ENOSPC;
+            break;
+        }
+
+        pframe_t *pf;
+        mobj_lock(mobj);
+        mobj_find_pframe(mobj, (blocknum_t)loc, &pf);
+        if (pf)
+        {
+            memcpy((char *)pf->pf_addr + S5_DATA_OFFSET(pos),
+                   buf + bytes_written, to_write);
+            mobj_dirty_pframe(mobj, pf);
+            mobj_unlock(mobj);
+            pframe_release(&pf);
+            /* this write stopped at the cache, so fsync must flush it */
+            s5_dirty_data_block(sn, S5_DATA_BLOCK(pos));
+        }
+        else
+        {
+            mobj_unlock(mobj);
+            if (to_write < S5_BLOCK_SIZE)
+            {
+                /* Read-modify-write head: same single-block-with-waiter
+                 * situation as the read path above. */
+                status = blockdev_read_poll(s5fs->s5f_bdev, staging,
+                                            (blocknum_t)loc);
+                if (status < 0)
+                {
+                    break;
+                }
+            }
+            memcpy((char *)staging + S5_DATA_OFFSET(pos), buf + bytes_written,
+                   to_write);
+            status = s5fs->s5f_bdev->bd_ops->write_block(
+                s5fs->s5f_bdev, staging, (blocknum_t)loc, 1);
+            if (status < 0)
+            {
+                break;
+            }
+            /* A frame created during the device write was filled from the
+             * disk's old contents; it is clean, so fixing the bytes in
+             * place keeps it consistent with what is now on disk. */
+            mobj_lock(mobj);
+            mobj_find_pframe(mobj, (blocknum_t)loc, &pf);
+            mobj_unlock(mobj);
+            if (pf)
+            {
+                memcpy((char *)pf->pf_addr + S5_DATA_OFFSET(pos),
+                       buf + bytes_written, to_write);
+                pframe_release(&pf);
+            }
+        }
+        bytes_written += to_write;
+        pos += to_write;
+        if (bytes_written < len)
+        {
+            /* Give threads working on other ranges a turn at the vnode. */
+            vunlock(&sn->vnode);
+            vlock(&sn->vnode);
+        }
+    }
+    vunlock(&sn->vnode);
+    page_free(staging);
+    return status < 0 ? status : (ssize_t)bytes_written;
+}
+
+/* Apply an access-pattern hint to the file (the advise vnode operation;
+ * see do_fadvise). The steering hints just set s5n_ra_advice, which
+ * s5_read_file consults before prefetching; FADV_WILLNEED queues
+ * asynchronous population of the file's blocks so they are resident by
+ * the time they are read, and FADV_DONTNEED releases the file's cached
+ * blocks back to the free pool, flushing any that are dirty. Called with
+ * the vnode locked.
+ */
+long s5_advise(s5_node_t *sn, int advice)
+{
+    s5fs_t *s5fs = FS_TO_S5FS(sn->vnode.vn_fs);
+    mobj_t *mobj = S5FS_TO_VMOBJ(s5fs);
+    switch (advice)
+    {
+        case FADV_SEQUENTIAL:
+            /* Don't wait for a streak; open the window right away. */
+            sn->s5n_ra_window = _s5_ra_ceiling();
+            sn->s5n_ra_advice = advice;
+            return 0;
+        case FADV_NORMAL:
+        case FADV_RANDOM:
+            sn->s5n_ra_window = S5_RA_WINDOW_MIN;
+            sn->s5n_ra_advice = advice;
+            return 0;
+        case FADV_WILLNEED:
+            for (size_t block = 0;
+                 block * S5_BLOCK_SIZE < (size_t)sn->vnode.vn_len; block++)
+            {
+                long loc = s5_file_block_to_disk_block(sn, block, 0);
+                if (loc <= 0)
+                {
+                    continue;
+                }
+                blockdev_readahead(s5fs->s5f_bdev, (blocknum_t)loc);
+            }
+            return 0;
+        case FADV_DONTNEED:
+            for (size_t block = 0;
+                 block * S5_BLOCK_SIZE < (size_t)sn->vnode.vn_len; block++)
+            {
+                long loc = s5_file_block_to_disk_block(sn, block, 0);
+                if (loc <= 0)
+                {
+                    continue;
+                }
+                pframe_t *pf;
+                mobj_lock(mobj);
+                mobj_find_pframe(mobj, (blocknum_t)loc, &pf);
+                if (pf && mobj_free_pframe(mobj, &pf) < 0)
+                {
+                    /* flush failed; leave the frame cached and dirty */
+                    pframe_release(&pf);
+                }
+                mobj_unlock(mobj);
+            }
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+/* Minimum size of the allocation bitmap, in block bits. Must be a multiple
+ * of S5_ALLOC_GROUP_BLOCKS; the bitmap only ever grows by doubling, so
+ * every size is, and every size is a whole number of groups. */
+#define S5_BITMAP_MIN_SIZE S5_ALLOC_GROUP_BLOCKS
+
+/* Words of the bitmap covered by one allocation group. */
+#define S5_ALLOC_GROUP_WORDS (S5_ALLOC_GROUP_BLOCKS / 64)
+
+/* Grow the allocation bitmap and the per-group free counts to cover
+ * blockno. Serialized by the super lock, which the caller must not hold;
+ * taking a group lock first is fine (group locks order before the super
+ * lock). Readers never block mid-scan and the new arrays are fully built
+ * before being installed, so with the kernel non-preemptible a concurrent
+ * allocator always sees either the old arrays or the new ones. */
+static void s5_bitmap_grow(s5fs_t *s5fs, blocknum_t blockno)
+{
+    s5_lock_super(s5fs);
+    if ((size_t)blockno >= s5fs->s5f_bitmap_size)
+    {
+        size_t size = MAX(s5fs->s5f_bitmap_size, S5_BITMAP_MIN_SIZE);
+        while (size <= (size_t)blockno)
+        {
+            size *= 2;
+        }
+        uint64_t *bitmap = kmalloc(size / 8);
+        size_t ngroups = size / S5_ALLOC_GROUP_BLOCKS;
+        size_t *nfree = kmalloc(ngroups * sizeof(size_t));
+        uint32_t *ffree = kmalloc(ngroups * sizeof(uint32_t));
+        KASSERT(bitmap && nfree && ffree);
+        memset(bitmap, 0, size / 8);
+        memset(nfree, 0, ngroups * sizeof(size_t));
+        memset(ffree, 0, ngroups * sizeof(uint32_t));
+        if (s5fs->s5f_block_bitmap)
+        {
+            memcpy(bitmap, s5fs->s5f_block_bitmap, s5fs->s5f_bitmap_size / 8);
+            memcpy(nfree, s5fs->s5f_group_nfree,
+                   s5fs->s5f_ngroups * sizeof(size_t));
+            memcpy(ffree, s5fs->s5f_group_ffree,
+                   s5fs->s5f_ngroups * sizeof(uint32_t));
+            kfree(s5fs->s5f_block_bitmap);
+            kfree(s5fs->s5f_group_nfree);
+            kfree(s5fs->s5f_group_ffree);
+        }
+        if (s5fs->s5f_group_loaded)
+        {
+            /* appended groups have no persisted slice; their (all
+             * allocated) bits above are already correct, so they are
+             * born loaded */
+            size_t words = (ngroups + 63) / 64;
+            uint64_t *loaded = kmalloc(words * sizeof(uint64_t));
+            KASSERT(loaded);
+            memset(loaded, 0, words * sizeof(uint64_t));
+            memcpy(loaded, s5fs->s5f_group_loaded,
+                   (s5fs->s5f_ngroups + 63) / 64 * sizeof(uint64_t));
+            for (size_t g = s5fs->s5f_ngroups; g < ngroups; g++)
+            {
+                loaded[g / 64] |= 1UL << (g % 64);
+            }
+            kfree(s5fs->s5f_group_loaded);
+            s5fs->s5f_group_loaded = loaded;
+        }
+        s5fs->s5f_block_bitmap = bitmap;
+        s5fs->s5f_group_nfree = nfree;
+        s5fs->s5f_group_ffree = ffree;
+        s5fs->s5f_bitmap_size = size;
+        s5fs->s5f_ngroups = ngroups;
+    }
+    s5_unlock_super(s5fs);
+}
+
+/* Bring group g's slice of the bitmap in from the persisted region, on a
+ * mount that loaded only the group summaries. Must be called with g's
+ * group lock held, before the group's bits or free count are touched.
+ * The whole region was queued for readahead at mount, so the read below
+ * is normally a cache hit rather than a disk wait. */
+static void s5_group_ensure_loaded(s5fs_t *s5fs, size_t g)
+{
+    if (!s5fs->s5f_group_loaded ||
+        (s5fs->s5f_group_loaded[g / 64] >> (g % 64)) & 1)
+    {
+        return;
+    }
+    size_t bit = g * S5_ALLOC_GROUP_BLOCKS;
+    blocknum_t block = (blocknum_t)(s5fs->s5f_super.s5s_bmap_block + 1 +
+                                    bit / S5_BMAP_BITS_PER_BLOCK);
+    pframe_t *pf;
+    s5_get_disk_block(s5fs, block, 0, &pf);
+    memcpy(s5fs->s5f_block_bitmap + g * S5_ALLOC_GROUP_WORDS,
+           (char *)pf->pf_addr + (bit % S5_BMAP_BITS_PER_BLOCK) / 8,
+           S5_ALLOC_GROUP_WORDS * sizeof(uint64_t));
+    s5_release_disk_block(&pf);
+    /* the groups sharing this word belong to different lock stripes */
+    __sync_fetch_and_or(&s5fs->s5f_group_loaded[g / 64], 1UL << (g % 64));
+}
+
+/* Load every group's slice; for the paths that walk the whole bitmap
+ * (free-list serialization, the journal carve). */
+void s5_bitmap_load_all(s5fs_t *s5fs)
+{
+    if (!s5fs->s5f_group_loaded)
+    {
+        return;
+    }
+    for (size_t g = 0; g < s5fs->s5f_ngroups; g++)
+    {
+        s5_lock_group(s5fs, g);
+        s5_group_ensure_loaded(s5fs, g);
+        s5_unlock_group(s5fs, g);
+    }
+}
+
+/* Mark blockno free in the allocation bitmap, growing the bitmap if it does
+ * not yet cover blockno. Must be called with blockno's group locked (or
+ * before the mount is visible to anyone else). */
+static void s5_bitmap_mark_free(s5fs_t *s5fs, blocknum_t blockno)
+{
+    if ((size_t)blockno >= s5fs->s5f_bitmap_size)
+    {
+        s5_bitmap_grow(s5fs, blockno);
+    }
+    size_t g = blockno / S5_ALLOC_GROUP_BLOCKS;
+    s5_group_ensure_loaded(s5fs, g);
+    KASSERT(!(s5fs->s5f_block_bitmap[blockno / 64] & (1UL << (blockno % 64))) &&
+            "block freed twice");
+    s5fs->s5f_block_bitmap[blockno / 64] |= 1UL << (blockno % 64);
+    s5fs->s5f_group_nfree[g]++;
+    uint32_t w = (uint32_t)((blockno % S5_ALLOC_GROUP_BLOCKS) / 64);
+    if (w < s5fs->s5f_group_ffree[g])
+    {
+        s5fs->s5f_group_ffree[g] = w;
+    }
+}
+
+/* Try to set up the bitmap from the region persisted by the last
+ * free-list sync (see _s5_bitmap_region_write): one batched readahead for
+ * the whole region, then only the summary block is actually read before
+ * the mount proceeds - the free counts and first-free hints are enough to
+ * size the arrays and steer allocation, and each group's slice of the
+ * bitmap is pulled in by s5_group_ensure_loaded the first time the group
+ * is touched. Returns 1 on success, 0 when there is no usable region (a
+ * disk from before the region existed, or one too large to have been
+ * persisted) and the free list must be walked instead.
+ */
+static long s5_load_block_bitmap(s5fs_t *s5fs)
+{
+    s5_super_t *super = &s5fs->s5f_super;
+    size_t bits = super->s5s_bmap_bits;
+    if (!super->s5s_bmap_block || !bits || bits % S5_ALLOC_GROUP_BLOCKS ||
+        bits / S5_ALLOC_GROUP_BLOCKS > S5_BMAP_SUMMARY_GROUPS ||
+        super->s5s_bmap_blocks !=
+            1 + (bits + S5_BMAP_BITS_PER_BLOCK - 1) / S5_BMAP_BITS_PER_BLOCK)
+    {
+        return 0;
+    }
+    size_t ngroups = bits / S5_ALLOC_GROUP_BLOCKS;
+
+    for (uint32_t b = 0; b < super->s5s_bmap_blocks; b++)
+    {
+        blockdev_readahead(s5fs->s5f_bdev, super->s5s_bmap_block + b);
+    }
+
+    uint64_t *bitmap = kmalloc(bits / 8);
+    size_t *nfree = kmalloc(ngroups * sizeof(size_t));
+    uint32_t *ffree = kmalloc(ngroups * sizeof(uint32_t));
+    size_t loaded_words = (ngroups + 63) / 64;
+    uint64_t *loaded = kmalloc(loaded_words * sizeof(uint64_t));
+    KASSERT(bitmap && nfree && ffree && loaded);
+    /* an unloaded slice reads as all-allocated until it comes in */
+    memset(bitmap, 0, bits / 8);
+    memset(loaded, 0, loaded_words * sizeof(uint64_t));
+
+    pframe_t *pf;
+    s5_get_disk_block(s5fs, super->s5s_bmap_block, 0, &pf);
+    s5_group_summary_t *sum = pf->pf_addr;
+    size_t total_free = 0;
+    for (size_t g = 0; g < ngroups; g++)
+    {
+        nfree[g] = sum[g].gs_nfree;
+        ffree[g] = MIN(sum[g].gs_first_free, S5_ALLOC_GROUP_BLOCKS) / 64;
+        total_free += nfree[g];
+    }
+    s5_release_disk_block(&pf);
+
+    s5fs->s5f_block_bitmap = bitmap;
+    s5fs->s5f_bitmap_size = bits;
+    s5fs->s5f_group_nfree = nfree;
+    s5fs->s5f_group_ffree = ffree;
+    s5fs->s5f_group_loaded = loaded;
+    s5fs->s5f_ngroups = ngroups;
+    dbg(DBG_S5FS,
+        "loaded block bitmap summaries: %lu free blocks in %lu groups\n",
+        total_free, ngroups);
+    return 1;
+}
+
+/* Build the in-memory allocation bitmap by walking the on-disk free list.
+ * Called once at mount time, before the filesystem is in use. Every data
+ * block is either on the free list or reachable from an inode, so blocks
+ * beyond the bitmap are allocated by definition; s5_bitmap_mark_free grows
+ * the bitmap if such a block is later freed.
+ *
+ * When the last sync persisted the bitmap region, the walk (a serial
+ * chain of disk reads, one per S5_NBLKS_PER_FNODE - 1 free blocks) is
+ * skipped entirely in favor of s5_load_block_bitmap, keeping mount cost
+ * proportional to the number of allocation groups rather than blocks.
+ *
+ * Recall that the free list is a linked list of nodes of S5_NBLKS_PER_FNODE
+ * block numbers, where the last entry of each node links to the block
+ * containing the next node (or -1 at the end of the list). The first node is
+ * the super block's s5s_free_blocks array, and each subsequent node lives in
+ * a block that is itself free.
+ */
+void s5_build_block_bitmap(s5fs_t *s5fs)
+{
+    s5_super_t *super = &s5fs->s5f_super;
+
+    s5fs->s5f_block_bitmap = NULL;
+    s5fs->s5f_bitmap_size = 0;
+    s5fs->s5f_group_nfree = NULL;
+    s5fs->s5f_group_ffree = NULL;
+    s5fs->s5f_group_loaded = NULL;
+    s5fs->s5f_ngroups = 0;
+    for (size_t i = 0; i < S5_ALLOC_GROUP_LOCKS; i++)
+    {
+        kmutex_init(&s5fs->s5f_group_mutex[i]);
+    }
+
+    if (s5_load_block_bitmap(s5fs))
+    {
+        return;
+    }
+
+    uint32_t node[S5_NBLKS_PER_FNODE];
+    memcpy(node, super->s5s_free_blocks, sizeof(node));
+    uint32_t nfree = super->s5s_nfree;
+    while (1)
+    {
+        for (uint32_t i = 0; i < nfree; i++)
+        {
+            s5_bitmap_mark_free(s5fs, node[i]);
+        }
+        uint32_t next = node[S5_NBLKS_PER_FNODE - 1];
+        if (next == (uint32_t)-1)
+        {
+            break;
+        }
+        /* the block containing the next node is itself free */
+        pframe_t *pf;
+        s5_get_disk_block(s5fs, next, 0, &pf);
+        memcpy(node, pf->pf_addr, sizeof(node));
+        s5_release_disk_block(&pf);
+        s5_bitmap_mark_free(s5fs, next);
+        nfree = S5_NBLKS_PER_FNODE - 1;
+    }
+    size_t total_free = 0;
+    for (size_t g = 0; g < s5fs->s5f_ngroups; g++)
+    {
+        total_free += s5fs->s5f_group_nfree[g];
+    }
+    dbg(DBG_S5FS, "built block bitmap: %lu free blocks in %lu groups\n",
+        total_free, s5fs->s5f_ngroups);
+}
+
+/* Persist the group summaries and the raw bitmap into the on-disk region,
+ * (re)carving the region out of the free blocks first when the disk has
+ * none yet or the bitmap has outgrown it. Called from s5_sync_free_list
+ * with every group lock and the super lock held, so the snapshot written
+ * here is exactly the one serialized into the free list alongside it (and
+ * is therefore equally stale after a crash - no worse than before). The
+ * dirtied blocks reach the disk through s5fs_sync's flush, before the
+ * super block that points at them. */
+static void _s5_bitmap_region_write(s5fs_t *s5fs)
+{
+    s5_super_t *super = &s5fs->s5f_super;
+    size_t bits = s5fs->s5f_bitmap_size;
+    size_t ngroups = s5fs->s5f_ngroups;
+    uint32_t nblocks =
+        (uint32_t)(1 + (bits + S5_BMAP_BITS_PER_BLOCK - 1) /
+                           S5_BMAP_BITS_PER_BLOCK);
+
+    if (super->s5s_bmap_block && (ngroups > S5_BMAP_SUMMARY_GROUPS ||
+                                  super->s5s_bmap_blocks < nblocks))
+    {
+        /* outgrown: give the old region back to the free set and carve a
+         * bigger one below (or none, if there are now too many groups) */
+        for (uint32_t b = 0; b < super->s5s_bmap_blocks; b++)
+        {
+            s5_bitmap_mark_free(s5fs, super->s5s_bmap_block + b);
+        }
+        super->s5s_bmap_block = 0;
+        super->s5s_bmap_blocks = 0;
+        super->s5s_bmap_bits = 0;
+    }
+    if (!bits || ngroups > S5_BMAP_SUMMARY_GROUPS)
+    {
+        return;
+    }
+    if (!super->s5s_bmap_block)
+    {
+        /* first fit from the front of the disk: the region is read right
+         * after the super block at mount, so keep the seek short */
+        size_t run = 0;
+        blocknum_t start = 0;
+        for (size_t b = 1; b < bits && run < nblocks; b++)
+        {
+            if (s5fs->s5f_block_bitmap[b / 64] & (1UL << (b % 64)))
+            {
+                if (!run)
+                {
+                    start = (blocknum_t)b;
+                }
+                run++;
+            }
+            else
+            {
+                run = 0;
+            }
+        }
+        if (run < nblocks)
+        {
+            dbg(DBG_S5FS, "no free run to persist the block bitmap\n");
+            return;
+        }
+        for (blocknum_t b = start; b < start + nblocks; b++)
+        {
+            s5fs->s5f_block_bitmap[b / 64] &= ~(1UL << (b % 64));
+            s5fs->s5f_group_nfree[b / S5_ALLOC_GROUP_BLOCKS]--;
+        }
+        super->s5s_bmap_block = start;
+        super->s5s_bmap_blocks = nblocks;
+        dbg(DBG_S5FS, "carved bitmap region at blocks %u..%u\n", start,
+            start + nblocks - 1);
+    }
+    super->s5s_bmap_bits = (uint32_t)bits;
+
+    pframe_t *pf;
+    s5_get_disk_block(s5fs, super->s5s_bmap_block, 1, &pf);
+    memset(pf->pf_addr, 0, S5_BLOCK_SIZE);
+    s5_group_summary_t *sum = pf->pf_addr;
+    for (size_t g = 0; g < ngroups; g++)
+    {
+        sum[g].gs_nfree = (uint32_t)s5fs->s5f_group_nfree[g];
+        sum[g].gs_first_free = s5fs->s5f_group_ffree[g] * 64;
+    }
+    s5_release_disk_block(&pf);
+
+    for (uint32_t b = 1; b < nblocks; b++)
+    {
+        size_t off = (size_t)(b - 1) * (S5_BMAP_BITS_PER_BLOCK / 8);
+        size_t len = MIN(bits / 8 - off, (size_t)S5_BLOCK_SIZE);
+        s5_get_disk_block(s5fs, super->s5s_bmap_block + b, 1, &pf);
+        memcpy(pf->pf_addr, (char *)s5fs->s5f_block_bitmap + off, len);
+        if (len < S5_BLOCK_SIZE)
+        {
+            memset((char *)pf->pf_addr + len, 0, S5_BLOCK_SIZE - len);
+        }
+        s5_release_disk_block(&pf);
+    }
+}
+
+/* Serialize the allocation bitmap back into on-disk free-list form so that
+ * the superblock written out by s5fs_sync describes the current free set.
+ * Inserting the free blocks in descending order replays exactly what a
+ * sequence of s5_free_block calls would have built under the old free-list
+ * scheme: full nodes are spilled into the block being inserted, which then
+ * becomes the new head link.
+ */
+void s5_sync_free_list(s5fs_t *s5fs)
+{
+    /* serializing needs every group's real bits in memory */
+    s5_bitmap_load_all(s5fs);
+
+    /* take every group lock, then the super lock (the lock order), so the
+     * bitmap cannot change while it is being serialized */
+    for (size_t i = 0; i < S5_ALLOC_GROUP_LOCKS; i++)
+    {
+        kmutex_lock(&s5fs->s5f_group_mutex[i]);
+    }
+    s5_lock_super(s5fs);
+
+    /* persist the group summaries and bitmap from the same snapshot the
+     * free list below is built from */
+    _s5_bitmap_region_write(s5fs);
+
+    s5_super_t *super = &s5fs->s5f_super;
+    super->s5s_nfree = 0;
+    super->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = (uint32_t)-1;
+
+    for (size_t w = s5fs->s5f_bitmap_size / 64; w-- > 0;)
+    {
+        uint64_t word = s5fs->s5f_block_bitmap[w];
+        while (word)
+        {
+            blocknum_t blockno = w * 64 + 63 - __builtin_clzl(word);
+            word &= ~(1UL << (blockno % 64));
+            if (super->s5s_nfree == S5_NBLKS_PER_FNODE - 1)
+            {
+                pframe_t *pf;
+                s5_get_disk_block(s5fs, blockno, 1, &pf);
+                memcpy(pf->pf_addr, super->s5s_free_blocks,
+                       sizeof(super->s5s_free_blocks));
+                s5_release_disk_block(&pf);
+                super->s5s_nfree = 0;
+                super->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = blockno;
+            }
+            else
+            {
+                super->s5s_free_blocks[super->s5s_nfree++] = blockno;
+            }
+        }
+    }
+    s5_unlock_super(s5fs);
+    for (size_t i = S5_ALLOC_GROUP_LOCKS; i-- > 0;)
+    {
+        kmutex_unlock(&s5fs->s5f_group_mutex[i]);
+    }
+}
+
+/* Blocks claimed ahead for a regular file the first time it allocates from
+ * a spot with free neighbors (see s5_alloc_block); sized so one window
+ * covers a typical small ingest file outright. */
+#define S5_ALLOC_RESV_BLOCKS 16
+
+/* Consume the head of sn's reservation window if it is exactly blockno.
+ * Returns 1 and hands the block over zeroed, like s5_claim_block, or 0
+ * when the window is empty or starts elsewhere. */
+static long s5_resv_take(s5fs_t *s5fs, s5_node_t *sn, blocknum_t blockno)
+{
+    spinlock_lock(&s5fs->s5f_resv_spin);
+    if (!sn->s5n_resv_count || sn->s5n_resv_start != blockno)
+    {
+        spinlock_unlock(&s5fs->s5f_resv_spin);
+        return 0;
+    }
+    sn->s5n_resv_start++;
+    if (!--sn->s5n_resv_count)
+    {
+        list_remove(&sn->s5n_resv_link);
+    }
+    spinlock_unlock(&s5fs->s5f_resv_spin);
+
+    pframe_t *pf;
+    s5_get_disk_block(s5fs, blockno, 1, &pf);
+    memset(pf->pf_addr, 0, PAGE_SIZE);
+    s5_release_disk_block(&pf);
+    return 1;
+}
+
+/* Return the unused tail of sn's reservation window to the free set. */
+void s5_resv_release(s5fs_t *s5fs, s5_node_t *sn)
+{
+    spinlock_lock(&s5fs->s5f_resv_spin);
+    blocknum_t start = sn->s5n_resv_start;
+    size_t count = sn->s5n_resv_count;
+    if (count)
+    {
+        sn->s5n_resv_count = 0;
+        list_remove(&sn->s5n_resv_link);
     }
-    int offset = S5_INODE_OFFSET(sn->inode.s5_number);
-    blocknum_t blocknum = S5_DATA_BLOCK(pos);
-    size_t bytes_written = 0;
-    pframe_t* pframe;
-    if (pos + len > S5_MAX_FILE_SIZE) {
-        len = S5_MAX_FILE_SIZE - pos;
+    spinlock_unlock(&s5fs->s5f_resv_spin);
+    for (size_t i = 0; i < count; i++)
+    {
+        s5_free_block(s5fs, start + (blocknum_t)i);
     }
-    while (bytes_written < len) {
-        blocknum = S5_DATA_BLOCK(pos);
-        size_t to_write = MIN(S5_BLOCK_SIZE - S5_DATA_OFFSET(pos), len - bytes_written);
-        uint32_t previous_size = sn->vnode.vn_len;
-        if (to_write + pos > sn->vnode.vn_len) {
-            sn->vnode.vn_len = to_write + pos;
-            sn->inode.s5_un.s5_size = to_write + pos;
-            sn->dirtied_inode = 1;
+}
+
+/* Drain every file's reservation window; called before the free list is
+ * rebuilt from the bitmap so blocks that were only ever reserved go back
+ * to disk as free, not leaked. A file can immediately reserve again. */
+void s5_resv_release_all(s5fs_t *s5fs)
+{
+    for (;;)
+    {
+        spinlock_lock(&s5fs->s5f_resv_spin);
+        if (list_empty(&s5fs->s5f_resv_nodes))
+        {
+            spinlock_unlock(&s5fs->s5f_resv_spin);
+            return;
         }
-        long status = s5_get_file_block(sn, blocknum, 1, &pframe);
-        if (status < 0) {
-            sn->vnode.vn_len = previous_size;
-            sn->inode.s5_un.s5_size = previous_size;
-            return status;
+        s5_node_t *sn =
+            list_head(&s5fs->s5f_resv_nodes, s5_node_t, s5n_resv_link);
+        blocknum_t start = sn->s5n_resv_start;
+        size_t count = sn->s5n_resv_count;
+        sn->s5n_resv_count = 0;
+        list_remove(&sn->s5n_resv_link);
+        spinlock_unlock(&s5fs->s5f_resv_spin);
+        for (size_t i = 0; i < count; i++)
+        {
+            s5_free_block(s5fs, start + (blocknum_t)i);
         }
-        memcpy((char *) pframe->pf_addr + S5_DATA_OFFSET(pos), buf + bytes_written, to_write);
-        bytes_written += to_write;
-        pos = pos + to_write;
-        sn->dirtied_inode = 1;
-        s5_release_file_block(&pframe);
     }
-    return bytes_written;
 }
 
 /* Allocate one block from the filesystem.
+ *
+ *  sn - The file the block is being allocated for; its s5n_alloc_hint steers
+ *       the search so consecutive allocations for the same file come from
+ *       physically contiguous runs
  *
  * Return the block number of the newly allocated block, or:
  *  - ENOSPC: There are no more free blocks
  *
- * Hints:
- *  - Protect access to the super block using s5_lock_super and s5_unlock super.
- *  - Recall that the free block list is a linked list of blocks containing disk
- *    block numbers of free blocks. Each node contains S5_NBLKS_PER_FNODE block
- *    numbers, where the last entry is a pointer to the next node in the linked
- *    list, or -1 if there are no more free blocks remaining. The super block's
- *    s5s_free_blocks is the first node of this linked list.
- *  - The super block's s5s_nfree member is the number of blocks that are free
- *    within s5s_free_blocks. You could use it as an index into the
- *    s5s_free_blocks array. Be sure to update the field appropriately.
- *  - When s5s_free_blocks runs out (i.e. s5s_nfree == 0), refill it by
- *    collapsing the next node of the free list into the super block. Exactly
- *    when you do this is up to you.
- *  - You should initialize the block's contents to 0. Specifically, 
- *    when you use s5_alloc_block to allocate an indirect block,
- *    as your implementation of s5_file_block_to_disk_block probably expects
- *    sparse blocks to be represented by a 0.
- *  - You may find it helpful to take a look at the implementation of
- *    s5_free_block below.
- *  - You may assume/assert that any pframe calls succeed.
+ * The search starts in the allocation group holding the file's hint and
+ * only that group's lock is taken while its slice of the bitmap is
+ * scanned, so writers whose files live in different groups allocate in
+ * parallel. Groups with no free blocks are skipped by their free count;
+ * within the hint's group the first word is scanned a second time without
+ * the hint mask so bits below the hint are not missed. The block's
+ * contents are zeroed after dropping the group lock (the cleared bitmap
+ * bit already makes the block ours), notably because
+ * s5_file_block_to_disk_block expects sparse entries in a fresh indirect
+ * block to be represented by 0.
+ *
+ * For regular files the found block's free successors, up to
+ * S5_ALLOC_RESV_BLOCKS of them, are claimed along with it as the file's
+ * reservation window, which later allocations consume first -- so even
+ * when many files are written concurrently each one's blocks come out of
+ * a contiguous run chosen in one decision, instead of interleaving
+ * first-fit singles. Unused windows are given back at sync and when the
+ * vnode is destroyed.
  */
-static long s5_alloc_block(s5fs_t *s5fs)
+static long s5_alloc_block(s5fs_t *s5fs, s5_node_t *sn)
 {
-    s5_lock_super(s5fs);
-    s5_super_t *super = &s5fs->s5f_super;
-    if (super->s5s_nfree == 0 && super->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] == (uint32_t) -1) {
-        s5_unlock_super(s5fs);
+    /* take the next block of this file's reservation window if it has
+     * one; its bitmap bit was already cleared when the window was claimed */
+    spinlock_lock(&s5fs->s5f_resv_spin);
+    if (sn->s5n_resv_count)
+    {
+        blocknum_t blockno = sn->s5n_resv_start++;
+        if (!--sn->s5n_resv_count)
+        {
+            list_remove(&sn->s5n_resv_link);
+        }
+        spinlock_unlock(&s5fs->s5f_resv_spin);
+        sn->s5n_alloc_hint = blockno + 1;
+
+        pframe_t *pf;
+        s5_get_disk_block(s5fs, blockno, 1, &pf);
+        memset(pf->pf_addr, 0, PAGE_SIZE);
+        s5_release_disk_block(&pf);
+
+        dbg(DBG_S5FS, "allocated reserved disk block %d\n", blockno);
+        return blockno;
+    }
+    spinlock_unlock(&s5fs->s5f_resv_spin);
+
+    blocknum_t hint = sn->s5n_alloc_hint;
+    if ((size_t)hint >= s5fs->s5f_bitmap_size)
+    {
+        hint = 0;
+    }
+    if (!hint && s5fs->s5f_super.s5s_journal_block)
+    {
+        /* a file with no history yet: start just past the (mid-disk)
+         * journal, so fresh data lands near where its metadata will be
+         * journaled rather than at the front of the disk */
+        hint = s5fs->s5f_super.s5s_journal_block +
+               s5fs->s5f_super.s5s_journal_size;
+        if ((size_t)hint >= s5fs->s5f_bitmap_size)
+        {
+            hint = 0;
+        }
+    }
+
+    /* a grow during the search only appends groups; they are seen by the
+     * next allocation */
+    size_t ngroups = s5fs->s5f_ngroups;
+    size_t startg = hint / S5_ALLOC_GROUP_BLOCKS;
+    blocknum_t blockno = 0;
+    size_t resv = 0;
+    for (size_t gi = 0; gi < ngroups && !blockno; gi++)
+    {
+        size_t g = (startg + gi) % ngroups;
+        s5_lock_group(s5fs, g);
+        if (!s5fs->s5f_group_nfree[g])
+        {
+            /* the summary alone rules the group out; its bitmap slice
+             * stays unloaded */
+            s5_unlock_group(s5fs, g);
+            continue;
+        }
+        s5_group_ensure_loaded(s5fs, g);
+        size_t base = g * S5_ALLOC_GROUP_WORDS;
+        size_t startw = gi == 0 ? hint / 64 - base : s5fs->s5f_group_ffree[g];
+        for (size_t i = 0; i <= S5_ALLOC_GROUP_WORDS; i++)
+        {
+            size_t w = base + (startw + i) % S5_ALLOC_GROUP_WORDS;
+            uint64_t word = s5fs->s5f_block_bitmap[w];
+            if (gi == 0 && i == 0)
+            {
+                word &= ~0UL << (hint % 64);
+            }
+            if (word)
+            {
+                blockno = w * 64 + __builtin_ctzl(word);
+                break;
+            }
+        }
+        KASSERT(blockno && "group free count does not match the bitmap");
+
+        s5fs->s5f_block_bitmap[blockno / 64] &= ~(1UL << (blockno % 64));
+        s5fs->s5f_group_nfree[g]--;
+        if (gi != 0)
+        {
+            /* the scan started at the group's first-free lower bound and
+             * found nothing before this word, so the word is the exact
+             * new bound (allocations only ever raise it; frees lower it
+             * in s5_bitmap_mark_free) */
+            s5fs->s5f_group_ffree[g] = (uint32_t)(blockno / 64 - base);
+        }
+
+        /* claim the block's free successors as this file's reservation
+         * window while the group lock is still held; stop at the group
+         * boundary so the free count stays per-group */
+        if (S_ISREG(sn->vnode.vn_mode))
+        {
+            blocknum_t b = blockno + 1;
+            blocknum_t limit = (blocknum_t)MIN(
+                (g + 1) * S5_ALLOC_GROUP_BLOCKS, s5fs->s5f_bitmap_size);
+            while (resv < S5_ALLOC_RESV_BLOCKS && b < limit &&
+                   (s5fs->s5f_block_bitmap[b / 64] >> (b % 64)) & 1)
+            {
+                s5fs->s5f_block_bitmap[b / 64] &= ~(1UL << (b % 64));
+                resv++;
+                b++;
+            }
+            s5fs->s5f_group_nfree[g] -= resv;
+        }
+        s5_unlock_group(s5fs, g);
+    }
+    if (!blockno)
+    {
         return -ENOSPC;
     }
+    if (resv)
+    {
+        spinlock_lock(&s5fs->s5f_resv_spin);
+        KASSERT(!sn->s5n_resv_count);
+        sn->s5n_resv_start = blockno + 1;
+        sn->s5n_resv_count = resv;
+        list_insert_tail(&s5fs->s5f_resv_nodes, &sn->s5n_resv_link);
+        spinlock_unlock(&s5fs->s5f_resv_spin);
+    }
+
+    sn->s5n_alloc_hint = blockno + 1;
+
     pframe_t *pf;
-    if (super->s5s_nfree == 0) {
-        s5_get_disk_block(s5fs, super->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1], 1, &pf);
-        long retval = super->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1];
-        super->s5s_nfree = S5_NBLKS_PER_FNODE - 1;
-        memcpy(super->s5s_free_blocks, pf->pf_addr, sizeof(super->s5s_free_blocks));
-        memset(pf->pf_addr, 0, PAGE_SIZE);
-        s5_release_disk_block(&pf);
-        s5_unlock_super(s5fs);
-        return retval;
-    } else {
-        s5_get_disk_block(s5fs, super->s5s_free_blocks[super->s5s_nfree-1], 1, &pf);
-        super->s5s_nfree -= 1;
+    s5_get_disk_block(s5fs, blockno, 1, &pf);
+    memset(pf->pf_addr, 0, PAGE_SIZE);
+    s5_release_disk_block(&pf);
+
+    dbg(DBG_S5FS, "allocated disk block %d\n", blockno);
+    return blockno;
+}
+
+/* Try to allocate blockno specifically, rather than whichever free block
+ * the search finds first. Returns 1 and hands the block over zeroed if it
+ * was free, or 0 if it is already in use (or out of range). The extent
+ * path uses this to grow a file's current run in place. */
+static long s5_claim_block(s5fs_t *s5fs, blocknum_t blockno)
+{
+    if ((size_t)blockno >= s5fs->s5f_bitmap_size)
+    {
+        return 0;
+    }
+    size_t group = blockno / S5_ALLOC_GROUP_BLOCKS;
+    s5_lock_group(s5fs, group);
+    s5_group_ensure_loaded(s5fs, group);
+    if (!(s5fs->s5f_block_bitmap[blockno / 64] & (1UL << (blockno % 64))))
+    {
+        s5_unlock_group(s5fs, group);
+        return 0;
     }
+    s5fs->s5f_block_bitmap[blockno / 64] &= ~(1UL << (blockno % 64));
+    s5fs->s5f_group_nfree[group]--;
+    s5_unlock_group(s5fs, group);
+
+    pframe_t *pf;
+    s5_get_disk_block(s5fs, blockno, 1, &pf);
     memset(pf->pf_addr, 0, PAGE_SIZE);
     s5_release_disk_block(&pf);
-    s5_unlock_super(s5fs);
-    return super->s5s_free_blocks[super->s5s_nfree];
+
+    dbg(DBG_S5FS, "claimed disk block %d\n", blockno);
+    return 1;
 }
 
 /*
- * The exact opposite of s5_alloc_block: add blockno to the free list of the
- * filesystem. This should never fail. You may assert that any pframe calls
- * succeed.
+ * The exact opposite of s5_alloc_block: return blockno to the free set of
+ * the filesystem. This should never fail.
  *
- * Don't forget to protect access to the super block, update s5s_nfree, and
- * expand the linked list correctly if the super block can no longer hold any
- * more free blocks in its s5s_free_blocks array according to s5s_nfree.
+ * Under the bitmap scheme this is just a bit flip; the freed block's former
+ * contents are left alone, and the on-disk free list is not touched until
+ * the next s5_sync_free_list.
  */
 static void s5_free_block(s5fs_t *s5fs, blocknum_t blockno)
 {
-    s5_lock_super(s5fs);
-    s5_super_t *s = &s5fs->s5f_super;
     dbg(DBG_S5FS, "freeing disk block %d\n", blockno);
     KASSERT(blockno);
-    KASSERT(s->s5s_nfree < S5_NBLKS_PER_FNODE);
-
-    pframe_t *pf;
-    s5_get_disk_block(s5fs, blockno, 1, &pf);
-
-    if (s->s5s_nfree == S5_NBLKS_PER_FNODE - 1)
-    {
-        memcpy(pf->pf_addr, s->s5s_free_blocks, sizeof(s->s5s_free_blocks));
-
-        s->s5s_nfree = 0;
-        s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = blockno;
-    }
-    else
-    {
-        s->s5s_free_blocks[s->s5s_nfree++] = blockno;
-        pf->pf_dirty = 0;
-    }
-    s5_release_disk_block(&pf);
-    s5_unlock_super(s5fs);
+    s5_meta_clear(s5fs, blockno);
+    size_t group = blockno / S5_ALLOC_GROUP_BLOCKS;
+    s5_lock_group(s5fs, group);
+    s5_bitmap_mark_free(s5fs, blockno);
+    s5_unlock_group(s5fs, group);
 }
 
 /*
@@ -402,7 +1729,8 @@ static void s5_free_block(s5fs_t *s5fs, blocknum_t blockno)
 long s5_alloc_inode(s5fs_t *s5fs, uint16_t type, devid_t devid)
 {
     KASSERT((S5_TYPE_DATA == type) || (S5_TYPE_DIR == type) ||
-            (S5_TYPE_CHR == type) || (S5_TYPE_BLK == type));
+            (S5_TYPE_CHR == type) || (S5_TYPE_BLK == type) ||
+            (S5_TYPE_LNK == type));
 
     s5_lock_super(s5fs);
     uint32_t new_ino = s5fs->s5f_super.s5s_free_inode;
@@ -425,6 +1753,11 @@ long s5_alloc_inode(s5fs_t *s5fs, uint16_t type, devid_t devid)
     memset(inode->s5_direct_blocks, 0, sizeof(inode->s5_direct_blocks));
     inode->s5_indirect_block =
         (S5_TYPE_CHR == type || S5_TYPE_BLK == type) ? devid : 0;
+    inode->s5_dindirect_block = 0;
+    inode->s5_flags = (S5_TYPE_DATA == type && s5fs->s5f_super.s5s_extents)
+                          ? S5_IFLAG_EXTENTS
+                          : 0;
+    inode->s5_atime = 0; /* stamped on first access (s5_touch_atime) */
 
     s5_release_inode(&pf, &inode);
     s5_unlock_super(s5fs);
@@ -433,6 +1766,61 @@ long s5_alloc_inode(s5fs_t *s5fs, uint16_t type, devid_t devid)
     return new_ino;
 }
 
+/* Free every disk block covered by the runs in ext; used for both the
+ * inline extent table and the overflow block's. */
+static void s5_free_extents(s5fs_t *s5fs, s5_extent_t *ext, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        for (uint32_t b = 0; b < ext[i].s5e_nblocks; b++)
+        {
+            s5_free_block(s5fs, ext[i].s5e_disk_block + b);
+        }
+    }
+}
+
+/* Free the runs in an extent overflow block and the block itself. */
+static void s5_free_extent_overflow(s5fs_t *s5fs, uint32_t block)
+{
+    pframe_t *pf;
+    s5_get_disk_block(s5fs, block, 0, &pf);
+    s5_free_extents(s5fs, pf->pf_addr, S5_EXTENTS_PER_BLOCK);
+    s5_release_disk_block(&pf);
+    s5_free_block(s5fs, block);
+}
+
+/* Free every data block reachable from a double-indirect tree, the leaf
+ * indirect blocks, and the root block itself. The frames are walked in
+ * place rather than copied out; each is only held while its slots are
+ * read. */
+static void s5_free_dindirect_tree(s5fs_t *s5fs, uint32_t root)
+{
+    pframe_t *pf;
+    s5_get_disk_block(s5fs, root, 0, &pf);
+    uint32_t *slots = pf->pf_addr;
+    for (unsigned i = 0; i < S5_NIDIRECT_BLOCKS; i++)
+    {
+        if (!slots[i])
+        {
+            continue;
+        }
+        pframe_t *leaf_pf;
+        s5_get_disk_block(s5fs, slots[i], 0, &leaf_pf);
+        uint32_t *leaf = leaf_pf->pf_addr;
+        for (unsigned j = 0; j < S5_NIDIRECT_BLOCKS; j++)
+        {
+            if (leaf[j])
+            {
+                s5_free_block(s5fs, leaf[j]);
+            }
+        }
+        s5_release_disk_block(&leaf_pf);
+        s5_free_block(s5fs, slots[i]);
+    }
+    s5_release_disk_block(&pf);
+    s5_free_block(s5fs, root);
+}
+
 /*
  * Free the inode by:
  *  1) adding the inode to the free inode linked list (opposite of
@@ -461,9 +1849,14 @@ void s5_free_inode(s5fs_t *s5fs, ino_t ino)
 
     uint32_t direct_blocks_to_free[S5_NDIRECT_BLOCKS];
     uint32_t indirect_block_to_free;
-    if (inode->s5_type == S5_TYPE_DATA || inode->s5_type == S5_TYPE_DIR)
+    uint32_t dindirect_block_to_free;
+    long extents = 0;
+    if (inode->s5_type == S5_TYPE_DATA || inode->s5_type == S5_TYPE_DIR ||
+        inode->s5_type == S5_TYPE_LNK)
     {
         indirect_block_to_free = inode->s5_indirect_block;
+        dindirect_block_to_free = inode->s5_dindirect_block;
+        extents = inode->s5_flags & S5_IFLAG_EXTENTS;
         memcpy(direct_blocks_to_free, inode->s5_direct_blocks,
                sizeof(direct_blocks_to_free));
     }
@@ -471,6 +1864,7 @@ void s5_free_inode(s5fs_t *s5fs, ino_t ino)
     {
         KASSERT(inode->s5_type == S5_TYPE_BLK || inode->s5_type == S5_TYPE_CHR);
         indirect_block_to_free = 0;
+        dindirect_block_to_free = 0;
         memset(direct_blocks_to_free, 0, sizeof(direct_blocks_to_free));
     }
 
@@ -481,34 +1875,231 @@ void s5_free_inode(s5fs_t *s5fs, ino_t ino)
     s5_release_inode(&pf, &inode);
     s5_unlock_super(s5fs);
 
-    for (unsigned i = 0; i < S5_NDIRECT_BLOCKS; i++)
+    if (extents)
     {
-        if (direct_blocks_to_free[i])
+        /* the copied direct-block area is the inline extent table, and the
+         * "indirect" block is the extent overflow block */
+        s5_free_extents(s5fs, (s5_extent_t *)direct_blocks_to_free,
+                        S5_INODE_EXTENTS);
+        if (indirect_block_to_free)
         {
-            s5_free_block(s5fs, direct_blocks_to_free[i]);
+            s5_free_extent_overflow(s5fs, indirect_block_to_free);
         }
     }
-    if (indirect_block_to_free)
+    else
     {
-        uint32_t indirect_blocks_to_free[S5_NIDIRECT_BLOCKS];
+        for (unsigned i = 0; i < S5_NDIRECT_BLOCKS; i++)
+        {
+            if (direct_blocks_to_free[i])
+            {
+                s5_free_block(s5fs, direct_blocks_to_free[i]);
+            }
+        }
+        if (indirect_block_to_free)
+        {
+            uint32_t indirect_blocks_to_free[S5_NIDIRECT_BLOCKS];
 
-        s5_get_disk_block(s5fs, indirect_block_to_free, 0, &pf);
-        KASSERT(S5_BLOCK_SIZE == PAGE_SIZE);
-        memcpy(indirect_blocks_to_free, pf->pf_addr, S5_BLOCK_SIZE);
-        s5_release_disk_block(&pf);
+            s5_get_disk_block(s5fs, indirect_block_to_free, 0, &pf);
+            KASSERT(S5_BLOCK_SIZE == PAGE_SIZE);
+            memcpy(indirect_blocks_to_free, pf->pf_addr, S5_BLOCK_SIZE);
+            s5_release_disk_block(&pf);
 
-        for (unsigned i = 0; i < S5_NIDIRECT_BLOCKS; i++)
-        {
-            if (indirect_blocks_to_free[i])
+            for (unsigned i = 0; i < S5_NIDIRECT_BLOCKS; i++)
             {
-                s5_free_block(s5fs, indirect_blocks_to_free[i]);
+                if (indirect_blocks_to_free[i])
+                {
+                    s5_free_block(s5fs, indirect_blocks_to_free[i]);
+                }
             }
+            s5_free_block(s5fs, indirect_block_to_free);
         }
-        s5_free_block(s5fs, indirect_block_to_free);
+    }
+    if (dindirect_block_to_free)
+    {
+        s5_free_dindirect_tree(s5fs, dindirect_block_to_free);
     }
     dbg(DBG_S5FS, "freed inode %d\n", ino);
 }
 
+/*
+ * Lazily built per-directory name index: maps the hash of an entry's name
+ * to the file positions of candidate dirents, so s5_find_dirent in a huge
+ * directory touches O(1) blocks instead of scanning every dirent. The
+ * index is built by the first lookup on a directory, kept current by
+ * s5_link and s5_remove_dirent, and dropped wholesale if memory runs
+ * short - lookups then fall back to the linear scan until the next
+ * rebuild. All access happens under the directory's vnode lock.
+ */
+#define S5_DIRHASH_BUCKETS 128
+
+/* After a build fails for lack of memory, leave the directory on the
+ * linear-scan fallback for this many ticks before trying again. */
+#define S5_DIRHASH_RETRY_TICKS 128
+
+typedef struct s5_dirhash
+{
+    list_t dh_buckets[S5_DIRHASH_BUCKETS];
+} s5_dirhash_t;
+
+typedef struct s5_dirhash_entry
+{
+    size_t dhe_hash; /* full hash of the entry's name, for cheap filtering */
+    size_t dhe_pos;  /* file position of the dirent */
+    list_link_t dhe_link;
+} s5_dirhash_entry_t;
+
+static slab_allocator_t *s5_dirhash_allocator;
+
+static size_t _s5_dirhash_hash(const char *name, size_t namelen)
+{
+    size_t hash = 0;
+    for (size_t i = 0; i < namelen; i++)
+    {
+        hash = hash * 31 + (unsigned char)name[i];
+    }
+    return hash;
+}
+
+void s5_dirhash_destroy(s5_node_t *sn)
+{
+    s5_dirhash_t *dh = sn->s5n_dirhash;
+    if (!dh)
+    {
+        return;
+    }
+    sn->s5n_dirhash = NULL;
+    for (size_t i = 0; i < S5_DIRHASH_BUCKETS; i++)
+    {
+        list_iterate(&dh->dh_buckets[i], dhe, s5_dirhash_entry_t, dhe_link)
+        {
+            list_remove(&dhe->dhe_link);
+            slab_obj_free(s5_dirhash_allocator, dhe);
+        }
+    }
+    kfree(dh);
+}
+
+/* Add (name, pos) to the directory's index, if it has one. On allocation
+ * failure the whole index is dropped rather than left incomplete. */
+static void _s5_dirhash_insert(s5_node_t *sn, const char *name, size_t namelen,
+                               size_t pos)
+{
+    s5_dirhash_t *dh = sn->s5n_dirhash;
+    if (!dh)
+    {
+        return;
+    }
+    s5_dirhash_entry_t *dhe = slab_obj_alloc(s5_dirhash_allocator);
+    if (!dhe)
+    {
+        s5_dirhash_destroy(sn);
+        sn->s5n_dirhash_retry = jiffies + S5_DIRHASH_RETRY_TICKS;
+        return;
+    }
+    dhe->dhe_hash = _s5_dirhash_hash(name, namelen);
+    dhe->dhe_pos = pos;
+    list_link_init(&dhe->dhe_link);
+    list_insert_tail(&dh->dh_buckets[dhe->dhe_hash % S5_DIRHASH_BUCKETS],
+                     &dhe->dhe_link);
+}
+
+/* Drop the index entry for the dirent at pos (whose name hashes the
+ * bucket to search). */
+static void _s5_dirhash_remove(s5_node_t *sn, const char *name, size_t namelen,
+                               size_t pos)
+{
+    s5_dirhash_t *dh = sn->s5n_dirhash;
+    if (!dh)
+    {
+        return;
+    }
+    size_t hash = _s5_dirhash_hash(name, namelen);
+    list_iterate(&dh->dh_buckets[hash % S5_DIRHASH_BUCKETS], dhe,
+                 s5_dirhash_entry_t, dhe_link)
+    {
+        if (dhe->dhe_pos == pos)
+        {
+            list_remove(&dhe->dhe_link);
+            slab_obj_free(s5_dirhash_allocator, dhe);
+            return;
+        }
+    }
+}
+
+/* Update the recorded position of name's dirent from 'from' to 'to'
+ * (s5_remove_dirent relocates the directory's last entry into the hole it
+ * leaves behind). */
+static void _s5_dirhash_move(s5_node_t *sn, const char *name, size_t namelen,
+                             size_t from, size_t to)
+{
+    s5_dirhash_t *dh = sn->s5n_dirhash;
+    if (!dh)
+    {
+        return;
+    }
+    size_t hash = _s5_dirhash_hash(name, namelen);
+    list_iterate(&dh->dh_buckets[hash % S5_DIRHASH_BUCKETS], dhe,
+                 s5_dirhash_entry_t, dhe_link)
+    {
+        if (dhe->dhe_pos == from)
+        {
+            dhe->dhe_pos = to;
+            return;
+        }
+    }
+}
+
+/* Build the index from the directory's current contents. A failure just
+ * leaves s5n_dirhash NULL; lookups use the linear scan. Failed builds are
+ * not retried until s5n_dirhash_retry passes: every create and lookup
+ * probes the index, so during a burst under memory pressure re-running
+ * the doomed allocations - and, worse, the full directory scan behind
+ * them - on every operation would dwarf the cost of the fallback scan
+ * itself. */
+static void _s5_dirhash_build(s5_node_t *sn)
+{
+    if (jiffies < sn->s5n_dirhash_retry)
+    {
+        return;
+    }
+    if (!s5_dirhash_allocator)
+    {
+        s5_dirhash_allocator =
+            slab_allocator_create("s5_dirhash", sizeof(s5_dirhash_entry_t));
+        if (!s5_dirhash_allocator)
+        {
+            sn->s5n_dirhash_retry = jiffies + S5_DIRHASH_RETRY_TICKS;
+            return;
+        }
+    }
+    s5_dirhash_t *dh = kmalloc(sizeof(s5_dirhash_t));
+    if (!dh)
+    {
+        sn->s5n_dirhash_retry = jiffies + S5_DIRHASH_RETRY_TICKS;
+        return;
+    }
+    for (size_t i = 0; i < S5_DIRHASH_BUCKETS; i++)
+    {
+        list_init(&dh->dh_buckets[i]);
+    }
+    sn->s5n_dirhash = dh;
+
+    s5_dirent_t dirent;
+    size_t pos = 0;
+    while (pos < sn->inode.s5_un.s5_size &&
+           s5_read_file(sn, pos, (char *)&dirent, sizeof(s5_dirent_t)) > 0)
+    {
+        _s5_dirhash_insert(sn, dirent.s5d_name, strlen(dirent.s5d_name), pos);
+        if (!sn->s5n_dirhash)
+        {
+            /* an insert failed and dropped the index */
+            sn->s5n_dirhash_retry = jiffies + S5_DIRHASH_RETRY_TICKS;
+            return;
+        }
+        pos += sizeof(s5_dirent_t);
+    }
+}
+
 /* Return the inode number corresponding to the directory entry specified by
  * name and namelen within a given directory.
  *
@@ -536,6 +2127,28 @@ long s5_find_dirent(s5_node_t *sn, const char *name, size_t namelen,
     KASSERT(S_ISDIR(sn->vnode.vn_mode) && "should be handled at the VFS level");
     KASSERT(S5_BLOCK_SIZE == PAGE_SIZE && "be wary, thee");
     s5_dirent_t result;
+    if (!sn->s5n_dirhash) {
+        _s5_dirhash_build(sn);
+    }
+    if (sn->s5n_dirhash) {
+        size_t hash = _s5_dirhash_hash(name, namelen);
+        list_iterate(&sn->s5n_dirhash->dh_buckets[hash % S5_DIRHASH_BUCKETS],
+                     dhe, s5_dirhash_entry_t, dhe_link) {
+            if (dhe->dhe_hash != hash) {
+                continue;
+            }
+            if (s5_read_file(sn, dhe->dhe_pos, (char *) &result, sizeof(s5_dirent_t)) <= 0) {
+                continue;
+            }
+            if (name_match(result.s5d_name, name, namelen)) {
+                if (filepos) {
+                    *filepos = dhe->dhe_pos;
+                }
+                return result.s5d_inode;
+            }
+        }
+        return -ENOENT;
+    }
     size_t read = 0;
     while (s5_read_file(sn, read, (char *) &result, sizeof(s5_dirent_t)) >= 0 && read < sn->inode.s5_un.s5_size) {
         if (name_match(result.s5d_name, name, namelen)) {
@@ -582,16 +2195,20 @@ void s5_remove_dirent(s5_node_t *sn, const char *name, size_t namelen,
     KASSERT(ino >= 0);
     KASSERT(child->inode.s5_number == ino);
     s5_dirent_t end;
-    s5_read_file(sn, sn->vnode.vn_len - sizeof(s5_dirent_t), (char *) &end, sizeof(s5_dirent_t));
+    size_t end_position = sn->vnode.vn_len - sizeof(s5_dirent_t);
+    s5_read_file(sn, end_position, (char *) &end, sizeof(s5_dirent_t));
     sn->vnode.vn_len -= sizeof(s5_dirent_t);
     sn->inode.s5_un.s5_size -= sizeof(s5_dirent_t);
+    _s5_dirhash_remove(sn, name, namelen, write_position);
     if (!name_match(end.s5d_name, name, namelen)) {
         s5_write_file(sn, write_position, (char *) &end, sizeof(s5_dirent_t));
+        _s5_dirhash_move(sn, end.s5d_name, strlen(end.s5d_name), end_position,
+                         write_position);
     }
     child->inode.s5_linkcount -= 1;
     KASSERT(child->inode.s5_linkcount >= 0);
-    child->dirtied_inode = 1;
-    sn->dirtied_inode = 1;
+    s5_dirty_inode(child);
+    s5_dirty_inode(sn);
 }
 
 /* Replace a directory entry.
@@ -612,16 +2229,34 @@ void s5_remove_dirent(s5_node_t *sn, const char *name, size_t namelen,
  *    before, but use the inode number from the new s5_node.
  *  - Update linkcounts and dirty inodes appropriately.
  *
- * s5_replace_dirent is NOT necessary to implement. It's only useful if 
- * you're planning on implementing the renaming of directories (which you shouldn't 
- * attempt until after the rest of S5FS is done).
+ * Used by s5fs_rename when the destination name already exists: the entry
+ * is overwritten in place, so there is no window where the name is absent
+ * from the directory (s5_remove_dirent + s5_link would leave one, and
+ * would also relocate the directory's last entry for nothing). The name
+ * and position are unchanged, so the directory's hash index stays valid.
  */
 void s5_replace_dirent(s5_node_t *sn, const char *name, size_t namelen,
                        s5_node_t *old, s5_node_t *new)
 {
-    vnode_t *dir = &sn->vnode;
-    s5_inode_t *inode = &sn->inode;
-    NOT_YET_IMPLEMENTED("RENAMEDIR: s5_replace_dirent()");
+    KASSERT(S_ISDIR(sn->vnode.vn_mode));
+    size_t write_position;
+    long ino = s5_find_dirent(sn, name, namelen, &write_position);
+    KASSERT(ino >= 0);
+    KASSERT(old->inode.s5_number == ino);
+    s5_dirent_t dirent;
+    ssize_t read = s5_read_file(sn, write_position, (char *) &dirent,
+                                sizeof(s5_dirent_t));
+    KASSERT(read > 0);
+    dirent.s5d_inode = new->inode.s5_number;
+    ssize_t written = s5_write_file(sn, write_position, (char *) &dirent,
+                                    sizeof(s5_dirent_t));
+    KASSERT(written >= 0 && "overwriting an existing dirent allocates nothing");
+    new->inode.s5_linkcount += 1;
+    old->inode.s5_linkcount -= 1;
+    KASSERT(old->inode.s5_linkcount >= 0);
+    s5_dirty_inode(new);
+    s5_dirty_inode(old);
+    s5_dirty_inode(sn);
 }
 
 /* Create a directory entry.
@@ -655,11 +2290,13 @@ long s5_link(s5_node_t *dir, const char *name, size_t namelen,
     }
     dirent.s5d_name[namelen] = '\0';
     dirent.s5d_inode = child->inode.s5_number;
-    child->dirtied_inode = 1;
-    status = s5_write_file(dir, dir->vnode.vn_len, (char *) &dirent, sizeof(s5_dirent_t));
+    s5_dirty_inode(child);
+    size_t dirent_position = dir->vnode.vn_len;
+    status = s5_write_file(dir, dirent_position, (char *) &dirent, sizeof(s5_dirent_t));
     if (status < 0) {
         return status;
     }
+    _s5_dirhash_insert(dir, name, namelen, dirent_position);
     child->inode.s5_linkcount += 1;
     KASSERT(child->inode.s5_linkcount > 0);
     return 0;
@@ -676,8 +2313,26 @@ long s5_link(s5_node_t *dir, const char *name, size_t namelen,
  *    these special files is actually the device id.
  */
 long s5_inode_blocks(s5_node_t *sn)
-{   
+{
     long count = 0;
+    if (sn->inode.s5_flags & S5_IFLAG_EXTENTS) {
+        s5_extent_t *ext = S5_INODE_EXTENT_ARRAY(&sn->inode);
+        for (size_t i = 0; i < S5_INODE_EXTENTS; i++) {
+            count += ext[i].s5e_nblocks;
+        }
+        if (sn->inode.s5_indirect_block) {
+            count += 1;
+            pframe_t *pframe;
+            s5_get_disk_block(FS_TO_S5FS(sn->vnode.vn_fs),
+                              sn->inode.s5_indirect_block, 0, &pframe);
+            ext = pframe->pf_addr;
+            for (size_t i = 0; i < S5_EXTENTS_PER_BLOCK; i++) {
+                count += ext[i].s5e_nblocks;
+            }
+            s5_release_disk_block(&pframe);
+        }
+        return count;
+    }
     for (int d = 0; d < S5_NDIRECT_BLOCKS; d++) {
         if (sn->inode.s5_direct_blocks[d]) {
             count += 1;
@@ -708,8 +2363,23 @@ void s5_remove_blocks(s5_node_t *sn)
     // Free the blocks used by the node
     // First, free the the direct blocks
     s5fs_t* s5fs = VNODE_TO_S5FS(&sn->vnode);
-    s5_inode_t* s5_inode = &sn->inode; 
-    for (unsigned i = 0; i < S5_NDIRECT_BLOCKS; i++) 
+    s5_inode_t* s5_inode = &sn->inode;
+
+    if (s5_inode->s5_flags & S5_IFLAG_EXTENTS)
+    {
+        s5_free_extents(s5fs, S5_INODE_EXTENT_ARRAY(s5_inode),
+                        S5_INODE_EXTENTS);
+        memset(s5_inode->s5_direct_blocks, 0,
+               sizeof(s5_inode->s5_direct_blocks));
+        if (s5_inode->s5_indirect_block)
+        {
+            s5_free_extent_overflow(s5fs, s5_inode->s5_indirect_block);
+            s5_inode->s5_indirect_block = 0;
+        }
+        return;
+    }
+
+    for (unsigned i = 0; i < S5_NDIRECT_BLOCKS; i++)
     {
         if (s5_inode->s5_direct_blocks[i])
         {
@@ -739,4 +2409,12 @@ void s5_remove_blocks(s5_node_t *sn)
         s5_free_block(s5fs, s5_inode->s5_indirect_block);
         s5_inode->s5_indirect_block = 0;
     }
+
+    if (s5_inode->s5_dindirect_block)
+    {
+        s5_free_dindirect_tree(s5fs, s5_inode->s5_dindirect_block);
+        s5_inode->s5_dindirect_block = 0;
+    }
+    // the cached leaf indirect block is gone with the rest of the tree
+    sn->s5n_leaf_cache_slot = 0;
 }
@@ -0,0 +1,916 @@
+/*
+ * tmpfs: a RAM-backed scratch filesystem.
+ *
+ * Unlike ramfs (which exists only to exercise the VFS before s5fs is
+ * written, and caps every file at a single page), tmpfs is meant to be
+ * mounted as working space for short-lived files. Each regular file's
+ * data lives in an anonymous memory object (vm/anon.c), which buys us:
+ *
+ *    o Files grow page by page with no fixed size limit; pages are
+ *      returned to the system on truncate, unlink, and umount.
+ *
+ *    o Holes cost nothing: reads of never-written pages are served from
+ *      the shared zero frame without materializing memory.
+ *
+ *    o mmap shares frames with read/write through the same object, and
+ *      every data page sits on the pageout daemon's LRU, so tmpfs usage
+ *      shows up in the ordinary residency accounting.
+ *
+ * Anonymous frames have no backing store to flush to, so tmpfs pages are
+ * not reclaimed under memory pressure; freeing memory means truncating
+ * or unlinking the files that hold it.
+ *
+ * Directories keep the ramfs scheme: a single page holding an array of
+ * (ino, name) pairs, and a fixed-size inode table per mount.
+ */
+
+#include "fs/tmpfs/tmpfs.h"
+#include "errno.h"
+#include "fs/dirent.h"
+#include "fs/stat.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "globals.h"
+#include "kernel.h"
+#include "mm/kmalloc.h"
+#include "mm/mobj.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+#include "util/debug.h"
+#include "util/string.h"
+#include "vm/anon.h"
+
+/*
+ * Filesystem operations
+ */
+static void tmpfs_read_vnode(fs_t *fs, vnode_t *vn);
+
+static void tmpfs_delete_vnode(fs_t *fs, vnode_t *vn);
+
+static long tmpfs_umount(fs_t *fs);
+
+static fs_ops_t tmpfs_ops = {.read_vnode = tmpfs_read_vnode,
+                             .delete_vnode = tmpfs_delete_vnode,
+                             .umount = tmpfs_umount};
+
+/*
+ * vnode operations
+ */
+static ssize_t tmpfs_read(vnode_t *file, size_t offset, void *buf,
+                          size_t count);
+
+static ssize_t tmpfs_write(vnode_t *file, size_t offset, const void *buf,
+                           size_t count);
+
+static long tmpfs_mmap(vnode_t *file, struct mobj **ret);
+
+static ssize_t tmpfs_mknod(struct vnode *dir, const char *name,
+                           size_t name_len, int mode, devid_t devid,
+                           struct vnode **out);
+
+static ssize_t tmpfs_lookup(vnode_t *dir, const char *name, size_t namelen,
+                            vnode_t **out);
+
+static long tmpfs_link(vnode_t *dir, const char *name, size_t namelen,
+                       vnode_t *child);
+
+static ssize_t tmpfs_unlink(vnode_t *dir, const char *name, size_t name_len);
+
+static ssize_t tmpfs_rename(vnode_t *olddir, const char *oldname,
+                            size_t oldnamelen, vnode_t *newdir,
+                            const char *newname, size_t newnamelen);
+
+static ssize_t tmpfs_mkdir(vnode_t *dir, const char *name, size_t name_len,
+                           struct vnode **out);
+
+static ssize_t tmpfs_rmdir(vnode_t *dir, const char *name, size_t name_len);
+
+static ssize_t tmpfs_readdir(vnode_t *dir, size_t offset, struct dirent *d);
+
+static ssize_t tmpfs_stat(vnode_t *file, stat_t *buf);
+
+static void tmpfs_truncate_file(vnode_t *file);
+
+static vnode_ops_t tmpfs_dir_vops = {.read = NULL,
+                                     .write = NULL,
+                                     .mmap = NULL,
+                                     .mknod = tmpfs_mknod,
+                                     .lookup = tmpfs_lookup,
+                                     .link = tmpfs_link,
+                                     .unlink = tmpfs_unlink,
+                                     .rename = tmpfs_rename,
+                                     .mkdir = tmpfs_mkdir,
+                                     .rmdir = tmpfs_rmdir,
+                                     .readdir = tmpfs_readdir,
+                                     .stat = tmpfs_stat,
+                                     .acquire = NULL,
+                                     .release = NULL,
+                                     .get_pframe = NULL,
+                                     .fill_pframe = NULL,
+                                     .flush_pframe = NULL,
+                                     .truncate_file = NULL};
+
+static vnode_ops_t tmpfs_file_vops = {.read = tmpfs_read,
+                                      .write = tmpfs_write,
+                                      .mmap = tmpfs_mmap,
+                                      .mknod = NULL,
+                                      .lookup = NULL,
+                                      .link = NULL,
+                                      .unlink = NULL,
+                                      .mkdir = NULL,
+                                      .rmdir = NULL,
+                                      .stat = tmpfs_stat,
+                                      .acquire = NULL,
+                                      .release = NULL,
+                                      .get_pframe = NULL,
+                                      .fill_pframe = NULL,
+                                      .flush_pframe = NULL,
+                                      .truncate_file = tmpfs_truncate_file};
+
+/*
+ * The tmpfs 'inode' structure. Regular files keep their data in tf_mobj;
+ * directories keep a page of dirents in tf_mem; device nodes stash the
+ * devid in tf_mem.
+ */
+typedef struct tmpfs_inode
+{
+    size_t tf_size;       /* Total file size */
+    ino_t tf_ino;         /* Inode number */
+    mobj_t *tf_mobj;      /* Anonymous object holding file data (files) */
+    char *tf_mem;         /* Dirent page (dirs) or devid (devices) */
+    ssize_t tf_mode;      /* Type of file */
+    ssize_t tf_linkcount; /* Number of links to this file */
+} tmpfs_inode_t;
+
+#define TMPFS_TYPE_DATA 0
+#define TMPFS_TYPE_DIR 1
+#define TMPFS_TYPE_CHR 2
+#define TMPFS_TYPE_BLK 3
+
+#define VNODE_TO_TMPFSINODE(vn) ((tmpfs_inode_t *)(vn)->vn_i)
+#define VNODE_TO_TMPFS(vn) ((tmpfs_t *)(vn)->vn_fs->fs_i)
+#define VNODE_TO_DIRENT(vn) \
+    ((tmpfs_dirent_t *)VNODE_TO_TMPFSINODE(vn)->tf_mem)
+
+/*
+ * tmpfs filesystem structure
+ */
+#define TMPFS_MAX_FILES 256
+
+typedef struct tmpfs
+{
+    tmpfs_inode_t *tfs_inodes[TMPFS_MAX_FILES]; /* Array of all files */
+} tmpfs_t;
+
+/*
+ * For directories, we simply store an array of (ino, name) pairs in the
+ * memory portion of the inode.
+ */
+typedef struct tmpfs_dirent
+{
+    ssize_t td_ino;         /* Inode number of this entry */
+    char td_name[NAME_LEN]; /* Name of this entry */
+} tmpfs_dirent_t;
+
+#define TMPFS_MAX_DIRENT ((size_t)(PAGE_SIZE / sizeof(tmpfs_dirent_t)))
+
+/* Helper functions */
+static ssize_t tmpfs_alloc_inode(fs_t *fs, ssize_t type, devid_t devid)
+{
+    tmpfs_t *tfs = (tmpfs_t *)fs->fs_i;
+    KASSERT((TMPFS_TYPE_DATA == type) || (TMPFS_TYPE_DIR == type) ||
+            (TMPFS_TYPE_CHR == type) || (TMPFS_TYPE_BLK == type));
+    /* Find a free inode */
+    ssize_t i;
+    for (i = 0; i < TMPFS_MAX_FILES; i++)
+    {
+        if (NULL == tfs->tfs_inodes[i])
+        {
+            tmpfs_inode_t *inode;
+            if (NULL == (inode = kmalloc(sizeof(tmpfs_inode_t))))
+            {
+                return -ENOSPC;
+            }
+            inode->tf_mobj = NULL;
+            inode->tf_mem = NULL;
+
+            if (TMPFS_TYPE_CHR == type || TMPFS_TYPE_BLK == type)
+            {
+                /* Don't need any space in memory, so put devid in here */
+                inode->tf_mem = (char *)(uint64_t)devid;
+            }
+            else if (TMPFS_TYPE_DIR == type)
+            {
+                if (NULL == (inode->tf_mem = page_alloc()))
+                {
+                    kfree(inode);
+                    return -ENOSPC;
+                }
+                memset(inode->tf_mem, 0, PAGE_SIZE);
+            }
+            else
+            {
+                /* Data pages materialize lazily on the first write to
+                 * each page; until then the object is all hole. */
+                inode->tf_mobj = anon_create();
+                if (NULL == inode->tf_mobj)
+                {
+                    kfree(inode);
+                    return -ENOSPC;
+                }
+                mobj_unlock(inode->tf_mobj);
+            }
+            inode->tf_size = 0;
+            inode->tf_ino = i;
+            inode->tf_mode = type;
+            inode->tf_linkcount = 1;
+
+            /* Install in table and return */
+            tfs->tfs_inodes[i] = inode;
+            return i;
+        }
+    }
+    return -ENOSPC;
+}
+
+/* Free whatever storage the inode type uses and the inode itself. */
+static void tmpfs_free_inode(tmpfs_inode_t *inode)
+{
+    if (TMPFS_TYPE_DATA == inode->tf_mode)
+    {
+        /* Dropping the last reference frees all resident frames. */
+        mobj_put(&inode->tf_mobj);
+    }
+    else if (TMPFS_TYPE_DIR == inode->tf_mode)
+    {
+        page_free(inode->tf_mem);
+    }
+    /* otherwise, inode->tf_mem is a devid */
+    kfree(inode);
+}
+
+/*
+ * Function implementations
+ */
+
+long tmpfs_mount(struct fs *fs)
+{
+    /* Allocate filesystem */
+    tmpfs_t *tfs = kmalloc(sizeof(tmpfs_t));
+    if (NULL == tfs)
+    {
+        return -ENOMEM;
+    }
+
+    memset(tfs->tfs_inodes, 0, sizeof(tfs->tfs_inodes));
+
+    fs->fs_i = tfs;
+    fs->fs_ops = &tmpfs_ops;
+
+    /* Set up root inode */
+    ssize_t root_ino;
+    if (0 > (root_ino = tmpfs_alloc_inode(fs, TMPFS_TYPE_DIR, 0)))
+    {
+        kfree(tfs);
+        return root_ino;
+    }
+
+    slab_allocator_t *allocator =
+        slab_allocator_create("tmpfs_node", sizeof(vnode_t));
+    fs->fs_vnode_allocator = allocator;
+    KASSERT(allocator);
+
+    KASSERT(0 == root_ino);
+    tmpfs_inode_t *root = tfs->tfs_inodes[root_ino];
+
+    /* Set up '.' and '..' in the root directory */
+    tmpfs_dirent_t *rootdent = (tmpfs_dirent_t *)root->tf_mem;
+    rootdent->td_ino = 0;
+    strcpy(rootdent->td_name, ".");
+    rootdent++;
+    rootdent->td_ino = 0;
+    strcpy(rootdent->td_name, "..");
+
+    /* Increase root inode size accordingly */
+    root->tf_size = 2 * sizeof(tmpfs_dirent_t);
+
+    /* And vget the root vnode */
+    fs->fs_root = vget(fs, 0);
+
+    return 0;
+}
+
+static void tmpfs_read_vnode(fs_t *fs, vnode_t *vn)
+{
+    tmpfs_t *tfs = VNODE_TO_TMPFS(vn);
+    tmpfs_inode_t *inode = tfs->tfs_inodes[vn->vn_vno];
+    KASSERT(inode && inode->tf_ino == vn->vn_vno);
+
+    inode->tf_linkcount++;
+
+    vn->vn_i = inode;
+    vn->vn_len = inode->tf_size;
+
+    switch (inode->tf_mode)
+    {
+    case TMPFS_TYPE_DATA:
+        vn->vn_mode = S_IFREG;
+        vn->vn_ops = &tmpfs_file_vops;
+        break;
+    case TMPFS_TYPE_DIR:
+        vn->vn_mode = S_IFDIR;
+        vn->vn_ops = &tmpfs_dir_vops;
+        break;
+    case TMPFS_TYPE_CHR:
+        vn->vn_mode = S_IFCHR;
+        vn->vn_ops = NULL;
+        vn->vn_devid = (devid_t)(uint64_t)(inode->tf_mem);
+        break;
+    case TMPFS_TYPE_BLK:
+        vn->vn_mode = S_IFBLK;
+        vn->vn_ops = NULL;
+        vn->vn_devid = (devid_t)(uint64_t)(inode->tf_mem);
+        break;
+    default:
+        panic("inode %ld has unknown/invalid type %ld!!\n",
+              (ssize_t)vn->vn_vno, (ssize_t)inode->tf_mode);
+    }
+}
+
+static void tmpfs_delete_vnode(fs_t *fs, vnode_t *vn)
+{
+    tmpfs_inode_t *inode = VNODE_TO_TMPFSINODE(vn);
+    tmpfs_t *tfs = VNODE_TO_TMPFS(vn);
+
+    if (0 == --inode->tf_linkcount)
+    {
+        KASSERT(tfs->tfs_inodes[vn->vn_vno] == inode);
+
+        tfs->tfs_inodes[vn->vn_vno] = NULL;
+        tmpfs_free_inode(inode);
+    }
+}
+
+static ssize_t tmpfs_umount(fs_t *fs)
+{
+    /* Everything is in memory; just release it all. */
+    tmpfs_t *tfs = (tmpfs_t *)fs->fs_i;
+
+    vput(&fs->fs_root);
+
+    /* Free all the inodes */
+    ssize_t i;
+    for (i = 0; i < TMPFS_MAX_FILES; i++)
+    {
+        if (NULL != tfs->tfs_inodes[i])
+        {
+            tmpfs_free_inode(tfs->tfs_inodes[i]);
+        }
+    }
+
+    kfree(tfs);
+    return 0;
+}
+
+static ssize_t tmpfs_mknod(struct vnode *dir, const char *name,
+                           size_t name_len, int mode, devid_t devid,
+                           struct vnode **out)
+{
+    size_t i;
+    tmpfs_dirent_t *entry;
+
+    /* Look for space in the directory */
+    entry = VNODE_TO_DIRENT(dir);
+    for (i = 0; i < TMPFS_MAX_DIRENT; i++, entry++)
+    {
+        if (!entry->td_name[0])
+        {
+            break;
+        }
+    }
+
+    if (i == TMPFS_MAX_DIRENT)
+    {
+        return -ENOSPC;
+    }
+
+    ssize_t ino;
+    if (S_ISCHR(mode))
+    {
+        ino = tmpfs_alloc_inode(dir->vn_fs, TMPFS_TYPE_CHR, devid);
+    }
+    else if (S_ISBLK(mode))
+    {
+        ino = tmpfs_alloc_inode(dir->vn_fs, TMPFS_TYPE_BLK, devid);
+    }
+    else if (S_ISREG(mode))
+    {
+        ino = tmpfs_alloc_inode(dir->vn_fs, TMPFS_TYPE_DATA, devid);
+    }
+    else if (S_ISLNK(mode))
+    {
+        /* symlinks are only supported on s5fs */
+        return -ENOTSUP;
+    }
+    else
+    {
+        panic("Invalid mode!\n");
+    }
+
+    if (ino < 0)
+    {
+        return ino;
+    }
+
+    /* Set entry in directory */
+    entry->td_ino = ino;
+    strncpy(entry->td_name, name, MIN(name_len, NAME_LEN - 1));
+    entry->td_name[MIN(name_len, NAME_LEN - 1)] = '\0';
+
+    VNODE_TO_TMPFSINODE(dir)->tf_size += sizeof(tmpfs_dirent_t);
+
+    vnode_t *child = vget(dir->vn_fs, ino);
+
+    dbg(DBG_VFS, "creating ino(%ld), vno(%d) with path: %s\n", ino,
+        child->vn_vno, entry->td_name);
+
+    KASSERT(child);
+    *out = child;
+    return 0;
+}
+
+static ssize_t tmpfs_lookup(vnode_t *dir, const char *name, size_t namelen,
+                            vnode_t **out)
+{
+    size_t i;
+    tmpfs_inode_t *inode = VNODE_TO_TMPFSINODE(dir);
+    tmpfs_dirent_t *entry = (tmpfs_dirent_t *)inode->tf_mem;
+
+    for (i = 0; i < TMPFS_MAX_DIRENT; i++, entry++)
+    {
+        if (name_match(entry->td_name, name, namelen))
+        {
+            if (dir->vn_vno != entry->td_ino)
+            {
+                fs_t *fs = (dir)->vn_fs;
+                *out = vget(fs, entry->td_ino);
+            }
+            else
+            {
+                vref(dir);
+                *out = dir;
+            }
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+static ssize_t tmpfs_find_dirent(vnode_t *dir, const char *name,
+                                 size_t namelen)
+{
+    size_t i;
+    tmpfs_inode_t *inode = VNODE_TO_TMPFSINODE(dir);
+    tmpfs_dirent_t *entry = (tmpfs_dirent_t *)inode->tf_mem;
+
+    for (i = 0; i < TMPFS_MAX_DIRENT; i++, entry++)
+    {
+        if (name_match(entry->td_name, name, namelen))
+        {
+            return entry->td_ino;
+        }
+    }
+
+    return -ENOENT;
+}
+
+static ssize_t tmpfs_append_dirent(vnode_t *dir, const char *name,
+                                   size_t namelen, vnode_t *child)
+{
+    size_t i;
+    tmpfs_dirent_t *entry;
+
+    KASSERT(child->vn_fs == dir->vn_fs);
+
+    /* Look for space in the directory */
+    entry = VNODE_TO_DIRENT(dir);
+    for (i = 0; i < TMPFS_MAX_DIRENT; i++, entry++)
+    {
+        if (name_match(entry->td_name, name, namelen))
+        {
+            return -EEXIST;
+        }
+
+        if (!entry->td_name[0])
+        {
+            break;
+        }
+    }
+
+    if (i == TMPFS_MAX_DIRENT)
+    {
+        return -ENOSPC;
+    }
+
+    /* Set entry in parent */
+    entry->td_ino = child->vn_vno;
+    strncpy(entry->td_name, name, MIN(namelen, NAME_LEN - 1));
+    entry->td_name[MIN(namelen, NAME_LEN - 1)] = '\0';
+
+    VNODE_TO_TMPFSINODE(dir)->tf_size += sizeof(tmpfs_dirent_t);
+
+    /* Increase linkcount */
+    VNODE_TO_TMPFSINODE(child)->tf_linkcount++;
+
+    return 0;
+}
+
+static ssize_t tmpfs_delete_dirent(vnode_t *dir, const char *name,
+                                   size_t namelen, vnode_t *child)
+{
+    int found = 0;
+    size_t i;
+    tmpfs_dirent_t *entry = VNODE_TO_DIRENT(dir);
+    for (i = 0; i < TMPFS_MAX_DIRENT; i++, entry++)
+    {
+        if (name_match(entry->td_name, name, namelen))
+        {
+            found = 1;
+            entry->td_name[0] = '\0';
+            break;
+        }
+    }
+
+    if (!found)
+    {
+        return -EEXIST;
+    }
+
+    VNODE_TO_TMPFSINODE(dir)->tf_size -= sizeof(tmpfs_dirent_t);
+    VNODE_TO_TMPFSINODE(child)->tf_linkcount--;
+
+    return 0;
+}
+
+static long tmpfs_link(vnode_t *dir, const char *name, size_t namelen,
+                       vnode_t *child)
+{
+    return tmpfs_append_dirent(dir, name, namelen, child);
+}
+
+static ssize_t tmpfs_unlink(vnode_t *dir, const char *name, size_t namelen)
+{
+    ssize_t ret;
+
+    long ino = tmpfs_find_dirent(dir, name, namelen);
+    if (ino < 0)
+    {
+        return ino;
+    }
+
+    vnode_t *child = vget_locked(dir->vn_fs, (ino_t)ino);
+    KASSERT(!S_ISDIR(child->vn_mode) && "handled at VFS level");
+
+    ret = tmpfs_delete_dirent(dir, name, namelen, child);
+    KASSERT(ret == 0);
+
+    vput_locked(&child);
+
+    return 0;
+}
+
+static ssize_t tmpfs_rename(vnode_t *olddir, const char *oldname,
+                            size_t oldnamelen, vnode_t *newdir,
+                            const char *newname, size_t newnamelen)
+{
+    long ino = tmpfs_find_dirent(olddir, oldname, oldnamelen);
+    if (ino < 0)
+    {
+        return ino;
+    }
+
+    vnode_t *oldvn = vget_locked(olddir->vn_fs, (ino_t)ino);
+    if (S_ISDIR(oldvn->vn_mode))
+    {
+        vput_locked(&oldvn);
+        return -EPERM;
+    }
+
+    /* Determine if an entry corresponding to `newname` already exists */
+    ino = tmpfs_find_dirent(newdir, newname, newnamelen);
+    if (ino != -ENOENT)
+    {
+        vput_locked(&oldvn);
+        if (ino < 0)
+        {
+            return ino;
+        }
+        return -EEXIST;
+    }
+
+    ssize_t ret = tmpfs_append_dirent(newdir, newname, newnamelen, oldvn);
+    if (ret < 0)
+    {
+        vput_locked(&oldvn);
+        return ret;
+    }
+
+    ret = tmpfs_delete_dirent(olddir, oldname, oldnamelen, oldvn);
+    vput_locked(&oldvn);
+
+    return ret;
+}
+
+static ssize_t tmpfs_mkdir(vnode_t *dir, const char *name, size_t name_len,
+                           struct vnode **out)
+{
+    size_t i;
+    tmpfs_dirent_t *entry;
+
+    /* Look for space in the directory */
+    entry = VNODE_TO_DIRENT(dir);
+    for (i = 0; i < TMPFS_MAX_DIRENT; i++, entry++)
+    {
+        if (!entry->td_name[0])
+        {
+            break;
+        }
+    }
+
+    if (i == TMPFS_MAX_DIRENT)
+    {
+        return -ENOSPC;
+    }
+
+    /* Allocate an inode */
+    ssize_t ino;
+    if (0 > (ino = tmpfs_alloc_inode(dir->vn_fs, TMPFS_TYPE_DIR, 0)))
+    {
+        return ino;
+    }
+
+    /* Set entry in parent */
+    entry->td_ino = ino;
+    strncpy(entry->td_name, name, MIN(name_len, NAME_LEN - 1));
+    entry->td_name[MIN(name_len, NAME_LEN - 1)] = '\0';
+
+    VNODE_TO_TMPFSINODE(dir)->tf_size += sizeof(tmpfs_dirent_t);
+
+    /* Set up '.' and '..' in the directory */
+    entry = (tmpfs_dirent_t *)VNODE_TO_TMPFS(dir)->tfs_inodes[ino]->tf_mem;
+    entry->td_ino = ino;
+    strcpy(entry->td_name, ".");
+    entry++;
+    entry->td_ino = dir->vn_vno;
+    strcpy(entry->td_name, "..");
+
+    /* Increase inode size accordingly */
+    VNODE_TO_TMPFS(dir)->tfs_inodes[ino]->tf_size =
+        2 * sizeof(tmpfs_dirent_t);
+
+    /* This probably can't fail... (unless OOM :/) */
+    *out = vget(dir->vn_fs, ino);
+
+    return 0;
+}
+
+static ssize_t tmpfs_rmdir(vnode_t *dir, const char *name, size_t name_len)
+{
+    size_t i;
+    tmpfs_dirent_t *entry;
+
+    KASSERT(!name_match(".", name, name_len) &&
+            !name_match("..", name, name_len));
+
+    long ino = tmpfs_find_dirent(dir, name, name_len);
+    if (ino < 0)
+    {
+        return ino;
+    }
+
+    vnode_t *child = vget_locked(dir->vn_fs, (ino_t)ino);
+    if (!S_ISDIR(child->vn_mode))
+    {
+        vput_locked(&child);
+        return -ENOTDIR;
+    }
+
+    /* We have to make sure that this directory is empty */
+    entry = VNODE_TO_DIRENT(child);
+    for (i = 0; i < TMPFS_MAX_DIRENT; i++, entry++)
+    {
+        if (!strcmp(entry->td_name, ".") || !strcmp(entry->td_name, ".."))
+        {
+            continue;
+        }
+
+        if (entry->td_name[0])
+        {
+            vput_locked(&child);
+            return -ENOTEMPTY;
+        }
+    }
+
+    /* Finally, remove the entry from the parent directory */
+    entry = VNODE_TO_DIRENT(dir);
+    for (i = 0; i < TMPFS_MAX_DIRENT; i++, entry++)
+    {
+        if (name_match(entry->td_name, name, name_len))
+        {
+            entry->td_name[0] = '\0';
+            break;
+        }
+    }
+    VNODE_TO_TMPFSINODE(dir)->tf_size -= sizeof(tmpfs_dirent_t);
+
+    VNODE_TO_TMPFSINODE(child)->tf_linkcount--;
+    vput_locked(&child);
+
+    return 0;
+}
+
+static ssize_t tmpfs_read(vnode_t *file, size_t offset, void *buf,
+                          size_t count)
+{
+    tmpfs_inode_t *inode = VNODE_TO_TMPFSINODE(file);
+    mobj_t *mo = inode->tf_mobj;
+    size_t bytes_read = 0;
+
+    KASSERT(!S_ISDIR(file->vn_mode));
+
+    if (offset >= inode->tf_size)
+    {
+        return 0;
+    }
+    count = MIN(count, inode->tf_size - offset);
+
+    while (bytes_read < count)
+    {
+        size_t pgoff = PAGE_OFFSET(offset);
+        size_t to_read = MIN(PAGE_SIZE - pgoff, count - bytes_read);
+        pframe_t *pf;
+
+        /* A read of a never-written page comes back as the shared zero
+         * frame (see anon_get_pframe), so holes are served without
+         * allocating memory. */
+        mobj_lock(mo);
+        long status = mobj_get_pframe(mo, offset / PAGE_SIZE, 0, &pf);
+        mobj_unlock(mo);
+        if (status < 0)
+        {
+            return bytes_read ? (ssize_t)bytes_read : status;
+        }
+
+        memcpy((char *)buf + bytes_read, (char *)pf->pf_addr + pgoff,
+               to_read);
+        pframe_release(&pf);
+
+        bytes_read += to_read;
+        offset += to_read;
+    }
+
+    return bytes_read;
+}
+
+static ssize_t tmpfs_write(vnode_t *file, size_t offset, const void *buf,
+                           size_t count)
+{
+    tmpfs_inode_t *inode = VNODE_TO_TMPFSINODE(file);
+    mobj_t *mo = inode->tf_mobj;
+    size_t bytes_written = 0;
+
+    KASSERT(!S_ISDIR(file->vn_mode));
+
+    while (bytes_written < count)
+    {
+        size_t pgoff = PAGE_OFFSET(offset);
+        size_t to_write = MIN(PAGE_SIZE - pgoff, count - bytes_written);
+        pframe_t *pf;
+        long status;
+
+        mobj_lock(mo);
+        if (to_write == PAGE_SIZE)
+        {
+            /* The entire page is about to be overwritten; skip zeroing
+             * it first. */
+            status = mobj_get_pframe_overwrite(mo, offset / PAGE_SIZE, &pf);
+        }
+        else
+        {
+            status = mobj_get_pframe(mo, offset / PAGE_SIZE, 1, &pf);
+        }
+        mobj_unlock(mo);
+        if (status < 0)
+        {
+            if (bytes_written)
+            {
+                break;
+            }
+            return status;
+        }
+
+        memcpy((char *)pf->pf_addr + pgoff, (const char *)buf + bytes_written,
+               to_write);
+        pframe_release(&pf);
+
+        bytes_written += to_write;
+        offset += to_write;
+    }
+
+    file->vn_len = MAX(file->vn_len, offset);
+    inode->tf_size = file->vn_len;
+
+    return bytes_written;
+}
+
+/*
+ * Hand out the file's anonymous object itself, so mapped pages and
+ * read/write share the same frames.
+ */
+static long tmpfs_mmap(vnode_t *file, struct mobj **ret)
+{
+    tmpfs_inode_t *inode = VNODE_TO_TMPFSINODE(file);
+    mobj_ref(inode->tf_mobj);
+    *ret = inode->tf_mobj;
+    return 0;
+}
+
+static ssize_t tmpfs_readdir(vnode_t *dir, size_t offset, struct dirent *d)
+{
+    ssize_t ret = 0;
+    tmpfs_dirent_t *dir_entry, *targ_entry;
+
+    KASSERT(S_ISDIR(dir->vn_mode));
+    KASSERT(0 == offset % sizeof(tmpfs_dirent_t));
+
+    dir_entry = VNODE_TO_DIRENT(dir);
+    dir_entry = (tmpfs_dirent_t *)(((char *)dir_entry) + offset);
+    targ_entry = dir_entry;
+
+    while ((offset < (size_t)(TMPFS_MAX_DIRENT * sizeof(tmpfs_dirent_t))) &&
+           (!targ_entry->td_name[0]))
+    {
+        ++targ_entry;
+        offset += sizeof(tmpfs_dirent_t);
+    }
+
+    if (offset >= (size_t)(TMPFS_MAX_DIRENT * sizeof(tmpfs_dirent_t)))
+    {
+        return 0;
+    }
+
+    ret = sizeof(tmpfs_dirent_t) +
+          (targ_entry - dir_entry) * sizeof(tmpfs_dirent_t);
+
+    d->d_ino = targ_entry->td_ino;
+    d->d_off = 0; /* unused */
+    strncpy(d->d_name, targ_entry->td_name, NAME_LEN - 1);
+    d->d_name[NAME_LEN - 1] = '\0';
+    return ret;
+}
+
+static ssize_t tmpfs_stat(vnode_t *file, stat_t *buf)
+{
+    tmpfs_inode_t *i = VNODE_TO_TMPFSINODE(file);
+    memset(buf, 0, sizeof(stat_t));
+    buf->st_mode = file->vn_mode;
+    buf->st_ino = (ssize_t)file->vn_vno;
+    buf->st_dev = 0;
+    if (file->vn_mode == S_IFCHR || file->vn_mode == S_IFBLK)
+    {
+        buf->st_rdev = (ssize_t)i->tf_mem;
+    }
+    buf->st_nlink = i->tf_linkcount - 1;
+    buf->st_size = (ssize_t)i->tf_size;
+    buf->st_blksize = (ssize_t)PAGE_SIZE;
+    /* Resident pages, not the nominal size: holes occupy nothing. */
+    buf->st_blocks =
+        (ssize_t)(i->tf_mobj ? i->tf_mobj->mo_resident : 1);
+
+    return 0;
+}
+
+static void tmpfs_truncate_file(vnode_t *file)
+{
+    KASSERT(S_ISREG(file->vn_mode) &&
+            "This routine should only be called for regular files");
+    tmpfs_inode_t *inode = VNODE_TO_TMPFSINODE(file);
+    mobj_t *mo = inode->tf_mobj;
+
+    /* Return every resident frame to the system rather than zeroing it;
+     * the next write repopulates the object page by page. */
+    mobj_lock(mo);
+    list_iterate(&mo->mo_pframes, pf, pframe_t, pf_link)
+    {
+        kmutex_lock(&pf->pf_mutex);
+        if (mobj_free_pframe(mo, &pf))
+        {
+            pframe_release(&pf);
+        }
+    }
+    mobj_unlock(mo);
+
+    inode->tf_size = 0;
+    file->vn_len = 0;
+}
@@ -5,12 +5,16 @@
 #include <fs/s5fs/s5fs.h>
 #include <fs/vnode.h>
 
+#include "fs/dcache.h"
 #include "fs/file.h"
 #include "fs/ramfs/ramfs.h"
+#include "fs/tmpfs/tmpfs.h"
+#include "fs/stat.h"
 
 #include "mm/kmalloc.h"
 #include "mm/slab.h"
 #include "util/debug.h"
+#include "util/printf.h"
 
 #ifdef __S5FS__
 #include "fs/s5fs/s5fs.h"
@@ -21,48 +25,86 @@
 list_t mounted_fs_list;
 
 /*
- * Implementing this function is not required and strongly discouraged unless
- * you are absolutley sure your Weenix is perfect.
- *
- * The purpose of this function is to set up the pointers between the file
- * system struct and the vnode of the mount point. Remember to watch your
- * reference counts. (The exception here is when the vnode's vn_mount field
- * points to the mounted file system's root we do not increment the reference
- * count on the file system's root vnode. The file system is already keeping
- * a reference to the vnode which will not go away until the file system is
- * unmounted. If we kept a second such reference it would conflict with the
- * behavior of vfs_is_in_use(), make sure you understand why.)
- *
- * Once everything is set up add the file system to the list of mounted file
+ * Set up the pointers between the file system struct and the vnode of the
+ * mount point, and add the file system to the list of mounted file
  * systems.
  *
- * Remember proper error handling.
+ * The mount point keeps a reference for as long as the mount lasts, but
+ * the vnode's vn_mount field pointing at the mounted file system's root
+ * does NOT hold a reference: the file system already keeps one through
+ * fs_root, which only goes away at unmount. A second reference there
+ * would make vfs_is_in_use() report an idle mounted fs as busy.
  *
  * This function is not meant to mount the root file system.
  */
 int vfs_mount(struct vnode *mtpt, fs_t *fs)
 {
-    NOT_YET_IMPLEMENTED("MOUNTING: vfs_mount");
-    return -EINVAL;
+    if (!mtpt || !fs)
+    {
+        return -EINVAL;
+    }
+    if (!S_ISDIR(mtpt->vn_mode))
+    {
+        return -ENOTDIR;
+    }
+    if (mtpt->vn_mount != mtpt)
+    {
+        /* something is already mounted here */
+        return -EBUSY;
+    }
+    if (mtpt == mtpt->vn_fs->fs_root && mtpt->vn_fs != &vfs_root_fs)
+    {
+        /* stacking a mount on another mount's root is not supported */
+        return -EBUSY;
+    }
+    vref(mtpt);
+    fs->fs_mtpt = mtpt;
+    mtpt->vn_mount = fs->fs_root;
+    list_insert_tail(&mounted_fs_list, &fs->fs_link);
+    /* Any full path crossing the mount point now resolves differently. */
+    dcache_path_invalidate();
+    return 0;
 }
 
 /*
- * Implementing this function is not required and strongly discouraged unless
- * you are absolutley sure your Weenix is perfect.
- *
- * The purpose of this function is to undo the setup done in vfs_mount(). Also
- * you should call the underlying file system's umount() function. Make sure
- * to keep track of reference counts. You should also kfree the fs struct at
- * the end of this method.
- *
- * Remember proper error handling. You might want to make sure that you do not
- * try to call this function on the root file system (this function is not meant
- * to unmount the root file system).
+ * Undo the setup done in vfs_mount(), call the underlying file system's
+ * umount() function, and free the fs struct. Fails with -EBUSY while the
+ * file system still has vnodes in use. Not meant for the root file
+ * system.
  */
 int vfs_umount(fs_t *fs)
 {
-    NOT_YET_IMPLEMENTED("MOUNTING: vfs_unmount");
-    return -EINVAL;
+    if (!fs || fs == &vfs_root_fs)
+    {
+        return -EINVAL;
+    }
+    if (vfs_is_in_use(fs))
+    {
+        return -EBUSY;
+    }
+    list_remove(&fs->fs_link);
+    vnode_t *mtpt = fs->fs_mtpt;
+    mtpt->vn_mount = mtpt;
+    /* Full-path entries may point into the departing file system; age
+     * them all out before its fs struct goes away. */
+    dcache_path_invalidate();
+
+    long ret = 0;
+    if (fs->fs_ops->umount)
+    {
+        ret = fs->fs_ops->umount(fs);
+    }
+    else
+    {
+        vput(&fs->fs_root);
+    }
+    if (fs->fs_vnode_allocator)
+    {
+        slab_allocator_destroy(fs->fs_vnode_allocator);
+    }
+    vput(&mtpt);
+    kfree(fs);
+    return ret;
 }
 #endif /* __MOUNTING__ */
 
@@ -70,7 +112,6 @@ fs_t vfs_root_fs = {
     .fs_dev = VFS_ROOTFS_DEV,
     .fs_type = VFS_ROOTFS_TYPE,
     .vnode_list = LIST_INITIALIZER(vfs_root_fs.vnode_list),
-    .vnode_list_mutex = KMUTEX_INITIALIZER(vfs_root_fs.vnode_list_mutex),
     .fs_vnode_allocator = NULL,
     .fs_i = NULL,
     .fs_ops = NULL,
@@ -82,6 +123,9 @@ fs_t vfs_root_fs = {
  */
 void vfs_init()
 {
+    dcache_init();
+    vnode_fs_init(&vfs_root_fs);
+
     long err = mountfunc(&vfs_root_fs);
     if (err)
     {
@@ -95,9 +139,15 @@ void vfs_init()
     vref(curproc->p_cwd = vfs_root_fs.fs_root);
     vunlock(vfs_root_fs.fs_root);
 
+    /* Every absolute path resolution locks the root directory first, so
+     * a holder preempted mid-lookup stalls lookups system-wide; let its
+     * holders finish their critical sections (see kmutex_mark_hot). */
+    kmutex_mark_hot(&vfs_root_fs.fs_root->vn_mobj.mo_mutex);
+
 #ifdef __MOUNTING__
     list_init(&mounted_fs_list);
-    fs->fs_mtpt = vfs_root_fs.fs_root;
+    vfs_root_fs.fs_mtpt = vfs_root_fs.fs_root;
+    list_link_init(&vfs_root_fs.fs_link);
 #endif
 }
 
@@ -108,7 +158,10 @@ void do_sync()
 {
     vfs_root_fs.fs_ops->sync(&vfs_root_fs);
 #ifdef __MOUNTING__
-    // if implementing mounting, just sync() all the mounted FS's as well
+    list_iterate(&mounted_fs_list, mtfs, fs_t, fs_link)
+    {
+        mtfs->fs_ops->sync(mtfs);
+    }
 #endif
 }
 
@@ -164,6 +217,7 @@ long mountfunc(fs_t *fs)
         {"s5fs", s5fs_mount},
 #endif
         {"ramfs", ramfs_mount},
+        {"tmpfs", tmpfs_mount},
     };
 
     for (unsigned int i = 0; i < sizeof(types) / sizeof(types[0]); i++)
@@ -187,7 +241,7 @@ long mountfunc(fs_t *fs)
 long vfs_is_in_use(fs_t *fs)
 {
     long ret = 0;
-    // kmutex_lock(&fs->vnode_list_mutex);
+    // krwlock_read_lock(&fs->vnode_list_lock);
     list_iterate(&fs->vnode_list, vn, vnode_t, vn_link)
     {
         vlock(vn);
@@ -205,7 +259,7 @@ long vfs_is_in_use(fs_t *fs)
             // break;
         }
     }
-    // kmutex_unlock(&fs->vnode_list_mutex);
+    // krwlock_read_unlock(&fs->vnode_list_lock);
     return ret;
 }
 
@@ -215,8 +269,47 @@ long vfs_is_in_use(fs_t *fs)
 size_t vfs_count_active_vnodes(fs_t *fs)
 {
     size_t count = 0;
-    kmutex_lock(&fs->vnode_list_mutex);
+    krwlock_read_lock(&fs->vnode_list_lock);
     list_iterate(&fs->vnode_list, vn, vnode_t, vn_link) { count++; }
-    kmutex_unlock(&fs->vnode_list_mutex);
+    krwlock_read_unlock(&fs->vnode_list_lock);
     return count;
 }
+
+/* One line of per-mount cache accounting: the device and type, the number
+ * of in-core vnodes, and the resident page count across their memory
+ * objects. */
+static size_t vfs_fs_info(fs_t *fs, char *buf, size_t size, size_t off)
+{
+    size_t vnodes = 0;
+    size_t resident = 0;
+    krwlock_read_lock(&fs->vnode_list_lock);
+    list_iterate(&fs->vnode_list, vn, vnode_t, vn_link)
+    {
+        vnodes++;
+        resident += vn->vn_mobj.mo_resident;
+    }
+    krwlock_read_unlock(&fs->vnode_list_lock);
+    if (off >= size)
+    {
+        return off;
+    }
+    return off + snprintf(buf + off, size - off,
+                          "%s %s vnodes %lu resident %lu\n", fs->fs_dev,
+                          fs->fs_type, vnodes, resident);
+}
+
+/*
+ * Formats one line per mounted file system, root first, so cache pressure
+ * can be attributed to a specific mount.
+ */
+size_t vfs_mount_info(char *buf, size_t size)
+{
+    size_t off = vfs_fs_info(&vfs_root_fs, buf, size, 0);
+#ifdef __MOUNTING__
+    list_iterate(&mounted_fs_list, mtfs, fs_t, fs_link)
+    {
+        off = vfs_fs_info(mtfs, buf, size, off);
+    }
+#endif
+    return MIN(off, size);
+}
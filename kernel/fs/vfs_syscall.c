@@ -1,14 +1,22 @@
 #include "fs/vfs_syscall.h"
+#include "config.h"
 #include "errno.h"
+#include "fs/dcache.h"
 #include "fs/fcntl.h"
 #include "fs/file.h"
 #include "fs/lseek.h"
+#include "fs/poll.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 #include "globals.h"
 #include "kernel.h"
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/slab.h"
+#include "proc/sched.h"
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/time.h"
 #include <limits.h>
 
 /*
@@ -34,17 +42,38 @@ ssize_t do_read(int fd, void *buf, size_t len)
         return -EBADF;
     }
     vnode_t *node = file->f_vnode;
-    vlock(node);
     if (S_ISDIR(node->vn_mode)) {
-        vunlock(node);
         return -EISDIR;
     }
     if (!(FMODE_READ & file->f_mode)) {
-        vunlock(node);
         return -EBADF;
     }
-    ssize_t num_read = node->vn_ops->read(node, file->f_pos, buf, len);
-    vunlock(node);
+    ssize_t num_read;
+    if (S_ISREG(node->vn_mode)) {
+        /* Regular files lock just the byte range being read, so
+         * non-overlapping I/O to the same file proceeds concurrently;
+         * the filesystem takes the vnode mutex per block underneath. */
+        vnode_range_t range;
+        vnode_range_lock(node, &range, file->f_pos, file->f_pos + len, 0);
+        if ((FMODE_DIRECT & file->f_mode) && node->vn_ops->read_direct) {
+            num_read = node->vn_ops->read_direct(node, file->f_pos, buf, len);
+        } else {
+            num_read = node->vn_ops->read(node, file->f_pos, buf, len);
+        }
+        vnode_range_unlock(node, &range);
+    } else {
+        vlock(node);
+        /* Non-blocking streams (pipes, ttys) advertise readiness via the
+         * poll op; if a read would block, fail instead of parking the
+         * thread. POLLHUP counts as ready: the read returns 0 at once. */
+        if ((FMODE_NONBLOCK & file->f_mode) && node->vn_ops->poll &&
+            !node->vn_ops->poll(node, file, POLLIN)) {
+            vunlock(node);
+            return -EAGAIN;
+        }
+        num_read = node->vn_ops->read(node, file->f_pos, buf, len);
+        vunlock(node);
+    }
     if (num_read < 0) {
         return num_read;
     }
@@ -79,20 +108,490 @@ ssize_t do_write(int fd, const void *buf, size_t len)
         return -EBADF;
     }
     vnode_t *node = file->f_vnode;
-    vlock(node);
-    if (FMODE_APPEND & file->f_mode) {
-        file->f_pos = node->vn_len;
+    ssize_t num_written;
+    if (S_ISREG(node->vn_mode)) {
+        vnode_range_t range;
+        if (FMODE_APPEND & file->f_mode) {
+            /* An append's range starts at the end of the file, but a
+             * conflicting appender may have grown the file while we
+             * waited; retry at the new end so appends never overlap. */
+            file->f_pos = node->vn_len;
+            vnode_range_lock(node, &range, file->f_pos, file->f_pos + len, 1);
+            while (file->f_pos != node->vn_len) {
+                vnode_range_unlock(node, &range);
+                file->f_pos = node->vn_len;
+                vnode_range_lock(node, &range, file->f_pos, file->f_pos + len,
+                                 1);
+            }
+        } else {
+            vnode_range_lock(node, &range, file->f_pos, file->f_pos + len, 1);
+        }
+        if ((FMODE_DIRECT & file->f_mode) && node->vn_ops->write_direct) {
+            num_written =
+                node->vn_ops->write_direct(node, file->f_pos, buf, len);
+        } else {
+            num_written = node->vn_ops->write(node, file->f_pos, buf, len);
+        }
+        vnode_range_unlock(node, &range);
+    } else {
+        vlock(node);
+        /* See do_read; POLLERR counts as ready (the write fails at once,
+         * e.g. with EPIPE on a pipe with no readers). */
+        if ((FMODE_NONBLOCK & file->f_mode) && node->vn_ops->poll &&
+            !node->vn_ops->poll(node, file, POLLOUT)) {
+            vunlock(node);
+            return -EAGAIN;
+        }
+        if (FMODE_APPEND & file->f_mode) {
+            file->f_pos = node->vn_len;
+        }
+        num_written = node->vn_ops->write(node, file->f_pos, buf, len);
+        vunlock(node);
     }
-    ssize_t num_written = node->vn_ops->write(node, file->f_pos, buf, len);
     if (num_written < 0) {
-        vunlock(node);
         return num_written;
     }
     file->f_pos = file->f_pos + num_written;
-    vunlock(node);
     return num_written;
 }
 
+/*
+ * Read into each buffer of iov in turn, as do_read would, but locking the
+ * fd's file (the byte range for regular files, the vnode otherwise) once
+ * for the whole vector rather than once per buffer.
+ * Stops early at a short read (end of file).
+ *
+ * Return the total number of bytes read on success, or:
+ *  - EBADF: fd is invalid or is not open for reading
+ *  - EISDIR: fd refers to a directory
+ *  - Propagate errors from the vnode operation read, unless some bytes have
+ *    already been read, in which case return the partial total
+ */
+ssize_t do_readv(int fd, const iovec_t *iov, size_t iovcnt)
+{
+    if (fd >= NFILES || fd < 0) {
+        return -EBADF;
+    }
+    file_t* file = curproc->p_files[fd];
+    if (!file) {
+        return -EBADF;
+    }
+    vnode_t *node = file->f_vnode;
+    if (S_ISDIR(node->vn_mode)) {
+        return -EISDIR;
+    }
+    if (!(FMODE_READ & file->f_mode)) {
+        return -EBADF;
+    }
+    size_t total_len = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        total_len += iov[i].iov_len;
+    }
+    vnode_range_t range;
+    long ranged = S_ISREG(node->vn_mode);
+    if (ranged) {
+        vnode_range_lock(node, &range, file->f_pos, file->f_pos + total_len,
+                         0);
+    } else {
+        vlock(node);
+    }
+    ssize_t total = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        ssize_t num_read = node->vn_ops->read(node, file->f_pos + total, iov[i].iov_base, iov[i].iov_len);
+        if (num_read < 0) {
+            if (ranged) {
+                vnode_range_unlock(node, &range);
+            } else {
+                vunlock(node);
+            }
+            return total ? total : num_read;
+        }
+        total += num_read;
+        if ((size_t)num_read < iov[i].iov_len) {
+            break;
+        }
+    }
+    if (ranged) {
+        vnode_range_unlock(node, &range);
+    } else {
+        vunlock(node);
+    }
+    file->f_pos = file->f_pos + total;
+    return total;
+}
+
+/*
+ * Write each buffer of iov in turn, as do_write would, but locking the
+ * fd's file (the byte range for regular files, the vnode otherwise) once
+ * for the whole vector, so the segments land contiguously even with
+ * concurrent writers.
+ *
+ * Return the total number of bytes written on success, or:
+ *  - EBADF: fd is invalid or is not open for writing
+ *  - Propagate errors from the vnode operation write, unless some bytes have
+ *    already been written, in which case return the partial total
+ */
+ssize_t do_writev(int fd, const iovec_t *iov, size_t iovcnt)
+{
+    if (fd >= NFILES || fd < 0) {
+        return -EBADF;
+    }
+    file_t* file = curproc->p_files[fd];
+    if (!file) {
+        return -EBADF;
+    }
+    if (!(FMODE_WRITE & file->f_mode)) {
+        return -EBADF;
+    }
+    vnode_t *node = file->f_vnode;
+    size_t total_len = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        total_len += iov[i].iov_len;
+    }
+    vnode_range_t range;
+    long ranged = S_ISREG(node->vn_mode);
+    if (ranged) {
+        if (FMODE_APPEND & file->f_mode) {
+            /* See do_write: retry until the locked range still starts at
+             * the end of the file. */
+            file->f_pos = node->vn_len;
+            vnode_range_lock(node, &range, file->f_pos,
+                             file->f_pos + total_len, 1);
+            while (file->f_pos != node->vn_len) {
+                vnode_range_unlock(node, &range);
+                file->f_pos = node->vn_len;
+                vnode_range_lock(node, &range, file->f_pos,
+                                 file->f_pos + total_len, 1);
+            }
+        } else {
+            vnode_range_lock(node, &range, file->f_pos,
+                             file->f_pos + total_len, 1);
+        }
+    } else {
+        vlock(node);
+        if (FMODE_APPEND & file->f_mode) {
+            file->f_pos = node->vn_len;
+        }
+    }
+    ssize_t total = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        ssize_t num_written = node->vn_ops->write(node, file->f_pos + total, iov[i].iov_base, iov[i].iov_len);
+        if (num_written < 0) {
+            if (ranged) {
+                vnode_range_unlock(node, &range);
+            } else {
+                vunlock(node);
+            }
+            if (total) {
+                file->f_pos = file->f_pos + total;
+                return total;
+            }
+            return num_written;
+        }
+        total += num_written;
+        if ((size_t)num_written < iov[i].iov_len) {
+            break;
+        }
+    }
+    file->f_pos = file->f_pos + total;
+    if (ranged) {
+        vnode_range_unlock(node, &range);
+    } else {
+        vunlock(node);
+    }
+    return total;
+}
+
+/*
+ * Read len bytes into buf from the given offset of the fd's file, as do_read
+ * would, but without consulting or updating the file's position. Because
+ * f_pos is never touched, concurrent readers sharing one file description
+ * do not serialize on the file object.
+ *
+ * Return the number of bytes read on success, or:
+ *  - EBADF: fd is invalid or is not open for reading
+ *  - EISDIR: fd refers to a directory
+ *  - EINVAL: offset is negative
+ *  - Propagate errors from the vnode operation read
+ */
+ssize_t do_pread(int fd, void *buf, size_t len, off_t offset)
+{
+    if (fd >= NFILES || fd < 0) {
+        return -EBADF;
+    }
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    file_t* file = curproc->p_files[fd];
+    if (!file) {
+        return -EBADF;
+    }
+    vnode_t *node = file->f_vnode;
+    if (S_ISDIR(node->vn_mode)) {
+        return -EISDIR;
+    }
+    if (!(FMODE_READ & file->f_mode)) {
+        return -EBADF;
+    }
+    ssize_t num_read;
+    if (S_ISREG(node->vn_mode)) {
+        vnode_range_t range;
+        vnode_range_lock(node, &range, offset, offset + len, 0);
+        if ((FMODE_DIRECT & file->f_mode) && node->vn_ops->read_direct) {
+            num_read = node->vn_ops->read_direct(node, offset, buf, len);
+        } else {
+            num_read = node->vn_ops->read(node, offset, buf, len);
+        }
+        vnode_range_unlock(node, &range);
+    } else {
+        vlock(node);
+        num_read = node->vn_ops->read(node, offset, buf, len);
+        vunlock(node);
+    }
+    return num_read;
+}
+
+/*
+ * Write len bytes from buf at the given offset of the fd's file, as do_write
+ * would, but without consulting or updating the file's position. The offset
+ * is honored even if the file was opened with O_APPEND.
+ *
+ * Return the number of bytes written on success, or:
+ *  - EBADF: fd is invalid or is not open for writing
+ *  - EINVAL: offset is negative
+ *  - Propagate errors from the vnode operation write
+ */
+ssize_t do_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+    if (fd >= NFILES || fd < 0) {
+        return -EBADF;
+    }
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    file_t* file = curproc->p_files[fd];
+    if (!file) {
+        return -EBADF;
+    }
+    if (!(FMODE_WRITE & file->f_mode)) {
+        return -EBADF;
+    }
+    vnode_t *node = file->f_vnode;
+    ssize_t num_written;
+    if (S_ISREG(node->vn_mode)) {
+        vnode_range_t range;
+        vnode_range_lock(node, &range, offset, offset + len, 1);
+        if ((FMODE_DIRECT & file->f_mode) && node->vn_ops->write_direct) {
+            num_written = node->vn_ops->write_direct(node, offset, buf, len);
+        } else {
+            num_written = node->vn_ops->write(node, offset, buf, len);
+        }
+        vnode_range_unlock(node, &range);
+    } else {
+        vlock(node);
+        num_written = node->vn_ops->write(node, offset, buf, len);
+        vunlock(node);
+    }
+    return num_written;
+}
+
+/*
+ * Flush the fd's file to its backing store using the file's vnode operation
+ * fsync, so that the file's own dirty pages (and, unless datasync is set,
+ * its metadata) are durable when this returns. Unlike do_sync, the I/O is
+ * proportional to this file's dirty pages, not the whole cache.
+ *
+ * Return 0 on success, or:
+ *  - EBADF: fd is invalid or not open
+ *  - Propagate errors from the vnode operation fsync
+ *
+ * Vnodes without an fsync operation (pipes, devices, filesystems with no
+ * backing store) have nothing to make durable, so return 0 for them.
+ */
+static long _do_fsync(int fd, long datasync)
+{
+    if (fd >= NFILES || fd < 0) {
+        return -EBADF;
+    }
+    file_t* file = curproc->p_files[fd];
+    if (!file) {
+        return -EBADF;
+    }
+    vnode_t *node = file->f_vnode;
+    if (!node->vn_ops || !node->vn_ops->fsync) {
+        return 0;
+    }
+    vlock(node);
+    long status = node->vn_ops->fsync(node, datasync);
+    vunlock(node);
+    return status;
+}
+
+long do_fsync(int fd) { return _do_fsync(fd, 0); }
+
+long do_fdatasync(int fd) { return _do_fsync(fd, 1); }
+
+/*
+ * Record an access-pattern hint (one of fcntl.h's FADV_ values) for the
+ * fd's file and forward it to the filesystem through the advise vnode
+ * operation, which steers readahead (SEQUENTIAL/RANDOM/NORMAL),
+ * pre-populates the cache (WILLNEED), or releases the file's cached pages
+ * (DONTNEED).
+ *
+ * Return 0 on success, or:
+ *  - EBADF: fd is invalid or not open
+ *  - EINVAL: advice is not one of the FADV_ values
+ *  - Propagate errors from the vnode operation advise
+ *
+ * The hint is advisory, so vnodes without an advise operation return 0.
+ */
+long do_fadvise(int fd, int advice)
+{
+    if (fd >= NFILES || fd < 0) {
+        return -EBADF;
+    }
+    file_t* file = curproc->p_files[fd];
+    if (!file) {
+        return -EBADF;
+    }
+    if (advice < FADV_NORMAL || advice > FADV_DONTNEED) {
+        return -EINVAL;
+    }
+    if (advice == FADV_NORMAL || advice == FADV_SEQUENTIAL ||
+        advice == FADV_RANDOM) {
+        file->f_advice = advice;
+    }
+    vnode_t *node = file->f_vnode;
+    if (!node->vn_ops || !node->vn_ops->advise) {
+        return 0;
+    }
+    vlock(node);
+    long status = node->vn_ops->advise(node, advice);
+    vunlock(node);
+    return status;
+}
+
+/*
+ * Copy up to count bytes from in_fd's file to out_fd's file or pipe without
+ * a round trip through user memory: data moves through a single in-kernel
+ * staging page, so each page costs one kernel copy instead of two
+ * user/kernel copies and two syscalls. Both files' positions advance as
+ * they would under the equivalent do_read/do_write loop, including the
+ * append and O_DIRECT behavior of each fd.
+ *
+ * Return the number of bytes copied on success (which is short if the
+ * source hits end of file), or:
+ *  - EBADF: either fd is invalid, in_fd is not open for reading, or out_fd
+ *    is not open for writing
+ *  - EISDIR: in_fd refers to a directory
+ *  - ENOMEM: no page was available for staging
+ *  - Propagate errors from the vnode operations, unless some bytes have
+ *    already been copied, in which case return the partial total
+ */
+ssize_t do_sendfile(int out_fd, int in_fd, size_t count)
+{
+    if (out_fd >= NFILES || out_fd < 0 || in_fd >= NFILES || in_fd < 0) {
+        return -EBADF;
+    }
+    file_t* file_in = curproc->p_files[in_fd];
+    file_t* file_out = curproc->p_files[out_fd];
+    if (!file_in || !file_out) {
+        return -EBADF;
+    }
+    vnode_t *in = file_in->f_vnode;
+    vnode_t *out = file_out->f_vnode;
+    if (S_ISDIR(in->vn_mode)) {
+        return -EISDIR;
+    }
+    if (!(FMODE_READ & file_in->f_mode) || !(FMODE_WRITE & file_out->f_mode)) {
+        return -EBADF;
+    }
+    char* buffer = page_alloc();
+    if (!buffer) {
+        return -ENOMEM;
+    }
+    size_t total = 0;
+    long status = 0;
+    while (total < count) {
+        size_t chunk = MIN(PAGE_SIZE, count - total);
+        ssize_t num_read;
+        if (S_ISREG(in->vn_mode)) {
+            vnode_range_t range;
+            vnode_range_lock(in, &range, file_in->f_pos, file_in->f_pos + chunk,
+                             0);
+            if ((FMODE_DIRECT & file_in->f_mode) && in->vn_ops->read_direct) {
+                num_read =
+                    in->vn_ops->read_direct(in, file_in->f_pos, buffer, chunk);
+            } else {
+                num_read = in->vn_ops->read(in, file_in->f_pos, buffer, chunk);
+            }
+            vnode_range_unlock(in, &range);
+        } else {
+            vlock(in);
+            num_read = in->vn_ops->read(in, file_in->f_pos, buffer, chunk);
+            vunlock(in);
+        }
+        if (num_read < 0) {
+            status = num_read;
+            break;
+        }
+        if (num_read == 0) {
+            break;
+        }
+        file_in->f_pos = file_in->f_pos + num_read;
+        ssize_t num_written;
+        if (S_ISREG(out->vn_mode)) {
+            vnode_range_t range;
+            if (FMODE_APPEND & file_out->f_mode) {
+                /* same retry dance as do_write, so appends never overlap */
+                file_out->f_pos = out->vn_len;
+                vnode_range_lock(out, &range, file_out->f_pos,
+                                 file_out->f_pos + num_read, 1);
+                while (file_out->f_pos != out->vn_len) {
+                    vnode_range_unlock(out, &range);
+                    file_out->f_pos = out->vn_len;
+                    vnode_range_lock(out, &range, file_out->f_pos,
+                                     file_out->f_pos + num_read, 1);
+                }
+            } else {
+                vnode_range_lock(out, &range, file_out->f_pos,
+                                 file_out->f_pos + num_read, 1);
+            }
+            if ((FMODE_DIRECT & file_out->f_mode) &&
+                out->vn_ops->write_direct) {
+                num_written = out->vn_ops->write_direct(out, file_out->f_pos,
+                                                        buffer, num_read);
+            } else {
+                num_written =
+                    out->vn_ops->write(out, file_out->f_pos, buffer, num_read);
+            }
+            vnode_range_unlock(out, &range);
+        } else {
+            vlock(out);
+            if (FMODE_APPEND & file_out->f_mode) {
+                file_out->f_pos = out->vn_len;
+            }
+            num_written =
+                out->vn_ops->write(out, file_out->f_pos, buffer, num_read);
+            vunlock(out);
+        }
+        if (num_written < 0) {
+            status = num_written;
+            break;
+        }
+        file_out->f_pos = file_out->f_pos + num_written;
+        total += num_written;
+        if ((size_t)num_read < chunk || num_written < num_read) {
+            break;
+        }
+    }
+    page_free(buffer);
+    if (status < 0 && !total) {
+        return status;
+    }
+    return (ssize_t)total;
+}
+
 /*
  * Close the file descriptor fd.
  *
@@ -112,8 +611,15 @@ long do_close(int fd)
     if (!curproc->p_files[fd]) {
         return -EBADF;
     }
+    // the table may be a snapshot shared with a fork relative; closing in
+    // place would close their descriptor too
+    long status = fdtable_unshare();
+    if (status < 0) {
+        return status;
+    }
     fput(&curproc->p_files[fd]);
     curproc->p_files[fd] = NULL;
+    curproc->p_fdtable->fdt_cloexec &= ~(1UL << fd);
     return 0;
 }
 
@@ -144,7 +650,13 @@ long do_dup(int fd)
         fput(&file);
         return -EBADF;
     }
+    if (fdtable_unshare() < 0) {
+        fput(&file);
+        return -ENOMEM;
+    }
     curproc->p_files[new_fd] = file;
+    // POSIX: the duplicate never inherits close-on-exec
+    curproc->p_fdtable->fdt_cloexec &= ~(1UL << new_fd);
     return new_fd;
 }
 
@@ -171,6 +683,10 @@ long do_dup2(int ofd, int nfd)
         fput(&file);
         return -EBADF;
     }
+    if (fdtable_unshare() < 0) {
+        fput(&file);
+        return -ENOMEM;
+    }
     if (curproc->p_files[nfd]) {
         long close_status = do_close(nfd);
         if (close_status < 0) {
@@ -179,6 +695,7 @@ long do_dup2(int ofd, int nfd)
         }
     }
     curproc->p_files[nfd] = file;
+    curproc->p_fdtable->fdt_cloexec &= ~(1UL << nfd);
     return nfd;
 }
 
@@ -262,6 +779,9 @@ long do_mkdir(const char *path)
     }
     vnode_t* created;
     status = res_vnode->vn_ops->mkdir(res_vnode, name, namelen, &created);
+    if (status >= 0) {
+        dcache_remove(res_vnode, name, namelen);
+    }
     vput_locked(&res_vnode);
     if (status < 0) {
         return status;
@@ -308,6 +828,9 @@ long do_rmdir(const char *path)
         return -ENOTDIR;
     }
     status = res->vn_ops->rmdir(res, name, len);
+    if (status >= 0) {
+        dcache_remove(res, name, len);
+    }
     vput_locked(&res);
     return status;
 }
@@ -350,6 +873,9 @@ long do_unlink(const char *path)
         return -EPERM;
     }
     status = res->vn_ops->unlink(res, name, len);
+    if (status >= 0) {
+        dcache_remove(res, name, len);
+    }
     vput(&found);
     vput_locked(&res);
     return status;
@@ -404,11 +930,80 @@ long do_link(const char *oldpath, const char *newpath)
     vlock_in_order(old_res, directory_res);
     status = directory_res->vn_ops->link(directory_res, new_name, new_len, old_res);
     vunlock_in_order(old_res, directory_res);
+    if (status >= 0) {
+        dcache_remove(directory_res, new_name, new_len);
+    }
     vput(&old_res);
     vput(&directory_res);
     return status;
 }
 
+/*
+ * Create a symbolic link at linkpath whose target is the string `target`.
+ *
+ * Return 0 on success, or:
+ *  - EINVAL: target is empty or longer than MAXPATHLEN - 1
+ *  - ENAMETOOLONG: The last component of linkpath is too long
+ *  - ENOTDIR: The parent of the link to be created is not a directory
+ *  - EEXIST: A file located at linkpath already exists
+ *  - Propagate errors from namev_dir() and the vnode operations mknod and
+ *    write
+ *
+ * The target is not resolved here - a symlink may point at a path that
+ * does not (yet) exist. The link inode is created with mknod(S_IFLNK) and
+ * the target string is stored as its file data, which is what
+ * namev_follow() reads back when the link is followed.
+ */
+long do_symlink(const char *target, const char *linkpath)
+{
+    size_t target_len = strlen(target);
+    if (target_len == 0 || target_len >= MAXPATHLEN) {
+        return -EINVAL;
+    }
+    vnode_t* dir;
+    const char* name;
+    size_t namelen;
+    long status = namev_dir(curproc->p_cwd, linkpath, &dir, &name, &namelen);
+    if (status < 0) {
+        return status;
+    }
+    if (namelen > NAME_LEN) {
+        vput(&dir);
+        return -ENAMETOOLONG;
+    }
+    if (!S_ISDIR(dir->vn_mode)) {
+        vput(&dir);
+        return -ENOTDIR;
+    }
+    vnode_t* existing;
+    vlock(dir);
+    status = namev_lookup(dir, name, namelen, &existing);
+    if (status >= 0) {
+        vput(&existing);
+        vput_locked(&dir);
+        return -EEXIST;
+    }
+    if (status != -ENOENT) {
+        vput_locked(&dir);
+        return status;
+    }
+    vnode_t* lnk;
+    status = dir->vn_ops->mknod(dir, name, namelen, S_IFLNK, 0, &lnk);
+    if (status < 0) {
+        vput_locked(&dir);
+        return status;
+    }
+    /* drop the negative entry the failed lookup just cached */
+    dcache_remove(dir, name, namelen);
+    vunlock(dir);
+    vlock(lnk);
+    ssize_t written = lnk->vn_ops->write(lnk, 0, target, target_len);
+    vunlock(lnk);
+    vput(&dir);
+    vput(&lnk);
+    return written < 0 ? written : 0;
+}
+
 /* Rename a file or directory.
  *
  * Return 0 on success, or:
@@ -470,6 +1065,10 @@ long do_rename(const char *oldpath, const char *newpath)
     vlock_in_order(old_res, new_res);
     status = old_res->vn_ops->rename(old_res, name, len, new_res, new_name, new_len);
     vunlock_in_order(old_res, new_res);
+    if (status >= 0) {
+        dcache_remove(old_res, name, len);
+        dcache_remove(new_res, new_name, new_len);
+    }
     vput(&old_res);
     vput(&new_res);
     return status;
@@ -504,20 +1103,20 @@ long do_chdir(const char *path)
 }
 
 /*
- * Read a directory entry from the file specified by fd into dirp.
+ * Read as many directory entries as fit in count bytes into dirp, taking
+ * the directory's vnode lock once for the whole batch rather than once
+ * per entry, so listing a large directory is one locked pass instead of
+ * one lock/readdir round trip per dirent.
  *
- * Return sizeof(dirent_t) on success, or:
+ * Return the number of bytes read (always a multiple of sizeof(dirent_t);
+ * 0 at the end of the directory), or:
  *  - EBADF: fd is invalid or is not open
  *  - ENOTDIR: fd does not refer to a directory
- *  - Propagate errors from the vnode operation readdir
- *
- * Hints:
- *  - Use the vnode operation readdir.
- *  - Be sure to update file position according to readdir's return value.
- *  - On success (readdir return value is strictly positive), return
- *    sizeof(dirent_t).
+ *  - Propagate errors from the vnode operation readdir, unless some
+ *    entries have already been read, in which case return the partial
+ *    total
  */
-ssize_t do_getdent(int fd, struct dirent *dirp)
+ssize_t do_getdents(int fd, struct dirent *dirp, size_t count)
 {
     if (fd < 0 || fd >= NFILES) {
         return -EBADF;
@@ -531,16 +1130,35 @@ ssize_t do_getdent(int fd, struct dirent *dirp)
         fput(&file);
         return -ENOTDIR;
     }
+    size_t nbytes = 0;
     vlock(vnode);
-    size_t read = vnode->vn_ops->readdir(vnode, file->f_pos, dirp);
-    vunlock(vnode);
-    if (read == 0) {
-        fput(&file);
-        return read;
+    while (nbytes + sizeof(dirent_t) <= count) {
+        ssize_t read = vnode->vn_ops->readdir(vnode, file->f_pos,
+                                              dirp + nbytes / sizeof(dirent_t));
+        if (read <= 0) {
+            vunlock(vnode);
+            fput(&file);
+            return nbytes ? (ssize_t)nbytes : read;
+        }
+        file->f_pos = file->f_pos + read;
+        nbytes += sizeof(dirent_t);
     }
-    file->f_pos = file->f_pos + read;
+    vunlock(vnode);
     fput(&file);
-    return sizeof(dirent_t);
+    return nbytes;
+}
+
+/*
+ * Read a single directory entry from the file specified by fd into dirp.
+ *
+ * Return sizeof(dirent_t) on success, 0 at the end of the directory, or:
+ *  - EBADF: fd is invalid or is not open
+ *  - ENOTDIR: fd does not refer to a directory
+ *  - Propagate errors from the vnode operation readdir
+ */
+ssize_t do_getdent(int fd, struct dirent *dirp)
+{
+    return do_getdents(fd, dirp, sizeof(dirent_t));
 }
 
 /*
@@ -561,7 +1179,8 @@ off_t do_lseek(int fd, off_t offset, int whence)
     if (fd < 0 || fd >= NFILES) {
         return -EBADF;
     }
-    if (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) {
+    if (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END &&
+        whence != SEEK_DATA && whence != SEEK_HOLE) {
         return -EINVAL;
     }
     file_t* file = curproc->p_files[fd];
@@ -591,9 +1210,155 @@ off_t do_lseek(int fd, off_t offset, int whence)
         file->f_pos = node->vn_len + offset;
         vunlock(node);
     }
+    if (whence == SEEK_DATA || whence == SEEK_HOLE) {
+        if (offset < 0) {
+            return -EINVAL;
+        }
+        vnode_t* node = file->f_vnode;
+        vlock(node);
+        if (offset >= (off_t) node->vn_len) {
+            vunlock(node);
+            return -ENXIO;
+        }
+        size_t res;
+        if (node->vn_ops->seek_sparse) {
+            long status = node->vn_ops->seek_sparse(node, (size_t) offset,
+                                                    whence == SEEK_DATA, &res);
+            if (status < 0) {
+                vunlock(node);
+                return status;
+            }
+        } else {
+            /* no sparseness info: one data region, implicit hole at EOF */
+            res = whence == SEEK_DATA ? (size_t) offset : (size_t) node->vn_len;
+        }
+        vunlock(node);
+        file->f_pos = (off_t) res;
+    }
     return file->f_pos;
 }
 
+/*
+ * Readiness notification for do_poll. A thread can only sleep on one
+ * ktqueue at a time (kt_qlink), so pollers cannot park themselves on the
+ * wait queue of every vnode they are watching; instead every poller
+ * sleeps on this one queue and event sources (currently the pipe code)
+ * call poll_notify() whenever a pollable condition may have changed. The
+ * generation counter closes the race between a poller's readiness scan
+ * and its sleep: if any notification arrives in between, the poller sees
+ * the counter move and rescans instead of sleeping through the event.
+ */
+static ktqueue_t poll_waitq;
+static spinlock_t poll_lock = SPINLOCK_INITIALIZER(poll_lock);
+static unsigned long poll_gen;
+static long poll_waiters;
+static long poll_initialized;
+
+void poll_notify(void)
+{
+    spinlock_lock(&poll_lock);
+    poll_gen++;
+    if (poll_waiters) {
+        sched_broadcast_on(&poll_waitq);
+    }
+    spinlock_unlock(&poll_lock);
+}
+
+/*
+ * One pass over the pollfd array: fill in each revents and return how
+ * many entries are ready. Never blocks.
+ */
+static long _poll_scan(struct pollfd *fds, nfds_t nfds)
+{
+    long nready = 0;
+    for (nfds_t i = 0; i < nfds; i++) {
+        struct pollfd *pfd = fds + i;
+        pfd->revents = 0;
+        if (pfd->fd < 0) {
+            continue;
+        }
+        if (pfd->fd >= NFILES || !curproc->p_files[pfd->fd]) {
+            pfd->revents = POLLNVAL;
+            nready++;
+            continue;
+        }
+        file_t *file = curproc->p_files[pfd->fd];
+        vnode_t *node = file->f_vnode;
+        if (node->vn_ops->poll) {
+            vlock(node);
+            pfd->revents = (short) node->vn_ops->poll(node, file, pfd->events);
+            vunlock(node);
+        } else {
+            /* vnode types without the op never block reads or writes */
+            pfd->revents = pfd->events & (POLLIN | POLLOUT);
+        }
+        if (pfd->revents) {
+            nready++;
+        }
+    }
+    return nready;
+}
+
+/*
+ * Wait for one of the given file descriptors to become ready for I/O.
+ *
+ * Each pollfd's revents is filled in with the subset of its events
+ * (POLLIN / POLLOUT) that is currently satisfied, plus POLLERR, POLLHUP
+ * or POLLNVAL as appropriate; entries with a negative fd are ignored.
+ * timeout is in milliseconds: 0 means scan once and return, a negative
+ * value means wait indefinitely.
+ *
+ * Return the number of ready descriptors (0 on timeout), or:
+ *  - EINTR: the wait was cancelled
+ */
+long do_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    uint64_t deadline = 0;
+    if (timeout > 0) {
+        deadline = jiffies + time_usec_to_ticks((uint64_t) timeout * 1000);
+    }
+
+    spinlock_lock(&poll_lock);
+    if (!poll_initialized) {
+        sched_queue_init(&poll_waitq);
+        poll_initialized = 1;
+    }
+    spinlock_unlock(&poll_lock);
+
+    for (;;) {
+        spinlock_lock(&poll_lock);
+        unsigned long gen = poll_gen;
+        spinlock_unlock(&poll_lock);
+
+        long nready = _poll_scan(fds, nfds);
+        if (nready || timeout == 0 || (timeout > 0 && jiffies >= deadline)) {
+            return nready;
+        }
+
+        spinlock_lock(&poll_lock);
+        if (gen != poll_gen) {
+            /* something fired between the scan and now; rescan */
+            spinlock_unlock(&poll_lock);
+            continue;
+        }
+        poll_waiters++;
+        long ret;
+        if (timeout < 0) {
+            ret = sched_cancellable_sleep_on(&poll_waitq, &poll_lock);
+        } else {
+            ret = sched_sleep_on_timeout(&poll_waitq, &poll_lock,
+                                         deadline - jiffies);
+        }
+        spinlock_lock(&poll_lock);
+        poll_waiters--;
+        spinlock_unlock(&poll_lock);
+        if (ret == -EINTR) {
+            return ret;
+        }
+        /* on -ETIMEDOUT the deadline check above returns the final scan */
+    }
+}
+
 /* Use buf to return the status of the file represented by path.
  *
  * Return 0 on success, or:
@@ -606,7 +1371,7 @@ long do_stat(const char *path, stat_t *buf)
     if (open_status < 0) {
         return open_status;
     }
-    long stat_status = res_vnode->vn_ops->stat(res_vnode, buf);
+    long stat_status = vnode_stat(res_vnode, buf);
     vput(&res_vnode);
     if (stat_status < 0) {
         return stat_status;
@@ -616,39 +1381,99 @@ long do_stat(const char *path, stat_t *buf)
 
 #ifdef __MOUNTING__
 /*
- * Implementing this function is not required and strongly discouraged unless
- * you are absolutely sure your Weenix is perfect.
- *
- * This is the syscall entry point into vfs for mounting. You will need to
- * create the fs_t struct and populate its fs_dev and fs_type fields before
- * calling vfs's mountfunc(). mountfunc() will use the fields you populated
- * in order to determine which underlying filesystem's mount function should
- * be run, then it will finish setting up the fs_t struct. At this point you
- * have a fully functioning file system, however it is not mounted on the
- * virtual file system, you will need to call vfs_mount to do this.
- *
- * There are lots of things which can go wrong here. Make sure you have good
- * error handling. Remember the fs_dev and fs_type buffers have limited size
- * so you should not write arbitrary length strings to them.
+ * Mount the file system of the given type backed by device `source` on the
+ * directory at `target`.
+ *
+ * Return 0 on success, or:
+ *  - EINVAL: source or type does not fit the fs_t name buffers, or type
+ *    is not a known file system type (via mountfunc)
+ *  - ENOTDIR: target is not a directory
+ *  - EBUSY: something is already mounted on target (via vfs_mount)
+ *  - Propagate errors from namev_resolve(), mountfunc(), and vfs_mount()
+ *
+ * The fs_t is created here and populated with the device and type;
+ * mountfunc() dispatches to the file-system-specific mount routine that
+ * fills in the rest, and vfs_mount() splices the new file system into the
+ * namespace.
  */
 int do_mount(const char *source, const char *target, const char *type)
 {
-    NOT_YET_IMPLEMENTED("MOUNTING: do_mount");
-    return -EINVAL;
+    if (strlen(source) >= STR_MAX || strlen(type) >= STR_MAX) {
+        return -EINVAL;
+    }
+    vnode_t* mtpt;
+    long status = namev_resolve(curproc->p_cwd, target, &mtpt);
+    if (status < 0) {
+        return status;
+    }
+    if (!S_ISDIR(mtpt->vn_mode)) {
+        vput(&mtpt);
+        return -ENOTDIR;
+    }
+    fs_t* fs = kmalloc(sizeof(fs_t));
+    if (!fs) {
+        vput(&mtpt);
+        return -ENOMEM;
+    }
+    memset(fs, 0, sizeof(fs_t));
+    strcpy(fs->fs_dev, source);
+    strcpy(fs->fs_type, type);
+    list_init(&fs->vnode_list);
+    list_link_init(&fs->fs_link);
+    vnode_fs_init(fs);
+    status = mountfunc(fs);
+    if (status < 0) {
+        kfree(fs);
+        vput(&mtpt);
+        return status;
+    }
+    status = vfs_mount(mtpt, fs);
+    if (status < 0) {
+        if (fs->fs_ops->umount) {
+            fs->fs_ops->umount(fs);
+        } else {
+            vput(&fs->fs_root);
+        }
+        if (fs->fs_vnode_allocator) {
+            slab_allocator_destroy(fs->fs_vnode_allocator);
+        }
+        kfree(fs);
+    }
+    vput(&mtpt);
+    return status;
 }
 
 /*
- * Implementing this function is not required and strongly discouraged unless
- * you are absolutley sure your Weenix is perfect.
+ * Unmount the file system mounted at `target`.
+ *
+ * Return 0 on success, or:
+ *  - EINVAL: target is not the mount point of a mounted file system
+ *  - EBUSY: the file system still has vnodes in use (via vfs_umount)
+ *  - Propagate errors from namev_resolve() and vfs_umount()
  *
- * This function delegates all of the real work to vfs_umount. You should not
- * worry about freeing the fs_t struct here, that is done in vfs_umount. All
- * this function does is figure out which file system to pass to vfs_umount and
- * do good error checking.
+ * All of the real work happens in vfs_umount, which also frees the fs_t;
+ * this function only figures out which file system target names. Because
+ * path resolution descends through mount points, resolving target yields
+ * the mounted file system's root.
  */
 int do_umount(const char *target)
 {
-    NOT_YET_IMPLEMENTED("MOUNTING: do_unmount");
+    vnode_t* res;
+    long status = namev_resolve(curproc->p_cwd, target, &res);
+    if (status < 0) {
+        return status;
+    }
+    fs_t* fs = res->vn_fs;
+    if (res != fs->fs_root) {
+        vput(&res);
+        return -EINVAL;
+    }
+    vput(&res);
+    list_iterate(&mounted_fs_list, mtfs, fs_t, fs_link) {
+        if (mtfs == fs) {
+            return vfs_umount(fs);
+        }
+    }
     return -EINVAL;
 }
 #endif
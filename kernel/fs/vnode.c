@@ -3,6 +3,7 @@
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "kernel.h"
+#include "mm/kmalloc.h"
 #include "mm/slab.h"
 #include "util/debug.h"
 #include "util/string.h"
@@ -10,6 +11,8 @@
 
 #define MOBJ_TO_VNODE(o) CONTAINER_OF((o), vnode_t, vn_mobj)
 
+#define VNODE_HASH(ino) ((ino) & (VNODE_HASH_BUCKETS - 1))
+
 static long vnode_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
                              pframe_t **pfp);
 static long vnode_fill_pframe(mobj_t *o, pframe_t *pf);
@@ -112,6 +115,16 @@ void notify_vnode_loaded(vnode_t *vn)
     sched_broadcast_on(&vn->vn_waitq);
 }
 
+void vnode_fs_init(fs_t *fs)
+{
+    for (size_t i = 0; i < VNODE_HASH_BUCKETS; i++)
+    {
+        list_init(&fs->vnode_hash[i]);
+        kmutex_init(&fs->vnode_hash_mutexes[i]);
+    }
+    krwlock_init(&fs->vnode_list_lock);
+}
+
 void vnode_init(vnode_t *vn, fs_t *fs, ino_t ino, int state)
 {
     vn->vn_state = VNODE_LOADING;
@@ -121,20 +134,162 @@ void vnode_init(vnode_t *vn, fs_t *fs, ino_t ino, int state)
     sched_queue_init(&vn->vn_waitq);
     mobj_init(&vn->vn_mobj, MOBJ_VNODE, &vnode_mobj_ops);
     KASSERT(vn->vn_mobj.mo_refcount);
+#ifdef __MOUNTING__
+    /* self pointer until a file system is mounted here (see vfs_mount) */
+    vn->vn_mount = vn;
+#endif
+    vn->vn_execs = 0;
+    /* the stat snapshot (vn_stat_gen == 0, zeroed by the allocator) must
+     * start out stale */
+    vn->vn_gen = 1;
+    list_init(&vn->vn_ranges);
+    spinlock_init(&vn->vn_range_lock);
+    sched_queue_init(&vn->vn_range_waitq);
+}
+
+void vnode_range_lock(vnode_t *vn, vnode_range_t *vr, size_t start, size_t end,
+                      long forwrite)
+{
+    vr->vr_start = start;
+    vr->vr_end = end;
+    vr->vr_write = forwrite;
+
+    spinlock_lock(&vn->vn_range_lock);
+retry:
+    list_iterate(&vn->vn_ranges, cur, vnode_range_t, vr_link)
+    {
+        if (cur->vr_start < end && start < cur->vr_end &&
+            (cur->vr_write || forwrite))
+        {
+            /* sched_sleep_on releases the spinlock once we're queued */
+            sched_sleep_on(&vn->vn_range_waitq, &vn->vn_range_lock);
+            spinlock_lock(&vn->vn_range_lock);
+            goto retry;
+        }
+    }
+    list_insert_tail(&vn->vn_ranges, &vr->vr_link);
+    spinlock_unlock(&vn->vn_range_lock);
+}
+
+void vnode_range_unlock(vnode_t *vn, vnode_range_t *vr)
+{
+    spinlock_lock(&vn->vn_range_lock);
+    KASSERT(list_link_is_linked(&vr->vr_link));
+    list_remove(&vr->vr_link);
+    sched_broadcast_on(&vn->vn_range_waitq);
+    spinlock_unlock(&vn->vn_range_lock);
+}
+
+long vnode_stat(vnode_t *vn, stat_t *buf)
+{
+    /* Lockless fast path: copy the snapshot, then confirm that no refresh
+     * was in flight (odd seq), that the seq did not move under the copy,
+     * and that no writer invalidated the snapshot meanwhile. */
+    uint64_t seq = vn->vn_stat_seq;
+    __sync_synchronize();
+    if (!(seq & 1) && vn->vn_stat_gen == vn->vn_gen)
+    {
+        stat_t snap = vn->vn_stat;
+        __sync_synchronize();
+        if (vn->vn_stat_seq == seq && vn->vn_stat_gen == vn->vn_gen)
+        {
+            *buf = snap;
+            return 0;
+        }
+    }
+
+    /* Refresh path: the file system's stat under the vnode lock, which
+     * also serializes concurrent refreshers on the seqlock write side.
+     * The generation is sampled before the stat call so a mutation that
+     * slips in during it leaves the new snapshot already stale. */
+    vlock(vn);
+    uint64_t gen = vn->vn_gen;
+    long ret = vn->vn_ops->stat(vn, buf);
+    if (!ret)
+    {
+        vn->vn_stat_seq++;
+        __sync_synchronize();
+        vn->vn_stat = *buf;
+        vn->vn_stat_gen = gen;
+        __sync_synchronize();
+        vn->vn_stat_seq++;
+    }
+    vunlock(vn);
+    return ret;
+}
+
+void vnode_stat_dirty(vnode_t *vn) { __sync_fetch_and_add(&vn->vn_gen, 1); }
+
+/*
+ * Pinned-binary cache: executables exec'd at least VNODE_PIN_EXECS times
+ * get an extra reference held here, keeping the vnode - and the text
+ * pages cached in its vn_mobj - resident between execs, so our
+ * frequently-spawned helper binaries don't re-fault their text every
+ * time. The pageout daemon calls vnode_pin_shrink() under memory
+ * pressure to drop the pins.
+ */
+#define VNODE_PIN_EXECS 4
+#define VNODE_PIN_MAX 8
+
+static vnode_t *vnode_pinned[VNODE_PIN_MAX];
+static size_t vnode_pinned_count;
+static kmutex_t vnode_pin_mutex = KMUTEX_INITIALIZER(vnode_pin_mutex);
+
+void vnode_record_exec(vnode_t *vn)
+{
+    kmutex_lock(&vnode_pin_mutex);
+    vn->vn_execs++;
+    if (vn->vn_execs >= VNODE_PIN_EXECS && vnode_pinned_count < VNODE_PIN_MAX)
+    {
+        size_t i;
+        for (i = 0; i < vnode_pinned_count; i++)
+        {
+            if (vnode_pinned[i] == vn)
+            {
+                break;
+            }
+        }
+        if (i == vnode_pinned_count)
+        {
+            dbg(DBG_VFS, "pinning exec'd vnode %d after %lu execs\n",
+                vn->vn_vno, vn->vn_execs);
+            vref(vn);
+            vnode_pinned[vnode_pinned_count++] = vn;
+        }
+    }
+    kmutex_unlock(&vnode_pin_mutex);
+}
+
+size_t vnode_pin_shrink()
+{
+    kmutex_lock(&vnode_pin_mutex);
+    size_t released = vnode_pinned_count;
+    for (size_t i = 0; i < vnode_pinned_count; i++)
+    {
+        vnode_t *vn = vnode_pinned[i];
+        vnode_pinned[i] = NULL;
+        vn->vn_execs = 0;
+        vput(&vn);
+    }
+    vnode_pinned_count = 0;
+    kmutex_unlock(&vnode_pin_mutex);
+    return released;
 }
 
 vnode_t *__vget(fs_t *fs, ino_t ino, int get_locked)
 {
+    list_t *bucket = &fs->vnode_hash[VNODE_HASH(ino)];
+    kmutex_t *bucket_mutex = &fs->vnode_hash_mutexes[VNODE_HASH(ino)];
 find:
-    kmutex_lock(&fs->vnode_list_mutex);
-    list_iterate(&fs->vnode_list, vn, vnode_t, vn_link)
+    kmutex_lock(bucket_mutex);
+    list_iterate(bucket, vn, vnode_t, vn_hlink)
     {
         if (vn->vn_vno == ino)
         {
-            if (atomic_inc_not_zero(&vn->vn_mobj.mo_refcount))
+            if (refcount_inc_not_zero(&vn->vn_mobj.mo_refcount))
             {
-                /* reference acquired, we can release the per-FS list */
-                kmutex_unlock(&fs->vnode_list_mutex);
+                /* reference acquired, we can release the bucket */
+                kmutex_unlock(bucket_mutex);
                 await_vnode_loaded(vn);
                 if (get_locked)
                 {
@@ -145,7 +300,7 @@ find:
             else
             {
                 /* count must be 0, wait and try again later */
-                kmutex_unlock(&fs->vnode_list_mutex);
+                kmutex_unlock(bucket_mutex);
                 sched_yield();
                 goto find;
             }
@@ -161,11 +316,14 @@ find:
     /* initialize the vnode state */
     vnode_init(vn, fs, ino, VNODE_LOADING);
 
-    /* add the vnode to the per-FS list, lock the vnode, and release the list
-     * (unblocking other `vget` calls) */
+    /* add the vnode to its hash bucket and the per-FS list, lock the vnode,
+     * and release the bucket (unblocking other `vget` calls) */
+    list_insert_tail(bucket, &vn->vn_hlink);
+    krwlock_write_lock(&fs->vnode_list_lock);
     list_insert_tail(&fs->vnode_list, &vn->vn_link);
+    krwlock_write_unlock(&fs->vnode_list_lock);
     vlock(vn);
-    kmutex_unlock(&fs->vnode_list_mutex);
+    kmutex_unlock(bucket_mutex);
 
     /* load the vnode */
     vn->vn_fs->fs_ops->read_vnode(vn->vn_fs, vn);
@@ -247,10 +405,20 @@ static void vnode_destructor(mobj_t *o)
     KASSERT(!kmutex_has_waiters(&o->mo_mutex));
     vunlock(vn);
 
-    /* remove the vnode from the list and free it*/
-    kmutex_lock(&vn->vn_fs->vnode_list_mutex);
+    /* remove the vnode from its hash bucket and the list and free it */
+    kmutex_t *bucket_mutex =
+        &vn->vn_fs->vnode_hash_mutexes[VNODE_HASH(vn->vn_vno)];
+    kmutex_lock(bucket_mutex);
+    KASSERT(list_link_is_linked(&vn->vn_hlink));
+    list_remove(&vn->vn_hlink);
+    krwlock_write_lock(&vn->vn_fs->vnode_list_lock);
     KASSERT(list_link_is_linked(&vn->vn_link));
     list_remove(&vn->vn_link);
-    kmutex_unlock(&vn->vn_fs->vnode_list_mutex);
+    krwlock_write_unlock(&vn->vn_fs->vnode_list_lock);
+    kmutex_unlock(bucket_mutex);
+    if (vn->vn_link_target)
+    {
+        kfree(vn->vn_link_target);
+    }
     slab_obj_free(vn->vn_fs->fs_vnode_allocator, vn);
 }
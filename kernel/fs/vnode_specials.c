@@ -1,4 +1,6 @@
 #include <errno.h>
+#include <fs/file.h>
+#include <fs/poll.h>
 #include <fs/stat.h>
 #include <fs/vfs.h>
 #include <fs/vnode.h>
@@ -12,6 +14,8 @@ static ssize_t chardev_file_read(vnode_t *file, size_t pos, void *buf,
 static ssize_t chardev_file_write(vnode_t *file, size_t pos, const void *buf,
                                   size_t count);
 
+static long chardev_file_poll(vnode_t *file, file_t *fp, int events);
+
 static long chardev_file_mmap(vnode_t *file, mobj_t **ret);
 
 static long chardev_file_fill_pframe(vnode_t *file, pframe_t *pf);
@@ -30,6 +34,7 @@ static vnode_ops_t chardev_spec_vops = {
     .rmdir = NULL,
     .readdir = NULL,
     .stat = special_file_stat,
+    .poll = chardev_file_poll,
     .get_pframe = NULL,
     .fill_pframe = chardev_file_fill_pframe,
     .flush_pframe = chardev_file_flush_pframe,
@@ -133,6 +138,21 @@ static long chardev_file_write(vnode_t *file, size_t pos, const void *buf,
     return size;
 }
 
+/*
+ * Report readiness by deferring to the underlying chardev's poll operation.
+ * Devices without one (e.g. memory devices) never block and are always
+ * ready.
+ */
+static long chardev_file_poll(vnode_t *file, file_t *fp, int events)
+{
+    chardev_t *cdev = file->vn_dev.chardev;
+    if (!cdev->cd_ops->poll)
+    {
+        return events & (POLLIN | POLLOUT);
+    }
+    return cdev->cd_ops->poll(cdev, events);
+}
+
 /*
  * For this and the following chardev functions, simply defer to the underlying
  * chardev's corresponding operations.
@@ -9,4 +9,6 @@ long do_execve(const char *filename, char *const *argv, char *const *envp,
 
 void kernel_execve(const char *filename, char *const *argv, char *const *envp);
 
+long do_spawn(char *filename, char **argv, char **envp);
+
 void userland_entry(struct regs regs);
@@ -15,6 +15,38 @@
 #define DEFAULT_STACK_SIZE (DEFAULT_STACK_SIZE_PAGES << PAGE_SHIFT)
 #define TICK_MSECS 10 /* msecs between clock interrupts */
 
+/*
+ * Lock contention profiling: when set to 1, kmutex_lock() and
+ * spinlock_lock() record acquisition counts, total wait time and maximum
+ * hold time (both in TSC ticks) per call site, dumped with the kshell
+ * "lockstat" command. Costs an rdtsc and a hash-table update on every
+ * acquisition and release; leave at 0 for normal builds.
+ */
+#define LOCK_PROFILING 0
+
+/*
+ * Guarded slab allocations: when set to 1, slab_obj_alloc() and
+ * slab_obj_free() verify the canaries around every object and plant (on
+ * free) / re-check (on alloc) poison words in the object body, catching
+ * overruns and writes through stale pointers on every operation -
+ * including the magazine fast path, which the depot-only red-zone checks
+ * never see. Costs a handful of compares and stores per operation, cheap
+ * enough to leave enabled during soak tests; the gdb memcheck workflow
+ * remains the heavyweight option for pinpointing a culprit.
+ */
+#define SLAB_GUARD 0
+
+/*
+ * Assertion level: 2 compiles every assertion, including the expensive
+ * whole-structure scans written with KASSERT_EXPENSIVE (and the per-call
+ * list sanity checks on the scheduler queues); 1 keeps only the cheap
+ * always-on invariants -- KASSERT and friends, each a compare or two --
+ * which is what production/benchmark builds should use; 0 drops
+ * assertions entirely, like defining NDEBUG (which forces level 0
+ * regardless of this setting). See util/debug.h.
+ */
+#define KASSERT_LEVEL 2
+
 /*
  * Memory-management-related:
  */
@@ -13,10 +13,24 @@
 #include "mm/mobj.h"
 #include "mm/page.h"
 
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
 #define BLOCK_SIZE PAGE_SIZE
 
 struct blockdev_ops;
 
+/*
+ * One segment of a vectored block request: block_count blocks starting at
+ * biov_block, transferred to/from the (page-aligned) buffer biov_buf.
+ */
+typedef struct blockdev_iovec
+{
+    blocknum_t biov_block; /* starting block number */
+    char *biov_buf;        /* page-aligned buffer for the segment */
+    size_t biov_count;     /* number of blocks in the segment */
+} blockdev_iovec_t;
+
 /*
  * Represents a Weenix block device.
  */
@@ -32,6 +46,18 @@ typedef struct blockdev
 
     /* Link on the list of block-oriented devices */
     list_link_t bd_link;
+
+    /*
+     * I/O scheduler state. blockdev_register() saves the driver's ops in
+     * bd_driver_ops and points bd_ops at the elevator, so every read/write
+     * issued through bd_ops is queued, sorted, and merged before it reaches
+     * the driver (see drivers/blockdev.c).
+     */
+    struct blockdev_ops *bd_driver_ops; /* the real driver ops */
+    list_t bd_elev_pending;             /* pending requests, sorted by block */
+    blocknum_t bd_elev_pos;             /* sweep position of the C-SCAN pass */
+    spinlock_t bd_elev_lock;            /* protects the three fields above */
+    ktqueue_t bd_elev_waitq;            /* where the dispatcher waits for work */
 } blockdev_t;
 
 typedef struct blockdev_ops
@@ -49,6 +75,22 @@ typedef struct blockdev_ops
     long (*read_block)(blockdev_t *bdev, char *buf, blocknum_t loc,
                        size_t block_count);
 
+    /**
+     * Reads a single block with polled completion, trading a short busy
+     * wait (with preemption disabled) for skipping the interrupt round
+     * trip and wakeup - worthwhile only for latency-critical reads.
+     * Optional; may fail with -ENOTSUP or -EBUSY when polling is not
+     * possible at the moment. Callers should go through
+     * blockdev_read_poll(), which handles the fallback.
+     *
+     * @param bdev the block device
+     * @param buf the memory into which to read the block (must be
+     *      page-aligned)
+     * @param loc the number of the block to read
+     * @return 0 on success, -errno on failure
+     */
+    long (*read_block_poll)(blockdev_t *bdev, char *buf, blocknum_t loc);
+
     /**
      * Writes a block to the block device. This call will block.
      *
@@ -61,6 +103,32 @@ typedef struct blockdev_ops
      */
     long (*write_block)(blockdev_t *bdev, const char *buf, blocknum_t loc,
                         size_t block_count);
+
+    /**
+     * Reads a vector of segments from the block device in as few device
+     * commands as the driver can manage. Optional; when NULL, callers going
+     * through blockdev_read_vector() fall back to one read_block call per
+     * segment. This call will block.
+     *
+     * @param bdev the block device
+     * @param iov the segments to read, sorted by block number
+     * @param iovcnt the number of segments
+     * @return 0 on success, -errno on failure
+     */
+    long (*read_vector)(blockdev_t *bdev, blockdev_iovec_t *iov,
+                        size_t iovcnt);
+
+    /**
+     * Writes a vector of segments to the block device. Optional; see
+     * read_vector. This call will block.
+     *
+     * @param bdev the block device
+     * @param iov the segments to write, sorted by block number
+     * @param iovcnt the number of segments
+     * @return 0 on success, -errno on failure
+     */
+    long (*write_vector)(blockdev_t *bdev, blockdev_iovec_t *iov,
+                         size_t iovcnt);
 } blockdev_ops_t;
 
 /**
@@ -75,6 +143,33 @@ void blockdev_init(void);
  */
 long blockdev_register(blockdev_t *dev);
 
+/**
+ * Creates and starts the readahead worker process, which asynchronously
+ * populates block cache pframes queued via blockdev_readahead(). Called once
+ * from initproc_start().
+ */
+void blockdev_readahead_start(void);
+
+/**
+ * Creates and starts the per-device I/O scheduler (elevator) dispatchers.
+ * Until this is called, requests pass straight through to the drivers;
+ * afterward they are queued, sorted by block number, and merged into
+ * vectored driver commands, with deadline promotion so reads are not
+ * starved by streaming writes. Called once from initproc_start().
+ */
+void blockdev_elevator_start(void);
+
+/**
+ * Queues an asynchronous request to bring a block into bdev's block cache.
+ * Best-effort and non-blocking: if the request queue is full (or the worker
+ * has not started yet) the request is silently dropped, and a failed fill is
+ * simply not cached. Safe to call from any thread context.
+ *
+ * @param bdev the block device
+ * @param block the block to prefetch
+ */
+void blockdev_readahead(blockdev_t *bdev, blocknum_t block);
+
 /**
  * Finds a block device with a given device id.
  *
@@ -84,6 +179,46 @@ long blockdev_register(blockdev_t *dev);
  */
 blockdev_t *blockdev_lookup(devid_t id);
 
+/**
+ * Reads a vector of segments from a block device, using the driver's
+ * vectored operation when available and falling back to per-segment
+ * read_block calls otherwise.
+ *
+ * @param bdev the block device
+ * @param iov the segments to read, sorted by block number
+ * @param iovcnt the number of segments
+ * @return 0 on success, -errno on failure
+ */
+long blockdev_read_vector(blockdev_t *bdev, blockdev_iovec_t *iov,
+                          size_t iovcnt);
+
+/**
+ * Reads a single block, preferring the driver's polled completion mode
+ * when it has one: the request bypasses the I/O scheduler and spins out
+ * the device access instead of sleeping through the completion
+ * interrupt. Falls back to the ordinary read path when polling is
+ * unavailable or the device is busy, so it is always safe to call; meant
+ * for latency-critical metadata reads, not bulk data.
+ *
+ * @param bdev the block device
+ * @param buf the memory into which to read the block (must be
+ *      page-aligned)
+ * @param block the number of the block to read
+ * @return 0 on success, -errno on failure
+ */
+long blockdev_read_poll(blockdev_t *bdev, char *buf, blocknum_t block);
+
+/**
+ * Writes a vector of segments to a block device; see blockdev_read_vector.
+ *
+ * @param bdev the block device
+ * @param iov the segments to write, sorted by block number
+ * @param iovcnt the number of segments
+ * @return 0 on success, -errno on failure
+ */
+long blockdev_write_vector(blockdev_t *bdev, blockdev_iovec_t *iov,
+                           size_t iovcnt);
+
 /**
  * Cleans and frees all resident pages belonging to a given block
  * device.
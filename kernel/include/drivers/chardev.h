@@ -22,6 +22,14 @@ typedef struct chardev_ops
 
     ssize_t (*write)(chardev_t *dev, size_t pos, const void *buf, size_t count);
 
+    /*
+     * Reports the subset of events (POLLIN / POLLOUT, see fs/poll.h) for
+     * which the device is currently ready, without blocking. Optional;
+     * devices without the op (e.g. memory devices) never block and are
+     * treated as always ready.
+     */
+    long (*poll)(chardev_t *dev, int events);
+
     long (*mmap)(struct vnode *file, struct mobj **ret);
 
     long (*fill_pframe)(struct vnode *file, struct pframe *pf);
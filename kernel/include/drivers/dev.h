@@ -47,3 +47,24 @@
 #define MEM_MAJOR 1
 #define MEM_NULL_MINOR 0
 #define MEM_ZERO_MINOR 1
+
+/* Read-only kernel statistics devices (see drivers/statdev.c) */
+#define STAT_MAJOR 3
+#define STAT_RUNQ_MINOR 0
+#define STAT_CTXSWITCH_MINOR 1
+#define STAT_PAGEFREE_MINOR 2
+#define STAT_SLAB_MINOR 3
+#define STAT_SATA_MINOR 4
+#define STAT_KMALLOC_MINOR 5
+#define STAT_RESIDENT_MINOR 6 /* writable: a page count sets the quota */
+#define STAT_SCHEDLAT_MINOR 7
+#define STAT_SYSCALL_MINOR 8
+#define STAT_MOUNT_MINOR 9
+#define STAT_SWAP_MINOR 10
+#define STAT_LODEV_MINOR 11
+#define STAT_READAHEAD_MINOR 12
+#define STAT_NUM_MINORS 13
+
+/* Loopback packet device (see drivers/lodev.c) */
+#define LO_MAJOR 4
+#define LO_NUM_MINORS 1
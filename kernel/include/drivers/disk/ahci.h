@@ -241,7 +241,9 @@ typedef struct hba_ghc
 {
     struct
     {
-        uint32_t : 30;
+        uint8_t : 7;
+        uint8_t cccs : 1; /* Supports Command Completion Coalescing. */
+        uint32_t : 22;
         uint8_t sncq : 1; /* Supports Native Command Queueing. */
         uint8_t : 1;
     } packed cap;
@@ -258,7 +260,23 @@ typedef struct hba_ghc
                     interrupt. */
     uint32_t pi; /* Ports Implemented: If bit x is set, then port x is available
                     for use. */
-    uint32_t _omit[7];
+    uint32_t vs; /* Version. */
+    struct
+    {
+        uint8_t en : 1; /* Enable: Turns coalescing on. The other fields may
+                           only be written while this is 0. */
+        uint8_t : 2;
+        uint8_t intr : 5; /* Interrupt: read-only; the ghc.is bit the HBA
+                             asserts for a coalesced completion event. */
+        uint8_t cc : 8;   /* Command Completions: completions accumulated
+                             before an interrupt is raised. */
+        uint16_t tv : 16; /* Timeout Value: 1ms units; an interrupt is raised
+                             this long after the first unreported completion
+                             even if the threshold has not been met. */
+    } packed ccc_ctl;  /* Command Completion Coalescing Control (3.1.5). */
+    uint32_t ccc_ports; /* Ports whose completions participate in coalescing
+                           (may only be written while ccc_ctl.en is 0). */
+    uint32_t _omit[4];
 } packed hba_ghc_t;
 
 /* Signature for SATA devices. Compare this against hba_port_t->px_sig to
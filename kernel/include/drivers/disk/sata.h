@@ -7,6 +7,30 @@
 
 void sata_init();
 
+/* Panic-context write of one page-aligned block: polled, lock-free,
+ * interrupt-free (see sata.c). Used by util/crashdump.c only. */
+long sata_write_poll(blockdev_t *bdev, const char *buf, blocknum_t block);
+
+/* Polled-completion read of one page-aligned block for latency-critical
+ * callers; -ENOTSUP/-EBUSY mean "use the interrupt path" (see sata.c).
+ * Reached through blockdev_read_poll(). */
+long sata_read_poll(blockdev_t *bdev, char *buf, blocknum_t block);
+
+/* Number of SATA commands currently in flight across all ports. */
+size_t sata_queue_depth();
+
+/* Formats the queue-wait/device-time latency histograms (see sata.c). */
+size_t sata_latency_info(char *buf, size_t size);
+
+/* Steers the AHCI completion MSI to the given core (core 0 by default). */
+void sata_set_interrupt_affinity(long core);
+
+/* Takes/returns a pre-mapped, physically contiguous DMA staging buffer
+ * (SATA_DMA_BUF_SIZE bytes, see sata.c) from the recycling pool;
+ * sata_dma_alloc blocks while the pool is empty. */
+void *sata_dma_alloc();
+void sata_dma_free(void *buf);
+
 typedef struct ata_disk
 {
     hba_port_t *port;
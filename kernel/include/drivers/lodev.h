@@ -0,0 +1,21 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Loopback packet device (major LO_MAJOR): a network-style event source
+ * for exercising the scheduler and wakeup paths before real NIC support
+ * exists. write() submits one packet per call; delivery happens on a
+ * software interrupt (INTR_NET_SOFTIRQ) whose deferred bottom half moves
+ * packets to the receive ring and wakes readers, so the handoff has the
+ * same shape as hardware-interrupt-driven receive. See drivers/lodev.c.
+ */
+
+/* Largest packet a single write() submits; longer writes are truncated. */
+#define LO_MAX_PACKET PAGE_SIZE
+
+void lodev_init(void);
+
+/* Formats the packet counters (submitted/delivered/dropped) into buf for
+ * the stats device; returns the number of bytes written. */
+size_t lodev_info(char *buf, size_t size);
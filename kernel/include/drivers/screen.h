@@ -59,6 +59,8 @@ void vga_init();
 
 void vga_write_char_at(size_t row, size_t col, uint16_t v);
 
+void vga_scroll_up(size_t lines);
+
 void vga_set_cursor(size_t row, size_t col);
 
 void vga_clear_screen();
@@ -0,0 +1,9 @@
+#pragma once
+
+/**
+ * Registers the kernel statistics character devices (major STAT_MAJOR, one
+ * minor per metric - see dev.h). Each device formats a text snapshot of its
+ * metric on every read, so monitoring tools can poll them through the
+ * normal do_read() path.
+ */
+void statdev_init(void);
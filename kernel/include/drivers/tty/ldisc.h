@@ -53,8 +53,18 @@ typedef struct ldisc
                          // 1 -> full
                          // 0 -> not full  
 
-    ktqueue_t ldisc_read_queue; // Queue for threads waiting for data to be read 
+    ktqueue_t ldisc_read_queue; // Queue for threads waiting for data to be read
     char ldisc_buffer[LDISC_BUFFER_SIZE];
+
+    /*
+     * Batched output state: ldisc_key_pressed stages its echo bytes and
+     * reader wakeups here instead of performing them inline, and
+     * ldisc_flush_batch emits them once per burst of input (see the tty
+     * input worker in tty.c).
+     */
+    char ldisc_echo_buffer[LDISC_BUFFER_SIZE]; // echo bytes staged for the vterminal
+    size_t ldisc_echo_len;                     // number of staged echo bytes
+    char ldisc_wakeup_pending;                 // a line was cooked since the last flush
 } ldisc_t;
 
 void ldisc_init(ldisc_t *ldisc);
@@ -65,4 +75,6 @@ size_t ldisc_read(ldisc_t *ldisc, char *buf, size_t count);
 
 void ldisc_key_pressed(ldisc_t *ldisc, char c);
 
+void ldisc_flush_batch(ldisc_t *ldisc);
+
 size_t ldisc_get_current_line_raw(ldisc_t *ldisc, char *s);
\ No newline at end of file
@@ -6,17 +6,42 @@
 
 #define TTY_MAJOR 2
 #define cd_to_tty(cd) \
-    CONTAINER_OF((cd), tty_t, tty_cdev) 
+    CONTAINER_OF((cd), tty_t, tty_cdev)
+
+/* Size of the staging ring between tty_write and the deferred output
+ * drain (see tty.c); must be a power of two (the head and tail are
+ * free-running counters) and comfortably exceed the drain chunk. */
+#define TTY_OUT_RING_SIZE 1024
+#define TTY_OUT_RING_MASK (TTY_OUT_RING_SIZE - 1)
 
 typedef struct tty
 {
     vterminal_t tty_vterminal; // the virtual terminal, where the characters will be displayed
-    ldisc_t tty_ldisc; // the line discipline for the tty 
-    chardev_t tty_cdev; // the super struct for the tty 
+    ldisc_t tty_ldisc; // the line discipline for the tty
+    chardev_t tty_cdev; // the super struct for the tty
     kmutex_t tty_read_mutex;
     kmutex_t tty_write_mutex;
     spinlock_t tty_lock;
+
+    /* Output ring between writers and the softirq drain: tty_write only
+     * stages bytes here, so no single tty_lock hold spans more than one
+     * bounded chunk of screen work (see tty_output_drain in tty.c). All
+     * fields are protected by tty_lock. */
+    char tty_out_ring[TTY_OUT_RING_SIZE];
+    size_t tty_out_head;     /* next slot to fill (writers) */
+    size_t tty_out_tail;     /* next slot to drain (softirq) */
+    long tty_out_sched;      /* a drain is queued or in progress */
+    ktqueue_t tty_out_waitq; /* writers waiting for ring space */
 } tty_t;
 
 void tty_init(void);
 
+/**
+ * Creates and starts the tty input worker, which drains bursts of keyboard
+ * input accumulated by the interrupt handler and runs them through the line
+ * discipline with batched echo and reader wakeups. Until it is started,
+ * input is processed synchronously in the interrupt handler. Called once
+ * from initproc_start().
+ */
+void tty_input_start(void);
+
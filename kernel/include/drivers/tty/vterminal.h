@@ -147,6 +147,9 @@ void vterminal_scroll_to_bottom(vterminal_t *vt);
     (vtattr_t) { 0, VTC_DEFAULT_FOREGROUND, VTC_DEFAULT_BACKGROUND }
 #define VTC_ANSI_PARSER_STACK_SIZE 8
 
+/* Rows of output kept after they scroll off the top of the console. */
+#define VTC_SCROLLBACK_LINES 100
+
 struct vtconsole;
 
 typedef enum
@@ -218,6 +221,23 @@ typedef struct vtconsole
     int tab_index;
     vtcursor_t cursor;
 
+    /*
+     * Damage tracking: bit y set means row y must be repainted. Cell
+     * mutations only mark rows here; vtconsole_flush_damage repaints the
+     * dirty rows once per batch of console activity.
+     */
+    uint32_t damage;
+
+    /*
+     * Off-screen scrollback: a ring of rows that have scrolled off the top
+     * of the console. sb_view is how many rows the user has scrolled back
+     * into it (0 = the live screen); new output snaps the view back.
+     */
+    vtcell_t *scrollback;
+    int sb_next;  /* ring slot the next evicted row is stored in */
+    int sb_count; /* rows currently stored */
+    int sb_view;  /* rows scrolled back in the view */
+
     vtc_paint_handler_t on_paint;
     vtc_cursor_handler_t on_move;
 } vtconsole_t;
@@ -235,6 +255,7 @@ void vtconsole_newline(vtconsole_t *vtc);
 
 void vtconsole_putchar(vtconsole_t *vtc, char c);
 void vtconsole_write(vtconsole_t *vtc, const char *buffer, uint32_t size);
+void vtconsole_flush_damage(vtconsole_t *vtc);
 
 size_t vterminal_write(vterminal_t *vt, const char *buf, size_t len);
 
@@ -247,3 +268,5 @@ void vterminal_scroll_to_bottom(vterminal_t *vt);
 void vterminal_init(vterminal_t *vt);
 
 void vterminal_make_active(vterminal_t *vt);
+
+void vterminal_scroll(vterminal_t *vt, long count);
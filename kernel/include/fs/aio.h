@@ -0,0 +1,77 @@
+#pragma once
+
+#include "mm/page.h"
+#include "types.h"
+
+struct proc;
+
+/*
+ * Asynchronous file I/O: a process submits descriptors with aio_submit
+ * and collects completions from a shared-memory ring set up by
+ * aio_setup, overlapping its own computation with disk access without
+ * forking helpers. Requests are serviced by a small pool of kernel
+ * worker threads (see fs/aio.c); ordering between outstanding requests
+ * is not guaranteed, which is why each completion echoes the
+ * submitter's cookie.
+ *
+ * The layout of aio_iocb, aio_event and aio_ring is shared with
+ * userland (user/include/sys/aio.h) and must not change independently.
+ */
+
+#define AIO_READ 0
+#define AIO_WRITE 1
+#define AIO_FSYNC 2
+
+/* Cap on iocbs accepted by one aio_submit call. */
+#define AIO_MAX_SUBMIT 32
+
+/* One submitted operation. aio_id is an opaque cookie echoed in the
+ * completion event. The buffer must stay mapped (and, for reads,
+ * writable) until the completion for this iocb has been posted. */
+typedef struct aio_iocb
+{
+    int aio_fd;
+    int aio_op;
+    long aio_id;
+    void *aio_buf;
+    size_t aio_count;
+    size_t aio_offset;
+} aio_iocb_t;
+
+typedef struct aio_event
+{
+    long ae_id;        /* the submitter's aio_id */
+    ssize_t ae_result; /* bytes transferred or -errno */
+} aio_event_t;
+
+/*
+ * Header of the completion ring, which occupies one page mapped shared
+ * into the submitting process. The kernel is the only writer of ar_tail
+ * and the events; userland consumes by reading ar_events[ar_head %
+ * ar_nr] while ar_head != ar_tail and then advancing ar_head. A
+ * misbehaving consumer can only lose its own completions.
+ */
+typedef struct aio_ring
+{
+    volatile uint64_t ar_head;
+    volatile uint64_t ar_tail;
+    uint64_t ar_nr;
+    uint64_t ar_pad;
+    aio_event_t ar_events[];
+} aio_ring_t;
+
+#define AIO_RING_EVENTS ((PAGE_SIZE - sizeof(aio_ring_t)) / sizeof(aio_event_t))
+
+/* Spawns the worker thread pool; called once at boot. */
+void aio_start(void);
+
+long do_aio_setup(void **ret);
+
+long do_aio_submit(aio_iocb_t *iocbs, size_t nr);
+
+long do_aio_wait(long min);
+
+/* Cancels the exiting process's queued requests and waits out the
+ * in-flight ones; called from proc_cleanup before the address space and
+ * file table can go away. */
+void aio_proc_cleanup(struct proc *proc);
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "types.h"
+
+struct vnode;
+
+/* The directory entry cache maps (parent directory, component name) pairs to
+ * inode numbers so that repeated path resolution of hot paths can skip the
+ * filesystem's lookup operation (for s5fs, a linear scan of directory blocks
+ * through the page cache). Failed lookups are cached as negative entries.
+ *
+ * The cache holds no vnode references; positive hits are re-acquired with
+ * vget(). Any operation that creates, removes, or renames a directory entry
+ * must call dcache_remove() for the affected (directory, name) pairs. */
+
+/* Initializes the directory entry cache. Called once from vfs_init(). */
+void dcache_init();
+
+/* Consult the cache for name in the directory dir.
+ *
+ * Returns 1 on a positive hit, in which case *res_vnode refers to the child
+ * with a reference added (as with the lookup vnode operation); -ENOENT on a
+ * negative hit; and 0 on a miss. */
+long dcache_lookup(struct vnode *dir, const char *name, size_t namelen,
+                   struct vnode **res_vnode);
+
+/* Record the result of a lookup of name in dir. A null child caches the
+ * nonexistence of the name (a negative entry). */
+void dcache_insert(struct vnode *dir, const char *name, size_t namelen,
+                   struct vnode *child);
+
+/* Drop any cached entry (positive or negative) for name in dir. Must be
+ * called when a directory entry is created, unlinked, or renamed. Also
+ * advances the namespace generation, invalidating every full-path entry
+ * cached before the call. */
+void dcache_remove(struct vnode *dir, const char *name, size_t namelen);
+
+/* Alongside the per-component cache there is a full-path cache mapping
+ * (starting directory, exact remaining path) to the finally resolved
+ * inode, so an exact-repeat resolution of a deep path skips the
+ * per-component walk and its locking entirely. Entries carry the
+ * namespace generation they were minted under and die wholesale when any
+ * entry anywhere is created, unlinked, renamed, or (un)mounted; repeated
+ * lookups of stable paths - the common hot case - rebuild quickly. */
+
+/* Consult the full-path cache for path resolved from base (or from the
+ * root, for an absolute path). Returns 1 on a hit, with *res_vnode
+ * referenced as namev_resolve would return it, and 0 on a miss. */
+long dcache_path_lookup(struct vnode *base, const char *path,
+                        struct vnode **res_vnode);
+
+/* Record that resolving path from base yielded res_vnode. generation must
+ * be the value dcache_path_generation() returned before the resolution
+ * began; if the namespace changed in between, the result is not cached. */
+void dcache_path_insert(struct vnode *base, const char *path,
+                        struct vnode *res_vnode, uint64_t generation);
+
+/* The current namespace generation, sampled before a resolution so that
+ * dcache_path_insert can tell whether the result is still trustworthy. */
+uint64_t dcache_path_generation();
+
+/* Advance the namespace generation without touching the per-component
+ * cache; called on mount and unmount. */
+void dcache_path_invalidate();
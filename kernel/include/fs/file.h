@@ -1,11 +1,17 @@
 #pragma once
 
+#include "config.h"
 #include "types.h"
+#include "util/reclaim.h"
+#include "util/refcount.h"
 
 #define FMODE_READ 1
 #define FMODE_WRITE 2
 #define FMODE_APPEND 4
-#define FMODE_MAX_VALUE (FMODE_READ | FMODE_WRITE | FMODE_APPEND)
+#define FMODE_DIRECT 8
+#define FMODE_NONBLOCK 16
+#define FMODE_MAX_VALUE \
+    (FMODE_READ | FMODE_WRITE | FMODE_APPEND | FMODE_DIRECT | FMODE_NONBLOCK)
 
 struct vnode;
 
@@ -19,24 +25,105 @@ typedef struct file
     size_t f_pos;
 
     /*
-     * The mode in which this file was opened. This is a mask of the flags
-     * FMODE_READ, FMODE_WRITE, and FMODE_APPEND. It is set when the file
+     * The mode in which this file was opened. This is a mask of the FMODE_*
+     * flags above. It is set when the file
      * is first opened, and use to restrict the operations that can be
      * performed on the underlying vnode.
      */
     unsigned int f_mode;
 
     /*
-     * The number of references to this struct. 
+     * The most recent access-pattern steering hint given for this open
+     * file via do_fadvise (one of fcntl.h's FADV_NORMAL, FADV_SEQUENTIAL,
+     * or FADV_RANDOM; zero, the default, is FADV_NORMAL). Forwarded to
+     * the filesystem, which uses it to steer readahead.
      */
-    size_t f_refcount;
+    int f_advice;
+
+    /*
+     * The number of references to this struct. Maintained atomically so
+     * fget can take a reference with a plain load and one atomic
+     * increment, with no process-wide lock (see fget for the publish
+     * protocol this relies on).
+     */
+    refcount_t f_refcount;
 
     /*
      * The vnode which corresponds to this file.
      */
     struct vnode *f_vnode;
+
+    /*
+     * Deferral record used to free this struct through the epoch
+     * reclaimer, so a lock-free fget that loaded a stale table pointer
+     * never dereferences freed memory (see fput).
+     */
+    reclaim_node_t f_reclaim;
 } file_t;
 
+/*
+ * A process's descriptor table. fork does not copy one of these: the child
+ * shares the parent's table by reference (one atomic increment instead of
+ * NFILES refs under the process list lock), and the table is copied lazily
+ * the first time either side modifies it - open, close, or dup - by
+ * fdtable_unshare. Lookups (fget) therefore always see an immutable
+ * snapshot or the process's own private copy; only the owning process
+ * mutates its table, so no table-wide lock is needed.
+ */
+typedef struct fdtable
+{
+    /*
+     * The number of processes sharing this table. While it is greater
+     * than one, the table is a frozen snapshot: slots and close-on-exec
+     * bits are never written, only the whole table replaced via
+     * fdtable_unshare.
+     */
+    refcount_t fdt_refcount;
+
+    /*
+     * Bitmap of descriptors to be closed on a successful execve or spawn
+     * (bit fd set == FD_CLOEXEC); see fdtable_close_exec. NFILES is small
+     * enough that one word covers the whole table.
+     */
+    unsigned long fdt_cloexec;
+
+    struct file *fdt_files[NFILES];
+} fdtable_t;
+
+/*
+ * Allocate an empty descriptor table with a refcount of one, or return
+ * NULL on failure.
+ */
+fdtable_t *fdtable_create(void);
+
+/*
+ * Share table with one more process (fork); just bumps the refcount and
+ * returns table.
+ */
+fdtable_t *fdtable_clone(fdtable_t *table);
+
+/*
+ * Drop one process's reference to the table, NULLing *tablep. The last
+ * reference fputs every open slot and frees the table.
+ */
+void fdtable_put(fdtable_t **tablep);
+
+/*
+ * Make curproc's descriptor table safe to modify: if it is still shared
+ * with another process, replace it with a private copy (taking a ref on
+ * every open file) and drop the shared one. No-op when already private.
+ * Returns 0, or -ENOMEM if the copy cannot be allocated, in which case
+ * the table is unchanged.
+ */
+long fdtable_unshare(void);
+
+/*
+ * Close every descriptor marked close-on-exec in curproc's table, for
+ * execve and spawn. Best-effort: if the table is shared and the private
+ * copy cannot be allocated, the descriptors stay open.
+ */
+void fdtable_close_exec(void);
+
 struct file *fcreate(int fd, struct vnode *vnode, unsigned int mode);
 
 /*
@@ -0,0 +1,27 @@
+#pragma once
+
+/* Poll event bits and the pollfd structure, shared with userland (see
+ * user/include/poll.h and do_poll in fs/vfs_syscall.c). */
+
+typedef unsigned long nfds_t;
+
+struct pollfd
+{
+    int fd;        /* file descriptor, or negative to ignore the entry */
+    short events;  /* requested events (POLLIN / POLLOUT) */
+    short revents; /* returned events */
+};
+
+#define POLLIN 0x1    /* reading would not block */
+#define POLLOUT 0x4   /* writing would not block */
+#define POLLERR 0x8   /* error condition (e.g. pipe with no readers) */
+#define POLLHUP 0x10  /* hung up (e.g. pipe with no writers) */
+#define POLLNVAL 0x20 /* fd is not open */
+
+/* Cap on nfds for one call; keeps the kernel copy of the array to a page. */
+#define POLL_MAX_NFDS 512
+
+/* Wakes any do_poll sleepers so they re-evaluate readiness. Event sources
+ * (currently the pipe code) call this whenever a pollable condition may
+ * have changed; it is cheap when nothing is polling. */
+void poll_notify(void);
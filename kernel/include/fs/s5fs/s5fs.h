@@ -26,10 +26,18 @@
 #define S5_NBLKS_PER_FNODE 30
 
 #define S5_BLOCK_SIZE 4096
-#define S5_NDIRECT_BLOCKS 28
+/* Version 4 of the disk format gave up two direct blocks to make room in
+ * the inode for the double (and reserved triple) indirect pointers. */
+#define S5_NDIRECT_BLOCKS 26
+
+/* Bounds for the adaptive per-file readahead window, in file blocks
+ * (see s5_read_file and _s5_ra_ceiling in s5fs_subr.c). */
+#define S5_RA_WINDOW_MIN 2
+#define S5_RA_WINDOW_MAX 32
 #define S5_INODES_PER_BLOCK (S5_BLOCK_SIZE / sizeof(s5_inode_t))
 #define S5_DIRENTS_PER_BLOCK (S5_BLOCK_SIZE / sizeof(s5_dirent_t))
-#define S5_MAX_FILE_BLOCKS (S5_NDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS)
+#define S5_MAX_FILE_BLOCKS \
+    (S5_NDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS + S5_NDINDIRECT_BLOCKS)
 #define S5_MAX_FILE_SIZE (S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE)
 #define S5_NAME_LEN 28
 
@@ -38,12 +46,33 @@
 #define S5_TYPE_DIR 0x2
 #define S5_TYPE_CHR 0x4
 #define S5_TYPE_BLK 0x8
+#define S5_TYPE_LNK 0x10 /* symlink; target path stored as file data */
 
 #define S5_MAGIC 071177
-#define S5_CURRENT_VERSION 3
+/* Version 5 appended the access-time field to the inode. */
+#define S5_CURRENT_VERSION 5
+
+/* Size of a block-allocation group (4MB of disk) and the number of striped
+ * locks the groups share; both are in-memory notions, not disk format. */
+#define S5_ALLOC_GROUP_BLOCKS 1024
+#define S5_ALLOC_GROUP_LOCKS 16
+
+/* Most blocks one group-committed fsync transaction can carry (see
+ * s5_journal_group_commit); must fit a journal transaction with its
+ * descriptor and commit blocks. */
+#define S5_GROUP_COMMIT_BATCH 32
 
-/* Number of blocks stored in the indirect block */
+/* Reach of the per-file dirty-block bitmap (see s5n_dirty_blocks) in file
+ * blocks, and the words that takes. The double-indirect range pushed the
+ * maximum file far past what an inline per-block map can cover, so blocks
+ * beyond this set a spill flag instead. */
+#define S5_DIRTY_MAP_BLOCKS 2048
+#define S5_DIRTY_MAP_WORDS (S5_DIRTY_MAP_BLOCKS / 64)
+
+/* Number of blocks stored in the indirect block, and in the two-level tree
+ * hanging off the double indirect block. */
 #define S5_NIDIRECT_BLOCKS (S5_BLOCK_SIZE / sizeof(uint32_t))
+#define S5_NDINDIRECT_BLOCKS (S5_NIDIRECT_BLOCKS * S5_NIDIRECT_BLOCKS)
 
 /* Given a file offset, returns the block number that it is in */
 #define S5_DATA_BLOCK(seekptr) ((seekptr) / S5_BLOCK_SIZE)
@@ -87,8 +116,49 @@ typedef struct s5_super
     uint32_t s5s_root_inode; /* root inode */
     uint32_t s5s_num_inodes; /* number of inodes */
     uint32_t s5s_version;    /* version of this disk format */
+
+    /* Metadata journal region (see s5fs_journal.c), carved out of the free
+     * blocks on first mount. Disks formatted before the journal existed
+     * have zeros here (the super block is zero-filled past the struct), so
+     * the fields double as a "no journal yet" marker. */
+    uint32_t s5s_journal_block; /* first block of the journal, or 0 */
+    uint32_t s5s_journal_size;  /* size of the journal in blocks */
+
+    /* Nonzero iff the disk was formatted with the extent option (fsmaker
+     * "format -e"): regular files created by the kernel then map their data
+     * in (start, length) runs instead of per-block pointers (see
+     * s5_extent_t). Zero-filled on disks formatted without the option. */
+    uint32_t s5s_extents;
+
+    /* Persisted allocation-bitmap region (see s5_sync_free_list), carved
+     * out of the free blocks like the journal: one block of per-group
+     * summaries (s5_group_summary_t) followed by the raw bitmap. Written
+     * whenever the free list is synced, so it is exactly as fresh as the
+     * free list; a mount that finds it skips the free-list walk and loads
+     * each group's bitmap slice on first use. Zeros on disks from before
+     * the region existed (or when no free run could be carved). */
+    uint32_t s5s_bmap_block;  /* first block (the summary block), or 0 */
+    uint32_t s5s_bmap_blocks; /* total region size in blocks */
+    uint32_t s5s_bmap_bits;   /* block bits covered when last written */
 } s5_super_t;
 
+/* One allocation group's entry in the persisted summary block: enough to
+ * size the in-memory free counts and steer allocation into the group
+ * without reading the group's slice of the bitmap itself. */
+typedef struct s5_group_summary
+{
+    uint32_t gs_nfree;      /* free blocks in the group */
+    uint32_t gs_first_free; /* lower bound on the group's first free
+                             * block, group-relative */
+} packed s5_group_summary_t;
+
+/* Groups whose summaries fit in the region's single summary block; disks
+ * with more groups than this simply go unpersisted. */
+#define S5_BMAP_SUMMARY_GROUPS (S5_BLOCK_SIZE / sizeof(s5_group_summary_t))
+
+/* Block bits held by each block of the region's raw-bitmap part. */
+#define S5_BMAP_BITS_PER_BLOCK (S5_BLOCK_SIZE * 8)
+
 /* The contents of an inode, as stored on disk. */
 typedef struct s5_inode
 {
@@ -101,17 +171,126 @@ typedef struct s5_inode
     int16_t s5_linkcount; /* link count of this inode */
     uint32_t s5_direct_blocks[S5_NDIRECT_BLOCKS];
     uint32_t s5_indirect_block;
+    uint32_t s5_dindirect_block; /* two-level indirect tree */
+    uint32_t s5_flags;           /* S5_IFLAG_*; 0 on block-mapped inodes */
+    uint32_t s5_atime;           /* access time, seconds since the epoch;
+                                  * updated lazily (see s5_touch_atime) */
 } s5_inode_t;
 
+/* The inode is extent-mapped: the s5_direct_blocks area holds s5_extent_t
+ * runs instead of block pointers, s5_indirect_block points to one overflow
+ * block of further runs (or is 0), and s5_dindirect_block is unused. Set at
+ * inode creation on disks formatted with the extent option (s5s_extents)
+ * and never changed afterwards. */
+#define S5_IFLAG_EXTENTS 0x1
+
+/* One extent: s5e_nblocks consecutive file blocks starting at
+ * s5e_file_block stored in consecutive disk blocks starting at
+ * s5e_disk_block. An entry with s5e_nblocks == 0 is unused; entries never
+ * overlap and are in no particular order. Sequential writes grow the run
+ * they land at the end of whenever the next disk block is still free, so a
+ * file streamed onto a quiet disk is typically described by a handful of
+ * runs that the SATA scatter-gather path can fetch in single commands. */
+typedef struct s5_extent
+{
+    uint32_t s5e_file_block;
+    uint32_t s5e_disk_block;
+    uint32_t s5e_nblocks;
+} s5_extent_t;
+
+/* Extents stored inline in the inode's s5_direct_blocks area, and in the
+ * overflow block. */
+#define S5_INODE_EXTENTS \
+    (S5_NDIRECT_BLOCKS * sizeof(uint32_t) / sizeof(s5_extent_t))
+#define S5_EXTENTS_PER_BLOCK (S5_BLOCK_SIZE / sizeof(s5_extent_t))
+
+#define S5_INODE_EXTENT_ARRAY(inode) ((s5_extent_t *)(inode)->s5_direct_blocks)
+
 typedef struct s5_node
 {
     vnode_t vnode;
     s5_inode_t inode;
     long dirtied_inode;
+
+    /* Link on the mount's queue of nodes with dirty inodes (see
+     * s5_dirty_inode); while linked, the queue holds a reference on the
+     * vnode so the node outlives the next writeback pass. */
+    list_link_t s5n_dirty_link;
+
+    /* Sequential-read detection for readahead, protected by the vnode's
+     * lock: the file block the next sequential read would start at, the
+     * number of consecutive sequential s5_read_file calls observed, the
+     * current prefetch window in blocks (doubles per confirmed
+     * sequential read between S5_RA_WINDOW_MIN and the hit-rate-driven
+     * ceiling; see _s5_ra_ceiling), and the steering hint most recently
+     * applied through s5_advise (FADV_NORMAL unless told otherwise). */
+    size_t s5n_ra_next;
+    size_t s5n_ra_streak;
+    size_t s5n_ra_window;
+    int s5n_ra_advice;
+
+    /* Allocation hint, protected by the vnode's lock: the disk block just
+     * past this file's most recent allocation, so sequential writes get
+     * physically contiguous runs of blocks. */
+    blocknum_t s5n_alloc_hint;
+
+    /* Reservation window (see s5_alloc_block), protected by the mount's
+     * s5f_resv_spin: a run of s5n_resv_count disk blocks starting at
+     * s5n_resv_start, already claimed in the bitmap for this file but not
+     * yet assigned to file slots, so a regular file's consecutive
+     * allocations come out of one contiguous run even when many files
+     * are being written at once. While a window exists the node sits on
+     * the mount's s5f_resv_nodes list so unused tails can be returned to
+     * the free set before the free list is synced. */
+    blocknum_t s5n_resv_start;
+    size_t s5n_resv_count;
+    list_link_t s5n_resv_link;
+
+    /* Lazily built name index for directories, protected by the vnode's
+     * lock: NULL until the first s5_find_dirent builds it (see
+     * s5fs_subr.c), then maintained by s5_link/s5_remove_dirent. When a
+     * build fails for lack of memory, s5n_dirhash_retry holds the
+     * jiffies value before which it will not be attempted again, so a
+     * create or lookup burst under memory pressure does not pay a full
+     * directory scan per operation for nothing. */
+    struct s5_dirhash *s5n_dirhash;
+    uint64_t s5n_dirhash_retry;
+
+    /* One-entry cache of the most recently resolved leaf indirect block
+     * in the double-indirect range, protected by the vnode's lock: the
+     * top-level slot (plus one, so 0 means empty) and the leaf's disk
+     * block. Sequential I/O stays within one leaf for S5_NIDIRECT_BLOCKS
+     * file blocks, so this skips re-reading the top-level block per
+     * block. Invalidated when the file's blocks are removed. */
+    size_t s5n_leaf_cache_slot;
+    blocknum_t s5n_leaf_cache_block;
+
+    /* Bitmap of this file's blocks dirtied in the disk cache since the
+     * last fsync, protected by the vnode's lock. Bit b covers file block
+     * b for the first S5_DIRTY_MAP_BLOCKS blocks; dirtying a block past
+     * that sets s5n_dirty_spill, and the next fsync falls back to
+     * flushing the whole disk cache. fsync I/O is thus proportional to
+     * the file's own dirty pages for all but enormous files. */
+    uint64_t s5n_dirty_blocks[S5_DIRTY_MAP_WORDS];
+    long s5n_dirty_spill;
 } s5_node_t;
 
 #define VNODE_TO_S5NODE(vn) CONTAINER_OF(vn, s5_node_t, vnode)
 
+/* Record that file block blocknum of sn was dirtied in the disk cache.
+ * Called with the vnode locked. */
+static inline void s5_dirty_data_block(s5_node_t *sn, size_t blocknum)
+{
+    if (blocknum < S5_DIRTY_MAP_BLOCKS)
+    {
+        sn->s5n_dirty_blocks[blocknum / 64] |= 1ul << (blocknum % 64);
+    }
+    else
+    {
+        sn->s5n_dirty_spill = 1;
+    }
+}
+
 /* The contents of a directory entry, as stored on disk. */
 typedef struct s5_dirent
 {
@@ -127,13 +306,108 @@ typedef struct s5fs
     s5_super_t s5f_super;
     kmutex_t s5f_mutex;
     fs_t *s5f_fs;
+
+    /* In-memory block allocation bitmap: bit n is set iff disk block n is
+     * free. Built from the on-disk free list at mount
+     * (s5_build_block_bitmap) and serialized back into free-list form at
+     * sync (s5_sync_free_list). The bitmap is partitioned into allocation
+     * groups of S5_ALLOC_GROUP_BLOCKS blocks, each with its own free
+     * count; a group's count and its slice of the bitmap are protected by
+     * the group's striped mutex (group mod S5_ALLOC_GROUP_LOCKS), so
+     * writers to different files can allocate in parallel. Lock order:
+     * group mutexes (ascending) before s5f_mutex, which still covers the
+     * superblock, the inode free list, and bitmap growth. */
+    uint64_t *s5f_block_bitmap;
+    size_t s5f_bitmap_size;  /* number of block bits in the bitmap */
+    size_t *s5f_group_nfree; /* free blocks in each allocation group */
+    size_t s5f_ngroups;
+    kmutex_t s5f_group_mutex[S5_ALLOC_GROUP_LOCKS];
+
+    /* Per-group word index below which the group has no free block - a
+     * lower bound, so allocation scans can start there instead of at the
+     * group base. Loaded from the persisted summaries when available. */
+    uint32_t *s5f_group_ffree;
+
+    /* When the bitmap was loaded from the persisted region rather than
+     * rebuilt from the free list, bit g is set once group g's slice of
+     * the bitmap has been read in (see s5_group_ensure_loaded); NULL on
+     * mounts that walked the free list, meaning every group is loaded. */
+    uint64_t *s5f_group_loaded;
+
+    /* Wall-clock time corresponding to uptime zero, captured at mount so
+     * access-time stamps are a cheap uptime read rather than an RTC one. */
+    time_t s5f_mount_epoch;
+
+    /* State of this mount's write-behind daemon (see s5fs_writeback_run);
+     * every mount gets its own daemon so one mount's I/O load cannot
+     * starve another's writeback. The daemon serializes its passes with
+     * sync and unmount through s5f_wb_mutex and sleeps on s5f_wb_waitq
+     * (under s5f_wb_spin) between passes. s5f_wb_exit is -1 when no
+     * daemon was started, 0 while it runs, 1 once unmount asks it to
+     * stop, and 2 once it has. */
+    kmutex_t s5f_wb_mutex;
+    spinlock_t s5f_wb_spin;
+    ktqueue_t s5f_wb_waitq;
+    long s5f_wb_exit;
+
+    /* Nodes whose in-memory inodes are dirty, queued by s5_dirty_inode and
+     * drained by the writeback daemon, which groups inodes sharing a disk
+     * block so the block is updated and flushed once per pass. */
+    list_t s5f_dirty_nodes;
+
+    /* Nodes holding a block-reservation window (see s5n_resv_start) and
+     * the spinlock covering the list and every node's window fields;
+     * s5_resv_release_all drains the list before each free-list sync so
+     * reserved-but-unused blocks never reach the disk as allocated. */
+    list_t s5f_resv_nodes;
+    spinlock_t s5f_resv_spin;
+
+    /* Metadata journal state (see s5fs_journal.c): the next transaction
+     * sequence number, a page buffer for journal records (serialized by
+     * the writeback mutex), and a growable bitmap marking which blocks
+     * currently hold metadata beyond the fixed inode region (indirect
+     * blocks and directory contents). */
+    uint32_t s5f_journal_seq;
+    void *s5f_journal_buf;
+    uint64_t *s5f_meta_bitmap;
+    size_t s5f_meta_bitmap_size;
+
+    /* Group-commit state for fsync (see s5_journal_group_commit): fsyncs
+     * arriving close together merge their metadata blocks into the open
+     * transaction, numbered s5f_txn_open; one of them leads, waits a
+     * short join window, and journals the merged batch once for
+     * everyone. s5f_txn_done is the last transaction committed and
+     * s5f_txn_err the most recent commit's flush status; all of it is
+     * protected by s5f_txn_spin, with waiters parked on s5f_txn_waitq. */
+    blocknum_t s5f_txn_blocks[S5_GROUP_COMMIT_BATCH];
+    size_t s5f_txn_count;
+    uint64_t s5f_txn_open;
+    uint64_t s5f_txn_done;
+    long s5f_txn_leader;
+    long s5f_txn_err;
+    spinlock_t s5f_txn_spin;
+    ktqueue_t s5f_txn_waitq;
 } s5fs_t;
 
 long s5fs_mount(struct fs *fs);
 
+/**
+ * Starts the s5fs writeback daemon, which periodically flushes dirty disk
+ * blocks in LBA-sorted batches rather than leaving all flushing to unmount
+ * and eviction. Called once at boot.
+ */
+void s5fs_writeback_start(void);
+
+/* Snapshot of the adaptive readahead window state, for /dev/stats
+ * (see _s5_ra_ceiling in s5fs_subr.c). */
+size_t s5_readahead_info(char *buf, size_t size);
+
 void s5_get_disk_block(s5fs_t *s5fs, blocknum_t blocknum, long forwrite,
                        pframe_t **pfp);
 
+void s5_get_disk_block_overwrite(s5fs_t *s5fs, blocknum_t blocknum,
+                                 pframe_t **pfp);
+
 void s5_release_disk_block(pframe_t **pfp);
 
 #endif
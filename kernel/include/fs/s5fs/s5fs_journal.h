@@ -0,0 +1,27 @@
+/*
+ *   FILE: s5fs_journal.h
+ *  DESCR: write-ahead metadata journal for s5fs
+ */
+
+#pragma once
+
+#include "fs/s5fs/s5fs.h"
+
+/* On-disk size of the journal region, in blocks: a descriptor block, a
+ * commit block, and room for one writeback batch of metadata copies. */
+#define S5_JOURNAL_BLOCKS 64
+
+void s5_journal_recover(s5fs_t *s5fs);
+
+long s5_journal_init(s5fs_t *s5fs);
+
+size_t s5_journal_log(s5fs_t *s5fs, const blocknum_t *blocks, size_t count);
+
+void s5_journal_checkpoint(s5fs_t *s5fs);
+
+long s5_journal_group_commit(s5fs_t *s5fs, const blocknum_t *blocks,
+                             size_t count);
+
+void s5_meta_mark(s5fs_t *s5fs, blocknum_t blockno);
+
+void s5_meta_clear(s5fs_t *s5fs, blocknum_t blockno);
@@ -15,11 +15,21 @@ long s5_alloc_inode(struct s5fs *s5fs, uint16_t type, devid_t devid);
 
 void s5_free_inode(struct s5fs *s5fs, ino_t ino);
 
+void s5_dirty_inode(struct s5_node *sn);
+
 ssize_t s5_read_file(struct s5_node *vn, size_t pos, char *buf, size_t len);
 
 ssize_t s5_write_file(struct s5_node *vn, size_t pos, const char *buf,
                       size_t len);
 
+ssize_t s5_direct_read_file(struct s5_node *vn, size_t pos, char *buf,
+                            size_t len);
+
+ssize_t s5_direct_write_file(struct s5_node *vn, size_t pos, const char *buf,
+                             size_t len);
+
+long s5_advise(struct s5_node *sn, int advice);
+
 long s5_link(struct s5_node *dir, const char *name, size_t namelen,
              struct s5_node *child);
 
@@ -29,6 +39,8 @@ long s5_find_dirent(struct s5_node *dir, const char *name, size_t namelen,
 void s5_remove_dirent(struct s5_node *dir, const char *name, size_t namelen,
                       struct s5_node *ent);
 
+void s5_dirhash_destroy(struct s5_node *sn);
+
 void s5_replace_dirent(struct s5_node *sn, const char *name, size_t namelen,
                        struct s5_node *old, struct s5_node *new);
 
@@ -37,8 +49,21 @@ long s5_file_block_to_disk_block(struct s5_node *sn, size_t file_blocknum,
 
 long s5_inode_blocks(struct s5_node *vnode);
 
+void s5_build_block_bitmap(struct s5fs *s5fs);
+
+void s5_sync_free_list(struct s5fs *s5fs);
+
+/* Read in every allocation group's bitmap slice on a mount that loaded
+ * only the persisted group summaries; no-op otherwise. For paths that
+ * walk the whole bitmap rather than single groups. */
+void s5_bitmap_load_all(struct s5fs *s5fs);
+
 void s5_remove_blocks(struct s5_node *vnode);
 
+void s5_resv_release(struct s5fs *s5fs, struct s5_node *sn);
+
+void s5_resv_release_all(struct s5fs *s5fs);
+
 /* Converts a vnode_t* to the s5fs_t* (s5fs file system) struct */
 #define VNODE_TO_S5FS(vn) ((s5fs_t *)((vn)->vn_fs->fs_i))
 
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "fs/vfs.h"
+
+long tmpfs_mount(struct fs *fs);
@@ -4,6 +4,7 @@
 
 #include "fs/open.h"
 #include "proc/kmutex.h"
+#include "proc/krwlock.h"
 #include "util/list.h"
 
 struct vnode;
@@ -45,6 +46,10 @@ typedef struct fs_ops
 #define STR_MAX 32
 #endif
 
+/* Number of buckets in each filesystem's vnode hash table. Must be a
+ * power of two. */
+#define VNODE_HASH_BUCKETS 64
+
 /* similar to Linux's super_block. */
 typedef struct fs
 {
@@ -100,7 +105,23 @@ typedef struct fs
 
     struct slab_allocator *fs_vnode_allocator;
     list_t vnode_list;
-    kmutex_t vnode_list_mutex;
+    /*
+     * Protects vnode_list. Read-mostly: whole-list scans (vfs_is_in_use,
+     * vfs_count_active_vnodes) take it shared, while vget() inserts and the
+     * vnode destructor's removal take it exclusively. Initialized by
+     * vnode_fs_init().
+     */
+    krwlock_t vnode_list_lock;
+
+    /*
+     * Hash table of cached vnodes keyed by inode number, so that vget()
+     * can find an existing vnode without scanning vnode_list. Each bucket
+     * has its own mutex so lookups of different inodes do not serialize
+     * on a single lock. Initialized by vnode_fs_init().
+     */
+    list_t vnode_hash[VNODE_HASH_BUCKETS];
+    kmutex_t vnode_hash_mutexes[VNODE_HASH_BUCKETS];
+
     kmutex_t vnode_rename_mutex;
 
 } fs_t;
@@ -160,3 +181,15 @@ long lookup_dirpath(struct vnode *dir, char *buf, size_t size);
 #endif /* __GETCWD__ */
 
 long mountfunc(fs_t *fs);
+
+#ifdef __MOUNTING__
+extern list_t mounted_fs_list;
+
+int vfs_mount(struct vnode *mtpt, fs_t *fs);
+
+int vfs_umount(fs_t *fs);
+#endif
+
+/* Formats per-mount cache statistics for the mounts stat device (see
+ * vfs_mount_info in vfs.c). */
+size_t vfs_mount_info(char *buf, size_t size);
@@ -4,8 +4,10 @@
 
 #include "types.h"
 
+#include "api/syscall.h"
 #include "fs/open.h"
 #include "fs/pipe.h"
+#include "fs/poll.h"
 #include "fs/stat.h"
 
 long do_close(int fd);
@@ -14,6 +16,22 @@ ssize_t do_read(int fd, void *buf, size_t len);
 
 ssize_t do_write(int fd, const void *buf, size_t len);
 
+ssize_t do_readv(int fd, const iovec_t *iov, size_t iovcnt);
+
+ssize_t do_writev(int fd, const iovec_t *iov, size_t iovcnt);
+
+ssize_t do_pread(int fd, void *buf, size_t len, off_t offset);
+
+ssize_t do_pwrite(int fd, const void *buf, size_t len, off_t offset);
+
+long do_fsync(int fd);
+
+long do_fdatasync(int fd);
+
+ssize_t do_sendfile(int out_fd, int in_fd, size_t count);
+
+long do_fadvise(int fd, int advice);
+
 long do_dup(int fd);
 
 long do_dup2(int ofd, int nfd);
@@ -28,12 +46,24 @@ long do_unlink(const char *path);
 
 long do_link(const char *oldpath, const char *newpath);
 
+long do_symlink(const char *target, const char *linkpath);
+
 long do_rename(const char *oldpath, const char *newpath);
 
 long do_chdir(const char *path);
 
+#ifdef __MOUNTING__
+int do_mount(const char *source, const char *target, const char *type);
+
+int do_umount(const char *target);
+#endif
+
 ssize_t do_getdent(int fd, struct dirent *dirp);
 
+ssize_t do_getdents(int fd, struct dirent *dirp, size_t count);
+
 off_t do_lseek(int fd, off_t offset, int whence);
 
+long do_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
 long do_stat(const char *path, struct stat *uf);
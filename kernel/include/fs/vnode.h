@@ -11,6 +11,7 @@
 #include "drivers/blockdev.h"
 #include "drivers/chardev.h"
 #include "drivers/dev.h"
+#include "fs/stat.h"
 #include "mm/mobj.h"
 #include "mm/pframe.h"
 #include "proc/kmutex.h"
@@ -53,6 +54,58 @@ typedef struct vnode_ops
     ssize_t (*write)(struct vnode *file, size_t pos, const void *buf,
                      size_t count);
 
+    /*
+     * Uncached variants of read and write, used for files opened with
+     * O_DIRECT: data is transferred between buf and the backing store
+     * without populating the file's page cache. Optional; filesystems
+     * that cannot bypass the cache leave these NULL and O_DIRECT files
+     * fall back to the cached operations.
+     */
+    ssize_t (*read_direct)(struct vnode *file, size_t pos, void *buf,
+                           size_t count);
+    ssize_t (*write_direct)(struct vnode *file, size_t pos, const void *buf,
+                            size_t count);
+
+    /*
+     * fsync writes this file's dirty cached blocks, and the metadata
+     * needed to reach them, to the backing store before returning. When
+     * datasync is set, metadata is only written if it is needed to
+     * retrieve the data (e.g. the file's length changed). Optional;
+     * filesystems with no backing store leave this NULL and do_fsync
+     * succeeds trivially. Called with the vnode locked.
+     */
+    long (*fsync)(struct vnode *file, long datasync);
+
+    /*
+     * advise applies an access-pattern hint (one of fcntl.h's FADV_
+     * values) to the file: steering readahead, pre-populating the cache,
+     * or releasing the file's cached pages. Optional and purely advisory;
+     * do_fadvise succeeds trivially when it is NULL. Called with the
+     * vnode locked.
+     */
+    long (*advise)(struct vnode *file, int advice);
+
+    /*
+     * seek_sparse implements lseek's SEEK_DATA and SEEK_HOLE: through
+     * ret, reports the position of the first byte of data (datawise set)
+     * or of the first hole at or after pos, or returns -ENXIO when there
+     * is none before the end of the file. Optional; when NULL, do_lseek
+     * treats the whole file as one data region with an implicit hole at
+     * its end. Called with the vnode locked and pos < vn_len.
+     */
+    long (*seek_sparse)(struct vnode *file, size_t pos, long datawise,
+                        size_t *ret);
+
+    /*
+     * poll reports the subset of events (POLLIN / POLLOUT, see fs/poll.h)
+     * for which fp is currently ready, plus POLLERR / POLLHUP regardless
+     * of events. Must not block; the answer is a snapshot and do_poll
+     * rechecks it after every wakeup. Optional; vnode types without the
+     * op never block reads or writes and are treated by do_poll as always
+     * ready. Called with the vnode locked.
+     */
+    long (*poll)(struct vnode *file, struct file *fp, int events);
+
     /*
      * Implementations should supply an mobj through the "ret"
      * argument (not by setting vma->vma_obj). If for any reason
@@ -261,11 +314,66 @@ typedef struct vnode
     } vn_dev;
 
     /* Used (only) by the v{get,ref,put} facilities (vfs/vnode.c): */
-    list_link_t vn_link; /* link on system vnode list */
+    list_link_t vn_link;  /* link on system vnode list */
+    list_link_t vn_hlink; /* link on the fs's vnode hash bucket */
+
+    /*
+     * Byte-range locking for regular-file I/O (see vnode_range_lock):
+     * the list of currently locked ranges, the spinlock protecting it,
+     * and the queue threads wait on when their range conflicts.
+     */
+    list_t vn_ranges;
+    spinlock_t vn_range_lock;
+    ktqueue_t vn_range_waitq;
+
+    /*
+     * Number of times this vnode has been exec'd, used by the
+     * pinned-binary cache (see vnode_record_exec).
+     */
+    size_t vn_execs;
+
+    /*
+     * Seqlock-protected stat snapshot, so do_stat can be served without
+     * touching the vnode lock (or, for s5fs, the disk block cache).
+     * vn_stat_seq is even while the snapshot is stable and odd while a
+     * refresh is writing it; the snapshot is only believed while
+     * vn_stat_gen matches vn_gen, which metadata writers bump through
+     * vnode_stat_dirty. See vnode_stat in fs/vnode.c.
+     */
+    stat_t vn_stat;
+    uint64_t vn_stat_seq;
+    uint64_t vn_stat_gen;
+    uint64_t vn_gen;
+
+    /*
+     * For symlinks only: the target path, read from the filesystem and
+     * cached here the first time the link is followed (see namev_follow).
+     * Filled lazily under the vnode lock and immutable once set; freed
+     * when the vnode is destroyed.
+     */
+    char *vn_link_target;
 } vnode_t;
 
+/*
+ * A locked byte range of a vnode; stack-allocated by the caller of
+ * vnode_range_lock and linked on the vnode's vn_ranges while held.
+ */
+typedef struct vnode_range
+{
+    size_t vr_start; /* inclusive */
+    size_t vr_end;   /* exclusive */
+    long vr_write;
+    list_link_t vr_link;
+} vnode_range_t;
+
 void init_special_vnode(vnode_t *vn);
 
+/*
+ * Initializes a filesystem's vnode hash table (vnode_hash and the
+ * per-bucket mutexes). Must be called before the first vget() on the fs.
+ */
+void vnode_fs_init(struct fs *fs);
+
 /* Core vnode management routines: */
 /*
  *     Obtain a vnode representing the file that filesystem 'fs' identifies
@@ -332,6 +440,56 @@ void vref(vnode_t *vn);
  */
 void vput(vnode_t **vnp);
 
+/*
+ * Locks the byte range [start, end) of the vnode for I/O, blocking while
+ * any held range overlaps it (two read locks may overlap). vr is
+ * caller-provided storage, typically on the stack, and must stay valid
+ * until the matching vnode_range_unlock. This serializes overlapping
+ * regular-file I/O while letting non-overlapping operations proceed
+ * concurrently; the filesystem takes the vnode mutex a block at a time
+ * underneath (see s5_read_file).
+ *
+ * Lock ordering: a range lock is taken before the vnode mutex, never
+ * while holding it.
+ */
+void vnode_range_lock(vnode_t *vn, vnode_range_t *vr, size_t start, size_t end,
+                      long forwrite);
+
+/*
+ * Releases a byte range taken with vnode_range_lock and wakes any
+ * waiters whose ranges conflicted with it.
+ */
+void vnode_range_unlock(vnode_t *vn, vnode_range_t *vr);
+
+/*
+ * Fills buf from the vnode's stat snapshot when it is still valid - a
+ * lockless read retried under the seqlock - and otherwise refreshes the
+ * snapshot through vn_ops->stat under the vnode lock. Stat-heavy
+ * monitoring thus stays off the locks the I/O path uses.
+ */
+long vnode_stat(vnode_t *vn, stat_t *buf);
+
+/*
+ * Marks the vnode's stat snapshot stale. File systems must call this
+ * whenever they mutate anything stat reports (size, link count, times,
+ * block allocation); the next vnode_stat takes the refresh path.
+ */
+void vnode_stat_dirty(vnode_t *vn);
+
+/*
+ * Notes that the given vnode has been successfully exec'd. Binaries
+ * exec'd often enough are pinned: the cache takes an extra reference so
+ * the vnode - and the text pages cached in its vn_mobj - stay resident
+ * across execs.
+ */
+void vnode_record_exec(vnode_t *vn);
+
+/*
+ * Releases every pinned binary (called by the pageout daemon under
+ * memory pressure). Returns the number of vnodes unpinned.
+ */
+size_t vnode_pin_shrink();
+
 /* Auxilliary: */
 
 /* Unmounting (shutting down the VFS) is the primary reason for the
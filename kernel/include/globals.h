@@ -4,7 +4,19 @@
 #include "proc/kthread.h"
 #include "proc/proc.h"
 
+/* Every core's copy of the .csd section lives on its own private pages
+ * (same virtual range, per-core physical backing; see core_init), so two
+ * cores never share a cacheline through their own copies. Cross-core
+ * reads and writes go through GET_CSD, which aliases the owner's pages
+ * via the physmap -- and THOSE can false-share: a variable other cores
+ * poke sitting in the same cacheline as one the owner updates on every
+ * context switch turns each remote access into coherence traffic on the
+ * hot one. Variables reached through GET_CSD therefore take
+ * CORE_SPECIFIC_DATA_REMOTE, which gives each its own cacheline in a
+ * block the linker keeps apart from the owner-only data. */
 #define CORE_SPECIFIC_DATA __attribute__((section(".csd"))) = {0}
+#define CORE_SPECIFIC_DATA_REMOTE \
+    __attribute__((section(".csd.remote"), aligned(64))) = {0}
 
 extern core_t curcore;
 extern proc_t *curproc;
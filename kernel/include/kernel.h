@@ -20,6 +20,10 @@ extern void *kernel_end_data;
 extern void *kernel_end_bss;
 extern void *kernel_start_init;
 extern void *kernel_end_init;
+extern void *kernel_start_tracepoint;
+extern void *kernel_end_tracepoint;
+extern void *kernel_start_profsyms;
+extern void *kernel_end_profsyms;
 
 extern void *kernel_phys_base;
 extern void *kernel_phys_end;
@@ -29,6 +29,10 @@ long apic_max_id();
 /* Maps the given IRQ to the given interrupt number. */
 void apic_setredir(uint32_t irq, uint8_t intr);
 
+/* Steers the given IRQ to one core (or to any core if core is negative,
+ * the default for new redirections). */
+void apic_set_irq_affinity(uint32_t irq, long core);
+
 void apic_enable();
 
 // timer interrupts arrive at a rate of (freq / 16) interrupts per millisecond
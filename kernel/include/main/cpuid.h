@@ -33,6 +33,7 @@ enum
     CPUID_FEAT_ECX_CX16 = 1 << 13,
     CPUID_FEAT_ECX_ETPRD = 1 << 14,
     CPUID_FEAT_ECX_PDCM = 1 << 15,
+    CPUID_FEAT_ECX_PCID = 1 << 17,
     CPUID_FEAT_ECX_DCA = 1 << 18,
     CPUID_FEAT_ECX_SSE4_1 = 1 << 19,
     CPUID_FEAT_ECX_SSE4_2 = 1 << 20,
@@ -97,6 +98,16 @@ static inline void cpuid(int request, uint32_t *a, uint32_t *b, uint32_t *c,
                      : "0"(request));
 }
 
+/* Like cpuid(), for leaves that take a sub-leaf in ecx (e.g. 0xb, the
+ * extended topology enumeration leaf). */
+static inline void cpuid_count(int request, int count, uint32_t *a,
+                               uint32_t *b, uint32_t *c, uint32_t *d)
+{
+    __asm__ volatile("cpuid"
+                     : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                     : "0"(request), "2"(count));
+}
+
 static inline void cpuid_get_msr(uint32_t msr, uint32_t *lo, uint32_t *hi)
 {
     __asm__ volatile("rdmsr"
@@ -7,13 +7,24 @@
 // intr_disk_priamry/seconday so that they are different task priority classes
 #define INTR_DIVIDE_BY_ZERO 0x00
 #define INTR_INVALID_OPCODE 0x06
+#define INTR_DEVICE_NOT_AVAILABLE 0x07
 #define INTR_GPF 0x0d
 #define INTR_PAGE_FAULT 0x0e
 
 #define INTR_APICTIMER 0xf0
+#define INTR_TLB_SHOOTDOWN 0xf1
+#define INTR_SCHED_WAKE 0xf2
 #define INTR_KEYBOARD 0xe0
 
 #define INTR_DISK_PRIMARY 0xd0
+/* Self-IPI vector for the loopback packet device's softirq (see
+ * drivers/lodev.c); same priority class as the disk so packet delivery
+ * does not starve keyboard or timer interrupts. */
+#define INTR_NET_SOFTIRQ 0xd1
+/* Self-IPI vector for the tty output drain (see drivers/tty/tty.c);
+ * below INTR_KEYBOARD, so raising the IPL to INTR_KEYBOARD also holds
+ * off the drain closure. */
+#define INTR_TTY_SOFTIRQ 0xd2
 #define INTR_SPURIOUS 0xfe
 #define INTR_APICERR 0xff
 #define INTR_SHUTDOWN 0xfd
@@ -78,6 +89,19 @@ intr_handler_t intr_register(uint8_t intr, intr_handler_t handler);
 
 int32_t intr_map(uint16_t irq, uint8_t intr);
 
+/* A deferred work closure; see intr_defer. */
+typedef void (*intr_work_func_t)(void *arg);
+
+/* Defers func(arg) to this core's interrupt exit path. Interrupt handlers
+ * should only acknowledge their hardware and enqueue the rest of their
+ * work here: the closures run once the handler has returned and the
+ * interrupt controller has been acked, with further interrupts allowed, so
+ * wakeups and bookkeeping no longer extend the masked window. Must be
+ * called from interrupt context. Closures run in FIFO order on the
+ * enqueueing core and may themselves be interrupted; anything they touch
+ * that an interrupt handler also touches must still be IPL-protected. */
+void intr_defer(intr_work_func_t func, void *arg);
+
 static inline uint64_t intr_enabled()
 {
     uint64_t flags;
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "boot/config.h"
 #include "mm/page.h"
 #include "proc/core.h"
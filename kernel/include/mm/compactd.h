@@ -0,0 +1,21 @@
+#pragma once
+
+#include "types.h"
+
+/* The compaction daemon defragments physical memory so multi-page
+ * allocations (kernel stacks, DMA buffers) can succeed: when
+ * page_alloc_n() fails with enough total memory free, the daemon picks
+ * the 2^order-aligned block needing the fewest pages moved and migrates
+ * the movable pframes in it elsewhere, letting the freed pages coalesce
+ * in the btree. Only frames that were never mapped into a page table can
+ * move (there are no reverse mappings with which to fix up page tables),
+ * the same restriction pageout and merging work under. */
+
+/* Creates and starts the compaction daemon process. Called once from
+ * initproc_start(). */
+void compactd_start();
+
+/* Request a compaction pass aiming to free one aligned run of
+ * (1 << order) pages. Called by page_alloc_n() on failure; safe to call
+ * from any context, including before the daemon has started. */
+void compactd_wakeup(size_t order);
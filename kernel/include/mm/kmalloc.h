@@ -5,3 +5,8 @@
 void *kmalloc(size_t size);
 
 void kfree(void *addr);
+
+/* Formats a per-size-class allocation report (name, allocs, frees; one
+ * class per line, plus the large passthrough) into the given buffer.
+ * Returns the number of bytes written, at most size. */
+size_t kmalloc_info(char *buf, size_t size);
@@ -23,3 +23,7 @@
  */
 #define MAP_FIXED 4
 #define MAP_ANON 8
+
+/* Set on a vmarea by mlock(): its pages are faulted in up front and the
+ * frames are exempt from pageout (see do_mlock). */
+#define MAP_PINNED 16
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "proc/kmutex.h"
-#include "util/atomic.h"
+#include "proc/spinlock.h"
+#include "util/refcount.h"
 #include "util/list.h"
 struct pframe;
 
@@ -27,13 +28,68 @@ typedef struct mobj_ops
     void (*destructor)(struct mobj *o);
 } mobj_ops_t;
 
+/* Number of buckets in each mobj's resident-pframe hash index. Must be a
+ * power of two. Lookups by page number go through the index; mo_pframes
+ * remains the canonical list for whole-object iteration. */
+#define MOBJ_PFRAME_HASH_BUCKETS 32
+
+/* Number of locks striped over the hash buckets; a power of two no larger
+ * than MOBJ_PFRAME_HASH_BUCKETS. */
+#define MOBJ_PFRAME_LOCKS 8
+
 typedef struct mobj
 {
     long mo_type;
     struct mobj_ops mo_ops;
-    atomic_t mo_refcount;
+    refcount_t mo_refcount;
     list_t mo_pframes;
+    list_t mo_pframe_hash[MOBJ_PFRAME_HASH_BUCKETS];
+
+    /* Resident pframes that are currently dirty, so writeback can find
+     * them without walking every resident page. Maintained by
+     * mobj_dirty_pframe and the flush/detach paths. */
+    list_t mo_dirty_pframes;
+
     kmutex_t mo_mutex;
+
+    /* Locks over the pframe hash index, striped across the buckets
+     * (lock i covers buckets i, i + MOBJ_PFRAME_LOCKS, ...), so index
+     * lookups of different pages in the same hot object - every path
+     * lookup hits the root directory's mobj, on every core - proceed
+     * concurrently instead of funneling through one lock. Attach/detach
+     * take the bucket's lock around the hash edit (and always also hold
+     * mo_mutex); the page fault fast path takes only the bucket lock,
+     * see mobj_fast_lookup_mapped. */
+    spinlock_t mo_pframe_locks[MOBJ_PFRAME_LOCKS];
+
+    /* Number of pframes currently attached to this object. Maintained by
+     * mobj_attach_pframe/mobj_detach_pframe; a cheap per-object view of
+     * cache occupancy (see also the resident stats device). */
+    size_t mo_resident;
+
+    /* Set for memory objects whose pframes the pageout daemon may reclaim
+     * under memory pressure. Only objects that live for the lifetime of the
+     * system and are never mapped into page tables (i.e. the block device
+     * caches) may be marked evictable; see mm/pageoutd.c. */
+    long mo_evictable;
+
+    /* Set for memory objects whose unmapped pframes may be written out to
+     * the swap device and reclaimed (anonymous and shadow objects); see
+     * mm/swap.c. Unlike mo_evictable objects, swappable objects are
+     * destroyed normally, so the pageout daemon pins one with a reference
+     * before touching its frames. */
+    long mo_swappable;
+
+    /* Set for memory objects whose fill_pframe may run with both the
+     * object's mutex and the frame's mutex dropped, so a long disk read
+     * for one page does not serialize lookups and fills of every other
+     * page in the object (the frame is marked PF_STATE_BUSY for the
+     * duration, and lookups of that one page wait on its pf_waitq; see
+     * mobj_materialize_pframe and mobj_find_pframe). Only correct when
+     * the fill implementation takes whatever locks it needs internally
+     * rather than relying on mo_mutex - currently the block device
+     * caches, whose fill is a self-contained driver read. */
+    long mo_concurrent_fill;
 } mobj_t;
 
 void mobj_init(mobj_t *o, long type, mobj_ops_t *ops);
@@ -53,6 +109,17 @@ long mobj_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
 
 void mobj_find_pframe(mobj_t *o, uint64_t pagenum, struct pframe **pfp);
 
+/* Fast lookup for the page fault path: returns the kernel virtual address
+ * of a resident, already-mapped (pf_mapped) frame, or NULL. Takes only
+ * mo_pframe_lock, never mo_mutex or the frame's mutex. */
+void *mobj_fast_lookup_mapped(mobj_t *o, uint64_t pagenum);
+
+void mobj_attach_pframe(mobj_t *o, struct pframe *pf);
+
+void mobj_detach_pframe(mobj_t *o, struct pframe *pf);
+
+void mobj_dirty_pframe(mobj_t *o, struct pframe *pf);
+
 long mobj_flush_pframe(mobj_t *o, struct pframe *pf);
 
 long mobj_flush(mobj_t *o);
@@ -62,4 +129,13 @@ long mobj_free_pframe(mobj_t *o, struct pframe **pfp);
 long mobj_default_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
                              struct pframe **pfp);
 
+/* Allocate a backing page and run fill_pframe for a placeholder frame
+ * (pf_addr == NULL, e.g. swapped out); no-op for resident frames. */
+long mobj_materialize_pframe(mobj_t *o, struct pframe *pf);
+
+/* For a caller about to overwrite the entire page: the frame's backing
+ * page is allocated but not filled, and the frame is marked dirty. */
+long mobj_get_pframe_overwrite(mobj_t *o, uint64_t pagenum,
+                               struct pframe **pfp);
+
 void mobj_default_destructor(mobj_t *o);
@@ -116,8 +116,84 @@ void page_add_range(void *start, void *end);
 
 void page_mark_reserved(void *paddr);
 
+/* Whether an aligned free run of (1 << order) pages currently exists. */
+long page_order_available(size_t order);
+
+/* Returns the physmap address of the 2^order-aligned block needing the
+ * fewest pages moved to become entirely free (with *busy_out set to that
+ * count), or NULL. Used by the compaction daemon; see mm/compactd.c. */
+void *page_compact_candidate(size_t order, size_t *busy_out);
+
+/*
+ * Per-physical-page metadata, one entry for every page frame the
+ * allocator manages (a statically sized array carved out next to the
+ * btree at boot). Given any physical or physmap address this answers,
+ * in O(1), who owns the frame - the foundation for reverse lookups by
+ * the pageout and COW paths, which can't otherwise get from a paddr
+ * back to the owning pframe.
+ */
+typedef struct ppage
+{
+    void *pp_owner;       /* owning object (typically a pframe_t), or NULL */
+    uint32_t pp_refcount; /* owner references (>1 once pages are shared) */
+    uint32_t pp_flags;
+} ppage_t;
+
+#define PP_RESERVED 0x1 /* never allocatable (firmware, boot reservations) */
+
+/* Returns the metadata entry for the page containing addr (either a
+ * physical address or a physmap address), or NULL if the address is
+ * outside the managed range. */
+ppage_t *ppage_get(void *addr);
+
+/* Records owner as the owner of the page containing addr (NULL clears
+ * it); the refcount is reset to 1 (or 0 when clearing). No-op for
+ * unmanaged addresses. */
+void ppage_set_owner(void *addr, void *owner);
+
+/*
+ * NUMA support: page_numa_init() (called after acpi_init()) parses the
+ * ACPI SRAT to learn which physical ranges and which cores belong to
+ * which node. On machines without an SRAT (e.g. our usual QEMU target)
+ * everything lands on node 0 and the node-aware calls below collapse to
+ * the ordinary allocator.
+ */
+void page_numa_init();
+
+/* Number of memory nodes (at least 1). */
+long page_numa_node_count();
+
+/* Returns the node owning the page containing addr (a physical or
+ * physmap address); node 0 if unknown. */
+long page_node_of(void *addr);
+
+/* Returns the node the given core (APIC id) belongs to; node 0 if
+ * unknown. Useful together with kthread_set_affinity() to keep a thread
+ * on the cores local to the node its pages were allocated from. */
+long page_node_of_core(long core);
+
+/* Relative distance between two nodes, from the ACPI SLIT (10 is a
+ * node's distance to itself; larger is farther; 20 everywhere when the
+ * firmware provides no SLIT). The scheduler's work stealing and the
+ * node allocator's fallback order both rank candidates with this. */
+long page_node_distance(long node_a, long node_b);
+
+/* Like page_alloc()/page_alloc_n(), but prefers memory belonging to
+ * node (pass a negative node for the calling core's node). Falls back
+ * to any free memory rather than failing when the node is exhausted. */
+void *page_alloc_node(long node);
+
+void *page_alloc_n_node(size_t npages, long node);
+
 void page_init_finish();
 
+/* Turns on the calling core's magazine of order-0 pages, which caches
+ * single pages in front of the (shared, locked) allocator. Must be called
+ * exactly once per core, only after the core's core-specific data has been
+ * mapped in. Until then single-page operations fall through to the shared
+ * allocator. */
+void page_magazines_enable();
+
 /* Returns the number of free pages remaining in the
  * system. Note that calls to page_alloc_n(npages) may
  * fail even if page_free_count() >= npages. */
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.h"
+
+struct merge_frame;
+struct pframe;
+
+/* Scan period and batch size for the merge daemon. */
+#define PAGEMERGED_INTERVAL_TICKS 500
+#define PAGEMERGED_BATCH 64
+
+/* Creates and starts the page-merging daemon process. Called once from
+ * initproc_start(), alongside the other VM daemons. */
+void pagemerged_start();
+
+/* Copy a merged frame's contents out of its shared frame into the freshly
+ * allocated pf->pf_addr and drop the placeholder's reference. Called from
+ * the fill_pframe paths of swappable objects (see vm/anon.c and
+ * vm/shadow.c); pf must be locked. */
+long pagemerged_copy_in(struct pframe *pf);
+
+/* Copy a merged frame's contents into dst without materializing a private
+ * frame; the caller must hold the (locked) placeholder that references
+ * mf. Used by the shadow chain walk to service copies. */
+void pagemerged_copy_from(struct merge_frame *mf, void *dst);
+
+/* Lock and return the shared frame behind mf, for mapping it read-only
+ * straight into a faulting address space (zero-frame style; see
+ * vm/anon.c). The caller must hold the placeholder referencing mf. */
+struct pframe *pagemerged_shared_frame(struct merge_frame *mf);
+
+/* Drop a placeholder's reference on its shared frame, clearing pf_merge.
+ * Called when a merged frame is freed (see mobj_free_pframe). */
+void pagemerged_release(struct pframe *pf);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "types.h"
+
+struct mobj;
+struct pframe;
+struct proc;
+
+/* The pageout daemon maintains a global LRU over resident pframes and, when
+ * the number of free pages drops below PAGEOUTD_LOW_WATERMARK, writes back
+ * and frees cold pages from evictable memory objects (see mo_evictable)
+ * until PAGEOUTD_HIGH_WATERMARK pages are free again. Frames that have ever
+ * been mapped into a page table are pinned, as we have no reverse mappings
+ * with which to unmap them. */
+
+/* Watermarks, in pages. */
+#define PAGEOUTD_LOW_WATERMARK 1024
+#define PAGEOUTD_HIGH_WATERMARK 2048
+
+/* Creates and starts the pageout daemon process. Called once from
+ * initproc_start(), after the init process has been created (so the daemon
+ * does not claim PID_INIT). */
+void pageoutd_start();
+
+/* Wakes the pageout daemon. Called by the page allocator whenever an
+ * allocation leaves fewer than PAGEOUTD_LOW_WATERMARK pages free. Safe to
+ * call from any context, including before the daemon has started. */
+void pageoutd_wakeup();
+
+/* Per-process resident-page quota, in pages; 0 (the default) disables it.
+ * When a process's p_resident exceeds the quota, the daemon preferentially
+ * evicts that process's own frames, even when free memory is plentiful.
+ * Settable at runtime through the resident stats device. */
+size_t pageoutd_get_proc_quota();
+
+void pageoutd_set_proc_quota(size_t pages);
+
+/* Whether p is currently over the resident quota (always false when the
+ * quota is disabled). */
+long pageoutd_over_quota(struct proc *p);
+
+/* Collect up to max of the coldest resident, unmapped frames of swappable
+ * mobjs as (object, page number) pairs, taking a reference on each object
+ * (the caller owns the references). Used by the page-merging daemon; see
+ * mm/pagemerged.c. */
+size_t pageoutd_collect_swappable(struct mobj **objs, uint64_t *pagenums,
+                                  size_t max);
+
+/* Collect up to max movable (evictable or swappable, never mapped) frames
+ * whose pages lie in [start, end), as (object, page number) pairs, taking
+ * a reference on each object (the caller owns the references). Used by
+ * the compaction daemon; see mm/compactd.c. */
+size_t pageoutd_collect_range(void *start, void *end, struct mobj **objs,
+                              uint64_t *pagenums, size_t max);
+
+/* LRU maintenance hooks, called by the mobj code: insert when a pframe is
+ * attached to a memory object, remove when it is detached, and touch on
+ * every successful get_pframe. */
+void pageoutd_lru_insert(struct pframe *pf);
+
+void pageoutd_lru_remove(struct pframe *pf);
+
+void pageoutd_lru_touch(struct pframe *pf);
@@ -62,6 +62,30 @@ typedef struct pt
      PHYS_OFFSET)
 #define GDB_CUR_PHYSADDR(v) GDB_PHYSADDR(curproc->p_pml4, (v))
 
+/*
+ * Mapping census of the user half of an address space; filled in by
+ * pt_mapping_stats. Leaf counts are present terminal mappings by page
+ * size; table counts are intermediate tables reachable from the pml4,
+ * with ps_tables_empty counting those containing no present entry at
+ * all. Permission counts are over all present leaves.
+ */
+typedef struct pt_stats
+{
+    size_t ps_pages_4k;
+    size_t ps_pages_2mb;
+    size_t ps_pages_1gb;
+    size_t ps_tables_pdp;
+    size_t ps_tables_pd;
+    size_t ps_tables_pt;
+    size_t ps_tables_empty;
+    size_t ps_leaf_user;
+    size_t ps_leaf_write;
+    size_t ps_leaf_accessed;
+    size_t ps_leaf_dirty;
+} pt_stats_t;
+
+void pt_mapping_stats(pml4_t *pml4, pt_stats_t *stats);
+
 uintptr_t pt_virt_to_phys_helper(pml4_t *pml4, uintptr_t vaddr);
 
 uintptr_t pt_virt_to_phys(uintptr_t vaddr);
@@ -87,8 +111,28 @@ long pt_map(pml4_t *pml4, uintptr_t paddr, uintptr_t vaddr, uint32_t pdflags,
 long pt_map_range(pml4_t *pml4, uintptr_t paddr, uintptr_t vaddr,
                   uintptr_t vmax, uint32_t pdflags, uint32_t ptflags);
 
+/* Replaces the 2MB-aligned window at vaddr with a single 2MB PDE mapping
+ * the physically contiguous run at paddr, freeing the old page table.
+ * For the anonymous huge-page promotion path; see vmmap_try_promote_huge. */
+long pt_promote_2mb(pml4_t *pml4, uintptr_t paddr, uintptr_t vaddr,
+                    uint32_t pdflags, uint32_t ptflags);
+
 void pt_unmap(pml4_t *pml4, uintptr_t vaddr);
 
 void pt_unmap_range(pml4_t *pml4, uintptr_t vaddr, uintptr_t vmax);
 
+void pt_write_protect_range(pml4_t *pml4, uintptr_t vaddr, uintptr_t vmax);
+
+/* Kernel text and rodata are sealed read-only at the end of pt_init (in
+ * both the kernel image mapping and its physmap alias) so a stray kernel
+ * write to code takes a fault instead of silently corrupting it. The rare
+ * deliberate patcher brackets its writes with this pair; both flush the
+ * local TLB, global entries included. */
+void pt_kernel_text_unlock(void);
+void pt_kernel_text_lock(void);
+
+/* Returns 1 if every page of [vaddr, vaddr + len) is mapped with user
+ * access (and write access, when forwrite is set); 0 otherwise. */
+long pt_range_mapped(pml4_t *pml4, uintptr_t vaddr, size_t len, long forwrite);
+
 void check_invalid_mappings(pml4_t *pml4, vmmap_t *vmmap, char *prompt);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "types.h"
+
+/* The pre-zero daemon keeps a small pool of already-zeroed pages, filled at
+ * idle priority whenever free memory is plentiful. Anonymous write faults
+ * drain the pool (see anon_fill_pframe), so after any idle time the fault
+ * path pays a pointer swap instead of a PAGE_SIZE memset. */
+
+/* How many zeroed pages the pool holds, in pages. */
+#define PAGEZEROD_POOL_CAPACITY 64
+
+/* Creates and starts the pre-zero daemon process. Called once from
+ * initproc_start(), after the init process has been created (so the daemon
+ * does not claim PID_INIT). */
+void pagezerod_start();
+
+/* Takes a pre-zeroed page from the pool, or returns NULL if none is ready
+ * (the caller zeroes synchronously as before). Safe to call from any thread
+ * context, including before the daemon has started. */
+void *pagezerod_claim();
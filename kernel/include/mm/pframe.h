@@ -2,17 +2,62 @@
 
 #include "mm/mobj.h"
 #include "proc/kmutex.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
 #include "types.h"
 
+/* pf_state values; see mobj_materialize_pframe. A frame is BUSY while an
+ * unlocked fill is in flight for it, with neither its own mutex nor its
+ * mobj's held. */
+#define PF_STATE_READY 0
+#define PF_STATE_BUSY 1
+
 typedef struct pframe
 {
     size_t pf_pagenum;
     void *pf_addr;
     long pf_dirty;
+    long pf_state;             /* READY, or BUSY during an unlocked fill;
+                                * transitions happen with both pf_mutex and
+                                * the mobj's mutex held, reads under
+                                * pf_state_lock (or both mutexes) */
+    spinlock_t pf_state_lock;  /* protects pf_state for sleepers */
+    ktqueue_t pf_waitq;        /* lookups waiting out a BUSY fill; see
+                                * mobj_find_pframe */
+    long pf_mapped;           /* ever mapped into a page table; pins the
+                               * frame against pageout (we have no reverse
+                               * mappings with which to unmap it) */
+    pid_t pf_owner;           /* pid of the process that brought the frame
+                               * in (0 for the kernel); charged for it in
+                               * p_resident while the frame is attached */
+    long pf_readahead;        /* brought in by the readahead worker and
+                               * not yet touched by a real lookup; feeds
+                               * the prefetch hit-rate counters below */
+    blocknum_t pf_swap_slot;  /* swap-device slot holding the page's data
+                               * while pf_addr is NULL (0 = none); see
+                               * mm/swap.c */
+    struct comp_page *pf_comp; /* pooled compressed copy of the page's
+                                * data while pf_addr is NULL; see
+                                * mm/swapcomp.c */
+    struct merge_frame *pf_merge; /* shared frame holding the page's data
+                                   * while pf_addr is NULL (deduplicated);
+                                   * see mm/pagemerged.c */
     kmutex_t pf_mutex;
-    list_link_t pf_link;
+    struct mobj *pf_mobj;     /* owning mobj, while attached */
+    list_link_t pf_link;       /* link on mobj's mo_pframes list */
+    list_link_t pf_hash_link;  /* link on mobj's mo_pframe_hash bucket */
+    list_link_t pf_lru_link;   /* link on the pageout daemon's LRU */
+    list_link_t pf_dirty_link; /* link on mobj's mo_dirty_pframes while
+                                * dirty */
 } pframe_t;
 
+/* Readahead effectiveness counters (defined in pframe.c): prefetched
+ * frames a real lookup later consumed vs. frames evicted with the
+ * pf_readahead mark still set. The filesystems feed these back into
+ * their window sizing (see _s5_ra_ceiling in fs/s5fs/s5fs_subr.c). */
+extern uint64_t pframe_ra_used;
+extern uint64_t pframe_ra_wasted;
+
 void pframe_init();
 
 pframe_t *pframe_create();
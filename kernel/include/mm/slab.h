@@ -24,6 +24,10 @@ typedef struct slab_allocator slab_allocator_t;
  * and kmalloc will not work until this function has been called. */
 void slab_init();
 
+/* Enables the calling core's per-core slab magazines. Called once per core
+ * from core_init(), after the core's CSD pages have been mapped. */
+void slab_magazines_enable();
+
 /*
  * Example Usage
  * See the below example for how to use a slab allocator to allocate objects 
@@ -59,6 +63,20 @@ void slab_init();
  */
 slab_allocator_t *slab_allocator_create(const char *name, size_t size);
 
+/**
+ * As slab_allocator_create, but objects handed out are aligned to `align`
+ * bytes (a power of two). Use a cacheline (64) for contended structures
+ * that embed spinlocks or wait queues, so their hot members don't share
+ * lines with neighboring objects.
+ *
+ * @param name The name of the allocator (for debugging)
+ * @param size The size (bytes) of objects that will be allocated from this allocator
+ * @param align Required alignment of returned objects, a power of two
+ * @return slab_allocator_t* An allocator, or NULL on failure
+ */
+slab_allocator_t *slab_allocator_create_aligned(const char *name, size_t size,
+                                                size_t align);
+
 /**
  * Destroys a slab allocator.
  * 
@@ -84,6 +102,17 @@ void *slab_obj_alloc(slab_allocator_t *allocator);
  */
 void slab_obj_free(slab_allocator_t *allocator, void *obj);
 
+/**
+ * Formats a per-allocator occupancy report (name, object size, objects in
+ * use, total object capacity; one allocator per line) into the given
+ * buffer.
+ *
+ * @param buf The buffer to write into
+ * @param size Size of the buffer
+ * @return size_t Number of bytes written, at most size
+ */
+size_t slab_allocators_info(char *buf, size_t size);
+
 /**
  * Reclaims memory from unused slabs. 
  * 
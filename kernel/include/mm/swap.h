@@ -0,0 +1,27 @@
+#pragma once
+
+#include "types.h"
+
+struct mobj;
+struct pframe;
+
+/* Minor number of the disk dedicated to swap (disk 0 holds the root file
+ * system). The weenix script attaches swap0.img as the second drive. */
+#define SWAP_DISK_MINOR 1
+
+/* Size of the swap device in page-sized slots; must match the image the
+ * weenix script creates. Slot 0 is reserved so that a pf_swap_slot of 0
+ * always means "not swapped". */
+#define SWAP_SLOTS 8192
+
+void swap_start(void);
+
+long swap_ready(void);
+
+long swap_out(struct mobj *o, struct pframe *pf);
+
+long swap_in(struct pframe *pf);
+
+void swap_slot_free(blocknum_t slot);
+
+size_t swap_info(char *buf, size_t size);
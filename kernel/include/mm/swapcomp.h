@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.h"
+
+struct pframe;
+
+/* Cap on the number of physical pages the compressed pool may consume.
+ * Every pooled page holds at least two compressed pages' worth of data,
+ * so the pool is always a net gain, but an unbounded pool would compete
+ * with the very allocations eviction is trying to satisfy. */
+#define SWAPCOMP_POOL_PAGES 1024
+
+/* Whether the compressed tier can currently accept a page: the pool is
+ * under budget or has free cells. Used alongside swap_ready() to decide
+ * whether paging out is worth attempting at all. */
+long swapcomp_ready();
+
+/* Compress pf's page into the pool and make the frame remember the copy
+ * in pf_comp. Returns 0 on success; nonzero if the page did not compress
+ * well enough to be worth keeping or the pool is full, in which case the
+ * caller falls back to the swap device. pf must be locked, resident, and
+ * unmapped; called only from swap_out (see mm/swap.c). */
+long swapcomp_out(struct pframe *pf);
+
+/* Decompress a compressed-out frame's page back into the freshly
+ * allocated pf->pf_addr and release the pooled copy. Called from the
+ * fill_pframe paths of swappable objects (see vm/anon.c and
+ * vm/shadow.c); pf must be locked. */
+long swapcomp_in(struct pframe *pf);
+
+/* Drop a compressed placeholder's pooled copy, clearing pf_comp. Called
+ * when a compressed-out frame is freed (see mobj_free_pframe). */
+void swapcomp_release(struct pframe *pf);
+
+/* One line of pool-usage accounting for the swap stats device. */
+size_t swapcomp_info(char *buf, size_t size);
@@ -33,3 +33,33 @@ static inline void tlb_flush_all()
     __asm__ volatile("movq %0, %%cr3" ::"r"(pdir)
                      : "memory");
 }
+
+struct pt;
+
+/* A batched TLB shootdown: collect the pages invalidated by an operation
+ * (e.g. each leg of a vmmap_remove), then commit once. Commit flushes the
+ * local TLB and sends a single IPI round to only the cores whose cr3
+ * currently holds the affected pml4 (see kc_pml4), rather than one
+ * invalidation per page per core. The struct lives on the caller's stack. */
+typedef struct tlb_shootdown
+{
+    struct pt *ts_pml4; /* the address space being invalidated */
+    uintptr_t ts_low;   /* lowest collected vaddr */
+    uintptr_t ts_high;  /* highest collected vaddr (exclusive) */
+    size_t ts_count;    /* number of pages collected */
+} tlb_shootdown_t;
+
+/* Registers the shootdown interrupt handler; called once from kmain. */
+void tlb_shootdown_init();
+
+/* Begins collecting invalidations of pml4's mappings into ts. */
+void tlb_shootdown_begin(tlb_shootdown_t *ts, struct pt *pml4);
+
+/* Records count pages starting at vaddr as invalidated. */
+void tlb_shootdown_add(tlb_shootdown_t *ts, uintptr_t vaddr, size_t count);
+
+/* Flushes everything collected in ts, locally and on any other core whose
+ * cr3 holds ts_pml4. No-op if nothing was collected. Must be called with
+ * interrupts enabled so that concurrent committers can service each other's
+ * shootdowns while waiting their turn. */
+void tlb_shootdown_commit(tlb_shootdown_t *ts);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "types.h"
+
+/* Scan period for the balance daemon, in timer ticks. */
+#define BALANCED_INTERVAL_TICKS 64
+
+/* Creates and starts the run-queue balance daemon process. Called once
+ * from initproc_start(), alongside the other daemons. */
+void balanced_start();
+
+/* One line of migration and load-average accounting for the scheduler
+ * stats device. */
+size_t balanced_info(char *buf, size_t size);
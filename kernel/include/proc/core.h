@@ -4,6 +4,8 @@
 #include "proc/sched.h"
 #include "proc/spinlock.h"
 
+struct pt;
+
 typedef struct core
 {
     long kc_id;
@@ -13,4 +15,9 @@ typedef struct core
     spinlock_t *kc_lock;
 
     uintptr_t kc_csdpaddr;
+
+    /* The pml4 most recently loaded into this core's cr3 (see pt_set);
+     * consulted by the TLB shootdown path to target only cores that
+     * currently hold the affected address space. */
+    struct pt *kc_pml4;
 } core_t;
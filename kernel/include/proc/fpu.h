@@ -0,0 +1,44 @@
+#pragma once
+
+#include "proc/kthread.h"
+
+/*
+ * Lazy FPU/SIMD context switching. Integer-only threads - most kernel
+ * threads - never pay for saving or restoring the 512-byte fxsave image.
+ * The scheduler sets CR0.TS when it dispatches a thread that does not
+ * already own this core's FPU registers; the thread's first FP/SIMD
+ * instruction then takes a device-not-available fault, and the handler
+ * saves the previous owner's registers and loads the new owner's. A
+ * thread that never touches the FPU never faults and never costs a save.
+ */
+
+/**
+ * Per-core FPU setup (CR0/CR4 feature bits); the first call also
+ * registers the fault handler and captures the clean initial register
+ * image handed to first-time FPU users. Called from core_init.
+ */
+void fpu_init(void);
+
+/**
+ * Checkpoints thr's FPU registers into its kthread if it owns this
+ * core's FPU; called when thr leaves the CPU, since it may next run on a
+ * core where these registers are unreachable.
+ *
+ * @param thr the outgoing thread
+ */
+void fpu_switch_away(struct kthread *thr);
+
+/**
+ * Arms (or disarms) the device-not-available trap for the incoming
+ * curthr: owners of this core's FPU registers run with CR0.TS clear,
+ * everyone else faults on first FPU use.
+ */
+void fpu_switch_to(void);
+
+/**
+ * Disowns thr's FPU registers on every core, so no later fault saves
+ * into a freed kthread. Called from kthread_destroy.
+ *
+ * @param thr the thread being destroyed
+ */
+void fpu_thread_exited(struct kthread *thr);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.h"
+
+/* Futex-style addressed wait/wake for userland synchronization. An
+ * uncontended user lock is a plain atomic in user memory and never
+ * enters the kernel; on contention the waiter calls futex_wait, which
+ * blocks only if the word still holds the expected value, and the
+ * unlocker calls futex_wake. Addresses are resolved to the backing
+ * (memory object, offset), so locks in shared memory work between
+ * processes. Spurious wakeups are possible (hash-bucket collisions);
+ * callers must recheck the word and retry, as with any futex. */
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_REQUEUE 2
+
+void futex_init();
+
+/* Blocks until woken, provided *uaddr (a 4-byte-aligned user address)
+ * still equals expected. Returns 0 when woken, -EAGAIN if the value
+ * already differed, -EINTR if cancelled, or -EFAULT/-EINVAL on a bad
+ * address. */
+long futex_wait(void *uaddr, int expected);
+
+/* Wakes up to nwake threads waiting on uaddr; returns how many were
+ * woken. */
+long futex_wake(void *uaddr, int nwake);
+
+/* Wakes up to nwake threads waiting on uaddr and moves the remaining
+ * waiters to uaddr2's queue without waking them (see sched_requeue_on),
+ * so a broadcast-style waker does not make every waiter race and
+ * re-block. Returns the number of threads woken plus moved. */
+long futex_requeue(void *uaddr, int nwake, void *uaddr2);
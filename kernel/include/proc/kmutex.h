@@ -1,5 +1,6 @@
 #pragma once
 
+#include "proc/lockprof.h"
 #include "proc/sched.h"
 #include "proc/spinlock.h"
 
@@ -13,13 +14,18 @@ typedef struct kmutex
     struct kthread *km_holder; /* current holder */
     spinlock_t km_lock;
     list_link_t km_link;
+    long km_hot; /* holders get brief preemption deferral; see
+                    kmutex_mark_hot */
+#if LOCK_PROFILING
+    lockprof_lock_t km_lp; /* contention profiling state */
+#endif
 } kmutex_t;
 
 #define KMUTEX_INITIALIZER(mtx)                                             \
     {                                                                       \
         .km_waitq = KTQUEUE_INITIALIZER((mtx).km_waitq), .km_holder = NULL, \
         .km_lock = SPINLOCK_INITIALIZER((mtx).km_lock),                     \
-        .km_link = LIST_LINK_INITIALIZER((mtx).km_link),                    \
+        .km_link = LIST_LINK_INITIALIZER((mtx).km_link), .km_hot = 0,       \
     }
 
 /*==========
@@ -33,6 +39,17 @@ typedef struct kmutex
  */
 void kmutex_init(kmutex_t *mtx);
 
+/**
+ * Marks a mutex as hot: while a thread holds it, the timer tick defers
+ * preemption for a short, bounded grace window (see timer_tick_handler)
+ * so the critical section can finish, and the thread yields on release
+ * to pay the slice back. Reserved for the few locks whose holder being
+ * switched out convoys the whole system, such as the root directory's.
+ *
+ * @param mtx the mutex
+ */
+void kmutex_mark_hot(kmutex_t *mtx);
+
 /**
  * Locks the specified mutex.
  *
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+/*===========
+ * Structures
+ *==========*/
+
+/*
+ * A blocking reader-writer lock with writer preference: any number of
+ * readers may hold the lock at once, a writer holds it exclusively, and
+ * once a writer is waiting, new readers queue up behind it so writers are
+ * not starved by a steady stream of readers.
+ */
+typedef struct krwlock
+{
+    long krw_readers;          /* number of active readers */
+    struct kthread *krw_writer; /* active writer, if any */
+    long krw_wr_waiters;       /* writers queued; blocks new readers */
+    ktqueue_t krw_rwaitq;      /* wait queue for readers */
+    ktqueue_t krw_wwaitq;      /* wait queue for writers */
+    spinlock_t krw_lock;
+} krwlock_t;
+
+/*==========
+ * Functions
+ *=========*/
+
+/**
+ * Initializes a reader-writer lock.
+ *
+ * @param rw the lock
+ */
+void krwlock_init(krwlock_t *rw);
+
+/**
+ * Acquires the lock in shared (read) mode.
+ *
+ * Note: This function may block.
+ *
+ * @param rw the lock to acquire
+ */
+void krwlock_read_lock(krwlock_t *rw);
+
+/**
+ * Releases a shared (read) hold on the lock.
+ *
+ * @param rw the lock to release
+ */
+void krwlock_read_unlock(krwlock_t *rw);
+
+/**
+ * Acquires the lock in exclusive (write) mode.
+ *
+ * Note: This function may block.
+ *
+ * @param rw the lock to acquire
+ */
+void krwlock_write_lock(krwlock_t *rw);
+
+/**
+ * Releases an exclusive (write) hold on the lock.
+ *
+ * @param rw the lock to release
+ */
+void krwlock_write_unlock(krwlock_t *rw);
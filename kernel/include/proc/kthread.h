@@ -39,8 +39,39 @@ typedef struct kthread
     struct proc *kt_proc; /* Corresponding process */
 
     long kt_cancelled;   /* Set if the thread has been cancelled */
+    long kt_timed_out;   /* Set if the last timed sleep expired (see
+                            sched_sleep_on_timeout) */
     ktqueue_t *kt_wchan; /* If blocking, the queue this thread is blocked on  NULL*/
     kthread_state_t kt_state;
+    int kt_prio;         /* Effective run queue priority level, 0 (highest)
+                            through SCHED_NUM_PRIOS - 1; the lower
+                            (numerically) of kt_base_prio and
+                            kt_inherit_prio. See proc/sched.h */
+    int kt_base_prio;    /* The thread's own priority, absent inheritance;
+                            this is what decays on yield and is boosted on
+                            wakeup */
+    int kt_inherit_prio; /* Highest priority donated by mutex waiters, or
+                            SCHED_NUM_PRIOS while no donation is active;
+                            see kmutex_lock in proc/kmutex.c */
+    struct kmutex *kt_blocked_mtx; /* The mutex this thread is sleeping on,
+                                      if any; priority donation follows
+                                      these links through nested waits */
+
+    long kt_hot_locks;     /* Held mutexes marked hot (kmutex_mark_hot);
+                              while nonzero, the timer tick briefly defers
+                              preemption so the critical section finishes */
+    long kt_defer_pending; /* A preemption was deferred for a hot lock;
+                              the unlock path yields to pay it back */
+
+    /* Deadline/budget class (see sched_set_deadline): while kt_dl_period
+     * is nonzero the thread runs at the top priority until it has used
+     * kt_dl_budget ticks of the current period, then at the bottom
+     * priority until the period rolls over. Replaces the decay/boost
+     * rules for the thread. */
+    uint64_t kt_dl_budget; /* ticks granted per period */
+    uint64_t kt_dl_period; /* period length in ticks; 0 = normal rules */
+    uint64_t kt_dl_left;   /* budget left in the current period */
+    uint64_t kt_dl_start;  /* jiffies stamp of the period's start */
 
     spinlock_t kt_lock;
 
@@ -50,7 +81,31 @@ typedef struct kthread
     list_t kt_mutexes;   /* List of owned mutexes, for use in debugging */
     long kt_recent_core; /* For SMP */
 
+    uint64_t kt_affinity; /* Bitmask of cores the thread may be run on
+                             (bit n = core n); see kthread_set_affinity */
+
     uint64_t kt_preemption_count;
+
+    uint64_t kt_queued_tsc; /* TSC stamp from when the thread was last
+                               enqueued on a run queue; cleared at dispatch
+                               after feeding the run-queue wait histogram
+                               (see sched_latency_info) */
+
+    /* CPU-time accounting (see do_getrusage): cycles are charged at
+     * every accounting boundary - dispatch, switch-away, and the syscall
+     * boundary - so the totals are exact sums of TSC intervals, not tick
+     * samples. */
+    uint64_t kt_utime_tsc; /* TSC cycles spent in user mode */
+    uint64_t kt_stime_tsc; /* TSC cycles spent in kernel mode */
+    uint64_t kt_acct_tsc;  /* stamp of the last accounting boundary;
+                              0 while the thread is off-CPU */
+    long kt_in_user;       /* the thread was executing userland code at
+                              its last accounting boundary */
+
+    uint8_t kt_fpu_state[512] __attribute__((
+        aligned(16)));  /* fxsave64 image; valid only when the thread is
+                           off-CPU and kt_fpu_used is set (see proc/fpu.c) */
+    long kt_fpu_used;   /* the thread has executed an FPU/SIMD instruction */
 } kthread_t;
 
 /*==========
@@ -84,6 +139,21 @@ kthread_t *kthread_create(struct proc *proc, kthread_func_t func, long arg1,
  */
 kthread_t *kthread_clone(kthread_t *thr);
 
+/* Affinity mask allowing every core (the default for new threads). */
+#define KT_AFFINITY_ANY (~0UL)
+
+/**
+ * Restricts the cores thr may run on to those set in mask (bit n = core
+ * n). The mask is honored when the thread is enqueued on a run queue and
+ * by work stealing; a thread that is already running or already enqueued
+ * is not migrated, so the restriction takes effect at its next wakeup.
+ *
+ * @param thr the thread to restrict
+ * @param mask the set of allowed cores; must include at least one core
+ *  that is online
+ */
+void kthread_set_affinity(kthread_t *thr, uint64_t mask);
+
 /**
  * Frees resources associated with a thread.
  *
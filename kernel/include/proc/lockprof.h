@@ -0,0 +1,73 @@
+#pragma once
+
+#include "config.h"
+#include "types.h"
+
+#if LOCK_PROFILING
+
+/*===========
+ * Structures
+ *==========*/
+
+/*
+ * Per-lock bookkeeping embedded in kmutex_t and spinlock_t when lock
+ * profiling is compiled in. Records who acquired the lock and when, so
+ * the hold time can be charged back to the acquiring call site on
+ * release.
+ */
+typedef struct lockprof_lock
+{
+    const void *lp_site;  /* call site of the current holder */
+    uint64_t lp_acquired; /* TSC timestamp of the acquisition */
+} lockprof_lock_t;
+
+/*==========
+ * Functions
+ *=========*/
+
+/**
+ * Returns the current TSC tick count.
+ */
+static inline uint64_t lockprof_ticks()
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Records a successful lock acquisition: bumps the call site's
+ * acquisition count, charges it the time spent waiting, and stamps the
+ * lock for the matching lockprof_unlocked() call.
+ *
+ * @param lp the lock's embedded profiling state
+ * @param site the caller of the lock function (__builtin_return_address)
+ * @param wait_start TSC timestamp from just before the acquisition began
+ */
+void lockprof_locked(lockprof_lock_t *lp, const void *site,
+                     uint64_t wait_start);
+
+/**
+ * Records a lock release, updating the acquiring call site's maximum
+ * hold time.
+ *
+ * @param lp the lock's embedded profiling state
+ */
+void lockprof_unlocked(lockprof_lock_t *lp);
+
+/**
+ * Formats the profiling table (one call site per line: site address,
+ * acquisitions, total wait ticks, max hold ticks) into the given buffer.
+ *
+ * @param buf the buffer to write into
+ * @param size size of the buffer
+ * @return number of bytes written, at most size
+ */
+size_t lockprof_info(char *buf, size_t size);
+
+/**
+ * Clears all recorded statistics.
+ */
+void lockprof_reset();
+
+#endif
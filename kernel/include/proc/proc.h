@@ -35,6 +35,7 @@ typedef struct proc
     struct proc *p_pproc; /* Parent process */
 
     list_link_t p_list_link;  /* Link of list of all processes */
+    list_link_t p_hash_link;  /* Link on the pid hash table bucket */
     list_link_t p_child_link; /* Link on parent's list of children */
 
     long p_status;        /* Exit status */
@@ -43,15 +44,38 @@ typedef struct proc
     pml4_t *p_pml4; /* Page table. */
 
     /*
-     * If a parent is waiting on a child, the parent puts itself on its own
-     * p_wait queue. When a child terminates, it broadcasts on its parent's
-     * p_wait to wake it up.
+     * A vfork parent puts itself on its own p_wait queue until the child
+     * hands the borrowed address space back (see proc_vfork_done, which
+     * broadcasts on it).
      */
     ktqueue_t p_wait;
 
+    /*
+     * Completion queue for waitpid: when a process dies it links itself
+     * onto its parent's p_zombies (oldest first, under the parent's
+     * p_children_lock) and wakes one waiter on p_zombie_wait, so
+     * do_waitpid(-1) reaps the head in O(1) instead of scanning
+     * p_children - and only one waiter wakes per exit. A thread blocked
+     * on a specific pid counts itself in p_wait_specific while it
+     * sleeps; exits broadcast instead while any such waiter exists,
+     * since wake-one cannot know which waiter wants which child.
+     */
+    list_t p_zombies;
+    list_link_t p_zombie_link; /* Link on parent's p_zombies */
+    ktqueue_t p_zombie_wait;
+    long p_wait_specific;
+
     /* VFS related */
-    struct file *p_files[NFILES]; /* Open files */
-    struct vnode *p_cwd;          /* Current working directory */
+    /*
+     * The descriptor table, shared by reference with fork children until
+     * one side modifies it (see fdtable_t in fs/file.h). p_files is a
+     * cached alias of p_fdtable->fdt_files, kept so that descriptor
+     * lookups stay a single indexed load; fdtable_unshare refreshes both
+     * together.
+     */
+    struct fdtable *p_fdtable;
+    struct file **p_files;
+    struct vnode *p_cwd; /* Current working directory */
 
     /* VM related */
     /*
@@ -71,6 +95,25 @@ typedef struct proc
     void *p_start_brk;     /* Initial value of process break */
     struct vmmap *p_vmmap; /* List of areas mapped into process's
                               user address space. */
+    long p_vforked;        /* p_vmmap is borrowed from the parent (vfork);
+                              the parent is blocked until exec or exit
+                              hands it back via proc_vfork_done() */
+    size_t p_resident;     /* Pages this process brought into memory that
+                              are still resident (see pf_owner); used by
+                              the pageout daemon's per-process quota. */
+
+    /* Async I/O context (fs/aio.c), created on first aio_setup; NULL
+     * for processes that never use async I/O. */
+    struct aio_context *p_aio;
+
+    /* CPU-time totals in TSC cycles (see do_getrusage): exited threads
+     * fold their kt_utime_tsc/kt_stime_tsc in here, and do_waitpid folds
+     * a reaped child's totals (own plus its own reaped children) into
+     * the p_c* pair. Live threads' counters are summed on demand. */
+    uint64_t p_utime_tsc;  /* user cycles of this process's exited threads */
+    uint64_t p_stime_tsc;  /* system cycles of this process's exited threads */
+    uint64_t p_cutime_tsc; /* user cycles of reaped children */
+    uint64_t p_cstime_tsc; /* system cycles of reaped children */
 } proc_t;
 
 /*==========
@@ -107,9 +150,26 @@ proc_t *proc_create(const char *name);
  */
 void proc_destroy(proc_t *proc);
 
+/**
+ * Starts the reaper daemon, which batches the heavyweight part of
+ * process teardown (address-space and page-table reclamation) off the
+ * exit/wait path. Called once at boot, after the scheduler is running.
+ */
+void proc_reaper_start();
+
 
 proc_t *proc_lookup(pid_t pid);
 
+/**
+ * Formats one "pid name resident-pages pinned-pages" line per process into
+ * buf, for the resident stats device.
+ *
+ * @param buf the buffer to format into
+ * @param size the size of the buffer
+ * @return the number of bytes written
+ */
+size_t proc_resident_info(char *buf, size_t size);
+
 /**
  * Handles exiting the current process.
  *
@@ -156,6 +216,23 @@ void do_exit(long status);
  */
 pid_t do_waitpid(pid_t pid, int *status, int options);
 
+/* Values for do_getrusage's who (mirrored in the userland syscall
+ * header). */
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN (-1)
+
+/**
+ * Reports CPU time consumed, in TSC cycles, split into user and system
+ * time (see the accounting fields in kthread_t and proc_t).
+ *
+ * @param who RUSAGE_SELF for the calling process (exited threads plus
+ *  live ones) or RUSAGE_CHILDREN for its reaped children
+ * @param utime out: user cycles
+ * @param stime out: system cycles
+ * @return 0 on success, or -EINVAL for an unknown who
+ */
+long do_getrusage(int who, uint64_t *utime, uint64_t *stime);
+
 /**
  * This function implements the fork(2) system call.
  *
@@ -164,6 +241,44 @@ pid_t do_waitpid(pid_t pid, int *status, int options);
 struct regs;
 long do_fork(struct regs *regs);
 
+/**
+ * This function implements the vfork(2) system call: like fork, but the
+ * child borrows the parent's address space instead of cloning it, and the
+ * parent blocks until the child calls execve or exits. Spawn cost is
+ * therefore independent of how much the parent has mapped.
+ */
+long do_vfork(struct regs *regs);
+
+/**
+ * This function implements the thr_create(2) system call: creates an
+ * additional user thread in the current process, sharing its address
+ * space and file table. The thread begins execution at entry with arg as
+ * its argument; if stack is NULL a private anonymous stack is mapped for
+ * it. entry must not return - it should call thr_exit.
+ */
+long do_thr_create(struct regs *regs, void *entry, void *stack, void *arg);
+
+/**
+ * Like proc_create(), but the new process borrows curproc's address
+ * space rather than cloning it (for vfork).
+ */
+proc_t *proc_create_vfork(const char *name);
+
+/**
+ * Like proc_create(), but the new process gets a fresh empty vmmap
+ * instead of a COW clone of curproc's (for spawn, where the child execs
+ * immediately and would never touch the clone).
+ */
+proc_t *proc_create_spawn(const char *name);
+
+/**
+ * Called by a vforked process when it stops using the parent's address
+ * space (on exec, once the new vmmap is ready, or on exit): switches back
+ * to the process's own page tables, drops the borrowed vmmap pointer, and
+ * wakes the blocked parent.
+ */
+void proc_vfork_done();
+
 /*===========
  * Miscellany
  *==========*/
@@ -29,6 +29,15 @@ typedef struct ktqueue
         .tq_lock = SPINLOCK_INITIALIZER(sdf.tq_lock), .tq_size = 0, \
     }
 
+/*
+ * Number of priority levels in the run queue. Level 0 is the highest
+ * priority and is given to threads waking from a sleep (they are presumed
+ * interactive); threads that burn through their time slice decay toward
+ * SCHED_NUM_PRIOS - 1. New threads start at SCHED_PRIO_DEFAULT.
+ */
+#define SCHED_NUM_PRIOS 3
+#define SCHED_PRIO_DEFAULT 1
+
 /*
  * kthread declaration to make function signatures happy
  */
@@ -72,6 +81,18 @@ void sched_make_runnable(struct kthread *thr);
  */
 void sched_sleep_on(ktqueue_t *q, spinlock_t *lock);
 
+/**
+ * Causes the current thread to enter into an uncancellable sleep on the
+ * given queue, waking after at most the given number of ticks if nothing
+ * else wakes it first.
+ *
+ * @param q the queue to sleep on
+ * @param lock optional lock for release in another context
+ * @param ticks the maximum number of timer ticks to sleep for
+ * @return -ETIMEDOUT if the sleep timed out and 0 otherwise
+ */
+long sched_sleep_on_timeout(ktqueue_t *q, spinlock_t *lock, uint64_t ticks);
+
 /**
  * Causes the current thread to enter into a cancellable sleep on the
  * given queue.
@@ -83,7 +104,10 @@ void sched_sleep_on(ktqueue_t *q, spinlock_t *lock);
 long sched_cancellable_sleep_on(ktqueue_t *queue, spinlock_t *lock);
 
 /**
- * Wakes up a thread from q.
+ * Wakes up a thread from q. Threads are woken in FIFO order (oldest
+ * sleeper first), so this is the preferred wakeup when one waiter can
+ * make progress: waking the whole queue just makes the losers re-block
+ * through full sched_switch() cycles.
  *
  * @param q queue
  * @param thrp if an address is provided, *thrp is set to the woken up thread
@@ -92,12 +116,68 @@ long sched_cancellable_sleep_on(ktqueue_t *queue, spinlock_t *lock);
 void sched_wakeup_on(ktqueue_t *q, struct kthread **thrp);
 
 /**
- * Wake up all threads running on the queue.
+ * Wake up all threads running on the queue. Use when every waiter can
+ * make progress from the event (state changes that never revert, or
+ * waiters watching disjoint conditions); otherwise prefer
+ * sched_wakeup_on.
  *
  * @param q the queue to wake up threads from
  */
 void sched_broadcast_on(ktqueue_t *q);
 
+/**
+ * Moves up to nmove sleeping threads (oldest first) from one queue to
+ * another without waking them.
+ *
+ * @param from the queue to move threads off of
+ * @param to the queue to move threads onto
+ * @param nmove the maximum number of threads to move
+ * @return the number of threads moved
+ */
+size_t sched_requeue_on(ktqueue_t *from, ktqueue_t *to, size_t nmove);
+
+/**
+ * Raises thr's effective priority to at least prio (0 is highest) on
+ * behalf of a mutex waiter; see kmutex_lock. A runnable thread is
+ * re-enqueued at the boosted run queue level.
+ *
+ * @param thr the thread receiving the donation
+ * @param prio the donated priority level
+ */
+void sched_priority_donate(struct kthread *thr, int prio);
+
+/**
+ * Sets thr's donated priority to exactly prio (SCHED_NUM_PRIOS clears
+ * the donation) and recomputes the effective priority; see
+ * kmutex_unlock.
+ *
+ * @param thr the thread whose donation is replaced
+ * @param prio the new donated priority level
+ */
+void sched_priority_set_inherited(struct kthread *thr, int prio);
+
+/**
+ * Places thr in the deadline/budget scheduling class: it runs at the
+ * top priority for up to budget timer ticks out of every period ticks
+ * and at the bottom priority for the remainder of each period. Intended
+ * for kernel service threads (writeback, readahead) that should make
+ * steady progress without competing with foreground threads once they
+ * have had their share; exempts the thread from the usual yield decay
+ * and wakeup boost.
+ *
+ * @param thr the thread to place in the class
+ * @param budget top-priority ticks per period; 0 < budget <= period
+ * @param period the period length in ticks
+ */
+void sched_set_deadline(struct kthread *thr, uint64_t budget,
+                        uint64_t period);
+
+/**
+ * Charges one timer tick against the running thread's deadline budget,
+ * if it is in the class; called from the timer tick handler.
+ */
+void sched_deadline_tick(void);
+
 /**
  * Cancel the given thread from the queue it sleeps on.
  *
@@ -120,6 +200,65 @@ void sched_queue_init(ktqueue_t *queue);
  */
 long sched_queue_empty(ktqueue_t *queue);
 
+/**
+ * Returns the number of runnable threads currently queued on the given
+ * core's run queue, summed across priority levels. Unlocked snapshot;
+ * intended for the stats devices.
+ *
+ * @param core the core to inspect
+ * @return the run queue depth
+ */
+size_t sched_runq_depth(long core);
+
+/* Moves one runnable thread whose affinity allows core to from core
+ * from's run queue to core to's; returns 1 if a thread moved. Used by
+ * the balance daemon (see proc/balanced.c). */
+long sched_migrate_one(long from, long to);
+
+/**
+ * Returns the number of context switches the given core has performed
+ * since boot. Unlocked snapshot; intended for the stats devices.
+ *
+ * @param core the core to inspect
+ * @return the context switch count
+ */
+uint64_t sched_context_switches(long core);
+
+/**
+ * Returns whether thr is executing on some core right now, verified
+ * against the owning core's published curthr rather than just
+ * thr->kt_state. Unlocked snapshot; intended for adaptive spinners
+ * deciding whether a lock holder is worth busy-waiting for.
+ *
+ * @param thr the thread to inspect
+ * @return nonzero if the thread is currently on a CPU
+ */
+long sched_thread_on_cpu(struct kthread *thr);
+
+/**
+ * Formats every core's scheduler latency histograms (log2 TSC-cycle
+ * buckets of run-queue wait and switch duration) and involuntary
+ * preemption counts into buf. Unlocked snapshot; intended for the stats
+ * devices.
+ *
+ * @param buf the buffer to format into
+ * @param size the size of the buffer
+ * @return the number of bytes written
+ */
+size_t sched_latency_info(char *buf, size_t size);
+
+/**
+ * CPU-time accounting boundary: charges the TSC cycles since curthr's
+ * last boundary to its user or system total (per kt_in_user) and starts
+ * the next interval with kt_in_user set to in_user. Called at the
+ * syscall boundary and on first entry to userland; dispatch and
+ * switch-away inside core_switch() stamp and charge directly. A few
+ * cycles per call - no sampling involved.
+ *
+ * @param in_user whether the thread is about to execute userland code
+ */
+void sched_acct_mark(long in_user);
+
 /**
  * Functions for managing the current thread's preemption status.
  */
@@ -1,13 +1,36 @@
 #pragma once
 
+#include "proc/lockprof.h"
+
+/*
+ * Per-waiter queue node for MCS-mode spinlocks. Padded to a cacheline so
+ * each waiter spins on memory nobody else writes.
+ */
+typedef struct mcs_node
+{
+    struct mcs_node *mn_next;
+    volatile long mn_locked;
+} __attribute__((aligned(64))) mcs_node_t;
+
 typedef struct spinlock
 {
     volatile char s_locked;
+    /*
+     * If set (see spinlock_init_mcs), contended acquisitions queue up
+     * MCS-style: each waiter spins on its own cacheline and the lock is
+     * handed off FIFO, instead of every waiter hammering s_locked.
+     */
+    char s_mcs;
+    struct mcs_node *s_tail;  /* tail of the MCS waiter queue */
+    struct mcs_node *s_owner; /* queue node held by the current owner */
+#if LOCK_PROFILING
+    lockprof_lock_t s_lp; /* contention profiling state */
+#endif
 } spinlock_t;
 
-#define SPINLOCK_INITIALIZER(lock) \
-    {                              \
-        .s_locked = 0              \
+#define SPINLOCK_INITIALIZER(lock)                              \
+    {                                                           \
+        .s_locked = 0, .s_mcs = 0, .s_tail = NULL, .s_owner = NULL \
     }
 
 /**
@@ -16,6 +39,14 @@ typedef struct spinlock
  */
 void spinlock_init(spinlock_t *lock);
 
+/**
+ * Initializes the specified spinlock_t in MCS (queued) mode. Use for locks
+ * that see real multi-core contention; uncontended cost is one extra
+ * atomic exchange over the plain test-and-set lock.
+ * @param lock the spinlock to initialize
+ */
+void spinlock_init_mcs(spinlock_t *lock);
+
 /**
  * Locks the specified spinlock.
  *
@@ -0,0 +1,7 @@
+#pragma once
+
+long kbench_main(long, void *);
+
+/* Headless run for benchmark-mode boots: writes CSV results to
+ * /kbench.out instead of printing (see Config.mk's BENCHMODE). */
+long kbench_headless(void);
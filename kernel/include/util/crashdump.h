@@ -0,0 +1,51 @@
+#pragma once
+
+#include "types.h"
+
+#include "mm/swap.h"
+
+/*
+ * Post-mortem crash dumps.
+ *
+ * A panic leaves nothing behind but whatever made it out the serial port,
+ * so the performance-relevant state at the moment of death - queue
+ * depths, allocator occupancy, the buffered debug log, the trace rings -
+ * is lost with the machine. crashdump_save() (called from dbg_panic)
+ * formats that state into a static buffer and writes it to a reserved
+ * region at the tail of the swap disk using polling-mode SATA writes; at
+ * that point the completion interrupt, the scheduler, and the I/O locks
+ * can no longer be trusted, so the normal disk path is off limits (see
+ * sata_write_poll). The dump survives the reboot and the kshell
+ * 'crashdump' command reads it back.
+ */
+
+/* Blocks reserved at the tail of the swap disk; swap_start() keeps the
+ * slot allocator off of them. 64 blocks = 256 KiB of dump text. */
+#define CRASHDUMP_BLOCKS 64
+#define CRASHDUMP_FIRST_BLOCK (SWAP_SLOTS - CRASHDUMP_BLOCKS)
+
+/* Looks up the dump device; without it crashdump_save degrades to a
+ * no-op and panics lose nothing they weren't already losing. */
+void crashdump_init(void);
+
+/**
+ * Captures and writes the dump. Called from dbg_panic with the panic
+ * site and the formatted panic message; must not sleep, allocate, or
+ * take locks. Best effort throughout: any failure just leaves a partial
+ * (or no) dump.
+ */
+void crashdump_save(const char *file, int line, const char *func,
+                    const char *msg);
+
+/**
+ * Reads back the dump retained on disk (normal context, normal I/O
+ * path), following the dbg_infofunc_t buffer conventions. Returns 0 if
+ * no dump is recorded.
+ */
+size_t crashdump_info(char *buf, size_t size);
+
+/**
+ * Discards the retained dump so a stale one can't be mistaken for the
+ * product of a later crash.
+ */
+long crashdump_clear(void);
@@ -177,20 +177,35 @@ const char *dbg_color(uint64_t d_mode);
 
 #ifndef NDEBUG
 extern spinlock_t debug_lock;
-#define dbg(mode, ...)                                               \
-    do                                                               \
-    {                                                                \
-        if (dbg_active(mode))                                        \
-        {                                                            \
-            DEBUG_ENTER                                              \
-            dbg_print("%s", dbg_color(mode));                        \
-            dbg_print("C%ld P%ld ", curcore.kc_id,                   \
-                      curproc ? curproc->p_pid : -1L);               \
-            dbg_print("%s:%d %s(): ", __FILE__, __LINE__, __func__); \
-            dbg_print(__VA_ARGS__);                                  \
-            dbg_print("%s", _NORMAL_);                               \
-            DEBUG_EXIT                                               \
-        }                                                            \
+
+/* Logs a message into the current core's ring (or emits it synchronously
+ * before the drain thread exists); dbg() and dbgq() expand to this. The
+ * ring path stores the format pointer and raw argument words and defers
+ * formatting to the drain thread or the dbglog dump. Pass NULL for file
+ * to omit the file:line function() prefix. */
+void dbg_log(uint64_t mode, const char *file, int line, const char *func,
+             const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+
+/* Spawns the drain thread and switches dbg() over to the rings. */
+void dbg_ring_start(void);
+
+/* Drains all rings synchronously and disables buffering (panic path). */
+void dbg_ring_flush(void);
+
+/* Fills buf with the retained ring records matching the mode mask, oldest
+ * first, following the dbg_infofunc_t conventions. */
+size_t dbg_ring_info(uint64_t modes, char *buf, size_t size);
+
+/* Returns the mode mask for a name from DBG_TAB, or 0 if unknown. */
+uint64_t dbg_mode_lookup(const char *name);
+
+#define dbg(mode, ...)                                                \
+    do                                                                \
+    {                                                                 \
+        if (dbg_active(mode))                                         \
+        {                                                             \
+            dbg_log(mode, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        }                                                             \
     } while (0)
 
 #define dbg_force(mode, ...)                                     \
@@ -206,19 +221,13 @@ extern spinlock_t debug_lock;
         DEBUG_EXIT                                               \
     } while (0)
 
-#define dbgq(mode, ...)                                \
-    do                                                 \
-    {                                                  \
-        if (dbg_active(mode))                          \
-        {                                              \
-            DEBUG_ENTER                                \
-            dbg_print("%s", dbg_color(mode));          \
-            dbg_print("C%ld P%ld ", curcore.kc_id,     \
-                      curproc ? curproc->p_pid : -1L); \
-            dbg_print(__VA_ARGS__);                    \
-            dbg_print("%s", _NORMAL_);                 \
-            DEBUG_EXIT                                 \
-        }                                              \
+#define dbgq(mode, ...)                            \
+    do                                             \
+    {                                              \
+        if (dbg_active(mode))                      \
+        {                                          \
+            dbg_log(mode, NULL, 0, NULL, __VA_ARGS__); \
+        }                                          \
     } while (0)
 
 #define dbginfo(mode, func, data)                      \
@@ -249,6 +258,8 @@ void dbg_add_modes(const char *modes);
 #define dbg_active(mode) 0
 #define dbg_add_mode(mode)
 #define dbg_add_modes(modes)
+#define dbg_ring_start()
+#define dbg_ring_flush()
 #endif
 
 noreturn void dbg_panic(const char *file, int line, const char *func,
@@ -257,7 +268,19 @@ noreturn void dbg_panic(const char *file, int line, const char *func,
 
 #define panic(...) dbg_panic(__FILE__, __LINE__, __func__, __VA_ARGS__)
 
-#ifndef NDEBUG
+/* Leveled assertions, selected by KASSERT_LEVEL in config.h: KASSERT and
+ * its comparison variants are the cheap always-on invariants, compiled at
+ * level 1 and up; KASSERT_EXPENSIVE marks checks that walk a whole
+ * structure (O(n) or worse) and is compiled only at level 2. Defining
+ * NDEBUG forces level 0, dropping everything. */
+#include "config.h"
+
+#ifdef NDEBUG
+#undef KASSERT_LEVEL
+#define KASSERT_LEVEL 0
+#endif
+
+#if KASSERT_LEVEL >= 1
 #define KASSERT(x)                             \
     do                                         \
     {                                          \
@@ -306,3 +329,9 @@ static long greaterthaneq(long l, long r) { return l >= r; }
 #define KASSERT_GREQ(l, r)
 #define KASSERT_LESSEQ(l, r)
 #endif
+
+#if KASSERT_LEVEL >= 2
+#define KASSERT_EXPENSIVE(x) KASSERT(x)
+#else
+#define KASSERT_EXPENSIVE(x)
+#endif
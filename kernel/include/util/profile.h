@@ -0,0 +1,44 @@
+#pragma once
+
+#include "main/interrupt.h"
+#include "types.h"
+
+/*
+ * Statistical kernel profiler.
+ *
+ * While profiling is enabled, the APIC timer interrupt hands every
+ * interrupted register frame to profile_sample(), which bins the RIP into a
+ * per-core hash of (address, count) pairs - a few memory references per
+ * tick, no allocation, no locks. The report maps the sampled addresses to
+ * function names using the symbol table the Makefile embeds in the
+ * .profsyms section: the kernel is linked, its text symbols are extracted
+ * with nm, and the table is compiled in by a second link. The section sits
+ * at the very end of the image so the second link does not move anything
+ * the table describes. Control and reporting are via the kshell 'profile'
+ * command.
+ */
+
+typedef struct profsym
+{
+    uintptr_t ps_addr;
+    char ps_name[48];
+} profsym_t;
+
+extern long profile_enabled;
+
+/**
+ * Bins one sample; called from the timer interrupt with the interrupted
+ * register frame.
+ */
+void profile_sample(regs_t *regs);
+
+/**
+ * Discards all samples. Only call while profiling is disabled.
+ */
+void profile_reset(void);
+
+/**
+ * Formats the profile report (sample totals, then functions by descending
+ * sample count) into buf, following the dbg_infofunc_t conventions.
+ */
+size_t profile_info(const void *data, char *buf, size_t size);
@@ -0,0 +1,25 @@
+/*
+ *   FILE: reclaim.h
+ *  DESCR: epoch-based deferred reclamation for lock-free structures
+ */
+
+#pragma once
+
+#include "util/list.h"
+
+/*
+ * A deferral record, embedded in the structure to be freed (in the same
+ * way as list_link_t). The free callback receives the node; use
+ * CONTAINER_OF to recover the enclosing structure. Callbacks run in the
+ * context-switch path with interrupts disabled, so they must not block;
+ * returning memory to the slab or kmalloc is fine.
+ */
+typedef struct reclaim_node
+{
+    list_link_t rn_link;
+    void (*rn_free)(struct reclaim_node *node);
+} reclaim_node_t;
+
+void reclaim_defer(reclaim_node_t *node, void (*free_fn)(reclaim_node_t *));
+
+void reclaim_quiesce(void);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "util/atomic.h"
+#include "util/debug.h"
+
+/*
+ * Shared reference counting.
+ *
+ * A refcount_t is an atomic counter with lock-free fast paths, used by
+ * the objects whose ref/unref sits on the fault and syscall paths
+ * (mobjs, and through their embedded mobj vnodes; open files;
+ * descriptor tables). The conventions:
+ *
+ *  - refcount_inc takes a reference the caller is entitled to because it
+ *    already holds one, directly or through a structure that does. It
+ *    must never see a zero count - that object is already being torn
+ *    down - and debug builds KASSERT it.
+ *
+ *  - refcount_inc_not_zero is for lock-free lookups that hold no
+ *    reference yet (fget's table probe, the pageout daemon chasing
+ *    pf_mobj): instead of resurrecting a dying object it fails, and the
+ *    lookup behaves as if the teardown had finished first.
+ *
+ *  - refcount_dec_and_test returns 1 for exactly one caller, who owns
+ *    the teardown from that point. Decrementing a zero count is a
+ *    double put, and debug builds KASSERT that too.
+ *
+ * The counter is a bare atomic_t underneath, so existing invariant
+ * assertions may keep reading the field directly; treat such reads as
+ * advisory unless the count cannot change (for example, it is known to
+ * be 1 and only the owner could grow it).
+ */
+typedef atomic_t refcount_t;
+
+#define REFCOUNT_INIT(n) ATOMIC_INIT(n)
+
+static inline void refcount_init(refcount_t *rc, int n) { atomic_set(rc, n); }
+
+static inline int refcount_read(const refcount_t *rc) { return *rc; }
+
+static inline void refcount_inc(refcount_t *rc)
+{
+    KASSERT(*rc > 0 && "refcount_inc of a dead object");
+    atomic_inc(rc);
+}
+
+static inline long refcount_inc_not_zero(refcount_t *rc)
+{
+    return atomic_inc_not_zero(rc);
+}
+
+static inline long refcount_dec_and_test(refcount_t *rc)
+{
+    KASSERT(*rc > 0 && "refcount underflow");
+    return atomic_dec_and_test(rc);
+}
@@ -18,6 +18,13 @@ void time_sleep(time_t ms);
 
 long do_usleep(useconds_t usec);
 
+/* Converts microseconds to timer ticks (the unit of jiffies). */
+uint64_t time_usec_to_ticks(uint64_t usec);
+
+/* Restarts the adaptive preemption quantum for this core; called at
+ * dispatch so a freshly scheduled thread gets a full slice. */
+void time_slice_reset();
+
 time_t core_uptime();
 
 time_t do_time();
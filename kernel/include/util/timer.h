@@ -3,14 +3,27 @@
 
 #include "util/list.h"
 
+/* core value for a timer that is not parked in a core's insertion buffer
+ * (i.e. it is unarmed, on the timer wheel, or about to fire) */
+#define TIMER_CORE_NONE (-1)
+
 typedef struct timer
 {
     void (*function)(uint64_t data);
     uint64_t data;
     uint64_t expires;
+    /* the core whose insertion buffer holds this timer, or TIMER_CORE_NONE;
+     * identifies the lock protecting the timer's link */
+    long core;
     list_link_t link;
 } timer_t;
 
+/* Sets up the timer wheel; called once from kmain. */
+void timers_init();
+
+/* Sets up the calling core's timer insertion buffer. */
+void timers_enable();
+
 void timer_init(timer_t *timer);
 
 void timer_add(timer_t *timer);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "kernel.h"
+#include "types.h"
+
+/*
+ * Structured event tracing.
+ *
+ * Where dbg() produces text, a tracepoint produces a fixed-size binary
+ * record: a TSC timestamp plus two site-chosen arguments, written into a
+ * per-core ring. TRACE() compiles to a load-and-test of trace_enabled and
+ * (when tracing is on) a single call, so sites are cheap enough to keep in
+ * hot paths like core_switch() permanently. Pairs of sites (submit and
+ * complete, entry and exit) give in-situ latency distributions once the
+ * records are pulled out.
+ *
+ * TRACEPOINT(name) at file scope places the site's registry entry in the
+ * .tracepoint section; the linker collects the entries between
+ * kernel_start_tracepoint and kernel_end_tracepoint (see link.ld), so sites
+ * are registered at compile time with no runtime call. Extraction is via
+ * the kshell 'trace' command.
+ */
+
+typedef struct trace_point
+{
+    const char *tp_name;
+    uint64_t tp_hits;
+} trace_point_t;
+
+typedef struct trace_record
+{
+    uint64_t tr_seq; /* sequence + 1, stored once the record is complete */
+    uint64_t tr_tsc;
+    trace_point_t *tr_point;
+    uint64_t tr_arg0;
+    uint64_t tr_arg1;
+} trace_record_t;
+
+#define TRACEPOINT(name)                     \
+    static trace_point_t __tracepoint_##name \
+        __attribute__((section(".tracepoint"), used)) = {#name, 0}
+
+#define TRACE(name, arg0, arg1)                                \
+    do                                                         \
+    {                                                          \
+        if (trace_enabled)                                     \
+        {                                                      \
+            trace_emit(&__tracepoint_##name, (uint64_t)(arg0), \
+                       (uint64_t)(arg1));                      \
+        }                                                      \
+    } while (0)
+
+extern long trace_enabled;
+
+/**
+ * Writes one record to the current core's ring. Call through the TRACE()
+ * macro, which performs the enabled check inline.
+ */
+void trace_emit(trace_point_t *tp, uint64_t arg0, uint64_t arg1);
+
+/**
+ * Discards all retained records and zeroes every site's hit count. Only
+ * call while tracing is disabled.
+ */
+void trace_reset(void);
+
+/**
+ * Formats the tracepoint registry (one site per line: name and hit count)
+ * into buf, following the dbg_infofunc_t conventions.
+ */
+size_t trace_points_info(const void *data, char *buf, size_t size);
+
+/**
+ * Formats the retained records (core, timestamp, site, arguments; oldest
+ * first per core) into buf, following the dbg_infofunc_t conventions.
+ */
+size_t trace_records_info(const void *data, char *buf, size_t size);
@@ -4,8 +4,17 @@
 
 void shadow_init();
 
+/* Starts the shadow chain flattening daemon; called once the scheduler is
+ * up, alongside the other kernel daemons. */
+void shadowd_start();
+
 mobj_t *shadow_create(mobj_t *shadowed);
 
 void shadow_collapse(mobj_t *o);
 
+/* Returns 1 if the given (locked, unmapped) frame is a private copy whose
+ * contents match what the chain below o would supply anyway, so it can be
+ * dropped instead of paged out; see mm/pageoutd.c. */
+long shadow_pframe_redundant(mobj_t *o, struct pframe *pf);
+
 extern int shadow_count;
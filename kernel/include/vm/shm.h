@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+/* Named shared-memory objects: a shmget-style registry of anonymous
+ * memory objects that any number of processes can map (via do_shmat /
+ * MAP_SHARED), so cooperating processes exchange bulk data in place
+ * instead of copying it through pipes. */
+
+#define SHM_NAME_LEN 32
+#define SHM_MAX_OBJECTS 16
+
+/* Returns the id of the shared memory object called name, creating it
+ * with room for size bytes if it does not exist yet. */
+long do_shmget(const char *name, size_t size);
+
+/* Maps the object id into curproc's address space with the given
+ * protections (MAP_SHARED; at addr with MAP_FIXED semantics when addr is
+ * non-null). The chosen address is returned in ret. Detach is a plain
+ * munmap of the returned range. */
+long do_shmat(long id, void *addr, int prot, void **ret);
+
+/* Removes the object id from the registry. Existing mappings keep their
+ * references; the memory goes away once the last mapping is unmapped. */
+long do_shmrm(long id);
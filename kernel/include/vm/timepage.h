@@ -0,0 +1,46 @@
+#pragma once
+
+#include "types.h"
+
+struct vmmap;
+
+/*
+ * The shared time page: one read-only page mapped into every user
+ * address space at TIMEPAGE_ADDR (by _elf64_load), republished from the
+ * timer tick so userland can read the time without a syscall.
+ *
+ * tp_seq is a seqlock: it is bumped to odd before the tick's fields are
+ * rewritten and back to even after, so a reader retries whenever it
+ * sees an odd value or a value that changed across its reads. The tsc
+ * fields let a reader interpolate below tick granularity:
+ *
+ *   usec = tp_ticks * tp_tick_usec
+ *          + (rdtsc() - tp_tsc_at_tick) * tp_tick_usec / tp_tsc_per_tick
+ *
+ * The layout is ABI shared with userland; keep
+ * user/include/weenix/timepage.h in sync.
+ */
+typedef struct time_page
+{
+    uint64_t tp_seq;          /* odd while an update is in flight */
+    uint64_t tp_ticks;        /* timer ticks since boot */
+    uint64_t tp_tick_usec;    /* microseconds per tick */
+    uint64_t tp_tsc_at_tick;  /* rdtsc when tp_ticks was written */
+    uint64_t tp_tsc_per_tick; /* rdtsc delta across the last tick */
+    uint64_t tp_boot_sec;     /* wall-clock (Unix) seconds at boot */
+} time_page_t;
+
+/* Fixed user virtual address of the page: the top page of user memory
+ * (USER_MEM_HIGH - PAGE_SIZE). It is mapped before the stack is placed,
+ * so the stack lands just below it. */
+#define TIMEPAGE_ADDR 0x7ffffffff000UL
+
+void timepage_init();
+
+/* Publish a new tick; called from the timer interrupt on core 0 (see
+ * util/time.c). */
+void timepage_tick(uint64_t ticks, uint64_t tick_usec);
+
+/* Map the page read-only into map at TIMEPAGE_ADDR; called by
+ * _elf64_load for every new address space. */
+long timepage_map(struct vmmap *map);
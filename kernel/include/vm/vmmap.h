@@ -13,10 +13,30 @@ struct vnode;
 
 typedef struct vmmap
 {
-    list_t vmm_list;       /* list of virtual memory areas */
-    struct proc *vmm_proc; /* the process that corresponds to this vmmap */
+    list_t vmm_list;         /* list of virtual memory areas */
+    struct vmarea *vmm_tree; /* root of the vmarea index tree */
+    struct proc *vmm_proc;   /* the process that corresponds to this vmmap */
+    long vmm_clone_pending;  /* set while vmmap_clone snapshots this map;
+                                write faults by the process's other threads
+                                wait it out (see handle_pagefault), read
+                                faults proceed throughout */
 } vmmap_t;
 
+/* Node in a vmmap's AVL tree of vmareas, keyed by vma_start. Each node
+ * caches the number of free pages immediately below its vmarea (vtn_gap)
+ * and the largest such gap anywhere in its subtree (vtn_maxgap), so that
+ * vmmap_lookup and vmmap_find_range are both O(log n) instead of walking
+ * the list. The list remains the source of in-order iteration. */
+typedef struct vmtree_node
+{
+    struct vmarea *vtn_parent;
+    struct vmarea *vtn_left;
+    struct vmarea *vtn_right;
+    size_t vtn_height; /* height of this subtree (leaf == 1) */
+    size_t vtn_gap;    /* free pages between the previous vmarea and this one */
+    size_t vtn_maxgap; /* largest vtn_gap in this subtree */
+} vmtree_node_t;
+
 /* Make sure you understand why mapping boundaries are in terms of frame
  * numbers (page numbers) and not addresses */
 typedef struct vmarea
@@ -33,13 +53,25 @@ typedef struct vmarea
     int vma_flags; /* either MAP_SHARED or MAP_PRIVATE. It can also specify 
                       MAP_ANON and MAP_FIXED */
 
+    size_t vma_faults; /* page faults served in this area; paces the
+                          huge-page promotion checks (see
+                          vmmap_try_promote_huge) */
+
     struct vmmap *vma_vmmap; /* address space that this area belongs to */
     struct mobj *vma_obj;    /* the memory object that corresponds to this address region */
     list_link_t vma_plink;   /* link on process vmmap maps list */
+    vmtree_node_t vma_tnode; /* node in the vmmap's vmarea index tree */
 } vmarea_t;
 
 void vmmap_init(void);
 
+/* Allocate a zeroed, unlinked vmarea / free one, removing it from any
+ * map it is on and putting its vma_obj. Most callers should go through
+ * vmmap_map; the tests use these to build areas by hand. */
+vmarea_t *vmarea_alloc(void);
+
+void vmarea_free(vmarea_t *vma);
+
 vmmap_t *vmmap_create(void);
 
 void vmmap_destroy(vmmap_t **mapp);
@@ -51,11 +83,29 @@ vmarea_t *vmmap_lookup(vmmap_t *map, size_t vfn);
 long vmmap_map(vmmap_t *map, struct vnode *file, size_t lopage, size_t npages,
                int prot, int flags, off_t off, int dir, vmarea_t **new_vma);
 
+/* Like vmmap_map(), but maps an existing memory object (e.g. a shared
+ * memory object from vm/shm.c) rather than creating a fresh one; takes
+ * its own reference on mobj for the mapping. */
+long vmmap_map_mobj(vmmap_t *map, struct mobj *mobj, size_t lopage,
+                    size_t npages, int prot, int flags, off_t off, int dir,
+                    vmarea_t **new_vma);
+
 long vmmap_remove(vmmap_t *map, size_t lopage, size_t npages);
 
+/* Called from the page fault path after a fault in vma is served. Every
+ * few faults, checks whether the 2MB-aligned window around vfn is fully
+ * resident in a private anonymous area and, if so, migrates its data
+ * into a physically contiguous run and maps it with a single 2MB PDE. */
+void vmmap_try_promote_huge(vmarea_t *vma, size_t vfn);
+
 long vmmap_is_range_empty(vmmap_t *map, size_t startvfn, size_t npages);
 
-void vmmap_insert(vmmap_t *map, vmarea_t *new_vma); 
+void vmmap_insert(vmmap_t *map, vmarea_t *new_vma);
+
+/* Must be called after changing the bounds of an inserted vmarea in place
+ * (e.g. growing the heap) so the gaps cached in the index tree stay
+ * accurate; updates vma's own gap and that of its successor. */
+void vmmap_area_resized(vmarea_t *vma);
 
 ssize_t vmmap_find_range(vmmap_t *map, size_t npages, int dir);
 
@@ -243,6 +243,13 @@ inline static void __ioapic_setredir(uint32_t irq, uint8_t intr)
     ioapic_write(IRQ_TO_OFFSET(irq, 1), data);
 }
 
+inline static void __ioapic_set_affinity(uint32_t irq, uint8_t dest)
+{
+    uint32_t data = ioapic_read(IRQ_TO_OFFSET(irq, 1));
+    ((uint8_t *)&data)[3] = dest;
+    ioapic_write(IRQ_TO_OFFSET(irq, 1), data);
+}
+
 inline static void __ioapic_setmask(uint32_t irq, int mask)
 {
     uint32_t data = ioapic_read(IRQ_TO_OFFSET(irq, 0));
@@ -556,6 +563,18 @@ void apic_setredir(uint32_t irq, uint8_t intr)
     __ioapic_setmask(irq, 0);
 }
 
+void apic_set_irq_affinity(uint32_t irq, long core)
+{
+    /* Redirection entries use lowest-priority delivery to a logical
+     * destination (see __ioapic_setredir), and each core's logical id is
+     * (1 << core id), so a single-bit mask steers the IRQ to one core
+     * while 0xff restores delivery to whichever core the hardware picks. */
+    KASSERT(core <= apic_max_id());
+    uint8_t dest = core < 0 ? 0xff : (uint8_t)(1 << core);
+    dbg(DBG_CORE, "steering irq %u to logical destination 0x%x\n", irq, dest);
+    __ioapic_set_affinity(irq, dest);
+}
+
 void apic_start_processor(uint8_t processor, uint8_t execution_page)
 {
     // [+] TODO FIX MAGIC NUMBERS
@@ -397,6 +397,60 @@ intr_info_t intr_data;
  * debuggers. */
 static regs_t *_intr_regs CORE_SPECIFIC_DATA;
 
+/*
+ * Deferred interrupt work ("bottom halves"). Handlers hand the non-urgent
+ * part of their job to intr_defer(); interrupt_handler() drains the ring on
+ * the way out, after the EOI, with interrupts re-enabled between closures.
+ * The ring is per-core and needs no locking: enqueues happen in interrupt
+ * context (interrupts masked) and the drain runs on the same core. The
+ * active flag keeps a nested interrupt's exit path from draining the ring
+ * out from under the outer drain.
+ */
+#define INTR_DEFERRED_MAX 64
+
+typedef struct intr_deferred
+{
+    intr_work_func_t id_func;
+    void *id_arg;
+} intr_deferred_t;
+
+static intr_deferred_t intr_deferred_ring[INTR_DEFERRED_MAX] CORE_SPECIFIC_DATA;
+static size_t intr_deferred_head CORE_SPECIFIC_DATA;
+static size_t intr_deferred_tail CORE_SPECIFIC_DATA;
+static long intr_deferred_active CORE_SPECIFIC_DATA;
+
+void intr_defer(intr_work_func_t func, void *arg)
+{
+    KASSERT(!intr_enabled());
+    size_t next = (intr_deferred_head + 1) % INTR_DEFERRED_MAX;
+    KASSERT(next != intr_deferred_tail && "deferred work ring overflow");
+    intr_deferred_ring[intr_deferred_head].id_func = func;
+    intr_deferred_ring[intr_deferred_head].id_arg = arg;
+    intr_deferred_head = next;
+}
+
+static void intr_run_deferred(void)
+{
+    if (intr_deferred_active)
+    {
+        /* We interrupted a drain in progress; it will pick up whatever
+         * this interrupt enqueued. */
+        return;
+    }
+    intr_deferred_active = 1;
+    while (intr_deferred_tail != intr_deferred_head)
+    {
+        intr_deferred_t work = intr_deferred_ring[intr_deferred_tail];
+        intr_deferred_tail = (intr_deferred_tail + 1) % INTR_DEFERRED_MAX;
+        /* The hardware is acked and the EOI sent, so further interrupts
+         * can be taken while the closure runs. */
+        intr_enable();
+        work.id_func(work.id_arg);
+        intr_disable();
+    }
+    intr_deferred_active = 0;
+}
+
 inline uint8_t intr_setipl(uint8_t ipl)
 {
     uint8_t oldipl = apic_getipl();
@@ -425,6 +479,7 @@ static __attribute__((used)) void interrupt_handler(regs_t regs)
         panic("Unhandled interrupt 0x%x\n", (int)regs.r_intr);
     }
     _intr_regs = NULL;
+    intr_run_deferred();
 }
 
 int32_t intr_map(uint16_t irq, uint8_t intr)
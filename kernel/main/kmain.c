@@ -7,12 +7,22 @@
 #include <drivers/tty/vterminal.h>
 #include <main/io.h>
 #include <mm/mm.h>
+#include <mm/compactd.h>
+#include <mm/pagemerged.h>
+#include <mm/pageoutd.h>
+#include <mm/pagezerod.h>
+#include <mm/swap.h>
 #include <mm/slab.h>
+#include <mm/tlb.h>
+#include <test/kbench.h>
 #include <test/kshell/kshell.h>
 #include <util/time.h>
+#include <util/timer.h>
 #include <vm/anon.h>
 #include <vm/shadow.h>
+#include <vm/timepage.h>
 
+#include "util/crashdump.h"
 #include "util/debug.h"
 #include "util/gdb.h"
 #include "util/printf.h"
@@ -22,12 +32,18 @@
 #include "main/apic.h"
 #include "main/inits.h"
 
+#include "proc/balanced.h"
+#include "proc/futex.h"
+
+#include "drivers/blockdev.h"
 #include "drivers/dev.h"
 #include "drivers/pcie.h"
 
 #include "api/syscall.h"
 
+#include "fs/aio.h"
 #include "fs/fcntl.h"
+#include "fs/s5fs/s5fs.h"
 #include "fs/vfs.h"
 #include "fs/vfs_syscall.h"
 #include "fs/vnode.h"
@@ -51,8 +67,11 @@ static init_func_t init_funcs[] = {
     intr_init,
     page_init,
     pt_init,
+    tlb_shootdown_init,
     acpi_init,
+    page_numa_init,
     apic_init,
+    timers_init,
     core_init,
     slab_init,
     pframe_init,
@@ -61,10 +80,12 @@ static init_func_t init_funcs[] = {
 #ifdef __VM__
     anon_init,
     shadow_init,
+    timepage_init,
 #endif
     vmmap_init,
     proc_init,
     kthread_init,
+    futex_init,
 #ifdef __DRIVERS__
     chardev_init,
     blockdev_init,
@@ -103,6 +124,8 @@ void kmain()
  * 2) /dev/zero
  * 3) /dev/ttyX for 0 <= X < __NTERMS__
  * 4) /dev/hdaX for 0 <= X < __NDISKS__
+ * 5) /dev/stats/<metric> for each stats device minor
+ * 6) /dev/lo0, the loopback packet device
  */
 static void make_devices()
 {
@@ -130,6 +153,24 @@ static void make_devices()
         status = do_mknod(path, S_IFBLK, MKDEVID(DISK_MAJOR, i));
         KASSERT(!status || status == -EEXIST);
     }
+
+    status = do_mkdir("/dev/stats");
+    KASSERT(!status || status == -EEXIST);
+
+    static const char *stat_names[STAT_NUM_MINORS] = {
+        "runq", "ctxswitch", "pagefree", "slab", "sata", "kmalloc",
+        "resident", "schedlat", "syscall", "mounts", "swap", "lo",
+        "readahead"};
+    for (long i = 0; i < STAT_NUM_MINORS; i++)
+    {
+        snprintf(path, sizeof(path), "/dev/stats/%s", stat_names[i]);
+        dbg(DBG_INIT, "Creating stats mknod with path %s\n", path);
+        status = do_mknod(path, S_IFCHR, MKDEVID(STAT_MAJOR, i));
+        KASSERT(!status || status == -EEXIST);
+    }
+
+    status = do_mknod("/dev/lo0", S_IFCHR, MKDEVID(LO_MAJOR, 0));
+    KASSERT(!status || status == -EEXIST);
 }
 
 /*
@@ -162,6 +203,16 @@ static void *initproc_run(long arg1, void *arg2)
         dbg(DBG_INIT, "Initializing VFS...\n");
         vfs_init();
         make_devices();
+    #ifdef __BENCHMODE__
+        /* Benchmark-mode boot (see Config.mk): no shell and no
+         * terminals - run the kbench suite headlessly, leave the CSV
+         * results in /kbench.out, and exit the VM through qemu's
+         * isa-debug-exit device (the weenix script always attaches
+         * one), so CI can read the numbers off the disk image. */
+        kbench_headless();
+        outb(0x501, 0);
+        panic("benchmark mode: isa-debug-exit had no effect\n");
+    #endif
     #endif
     char *const argv[] = {NULL}; 
     char *const envp[] = {NULL};
@@ -207,6 +258,31 @@ void initproc_start()
     // put kassertions about the validity of the output of proc_create here
     kthread_t* thread = kthread_create(init_process, &initproc_run, 0, NULL);
     sched_make_runnable(thread);
+    /* Created after init (so init keeps PID_INIT) and parented to the idle
+     * process, so init's wait loop never has to reap them. */
+    pageoutd_start();
+    compactd_start();
+    aio_start();
+    proc_reaper_start();
+    dbg_ring_start();
+#ifdef __SMP__
+    balanced_start();
+#endif
+#ifdef __DRIVERS__
+    blockdev_elevator_start();
+    blockdev_readahead_start();
+    tty_input_start();
+    crashdump_init();
+#endif
+#ifdef __VM__
+    shadowd_start();
+    pagezerod_start();
+    swap_start();
+    pagemerged_start();
+#endif
+#ifdef __S5FS__
+    s5fs_writeback_start();
+#endif
     context_make_active(&curcore.kc_ctx);
 }
 
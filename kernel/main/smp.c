@@ -5,10 +5,14 @@
 #include "main/apic.h"
 #include "main/inits.h"
 
+#include "mm/slab.h"
 #include "mm/tlb.h"
 
+#include "proc/fpu.h"
+
 #include "util/string.h"
 #include "util/time.h"
+#include "util/timer.h"
 
 static long smp_processor_count;
 static spinlock_t smp_startup_spinlock =
@@ -21,16 +25,17 @@ extern uintptr_t smp_initialization_end;
 #define smp_initialization_size \
     (smp_initialization_end - smp_initialization_start)
 
-static void smp_start_processor(uint8_t apic_id);
 static long smp_stop_processor(regs_t *regs);
 
 extern void *csd_start;
+extern void *csd_remote_end;
 extern void *csd_end;
 #define CSD_START ((uintptr_t)&csd_start)
+#define CSD_REMOTE_END ((uintptr_t)&csd_remote_end)
 #define CSD_END ((uintptr_t)&csd_end)
 #define CSD_PAGES (uintptr_t)((CSD_END - CSD_START) >> PAGE_SHIFT)
 
-core_t curcore CORE_SPECIFIC_DATA;
+core_t curcore CORE_SPECIFIC_DATA_REMOTE;
 uintptr_t csd_vaddr_table[MAX_LAPICS] = {NULL};
 
 void map_in_core_specific_data(pml4_t *pml4)
@@ -78,6 +83,7 @@ void core_init()
 
     intr_init();
     gdt_init();
+    fpu_init();
 
     apic_enable();
     time_init();
@@ -87,6 +93,12 @@ void core_init()
     KASSERT(stack != NULL);
 
     context_setup_raw(&curcore.kc_ctx, core_switch, stack, PAGE_SIZE, pt_get());
+
+    // our copy of the core-specific data is mapped in and zeroed, so the
+    // core-local page and slab magazines are safe to use from here on out
+    page_magazines_enable();
+    slab_magazines_enable();
+    timers_enable();
 }
 
 void __attribute__((used)) smp_processor_entry()
@@ -105,35 +117,58 @@ void __attribute__((used)) smp_processor_entry()
 
 /*
  * Prepare for SMP by copying the real-mode trampoline code into the
- * first 1mb of memory.
+ * first 1mb of memory, then bring up every application processor.
+ *
+ * The INIT/SIPI kicks are all sent before waiting on any core, and the
+ * trampoline gives each core its own temp stack slot (keyed by APIC ID,
+ * see smp_trampoline.S), so the APs run firmware startup and core_init in
+ * parallel and boot pays one bring-up latency instead of one per core.
+ * Intel Vol. 3A 10-11, 10.4.7.3.
  */
 void smp_init()
 {
-    NOT_YET_IMPLEMENTED("SMP: smp_init");
-}
-
-// Intel Vol. 3A 10-11, 10.4.7.3
-static void smp_start_processor(uint8_t apic_id)
-{
-    // TODO: not necessarily true that apic_id == processor_id
-    dbg_force(DBG_CORE, "Booting C%d\n", apic_id);
-
     memcpy((void *)PHYS_OFFSET, (void *)smp_initialization_start,
            smp_initialization_size);
 
-    // First, send a INIT IPI
-
-    long prev_count = smp_processor_count;
-    apic_start_processor(apic_id, 0);
-
-    while (smp_processor_count == prev_count)
+    long expected = 0;
+    for (long id = 0; id <= apic_max_id(); id++)
+    {
+        if (id == apic_current_id())
+        {
+            continue;
+        }
+        dbg_force(DBG_CORE, "Booting C%ld\n", id);
+        // TODO: not necessarily true that apic_id == processor_id
+        apic_start_processor((uint8_t)id, 0);
+        expected++;
+    }
+
+    // One completion handshake for the whole broadcast: each AP bumps
+    // smp_processor_count from smp_processor_entry once it is on its own
+    // proper context and off the low-memory temp stack.
+    while (smp_processor_count < expected)
         ;
-
-    // by the time we get the spinlock, we are guaranteed that the core we are
-    // starting now has its own proper context and is no longer using the temp
-    // stack in the first 4 MB of RAM
     spinlock_lock(&smp_startup_spinlock);
     spinlock_unlock(&smp_startup_spinlock);
+    dbg_force(DBG_CORE, "all %ld application cores online\n", expected);
+
+    /* report the per-core data layout: the shared virtual window, the
+     * cacheline-isolated block of remotely-accessed variables at its
+     * front, and where each core's private backing pages live */
+    dbg_force(DBG_CORE,
+              "core-specific data: %lu page(s) per core at 0x%p..0x%p, "
+              "remote block 0x%p..0x%p (%lu bytes, cacheline-isolated)\n",
+              CSD_PAGES, (void *)CSD_START, (void *)CSD_END,
+              (void *)CSD_START, (void *)CSD_REMOTE_END,
+              CSD_REMOTE_END - CSD_START);
+    for (long id = 0; id <= apic_max_id(); id++)
+    {
+        if (csd_vaddr_table[id])
+        {
+            dbg(DBG_CORE, "  C%ld backed at physical 0x%p\n", id,
+                (void *)(csd_vaddr_table[id] - PHYS_OFFSET));
+        }
+    }
 }
 
 static long smp_stop_processor(regs_t *regs)
@@ -0,0 +1,211 @@
+/*
+ * Memory compaction: defragmenting physical memory on demand.
+ *
+ * After enough churn, multi-page allocations can fail with plenty of
+ * memory free simply because no aligned run of it is left. When that
+ * happens, page_alloc_n() wakes this daemon with the order it needed.
+ * A pass picks the 2^order-aligned block of physical memory that needs
+ * the fewest pages moved to become entirely free (page_compact_candidate)
+ * and migrates the movable frames in it to pages outside the block; each
+ * page freed coalesces with its buddies in the btree, and once the whole
+ * block is free the (likely retrying) caller's allocation succeeds.
+ *
+ * A frame is movable if it belongs to an evictable or swappable mobj and
+ * was never mapped into a page table - with no reverse mappings there is
+ * no way to fix up page-table entries pointing at the old page - so in
+ * practice compaction relocates the block caches and unmapped anonymous
+ * memory. Candidates are taken from the pageout daemon's LRU and their
+ * objects pinned by refcount, for the same lifetime reasons the swap
+ * victim scan works that way (see _pageoutd_swap_one); holding the
+ * frame's mutex during the copy excludes every reader, writer, and
+ * in-flight disk transfer, all of which hold it too.
+ */
+
+#include "globals.h"
+#include "kernel.h"
+
+#include "mm/compactd.h"
+#include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/pageoutd.h"
+#include "mm/pframe.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+/* Largest order any allocation has failed at since the last pass;
+ * 0 = no work pending. Protected by compactd_lock. */
+static size_t compactd_order;
+static spinlock_t compactd_lock = SPINLOCK_INITIALIZER(compactd_lock);
+static ktqueue_t compactd_queue;
+static long compactd_ready = 0;
+
+/* Candidate batch for one pass; only the daemon touches these. */
+#define COMPACTD_BATCH 64
+static mobj_t *compactd_objs[COMPACTD_BATCH];
+static uint64_t compactd_pagenums[COMPACTD_BATCH];
+
+/* How many pages from inside the target block we are willing to draw and
+ * park while hunting for a migration destination outside it. */
+#define COMPACTD_DISCARD_MAX 8
+
+void compactd_wakeup(size_t order)
+{
+    if (!compactd_ready)
+    {
+        return;
+    }
+    spinlock_lock(&compactd_lock);
+    if (order > compactd_order)
+    {
+        compactd_order = order;
+    }
+    sched_broadcast_on(&compactd_queue);
+    spinlock_unlock(&compactd_lock);
+}
+
+/*
+ * Migrate one frame of a pinned mobj out of [start, end): find it again
+ * by page number under the object's own lock (the LRU scan's pframe
+ * pointer cannot be trusted once the LRU lock is dropped), copy its page
+ * into one allocated outside the range, and free the old page so it can
+ * coalesce. Drops the reference the collector took on o. Returns 1 if a
+ * page was freed out of the range.
+ */
+static long compactd_migrate_one(mobj_t *o, uint64_t pagenum, void *start,
+                                 void *end)
+{
+    long moved = 0;
+    mobj_lock(o);
+    pframe_t *pf;
+    mobj_find_pframe(o, pagenum, &pf);
+    if (pf && pf->pf_addr && !pf->pf_mapped && pf->pf_addr >= start &&
+        pf->pf_addr < end)
+    {
+        /* The allocator may well hand back pages from inside the very
+         * block being compacted (they are mostly free); park those to
+         * the side until a destination outside it turns up. */
+        void *discard[COMPACTD_DISCARD_MAX];
+        size_t ndiscard = 0;
+        void *dest = NULL;
+        while (!dest && ndiscard < COMPACTD_DISCARD_MAX)
+        {
+            void *page = page_alloc();
+            if (!page)
+            {
+                break;
+            }
+            if (page >= start && page < end)
+            {
+                discard[ndiscard++] = page;
+                continue;
+            }
+            dest = page;
+        }
+        if (dest)
+        {
+            memcpy(dest, pf->pf_addr, PAGE_SIZE);
+            ppage_set_owner(dest, pf);
+            ppage_set_owner(pf->pf_addr, NULL);
+            page_free(pf->pf_addr);
+            pf->pf_addr = dest;
+            moved = 1;
+        }
+        while (ndiscard)
+        {
+            page_free(discard[--ndiscard]);
+        }
+    }
+    if (pf)
+    {
+        pframe_release(&pf);
+    }
+    mobj_unlock(o);
+    mobj_put(&o);
+    return moved;
+}
+
+/*
+ * One compaction pass: pick the aligned block needing the fewest pages
+ * moved, collect the movable frames inside it, and migrate them out.
+ * Returns the number of pages freed out of the block (0 means no
+ * candidate block or nothing movable, so further passes are futile until
+ * something changes).
+ */
+static size_t compactd_pass(size_t order)
+{
+    size_t busy;
+    void *start = page_compact_candidate(order, &busy);
+    if (!start)
+    {
+        return 0;
+    }
+    void *end = (void *)((uintptr_t)start + ((uintptr_t)PAGE_SIZE << order));
+    size_t n = pageoutd_collect_range(start, end, compactd_objs,
+                                     compactd_pagenums, COMPACTD_BATCH);
+    size_t moved = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        moved += (size_t)compactd_migrate_one(compactd_objs[i],
+                                              compactd_pagenums[i], start,
+                                              end);
+    }
+    dbg(DBG_PFRAME, "compactd: order %lu block 0x%p: %lu busy, %lu moved\n",
+        order, start, busy, moved);
+    return moved;
+}
+
+static void *compactd_run(long arg1, void *arg2)
+{
+    dbg(DBG_PROC, "compactd: running\n");
+    for (;;)
+    {
+        spinlock_lock(&compactd_lock);
+        while (!compactd_order)
+        {
+            /* sched_sleep_on releases compactd_lock once we're on the
+             * queue */
+            sched_sleep_on(&compactd_queue, &compactd_lock);
+            spinlock_lock(&compactd_lock);
+        }
+        size_t order = compactd_order;
+        compactd_order = 0;
+        spinlock_unlock(&compactd_lock);
+
+        /* Keep compacting until an aligned run of the needed order
+         * exists or a pass stops making progress. */
+        size_t moved = 0;
+        while (!page_order_available(order))
+        {
+            size_t pass = compactd_pass(order);
+            if (!pass)
+            {
+                break;
+            }
+            moved += pass;
+        }
+        dbg(DBG_PFRAME,
+            "compactd: order %lu %s after moving %lu pages\n", order,
+            page_order_available(order) ? "assembled" : "not assembled",
+            moved);
+    }
+    return NULL;
+}
+
+void compactd_start()
+{
+    sched_queue_init(&compactd_queue);
+
+    proc_t *proc = proc_create("compactd");
+    KASSERT(proc && "couldn't create the compaction daemon");
+    kthread_t *thr = kthread_create(proc, compactd_run, 0, NULL);
+    KASSERT(thr && "couldn't create the compaction daemon's thread");
+
+    compactd_ready = 1;
+    sched_make_runnable(thr);
+}
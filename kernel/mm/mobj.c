@@ -1,7 +1,13 @@
 #include "errno.h"
+#include "globals.h"
 
 #include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/pagemerged.h"
+#include "mm/pageoutd.h"
 #include "mm/pframe.h"
+#include "mm/swap.h"
+#include "mm/swapcomp.h"
 
 #include "util/debug.h"
 #include <util/string.h>
@@ -30,9 +36,104 @@ void mobj_init(mobj_t *o, long type, mobj_ops_t *ops)
     }
 
     kmutex_init(&o->mo_mutex);
+    for (size_t i = 0; i < MOBJ_PFRAME_LOCKS; i++)
+    {
+        spinlock_init(&o->mo_pframe_locks[i]);
+    }
 
-    o->mo_refcount = ATOMIC_INIT(1);
+    refcount_init(&o->mo_refcount, 1);
+    o->mo_evictable = 0;
+    o->mo_swappable = 0;
+    o->mo_concurrent_fill = 0;
+    o->mo_resident = 0;
     list_init(&o->mo_pframes);
+    list_init(&o->mo_dirty_pframes);
+    for (size_t i = 0; i < MOBJ_PFRAME_HASH_BUCKETS; i++)
+    {
+        list_init(&o->mo_pframe_hash[i]);
+    }
+}
+
+#define MOBJ_PFRAME_HASH(pagenum) ((pagenum) & (MOBJ_PFRAME_HASH_BUCKETS - 1))
+
+/* The striped lock covering pagenum's hash bucket. */
+#define MOBJ_PFRAME_LOCK(o, pagenum) \
+    (&(o)->mo_pframe_locks[MOBJ_PFRAME_HASH(pagenum) & (MOBJ_PFRAME_LOCKS - 1)])
+
+/*
+ * Add pf to both the mobj's pframe list and its page-number hash index.
+ *
+ * The mobj o must be locked when calling this function
+ */
+void mobj_attach_pframe(mobj_t *o, pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    pf->pf_mobj = o;
+    list_insert_tail(&o->mo_pframes, &pf->pf_link);
+    spinlock_lock(MOBJ_PFRAME_LOCK(o, pf->pf_pagenum));
+    list_insert_tail(&o->mo_pframe_hash[MOBJ_PFRAME_HASH(pf->pf_pagenum)],
+                     &pf->pf_hash_link);
+    spinlock_unlock(MOBJ_PFRAME_LOCK(o, pf->pf_pagenum));
+    o->mo_resident++;
+    /* Charge the frame to whoever caused it to become resident, so the
+     * pageout daemon can prefer an over-quota process's pages. */
+    if (curproc)
+    {
+        pf->pf_owner = curproc->p_pid;
+        curproc->p_resident++;
+        if (pageoutd_over_quota(curproc))
+        {
+            pageoutd_wakeup();
+        }
+    }
+    pageoutd_lru_insert(pf);
+}
+
+/*
+ * Remove pf from both the mobj's pframe list and its page-number hash index.
+ *
+ * The mobj o must be locked when calling this function
+ */
+void mobj_detach_pframe(mobj_t *o, pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    pageoutd_lru_remove(pf);
+    o->mo_resident--;
+    if (pf->pf_owner)
+    {
+        /* The owner may have exited since the frame came in. */
+        proc_t *owner = proc_lookup(pf->pf_owner);
+        if (owner && owner->p_resident)
+        {
+            owner->p_resident--;
+        }
+        pf->pf_owner = 0;
+    }
+    list_remove(&pf->pf_link);
+    spinlock_lock(MOBJ_PFRAME_LOCK(o, pf->pf_pagenum));
+    list_remove(&pf->pf_hash_link);
+    spinlock_unlock(MOBJ_PFRAME_LOCK(o, pf->pf_pagenum));
+    if (list_link_is_linked(&pf->pf_dirty_link))
+    {
+        list_remove(&pf->pf_dirty_link);
+    }
+    pf->pf_mobj = NULL;
+}
+
+/*
+ * Mark pf dirty and place it on the mobj's dirty list so writeback can find
+ * it without walking every resident page.
+ *
+ * The mobj o must be locked when calling this function
+ */
+void mobj_dirty_pframe(mobj_t *o, pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    pf->pf_dirty = 1;
+    if (!list_link_is_linked(&pf->pf_dirty_link))
+    {
+        list_insert_tail(&o->mo_dirty_pframes, &pf->pf_dirty_link);
+    }
 }
 
 /*
@@ -50,7 +151,7 @@ inline void mobj_unlock(mobj_t *o) { kmutex_unlock(&o->mo_mutex); }
  */
 void mobj_ref(mobj_t *o)
 {
-    atomic_inc(&o->mo_refcount);
+    refcount_inc(&o->mo_refcount);
 }
 
 void mobj_put_locked(mobj_t **op)
@@ -66,11 +167,10 @@ void mobj_put_locked(mobj_t **op)
 void mobj_put(mobj_t **op)
 {
     mobj_t *o = *op;
-    KASSERT(o->mo_refcount);
     *op = NULL;
 
     dbg(DBG_ERROR, "count: %d\n", o->mo_refcount);
-    if (atomic_dec_and_test(&o->mo_refcount))
+    if (refcount_dec_and_test(&o->mo_refcount))
     {
         dbg(DBG_ERROR, "count: %d\n", o->mo_refcount);
 
@@ -84,17 +184,36 @@ void mobj_put(mobj_t **op)
 }
 
 /*
- * Find a pframe that already exists in the memory object's mo_pframes list.
+ * Find a pframe that already exists in the memory object, consulting the
+ * page-number hash index rather than walking every resident page.
  * If a pframe is found, it must be locked upon return from this function using
  * pf_mutex.
  */
 void mobj_find_pframe(mobj_t *o, uint64_t pagenum, pframe_t **pfp)
 {
     KASSERT(kmutex_owns_mutex(&o->mo_mutex));
-    list_iterate(&o->mo_pframes, pf, pframe_t, pf_link)
+retry:
+    list_iterate(&o->mo_pframe_hash[MOBJ_PFRAME_HASH(pagenum)], pf, pframe_t,
+                 pf_hash_link)
     {
         if (pf->pf_pagenum == pagenum)
         {
+            spinlock_lock(&pf->pf_state_lock);
+            if (pf->pf_state == PF_STATE_BUSY)
+            {
+                /* An unlocked fill is in flight for this page (see
+                 * mobj_materialize_pframe): wait on the frame rather
+                 * than spin, dropping the object lock so lookups and
+                 * fills of other pages proceed meanwhile. The filler
+                 * reacquires mo_mutex before broadcasting, so after
+                 * waking we re-walk the bucket from scratch - the frame
+                 * may have been freed or replaced while we slept. */
+                mobj_unlock(o);
+                sched_sleep_on(&pf->pf_waitq, &pf->pf_state_lock);
+                mobj_lock(o);
+                goto retry;
+            }
+            spinlock_unlock(&pf->pf_state_lock);
             kmutex_lock(&pf->pf_mutex);
             *pfp = pf;
             return;
@@ -103,6 +222,41 @@ void mobj_find_pframe(mobj_t *o, uint64_t pagenum, pframe_t **pfp)
     *pfp = NULL;
 }
 
+/*
+ * Fast lookup for the page fault path. Returns the kernel virtual address
+ * of the frame backing pagenum if one is resident AND already mapped
+ * somewhere (pf_mapped), else NULL. Holds only the striped lock covering
+ * pagenum's hash bucket for the walk - never mo_mutex or the frame's own
+ * mutex - so a fault on an already-resident page does not serialize
+ * against fills, flushes, or even other fast lookups of different pages
+ * in the same object.
+ *
+ * pf_mapped is what makes this safe: it is set only after a successful
+ * locked mobj_get_pframe (so the frame's contents are fully loaded), and
+ * a mapped frame is pinned - the pageout daemon never reclaims it, and
+ * only o's destructor would free it - so the returned address stays
+ * valid after the lock is dropped, for as long as o itself is alive.
+ */
+void *mobj_fast_lookup_mapped(mobj_t *o, uint64_t pagenum)
+{
+    void *addr = NULL;
+    spinlock_lock(MOBJ_PFRAME_LOCK(o, pagenum));
+    list_iterate(&o->mo_pframe_hash[MOBJ_PFRAME_HASH(pagenum)], pf, pframe_t,
+                 pf_hash_link)
+    {
+        if (pf->pf_pagenum == pagenum)
+        {
+            if (pf->pf_addr && pf->pf_mapped)
+            {
+                addr = pf->pf_addr;
+            }
+            break;
+        }
+    }
+    spinlock_unlock(MOBJ_PFRAME_LOCK(o, pagenum));
+    return addr;
+}
+
 /*
  * Wrapper around the memory object's get_pframe function
  * Assert a sane state of the world surrounding the call to get_pframe
@@ -114,6 +268,16 @@ long mobj_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
     *pfp = NULL;
     long ret = o->mo_ops.get_pframe(o, pagenum, forwrite, pfp);
     KASSERT((!*pfp && ret) || kmutex_owns_mutex(&(*pfp)->pf_mutex));
+    if (*pfp)
+    {
+        if ((*pfp)->pf_readahead)
+        {
+            /* A prefetched frame just paid off; see pframe.h. */
+            (*pfp)->pf_readahead = 0;
+            pframe_ra_used++;
+        }
+        pageoutd_lru_touch(*pfp);
+    }
     return ret;
 }
 
@@ -130,7 +294,7 @@ static void mobj_create_pframe(mobj_t *o, uint64_t pagenum, pframe_t **pfp)
         kmutex_lock(&pf->pf_mutex);
 
         pf->pf_pagenum = pagenum;
-        list_insert_tail(&o->mo_pframes, &pf->pf_link);
+        mobj_attach_pframe(o, pf);
     }
     KASSERT(!pf || kmutex_owns_mutex(&pf->pf_mutex));
     *pfp = pf;
@@ -159,6 +323,116 @@ static void mobj_create_pframe(mobj_t *o, uint64_t pagenum, pframe_t **pfp)
  */
 long mobj_default_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
                              pframe_t **pfp)
+{
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    *pfp = NULL;
+    pframe_t *pf = NULL;
+    mobj_find_pframe(o, pagenum, &pf);
+    if (!pf)
+    {
+        mobj_create_pframe(o, pagenum, &pf);
+    }
+    if (!pf)
+    {
+        return -ENOMEM;
+    }
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    if (!pf->pf_addr)
+    {
+        long ret = mobj_materialize_pframe(o, pf);
+        if (ret)
+        {
+            kmutex_unlock(&pf->pf_mutex);
+            return ret;
+        }
+    }
+    if (forwrite)
+    {
+        mobj_dirty_pframe(o, pf);
+    }
+    *pfp = pf;
+    return 0;
+}
+
+/*
+ * Ensure pf's contents are in memory: allocate a backing page and run the
+ * mobj's fill_pframe if the frame is currently a placeholder (pf_addr ==
+ * NULL, as a swapped-out frame is); no-op for resident frames.
+ *
+ * Both o and pf must be locked. On failure the frame is left a locked
+ * placeholder.
+ */
+long mobj_materialize_pframe(mobj_t *o, pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    if (pf->pf_addr)
+    {
+        return 0;
+    }
+    KASSERT(!pf->pf_dirty && "dirtied page doesn't have a physical address");
+    pf->pf_addr = page_alloc();
+    if (!pf->pf_addr)
+    {
+        return -ENOMEM;
+    }
+    ppage_set_owner(pf->pf_addr, pf);
+
+    dbg(DBG_PFRAME, "filling pframe 0x%p (mobj 0x%p page %lu)\n", pf, o,
+        pf->pf_pagenum);
+    KASSERT(o->mo_ops.fill_pframe);
+    long ret;
+    if (o->mo_concurrent_fill)
+    {
+        /* Mark the frame busy and run the fill with both locks dropped,
+         * so a milliseconds-long disk read for this page does not
+         * serialize every other lookup and fill on the object. The BUSY
+         * state is what keeps the frame safe meanwhile: lookups of this
+         * page wait on pf_waitq in mobj_find_pframe, the pageout daemon
+         * skips busy frames, and the flush paths see a clean frame. Both
+         * transitions happen with mo_mutex and pf_mutex held, so anyone
+         * holding those can read pf_state without the state lock. */
+        spinlock_lock(&pf->pf_state_lock);
+        pf->pf_state = PF_STATE_BUSY;
+        spinlock_unlock(&pf->pf_state_lock);
+        kmutex_unlock(&pf->pf_mutex);
+        mobj_unlock(o);
+
+        ret = o->mo_ops.fill_pframe(o, pf);
+
+        /* Reacquire in the canonical order (object, then frame) before
+         * publishing the result; waiters re-walk the index under
+         * mo_mutex once woken. */
+        mobj_lock(o);
+        kmutex_lock(&pf->pf_mutex);
+        spinlock_lock(&pf->pf_state_lock);
+        pf->pf_state = PF_STATE_READY;
+        spinlock_unlock(&pf->pf_state_lock);
+        sched_broadcast_on(&pf->pf_waitq);
+    }
+    else
+    {
+        ret = o->mo_ops.fill_pframe(o, pf);
+    }
+    if (ret)
+    {
+        ppage_set_owner(pf->pf_addr, NULL);
+        page_free(pf->pf_addr);
+        pf->pf_addr = NULL;
+    }
+    return ret;
+}
+
+/*
+ * Like mobj_default_get_pframe with forwrite set, but for a caller that is
+ * about to overwrite the entire page (e.g. an aligned full-block file
+ * write): if the frame is not resident, its backing page is allocated but
+ * deliberately NOT filled from the mobj, skipping the read half of the
+ * read-modify-write cycle. The frame is always marked dirty. Only correct
+ * when the caller writes all PAGE_SIZE bytes before releasing the frame -
+ * until then the page holds whatever page_alloc returned.
+ */
+long mobj_get_pframe_overwrite(mobj_t *o, uint64_t pagenum, pframe_t **pfp)
 {
     KASSERT(kmutex_owns_mutex(&o->mo_mutex));
     *pfp = NULL;
@@ -182,20 +456,15 @@ long mobj_default_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
         {
             return -ENOMEM;
         }
+        ppage_set_owner(pf->pf_addr, pf);
 
-        dbg(DBG_PFRAME, "filling pframe 0x%p (mobj 0x%p page %lu)\n", pf, o,
-            pf->pf_pagenum);
-        KASSERT(o->mo_ops.fill_pframe);
-        long ret = o->mo_ops.fill_pframe(o, pf);
-        if (ret)
-        {
-            page_free(pf->pf_addr);
-            pf->pf_addr = NULL;
-            kmutex_unlock(&pf->pf_mutex);
-            return ret;
-        }
+        dbg(DBG_PFRAME,
+            "pframe 0x%p (mobj 0x%p page %lu) taken for full overwrite, "
+            "fill skipped\n",
+            pf, o, pf->pf_pagenum);
     }
-    pf->pf_dirty |= forwrite;
+    mobj_dirty_pframe(o, pf);
+    pageoutd_lru_touch(pf);
     *pfp = pf;
     return 0;
 }
@@ -220,6 +489,10 @@ long mobj_flush_pframe(mobj_t *o, pframe_t *pf)
         if (ret)
             return ret;
         pf->pf_dirty = 0;
+        if (list_link_is_linked(&pf->pf_dirty_link))
+        {
+            list_remove(&pf->pf_dirty_link);
+        }
     }
     KASSERT(!pf->pf_dirty);
     return 0;
@@ -270,12 +543,23 @@ long mobj_free_pframe(mobj_t *o, pframe_t **pfp)
         // TABLES THAT USE THEM)
         if (pf->pf_addr)
         {
+            ppage_set_owner(pf->pf_addr, NULL);
             page_free(pf->pf_addr);
             pf->pf_addr = NULL;
         }
     }
     *pfp = NULL;
-    list_remove(&pf->pf_link);
+    if (pf->pf_swap_slot)
+    {
+        /* The frame is a swapped-out placeholder; give its slot back. */
+        swap_slot_free(pf->pf_swap_slot);
+        pf->pf_swap_slot = 0;
+    }
+    /* Likewise for a compressed placeholder's pooled copy and a
+     * deduplicated placeholder's shared-frame reference. */
+    swapcomp_release(pf);
+    pagemerged_release(pf);
+    mobj_detach_pframe(o, pf);
     pframe_free(&pf);
     return 0;
 }
@@ -5,9 +5,15 @@
 #include <boot/multiboot_macros.h>
 
 #include "boot/config.h"
+#include "globals.h"
+#include "main/acpi.h"
+#include "main/apic.h"
+#include "main/interrupt.h"
 
+#include "mm/compactd.h"
 #include "mm/mm.h"
 #include "mm/page.h"
+#include "mm/pageoutd.h"
 
 #include "util/debug.h"
 #include "util/gdb.h"
@@ -96,6 +102,33 @@ GDB_DEFINE_HOOK(page_free, void *addr, size_t npages)
 
 static spinlock_t page_spinlock;
 
+// Per-core magazine of order-0 pages sitting in front of the btree. The
+// single-page hot path (far and away the most common caller) becomes a
+// core-local pop/push with interrupts masked (SMP.1 + SMP.2); the btree and
+// its spinlock are only touched every PAGE_MAGAZINE_BATCH single-page
+// operations, when a magazine is refilled or drained wholesale.
+//
+// pm_enabled lives inside the magazine (i.e. inside the .csd section) on
+// purpose: it only becomes set for a core once that core has mapped in and
+// zeroed its own copy of the core-specific data, so early boot allocations
+// (and APs still borrowing another core's page tables) fall through to the
+// locked btree path.
+#define PAGE_MAGAZINE_CAPACITY 64
+#define PAGE_MAGAZINE_BATCH (PAGE_MAGAZINE_CAPACITY / 2)
+
+typedef struct page_magazine
+{
+    long pm_enabled;
+    size_t pm_count;
+    void *pm_pages[PAGE_MAGAZINE_CAPACITY];
+} page_magazine_t;
+
+static page_magazine_t page_magazine CORE_SPECIFIC_DATA;
+
+static size_t _page_magazine_refill_locked(void **pages, size_t count);
+
+static void _page_magazine_drain_locked(void **pages, size_t count);
+
 static size_t page_freecount;
 
 // if you rename these variables, update them in the macros above
@@ -107,6 +140,89 @@ static btree_word *btree;
 static uintptr_t *min_available_idx_by_order;
 static size_t *count_available_by_order;
 
+/* Per-physical-page metadata (see ppage_t in page.h), carved out of the
+ * reserved region next to the btree; one entry per managed page frame. */
+static ppage_t *ppages;
+
+/*
+ * NUMA topology, filled in from the ACPI SRAT by page_numa_init(). The
+ * btree itself stays unified; instead each node's physical ranges are
+ * recorded here and page_alloc_n_node() restricts its search of the
+ * availability rows to the leaves inside those ranges. Without an SRAT
+ * (QEMU) nothing is recorded and every node-aware call degenerates to
+ * the plain allocator.
+ */
+#define SRAT_SIGNATURE (*(uint32_t *)"SRAT")
+
+#define SRAT_TYPE_CPU_AFFINITY 0
+#define SRAT_TYPE_MEM_AFFINITY 1
+
+#define SRAT_FLAG_ENABLED 0x1
+
+#define NUMA_MAX_NODES 4
+#define NUMA_MAX_RANGES 8
+
+typedef struct srat_cpu_affinity
+{
+    uint8_t sca_type;
+    uint8_t sca_size;
+    uint8_t sca_domain_low;
+    uint8_t sca_apicid;
+    uint32_t sca_flags;
+    uint8_t sca_sapic_eid;
+    uint8_t sca_domain_high[3];
+    uint32_t sca_clock_domain;
+} packed srat_cpu_affinity_t;
+
+typedef struct srat_mem_affinity
+{
+    uint8_t sma_type;
+    uint8_t sma_size;
+    uint32_t sma_domain;
+    uint16_t sma_reserved1;
+    uint64_t sma_base;
+    uint64_t sma_length;
+    uint32_t sma_reserved2;
+    uint32_t sma_flags;
+    uint64_t sma_reserved3;
+} packed srat_mem_affinity_t;
+
+#define SLIT_SIGNATURE (*(uint32_t *)"SLIT")
+
+/* SLIT distance convention: 10 is a locality's distance to itself and
+ * everything else is relative to that; firmware without a SLIT gets a
+ * flat local/remote split. */
+#define NUMA_DIST_LOCAL 10
+#define NUMA_DIST_REMOTE 20
+
+typedef struct slit_table
+{
+    acpi_header_t st_header;
+    uint64_t st_localities;
+    uint8_t st_distance[]; /* st_localities x st_localities matrix */
+} packed slit_table_t;
+
+typedef struct numa_range
+{
+    uintptr_t nr_start; /* first physical address of the range */
+    uintptr_t nr_end;   /* one past the last physical address */
+    long nr_node;
+} numa_range_t;
+
+static numa_range_t numa_ranges[NUMA_MAX_RANGES];
+static size_t numa_nranges;
+static long numa_nnodes = 1;
+static long numa_core_node[MAX_LAPICS];
+
+/* Proximity domains in the SRAT are arbitrary firmware tokens; compact
+ * them into node ids 0..n-1 in order of first appearance. */
+static uint32_t numa_domains[NUMA_MAX_NODES];
+static size_t numa_ndomains;
+
+/* Node-to-node distances from the ACPI SLIT, indexed by compacted node
+ * id; defaults apply when the firmware provides no SLIT. */
+static uint8_t numa_node_distance[NUMA_MAX_NODES][NUMA_MAX_NODES];
+
 static char *type_strings[] = {"ERROR: type = 0", "Available", "Reserved",
                                "ACPI Reclaimable", "ACPI NVS", "GRUB Bad Ram"};
 static size_t type_count = sizeof(type_strings) / sizeof(type_strings[0]);
@@ -122,7 +238,8 @@ inline void *physmap_end()
 
 static inline void _btree_expensive_sanity_check()
 {
-#ifdef DEBUG_PHYSICAL_PAGING
+/* whole-tree walk; wants KASSERT_LEVEL 2 as well as the local switch */
+#if defined(DEBUG_PHYSICAL_PAGING) && KASSERT_LEVEL >= 2
     size_t available = 0;
     for (unsigned order = 0; order <= max_order; order++)
     {
@@ -225,7 +342,8 @@ void page_init()
         // 2^(max_order-2) bytes for the binary tree
         btree_size = 1UL << (max_order - 2);
         metadata_size = sizeof(uintptr_t) * (max_order + 1) +
-                        sizeof(size_t) * (max_order + 1);
+                        sizeof(size_t) * (max_order + 1) +
+                        sizeof(ppage_t) * max_pages;
 
         if (memory_available_for_use >= btree_size + metadata_size)
         {
@@ -261,10 +379,17 @@ void page_init()
         min_available_idx_by_order[order] = BTREE_ROW_END_INDEX(order);
     }
 
-    count_available_by_order =
-        min_available_idx_by_order + sizeof(uintptr_t) * (max_order + 1);
+    /* Note: plain pointer arithmetic here; the old sizeof-scaled offset
+     * overshot the reservation, which mattered once the ppage array was
+     * appended to it. */
+    count_available_by_order = min_available_idx_by_order + (max_order + 1);
     memset(count_available_by_order, 0, sizeof(size_t) * (max_order + 1));
 
+    /* The per-page metadata array sits after the btree's own metadata
+     * and covers every frame up to max_pages. */
+    ppages = (ppage_t *)(count_available_by_order + (max_order + 1));
+    memset(ppages, 0, sizeof(ppage_t) * max_pages);
+
     page_freecount = 0;
 
     uintptr_t reserved_ram_start = KERNEL_PHYS_BASE;
@@ -338,6 +463,176 @@ void page_init_finish()
         (uintptr_t *)((uintptr_t)min_available_idx_by_order + PHYS_OFFSET);
     count_available_by_order =
         (uintptr_t *)((uintptr_t)count_available_by_order + PHYS_OFFSET);
+    ppages = (ppage_t *)((uintptr_t)ppages + PHYS_OFFSET);
+}
+
+static long _numa_node_of_domain(uint32_t domain)
+{
+    for (size_t i = 0; i < numa_ndomains; i++)
+    {
+        if (numa_domains[i] == domain)
+        {
+            return (long)i;
+        }
+    }
+    if (numa_ndomains == NUMA_MAX_NODES)
+    {
+        dbgq(DBG_PAGEALLOC,
+             "SRAT: too many proximity domains; folding 0x%x into node 0\n",
+             domain);
+        return 0;
+    }
+    numa_domains[numa_ndomains] = domain;
+    return (long)numa_ndomains++;
+}
+
+void page_numa_init()
+{
+    for (long a = 0; a < NUMA_MAX_NODES; a++)
+    {
+        for (long b = 0; b < NUMA_MAX_NODES; b++)
+        {
+            numa_node_distance[a][b] =
+                a == b ? NUMA_DIST_LOCAL : NUMA_DIST_REMOTE;
+        }
+    }
+
+    acpi_header_t *srat = acpi_table(SRAT_SIGNATURE, 0);
+    if (!srat)
+    {
+        dbgq(DBG_PAGEALLOC,
+             "No SRAT found; treating memory as a single node\n");
+        return;
+    }
+
+    /* the static part of the SRAT is the ACPI header plus 12 reserved
+     * bytes; affinity entries follow */
+    uint8_t *ptr = (uint8_t *)srat;
+    uint32_t off = sizeof(acpi_header_t) + 12;
+    while (off < srat->ah_size)
+    {
+        uint8_t type = *(ptr + off);
+        uint8_t size = *(ptr + off + 1);
+        if (SRAT_TYPE_MEM_AFFINITY == type)
+        {
+            KASSERT(sizeof(srat_mem_affinity_t) == size);
+            srat_mem_affinity_t *mem = (srat_mem_affinity_t *)(ptr + off);
+            if ((mem->sma_flags & SRAT_FLAG_ENABLED) && mem->sma_length &&
+                numa_nranges < NUMA_MAX_RANGES)
+            {
+                uintptr_t start = (uintptr_t)mem->sma_base;
+                uintptr_t end = start + (uintptr_t)mem->sma_length;
+                if (end > (max_pages << PAGE_SHIFT))
+                {
+                    end = max_pages << PAGE_SHIFT;
+                }
+                if (start < end)
+                {
+                    numa_range_t *range = numa_ranges + numa_nranges++;
+                    range->nr_start = start;
+                    range->nr_end = end;
+                    range->nr_node = _numa_node_of_domain(mem->sma_domain);
+                    dbgq(DBG_PAGEALLOC, "SRAT: node %ld memory [0x%p, 0x%p)\n",
+                         range->nr_node, (void *)start, (void *)end);
+                }
+            }
+        }
+        else if (SRAT_TYPE_CPU_AFFINITY == type)
+        {
+            KASSERT(sizeof(srat_cpu_affinity_t) == size);
+            srat_cpu_affinity_t *cpu = (srat_cpu_affinity_t *)(ptr + off);
+            if ((cpu->sca_flags & SRAT_FLAG_ENABLED) &&
+                cpu->sca_apicid < MAX_LAPICS)
+            {
+                uint32_t domain = cpu->sca_domain_low;
+                // revision >= 2 widens the proximity domain to 32 bits
+                if (srat->ah_rev >= 2)
+                {
+                    domain |= (uint32_t)cpu->sca_domain_high[0] << 8 |
+                              (uint32_t)cpu->sca_domain_high[1] << 16 |
+                              (uint32_t)cpu->sca_domain_high[2] << 24;
+                }
+                numa_core_node[cpu->sca_apicid] = _numa_node_of_domain(domain);
+                dbgq(DBG_PAGEALLOC, "SRAT: core %u on node %ld\n",
+                     (uint32_t)cpu->sca_apicid,
+                     numa_core_node[cpu->sca_apicid]);
+            }
+        }
+        else
+        {
+            dbgq(DBG_PAGEALLOC, "SRAT: skipping entry of type 0x%x\n",
+                 (uint32_t)type);
+        }
+        off += size;
+    }
+    if (numa_ndomains)
+    {
+        numa_nnodes = (long)numa_ndomains;
+    }
+    dbgq(DBG_PAGEALLOC, "SRAT: %ld node(s), %lu memory range(s)\n",
+         numa_nnodes, numa_nranges);
+
+    /* The SLIT, when present, refines the flat local/remote defaults
+     * into the firmware's measured relative distances. It is indexed by
+     * proximity domain, so translate through the compaction table. */
+    slit_table_t *slit = acpi_table(SLIT_SIGNATURE, 0);
+    if (!slit)
+    {
+        return;
+    }
+    for (long a = 0; a < numa_nnodes; a++)
+    {
+        for (long b = 0; b < numa_nnodes; b++)
+        {
+            uint64_t da = numa_domains[a];
+            uint64_t db = numa_domains[b];
+            if (da < slit->st_localities && db < slit->st_localities)
+            {
+                numa_node_distance[a][b] =
+                    slit->st_distance[da * slit->st_localities + db];
+            }
+            dbgq(DBG_PAGEALLOC, "SLIT: distance %ld -> %ld is %u\n", a, b,
+                 (uint32_t)numa_node_distance[a][b]);
+        }
+    }
+}
+
+long page_numa_node_count() { return numa_nnodes; }
+
+long page_node_of(void *addr)
+{
+    uintptr_t paddr = (uintptr_t)addr;
+    if (paddr >= PHYS_OFFSET)
+    {
+        paddr -= PHYS_OFFSET;
+    }
+    for (size_t i = 0; i < numa_nranges; i++)
+    {
+        if (paddr >= numa_ranges[i].nr_start && paddr < numa_ranges[i].nr_end)
+        {
+            return numa_ranges[i].nr_node;
+        }
+    }
+    return 0;
+}
+
+long page_node_of_core(long core)
+{
+    if (core < 0 || core >= MAX_LAPICS)
+    {
+        return 0;
+    }
+    return numa_core_node[core];
+}
+
+long page_node_distance(long node_a, long node_b)
+{
+    if (node_a < 0 || node_a >= numa_nnodes || node_b < 0 ||
+        node_b >= numa_nnodes)
+    {
+        return NUMA_DIST_REMOTE;
+    }
+    return numa_node_distance[node_a][node_b];
 }
 
 static void _btree_update_metadata_after_removal(size_t order, size_t idx)
@@ -474,14 +769,70 @@ void page_add_range(void *start, void *end)
     _btree_expensive_sanity_check();
 }
 
-void *page_alloc() { return page_alloc_n(1); }
+void *page_alloc()
+{
+    page_magazine_t *mag = &page_magazine;
+    if (!mag->pm_enabled)
+    {
+        return page_alloc_n(1);
+    }
+
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    if (!mag->pm_count)
+    {
+        spinlock_lock(&page_spinlock);
+        mag->pm_count =
+            _page_magazine_refill_locked(mag->pm_pages, PAGE_MAGAZINE_BATCH);
+        spinlock_unlock(&page_spinlock);
+        if (!mag->pm_count)
+        {
+            intr_setipl(ipl);
+            return NULL;
+        }
+    }
+    void *addr = mag->pm_pages[--mag->pm_count];
+    intr_setipl(ipl);
+    if (page_freecount < PAGEOUTD_LOW_WATERMARK)
+    {
+        pageoutd_wakeup();
+    }
+    return addr;
+}
 
 void *page_alloc_bounded(void *max_paddr)
 {
     return page_alloc_n_bounded(1, max_paddr);
 }
 
-void page_free(void *addr) { page_free_n(addr, 1); }
+void page_free(void *addr)
+{
+    page_magazine_t *mag = &page_magazine;
+    if (!mag->pm_enabled)
+    {
+        page_free_n(addr, 1);
+        return;
+    }
+
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    if (mag->pm_count == PAGE_MAGAZINE_CAPACITY)
+    {
+        spinlock_lock(&page_spinlock);
+        mag->pm_count -= PAGE_MAGAZINE_BATCH;
+        _page_magazine_drain_locked(mag->pm_pages + mag->pm_count,
+                                    PAGE_MAGAZINE_BATCH);
+        spinlock_unlock(&page_spinlock);
+    }
+    mag->pm_pages[mag->pm_count++] = addr;
+    intr_setipl(ipl);
+}
+
+void page_magazines_enable()
+{
+    // called once per core, after that core has mapped in and zeroed its own
+    // core-specific data (see core_init())
+    KASSERT(!page_magazine.pm_enabled && !page_magazine.pm_count);
+    page_magazine.pm_enabled = 1;
+}
 
 static void *_btree_alloc(size_t npages, uintptr_t idx, size_t smallest_order,
                           size_t actual_order)
@@ -546,9 +897,74 @@ static void *_btree_alloc(size_t npages, uintptr_t idx, size_t smallest_order,
     return (void *)(addr + PHYS_OFFSET);
 }
 
+/*
+ * Pops up to count order-0 pages out of the btree into pages, locking the
+ * btree once for the whole batch rather than once per page.
+ *
+ * page_spinlock must be held. Returns the number of pages obtained, which
+ * may be short (including zero) if physical memory is nearly exhausted.
+ */
+static size_t _page_magazine_refill_locked(void **pages, size_t count)
+{
+    size_t filled = 0;
+    while (filled < count && page_freecount)
+    {
+        void *addr = NULL;
+        for (size_t order = 0; order <= max_order; order++)
+        {
+            if (!count_available_by_order[order])
+            {
+                continue;
+            }
+            addr = _btree_alloc(1, min_available_idx_by_order[order], 0, order);
+            break;
+        }
+        if (!addr)
+        {
+            break;
+        }
+        pages[filled++] = addr;
+    }
+    return filled;
+}
+
+/*
+ * Returns count order-0 pages to the btree under a single lock acquisition.
+ *
+ * page_spinlock must be held.
+ */
+static void _page_magazine_drain_locked(void **pages, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uintptr_t idx =
+            BTREE_ADDR_TO_LEAF_INDEX((uintptr_t)pages[i] - PHYS_OFFSET);
+        _btree_mark_range_available(idx, 1);
+        page_freecount++;
+    }
+    _btree_expensive_sanity_check();
+}
+
 void *page_alloc_n(size_t npages)
 {
-    return page_alloc_n_bounded(npages, (void *)~0UL);
+    void *addr = page_alloc_n_bounded(npages, (void *)~0UL);
+    if (!addr && npages > 1 && npages <= page_freecount)
+    {
+        /* Fragmentation, not exhaustion: there is enough memory free,
+         * just no aligned run of it. Ask the compaction daemon to
+         * assemble one for the (likely retrying) caller. */
+        size_t order = 0;
+        while ((1UL << order) < npages)
+        {
+            order++;
+        }
+        compactd_wakeup(order);
+    }
+    if (addr && page_freecount < PAGEOUTD_LOW_WATERMARK)
+    {
+        pageoutd_wakeup();
+    }
+    return addr;
 }
 
 // this is really only used for setting up initial page tables
@@ -559,6 +975,7 @@ void *page_alloc_n_bounded(size_t npages, void *max_paddr)
     KASSERT(npages > 0 && npages <= (1UL << max_order));
     if (npages > page_freecount)
     {
+        spinlock_unlock(&page_spinlock);
         return 0;
     }
     // a note on max_pages: so long as we never mark a page that is beyond our
@@ -602,6 +1019,132 @@ void *page_alloc_n_bounded(size_t npages, void *max_paddr)
     return 0;
 }
 
+/*
+ * Scan the availability rows for a block of npages lying entirely inside
+ * one of node's physical ranges, and allocate it if found.
+ *
+ * page_spinlock must be held
+ */
+static void *_page_alloc_n_on_node(size_t npages, size_t smallest_order,
+                                   long node)
+{
+    for (size_t order = smallest_order; order <= max_order; order++)
+    {
+        if (!count_available_by_order[order])
+        {
+            continue;
+        }
+        for (size_t i = 0; i < numa_nranges; i++)
+        {
+            numa_range_t *range = numa_ranges + i;
+            if (range->nr_node != node)
+            {
+                continue;
+            }
+            // row indices of the first and last blocks of this order that
+            // lie entirely inside the range; nothing is available below
+            // min_available_idx_by_order, so start the scan there
+            uintptr_t lo = BTREE_ROW_START_INDEX(order) +
+                           ((ADDR_TO_PN(PAGE_ALIGN_UP(range->nr_start)) +
+                             (1UL << order) - 1) >>
+                            order);
+            uintptr_t hi = BTREE_ROW_START_INDEX(order) +
+                           (ADDR_TO_PN(range->nr_end) >> order);
+            if (lo < min_available_idx_by_order[order])
+            {
+                lo = min_available_idx_by_order[order];
+            }
+            for (uintptr_t idx = lo; idx < hi; idx++)
+            {
+                if (BTREE_IS_AVAILABLE(idx))
+                {
+                    return _btree_alloc(npages, idx, smallest_order, order);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Node-preferring variant of page_alloc_n(). The btree stays unified
+ * across nodes, so rather than maintaining per-node trees this walks the
+ * availability rows like page_alloc_n_bounded() does, but only accepts
+ * blocks lying entirely within one of the node's physical ranges. If the
+ * node has nothing suitable, the other nodes are tried nearest-first by
+ * SLIT distance, and as a last resort the request is satisfied from any
+ * free memory - remote pages are slower, but far better than failing.
+ */
+void *page_alloc_n_node(size_t npages, long node)
+{
+    if (node < 0)
+    {
+        node = page_node_of_core(curcore.kc_id);
+    }
+    if (!numa_nranges || node >= numa_nnodes)
+    {
+        return page_alloc_n(npages);
+    }
+
+    spinlock_lock(&page_spinlock);
+    KASSERT(npages > 0 && npages <= (1UL << max_order));
+    if (npages > page_freecount)
+    {
+        spinlock_unlock(&page_spinlock);
+        return 0;
+    }
+
+    size_t smallest_order = 0;
+    while ((1UL << smallest_order) < npages)
+        smallest_order++;
+
+    void *ret = _page_alloc_n_on_node(npages, smallest_order, node);
+
+    /* Nothing on the preferred node; walk the others in increasing
+     * distance order so the fallback lands as close as possible. */
+    unsigned long visited = 1UL << node;
+    while (!ret)
+    {
+        long best = -1;
+        for (long cand = 0; cand < numa_nnodes; cand++)
+        {
+            if ((visited & (1UL << cand)) ||
+                (best >= 0 && page_node_distance(node, cand) >=
+                                  page_node_distance(node, best)))
+            {
+                continue;
+            }
+            best = cand;
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        visited |= 1UL << best;
+        ret = _page_alloc_n_on_node(npages, smallest_order, best);
+        if (ret)
+        {
+            dbgq(DBG_MM,
+                 "page_alloc_n_node(%lu, %ld): node exhausted, allocated on "
+                 "node %ld (distance %ld)\n",
+                 npages, node, best, page_node_distance(node, best));
+        }
+    }
+    spinlock_unlock(&page_spinlock);
+    if (ret)
+    {
+        return ret;
+    }
+
+    dbgq(DBG_MM,
+         "page_alloc_n_node(%lu, %ld): node exhausted, falling back to any "
+         "node\n",
+         npages, node);
+    return page_alloc_n(npages);
+}
+
+void *page_alloc_node(long node) { return page_alloc_n_node(1, node); }
+
 void page_free_n(void *addr, size_t npages)
 {
     spinlock_lock(&page_spinlock);
@@ -630,6 +1173,10 @@ void page_mark_reserved(void *paddr)
          (void *)((uintptr_t)paddr + PHYS_OFFSET + PAGE_SIZE));
 
     KASSERT(PAGE_ALIGNED(paddr));
+    if (ADDR_TO_PN(paddr) < max_pages)
+    {
+        ppages[ADDR_TO_PN(paddr)].pp_flags |= PP_RESERVED;
+    }
     uintptr_t idx = BTREE_ADDR_TO_LEAF_INDEX(paddr);
     size_t order = 0;
     while (idx && !BTREE_IS_AVAILABLE(idx))
@@ -666,4 +1213,114 @@ void page_mark_reserved(void *paddr)
     spinlock_unlock(&page_spinlock);
 }
 
+long page_order_available(size_t order)
+{
+    spinlock_lock(&page_spinlock);
+    long available = 0;
+    for (size_t o = order; o <= max_order && !available; o++)
+    {
+        available = count_available_by_order[o] != 0;
+    }
+    spinlock_unlock(&page_spinlock);
+    return available;
+}
+
+/*
+ * Find the best target block for a compaction pass at the given order:
+ * the 2^order-aligned block of managed memory with the fewest busy pages
+ * (but at least one, and no reserved ones). Returns the block's physmap
+ * address with *busy_out set to its busy count, or NULL if no block
+ * qualifies.
+ *
+ * The btree is sampled one block at a time so allocators are never locked
+ * out for a whole sweep; the result is a heuristic snapshot, revalidated
+ * page by page by the migration itself (see mm/compactd.c). Note that
+ * pages parked in the per-core magazines count as busy and have no owner,
+ * so a block they land in just looks a little worse than it is.
+ */
+void *page_compact_candidate(size_t order, size_t *busy_out)
+{
+    size_t block_pages = 1UL << order;
+    uintptr_t best_base = (uintptr_t)-1;
+    size_t best_busy = 0;
+    for (uintptr_t base = 0; base + block_pages <= max_pages;
+         base += block_pages)
+    {
+        spinlock_lock(&page_spinlock);
+        size_t busy = 0;
+        long reserved = 0;
+        for (uintptr_t pn = base; pn < base + block_pages; pn++)
+        {
+            if (ppages[pn].pp_flags & PP_RESERVED)
+            {
+                reserved = 1;
+                break;
+            }
+            /* A page is free iff its leaf or some ancestor of it is
+             * marked available. */
+            uintptr_t idx = BTREE_ADDR_TO_LEAF_INDEX(pn << PAGE_SHIFT);
+            while (idx && !BTREE_IS_AVAILABLE(idx))
+            {
+                idx = BTREE_PARENT(idx);
+            }
+            if (!BTREE_IS_AVAILABLE(idx))
+            {
+                busy++;
+            }
+        }
+        spinlock_unlock(&page_spinlock);
+        if (reserved || !busy)
+        {
+            continue;
+        }
+        if (best_base == (uintptr_t)-1 || busy < best_busy)
+        {
+            best_base = base;
+            best_busy = busy;
+            if (best_busy == 1)
+            {
+                break;
+            }
+        }
+    }
+    if (best_base == (uintptr_t)-1)
+    {
+        return NULL;
+    }
+    *busy_out = best_busy;
+    return (void *)((best_base << PAGE_SHIFT) + PHYS_OFFSET);
+}
+
+/*
+ * O(1) lookup of the metadata entry for the page containing addr. Accepts
+ * either a raw physical address or a physmap address (everything above
+ * PHYS_OFFSET is translated down), since callers usually hold the
+ * physmap pointer that page_alloc returned.
+ */
+ppage_t *ppage_get(void *addr)
+{
+    uintptr_t paddr = (uintptr_t)addr;
+    if (paddr >= PHYS_OFFSET)
+    {
+        paddr -= PHYS_OFFSET;
+    }
+    size_t pagenum = paddr >> PAGE_SHIFT;
+    if (pagenum >= max_pages)
+    {
+        return NULL;
+    }
+    return ppages + pagenum;
+}
+
+void ppage_set_owner(void *addr, void *owner)
+{
+    ppage_t *pp = ppage_get(addr);
+    if (!pp)
+    {
+        return;
+    }
+    pp->pp_owner = owner;
+    pp->pp_refcount = owner ? 1 : 0;
+}
+
 size_t page_free_count() { return page_freecount; }
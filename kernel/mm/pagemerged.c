@@ -0,0 +1,411 @@
+/*
+ * Same-page merging: deduplication of identical pages of anonymous memory.
+ *
+ * A low-priority daemon periodically hashes cold, unmapped frames of
+ * swappable memory objects - the same candidates the pageout daemon may
+ * swap. When two frames turn out to hold identical bytes, the bytes are
+ * kept in a single shared, immutable frame and each owner becomes a
+ * placeholder (pf_addr == NULL) referencing it: the same placeholder
+ * scheme swapped-out frames use (pf_swap_slot), with the backing copy in
+ * memory rather than on disk.
+ *
+ * Sharing follows the zero-frame model (see vm/anon.c): a read fault on a
+ * merged page maps the shared frame read-only, and the first write fault
+ * goes through the forwrite path, whose fill_pframe copies the bytes back
+ * out into a fresh private page (pagemerged_copy_in). Frames that have
+ * ever been mapped into a page table cannot be merged - there are no
+ * reverse mappings with which to unmap them - so in practice this
+ * deduplicates pages reached only through kernel copies: identical tmpfs
+ * file data and anonymous pages populated via syscalls rather than
+ * mappings.
+ *
+ * Unique pages are kept out of the shared pool by a table of recently
+ * seen content signatures: a page is only promoted to a shared frame once
+ * its hash has been seen from two different frames.
+ */
+
+#include "globals.h"
+#include "kernel.h"
+
+#include "mm/kmalloc.h"
+#include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/pagemerged.h"
+#include "mm/pageoutd.h"
+#include "mm/pframe.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+/*
+ * One shared frame holding the bytes of one or more merged pages. The
+ * frame is never attached to any mobj and its contents never change once
+ * the entry is in the pool; mf_refs counts the placeholders referencing
+ * it, plus any transient reference held across an unlocked compare.
+ */
+typedef struct merge_frame
+{
+    pframe_t *mf_pf;
+    uint64_t mf_hash;
+    size_t mf_refs;
+    list_link_t mf_link; /* bucket link in pagemerged_pool */
+} merge_frame_t;
+
+#define PAGEMERGED_BUCKETS 64
+
+/* Pool of shared frames, hashed by content; pagemerged_lock protects the
+ * buckets and every mf_refs. */
+static list_t pagemerged_pool[PAGEMERGED_BUCKETS];
+static spinlock_t pagemerged_lock = SPINLOCK_INITIALIZER(pagemerged_lock);
+
+static ktqueue_t pagemerged_queue;
+static spinlock_t pagemerged_sleep_lock =
+    SPINLOCK_INITIALIZER(pagemerged_sleep_lock);
+
+/*
+ * Recently seen content signatures, direct-mapped by hash. The object
+ * pointer and page number identify where a hash was last seen so a frame
+ * rescanned on consecutive passes does not promote itself; the pointer is
+ * only ever compared, never dereferenced, since the object may be gone.
+ */
+typedef struct merge_sig
+{
+    uint64_t sig_hash;
+    mobj_t *sig_obj;
+    uint64_t sig_pagenum;
+} merge_sig_t;
+
+#define PAGEMERGED_SIGNATURES 1024
+
+static merge_sig_t pagemerged_sigs[PAGEMERGED_SIGNATURES];
+
+/* Candidate batch for one pass; only the daemon touches these. */
+static mobj_t *pagemerged_objs[PAGEMERGED_BATCH];
+static uint64_t pagemerged_pagenums[PAGEMERGED_BATCH];
+
+/* FNV-1a over the page, a word at a time. */
+static uint64_t pagemerged_hash(const void *addr)
+{
+    const uint64_t *words = addr;
+    uint64_t hash = 0xcbf29ce484222325UL;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+    {
+        hash ^= words[i];
+        hash *= 0x100000001b3UL;
+    }
+    return hash;
+}
+
+/*
+ * Drop one reference on a pool entry. When the last reference goes away
+ * the entry is pulled out of its bucket and, if the shared frame was
+ * never mapped, freed. A mapped shared frame is permanent - read-only
+ * page-table entries for it may still exist and there are no reverse
+ * mappings to find them with (exactly the zero frame's situation) - so
+ * such an entry is put back in the pool, where it can at least keep
+ * serving as a merge target.
+ */
+static void pagemerged_unref(merge_frame_t *mf)
+{
+    spinlock_lock(&pagemerged_lock);
+    KASSERT(mf->mf_refs);
+    mf->mf_refs--;
+    if (mf->mf_refs)
+    {
+        spinlock_unlock(&pagemerged_lock);
+        return;
+    }
+    list_remove(&mf->mf_link);
+    spinlock_unlock(&pagemerged_lock);
+
+    /* With the entry unlinked and no references left, no new reader can
+     * reach it; the frame lock only waits out a reader that grabbed the
+     * shared frame before our reference was dropped. */
+    kmutex_lock(&mf->mf_pf->pf_mutex);
+    if (mf->mf_pf->pf_mapped)
+    {
+        kmutex_unlock(&mf->mf_pf->pf_mutex);
+        spinlock_lock(&pagemerged_lock);
+        list_insert_tail(&pagemerged_pool[mf->mf_hash % PAGEMERGED_BUCKETS],
+                         &mf->mf_link);
+        spinlock_unlock(&pagemerged_lock);
+        return;
+    }
+    ppage_set_owner(mf->mf_pf->pf_addr, NULL);
+    page_free(mf->mf_pf->pf_addr);
+    mf->mf_pf->pf_addr = NULL;
+    pframe_free(&mf->mf_pf);
+    kfree(mf);
+}
+
+/*
+ * Look for a pool entry whose contents equal the page at addr. On a hash
+ * hit the entry is referenced under the lock and the (4 KiB) compare done
+ * outside it; pool contents are immutable, so the compare cannot race.
+ * Returns the entry with a reference the caller owns, or NULL.
+ */
+static merge_frame_t *pagemerged_match(uint64_t hash, const void *addr)
+{
+    merge_frame_t *match = NULL;
+    spinlock_lock(&pagemerged_lock);
+    list_iterate(&pagemerged_pool[hash % PAGEMERGED_BUCKETS], mf,
+                 merge_frame_t, mf_link)
+    {
+        if (mf->mf_hash == hash)
+        {
+            mf->mf_refs++;
+            match = mf;
+            break;
+        }
+    }
+    spinlock_unlock(&pagemerged_lock);
+    if (!match)
+    {
+        return NULL;
+    }
+    if (memcmp(match->mf_pf->pf_addr, addr, PAGE_SIZE) == 0)
+    {
+        return match;
+    }
+    /* Hash collision; treat it as a miss rather than scanning on. */
+    pagemerged_unref(match);
+    return NULL;
+}
+
+/*
+ * Turn pf into a placeholder referencing mf, releasing its page (or, with
+ * keep_page set, leaving pf_addr for the caller, who is stealing the page
+ * into a new pool entry). Takes over the caller's reference on mf. Both
+ * the owning mobj and pf must be locked; mirrors swap_out's bookkeeping.
+ */
+static void pagemerged_convert(pframe_t *pf, merge_frame_t *mf,
+                               long keep_page)
+{
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    KASSERT(pf->pf_addr && !pf->pf_mapped && !pf->pf_swap_slot);
+
+    /* The shared frame preserves the bytes; the dirty flag tracks this
+     * frame's memory contents and no longer applies. */
+    if (pf->pf_dirty)
+    {
+        pf->pf_dirty = 0;
+        if (list_link_is_linked(&pf->pf_dirty_link))
+        {
+            list_remove(&pf->pf_dirty_link);
+        }
+    }
+    if (!keep_page)
+    {
+        ppage_set_owner(pf->pf_addr, NULL);
+        page_free(pf->pf_addr);
+    }
+    pf->pf_addr = NULL;
+    pf->pf_merge = mf;
+    if (pf->pf_owner)
+    {
+        /* The owner may have exited since the frame came in. */
+        proc_t *owner = proc_lookup(pf->pf_owner);
+        if (owner && owner->p_resident)
+        {
+            owner->p_resident--;
+        }
+        pf->pf_owner = 0;
+    }
+}
+
+/*
+ * Promote pf's page into a new pool entry, stealing the page itself as
+ * the shared frame's storage, and convert pf into the entry's first
+ * placeholder. Returns 1 on success, 0 if allocation failed (the frame is
+ * left untouched and will be reconsidered on a later pass).
+ */
+static long pagemerged_promote(pframe_t *pf, uint64_t hash)
+{
+    merge_frame_t *mf = kmalloc(sizeof(merge_frame_t));
+    if (!mf)
+    {
+        return 0;
+    }
+    pframe_t *shared = pframe_create();
+    if (!shared)
+    {
+        kfree(mf);
+        return 0;
+    }
+    shared->pf_addr = pf->pf_addr;
+    ppage_set_owner(shared->pf_addr, shared);
+    mf->mf_pf = shared;
+    mf->mf_hash = hash;
+    mf->mf_refs = 1;
+    list_link_init(&mf->mf_link);
+    spinlock_lock(&pagemerged_lock);
+    list_insert_tail(&pagemerged_pool[hash % PAGEMERGED_BUCKETS],
+                     &mf->mf_link);
+    spinlock_unlock(&pagemerged_lock);
+    pagemerged_convert(pf, mf, 1);
+    return 1;
+}
+
+long pagemerged_copy_in(pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    KASSERT(pf->pf_addr && pf->pf_merge);
+    merge_frame_t *mf = pf->pf_merge;
+    /* Safe without the shared frame's lock: pool contents are immutable
+     * and our reference keeps the entry alive. */
+    memcpy(pf->pf_addr, mf->mf_pf->pf_addr, PAGE_SIZE);
+    pf->pf_merge = NULL;
+    pagemerged_unref(mf);
+    /* Recharge residency to the process materializing the page. */
+    if (curproc)
+    {
+        pf->pf_owner = curproc->p_pid;
+        curproc->p_resident++;
+    }
+    return 0;
+}
+
+void pagemerged_copy_from(struct merge_frame *mf, void *dst)
+{
+    memcpy(dst, mf->mf_pf->pf_addr, PAGE_SIZE);
+}
+
+pframe_t *pagemerged_shared_frame(struct merge_frame *mf)
+{
+    kmutex_lock(&mf->mf_pf->pf_mutex);
+    return mf->mf_pf;
+}
+
+void pagemerged_release(pframe_t *pf)
+{
+    if (pf->pf_merge)
+    {
+        merge_frame_t *mf = pf->pf_merge;
+        pf->pf_merge = NULL;
+        pagemerged_unref(mf);
+    }
+}
+
+/*
+ * Examine one pinned candidate: find the frame again by page number under
+ * the object's own lock (the LRU scan's pframe pointer cannot be trusted
+ * once the LRU lock is dropped; see _pageoutd_swap_one), hash it, and
+ * either merge it with a matching pool entry, promote it on a second
+ * signature sighting, or just record its signature. Drops the reference
+ * the collector took on o. Returns 1 if a page was freed.
+ */
+static long pagemerged_scan_one(mobj_t *o, uint64_t pagenum)
+{
+    long merged = 0;
+    mobj_lock(o);
+    pframe_t *pf;
+    mobj_find_pframe(o, pagenum, &pf);
+    if (!pf || !pf->pf_addr || pf->pf_mapped)
+    {
+        if (pf)
+        {
+            pframe_release(&pf);
+        }
+        mobj_unlock(o);
+        mobj_put(&o);
+        return 0;
+    }
+
+    uint64_t hash = pagemerged_hash(pf->pf_addr);
+    merge_frame_t *mf = pagemerged_match(hash, pf->pf_addr);
+    if (mf)
+    {
+        pagemerged_convert(pf, mf, 0);
+        merged = 1;
+        dbg(DBG_PFRAME, "pagemerged: merged page %lu of mobj 0x%p\n",
+            pagenum, o);
+    }
+    else
+    {
+        merge_sig_t *sig = &pagemerged_sigs[hash % PAGEMERGED_SIGNATURES];
+        if (sig->sig_hash == hash &&
+            (sig->sig_obj != o || sig->sig_pagenum != pagenum))
+        {
+            /* Second sighting from a different frame: start a pool
+             * entry. The duplicate itself merges on a later pass (or the
+             * "different frame" was a stale signature and nothing else
+             * ever matches, in which case the entry is as good a home
+             * for the page as the frame was). */
+            pagemerged_promote(pf, hash);
+        }
+        else
+        {
+            sig->sig_hash = hash;
+            sig->sig_obj = o;
+            sig->sig_pagenum = pagenum;
+        }
+    }
+    pframe_release(&pf);
+    mobj_unlock(o);
+    mobj_put(&o);
+    return merged;
+}
+
+static void *pagemerged_run(long arg1, void *arg2)
+{
+    dbg(DBG_PROC, "pagemerged: running\n");
+    for (;;)
+    {
+        spinlock_lock(&pagemerged_sleep_lock);
+        /* sched_sleep_on_timeout releases the lock once we're on the
+         * queue; nothing signals the queue, so this is a pure periodic
+         * sleep. */
+        sched_sleep_on_timeout(&pagemerged_queue, &pagemerged_sleep_lock,
+                               PAGEMERGED_INTERVAL_TICKS);
+
+        /* The timer wakeup boosts us to the top queue; undo that before
+         * doing any work. Merging is pure opportunism and should only
+         * ever spend idle cycles. */
+        curthr->kt_base_prio = SCHED_NUM_PRIOS - 1;
+        curthr->kt_prio = SCHED_NUM_PRIOS - 1;
+
+        size_t n = pageoutd_collect_swappable(pagemerged_objs,
+                                              pagemerged_pagenums,
+                                              PAGEMERGED_BATCH);
+        size_t merged = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            merged += (size_t)pagemerged_scan_one(pagemerged_objs[i],
+                                                  pagemerged_pagenums[i]);
+            /* One candidate per trip through the scheduler, so a big
+             * batch never delays anything that actually has work. */
+            sched_yield();
+        }
+        if (merged)
+        {
+            dbg(DBG_PFRAME, "pagemerged: merged %lu pages this pass\n",
+                merged);
+        }
+    }
+    return NULL;
+}
+
+void pagemerged_start()
+{
+    for (size_t i = 0; i < PAGEMERGED_BUCKETS; i++)
+    {
+        list_init(&pagemerged_pool[i]);
+    }
+    sched_queue_init(&pagemerged_queue);
+
+    proc_t *proc = proc_create("pagemerged");
+    KASSERT(proc && "couldn't create the page-merging daemon");
+    kthread_t *thr = kthread_create(proc, pagemerged_run, 0, NULL);
+    KASSERT(thr && "couldn't create the page-merging daemon's thread");
+
+    /* Start at (and return to, see pagemerged_run) the lowest priority. */
+    thr->kt_base_prio = SCHED_NUM_PRIOS - 1;
+    thr->kt_prio = SCHED_NUM_PRIOS - 1;
+
+    sched_make_runnable(thr);
+}
@@ -0,0 +1,425 @@
+#include "errno.h"
+#include "globals.h"
+#include "kernel.h"
+
+#ifdef __VFS__
+#include "fs/vnode.h"
+#endif
+
+#include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/pageoutd.h"
+#include "mm/pframe.h"
+#include "mm/swap.h"
+#include "mm/swapcomp.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+
+#include "vm/shadow.h"
+
+/*
+ * LRU of resident pframes: the head is the coldest frame, the tail the most
+ * recently used. Every attached pframe is on the list. Frames belonging to
+ * evictable mobjs (block device caches) are reclaimed by writing them back
+ * through the mobj's flush; frames of swappable mobjs (anonymous and shadow
+ * objects) are reclaimed by compressing them into the in-memory pool or
+ * paging them out to the swap device, provided the frame was never
+ * mapped (see mm/swap.c and mm/swapcomp.c).
+ * Everything else just rides along so the ordering is ready if reverse
+ * mappings ever make mapped and vnode pages reclaimable too.
+ */
+static list_t pageoutd_lru = LIST_INITIALIZER(pageoutd_lru);
+static spinlock_t pageoutd_lru_lock = SPINLOCK_INITIALIZER(pageoutd_lru_lock);
+
+static ktqueue_t pageoutd_queue;
+static spinlock_t pageoutd_lock = SPINLOCK_INITIALIZER(pageoutd_lock);
+static long pageoutd_ready = 0;
+
+/*
+ * Per-process resident-page quota, in pages; 0 disables it. When set, a
+ * process whose p_resident exceeds the quota has its own frames evicted
+ * first, even with free memory to spare, so one process doing huge reads
+ * cannot monopolize the block caches (settable via the resident stats
+ * device).
+ */
+static size_t pageoutd_proc_quota = 0;
+
+size_t pageoutd_get_proc_quota()
+{
+    return pageoutd_proc_quota;
+}
+
+void pageoutd_set_proc_quota(size_t pages)
+{
+    pageoutd_proc_quota = pages;
+    if (pages)
+    {
+        pageoutd_wakeup();
+    }
+}
+
+long pageoutd_over_quota(proc_t *p)
+{
+    return pageoutd_proc_quota && p->p_resident > pageoutd_proc_quota;
+}
+
+void pageoutd_lru_insert(pframe_t *pf)
+{
+    spinlock_lock(&pageoutd_lru_lock);
+    KASSERT(!list_link_is_linked(&pf->pf_lru_link));
+    list_insert_tail(&pageoutd_lru, &pf->pf_lru_link);
+    spinlock_unlock(&pageoutd_lru_lock);
+}
+
+void pageoutd_lru_remove(pframe_t *pf)
+{
+    spinlock_lock(&pageoutd_lru_lock);
+    KASSERT(list_link_is_linked(&pf->pf_lru_link));
+    list_remove(&pf->pf_lru_link);
+    spinlock_unlock(&pageoutd_lru_lock);
+}
+
+void pageoutd_lru_touch(pframe_t *pf)
+{
+    spinlock_lock(&pageoutd_lru_lock);
+    if (list_link_is_linked(&pf->pf_lru_link))
+    {
+        list_remove(&pf->pf_lru_link);
+        list_insert_tail(&pageoutd_lru, &pf->pf_lru_link);
+    }
+    spinlock_unlock(&pageoutd_lru_lock);
+}
+
+/*
+ * Collect up to max candidates for the page-merging daemon: the coldest
+ * resident, unmapped frames of swappable mobjs. Each candidate's object
+ * is pinned with a reference (skipping objects already on their way out)
+ * and named as an (object, page number) pair, for the same reason
+ * _pageoutd_pick_victim does it that way: the pframe pointer cannot be
+ * trusted once the LRU lock is dropped. The caller owns the references.
+ */
+size_t pageoutd_collect_swappable(struct mobj **objs, uint64_t *pagenums,
+                                  size_t max)
+{
+    size_t n = 0;
+    spinlock_lock(&pageoutd_lru_lock);
+    list_iterate(&pageoutd_lru, pf, pframe_t, pf_lru_link)
+    {
+        if (n == max)
+        {
+            break;
+        }
+        if (!pf->pf_addr || pf->pf_mapped || !pf->pf_mobj->mo_swappable)
+        {
+            continue;
+        }
+        if (!refcount_inc_not_zero(&pf->pf_mobj->mo_refcount))
+        {
+            continue;
+        }
+        objs[n] = pf->pf_mobj;
+        pagenums[n] = pf->pf_pagenum;
+        n++;
+    }
+    spinlock_unlock(&pageoutd_lru_lock);
+    return n;
+}
+
+/*
+ * Collect up to max movable frames whose pages lie in [start, end), as
+ * (object, page number) pairs for the compaction daemon: resident,
+ * unmapped frames of evictable or swappable mobjs, each object pinned
+ * with a reference the caller owns. (Pinning an evictable mobj is
+ * harmless - they are never destroyed - and doing it uniformly keeps the
+ * caller simple.) Frames of other objects, and frames ever mapped,
+ * cannot be moved: no reverse mappings exist to fix the page tables up
+ * with.
+ */
+size_t pageoutd_collect_range(void *start, void *end, struct mobj **objs,
+                              uint64_t *pagenums, size_t max)
+{
+    size_t n = 0;
+    spinlock_lock(&pageoutd_lru_lock);
+    list_iterate(&pageoutd_lru, pf, pframe_t, pf_lru_link)
+    {
+        if (n == max)
+        {
+            break;
+        }
+        if (!pf->pf_addr || pf->pf_mapped || pf->pf_addr < start ||
+            pf->pf_addr >= end)
+        {
+            continue;
+        }
+        if (!pf->pf_mobj->mo_evictable && !pf->pf_mobj->mo_swappable)
+        {
+            continue;
+        }
+        if (!refcount_inc_not_zero(&pf->pf_mobj->mo_refcount))
+        {
+            continue;
+        }
+        objs[n] = pf->pf_mobj;
+        pagenums[n] = pf->pf_pagenum;
+        n++;
+    }
+    spinlock_unlock(&pageoutd_lru_lock);
+    return n;
+}
+
+void pageoutd_wakeup()
+{
+    if (!pageoutd_ready)
+    {
+        return;
+    }
+    spinlock_lock(&pageoutd_lock);
+    sched_broadcast_on(&pageoutd_queue);
+    spinlock_unlock(&pageoutd_lock);
+}
+
+/*
+ * Pick the coldest resident, unmapped pframe belonging to a reclaimable
+ * mobj. With over_quota_only set, only frames charged to a process
+ * currently over the resident quota qualify.
+ *
+ * For an evictable mobj, the frame itself is returned, and the pointer
+ * remains valid after the LRU lock is dropped: evictable mobjs are never
+ * destroyed, and the daemon is the only one who frees their pframes.
+ *
+ * Swappable mobjs offer no such guarantee - they are destroyed when their
+ * last reference goes away, and things like tmpfs truncation free their
+ * frames - so for those NULL is returned and (*swap_o, *swap_pagenum) name
+ * the candidate instead: a reference is taken on the object (skipping it
+ * if it is already on its way out), and _pageoutd_swap_one relocates the
+ * frame by page number under the object's own lock rather than trusting
+ * the pframe pointer.
+ *
+ * Returns NULL with *swap_o == NULL if there is no candidate at all.
+ */
+static pframe_t *_pageoutd_pick_victim(long over_quota_only, mobj_t **swap_o,
+                                       uint64_t *swap_pagenum)
+{
+    *swap_o = NULL;
+    spinlock_lock(&pageoutd_lru_lock);
+    list_iterate(&pageoutd_lru, pf, pframe_t, pf_lru_link)
+    {
+        if (!pf->pf_addr || pf->pf_mapped)
+        {
+            continue;
+        }
+        if (over_quota_only)
+        {
+            proc_t *owner = pf->pf_owner ? proc_lookup(pf->pf_owner) : NULL;
+            if (!owner || !pageoutd_over_quota(owner))
+            {
+                continue;
+            }
+        }
+        if (pf->pf_mobj->mo_evictable)
+        {
+            spinlock_unlock(&pageoutd_lru_lock);
+            return pf;
+        }
+        if (pf->pf_mobj->mo_swappable &&
+            (swap_ready() || swapcomp_ready()) &&
+            refcount_inc_not_zero(&pf->pf_mobj->mo_refcount))
+        {
+            *swap_o = pf->pf_mobj;
+            *swap_pagenum = pf->pf_pagenum;
+            spinlock_unlock(&pageoutd_lru_lock);
+            return NULL;
+        }
+    }
+    spinlock_unlock(&pageoutd_lru_lock);
+    return NULL;
+}
+
+/*
+ * Write back and free one previously picked frame. Returns 0 if the frame
+ * was freed, 1 if it was mapped or reclaimed while we took the locks (the
+ * caller should just pick again), and -1 if writeback failed (the caller
+ * should give up until the next wakeup rather than spin on the frame).
+ */
+static long _pageoutd_evict_one(pframe_t *pf)
+{
+    mobj_t *o = pf->pf_mobj;
+    mobj_lock(o);
+    kmutex_lock(&pf->pf_mutex);
+    if (!pf->pf_addr || pf->pf_mapped || pf->pf_state == PF_STATE_BUSY)
+    {
+        pframe_release(&pf);
+        mobj_unlock(o);
+        return 1;
+    }
+    long was_readahead = pf->pf_readahead;
+    if (mobj_free_pframe(o, &pf))
+    {
+        pframe_release(&pf);
+        mobj_unlock(o);
+        return -1;
+    }
+    mobj_unlock(o);
+    if (was_readahead)
+    {
+        /* Prefetched but never consulted: cache pollution. The window
+         * sizing feedback shrinks readahead when this dominates. */
+        pframe_ra_wasted++;
+    }
+    return 0;
+}
+
+/*
+ * Page out one frame of a pinned swappable object, found again by page
+ * number under the object's lock. Returns 0 if the page was written to
+ * swap and its memory freed, 1 if the frame disappeared or was mapped in
+ * the meantime (the caller should just pick again), and -1 if there are
+ * no free slots or the write failed (the caller should give up until the
+ * next wakeup). Drops the reference the victim scan took on *op.
+ */
+static long _pageoutd_swap_one(mobj_t **op, uint64_t pagenum)
+{
+    mobj_t *o = *op;
+    long ret;
+    mobj_lock(o);
+    pframe_t *pf;
+    mobj_find_pframe(o, pagenum, &pf);
+    if (!pf || !pf->pf_addr || pf->pf_mapped ||
+        pf->pf_state == PF_STATE_BUSY)
+    {
+        if (pf)
+        {
+            pframe_release(&pf);
+        }
+        ret = 1;
+    }
+    else if (o->mo_type == MOBJ_SHADOW && shadow_pframe_redundant(o, pf))
+    {
+        /* The private copy duplicates its ancestor's page (the COW write
+         * restored the same bytes); dropping it reverts the object to the
+         * ancestor mapping and saves both the memory and the swap write. */
+        ret = mobj_free_pframe(o, &pf) ? -1 : 0;
+        if (pf)
+        {
+            pframe_release(&pf);
+        }
+    }
+    else
+    {
+        ret = swap_out(o, pf) ? -1 : 0;
+        pframe_release(&pf);
+    }
+    mobj_unlock(o);
+    mobj_put(op);
+    return ret;
+}
+
+/*
+ * Evict frames charged to over-quota processes until every process is back
+ * within the resident quota or no such frames remain. Coldest first, so a
+ * process pays with the pages it is least likely to miss. Returns the
+ * number of pages freed.
+ */
+static size_t _pageoutd_evict_over_quota()
+{
+    size_t freed = 0;
+    for (;;)
+    {
+        mobj_t *swap_o;
+        uint64_t swap_pagenum;
+        pframe_t *pf = _pageoutd_pick_victim(1, &swap_o, &swap_pagenum);
+        if (!pf && !swap_o)
+        {
+            break;
+        }
+        long ret = pf ? _pageoutd_evict_one(pf)
+                      : _pageoutd_swap_one(&swap_o, swap_pagenum);
+        if (ret < 0)
+        {
+            break;
+        }
+        if (!ret)
+        {
+            freed++;
+        }
+    }
+    return freed;
+}
+
+/*
+ * Evict cold pages until the high watermark is reached or no candidates
+ * remain. Dirty frames are written back by mobj_free_pframe via the mobj's
+ * flush_pframe. Returns the number of pages freed.
+ */
+static size_t _pageoutd_evict()
+{
+    size_t freed = 0;
+    long pins_dropped = 0;
+    while (page_free_count() < PAGEOUTD_HIGH_WATERMARK)
+    {
+        mobj_t *swap_o;
+        uint64_t swap_pagenum;
+        pframe_t *pf = _pageoutd_pick_victim(0, &swap_o, &swap_pagenum);
+        if (!pf && !swap_o)
+        {
+#ifdef __VFS__
+            /* Out of ordinary candidates: drop the pinned-binary cache's
+             * references (once) and retry, since releasing those vnodes
+             * frees their cached text pages. */
+            if (!pins_dropped && vnode_pin_shrink())
+            {
+                pins_dropped = 1;
+                continue;
+            }
+#endif
+            break;
+        }
+
+        long ret = pf ? _pageoutd_evict_one(pf)
+                      : _pageoutd_swap_one(&swap_o, swap_pagenum);
+        if (ret < 0)
+        {
+            break;
+        }
+        if (!ret)
+        {
+            freed++;
+        }
+    }
+    return freed;
+}
+
+static void *pageoutd_run(long arg1, void *arg2)
+{
+    dbg(DBG_PROC, "pageoutd: running\n");
+    for (;;)
+    {
+        spinlock_lock(&pageoutd_lock);
+        /* sched_sleep_on releases pageoutd_lock once we're on the queue */
+        sched_sleep_on(&pageoutd_queue, &pageoutd_lock);
+
+        size_t freed = _pageoutd_evict_over_quota();
+        freed += _pageoutd_evict();
+        dbg(DBG_PFRAME, "pageoutd: freed %lu pages (%lu now free)\n", freed,
+            page_free_count());
+    }
+    return NULL;
+}
+
+void pageoutd_start()
+{
+    sched_queue_init(&pageoutd_queue);
+
+    proc_t *proc = proc_create("pageoutd");
+    KASSERT(proc && "couldn't create the pageout daemon");
+    kthread_t *thr = kthread_create(proc, pageoutd_run, 0, NULL);
+    KASSERT(thr && "couldn't create the pageout daemon's thread");
+
+    pageoutd_ready = 1;
+    sched_make_runnable(thr);
+}
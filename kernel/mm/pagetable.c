@@ -3,8 +3,11 @@
 #include "kernel.h"
 #include "types.h"
 
+#include "main/cpuid.h"
+
 #include "mm/mm.h"
 #include "mm/pframe.h"
+#include "mm/tlb.h"
 
 #include "util/debug.h"
 #include "util/string.h"
@@ -21,10 +24,121 @@ typedef enum
 
 static pml4_t *global_kernel_only_pml4;
 
+/*
+ * PCID support: without it, every cr3 write flushes the whole TLB, so two
+ * processes ping-ponging on a pipe rebuild their working sets from page
+ * walks on every switch. With PCIDs, each address space loaded on a core
+ * is assigned one of a small pool of tags and reactivated with the cr3
+ * no-flush bit, so its TLB entries survive while another space runs.
+ */
+#define PT_PCID_SLOTS 8
+#define PT_CR3_NOFLUSH (1UL << 63)
+#define CR4_PCIDE (1UL << 17)
+#define CR4_PGE (1UL << 7)
+
+/* Section boundaries from link.ld; as usual, the boundary is the address
+ * of the symbol, not its value. */
+extern void *k_start;
+extern void *csd_start;
+extern void *_rodata;
+extern void *_data;
+
+static long pt_pcid_supported; /* set once from cpuid in pt_init */
+
+/*
+ * Bumped whenever mappings are torn down or tightened (pt_unmap_range,
+ * pt_write_protect_range, pt_destroy). A PCID slot loaded under an older
+ * epoch may hold TLB entries those operations did not reach - invlpg and
+ * the shootdown IPIs only clean the tag that is current on each core -
+ * so pt_set reactivates it with a flushing cr3 write instead of the
+ * no-flush bit. Each invalidation thus costs every address space one
+ * full flush at its next activation, while the hot switch pattern (no
+ * unmaps between switches) keeps its TLB intact.
+ */
+static volatile uint64_t pt_pcid_epoch = 1;
+
+typedef struct pcid_slot
+{
+    pml4_t *ps_pml4;   /* address space last loaded with this tag */
+    uint64_t ps_epoch; /* pt_pcid_epoch at the time of that load */
+} pcid_slot_t;
+
+/* Per-core: slot i remembers the pml4 last loaded with PCID i + 1.
+ * PCID 0 is left for boot-time and pre-PCID cr3 loads. */
+static pcid_slot_t pt_pcid_cache[PT_PCID_SLOTS] CORE_SPECIFIC_DATA;
+static size_t pt_pcid_next CORE_SPECIFIC_DATA;
+
+/*
+ * Software translation cache: a small per-core direct-mapped table of
+ * recent (pml4, vpn) -> frame translations, consulted before the
+ * four-level walk in pt_virt_to_phys_helper. The hot callers translate
+ * the same few addresses over and over - the CSD probes on the context
+ * switch path and kernel-image buffers handed to drivers - so repeat
+ * translations hit here and skip the walk entirely.
+ *
+ * Invalidation mirrors the PCID epoch: any operation that changes an
+ * existing translation (unmap, write-protect, destroy, promotion, or a
+ * map that overwrites a present leaf) bumps pt_xlat_epoch, and entries
+ * stamped with an older epoch are ignored. Entries are only shared
+ * within a core, so the one concurrent writer to worry about is an
+ * interrupt handler on the same core; slots are published by writing
+ * the epoch stamp last, and a lookup re-checks the stamp after reading
+ * the fields, so a torn slot can only miss, never mistranslate.
+ */
+#define PT_XLAT_SLOTS 16
+
+typedef struct xlat_slot
+{
+    pml4_t *xs_pml4;           /* address space the entry belongs to */
+    uintptr_t xs_vpn;          /* virtual page number */
+    uintptr_t xs_ppage;        /* physical address of the 4K frame */
+    volatile uint64_t xs_epoch; /* pt_xlat_epoch when filled; 0 = empty */
+} xlat_slot_t;
+
+static volatile uint64_t pt_xlat_epoch = 1;
+static xlat_slot_t pt_xlat_cache[PT_XLAT_SLOTS] CORE_SPECIFIC_DATA;
+
 void pt_set(pml4_t *pml4)
 {
     KASSERT((void *)pml4 >= physmap_start());
     uintptr_t phys_addr = pt_virt_to_phys((uintptr_t)pml4);
+    curcore.kc_pml4 = pml4;
+    if (pt_pcid_supported)
+    {
+        /* The slot scan and the cr3 write must not be torn apart by a
+         * preemption that itself calls pt_set, or two loads could end up
+         * sharing a tag. */
+        uint8_t current_ipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        uint64_t epoch = pt_pcid_epoch;
+        size_t slot = (size_t)-1;
+        for (size_t i = 0; i < PT_PCID_SLOTS; i++)
+        {
+            if (pt_pcid_cache[i].ps_pml4 == pml4)
+            {
+                slot = i;
+                break;
+            }
+        }
+        uintptr_t noflush = 0;
+        if (slot == (size_t)-1)
+        {
+            /* Round-robin eviction; the flushing load below clears out
+             * whatever the previous tenant left under this tag. */
+            slot = pt_pcid_next++ % PT_PCID_SLOTS;
+            pt_pcid_cache[slot].ps_pml4 = pml4;
+        }
+        else if (pt_pcid_cache[slot].ps_epoch == epoch)
+        {
+            noflush = PT_CR3_NOFLUSH;
+        }
+        pt_pcid_cache[slot].ps_epoch = epoch;
+        __asm__ volatile(
+            "movq %0, %%cr3" ::"r"(phys_addr | (slot + 1) | noflush)
+            : "memory");
+        intr_setipl(current_ipl);
+        return;
+    }
     __asm__ volatile("movq %0, %%cr3" ::"r"(phys_addr)
                      : "memory");
 }
@@ -40,7 +154,8 @@ inline pml4_t *pt_get()
     uintptr_t pml4;
     __asm__ volatile("movq %%cr3, %0"
                      : "=r"(pml4));
-    return (pml4_t *)(pml4 + PHYS_OFFSET);
+    /* cr3 carries the PCID tag in its low bits when PCIDs are in use. */
+    return (pml4_t *)((pml4 & PAGE_MASK) + PHYS_OFFSET);
 }
 
 vaddr_map_status _vaddr_status(pml4_t *pml4, uintptr_t vaddr)
@@ -88,6 +203,93 @@ vaddr_map_status _vaddr_status(pml4_t *pml4, uintptr_t vaddr)
     return PAGE_4KB;
 }
 
+/*
+ * Returns 1 if every page of [vaddr, vaddr + len) is mapped in pml4 with
+ * user access (and write access, when forwrite is set); 0 otherwise.
+ *
+ * Only the leaf entry's flags are inspected: pt_map always sets
+ * PT_PRESENT | PT_WRITE | PT_USER on the upper levels, so the leaf is
+ * where the interesting bits live. This is the probe behind the
+ * copy_{from,to}_user fast path.
+ */
+long pt_range_mapped(pml4_t *pml4, uintptr_t vaddr, size_t len, long forwrite)
+{
+    uintptr_t flags = PT_PRESENT | PT_USER | (forwrite ? PT_WRITE : 0);
+    uintptr_t vmax = vaddr + len;
+    for (vaddr = (uintptr_t)PAGE_ALIGN_DOWN(vaddr); vaddr < vmax;
+         vaddr += PAGE_SIZE)
+    {
+        uint64_t idx;
+        pml4_t *table = pml4;
+        uintptr_t entry;
+
+        idx = PML4E(vaddr);
+        if (!IS_PRESENT(table->phys[idx]))
+        {
+            return 0;
+        }
+        table = (pdp_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+        idx = PDPE(vaddr);
+        entry = table->phys[idx];
+        if (!IS_PRESENT(entry))
+        {
+            return 0;
+        }
+        if (IS_1GB_PAGE(entry))
+        {
+            if ((entry & flags) != flags)
+            {
+                return 0;
+            }
+            continue;
+        }
+        table = (pd_t *)((entry & PAGE_MASK) + PHYS_OFFSET);
+
+        idx = PDE(vaddr);
+        entry = table->phys[idx];
+        if (!IS_PRESENT(entry))
+        {
+            return 0;
+        }
+        if (IS_2MB_PAGE(entry))
+        {
+            if ((entry & flags) != flags)
+            {
+                return 0;
+            }
+            continue;
+        }
+        table = (pt_t *)((entry & PAGE_MASK) + PHYS_OFFSET);
+
+        idx = PTE(vaddr);
+        if ((table->phys[idx] & flags) != flags)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Publish a freshly walked translation into its cache slot. The slot is
+ * emptied first and the epoch stamp written last, so a lookup racing an
+ * interrupt-context fill on this core sees either the old entry, an
+ * empty slot, or the complete new entry. The walked-under epoch is
+ * stamped (not the current one): if an invalidation landed during the
+ * walk, the entry records an old epoch and is never trusted. */
+static uintptr_t pt_xlat_fill(xlat_slot_t *slot, pml4_t *pml4, uint64_t epoch,
+                              uintptr_t vaddr, uintptr_t paddr)
+{
+    slot->xs_epoch = 0;
+    __asm__ volatile("" ::: "memory");
+    slot->xs_pml4 = pml4;
+    slot->xs_vpn = vaddr >> PAGE_SHIFT;
+    slot->xs_ppage = paddr - PAGE_OFFSET(vaddr);
+    __asm__ volatile("" ::: "memory");
+    slot->xs_epoch = epoch;
+    return paddr;
+}
+
 uintptr_t pt_virt_to_phys_helper(pml4_t *table, uintptr_t vaddr)
 {
     if (vaddr >= (uintptr_t)physmap_start() &&
@@ -96,6 +298,26 @@ uintptr_t pt_virt_to_phys_helper(pml4_t *table, uintptr_t vaddr)
         return vaddr - PHYS_OFFSET;
     }
 
+    /* Consult the per-core translation cache before walking. The epoch
+     * is checked both before and after the field reads so that a slot
+     * being rewritten by an interrupt on this core is rejected rather
+     * than read torn (same-key rewrites under the same epoch carry the
+     * same translation, so those are safe either way). */
+    uintptr_t vpn = vaddr >> PAGE_SHIFT;
+    xlat_slot_t *slot = &pt_xlat_cache[vpn & (PT_XLAT_SLOTS - 1)];
+    uint64_t epoch = pt_xlat_epoch;
+    if (slot->xs_epoch == epoch)
+    {
+        pml4_t *spml4 = slot->xs_pml4;
+        uintptr_t svpn = slot->xs_vpn;
+        uintptr_t sppage = slot->xs_ppage;
+        if (spml4 == table && svpn == vpn && slot->xs_epoch == epoch)
+        {
+            return sppage + PAGE_OFFSET(vaddr);
+        }
+    }
+
+    pml4_t *pml4 = table;
     uint64_t idx;
 
     // PML4
@@ -108,7 +330,9 @@ uintptr_t pt_virt_to_phys_helper(pml4_t *table, uintptr_t vaddr)
     KASSERT(IS_PRESENT(table->phys[idx]));
     if (USE_1GB_PAGES && IS_1GB_PAGE(table->phys[idx]))
     {
-        return PAGE_ALIGN_DOWN_1GB(table->phys[idx]) + PAGE_OFFSET_1GB(vaddr);
+        return pt_xlat_fill(slot, pml4, epoch, vaddr,
+                            PAGE_ALIGN_DOWN_1GB(table->phys[idx]) +
+                                PAGE_OFFSET_1GB(vaddr));
     }
     table = (pd_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
 
@@ -117,7 +341,9 @@ uintptr_t pt_virt_to_phys_helper(pml4_t *table, uintptr_t vaddr)
     KASSERT(IS_PRESENT(table->phys[idx]));
     if (USE_2MB_PAGES && IS_2MB_PAGE(table->phys[idx]))
     {
-        return PAGE_ALIGN_DOWN_2MB(table->phys[idx]) + PAGE_OFFSET_2MB(vaddr);
+        return pt_xlat_fill(slot, pml4, epoch, vaddr,
+                            PAGE_ALIGN_DOWN_2MB(table->phys[idx]) +
+                                PAGE_OFFSET_2MB(vaddr));
     }
     table = (pt_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
 
@@ -126,7 +352,110 @@ uintptr_t pt_virt_to_phys_helper(pml4_t *table, uintptr_t vaddr)
 
     KASSERT(IS_PRESENT(table->phys[idx]));
 
-    return (uintptr_t)PAGE_ALIGN_DOWN(table->phys[idx]) + PAGE_OFFSET(vaddr);
+    return pt_xlat_fill(slot, pml4, epoch, vaddr,
+                        (uintptr_t)PAGE_ALIGN_DOWN(table->phys[idx]) +
+                            PAGE_OFFSET(vaddr));
+}
+
+/* Tallies the permission bits of one present leaf mapping. */
+static void pt_stats_leaf(pt_stats_t *stats, uintptr_t entry)
+{
+    if (entry & PT_USER)
+    {
+        stats->ps_leaf_user++;
+    }
+    if (entry & PT_WRITE)
+    {
+        stats->ps_leaf_write++;
+    }
+    if (entry & PT_ACCESSED)
+    {
+        stats->ps_leaf_accessed++;
+    }
+    if (entry & PT_DIRTY)
+    {
+        stats->ps_leaf_dirty++;
+    }
+}
+
+/*
+ * Walks the user half of pml4 (the kernel half is shared by every
+ * process) and fills stats with what pt_map_range/clone_pml4 actually
+ * built: leaf mappings by page size, intermediate table counts, tables
+ * with no present entries (left behind by unmap, pure overhead), and
+ * permission breakdowns. The same read-only traversal as
+ * pt_virt_to_phys_helper, just exhaustive instead of keyed by one
+ * address; the caller must keep the address space alive across the walk.
+ */
+void pt_mapping_stats(pml4_t *pml4, pt_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i4 = 0; i4 < PT_ENTRY_COUNT / 2; i4++)
+    {
+        if (!IS_PRESENT(pml4->phys[i4]))
+        {
+            continue;
+        }
+        pdp_t *pdp = (pdp_t *)((pml4->phys[i4] & PAGE_MASK) + PHYS_OFFSET);
+        stats->ps_tables_pdp++;
+        size_t pdp_present = 0;
+        for (size_t i3 = 0; i3 < PT_ENTRY_COUNT; i3++)
+        {
+            if (!IS_PRESENT(pdp->phys[i3]))
+            {
+                continue;
+            }
+            pdp_present++;
+            if (USE_1GB_PAGES && IS_1GB_PAGE(pdp->phys[i3]))
+            {
+                stats->ps_pages_1gb++;
+                pt_stats_leaf(stats, pdp->phys[i3]);
+                continue;
+            }
+            pd_t *pd = (pd_t *)((pdp->phys[i3] & PAGE_MASK) + PHYS_OFFSET);
+            stats->ps_tables_pd++;
+            size_t pd_present = 0;
+            for (size_t i2 = 0; i2 < PT_ENTRY_COUNT; i2++)
+            {
+                if (!IS_PRESENT(pd->phys[i2]))
+                {
+                    continue;
+                }
+                pd_present++;
+                if (USE_2MB_PAGES && IS_2MB_PAGE(pd->phys[i2]))
+                {
+                    stats->ps_pages_2mb++;
+                    pt_stats_leaf(stats, pd->phys[i2]);
+                    continue;
+                }
+                pt_t *pt = (pt_t *)((pd->phys[i2] & PAGE_MASK) + PHYS_OFFSET);
+                stats->ps_tables_pt++;
+                size_t pt_present = 0;
+                for (size_t i1 = 0; i1 < PT_ENTRY_COUNT; i1++)
+                {
+                    if (!IS_PRESENT(pt->phys[i1]))
+                    {
+                        continue;
+                    }
+                    pt_present++;
+                    stats->ps_pages_4k++;
+                    pt_stats_leaf(stats, pt->phys[i1]);
+                }
+                if (!pt_present)
+                {
+                    stats->ps_tables_empty++;
+                }
+            }
+            if (!pd_present)
+            {
+                stats->ps_tables_empty++;
+            }
+        }
+        if (!pdp_present)
+        {
+            stats->ps_tables_empty++;
+        }
+    }
 }
 
 uintptr_t pt_virt_to_phys(uintptr_t vaddr)
@@ -159,7 +488,11 @@ long _fill_pd(pd_t *pd, uintptr_t paddr, uintptr_t vaddr, uintptr_t vmax,
     {
         KASSERT(!IS_PRESENT(pd->phys[idx]));
 #if USE_2MB_PAGES
-        if (vmax - vaddr >= PT_VADDR_SIZE)
+        /* A 2MB PDE is only legal if both addresses are 2MB-aligned; the
+         * kernel image's base may not be, in which case the first entries
+         * fall through to 4K page tables. */
+        if (PAGE_ALIGNED_2MB(vaddr) && PAGE_ALIGNED_2MB(paddr) &&
+            vmax - vaddr >= PT_VADDR_SIZE)
         {
             pd->phys[idx] = paddr | PT_PRESENT | PT_WRITE | PT_SIZE;
             continue;
@@ -188,7 +521,8 @@ long _fill_pdp(pdp_t *pdp, uintptr_t paddr, uintptr_t vaddr, uintptr_t vmax,
     {
         KASSERT(!IS_PRESENT(pdp->phys[idx]));
 #if USE_1GB_PAGES
-        if (vmax - vaddr >= PD_VADDR_SIZE)
+        if (PAGE_ALIGNED_1GB(vaddr) && PAGE_ALIGNED_1GB(paddr) &&
+            vmax - vaddr >= PD_VADDR_SIZE)
         {
             pdp->phys[idx] = paddr | PT_PRESENT | PT_WRITE | PT_SIZE;
             continue;
@@ -255,6 +589,12 @@ long pt_map_range(pml4_t *pml4, uintptr_t paddr, uintptr_t vaddr,
     KASSERT((pdflags & PT_USER) == (ptflags & PT_USER));
     KASSERT(!(pdflags & PT_SIZE) && !(ptflags & PT_SIZE));
 
+    /* Set when a present leaf is replaced: the old translation may sit in
+     * the software translation cache, so the epoch must be bumped. Fresh
+     * mappings (the overwhelmingly common case - page faults filling holes)
+     * leave the cache alone. */
+    long overwrote = 0;
+
     while (vaddr < vmax)
     {
         uint64_t size = vmax - vaddr;
@@ -287,7 +627,12 @@ long pt_map_range(pml4_t *pml4, uintptr_t paddr, uintptr_t vaddr,
         if (!IS_PRESENT(table->phys[idx]))
         {
 #if USE_1GB_PAGES
-            if (PAGE_ALIGNED_1GB(vaddr) && size > PAGE_SIZE_1GB)
+            /* Both addresses must be 1GB-aligned: a huge entry stores the
+             * frame number in the high bits, so an unaligned paddr would
+             * leak into the flag bits. >= so an exactly-1GB region still
+             * takes the huge path. */
+            if (PAGE_ALIGNED_1GB(vaddr) && PAGE_ALIGNED_1GB(paddr) &&
+                size >= PAGE_SIZE_1GB)
             {
                 table->phys[idx] = (uintptr_t)paddr | ptflags | PT_SIZE;
                 paddr += PAGE_SIZE_1GB;
@@ -338,7 +683,10 @@ long pt_map_range(pml4_t *pml4, uintptr_t paddr, uintptr_t vaddr,
         if (!IS_PRESENT(table->phys[idx]))
         {
 #if USE_2MB_PAGES
-            if (PAGE_ALIGNED_2MB(vaddr) && size > PAGE_SIZE_2MB)
+            /* As with the 1GB case: both addresses aligned, and >= so an
+             * exactly-2MB region still gets a single PDE. */
+            if (PAGE_ALIGNED_2MB(vaddr) && PAGE_ALIGNED_2MB(paddr) &&
+                size >= PAGE_SIZE_2MB)
             {
                 table->phys[idx] = (uintptr_t)paddr | ptflags | PT_SIZE;
                 paddr += PAGE_SIZE_2MB;
@@ -384,18 +732,87 @@ long pt_map_range(pml4_t *pml4, uintptr_t paddr, uintptr_t vaddr,
 
         // PT (4KB pages)
 
+        /* Fill consecutive PTEs in this page table directly rather than
+         * re-walking from the pml4 for every 4K page; the walk only needs
+         * to be redone when we cross into the next PDE (at which point the
+         * region might also become huge-page eligible again). */
         idx = PTE(vaddr);
-        table->phys[idx] = (uintptr_t)paddr | ptflags;
+        do
+        {
+            if (IS_PRESENT(table->phys[idx]))
+            {
+                overwrote = 1;
+            }
+            table->phys[idx] = (uintptr_t)paddr | ptflags;
 
-        KASSERT(IS_PRESENT(table->phys[idx]));
+            KASSERT(IS_PRESENT(table->phys[idx]));
 
-        paddr += PAGE_SIZE;
-        vaddr += PAGE_SIZE;
+            paddr += PAGE_SIZE;
+            vaddr += PAGE_SIZE;
+            idx++;
+        } while (vaddr < vmax && idx < PT_ENTRY_COUNT);
+    }
+
+    if (overwrote)
+    {
+        __sync_fetch_and_add(&pt_xlat_epoch, 1);
     }
 
     return 0;
 }
 
+/*
+ * Replace whatever currently maps the 2MB-aligned window at vaddr with a
+ * single 2MB PDE pointing at the physically contiguous run at paddr,
+ * freeing the window's old 4K page table if it had one. Used by the
+ * anonymous huge-page promotion path (vmmap_try_promote_huge) after it
+ * has migrated the window's data into the run; pt_unmap_range already
+ * knows how to split the PDE again on partial unmaps.
+ */
+long pt_promote_2mb(pml4_t *pml4, uintptr_t paddr, uintptr_t vaddr,
+                    uint32_t pdflags, uint32_t ptflags)
+{
+    dbg(DBG_PGTBL, "0x%p promoted to 2MB page at 0x%p; pml4: 0x%p\n",
+        (void *)vaddr, (void *)paddr, pml4);
+    KASSERT(PAGE_ALIGNED_2MB(paddr) && PAGE_ALIGNED_2MB(vaddr));
+    KASSERT(!(pdflags & PT_SIZE) && !(ptflags & PT_SIZE));
+
+    uint64_t idx = PML4E(vaddr);
+    pml4_t *table = pml4;
+    if (!IS_PRESENT(table->phys[idx]))
+    {
+        /* Nothing mapped this deep yet; the ordinary path installs the
+         * intermediate levels and the huge PDE itself. */
+        return pt_map_range(pml4, paddr, vaddr, vaddr + PAGE_SIZE_2MB,
+                            pdflags, ptflags);
+    }
+    table = (pdp_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+    idx = PDPE(vaddr);
+    if (!IS_PRESENT(table->phys[idx]))
+    {
+        return pt_map_range(pml4, paddr, vaddr, vaddr + PAGE_SIZE_2MB,
+                            pdflags, ptflags);
+    }
+    KASSERT(!IS_1GB_PAGE(table->phys[idx]) &&
+            "promoting inside an existing 1GB mapping");
+    table = (pd_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+    idx = PDE(vaddr);
+    uintptr_t entry = table->phys[idx];
+    if (IS_PRESENT(entry) && !IS_2MB_PAGE(entry))
+    {
+        page_free((void *)((entry & PAGE_MASK) + PHYS_OFFSET));
+    }
+    table->phys[idx] = paddr | ptflags | PT_SIZE;
+
+    /* The window's old translations are gone; stale PCID tags must not
+     * serve them (see pt_unmap_range). The caller flushes this core. */
+    __sync_fetch_and_add(&pt_pcid_epoch, 1);
+    __sync_fetch_and_add(&pt_xlat_epoch, 1);
+    return 0;
+}
+
 static long _pt_fault_handler(regs_t *regs)
 {
     uintptr_t vaddr;
@@ -409,6 +826,29 @@ static long _pt_fault_handler(regs_t *regs)
     {
         handle_pagefault(vaddr, cause);
     }
+    else if (!(cause & FAULT_PRESENT) &&
+             PML4E(vaddr) == PML4E(PHYS_OFFSET))
+    {
+        /* Kernel fault on a not-yet-mapped page of the physmap slot: the
+         * translation is fixed by construction (vaddr - PHYS_OFFSET), so
+         * install it directly - no vmmap locks, no curproc state. This
+         * demand-maps physical ranges beyond physmap_end, like the AHCI
+         * HBA registers and DMA buffers drivers/disk/sata.c pre-maps with
+         * ensure_mapped(), and keeps driver fault latency independent of
+         * process state. The physmap subtree is shared by reference
+         * across address spaces (see clone_pml4), so one insertion serves
+         * every pml4. Present faults (e.g. a write to sealed kernel text
+         * through its physmap alias) still panic below. */
+        if (pt_map(pt_get(), (uintptr_t)PAGE_ALIGN_DOWN(vaddr) - PHYS_OFFSET,
+                   (uintptr_t)PAGE_ALIGN_DOWN(vaddr), PT_PRESENT | PT_WRITE,
+                   PT_PRESENT | PT_WRITE))
+        {
+            dump_registers(regs);
+            panic("\nout of memory mapping kernel fault at vaddr 0x%p\n",
+                  (void *)vaddr);
+        }
+        tlb_flush(vaddr);
+    }
     else
     {
         dump_registers(regs);
@@ -454,7 +894,41 @@ void pt_init()
         pt_set((pml4_t *)((uintptr_t)pml4 + PHYS_OFFSET));
         global_kernel_only_pml4 = (pml4_t *)((uintptr_t)pml4 + PHYS_OFFSET);
         // pt_unmap_range(global_kernel_only_pml4, USER_MEM_LOW, USER_MEM_HIGH);
+
+        /* _fill_pml4 mapped the whole image (and its physmap alias)
+         * writable; reseal text and rodata now, before the first
+         * pt_create clone, so every address space inherits read-only
+         * leaves and a stray kernel write to code panics in the fault
+         * handler instead of silently corrupting it. */
+        pt_kernel_text_lock();
+
         intr_register(INTR_PAGE_FAULT, _pt_fault_handler);
+
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(CPUID_GETFEATURES, &eax, &ebx, &ecx, &edx);
+        pt_pcid_supported = (ecx & CPUID_FEAT_ECX_PCID) != 0;
+        dbg(DBG_PGTBL, "PCID %ssupported\n", pt_pcid_supported ? "" : "not ");
+    }
+    {
+        /* The sealed kernel leaves carry PT_GLOBAL (see
+         * pt_kernel_text_lock); with CR4.PGE set on every core they
+         * survive cr3 loads, so context switches stop evicting the
+         * kernel's own code and rodata translations. */
+        uintptr_t cr4;
+        __asm__ volatile("movq %%cr4, %0"
+                         : "=r"(cr4));
+        __asm__ volatile("movq %0, %%cr4" ::"r"(cr4 | CR4_PGE));
+    }
+    if (pt_pcid_supported)
+    {
+        /* Every core passes through here before its first tagged cr3 load.
+         * CR4.PCIDE may only be set while cr3's PCID field is zero, which
+         * still holds at this point (setting an already-set bit is fine,
+         * as happens on the boot core's second call). */
+        uintptr_t cr4;
+        __asm__ volatile("movq %%cr4, %0"
+                         : "=r"(cr4));
+        __asm__ volatile("movq %0, %%cr4" ::"r"(cr4 | CR4_PCIDE));
     }
     pt_set(global_kernel_only_pml4);
 }
@@ -544,6 +1018,14 @@ pdp_t *clone_pdp(pdp_t *pdp)
     return clone;
 }
 
+/* The kernel half of every address space is identical except for the slot
+ * covering the kernel image, which holds the per-core CSD mapping that
+ * map_in_core_specific_data() rewrites for each address space. All other
+ * kernel-half subtrees (notably physmap) are shared by reference rather than
+ * deep-copied, so creating an address space only clones a handful of pages.
+ * pt_destroy() must skip these shared subtrees; see below. */
+#define PML4_KERNEL_IMAGE_SLOT PML4E(KERNEL_VMA)
+
 pml4_t *clone_pml4(pml4_t *pml4, long include_user_mappings)
 {
     pml4_t *clone = page_alloc();
@@ -560,6 +1042,11 @@ pml4_t *clone_pml4(pml4_t *pml4, long include_user_mappings)
         // dbg(DBG_PRINT, "checking pml4 i = %u\n", i);
         if (pml4->phys[i])
         {
+            if (i >= PT_ENTRY_COUNT / 2 && i != PML4_KERNEL_IMAGE_SLOT)
+            {
+                clone->phys[i] = pml4->phys[i];
+                continue;
+            }
             pdp_t *cloned_pdp =
                 clone_pdp((pdp_t *)((pml4->phys[i] & PAGE_MASK) + PHYS_OFFSET));
             if (!cloned_pdp)
@@ -600,7 +1087,35 @@ void pt_destroy_helper(pt_t *pt, long depth)
     page_free(pt);
 }
 
-void pt_destroy(pml4_t *pml4) { pt_destroy_helper(pml4, 4); }
+void pt_destroy(pml4_t *pml4)
+{
+    /* Kernel-half subtrees other than the kernel image slot are shared with
+     * the address space this one was cloned from (see clone_pml4) and must
+     * not be freed here. */
+    for (uintptr_t i = 0; i < PT_ENTRY_COUNT; i++)
+    {
+        if (!pml4->phys[i] || (PT_SIZE & pml4->phys[i]))
+        {
+            continue;
+        }
+        if (i >= PT_ENTRY_COUNT / 2 && i != PML4_KERNEL_IMAGE_SLOT)
+        {
+            pml4->phys[i] = 0;
+            continue;
+        }
+        KASSERT(IS_PRESENT(pml4->phys[i]) && (pml4->phys[i] & PAGE_MASK));
+        pt_destroy_helper((pt_t *)((pml4->phys[i] & PAGE_MASK) + PHYS_OFFSET),
+                          3);
+        pml4->phys[i] = 0;
+    }
+    page_free(pml4);
+
+    /* The page may be reallocated as a new pml4 at the same address; a
+     * cached PCID tag must not treat that new space as already loaded, and
+     * a cached translation must not survive into the reincarnation. */
+    __sync_fetch_and_add(&pt_pcid_epoch, 1);
+    __sync_fetch_and_add(&pt_xlat_epoch, 1);
+}
 
 void pt_unmap(pml4_t *pml4, uintptr_t vaddr)
 {
@@ -739,8 +1254,272 @@ void pt_unmap_range(pml4_t *pml4, uintptr_t vaddr, uintptr_t vmax)
         vaddr += PAGE_SIZE;
     }
     KASSERT(_vaddr_status(pml4, vaddr_start) == UNMAPPED);
+
+    /* Retire every cached PCID tag: cores holding this address space under
+     * an inactive tag have TLB entries the invlpg/shootdown path cannot
+     * reach, so their next activation must be a flushing load. The software
+     * translation cache holds the same stale translations, so it is retired
+     * the same way. */
+    __sync_fetch_and_add(&pt_pcid_epoch, 1);
+    __sync_fetch_and_add(&pt_xlat_epoch, 1);
+}
+
+/*
+ * Clear the write permission on every present mapping in virt[vaddr, vmax).
+ * The mappings themselves survive, so reads proceed without faulting; the
+ * first write to each page takes a protection fault and is resolved by
+ * handle_pagefault(), which re-maps the page writable (copying it first if
+ * the backing object demands it). Used by do_fork to make the parent's
+ * resident pages copy-on-write instead of unmapping them outright.
+ *
+ * Large pages straddling the range boundary have the whole page
+ * write-protected rather than being split; the only cost is a spurious
+ * (but harmless) protection fault on the uncovered portion.
+ */
+void pt_write_protect_range(pml4_t *pml4, uintptr_t vaddr, uintptr_t vmax)
+{
+    dbg(DBG_PGTBL, "virt[0x%p, 0x%p); pml4: 0x%p\n", (void *)vaddr,
+        (void *)vmax, pml4);
+    KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(vmax) && vmax > vaddr);
+
+    while (vaddr < vmax)
+    {
+        uint64_t idx = PML4E(vaddr);
+        pml4_t *table = pml4;
+
+        if (!IS_PRESENT(table->phys[idx]))
+        {
+            vaddr = PAGE_ALIGN_UP_512GB(vaddr + 1);
+            continue;
+        }
+        table = (pdp_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+        // PDP (1GB pages)
+        idx = PDPE(vaddr);
+        if (!IS_PRESENT(table->phys[idx]))
+        {
+            vaddr = PAGE_ALIGN_UP_1GB(vaddr + 1);
+            continue;
+        }
+        if (IS_1GB_PAGE(table->phys[idx]))
+        {
+            table->phys[idx] &= ~(uintptr_t)PT_WRITE;
+            vaddr = PAGE_ALIGN_UP_1GB(vaddr + 1);
+            continue;
+        }
+        table = (pd_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+        // PD (2MB pages)
+        idx = PDE(vaddr);
+        if (!IS_PRESENT(table->phys[idx]))
+        {
+            vaddr = PAGE_ALIGN_UP_2MB(vaddr + 1);
+            continue;
+        }
+        if (IS_2MB_PAGE(table->phys[idx]))
+        {
+            table->phys[idx] &= ~(uintptr_t)PT_WRITE;
+            vaddr = PAGE_ALIGN_UP_2MB(vaddr + 1);
+            continue;
+        }
+        table = (pt_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+        // PT (4KB pages)
+        idx = PTE(vaddr);
+        if (IS_PRESENT(table->phys[idx]))
+        {
+            table->phys[idx] &= ~(uintptr_t)PT_WRITE;
+        }
+        vaddr += PAGE_SIZE;
+    }
+
+    /* As in pt_unmap_range: a stale writable entry cached under an
+     * inactive PCID tag would let a write bypass the protection fault. */
+    __sync_fetch_and_add(&pt_pcid_epoch, 1);
+    __sync_fetch_and_add(&pt_xlat_epoch, 1);
+}
+
+/*
+ * Rewrite the flags of every present leaf entry covering virt[vaddr, vmax):
+ * set the bits in `set`, clear the bits in `clear`. Unlike
+ * pt_write_protect_range, a 1GB or 2MB leaf straddling a range boundary is
+ * split first (same idiom as pt_map_range), because here the uncovered
+ * portion must genuinely keep its old permissions - the caller is sealing
+ * kernel text, and a "harmless spurious fault" in kernel mode is a panic.
+ * Only used on boot-built kernel mappings, so allocation failure panics
+ * like pt_unmap_range's split does.
+ */
+static void _pt_range_set_flags(pml4_t *pml4, uintptr_t vaddr, uintptr_t vmax,
+                                uintptr_t set, uintptr_t clear)
+{
+    dbg(DBG_PGTBL, "virt[0x%p, 0x%p) +0x%p -0x%p; pml4: 0x%p\n", (void *)vaddr,
+        (void *)vmax, (void *)set, (void *)clear, pml4);
+    KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(vmax) && vmax > vaddr);
+
+    while (vaddr < vmax)
+    {
+        uint64_t size = vmax - vaddr;
+
+        uint64_t idx = PML4E(vaddr);
+        pml4_t *table = pml4;
+
+        if (!IS_PRESENT(table->phys[idx]))
+        {
+            vaddr = PAGE_ALIGN_UP_512GB(vaddr + 1);
+            continue;
+        }
+        table = (pdp_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+        // PDP (1GB pages)
+        idx = PDPE(vaddr);
+        if (!IS_PRESENT(table->phys[idx]))
+        {
+            vaddr = PAGE_ALIGN_UP_1GB(vaddr + 1);
+            continue;
+        }
+        if (IS_1GB_PAGE(table->phys[idx]))
+        {
+            if (PAGE_ALIGNED_1GB(vaddr) && size >= PAGE_SIZE_1GB)
+            {
+                table->phys[idx] = (table->phys[idx] | set) & ~clear;
+                vaddr += PAGE_SIZE_1GB;
+                continue;
+            }
+            /* Partially covered: split into 2MB entries (keeping the old
+             * flags, including PT_SIZE) and retry at the PD level. */
+            pd_t *pd = page_alloc();
+            if (!pd)
+            {
+                panic(
+                    "Ran out of memory during _pt_range_set_flags; recovery "
+                    "from this situation has not yet been implemented!");
+            }
+            for (unsigned i = 0; i < PT_ENTRY_COUNT; i++)
+            {
+                pd->phys[i] = table->phys[idx] + i * PAGE_SIZE_2MB;
+            }
+            table->phys[idx] = ((uintptr_t)pd - PHYS_OFFSET) |
+                               (PAGE_CONTROL_FLAGS(table->phys[idx]) - PT_SIZE);
+            continue;
+        }
+        table = (pd_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+        // PD (2MB pages)
+        idx = PDE(vaddr);
+        if (!IS_PRESENT(table->phys[idx]))
+        {
+            vaddr = PAGE_ALIGN_UP_2MB(vaddr + 1);
+            continue;
+        }
+        if (IS_2MB_PAGE(table->phys[idx]))
+        {
+            if (PAGE_ALIGNED_2MB(vaddr) && size >= PAGE_SIZE_2MB)
+            {
+                /* Fully covered: rewrite in place, keeping the large-page
+                 * TLB footprint. */
+                table->phys[idx] = (table->phys[idx] | set) & ~clear;
+                vaddr += PAGE_SIZE_2MB;
+                continue;
+            }
+            pt_t *pt = page_alloc();
+            if (!pt)
+            {
+                panic(
+                    "Ran out of memory during _pt_range_set_flags; recovery "
+                    "from this situation has not yet been implemented!");
+            }
+            for (unsigned i = 0; i < PT_ENTRY_COUNT; i++)
+            {
+                pt->phys[i] = table->phys[idx] + i * PAGE_SIZE -
+                              PT_SIZE; // remove PT_SIZE flag
+            }
+            table->phys[idx] =
+                ((uintptr_t)pt - PHYS_OFFSET) |
+                (PAGE_CONTROL_FLAGS(table->phys[idx]) - PT_SIZE);
+            continue;
+        }
+        table = (pt_t *)((table->phys[idx] & PAGE_MASK) + PHYS_OFFSET);
+
+        // PT (4KB pages)
+        idx = PTE(vaddr);
+        if (IS_PRESENT(table->phys[idx]))
+        {
+            table->phys[idx] = (table->phys[idx] | set) & ~clear;
+        }
+        vaddr += PAGE_SIZE;
+    }
+
+    /* As in pt_write_protect_range: when tightening, a stale writable
+     * entry cached under an inactive PCID tag would let a write through. */
+    __sync_fetch_and_add(&pt_pcid_epoch, 1);
+    __sync_fetch_and_add(&pt_xlat_epoch, 1);
+}
+
+/* Flush the local TLB including global entries: a plain cr3 reload leaves
+ * PT_GLOBAL entries in place, which is the point of marking the sealed
+ * kernel mappings global, but means toggling their protection needs the
+ * CR4.PGE round trip instead. */
+static void _pt_flush_global()
+{
+    uintptr_t cr4;
+    __asm__ volatile("movq %%cr4, %0"
+                     : "=r"(cr4));
+    if (cr4 & CR4_PGE)
+    {
+        __asm__ volatile("movq %0, %%cr4" ::"r"(cr4 & ~CR4_PGE)
+                         : "memory");
+        __asm__ volatile("movq %0, %%cr4" ::"r"(cr4)
+                         : "memory");
+    }
+    else
+    {
+        tlb_flush_all();
+    }
+}
+
+/*
+ * Set or clear PT_WRITE on the leaves covering kernel text and rodata -
+ * through both the kernel image mapping and its physmap alias (the image
+ * is doubly mapped; sealing only one mapping would leave a writable
+ * synonym). The sealed leaves are also marked PT_GLOBAL: they are
+ * identical in every address space and never change outside this
+ * function, so with CR4.PGE set they survive cr3 loads.
+ *
+ * The physmap subtree is shared by reference across address spaces (see
+ * clone_pml4), so one pass over it covers every space. The kernel image
+ * slot is deep-cloned per address space for the CSD mapping, so this
+ * touches both global_kernel_only_pml4 and the live pml4; spaces cloned
+ * while sealed inherit the sealed leaves.
+ */
+static void _pt_kernel_text_protect(long writable)
+{
+    uintptr_t set = writable ? PT_WRITE : PT_GLOBAL;
+    uintptr_t clear = writable ? 0 : PT_WRITE;
+    uintptr_t ranges[2][2] = {
+        {(uintptr_t)&k_start, (uintptr_t)&csd_start}, /* .text */
+        {(uintptr_t)&_rodata, (uintptr_t)&_data},     /* .rodata */
+    };
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        uintptr_t lo = ranges[i][0];
+        uintptr_t hi = ranges[i][1];
+        _pt_range_set_flags(global_kernel_only_pml4, lo, hi, set, clear);
+        if (pt_get() != global_kernel_only_pml4)
+        {
+            _pt_range_set_flags(pt_get(), lo, hi, set, clear);
+        }
+        _pt_range_set_flags(global_kernel_only_pml4,
+                            (lo - KERNEL_VMA) + PHYS_OFFSET,
+                            (hi - KERNEL_VMA) + PHYS_OFFSET, set, clear);
+    }
+    _pt_flush_global();
 }
 
+void pt_kernel_text_unlock() { _pt_kernel_text_protect(1); }
+
+void pt_kernel_text_lock() { _pt_kernel_text_protect(0); }
+
 static char *entry_strings[] = {
     "4KB",
     "2MB",
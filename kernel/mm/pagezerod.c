@@ -0,0 +1,122 @@
+#include "globals.h"
+#include "kernel.h"
+
+#include "mm/page.h"
+#include "mm/pageoutd.h"
+#include "mm/pagezerod.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+/*
+ * Stack of pre-zeroed pages. pagezerod_lock protects the pool and the wait
+ * queue; the daemon sleeps whenever the pool is full (or memory is too
+ * tight to hoard pages) and is woken by pagezerod_claim once the pool has
+ * drained below half capacity.
+ */
+static void *pagezerod_pool[PAGEZEROD_POOL_CAPACITY];
+static size_t pagezerod_count = 0;
+static spinlock_t pagezerod_lock = SPINLOCK_INITIALIZER(pagezerod_lock);
+static ktqueue_t pagezerod_queue;
+static long pagezerod_ready = 0;
+
+void *pagezerod_claim()
+{
+    if (!pagezerod_ready)
+    {
+        return NULL;
+    }
+    spinlock_lock(&pagezerod_lock);
+    void *page = NULL;
+    if (pagezerod_count)
+    {
+        page = pagezerod_pool[--pagezerod_count];
+    }
+    if (pagezerod_count < PAGEZEROD_POOL_CAPACITY / 2)
+    {
+        sched_broadcast_on(&pagezerod_queue);
+    }
+    spinlock_unlock(&pagezerod_lock);
+    return page;
+}
+
+static void *pagezerod_run(long arg1, void *arg2)
+{
+    dbg(DBG_PROC, "pagezerod: running\n");
+    for (;;)
+    {
+        spinlock_lock(&pagezerod_lock);
+        while (pagezerod_count == PAGEZEROD_POOL_CAPACITY)
+        {
+            /* sched_sleep_on releases pagezerod_lock once we're on the
+             * queue */
+            sched_sleep_on(&pagezerod_queue, &pagezerod_lock);
+            spinlock_lock(&pagezerod_lock);
+        }
+        spinlock_unlock(&pagezerod_lock);
+
+        /* The wakeup path boosts every thread it wakes to the top queue;
+         * undo that before doing any work. Pre-zeroing is pure
+         * opportunism and should only ever spend idle cycles. */
+        curthr->kt_base_prio = SCHED_NUM_PRIOS - 1;
+        curthr->kt_prio = SCHED_NUM_PRIOS - 1;
+
+        size_t zeroed = 0;
+        for (;;)
+        {
+            /* Never hoard pages the pageout daemon is working to free. */
+            if (page_free_count() < PAGEOUTD_HIGH_WATERMARK)
+            {
+                break;
+            }
+            void *page = page_alloc();
+            if (!page)
+            {
+                break;
+            }
+            memset(page, 0, PAGE_SIZE);
+            spinlock_lock(&pagezerod_lock);
+            if (pagezerod_count == PAGEZEROD_POOL_CAPACITY)
+            {
+                spinlock_unlock(&pagezerod_lock);
+                page_free(page);
+                break;
+            }
+            pagezerod_pool[pagezerod_count++] = page;
+            long full = pagezerod_count == PAGEZEROD_POOL_CAPACITY;
+            spinlock_unlock(&pagezerod_lock);
+            zeroed++;
+            if (full)
+            {
+                break;
+            }
+            /* One page per trip through the scheduler, so a burst of
+             * refilling never delays anything that actually has work. */
+            sched_yield();
+        }
+        dbg(DBG_PFRAME, "pagezerod: pre-zeroed %lu pages\n", zeroed);
+    }
+    return NULL;
+}
+
+void pagezerod_start()
+{
+    sched_queue_init(&pagezerod_queue);
+
+    proc_t *proc = proc_create("pagezerod");
+    KASSERT(proc && "couldn't create the pre-zero daemon");
+    kthread_t *thr = kthread_create(proc, pagezerod_run, 0, NULL);
+    KASSERT(thr && "couldn't create the pre-zero daemon's thread");
+
+    /* Start at (and return to, see pagezerod_run) the lowest priority. */
+    thr->kt_base_prio = SCHED_NUM_PRIOS - 1;
+    thr->kt_prio = SCHED_NUM_PRIOS - 1;
+
+    pagezerod_ready = 1;
+    sched_make_runnable(thr);
+}
@@ -8,9 +8,18 @@
 
 static slab_allocator_t *pframe_allocator;
 
+/* Readahead effectiveness (see pframe.h). Unlocked increments, like the
+ * other stats counters: a lost update skews a sample slightly, nothing
+ * more. */
+uint64_t pframe_ra_used;
+uint64_t pframe_ra_wasted;
+
 void pframe_init()
 {
-    pframe_allocator = slab_allocator_create("pframe", sizeof(pframe_t));
+    /* Cacheline-aligned: pframes are the hottest slab objects, and each
+     * embeds a mutex hit from multiple cores. */
+    pframe_allocator =
+        slab_allocator_create_aligned("pframe", sizeof(pframe_t), 64);
     KASSERT(pframe_allocator);
 }
 
@@ -26,7 +35,12 @@ pframe_t *pframe_create()
     }
     memset(pf, 0, sizeof(pframe_t));
     kmutex_init(&pf->pf_mutex);
+    spinlock_init(&pf->pf_state_lock);
+    sched_queue_init(&pf->pf_waitq);
     list_link_init(&pf->pf_link);
+    list_link_init(&pf->pf_hash_link);
+    list_link_init(&pf->pf_lru_link);
+    list_link_init(&pf->pf_dirty_link);
     return pf;
 }
 
@@ -39,9 +53,16 @@ pframe_t *pframe_create()
 void pframe_free(pframe_t **pfp)
 {
     KASSERT(kmutex_owns_mutex(&(*pfp)->pf_mutex));
+    KASSERT((*pfp)->pf_state == PF_STATE_READY);
     KASSERT(!(*pfp)->pf_addr);
     KASSERT(!(*pfp)->pf_dirty);
+    KASSERT(!(*pfp)->pf_swap_slot);
+    KASSERT(!(*pfp)->pf_comp);
+    KASSERT(!(*pfp)->pf_merge);
     KASSERT(!list_link_is_linked(&(*pfp)->pf_link));
+    KASSERT(!list_link_is_linked(&(*pfp)->pf_hash_link));
+    KASSERT(!list_link_is_linked(&(*pfp)->pf_lru_link));
+    KASSERT(!list_link_is_linked(&(*pfp)->pf_dirty_link));
     kmutex_unlock(&(*pfp)->pf_mutex);
     slab_obj_free(pframe_allocator, *pfp);
     *pfp = NULL;
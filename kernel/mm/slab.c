@@ -17,6 +17,12 @@
 
 #include "types.h"
 
+#include "config.h"
+
+#include "globals.h"
+
+#include "main/interrupt.h"
+
 #include "mm/mm.h"
 #include "mm/page.h"
 #include "mm/slab.h"
@@ -25,6 +31,7 @@
 
 #include "util/debug.h"
 #include "util/gdb.h"
+#include "util/printf.h"
 #include "util/string.h"
 
 #ifdef SLAB_REDZONE
@@ -46,6 +53,19 @@
 
 #endif
 
+#if SLAB_GUARD
+
+#ifndef SLAB_REDZONE
+#error "SLAB_GUARD reuses the red-zone words as its canaries"
+#endif
+
+/* Value planted in the first and last words of a free object's body; if
+ * it isn't intact when the object is handed out again, someone wrote
+ * through a stale pointer in between. */
+#define SLAB_GUARD_POISON 0xfeedfacefeedfaceUL
+
+#endif
+
 struct slab
 {
     struct slab *s_next; /* link on list of slabs */
@@ -63,6 +83,10 @@ typedef struct slab_allocator
     size_t sa_slab_nobjs;           /* number of objs per slab */
     struct slab_allocator *sa_next; /* link on global list of allocators */
     spinlock_t sa_lock;
+    long sa_magazine_idx;           /* per-core magazine slot; -1 if none */
+    size_t sa_align;                /* alignment of caller-visible objects */
+    size_t sa_color_base;           /* front pad making objects aligned */
+    size_t sa_color;                /* next slab's color offset (rotates) */
 } slab_allocator_t;
 
 /* Stored at the end of every object to keep track of the 
@@ -101,6 +125,41 @@ static slab_allocator_t *slab_allocators = NULL;
 /* Special case - allocator for allocation of slab_allocator objects. */
 static slab_allocator_t slab_allocator_allocator;
 
+/*
+ * Per-core object magazines (Bonwick-style). Each of the first
+ * SLAB_MAX_MAGAZINES allocators created gets a slot in every core's magazine
+ * array; the common alloc/free is then a core-local stack push/pop with
+ * interrupts masked, and the depot (the slab lists, under sa_lock) is only
+ * visited a batch at a time. Allocators created past the limit simply skip
+ * the magazine layer. Slots are never reused, so a stale magazine can't feed
+ * a recycled allocator's objects to the wrong cache.
+ *
+ * Magazines hold caller-visible object pointers (past the front red-zone);
+ * red-zone and double-free checks still happen on every depot crossing.
+ *
+ * As with the page magazines, sm_enabled is flipped per-core once that
+ * core's CSD is mapped; until then every core falls through to the depot.
+ */
+#define SLAB_MAGAZINE_CAPACITY 32
+#define SLAB_MAGAZINE_BATCH (SLAB_MAGAZINE_CAPACITY / 2)
+#define SLAB_MAX_MAGAZINES 32
+
+typedef struct slab_magazine
+{
+    long sm_enabled;
+    size_t sm_count;
+    void *sm_objs[SLAB_MAGAZINE_CAPACITY];
+} slab_magazine_t;
+
+static slab_magazine_t slab_magazines[SLAB_MAX_MAGAZINES] CORE_SPECIFIC_DATA;
+
+/* Number of magazine slots handed out; monotonically increasing. */
+static size_t slab_magazine_slots = 0;
+
+static void *_slab_obj_alloc_locked(slab_allocator_t *allocator);
+
+static void _slab_obj_free_locked(slab_allocator_t *allocator, void *obj);
+
 /*
  * This constant defines how many orders of magnitude (in page block
  * sizes) we'll search for an optimal slab size (past the smallest
@@ -108,6 +167,15 @@ static slab_allocator_t slab_allocator_allocator;
  */
 #define SLAB_MAX_ORDER 5
 
+/*
+ * Slab coloring (Bonwick-style): each new slab starts its objects at a
+ * slightly different offset into the page block, rotating in cacheline
+ * steps through the space a slab naturally wastes. Without it every slab
+ * lays identical objects at identical page offsets, so the hot members of
+ * hot objects (pframes, kthreads) all compete for the same cache sets.
+ */
+#define SLAB_COLOR_STRIDE 64
+
 /**
  * Given the object size and the number of objects, calculates
  * the size of the slab. Each object includes a slab_bufctl_t, 
@@ -188,19 +256,50 @@ static void _calc_slab_size(slab_allocator_t *allocator)
     allocator->sa_order = best_order;
     allocator->sa_slab_nobjs = _slab_nobjs(allocator->sa_objsize, best_order);
     KASSERT(allocator->sa_slab_nobjs);
+
+    /* The alignment pad at the front of each slab comes out of the
+     * slab's wasted space; if the natural waste can't absorb it, give
+     * up one object instead. */
+    if (_slab_waste(allocator->sa_objsize, best_order) <
+            allocator->sa_color_base &&
+        allocator->sa_slab_nobjs > 1)
+    {
+        allocator->sa_slab_nobjs--;
+    }
+    KASSERT((PAGE_SIZE << best_order) -
+                _slab_size(allocator->sa_objsize, allocator->sa_slab_nobjs) >=
+            allocator->sa_color_base);
 }
 
 /*
- * Initializes a given allocator using the name and size passed in. 
+ * Initializes a given allocator using the name, size and alignment passed
+ * in. The alignment applies to the caller-visible object pointer; it is
+ * achieved by padding the object stride to a multiple of align and
+ * starting each slab's objects at an offset that aligns the first one.
 */
 static void _allocator_init(slab_allocator_t *allocator, const char *name,
-                            size_t size)
+                            size_t size, size_t align)
 {
+    size_t front = 0;
+
+    KASSERT(align > 0 && !(align & (align - 1)) &&
+            "alignment must be a power of two");
+
+#if SLAB_GUARD
+    /* The delayed-free poison needs at least one word of object body. */
+    if (size < sizeof(uintptr_t))
+    {
+        size = sizeof(uintptr_t);
+    }
+#endif
+
 #ifdef SLAB_REDZONE
     /*
-     * Add space for the front and rear red-zones.
+     * Add space for the front and rear red-zones. The caller-visible
+     * pointer sits past the front red-zone.
      */
     size += 2 * sizeof(uintptr_t);
+    front = sizeof(uintptr_t);
 #endif
 
     if (!name)
@@ -208,10 +307,23 @@ static void _allocator_init(slab_allocator_t *allocator, const char *name,
         name = "<unnamed>";
     }
 
+    /* Pad the object stride (object plus its bufctl) to a multiple of
+     * align, so that if the first object of a slab is aligned, all of
+     * them are. */
+    size_t stride = size + sizeof(slab_bufctl_t);
+    stride = (stride + align - 1) & ~(align - 1);
+    size = stride - sizeof(slab_bufctl_t);
+
     allocator->sa_name = name;
     allocator->sa_objsize = size;
+    allocator->sa_align = align;
+    allocator->sa_color_base = (align - front % align) % align;
+    allocator->sa_color = 0;
     allocator->sa_slabs = NULL;
     spinlock_init(&allocator->sa_lock);
+    allocator->sa_magazine_idx = slab_magazine_slots < SLAB_MAX_MAGAZINES
+                                     ? (long)slab_magazine_slots++
+                                     : -1;
     // this will set the fields sa_order and the number of objects per slab
     _calc_slab_size(allocator);
 
@@ -229,10 +341,22 @@ static void _allocator_init(slab_allocator_t *allocator, const char *name,
 
 /*
  * Given a name and size of object will create a slab_allocator
- * to manage slabs that store objects of size `size`, along with 
- * some metadata. 
+ * to manage slabs that store objects of size `size`, along with
+ * some metadata.
 */
 slab_allocator_t *slab_allocator_create(const char *name, size_t size)
+{
+    return slab_allocator_create_aligned(name, size, 1);
+}
+
+/*
+ * As slab_allocator_create, but every object handed out is aligned to
+ * `align` bytes (a power of two). Meant for contended structures where
+ * cacheline alignment keeps hot members from sharing lines with their
+ * neighbors.
+*/
+slab_allocator_t *slab_allocator_create_aligned(const char *name, size_t size,
+                                                size_t align)
 {
     slab_allocator_t *allocator;
 
@@ -242,7 +366,7 @@ slab_allocator_t *slab_allocator_create(const char *name, size_t size)
         return NULL;
     }
 
-    _allocator_init(allocator, name, size);
+    _allocator_init(allocator, name, size, align);
     return allocator;
 }
 
@@ -261,6 +385,7 @@ void slab_allocator_destroy(slab_allocator_t *allocator)
 static long _slab_allocator_grow(slab_allocator_t *allocator)
 {
     void *addr;
+    void *start;
     void *obj;
     struct slab *slab;
 
@@ -270,8 +395,27 @@ static long _slab_allocator_grow(slab_allocator_t *allocator)
         return 0;
     }
 
+    /* Pick this slab's color: the alignment pad plus a rotating offset,
+     * advancing a cacheline (or one alignment unit, if larger) per slab
+     * and wrapping once the offset no longer fits in the wasted space.
+     * sa_lock protects sa_color; grow is only called with it held. */
+    size_t space =
+        (PAGE_SIZE << allocator->sa_order) -
+        _slab_size(allocator->sa_objsize, allocator->sa_slab_nobjs);
+    size_t color_step = allocator->sa_align > SLAB_COLOR_STRIDE
+                            ? allocator->sa_align
+                            : SLAB_COLOR_STRIDE;
+    size_t off = allocator->sa_color_base + allocator->sa_color;
+    if (off > space)
+    {
+        allocator->sa_color = 0;
+        off = allocator->sa_color_base;
+    }
+    allocator->sa_color += color_step;
+    start = (void *)((uintptr_t)addr + off);
+
     /* Initialize each bufctl to be free and point to the next object. */
-    obj = addr;
+    obj = start;
     for (size_t i = 0; i < (allocator->sa_slab_nobjs - 1); i++)
     {
 #ifdef SLAB_CHECK_FREE
@@ -290,20 +434,27 @@ static long _slab_allocator_grow(slab_allocator_t *allocator)
     slab = (struct slab *)next_obj(allocator, obj);
 
     /*
-     * The first object in the slab will be the head of the free
-     * list and the start address of the slab.
+     * The first (colored) object in the slab will be the head of the
+     * free list; s_addr keeps the page block's true start for freeing.
      */
-    slab->s_free = addr;
+    slab->s_free = start;
     slab->s_addr = addr;
     slab->s_inuse = 0;
 
     /* Initialize objects. */
-    obj = addr;
+    obj = start;
     for (size_t i = 0; i < allocator->sa_slab_nobjs; i++)
     {
 #ifdef SLAB_REDZONE
         front_rz(obj) = SLAB_REDZONE;
         rear_rz(allocator, obj) = SLAB_REDZONE;
+#endif
+#if SLAB_GUARD
+        /* Fresh objects must look like delayed-free ones. */
+        *(uintptr_t *)((uintptr_t)obj + sizeof(uintptr_t)) =
+            SLAB_GUARD_POISON;
+        *(uintptr_t *)((uintptr_t)obj + allocator->sa_objsize -
+                       2 * sizeof(uintptr_t)) = SLAB_GUARD_POISON;
 #endif
         obj = next_obj(allocator, obj);
     }
@@ -319,11 +470,12 @@ static long _slab_allocator_grow(slab_allocator_t *allocator)
 }
 
 /*
- * Given an allocator, will allocate an object.  
-*/
-void *slab_obj_alloc(slab_allocator_t *allocator)
+ * Allocate one object from the depot. sa_lock must be held. Returns the
+ * caller-visible pointer (past the front red-zone), or NULL if the depot
+ * cannot grow.
+ */
+static void *_slab_obj_alloc_locked(slab_allocator_t *allocator)
 {
-    spinlock_lock(&allocator->sa_lock);
     struct slab *slab;
     void *obj;
 
@@ -339,7 +491,6 @@ void *slab_obj_alloc(slab_allocator_t *allocator)
         }
         if (!_slab_allocator_grow(allocator))
         {
-            spinlock_unlock(&allocator->sa_lock);
             return NULL;
         }
     }
@@ -372,16 +523,16 @@ void *slab_obj_alloc(slab_allocator_t *allocator)
     obj = (void *)((uintptr_t)obj + sizeof(uintptr_t));
 #endif
 
-    GDB_CALL_HOOK(slab_obj_alloc, obj, allocator);
-    spinlock_unlock(&allocator->sa_lock);
     return obj;
 }
 
-void slab_obj_free(slab_allocator_t *allocator, void *obj)
+/*
+ * Return an object to the depot. sa_lock must be held; obj is the
+ * caller-visible pointer.
+ */
+static void _slab_obj_free_locked(slab_allocator_t *allocator, void *obj)
 {
-    spinlock_lock(&allocator->sa_lock);
     struct slab *slab;
-    GDB_CALL_HOOK(slab_obj_free, obj, allocator);
 
 #ifdef SLAB_REDZONE
     /* Move pointer back to verify that the REDZONE is unchanged. */
@@ -405,9 +556,205 @@ void slab_obj_free(slab_allocator_t *allocator, void *obj)
 
     dbg(DBG_MM, "Freed object 0x%p from \"%s\" (0x%p), slab 0x%p, inuse %lu\n",
         obj, allocator->sa_name, allocator, slab, slab->s_inuse);
+}
+
+/*
+ * Try to pop an object off this core's magazine for allocator, refilling a
+ * batch from the depot when the magazine runs dry. Returns NULL if the
+ * allocator has no magazine slot, this core's magazines are not yet enabled,
+ * or the depot is exhausted.
+ */
+static void *_slab_magazine_pop(slab_allocator_t *allocator)
+{
+    if (allocator->sa_magazine_idx < 0)
+    {
+        return NULL;
+    }
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    slab_magazine_t *mag = &slab_magazines[allocator->sa_magazine_idx];
+    if (!mag->sm_enabled)
+    {
+        intr_setipl(ipl);
+        return NULL;
+    }
+    if (!mag->sm_count)
+    {
+        spinlock_lock(&allocator->sa_lock);
+        while (mag->sm_count < SLAB_MAGAZINE_BATCH)
+        {
+            void *obj = _slab_obj_alloc_locked(allocator);
+            if (!obj)
+            {
+                break;
+            }
+            mag->sm_objs[mag->sm_count++] = obj;
+        }
+        spinlock_unlock(&allocator->sa_lock);
+        if (!mag->sm_count)
+        {
+            intr_setipl(ipl);
+            return NULL;
+        }
+    }
+    void *obj = mag->sm_objs[--mag->sm_count];
+    intr_setipl(ipl);
+    return obj;
+}
+
+/*
+ * Try to push an object onto this core's magazine for allocator, draining a
+ * batch to the depot first if the magazine is full. Returns 1 if the object
+ * was taken, 0 if the caller must free to the depot itself.
+ */
+static long _slab_magazine_push(slab_allocator_t *allocator, void *obj)
+{
+    if (allocator->sa_magazine_idx < 0)
+    {
+        return 0;
+    }
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    slab_magazine_t *mag = &slab_magazines[allocator->sa_magazine_idx];
+    if (!mag->sm_enabled)
+    {
+        intr_setipl(ipl);
+        return 0;
+    }
+    if (mag->sm_count == SLAB_MAGAZINE_CAPACITY)
+    {
+        spinlock_lock(&allocator->sa_lock);
+        while (mag->sm_count > SLAB_MAGAZINE_CAPACITY - SLAB_MAGAZINE_BATCH)
+        {
+            _slab_obj_free_locked(allocator, mag->sm_objs[--mag->sm_count]);
+        }
+        spinlock_unlock(&allocator->sa_lock);
+    }
+    mag->sm_objs[mag->sm_count++] = obj;
+    intr_setipl(ipl);
+    return 1;
+}
+
+/*
+ * Enable the calling core's slab magazines. Called from core_init() once the
+ * core's CSD has been mapped and zeroed; see page_magazines_enable().
+ */
+void slab_magazines_enable()
+{
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    for (size_t i = 0; i < SLAB_MAX_MAGAZINES; i++)
+    {
+        KASSERT(!slab_magazines[i].sm_enabled && !slab_magazines[i].sm_count);
+        slab_magazines[i].sm_enabled = 1;
+    }
+    intr_setipl(ipl);
+}
+
+/*
+ * Given an allocator, will allocate an object.
+*/
+#if SLAB_GUARD
+/*
+ * Verify the canaries around obj (the caller-visible pointer), then
+ * either plant the delayed-free poison in the object body (on free) or
+ * verify it survived the object's time on the free lists (on alloc).
+ * Runs on every operation, magazine fast path included, and costs a
+ * handful of compares and stores. A corrupt word panics, like the depot
+ * red-zone checks.
+ */
+static void _slab_guard_check(slab_allocator_t *allocator, void *obj,
+                              long alloc)
+{
+    void *raw = (void *)((uintptr_t)obj - sizeof(uintptr_t));
+
+    if (front_rz(raw) != SLAB_REDZONE ||
+        rear_rz(allocator, raw) != SLAB_REDZONE)
+    {
+        panic("slab guard: overrun of object 0x%p in \"%s\"\n", obj,
+              allocator->sa_name);
+    }
+
+    size_t body = allocator->sa_objsize - 2 * sizeof(uintptr_t);
+    uintptr_t *head = (uintptr_t *)obj;
+    uintptr_t *tail =
+        (uintptr_t *)((uintptr_t)obj + body - sizeof(uintptr_t));
+    if (alloc)
+    {
+        if (*head != SLAB_GUARD_POISON || *tail != SLAB_GUARD_POISON)
+        {
+            panic("slab guard: write after free of object 0x%p in \"%s\"\n",
+                  obj, allocator->sa_name);
+        }
+    }
+    else
+    {
+        *head = SLAB_GUARD_POISON;
+        *tail = SLAB_GUARD_POISON;
+    }
+}
+#endif
+
+void *slab_obj_alloc(slab_allocator_t *allocator)
+{
+    void *obj = _slab_magazine_pop(allocator);
+    if (!obj)
+    {
+        spinlock_lock(&allocator->sa_lock);
+        obj = _slab_obj_alloc_locked(allocator);
+        spinlock_unlock(&allocator->sa_lock);
+        if (!obj)
+        {
+            return NULL;
+        }
+    }
+#if SLAB_GUARD
+    _slab_guard_check(allocator, obj, 1);
+#endif
+    GDB_CALL_HOOK(slab_obj_alloc, obj, allocator);
+    return obj;
+}
+
+void slab_obj_free(slab_allocator_t *allocator, void *obj)
+{
+    GDB_CALL_HOOK(slab_obj_free, obj, allocator);
+#if SLAB_GUARD
+    _slab_guard_check(allocator, obj, 0);
+#endif
+    if (_slab_magazine_push(allocator, obj))
+    {
+        return;
+    }
+    spinlock_lock(&allocator->sa_lock);
+    _slab_obj_free_locked(allocator, obj);
     spinlock_unlock(&allocator->sa_lock);
 }
 
+/*
+ * Formats a per-allocator occupancy report into buf: one line per
+ * allocator with its name, object size, objects in use and total object
+ * capacity. Used by the stats devices (see drivers/statdev.c).
+ */
+size_t slab_allocators_info(char *buf, size_t size)
+{
+    size_t len = 0;
+    slab_allocator_t *allocator = slab_allocators;
+    while (allocator && len < size)
+    {
+        spinlock_lock(&allocator->sa_lock);
+        size_t nslabs = 0;
+        size_t inuse = 0;
+        for (struct slab *s = allocator->sa_slabs; s; s = s->s_next)
+        {
+            nslabs++;
+            inuse += s->s_inuse;
+        }
+        spinlock_unlock(&allocator->sa_lock);
+        len += snprintf(buf + len, size - len, "%s %lu %lu %lu\n",
+                        allocator->sa_name, allocator->sa_objsize, inuse,
+                        nslabs * allocator->sa_slab_nobjs);
+        allocator = allocator->sa_next;
+    }
+    return len > size ? size : len;
+}
+
 /*
  * Reclaims as much memory (up to a target) from
  * unused slabs as possible
@@ -451,49 +798,86 @@ long slab_allocators_reclaim(long target)
     //     return npages_freed;
 }
 
-#define KMALLOC_SIZE_MIN_ORDER (6)
-#define KMALLOC_SIZE_MAX_ORDER (18)
+/*
+ * kmalloc size classes. Sub-256-byte allocations (list nodes, argv
+ * staging) dominate, so the classes extend down to 16 bytes and the bin
+ * index is computed directly from the size rather than scanned for; the
+ * bins themselves are slab caches, so the small hot classes are served
+ * from the per-core magazines. Anything larger than the biggest class
+ * goes straight to page_alloc_n with the page count tagged in the
+ * header, skipping the slab layer entirely.
+ */
+#define KMALLOC_SIZE_MIN_ORDER (4)
+#define KMALLOC_SIZE_MAX_ORDER (13)
+#define KMALLOC_NUM_CLASSES \
+    (KMALLOC_SIZE_MAX_ORDER - KMALLOC_SIZE_MIN_ORDER + 1)
 
-static slab_allocator_t
-    *kmalloc_allocators[KMALLOC_SIZE_MAX_ORDER - KMALLOC_SIZE_MIN_ORDER + 1];
+static slab_allocator_t *kmalloc_allocators[KMALLOC_NUM_CLASSES];
 
 /* Note that kmalloc_allocator_names should be modified to remain consistent
  * with KMALLOC_SIZE_MIN_ORDER ... KMALLOC_SIZE_MAX_ORDER.
  */
 static const char *kmalloc_allocator_names[] = {
-    "size-64", "size-128", "size-256", "size-512", "size-1024",
-    "size-2048", "size-4096", "size-8192", "size-16384", "size-32768",
-    "size-65536", "size-131072", "size-262144"};
+    "size-16", "size-32", "size-64", "size-128", "size-256",
+    "size-512", "size-1024", "size-2048", "size-4096", "size-8192"};
+
+/* Per-class allocation/free counts, plus the large passthrough (reported
+ * via kmalloc_info and /dev/stats/kmalloc). */
+static uint64_t kmalloc_class_allocs[KMALLOC_NUM_CLASSES];
+static uint64_t kmalloc_class_frees[KMALLOC_NUM_CLASSES];
+static uint64_t kmalloc_large_allocs;
+static uint64_t kmalloc_large_frees;
+
+/* Large allocations bypass the slab layer; the header stores the page
+ * count tagged with the low bit instead of an allocator pointer (real
+ * allocator pointers are always aligned, so the bit is free). */
+#define KMALLOC_LARGE_TAG(npages) \
+    ((slab_allocator_t *)(((uintptr_t)(npages) << 1) | 1))
+#define KMALLOC_IS_LARGE(sa) ((uintptr_t)(sa)&1)
+#define KMALLOC_LARGE_NPAGES(sa) ((size_t)((uintptr_t)(sa) >> 1))
 
 void *kmalloc(size_t size)
 {
     size += sizeof(slab_allocator_t *);
 
-    /*
-     * Find the first power of two bucket bigger than the
-     * requested size, and allocate from it.
-     */
-    slab_allocator_t **cs = kmalloc_allocators;
-    for (size_t order = KMALLOC_SIZE_MIN_ORDER; order <= KMALLOC_SIZE_MAX_ORDER;
-         order++, cs++)
+    /* Above the largest class, take whole pages directly. */
+    if (size > (1UL << KMALLOC_SIZE_MAX_ORDER))
     {
-        if ((1UL << order) >= size)
+        size_t npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+        void *addr = page_alloc_n(npages);
+        if (!addr)
         {
-            void *addr = slab_obj_alloc(*cs);
-            if (!addr)
-            {
-                dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
-                return NULL;
-            }
-#ifdef MM_POISON
-            memset(addr, MM_POISON_ALLOC, size);
-#endif /* MM_POISON */
-            *((slab_allocator_t **)addr) = *cs;
-            return (void *)(((slab_allocator_t **)addr) + 1);
+            dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
+            return NULL;
         }
+        __sync_fetch_and_add(&kmalloc_large_allocs, 1);
+        *((slab_allocator_t **)addr) = KMALLOC_LARGE_TAG(npages);
+        return (void *)(((slab_allocator_t **)addr) + 1);
     }
 
-    panic("size bigger than maxorder %ld\n", size);
+    /*
+     * Compute the smallest power-of-two class that fits the request
+     * directly from the size (no scan).
+     */
+    size_t order = 64 - (size_t)__builtin_clzl(size - 1);
+    if (order < KMALLOC_SIZE_MIN_ORDER)
+    {
+        order = KMALLOC_SIZE_MIN_ORDER;
+    }
+    size_t class = order - KMALLOC_SIZE_MIN_ORDER;
+
+    void *addr = slab_obj_alloc(kmalloc_allocators[class]);
+    if (!addr)
+    {
+        dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
+        return NULL;
+    }
+    __sync_fetch_and_add(kmalloc_class_allocs + class, 1);
+#ifdef MM_POISON
+    memset(addr, MM_POISON_ALLOC, size);
+#endif /* MM_POISON */
+    *((slab_allocator_t **)addr) = kmalloc_allocators[class];
+    return (void *)(((slab_allocator_t **)addr) + 1);
 }
 
 __attribute__((used)) static void *malloc(size_t size)
@@ -509,6 +893,22 @@ void kfree(void *addr)
     addr = (void *)(((slab_allocator_t **)addr) - 1);
     slab_allocator_t *sa = *(slab_allocator_t **)addr;
 
+    if (KMALLOC_IS_LARGE(sa))
+    {
+        __sync_fetch_and_add(&kmalloc_large_frees, 1);
+        page_free_n(addr, KMALLOC_LARGE_NPAGES(sa));
+        return;
+    }
+
+    for (size_t class = 0; class < KMALLOC_NUM_CLASSES; class++)
+    {
+        if (kmalloc_allocators[class] == sa)
+        {
+            __sync_fetch_and_add(kmalloc_class_frees + class, 1);
+            break;
+        }
+    }
+
 #ifdef MM_POISON
     /* If poisoning is enabled, wipe the memory given in
      * this object, as specified by the cache object size
@@ -531,12 +931,36 @@ __attribute__((used)) static void free(void *addr)
     kfree(addr);
 }
 
+/*
+ * Formats a per-size-class report for kmalloc into buf: one line per
+ * class with its name and cumulative allocation and free counts, plus
+ * one for the large page_alloc_n passthrough. Used by the stats devices
+ * (see drivers/statdev.c).
+ */
+size_t kmalloc_info(char *buf, size_t size)
+{
+    size_t len = 0;
+    for (size_t class = 0; class < KMALLOC_NUM_CLASSES && len < size; class++)
+    {
+        len += snprintf(buf + len, size - len, "%s %lu %lu\n",
+                        kmalloc_allocator_names[class],
+                        kmalloc_class_allocs[class],
+                        kmalloc_class_frees[class]);
+    }
+    if (len < size)
+    {
+        len += snprintf(buf + len, size - len, "large %lu %lu\n",
+                        kmalloc_large_allocs, kmalloc_large_frees);
+    }
+    return len > size ? size : len;
+}
+
 void slab_init()
 {
     /* Special case initialization of the allocator for `slab_allocator_t`s */
     /* In other words, initializes a slab allocator for other slab allocators. */
     _allocator_init(&slab_allocator_allocator, "slab_allocators",
-                    sizeof(slab_allocator_t));
+                    sizeof(slab_allocator_t), 1);
 
     /*
      * Allocate the power of two buckets for generic
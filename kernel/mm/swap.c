@@ -0,0 +1,223 @@
+/*
+ * Swap: backing store for anonymous memory.
+ *
+ * The second SATA disk (SWAP_DISK_MINOR) is treated as an array of
+ * page-sized slots handed out by a bitmap allocator. The pageout daemon
+ * calls swap_out on cold, unmapped frames of swappable memory objects
+ * (anonymous and shadow objects): the page is first offered to the
+ * compressed in-memory tier (see mm/swapcomp.c) and, failing that,
+ * written to a slot. Either way its memory is released and the frame
+ * stays attached to its object as a placeholder (pf_addr == NULL)
+ * remembering the copy. The object's fill_pframe path restores the page
+ * on the next touch - swapcomp_in decompresses it, swap_in reads the
+ * slot back (see vm/anon.c and vm/shadow.c).
+ *
+ * Frames that have ever been mapped into a page table are pinned by
+ * pf_mapped (there are no reverse mappings to unmap them with), so in
+ * practice swap reclaims pages reached only through kernel copies:
+ * tmpfs file data and not-yet-faulted pages deep in shadow chains.
+ *
+ * If the swap disk is absent, everything here degrades gracefully and
+ * anonymous memory simply remains unreclaimable, as before.
+ */
+
+#include "errno.h"
+#include "globals.h"
+
+#include "drivers/blockdev.h"
+#include "drivers/dev.h"
+
+#include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/swap.h"
+#include "mm/swapcomp.h"
+
+#include "proc/proc.h"
+#include "proc/spinlock.h"
+
+#include "util/crashdump.h"
+#include "util/debug.h"
+#include "util/printf.h"
+
+static blockdev_t *swap_bdev = NULL;
+
+/* One bit per slot; protected by swap_lock. */
+static uint8_t swap_bitmap[SWAP_SLOTS / 8];
+static size_t swap_used;
+static size_t swap_next = 1; /* next-fit scan position */
+static spinlock_t swap_lock = SPINLOCK_INITIALIZER(swap_lock);
+
+void swap_start()
+{
+    blockdev_t *bdev = blockdev_lookup(MKDEVID(DISK_MAJOR, SWAP_DISK_MINOR));
+    if (!bdev)
+    {
+        dbg(DBG_MM,
+            "swap: no disk %d attached; anonymous memory will not be paged "
+            "out\n",
+            SWAP_DISK_MINOR);
+        return;
+    }
+    /* Slot 0 is reserved as the "no slot" sentinel. */
+    swap_bitmap[0] |= 1;
+    /* The tail of the disk belongs to the crash dump (see
+     * util/crashdump.c); keep the slot allocator off of it. */
+    for (size_t slot = CRASHDUMP_FIRST_BLOCK; slot < SWAP_SLOTS; slot++)
+    {
+        swap_bitmap[slot >> 3] |= (uint8_t)(1 << (slot & 7));
+    }
+    swap_bdev = bdev;
+    dbg(DBG_MM, "swap: %d slots on disk %d\n",
+        SWAP_SLOTS - 1 - CRASHDUMP_BLOCKS, SWAP_DISK_MINOR);
+}
+
+long swap_ready() { return swap_bdev != NULL; }
+
+static blocknum_t swap_slot_alloc()
+{
+    spinlock_lock(&swap_lock);
+    for (size_t scanned = 0; scanned < SWAP_SLOTS; scanned++)
+    {
+        size_t slot = (swap_next + scanned) % SWAP_SLOTS;
+        if (!(swap_bitmap[slot >> 3] & (1 << (slot & 7))))
+        {
+            swap_bitmap[slot >> 3] |= (uint8_t)(1 << (slot & 7));
+            swap_used++;
+            swap_next = (slot + 1) % SWAP_SLOTS;
+            spinlock_unlock(&swap_lock);
+            return (blocknum_t)slot;
+        }
+    }
+    spinlock_unlock(&swap_lock);
+    return 0;
+}
+
+void swap_slot_free(blocknum_t slot)
+{
+    if (!slot)
+    {
+        return;
+    }
+    spinlock_lock(&swap_lock);
+    KASSERT(swap_bitmap[slot >> 3] & (1 << (slot & 7)));
+    swap_bitmap[slot >> 3] &= (uint8_t)~(1 << (slot & 7));
+    KASSERT(swap_used);
+    swap_used--;
+    spinlock_unlock(&swap_lock);
+}
+
+/*
+ * Evict pf's page and release its memory, leaving the frame attached to
+ * o as a placeholder the fill path can restore. The page goes to the
+ * compressed in-memory tier when it compresses well enough and the pool
+ * has room, and to a swap slot otherwise. The process charged for the
+ * frame is uncharged; whoever faults it back in pays.
+ *
+ * Both o and pf must be locked; the frame must be resident and unmapped.
+ *
+ * Error cases swap_out is responsible for generating:
+ *  - ENODEV: the compressed tier declined and there is no swap device
+ *  - ENOSPC: all swap slots are taken
+ *  - Propagate errors from the driver's write_block
+ */
+long swap_out(mobj_t *o, pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    KASSERT(pf->pf_addr && !pf->pf_mapped);
+    KASSERT(!pf->pf_swap_slot && !pf->pf_comp &&
+            "placeholder frames have no page to write");
+
+    if (swapcomp_out(pf))
+    {
+        if (!swap_bdev)
+        {
+            return -ENODEV;
+        }
+        blocknum_t slot = swap_slot_alloc();
+        if (!slot)
+        {
+            return -ENOSPC;
+        }
+        long ret =
+            swap_bdev->bd_ops->write_block(swap_bdev, pf->pf_addr, slot, 1);
+        if (ret)
+        {
+            swap_slot_free(slot);
+            return ret;
+        }
+        pf->pf_swap_slot = slot;
+    }
+    /* The only copy now lives in the pool or on disk; the dirty flag
+     * tracks memory contents and no longer applies. */
+    if (pf->pf_dirty)
+    {
+        pf->pf_dirty = 0;
+        if (list_link_is_linked(&pf->pf_dirty_link))
+        {
+            list_remove(&pf->pf_dirty_link);
+        }
+    }
+    ppage_set_owner(pf->pf_addr, NULL);
+    page_free(pf->pf_addr);
+    pf->pf_addr = NULL;
+    if (pf->pf_owner)
+    {
+        /* The owner may have exited since the frame came in. */
+        proc_t *owner = proc_lookup(pf->pf_owner);
+        if (owner && owner->p_resident)
+        {
+            owner->p_resident--;
+        }
+        pf->pf_owner = 0;
+    }
+    if (pf->pf_swap_slot)
+    {
+        dbg(DBG_PFRAME, "swap: out page %lu of mobj 0x%p to slot %u\n",
+            pf->pf_pagenum, o, pf->pf_swap_slot);
+    }
+    return 0;
+}
+
+/*
+ * Read a swapped-out frame's page back from its slot into the freshly
+ * allocated pf->pf_addr and release the slot. Called from the fill_pframe
+ * paths of swappable objects, so the usual get_pframe locking is in
+ * effect.
+ */
+long swap_in(pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    KASSERT(pf->pf_addr && pf->pf_swap_slot);
+    KASSERT(swap_bdev && "frame swapped out without a swap device?");
+
+    long ret = swap_bdev->bd_ops->read_block(swap_bdev, pf->pf_addr,
+                                             pf->pf_swap_slot, 1);
+    if (ret)
+    {
+        return ret;
+    }
+    dbg(DBG_PFRAME, "swap: in page %lu of mobj 0x%p from slot %u\n",
+        pf->pf_pagenum, pf->pf_mobj, pf->pf_swap_slot);
+    swap_slot_free(pf->pf_swap_slot);
+    pf->pf_swap_slot = 0;
+    /* Recharge residency to the process faulting the page back in. */
+    if (curproc)
+    {
+        pf->pf_owner = curproc->p_pid;
+        curproc->p_resident++;
+    }
+    return 0;
+}
+
+/* One line of slot-usage accounting for the swap stats device. */
+size_t swap_info(char *buf, size_t size)
+{
+    if (!swap_bdev)
+    {
+        return (size_t)snprintf(buf, size, "no swap device\n");
+    }
+    return (size_t)snprintf(buf, size, "slots %d used %lu\n",
+                            SWAP_SLOTS - 1 - CRASHDUMP_BLOCKS, swap_used);
+}
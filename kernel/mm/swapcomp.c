@@ -0,0 +1,417 @@
+/*
+ * Compressed in-memory tier for paged-out frames (zswap-style).
+ *
+ * Rather than going straight to the (slow) swap disk, a page selected
+ * for eviction is first run through a byte-oriented LZ compressor. If it
+ * shrinks to at most half a page it is stored in a pooled arena built on
+ * page_alloc_n, and the frame becomes a placeholder (pf_addr == NULL)
+ * remembering the pooled copy in pf_comp: the same placeholder scheme
+ * swapped-out frames use (pf_swap_slot), with the backing copy in memory
+ * rather than on disk. The next touch decompresses it back out through
+ * the object's fill_pframe path - a memory-to-memory copy instead of a
+ * disk read. Pages that do not compress well enough, or that arrive when
+ * the pool is full, fall through to the swap device as before (see
+ * swap_out in mm/swap.c).
+ *
+ * The arena hands out fixed-size cells in a few size classes, each class
+ * carved out of multi-page chunks. Since every stored page compressed
+ * 2:1 or better, a full pool of SWAPCOMP_POOL_PAGES pages holds at least
+ * twice that many evicted pages, so the pool pays for itself even under
+ * the memory pressure that drives eviction in the first place. Chunks
+ * are never returned to the page allocator; freed cells are recycled
+ * within their class.
+ *
+ * The compressor is LZ4-like: a greedy parse over a hash table of
+ * four-byte sequences, emitting token bytes whose nibbles hold literal
+ * and match lengths (15 meaning "extension bytes follow"), raw
+ * literals, and two-byte little-endian match offsets. A stream always
+ * ends in a literal run, so the decompressor stops when its input runs
+ * out. Compression aborts as soon as the output would exceed the
+ * largest cell, which is what rejects incompressible pages.
+ */
+
+#include "errno.h"
+#include "globals.h"
+
+#include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/swapcomp.h"
+
+#include "proc/proc.h"
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+/*
+ * One compressed page in the pool. The header and the compressed bytes
+ * share a cell; cp_class remembers which free list the cell goes back
+ * on. The entry is immutable once pf_comp points at it and is owned by
+ * the placeholder's frame, so reads need no locking beyond pf_mutex.
+ */
+typedef struct comp_page
+{
+    uint16_t cp_size;  /* compressed byte count in cp_data */
+    uint8_t cp_class;  /* index into swapcomp_classes */
+    uint8_t cp_data[];
+} comp_page_t;
+
+/* Cell sizes. A page is stored only if header plus compressed bytes fit
+ * the largest class, guaranteeing at least 2:1 over PAGE_SIZE. */
+static const uint16_t swapcomp_classes[] = {256, 512, 1024, 2048};
+#define SWAPCOMP_CLASSES 4
+#define SWAPCOMP_MAX_DATA (2048 - sizeof(comp_page_t))
+
+/* Pages per page_alloc_n chunk; each chunk is carved into cells of a
+ * single class. */
+#define SWAPCOMP_CHUNK_PAGES 8
+
+/* Per-class free cell lists, linked through the first word of each free
+ * cell; swapcomp_lock protects the lists and all the counters. */
+static void *swapcomp_free[SWAPCOMP_CLASSES];
+static size_t swapcomp_free_cells;
+static size_t swapcomp_pool_pages;
+static size_t swapcomp_stored;       /* pages currently in the pool */
+static size_t swapcomp_stored_bytes; /* their compressed footprint */
+static size_t swapcomp_rejected;     /* pages that compressed too poorly */
+static spinlock_t swapcomp_lock = SPINLOCK_INITIALIZER(swapcomp_lock);
+
+/* Match table and output scratch for the compressor. swap_out has a
+ * single caller - the pageout daemon - so one of each serves all
+ * compressions; the scratch page is allocated on first use. */
+#define SWAPCOMP_HASH_SIZE 4096
+static uint16_t swapcomp_table[SWAPCOMP_HASH_SIZE];
+static uint8_t *swapcomp_scratch = NULL;
+
+static uint32_t swapcomp_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static size_t swapcomp_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> 20; /* top 12 bits of a Knuth hash */
+}
+
+/* Emit the extension bytes for a length whose nibble was 15. */
+static uint8_t *swapcomp_emit_len(uint8_t *out, size_t rem)
+{
+    while (rem >= 255)
+    {
+        *out++ = 255;
+        rem -= 255;
+    }
+    *out++ = (uint8_t)rem;
+    return out;
+}
+
+/*
+ * Compress one page from src into dst. Returns the compressed size, or
+ * 0 if the result would not fit in limit bytes.
+ */
+static size_t swapcomp_compress(const uint8_t *src, uint8_t *dst,
+                                size_t limit)
+{
+    const uint8_t *in = src;
+    const uint8_t *anchor = src;
+    const uint8_t *in_end = src + PAGE_SIZE;
+    /* Stop searching near the end and never let a match run to the last
+     * byte, so the stream always closes with a literal run. */
+    const uint8_t *search_end = in_end - 12;
+    const uint8_t *match_limit = in_end - 5;
+    uint8_t *out = dst;
+    uint8_t *out_end = dst + limit;
+
+    memset(swapcomp_table, 0, sizeof(swapcomp_table));
+
+    while (in <= search_end)
+    {
+        uint32_t seq = swapcomp_read32(in);
+        size_t h = swapcomp_hash(seq);
+        const uint8_t *cand =
+            swapcomp_table[h] ? src + swapcomp_table[h] - 1 : NULL;
+        swapcomp_table[h] = (uint16_t)(in - src + 1);
+        if (!cand || swapcomp_read32(cand) != seq)
+        {
+            in++;
+            continue;
+        }
+        const uint8_t *p = in + 4;
+        const uint8_t *m = cand + 4;
+        while (p < match_limit && *p == *m)
+        {
+            p++;
+            m++;
+        }
+        size_t mlen = (size_t)(p - in);
+        size_t litlen = (size_t)(in - anchor);
+        /* Worst case for this sequence: token, literal extension,
+         * literals, offset, match extension. */
+        if ((size_t)(out_end - out) <
+            1 + litlen / 255 + 1 + litlen + 2 + mlen / 255 + 1)
+        {
+            return 0;
+        }
+        uint8_t *token = out++;
+        if (litlen >= 15)
+        {
+            *token = 15 << 4;
+            out = swapcomp_emit_len(out, litlen - 15);
+        }
+        else
+        {
+            *token = (uint8_t)(litlen << 4);
+        }
+        memcpy(out, anchor, litlen);
+        out += litlen;
+        size_t off = (size_t)(in - cand);
+        *out++ = (uint8_t)off;
+        *out++ = (uint8_t)(off >> 8);
+        if (mlen - 4 >= 15)
+        {
+            *token |= 15;
+            out = swapcomp_emit_len(out, mlen - 4 - 15);
+        }
+        else
+        {
+            *token |= (uint8_t)(mlen - 4);
+        }
+        in = p;
+        anchor = p;
+    }
+
+    /* Closing literal run. */
+    size_t litlen = (size_t)(in_end - anchor);
+    if ((size_t)(out_end - out) < 1 + litlen / 255 + 1 + litlen)
+    {
+        return 0;
+    }
+    if (litlen >= 15)
+    {
+        *out++ = 15 << 4;
+        out = swapcomp_emit_len(out, litlen - 15);
+    }
+    else
+    {
+        *out++ = (uint8_t)(litlen << 4);
+    }
+    memcpy(out, anchor, litlen);
+    out += litlen;
+    return (size_t)(out - dst);
+}
+
+/*
+ * Decompress len bytes from src into the page at dst. The stream was
+ * produced by swapcomp_compress from exactly one page, so this always
+ * writes exactly PAGE_SIZE bytes.
+ */
+static void swapcomp_decompress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    const uint8_t *in = src;
+    const uint8_t *in_end = src + len;
+    uint8_t *out = dst;
+    for (;;)
+    {
+        uint8_t token = *in++;
+        size_t litlen = token >> 4;
+        if (litlen == 15)
+        {
+            uint8_t b;
+            do
+            {
+                b = *in++;
+                litlen += b;
+            } while (b == 255);
+        }
+        memcpy(out, in, litlen);
+        out += litlen;
+        in += litlen;
+        if (in >= in_end)
+        {
+            break;
+        }
+        size_t off = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        size_t mlen = (token & 15) + 4;
+        if ((token & 15) == 15)
+        {
+            uint8_t b;
+            do
+            {
+                b = *in++;
+                mlen += b;
+            } while (b == 255);
+        }
+        /* Byte-at-a-time: the match may overlap the output (off < mlen
+         * encodes a run). */
+        const uint8_t *m = out - off;
+        while (mlen--)
+        {
+            *out++ = *m++;
+        }
+    }
+    KASSERT(out == dst + PAGE_SIZE);
+}
+
+/* Smallest class whose cell fits the header plus size compressed bytes,
+ * or -1 if none does. */
+static long swapcomp_class_for(size_t size)
+{
+    for (long c = 0; c < SWAPCOMP_CLASSES; c++)
+    {
+        if (sizeof(comp_page_t) + size <= swapcomp_classes[c])
+        {
+            return c;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Pop a cell of class c (or, failing that, a larger one), growing the
+ * pool by a chunk if the class is empty and the budget allows. Returns
+ * NULL when the pool is exhausted.
+ */
+static comp_page_t *swapcomp_cell_alloc(long c)
+{
+    spinlock_lock(&swapcomp_lock);
+    for (;;)
+    {
+        for (long try = c; try < SWAPCOMP_CLASSES; try++)
+        {
+            if (swapcomp_free[try])
+            {
+                comp_page_t *cell = swapcomp_free[try];
+                swapcomp_free[try] = *(void **)cell;
+                swapcomp_free_cells--;
+                cell->cp_class = (uint8_t)try;
+                spinlock_unlock(&swapcomp_lock);
+                return cell;
+            }
+        }
+        if (swapcomp_pool_pages + SWAPCOMP_CHUNK_PAGES > SWAPCOMP_POOL_PAGES)
+        {
+            spinlock_unlock(&swapcomp_lock);
+            return NULL;
+        }
+        /* Grow outside the lock; only the pageout daemon allocates
+         * cells, so nobody races the chunk in. */
+        spinlock_unlock(&swapcomp_lock);
+        uint8_t *chunk = page_alloc_n(SWAPCOMP_CHUNK_PAGES);
+        if (!chunk)
+        {
+            return NULL;
+        }
+        spinlock_lock(&swapcomp_lock);
+        swapcomp_pool_pages += SWAPCOMP_CHUNK_PAGES;
+        size_t cell_size = swapcomp_classes[c];
+        size_t ncells = SWAPCOMP_CHUNK_PAGES * PAGE_SIZE / cell_size;
+        for (size_t i = 0; i < ncells; i++)
+        {
+            void *cell = chunk + i * cell_size;
+            *(void **)cell = swapcomp_free[c];
+            swapcomp_free[c] = cell;
+        }
+        swapcomp_free_cells += ncells;
+    }
+}
+
+static void swapcomp_cell_free(comp_page_t *cell)
+{
+    spinlock_lock(&swapcomp_lock);
+    KASSERT(swapcomp_stored);
+    swapcomp_stored--;
+    swapcomp_stored_bytes -= cell->cp_size;
+    *(void **)cell = swapcomp_free[cell->cp_class];
+    swapcomp_free[cell->cp_class] = cell;
+    swapcomp_free_cells++;
+    spinlock_unlock(&swapcomp_lock);
+}
+
+long swapcomp_ready()
+{
+    return swapcomp_pool_pages + SWAPCOMP_CHUNK_PAGES <=
+               SWAPCOMP_POOL_PAGES ||
+           swapcomp_free_cells != 0;
+}
+
+long swapcomp_out(pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    KASSERT(pf->pf_addr && !pf->pf_mapped);
+    KASSERT(!pf->pf_comp);
+
+    if (!swapcomp_scratch)
+    {
+        swapcomp_scratch = page_alloc();
+        if (!swapcomp_scratch)
+        {
+            return -ENOMEM;
+        }
+    }
+    size_t size =
+        swapcomp_compress(pf->pf_addr, swapcomp_scratch, SWAPCOMP_MAX_DATA);
+    if (!size)
+    {
+        spinlock_lock(&swapcomp_lock);
+        swapcomp_rejected++;
+        spinlock_unlock(&swapcomp_lock);
+        return -EFBIG;
+    }
+    comp_page_t *cell = swapcomp_cell_alloc(swapcomp_class_for(size));
+    if (!cell)
+    {
+        return -ENOSPC;
+    }
+    cell->cp_size = (uint16_t)size;
+    memcpy(cell->cp_data, swapcomp_scratch, size);
+    spinlock_lock(&swapcomp_lock);
+    swapcomp_stored++;
+    swapcomp_stored_bytes += size;
+    spinlock_unlock(&swapcomp_lock);
+    pf->pf_comp = cell;
+    dbg(DBG_PFRAME, "swapcomp: page %lu of mobj 0x%p in %lu bytes\n",
+        pf->pf_pagenum, pf->pf_mobj, size);
+    return 0;
+}
+
+long swapcomp_in(pframe_t *pf)
+{
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    KASSERT(pf->pf_addr && pf->pf_comp);
+
+    comp_page_t *cell = pf->pf_comp;
+    swapcomp_decompress(cell->cp_data, cell->cp_size, pf->pf_addr);
+    dbg(DBG_PFRAME, "swapcomp: page %lu of mobj 0x%p back from %u bytes\n",
+        pf->pf_pagenum, pf->pf_mobj, cell->cp_size);
+    swapcomp_cell_free(cell);
+    pf->pf_comp = NULL;
+    /* Recharge residency to the process faulting the page back in. */
+    if (curproc)
+    {
+        pf->pf_owner = curproc->p_pid;
+        curproc->p_resident++;
+    }
+    return 0;
+}
+
+void swapcomp_release(pframe_t *pf)
+{
+    if (pf->pf_comp)
+    {
+        swapcomp_cell_free(pf->pf_comp);
+        pf->pf_comp = NULL;
+    }
+}
+
+size_t swapcomp_info(char *buf, size_t size)
+{
+    return (size_t)snprintf(
+        buf, size, "compressed %lu in %lu bytes, pool %lu pages, rejected %lu\n",
+        swapcomp_stored, swapcomp_stored_bytes, swapcomp_pool_pages,
+        swapcomp_rejected);
+}
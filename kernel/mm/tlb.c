@@ -0,0 +1,126 @@
+#include "globals.h"
+#include "kernel.h"
+
+#include "main/apic.h"
+#include "main/interrupt.h"
+#include "main/smp.h"
+
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
+
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+
+/*
+ * Past this many collected pages a full TLB flush is cheaper than per-page
+ * invlpg, both locally and on the shootdown targets.
+ */
+#define TLB_SHOOTDOWN_FLUSH_ALL 64
+
+/*
+ * The request currently being serviced. One shootdown is in flight at a
+ * time, serialized by tlb_shootdown_lock; the committing core publishes the
+ * request and a mask of cores it expects acknowledgements from, and each
+ * target clears its bit from the handler. spinlock_lock does not raise the
+ * IPL, so a core waiting for the lock still services the current holder's
+ * shootdown - which is what makes the wait finite.
+ */
+static spinlock_t tlb_shootdown_lock = SPINLOCK_INITIALIZER(tlb_shootdown_lock);
+static tlb_shootdown_t tlb_shootdown_request;
+static volatile uint64_t tlb_shootdown_pending_acks;
+
+static void _tlb_shootdown_flush(const tlb_shootdown_t *ts)
+{
+    if (ts->ts_count > TLB_SHOOTDOWN_FLUSH_ALL)
+    {
+        tlb_flush_all();
+    }
+    else
+    {
+        tlb_flush_range(ts->ts_low, (ts->ts_high - ts->ts_low) >> PAGE_SHIFT);
+    }
+}
+
+static long _tlb_shootdown_handler(regs_t *regs)
+{
+    if (tlb_shootdown_request.ts_pml4 == curcore.kc_pml4)
+    {
+        _tlb_shootdown_flush(&tlb_shootdown_request);
+    }
+    __sync_and_and_fetch(&tlb_shootdown_pending_acks,
+                         ~(1UL << curcore.kc_id));
+    return 0;
+}
+
+void tlb_shootdown_init()
+{
+    intr_register(INTR_TLB_SHOOTDOWN, _tlb_shootdown_handler);
+}
+
+void tlb_shootdown_begin(tlb_shootdown_t *ts, struct pt *pml4)
+{
+    ts->ts_pml4 = pml4;
+    ts->ts_low = ~0UL;
+    ts->ts_high = 0;
+    ts->ts_count = 0;
+}
+
+void tlb_shootdown_add(tlb_shootdown_t *ts, uintptr_t vaddr, size_t count)
+{
+    if (!count)
+    {
+        return;
+    }
+    ts->ts_low = MIN(ts->ts_low, vaddr);
+    ts->ts_high = MAX(ts->ts_high, vaddr + (count << PAGE_SHIFT));
+    ts->ts_count += count;
+}
+
+void tlb_shootdown_commit(tlb_shootdown_t *ts)
+{
+    if (!ts->ts_count)
+    {
+        return;
+    }
+
+    if (curcore.kc_pml4 == ts->ts_pml4)
+    {
+        _tlb_shootdown_flush(ts);
+    }
+
+#ifdef __SMP__
+    spinlock_lock(&tlb_shootdown_lock);
+
+    uint64_t targets = 0;
+    for (long i = 0; i <= apic_max_id(); i++)
+    {
+        if (i != curcore.kc_id &&
+            GET_CSD(i, core_t, curcore)->kc_pml4 == ts->ts_pml4)
+        {
+            targets |= 1UL << i;
+        }
+    }
+
+    if (targets)
+    {
+        tlb_shootdown_request = *ts;
+        tlb_shootdown_pending_acks = targets;
+        for (long i = 0; i <= apic_max_id(); i++)
+        {
+            if (targets & (1UL << i))
+            {
+                apic_send_ipi((uint8_t)i, DESTINATION_MODE_FIXED,
+                              INTR_TLB_SHOOTDOWN);
+                apic_wait_ipi();
+            }
+        }
+        while (tlb_shootdown_pending_acks)
+        {
+            __asm__ volatile("pause");
+        }
+    }
+
+    spinlock_unlock(&tlb_shootdown_lock);
+#endif
+}
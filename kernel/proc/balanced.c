@@ -0,0 +1,128 @@
+/*
+ * Proactive run-queue balancing.
+ *
+ * Work stealing (see load_balance in proc/sched.c) is reactive: it only
+ * runs when a core is about to idle. If every core is busy running
+ * something, nobody ever steals, so four long-running CPU-bound threads
+ * can share one core forever while the others each run a single thread.
+ * This daemon closes that gap. It periodically folds every core's
+ * run-queue depth into a decaying per-core load average and, once the
+ * busiest core's average has stayed a couple of threads above the
+ * idlest core's, migrates one eligible (affinity-permitting) thread
+ * from the one queue to the other via sched_migrate_one. The averaging
+ * and the one-thread-per-pass cap are the hysteresis: a transient spike
+ * never moves anything, and a real imbalance is walked down a thread at
+ * a time rather than ping-ponged.
+ */
+
+#include "globals.h"
+
+#include "main/apic.h"
+
+#include "proc/balanced.h"
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/printf.h"
+
+/* Decaying average of each core's run-queue depth, in 1/16ths of a
+ * thread; a quarter of each new sample is folded in per pass. Only the
+ * daemon writes these. */
+#define BALANCED_SCALE 16
+static uint64_t balanced_avg[MAX_LAPICS];
+
+/* Migrate only while the averages sit at least this far apart: two full
+ * threads of persistent imbalance. */
+#define BALANCED_GAP (2 * BALANCED_SCALE)
+
+static size_t balanced_migrations;
+
+static ktqueue_t balanced_queue;
+static spinlock_t balanced_sleep_lock =
+    SPINLOCK_INITIALIZER(balanced_sleep_lock);
+
+static void *balanced_run(long arg1, void *arg2)
+{
+    dbg(DBG_PROC, "balanced: running\n");
+    for (;;)
+    {
+        spinlock_lock(&balanced_sleep_lock);
+        /* sched_sleep_on_timeout releases the lock once we're on the
+         * queue; nothing signals the queue, so this is a pure periodic
+         * sleep. */
+        sched_sleep_on_timeout(&balanced_queue, &balanced_sleep_lock,
+                               BALANCED_INTERVAL_TICKS);
+
+        /* The timer wakeup boosts us to the top queue; undo that before
+         * doing any work. */
+        curthr->kt_base_prio = SCHED_NUM_PRIOS - 1;
+        curthr->kt_prio = SCHED_NUM_PRIOS - 1;
+
+        long busiest = -1;
+        long idlest = -1;
+        for (long i = 0; i <= apic_max_id(); i++)
+        {
+            uint64_t sample = sched_runq_depth(i) * BALANCED_SCALE;
+            balanced_avg[i] -= balanced_avg[i] / 4;
+            balanced_avg[i] += sample / 4;
+            if (busiest < 0 || balanced_avg[i] > balanced_avg[busiest])
+            {
+                busiest = i;
+            }
+            if (idlest < 0 || balanced_avg[i] < balanced_avg[idlest])
+            {
+                idlest = i;
+            }
+        }
+        if (busiest == idlest ||
+            balanced_avg[busiest] - balanced_avg[idlest] < BALANCED_GAP)
+        {
+            continue;
+        }
+        if (sched_migrate_one(busiest, idlest))
+        {
+            balanced_migrations++;
+            /* Charge the move to the averages right away so the next
+             * few passes do not migrate again off the same stale gap. */
+            balanced_avg[busiest] -= BALANCED_SCALE;
+            balanced_avg[idlest] += BALANCED_SCALE;
+            dbg(DBG_CORE, "balanced: migrated a thread C%ld -> C%ld\n",
+                busiest, idlest);
+        }
+    }
+    return NULL;
+}
+
+void balanced_start()
+{
+    sched_queue_init(&balanced_queue);
+
+    proc_t *proc = proc_create("balanced");
+    KASSERT(proc && "couldn't create the balance daemon");
+    kthread_t *thr = kthread_create(proc, balanced_run, 0, NULL);
+    KASSERT(thr && "couldn't create the balance daemon's thread");
+
+    /* Start at (and return to, see balanced_run) the lowest priority. */
+    thr->kt_base_prio = SCHED_NUM_PRIOS - 1;
+    thr->kt_prio = SCHED_NUM_PRIOS - 1;
+
+    sched_make_runnable(thr);
+}
+
+size_t balanced_info(char *buf, size_t size)
+{
+    size_t len = (size_t)snprintf(buf, size, "migrations %lu loadavg",
+                                  balanced_migrations);
+    for (long i = 0; i <= apic_max_id(); i++)
+    {
+        len += (size_t)snprintf(buf + len, size - len, " %lu.%02lu",
+                                balanced_avg[i] / BALANCED_SCALE,
+                                (balanced_avg[i] % BALANCED_SCALE) * 100 /
+                                    BALANCED_SCALE);
+    }
+    len += (size_t)snprintf(buf + len, size - len, "\n");
+    return len;
+}
@@ -13,6 +13,7 @@
 #include "fs/vnode.h"
 
 #include "vm/shadow.h"
+#include "vm/vmmap.h"
 
 #include "api/exec.h"
 
@@ -50,15 +51,16 @@ static uintptr_t fork_setup_stack(const regs_t *regs, void *kstack)
  *    c) Before the process begins execution in userland_entry, 
  *       we need to push all registers onto the kernel stack of the kthread. 
  *       Use fork_setup_stack to do this, and set RSP accordingly. 
- *    d) Use pt_unmap_range and tlb_flush_all on the parent in advance of
- *       copy-on-write.
+ *    d) Use pt_write_protect_range and a TLB shootdown on the parent in
+ *       advance of copy-on-write.
  * 5) Prepare the child process to be run on the CPU.
  * 6) Return the child's process id to the parent.
  */
-long do_fork(struct regs *regs)
+static long _do_fork(struct regs *regs, long vfork)
 {
     dbg(DBG_TEST, "\nDO_FORK STARTING\n");
-    proc_t* proc = proc_create(curproc->p_name);
+    proc_t* proc = vfork ? proc_create_vfork(curproc->p_name)
+                         : proc_create(curproc->p_name);
     if (!proc) {
         dbg(DBG_TEST, "\nDO_FORK FAILING\n");
         return -ENOMEM;
@@ -72,13 +74,98 @@ long do_fork(struct regs *regs)
     regs->r_rax = 0;
     uintptr_t new_stack_pointer = fork_setup_stack(regs, (void*) thread->kt_ctx.c_kstack);
     thread->kt_ctx.c_rsp = new_stack_pointer;
-    thread->kt_ctx.c_pml4 = proc->p_pml4;
+    /* A vforked child runs on the parent's page tables until it execs or
+     * exits (proc_vfork_done switches it onto its own p_pml4). */
+    thread->kt_ctx.c_pml4 = vfork ? curproc->p_pml4 : proc->p_pml4;
     thread->kt_ctx.c_rip = (uintptr_t) userland_entry;
     thread->kt_proc = proc;
     list_insert_tail(&proc->p_threads, &thread->kt_plink);
-    pt_unmap_range(curproc->p_pml4, USER_MEM_LOW, USER_MEM_HIGH);
-    tlb_flush_all();
+    if (!vfork) {
+        /* Write-protect (rather than unmap) the parent's user mappings: resident
+         * pages stay readable without refaulting, and the first write to each page
+         * protection-faults into handle_pagefault, which copies it into the
+         * parent's new shadow object. */
+        pt_write_protect_range(curproc->p_pml4, USER_MEM_LOW, USER_MEM_HIGH);
+        tlb_shootdown_t ts;
+        tlb_shootdown_begin(&ts, curproc->p_pml4);
+        tlb_shootdown_add(&ts, USER_MEM_LOW,
+                          (USER_MEM_HIGH - USER_MEM_LOW) >> PAGE_SHIFT);
+        tlb_shootdown_commit(&ts);
+    }
     sched_make_runnable(thread);
+    if (vfork) {
+        /* The child is using our address space; block until it hands it
+         * back from exec or exit (see proc_vfork_done). */
+        spinlock_lock(&curproc->p_children_lock);
+        while (proc->p_vforked) {
+            sched_sleep_on(&curproc->p_wait, &curproc->p_children_lock);
+            spinlock_lock(&curproc->p_children_lock);
+        }
+        spinlock_unlock(&curproc->p_children_lock);
+    }
     dbg(DBG_TEST, "\nDO_FORK FINISHING\n");
     return proc->p_pid;
 }
+
+long do_fork(struct regs *regs)
+{
+    return _do_fork(regs, 0);
+}
+
+/*
+ * vfork(2): the child borrows the parent's address space instead of
+ * getting a COW clone, and the parent blocks until the child execs or
+ * exits. For fork-then-exec spawns this skips vmmap_clone entirely, so
+ * spawn cost no longer depends on how much the parent has mapped.
+ */
+long do_vfork(struct regs *regs)
+{
+    return _do_fork(regs, 1);
+}
+
+/*
+ * thr_create(2): clone-style creation of an additional user thread in the
+ * current process. Unlike fork there is no new proc_t - the thread shares
+ * curproc's vmmap, file table, and page tables by construction - so no
+ * address space is cloned and no pages are write-protected. The thread
+ * enters userland at entry with arg in %rdi; if stack is NULL, a private
+ * anonymous stack is mapped for it first. The entry function must not
+ * return - it should call thr_exit().
+ */
+long do_thr_create(struct regs *regs, void *entry, void *stack, void *arg)
+{
+    if (!entry) {
+        return -EINVAL;
+    }
+    if (!stack) {
+        vmarea_t *vma = NULL;
+        long ret = vmmap_map(curproc->p_vmmap, NULL, 0,
+                             (DEFAULT_STACK_SIZE / PAGE_SIZE) + 1,
+                             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, 0,
+                             VMMAP_DIR_HILO, &vma);
+        if (ret < 0) {
+            return ret;
+        }
+        stack = PN_TO_ADDR(vma->vma_end);
+    }
+    kthread_t* thread = kthread_clone(curthr);
+    if (!thread) {
+        return -ENOMEM;
+    }
+    regs_t thread_regs = *regs;
+    thread_regs.r_rip = (uint64_t)entry;
+    /* as if a return address had just been pushed, per the ABI */
+    thread_regs.r_rsp = (((uint64_t)stack) & ~0xfUL) - 8;
+    thread_regs.r_rdi = (uint64_t)arg;
+    thread_regs.r_rax = 0;
+    thread->kt_ctx.c_rsp =
+        fork_setup_stack(&thread_regs, (void*) thread->kt_ctx.c_kstack);
+    thread->kt_ctx.c_pml4 = curproc->p_pml4;
+    thread->kt_ctx.c_rip = (uintptr_t) userland_entry;
+    thread->kt_proc = curproc;
+    list_insert_tail(&curproc->p_threads, &thread->kt_plink);
+    sched_make_runnable(thread);
+    dbg(DBG_THR, "thr_create: new thread 0x%p in P%d (%s)\n", thread,
+        curproc->p_pid, curproc->p_name);
+    return 0;
+}
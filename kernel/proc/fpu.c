@@ -0,0 +1,147 @@
+#include "proc/fpu.h"
+
+#include "globals.h"
+
+#include "main/apic.h"
+#include "main/interrupt.h"
+
+#include "util/debug.h"
+
+/*
+ * Lazy FPU/SIMD state switching (see proc/fpu.h for the protocol).
+ *
+ * Ownership is per core: fpu_owner is the thread whose FP/SIMD registers
+ * are physically live on this core. A thread keeps ownership across
+ * switches away and back, so a ping-ponging FPU user pays nothing as
+ * long as no other thread on the core touches the FPU in between - the
+ * dispatch path just clears CR0.TS again. Ownership changes only inside
+ * the device-not-available handler, which runs with interrupts disabled
+ * (it is a fault, taken before the faulting instruction).
+ *
+ * Because a thread can migrate, its registers are checkpointed into its
+ * kthread whenever it leaves a CPU (fpu_switch_away); the lazy part is
+ * the restore and the fact that non-FPU threads are never saved at all.
+ */
+
+#define CR0_MP (1UL << 1)
+#define CR0_EM (1UL << 2)
+#define CR0_TS (1UL << 3)
+#define CR4_OSFXSR (1UL << 9)
+
+/* MXCSR power-on default: all SIMD exceptions masked, flags clear. */
+#define FPU_MXCSR_DEFAULT 0x1f80
+
+/* Clean register image handed to a thread's first FPU use, captured once
+ * at boot right after fninit so no earlier thread's values leak. */
+static uint8_t fpu_initial_state[512] __attribute__((aligned(16)));
+
+/* The thread whose FPU registers are live on this core, if any. */
+static kthread_t *fpu_owner CORE_SPECIFIC_DATA_REMOTE;
+
+static inline void _fpu_set_ts()
+{
+    uintptr_t cr0;
+    __asm__ volatile("movq %%cr0, %0"
+                     : "=r"(cr0));
+    __asm__ volatile("movq %0, %%cr0" ::"r"(cr0 | CR0_TS));
+}
+
+static inline void _fpu_clear_ts() { __asm__ volatile("clts"); }
+
+static long _fpu_trap_handler(regs_t *regs)
+{
+    /* Let FPU instructions (including our own fxsave/fxrstor) proceed. */
+    _fpu_clear_ts();
+    if (fpu_owner == curthr)
+    {
+        /* The registers already belong to this thread; the trap only cost
+         * the fault, not a save/restore pair. */
+        return 0;
+    }
+    if (fpu_owner)
+    {
+        __asm__ volatile("fxsave64 %0"
+                         : "=m"(fpu_owner->kt_fpu_state));
+    }
+    if (curthr)
+    {
+        if (curthr->kt_fpu_used)
+        {
+            __asm__ volatile("fxrstor64 %0" ::"m"(curthr->kt_fpu_state));
+        }
+        else
+        {
+            __asm__ volatile("fxrstor64 %0" ::"m"(fpu_initial_state));
+            curthr->kt_fpu_used = 1;
+        }
+    }
+    fpu_owner = curthr;
+    return 0;
+}
+
+void fpu_init()
+{
+    uintptr_t reg;
+    /* CR0.MP so waiting FP instructions honor TS, and no emulation. */
+    __asm__ volatile("movq %%cr0, %0"
+                     : "=r"(reg));
+    __asm__ volatile("movq %0, %%cr0" ::"r"((reg | CR0_MP) & ~CR0_EM));
+    /* CR4.OSFXSR enables SSE instructions and the fxsave register format. */
+    __asm__ volatile("movq %%cr4, %0"
+                     : "=r"(reg));
+    __asm__ volatile("movq %0, %%cr4" ::"r"(reg | CR4_OSFXSR));
+
+    static long inited = 0;
+    if (!inited)
+    {
+        inited = 1;
+        uint32_t mxcsr = FPU_MXCSR_DEFAULT;
+        __asm__ volatile("fninit");
+        __asm__ volatile("ldmxcsr %0" ::"m"(mxcsr));
+        __asm__ volatile("fxsave64 %0"
+                         : "=m"(fpu_initial_state));
+        intr_register(INTR_DEVICE_NOT_AVAILABLE, _fpu_trap_handler);
+    }
+}
+
+void fpu_switch_away(kthread_t *thr)
+{
+    if (fpu_owner != thr)
+    {
+        return;
+    }
+    /* Checkpoint the registers: the thread may next be dispatched on a
+     * core where they are unreachable. Ownership is kept, so if the
+     * thread comes straight back here fpu_switch_to just clears TS. */
+    _fpu_clear_ts();
+    __asm__ volatile("fxsave64 %0"
+                     : "=m"(thr->kt_fpu_state));
+}
+
+void fpu_switch_to()
+{
+    if (fpu_owner && fpu_owner == curthr)
+    {
+        _fpu_clear_ts();
+    }
+    else
+    {
+        _fpu_set_ts();
+    }
+}
+
+void fpu_thread_exited(kthread_t *thr)
+{
+    for (long core = 0; core <= apic_max_id(); core++)
+    {
+        if (!csd_vaddr_table[core])
+        {
+            continue;
+        }
+        kthread_t **owner = GET_CSD(core, kthread_t *, fpu_owner);
+        if (*owner == thr)
+        {
+            *owner = NULL;
+        }
+    }
+}
@@ -0,0 +1,209 @@
+#include "proc/futex.h"
+
+#include "errno.h"
+#include "globals.h"
+
+#include "mm/mm.h"
+
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "vm/vmmap.h"
+
+#include "api/access.h"
+
+#include "util/debug.h"
+
+/*
+ * Waiters hash onto a fixed table of ktqueues by their futex key - the
+ * backing memory object and the offset within it, so two processes that
+ * map the same shared-memory object at different addresses still meet on
+ * the same queue. A wake on a colliding key can wake an unrelated waiter
+ * early; that is harmless, since futex_wait callers loop and recheck the
+ * word.
+ */
+#define FUTEX_HASH_BUCKETS 64
+
+typedef struct futex_bucket
+{
+    spinlock_t fb_lock;
+    ktqueue_t fb_queue;
+} futex_bucket_t;
+
+static futex_bucket_t futex_table[FUTEX_HASH_BUCKETS];
+
+void futex_init()
+{
+    for (size_t i = 0; i < FUTEX_HASH_BUCKETS; i++)
+    {
+        spinlock_init(&futex_table[i].fb_lock);
+        sched_queue_init(&futex_table[i].fb_queue);
+    }
+}
+
+/*
+ * Resolves uaddr to its futex key: the vmarea's backing object and the
+ * page-granular offset within it, plus the offset within the page. The
+ * word must be int-aligned and inside a mapping.
+ */
+static long _futex_key(void *uaddr, uintptr_t *key)
+{
+    if ((uintptr_t)uaddr & (sizeof(int) - 1))
+    {
+        return -EINVAL;
+    }
+    vmarea_t *vma = vmmap_lookup(curproc->p_vmmap, ADDR_TO_PN(uaddr));
+    if (!vma)
+    {
+        return -EFAULT;
+    }
+    size_t off =
+        ((ADDR_TO_PN(uaddr) - vma->vma_start + vma->vma_off) << PAGE_SHIFT) +
+        PAGE_OFFSET(uaddr);
+    *key = (uintptr_t)vma->vma_obj + off;
+    return 0;
+}
+
+static futex_bucket_t *_futex_bucket(uintptr_t key)
+{
+    /* Fibonacci hashing; the low bits of the key are mostly zero */
+    return futex_table +
+           ((key * 0x9e3779b97f4a7c15UL) >> 58) % FUTEX_HASH_BUCKETS;
+}
+
+long futex_wait(void *uaddr, int expected)
+{
+    uintptr_t key;
+    long ret = _futex_key(uaddr, &key);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    /* Fault the word in before taking the bucket lock, so the locked
+     * recheck below does not have to page. */
+    int val;
+    ret = copy_from_user(&val, uaddr, sizeof(val));
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    futex_bucket_t *bucket = _futex_bucket(key);
+    spinlock_lock(&bucket->fb_lock);
+    /* Recheck under the lock that serializes against futex_wake: if the
+     * value changed after the unlocked read, the waker has already been
+     * here (or soon will be) and we must not sleep. */
+    ret = copy_from_user(&val, uaddr, sizeof(val));
+    if (ret < 0)
+    {
+        spinlock_unlock(&bucket->fb_lock);
+        return ret;
+    }
+    if (val != expected)
+    {
+        spinlock_unlock(&bucket->fb_lock);
+        return -EAGAIN;
+    }
+
+    dbg(DBG_SCHED, "futex_wait: P%d blocking on key 0x%p\n", curproc->p_pid,
+        (void *)key);
+    ret = sched_cancellable_sleep_on(&bucket->fb_queue, &bucket->fb_lock);
+    return ret < 0 ? -EINTR : 0;
+}
+
+long futex_wake(void *uaddr, int nwake)
+{
+    uintptr_t key;
+    long ret = _futex_key(uaddr, &key);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (nwake < 0)
+    {
+        return -EINVAL;
+    }
+
+    futex_bucket_t *bucket = _futex_bucket(key);
+    long woken = 0;
+    spinlock_lock(&bucket->fb_lock);
+    while (woken < nwake)
+    {
+        kthread_t *thr = NULL;
+        sched_wakeup_on(&bucket->fb_queue, &thr);
+        if (!thr)
+        {
+            break;
+        }
+        woken++;
+    }
+    spinlock_unlock(&bucket->fb_lock);
+    dbg(DBG_SCHED, "futex_wake: P%d woke %ld waiter(s) on key 0x%p\n",
+        curproc->p_pid, woken, (void *)key);
+    return woken;
+}
+
+long futex_requeue(void *uaddr, int nwake, void *uaddr2)
+{
+    uintptr_t key;
+    uintptr_t key2;
+    long ret = _futex_key(uaddr, &key);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ret = _futex_key(uaddr2, &key2);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (nwake < 0)
+    {
+        return -EINVAL;
+    }
+
+    futex_bucket_t *bucket = _futex_bucket(key);
+    futex_bucket_t *bucket2 = _futex_bucket(key2);
+
+    /* The two keys may hash to the same bucket; lock in address order so
+     * concurrent requeues in opposite directions cannot deadlock. */
+    futex_bucket_t *first = bucket <= bucket2 ? bucket : bucket2;
+    futex_bucket_t *second = bucket <= bucket2 ? bucket2 : bucket;
+    spinlock_lock(&first->fb_lock);
+    if (second != first)
+    {
+        spinlock_lock(&second->fb_lock);
+    }
+
+    long woken = 0;
+    while (woken < nwake)
+    {
+        kthread_t *thr = NULL;
+        sched_wakeup_on(&bucket->fb_queue, &thr);
+        if (!thr)
+        {
+            break;
+        }
+        woken++;
+    }
+    long moved = 0;
+    if (bucket != bucket2)
+    {
+        /* Colliding keys already share a queue; otherwise hand the rest of
+         * the waiters to the target queue without waking them. */
+        moved = (long)sched_requeue_on(&bucket->fb_queue, &bucket2->fb_queue,
+                                       (size_t)-1);
+    }
+
+    if (second != first)
+    {
+        spinlock_unlock(&second->fb_lock);
+    }
+    spinlock_unlock(&first->fb_lock);
+    dbg(DBG_SCHED,
+        "futex_requeue: P%d woke %ld and moved %ld waiter(s) from key 0x%p to "
+        "0x%p\n",
+        curproc->p_pid, woken, moved, (void *)key, (void *)key2);
+    return woken + moved;
+}
@@ -46,9 +46,35 @@ void kmutex_init(kmutex_t *mtx)
     sched_queue_init(&mtx->km_waitq);
     spinlock_init(&mtx->km_lock);
     list_link_init(&mtx->km_link);
+    mtx->km_hot = 0;
     /* PROCS }}} */
 }
 
+/*
+ * Designates mtx as one of the few locks whose holder should not be
+ * switched out mid-critical-section (see the doc comment in kmutex.h).
+ * Called during setup, before the mutex sees contention.
+ */
+void kmutex_mark_hot(kmutex_t *mtx)
+{
+    mtx->km_hot = 1;
+}
+
+/*
+ * Upper bound on the busy-wait iterations kmutex_lock spends waiting for a
+ * holder that is running on another core before falling back to sleeping.
+ * Short critical sections (e.g. mobj_lock) release well within this budget.
+ */
+#define KMUTEX_SPIN_LIMIT 1024
+
+/*
+ * Upper bound on how many nested mutex waits a priority donation chases
+ * (waiter -> holder -> mutex the holder waits on -> its holder -> ...).
+ * Lock nesting in the kernel is shallow; a longer chain is either a
+ * deadlock (which detect_deadlocks flags) or not worth chasing.
+ */
+#define KMUTEX_PI_MAX_DEPTH 8
+
 /*
  * Obtains a mutex, potentially blocking.
  *
@@ -60,6 +86,10 @@ void kmutex_init(kmutex_t *mtx)
 void kmutex_lock(kmutex_t *mtx)
 {
     /* PROCS {{{ */
+#if LOCK_PROFILING
+    const void *lp_site = __builtin_return_address(0);
+    uint64_t lp_wait_start = lockprof_ticks();
+#endif
 
     dbg(DBG_ERROR, "locked mutex: %p\n", mtx);
     spinlock_lock(&mtx->km_lock);
@@ -69,14 +99,76 @@ void kmutex_lock(kmutex_t *mtx)
     if (mtx->km_holder)
     {
         detect_deadlocks(mtx);
+#ifdef __SMP__
+        /* Adaptive spin: if the holder is mid-critical-section on another
+         * core it will likely release soon, so briefly busy-wait for it
+         * instead of paying two context switches. sched_thread_on_cpu
+         * checks the owning core's published curthr, so under
+         * oversubscription we stop the moment the holder is switched out
+         * rather than spinning for a thread that cannot make progress.
+         * The spin itself runs with km_lock dropped - the holder needs
+         * that cacheline to release - and the unlocked km_holder reads
+         * are like the priority-inheritance walk below: a stale snapshot
+         * at worst wastes a spin iteration. */
+        spinlock_unlock(&mtx->km_lock);
+        long spins = KMUTEX_SPIN_LIMIT;
+        kthread_t *spin_holder;
+        while (spins-- && (spin_holder = mtx->km_holder) &&
+               sched_thread_on_cpu(spin_holder))
+        {
+            __asm__("pause;");
+        }
+        spinlock_lock(&mtx->km_lock);
+        if (!mtx->km_holder)
+        {
+            mtx->km_holder = curthr;
+            list_insert_tail(&curthr->kt_mutexes, &mtx->km_link);
+            if (mtx->km_hot)
+            {
+                curthr->kt_hot_locks++;
+            }
+            spinlock_unlock(&mtx->km_lock);
+#if LOCK_PROFILING
+            lockprof_locked(&mtx->km_lp, lp_site, lp_wait_start);
+#endif
+            return;
+        }
+#endif
+        /* Priority inheritance: boost the holder (and, through nested
+         * mutex waits, whoever the holder is blocked on) to our level, so
+         * a mid-priority thread cannot starve the holder and stall us
+         * indefinitely. The walk reads other threads' kt_blocked_mtx
+         * without their locks; a stale link at worst donates to a thread
+         * that no longer needs the boost. */
+        curthr->kt_blocked_mtx = mtx;
+        kthread_t *holder = mtx->km_holder;
+        long depth = KMUTEX_PI_MAX_DEPTH;
+        while (holder && holder != curthr && depth-- &&
+               curthr->kt_prio < holder->kt_prio)
+        {
+            sched_priority_donate(holder, curthr->kt_prio);
+            kmutex_t *next = holder->kt_blocked_mtx;
+            holder = next ? next->km_holder : NULL;
+        }
         sched_sleep_on(&mtx->km_waitq, &mtx->km_lock);
+        curthr->kt_blocked_mtx = NULL;
         KASSERT(kmutex_owns_mutex(mtx));
+#if LOCK_PROFILING
+        lockprof_locked(&mtx->km_lp, lp_site, lp_wait_start);
+#endif
     }
     else
     {
         mtx->km_holder = curthr;
         list_insert_tail(&curthr->kt_mutexes, &mtx->km_link);
+        if (mtx->km_hot)
+        {
+            curthr->kt_hot_locks++;
+        }
         spinlock_unlock(&mtx->km_lock);
+#if LOCK_PROFILING
+        lockprof_locked(&mtx->km_lp, lp_site, lp_wait_start);
+#endif
     }
     /* PROCS }}} */
 }
@@ -98,12 +190,59 @@ void kmutex_unlock(kmutex_t *mtx)
     spinlock_lock(&mtx->km_lock);
     KASSERT(curthr && (curthr == mtx->km_holder) &&
             "unlocking a mutex we don\'t own");
+#if LOCK_PROFILING
+    lockprof_unlocked(&mtx->km_lp);
+#endif
+    if (mtx->km_hot)
+    {
+        curthr->kt_hot_locks--;
+        KASSERT(curthr->kt_hot_locks >= 0);
+    }
     sched_wakeup_on(&mtx->km_waitq, &mtx->km_holder);
     KASSERT(!kmutex_owns_mutex(mtx));
     list_remove(&mtx->km_link);
     if (mtx->km_holder)
+    {
         list_insert_tail(&mtx->km_holder->kt_mutexes, &mtx->km_link);
+        if (mtx->km_hot)
+        {
+            /* The handoff makes the woken thread the holder before it
+             * runs; its hot-hold count must follow the ownership. */
+            mtx->km_holder->kt_hot_locks++;
+        }
+    }
     spinlock_unlock(&mtx->km_lock);
+    if (curthr->kt_inherit_prio < SCHED_NUM_PRIOS)
+    {
+        /* Donations tied to this mutex lapse with the handoff; keep only
+         * what waiters on still-held mutexes would donate. This is an
+         * unlocked snapshot of the wait queues, like detect_deadlocks: a
+         * waiter that arrives as we scan donates again on its own. */
+        int inherit = SCHED_NUM_PRIOS;
+        list_iterate(&curthr->kt_mutexes, held, kmutex_t, km_link)
+        {
+            list_iterate(&held->km_waitq.tq_list, waiter, kthread_t,
+                         kt_qlink)
+            {
+                if (waiter->kt_prio < inherit)
+                {
+                    inherit = waiter->kt_prio;
+                }
+            }
+        }
+        sched_priority_set_inherited(curthr, inherit);
+    }
+    if (curthr->kt_defer_pending && !curthr->kt_hot_locks)
+    {
+        /* The tick handler let us finish this critical section instead
+         * of preempting; now that the last hot lock is released, pay
+         * the slice back. */
+        curthr->kt_defer_pending = 0;
+        if (preemption_enabled())
+        {
+            sched_yield();
+        }
+    }
     /* PROCS }}} */
 }
 
@@ -0,0 +1,96 @@
+// SMP.1 + SMP.3
+// spinlock + mask interrupts
+#include "proc/krwlock.h"
+#include "globals.h"
+#include "util/debug.h"
+
+/*
+ * IMPORTANT: As with mutexes, reader-writer locks can _NEVER_ be locked or
+ * unlocked from an interrupt context, only from a thread context.
+ */
+
+/*
+ * Initializes the members of rw
+ */
+void krwlock_init(krwlock_t *rw)
+{
+    rw->krw_readers = 0;
+    rw->krw_writer = NULL;
+    rw->krw_wr_waiters = 0;
+    sched_queue_init(&rw->krw_rwaitq);
+    sched_queue_init(&rw->krw_wwaitq);
+    spinlock_init(&rw->krw_lock);
+}
+
+/*
+ * Obtains the lock in shared mode, potentially blocking. Readers queue up
+ * behind any waiting writer (writer preference), so the condition must be
+ * rechecked after every sleep: sched_sleep_on releases the spinlock and does
+ * not reacquire it.
+ */
+void krwlock_read_lock(krwlock_t *rw)
+{
+    KASSERT(curthr && "need thread context to lock krwlock");
+    spinlock_lock(&rw->krw_lock);
+    while (rw->krw_writer || rw->krw_wr_waiters)
+    {
+        sched_sleep_on(&rw->krw_rwaitq, &rw->krw_lock);
+        spinlock_lock(&rw->krw_lock);
+    }
+    rw->krw_readers++;
+    spinlock_unlock(&rw->krw_lock);
+}
+
+/*
+ * Releases a shared hold. The last reader out hands the lock to a waiting
+ * writer, if there is one.
+ */
+void krwlock_read_unlock(krwlock_t *rw)
+{
+    spinlock_lock(&rw->krw_lock);
+    KASSERT(rw->krw_readers > 0 && "read-unlocking a krwlock not read-held");
+    if (!--rw->krw_readers && rw->krw_wr_waiters)
+    {
+        sched_wakeup_on(&rw->krw_wwaitq, NULL);
+    }
+    spinlock_unlock(&rw->krw_lock);
+}
+
+/*
+ * Obtains the lock exclusively, potentially blocking. Registering as a
+ * waiting writer first blocks any new readers from getting in ahead of us.
+ */
+void krwlock_write_lock(krwlock_t *rw)
+{
+    KASSERT(curthr && "need thread context to lock krwlock");
+    spinlock_lock(&rw->krw_lock);
+    rw->krw_wr_waiters++;
+    while (rw->krw_readers || rw->krw_writer)
+    {
+        sched_sleep_on(&rw->krw_wwaitq, &rw->krw_lock);
+        spinlock_lock(&rw->krw_lock);
+    }
+    rw->krw_wr_waiters--;
+    rw->krw_writer = curthr;
+    spinlock_unlock(&rw->krw_lock);
+}
+
+/*
+ * Releases an exclusive hold, preferring a waiting writer over the readers.
+ */
+void krwlock_write_unlock(krwlock_t *rw)
+{
+    spinlock_lock(&rw->krw_lock);
+    KASSERT(curthr == rw->krw_writer &&
+            "write-unlocking a krwlock we don't hold");
+    rw->krw_writer = NULL;
+    if (rw->krw_wr_waiters)
+    {
+        sched_wakeup_on(&rw->krw_wwaitq, NULL);
+    }
+    else
+    {
+        sched_broadcast_on(&rw->krw_rwaitq);
+    }
+    spinlock_unlock(&rw->krw_lock);
+}
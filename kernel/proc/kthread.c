@@ -1,7 +1,9 @@
 // SMP.1 for non-curthr actions; none for curthr
 #include "config.h"
 #include "globals.h"
+#include "main/interrupt.h"
 #include "mm/slab.h"
+#include "proc/fpu.h"
 #include "util/debug.h"
 #include "util/string.h"
 
@@ -10,9 +12,13 @@
  *=========*/
 
 /*
- * Global variable maintaining the current thread on the cpu
+ * Global variable maintaining the current thread on the cpu. Lives in the
+ * remote-readable CSD block: adaptive spinners poll other cores' copies
+ * through GET_CSD (see sched_thread_on_cpu), and those reads must not
+ * share a cacheline with the owner-only data the core updates on every
+ * context switch.
  */
-kthread_t *curthr CORE_SPECIFIC_DATA;
+kthread_t *curthr CORE_SPECIFIC_DATA_REMOTE;
 
 /*
  * Private slab for kthread structs
@@ -24,15 +30,52 @@ static slab_allocator_t *kthread_allocator = NULL;
  *================*/
 
 /*
- * Allocates a new kernel stack. Returns null when not enough memory.
+ * Destroyed kernel stacks are parked on a small per-core pool and handed
+ * straight to the next kthread_create() instead of round-tripping through
+ * the page allocator, so fork/exec churn keeps reusing the same few
+ * stacks. The pool is bounded so an exit burst cannot pin much memory;
+ * overflow goes back to page_free_n. Like the page magazines, each pool
+ * is core-private and only needs the IPL raised around access.
  */
-static char *alloc_stack() { return page_alloc_n(DEFAULT_STACK_SIZE_PAGES); }
+#define KSTACK_POOL_CAPACITY 8
+
+static struct
+{
+    char *sp_stacks[KSTACK_POOL_CAPACITY];
+    size_t sp_count;
+} kstack_pool CORE_SPECIFIC_DATA;
+
+/*
+ * Allocates a new kernel stack, preferring the core's pool of recycled
+ * stacks. Returns null when not enough memory.
+ */
+static char *alloc_stack()
+{
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    if (kstack_pool.sp_count)
+    {
+        char *stack = kstack_pool.sp_stacks[--kstack_pool.sp_count];
+        intr_setipl(ipl);
+        return stack;
+    }
+    intr_setipl(ipl);
+    return page_alloc_n(DEFAULT_STACK_SIZE_PAGES);
+}
 
 /*
- * Frees an existing kernel stack.
+ * Frees an existing kernel stack, keeping it on the core's pool when
+ * there is room.
  */
 static void free_stack(char *stack)
 {
+    uint8_t ipl = intr_setipl(IPL_HIGH);
+    if (kstack_pool.sp_count < KSTACK_POOL_CAPACITY)
+    {
+        kstack_pool.sp_stacks[kstack_pool.sp_count++] = stack;
+        intr_setipl(ipl);
+        return;
+    }
+    intr_setipl(ipl);
     page_free_n(stack, DEFAULT_STACK_SIZE_PAGES);
 }
 
@@ -47,7 +90,10 @@ void kthread_init()
 {
     KASSERT(__builtin_popcount(DEFAULT_STACK_SIZE_PAGES) == 1 &&
             "stack size should me a power of 2 pages to reduce fragmentation");
-    kthread_allocator = slab_allocator_create("kthread", sizeof(kthread_t));
+    /* Cacheline-aligned: kthread_t embeds kt_lock and its wait-queue
+     * links, which other cores touch while this thread runs. */
+    kthread_allocator =
+        slab_allocator_create_aligned("kthread", sizeof(kthread_t), 64);
     KASSERT(kthread_allocator);
 }
 
@@ -78,19 +124,37 @@ kthread_t *kthread_create(proc_t *proc, kthread_func_t func, long arg1,
     context_setup(&thread->kt_ctx, func, arg1, arg2, stack, DEFAULT_STACK_SIZE, proc->p_pml4);
     thread->kt_kstack = stack;
     thread->kt_state = KT_NO_STATE;
+    thread->kt_prio = SCHED_PRIO_DEFAULT;
+    thread->kt_base_prio = SCHED_PRIO_DEFAULT;
+    thread->kt_inherit_prio = SCHED_NUM_PRIOS;
+    thread->kt_blocked_mtx = NULL;
+    thread->kt_hot_locks = 0;
+    thread->kt_defer_pending = 0;
+    thread->kt_dl_budget = 0;
+    thread->kt_dl_period = 0;
+    thread->kt_dl_left = 0;
+    thread->kt_dl_start = 0;
     list_link_init(&thread->kt_plink);
     list_init(&thread->kt_mutexes);
     list_insert_tail(&proc->p_threads, &thread->kt_plink);
     thread->kt_recent_core = ~0UL;
+    thread->kt_affinity = KT_AFFINITY_ANY;
     thread->kt_errno = 0;
     thread->kt_proc = proc;
     thread->kt_cancelled = 0;
+    thread->kt_timed_out = 0;
     // thread->kt_wchan not initialized here
     spinlock_init(&thread->kt_lock);
     list_link_init(&thread->kt_qlink);
     thread->kt_wchan = NULL;
     spinlock_init(&thread->kt_lock);
     thread->kt_preemption_count = 0;
+    thread->kt_queued_tsc = 0;
+    thread->kt_utime_tsc = 0;
+    thread->kt_stime_tsc = 0;
+    thread->kt_acct_tsc = 0;
+    thread->kt_in_user = 0;
+    thread->kt_fpu_used = 0;
     thread->kt_retval = 0;
     return thread;
 }
@@ -122,6 +186,7 @@ kthread_t *kthread_clone(kthread_t *thr)
     thread->kt_retval = thr->kt_retval;
     thread->kt_errno = thr->kt_errno;
     thread->kt_cancelled = thr->kt_cancelled;
+    thread->kt_affinity = thr->kt_affinity;
     spinlock_unlock(&thr->kt_lock);
     spinlock_init(&thread->kt_lock);
     list_init(&thread->kt_mutexes);
@@ -129,12 +194,42 @@ kthread_t *kthread_clone(kthread_t *thr)
     list_link_init(&thread->kt_qlink);
     thread->kt_recent_core = ~0UL;
     thread->kt_state = KT_NO_STATE;
+    thread->kt_prio = SCHED_PRIO_DEFAULT;
+    thread->kt_base_prio = SCHED_PRIO_DEFAULT;
+    thread->kt_inherit_prio = SCHED_NUM_PRIOS;
+    thread->kt_blocked_mtx = NULL;
+    thread->kt_hot_locks = 0;
+    thread->kt_defer_pending = 0;
+    thread->kt_dl_budget = 0;
+    thread->kt_dl_period = 0;
+    thread->kt_dl_left = 0;
+    thread->kt_dl_start = 0;
     thread->kt_preemption_count = 0;
+    thread->kt_queued_tsc = 0;
+    thread->kt_utime_tsc = 0;
+    thread->kt_stime_tsc = 0;
+    thread->kt_acct_tsc = 0;
+    thread->kt_in_user = 0;
+    thread->kt_fpu_used = 0;
     thread->kt_wchan = NULL;
     return thread;
 
 }
 
+/*
+ * Narrows the set of cores the thread may run on. Enforcement happens when
+ * the thread is next enqueued (see sched_make_runnable and load_balance in
+ * proc/sched.c), so a thread already on a CPU or a run queue finishes
+ * there before the new mask applies.
+ */
+void kthread_set_affinity(kthread_t *thr, uint64_t mask)
+{
+    KASSERT(mask && "affinity mask must allow at least one core");
+    spinlock_lock(&thr->kt_lock);
+    thr->kt_affinity = mask;
+    spinlock_unlock(&thr->kt_lock);
+}
+
 /*
  * Free the thread's stack, remove it from its process's list of threads, and
  * free the kthread_t struct itself. Protect access to the kthread using its
@@ -150,6 +245,7 @@ void kthread_destroy(kthread_t *thr)
     if (thr->kt_state != KT_EXITED)
         panic("destroying thread in state %d\n", thr->kt_state);
     free_stack(thr->kt_kstack);
+    fpu_thread_exited(thr);
     if (list_link_is_linked(&thr->kt_plink))
         list_remove(&thr->kt_plink);
 
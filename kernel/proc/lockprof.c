@@ -0,0 +1,118 @@
+#include "proc/lockprof.h"
+
+#if LOCK_PROFILING
+
+#include "util/printf.h"
+#include "util/string.h"
+
+/*
+ * Statistics are keyed by lock call site (the return address of the
+ * kmutex_lock()/spinlock_lock() call) in a fixed-size open-addressed
+ * hash table. All updates use atomics rather than a lock - the profiler
+ * runs inside spinlock_lock() itself, so it must never take one.
+ */
+#define LOCKPROF_TABLE_SIZE 256 /* power of two */
+
+typedef struct lockprof_site
+{
+    const void *ls_site;  /* call site, NULL if the slot is free */
+    uint64_t ls_count;    /* number of acquisitions */
+    uint64_t ls_wait;     /* total TSC ticks spent waiting to acquire */
+    uint64_t ls_max_hold; /* longest TSC ticks the lock was held */
+} lockprof_site_t;
+
+static lockprof_site_t lockprof_table[LOCKPROF_TABLE_SIZE];
+
+/*
+ * Finds (or claims) the table entry for a call site. Returns NULL if the
+ * table is full, in which case the sample is simply dropped.
+ */
+static lockprof_site_t *lockprof_site_get(const void *site)
+{
+    size_t idx = (((uintptr_t)site) >> 2) & (LOCKPROF_TABLE_SIZE - 1);
+    for (size_t probe = 0; probe < LOCKPROF_TABLE_SIZE; probe++)
+    {
+        lockprof_site_t *entry =
+            &lockprof_table[(idx + probe) & (LOCKPROF_TABLE_SIZE - 1)];
+        if (entry->ls_site == site)
+        {
+            return entry;
+        }
+        if (!entry->ls_site &&
+            __sync_bool_compare_and_swap(&entry->ls_site, NULL, site))
+        {
+            return entry;
+        }
+        /* Lost the claim race; the winner may have claimed it for us. */
+        if (entry->ls_site == site)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void lockprof_locked(lockprof_lock_t *lp, const void *site,
+                     uint64_t wait_start)
+{
+    uint64_t now = lockprof_ticks();
+    lockprof_site_t *entry = lockprof_site_get(site);
+    if (entry)
+    {
+        __sync_fetch_and_add(&entry->ls_count, 1);
+        __sync_fetch_and_add(&entry->ls_wait, now - wait_start);
+    }
+    lp->lp_site = site;
+    lp->lp_acquired = now;
+}
+
+void lockprof_unlocked(lockprof_lock_t *lp)
+{
+    const void *site = lp->lp_site;
+    if (!site)
+    {
+        /* Lock was acquired before profiling was reset, or never stamped
+         * (e.g. statically initialized and never contended). */
+        return;
+    }
+    lp->lp_site = NULL;
+    uint64_t hold = lockprof_ticks() - lp->lp_acquired;
+
+    lockprof_site_t *entry = lockprof_site_get(site);
+    if (!entry)
+    {
+        return;
+    }
+    uint64_t max = entry->ls_max_hold;
+    while (hold > max &&
+           !__sync_bool_compare_and_swap(&entry->ls_max_hold, max, hold))
+    {
+        max = entry->ls_max_hold;
+    }
+}
+
+size_t lockprof_info(char *buf, size_t size)
+{
+    size_t len = 0;
+    len += snprintf(buf + len, size - len, "%-18s %12s %16s %16s\n", "site",
+                    "acquires", "wait_ticks", "max_hold_ticks");
+    for (size_t i = 0; i < LOCKPROF_TABLE_SIZE && len < size; i++)
+    {
+        lockprof_site_t *entry = &lockprof_table[i];
+        if (!entry->ls_site)
+        {
+            continue;
+        }
+        len += snprintf(buf + len, size - len, "%-18p %12lu %16lu %16lu\n",
+                        entry->ls_site, entry->ls_count, entry->ls_wait,
+                        entry->ls_max_hold);
+    }
+    return len > size ? size : len;
+}
+
+void lockprof_reset()
+{
+    memset(lockprof_table, 0, sizeof(lockprof_table));
+}
+
+#endif
@@ -2,11 +2,13 @@
 // spinlock + mask interrupts
 #include "config.h"
 #include "errno.h"
+#include "fs/aio.h"
 #include "fs/file.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 #include "globals.h"
 #include "kernel.h"
+#include "mm/mman.h"
 #include "mm/slab.h"
 #include "util/debug.h"
 #include "util/printf.h"
@@ -31,6 +33,23 @@ proc_t *curproc CORE_SPECIFIC_DATA;
 static list_t proc_list = LIST_INITIALIZER(proc_list);
 static spinlock_t proc_list_lock = SPINLOCK_INITIALIZER(proc_list_lock);
 
+/*
+ * Hash table from pid to process descriptor, so proc_lookup() does not walk
+ * the whole process list. Shares proc_list_lock with the list; buckets are
+ * initialized lazily by proc_init(). Must be a power of two.
+ */
+#define PROC_HASH_BUCKETS 64
+#define PROC_HASH(pid) ((pid) & (PROC_HASH_BUCKETS - 1))
+static list_t proc_hash[PROC_HASH_BUCKETS];
+
+/*
+ * Bitmap of allocated pids (bit set iff the pid is in use), so allocation
+ * scans words instead of the process list. Protected by proc_list_lock.
+ * pid 0 is permanently claimed by the idle processes.
+ */
+static unsigned long pid_bitmap[PROC_MAX_COUNT / (8 * sizeof(unsigned long))] =
+    {1};
+
 /*
  * Allocator for process descriptors
  */
@@ -48,6 +67,21 @@ proc_t idleproc CORE_SPECIFIC_DATA;
  */
 static proc_t *proc_initproc = NULL;
 
+/*
+ * Dead processes waiting for their heavyweight reclamation (vmmap and
+ * page-table teardown), batched onto a reaper thread so do_waitpid()
+ * returns in O(1) no matter how much the child had mapped. Reuses
+ * p_list_link, which proc_destroy() has already taken off the global
+ * process list. Until the reaper is running (proc_reaper_start(), during
+ * boot), proc_destroy() reclaims synchronously as before.
+ */
+static list_t proc_reaper_list = LIST_INITIALIZER(proc_reaper_list);
+static spinlock_t proc_reaper_lock = SPINLOCK_INITIALIZER(proc_reaper_lock);
+static ktqueue_t proc_reaper_queue;
+static long proc_reaper_ready = 0;
+
+static void _proc_reclaim(proc_t *proc);
+
 /*===============
  * System startup
  *==============*/
@@ -57,8 +91,14 @@ static proc_t *proc_initproc = NULL;
  */
 void proc_init()
 {
-    proc_allocator = slab_allocator_create("proc", sizeof(proc_t));
+    /* Cacheline-aligned: proc_t embeds p_lock and p_wait, which other
+     * cores hit during wakeups and waitpid. */
+    proc_allocator = slab_allocator_create_aligned("proc", sizeof(proc_t), 64);
     KASSERT(proc_allocator);
+    for (size_t i = 0; i < PROC_HASH_BUCKETS; i++)
+    {
+        list_init(&proc_hash[i]);
+    }
 }
 
 /*
@@ -76,6 +116,7 @@ void proc_idleproc_init()
 
     list_link_init(&proc->p_child_link);
     list_link_init(&proc->p_list_link);
+    list_link_init(&proc->p_hash_link);
 
     spinlock_init(&proc->p_children_lock);
 
@@ -83,6 +124,10 @@ void proc_idleproc_init()
     proc->p_state = PROC_RUNNING;
 
     memset(&proc->p_wait, 0, sizeof(ktqueue_t)); // should not be used
+    memset(&proc->p_zombie_wait, 0, sizeof(ktqueue_t));
+    list_init(&proc->p_zombies);
+    list_link_init(&proc->p_zombie_link);
+    proc->p_wait_specific = 0;
 
     proc->p_pml4 = pt_get();
     #ifdef __VM__
@@ -91,7 +136,11 @@ void proc_idleproc_init()
 
     proc->p_cwd = NULL;
 
-    memset(proc->p_files, 0, sizeof(proc->p_files));
+    /* file_init has already run (see the kmain init list), so the
+     * descriptor table allocator is available here. */
+    proc->p_fdtable = fdtable_create();
+    KASSERT(proc->p_fdtable);
+    proc->p_files = proc->p_fdtable->fdt_files;
 
     char name[8];
     snprintf(name, sizeof(name), "idle%ld", curcore.kc_id);
@@ -114,28 +163,33 @@ static pid_t next_pid = 1;
 static pid_t _proc_getid()
 {
     spinlock_lock(&proc_list_lock);
-    pid_t pid = next_pid;
-restart:
-    list_iterate(&proc_list, p, proc_t, p_list_link)
+    const size_t bits = 8 * sizeof(unsigned long);
+    const size_t nwords = PROC_MAX_COUNT / bits;
+    size_t start = (size_t)next_pid / bits;
+    /* Scan the bitmap for a clear bit starting at next_pid and wrapping;
+     * the start word is revisited unmasked at the end of the scan so pids
+     * below next_pid are still considered. */
+    for (size_t i = 0; i <= nwords; i++)
     {
-        if (p->p_pid == pid)
+        size_t w = (start + i) % nwords;
+        unsigned long word = pid_bitmap[w];
+        if (i == 0)
         {
-            pid = pid + 1 == PROC_MAX_COUNT ? 1 : pid + 1;
-            if (pid == next_pid)
-            {
-                spinlock_unlock(&proc_list_lock);
-                return -1;
-            }
-            else
-            {
-                goto restart;
-            }
+            word |= ((1UL << ((size_t)next_pid % bits)) - 1);
+        }
+        if (word == ~0UL)
+        {
+            continue;
         }
+        pid_t pid = (pid_t)(w * bits + (size_t)__builtin_ctzl(~word));
+        pid_bitmap[w] |= 1UL << ((size_t)pid % bits);
+        next_pid = pid + 1 == PROC_MAX_COUNT ? 1 : pid + 1;
+        KASSERT(pid);
+        spinlock_unlock(&proc_list_lock);
+        return pid;
     }
-    next_pid = pid + 1 == PROC_MAX_COUNT ? 1 : pid + 1;
-    KASSERT(pid);
     spinlock_unlock(&proc_list_lock);
-    return pid;
+    return -1;
 }
 
 /*
@@ -149,7 +203,7 @@ proc_t *proc_lookup(pid_t pid)
         return &idleproc;
     }
     spinlock_lock(&proc_list_lock);
-    list_iterate(&proc_list, p, proc_t, p_list_link)
+    list_iterate(&proc_hash[PROC_HASH(pid)], p, proc_t, p_hash_link)
     {
         if (p->p_pid == pid)
         {
@@ -161,6 +215,37 @@ proc_t *proc_lookup(pid_t pid)
     return NULL;
 }
 
+/*
+ * Formats one "pid name resident-pages" line per process, for the resident
+ * stats device. The counts are a snapshot; they move as frames come and go.
+ */
+size_t proc_resident_info(char *buf, size_t size)
+{
+    size_t off = 0;
+    spinlock_lock(&proc_list_lock);
+    list_iterate(&proc_list, p, proc_t, p_list_link)
+    {
+        /* Pinned total: pages covered by vmareas the process has
+         * mlock()ed (see do_mlock). An unlocked snapshot, like the rest
+         * of the stats devices. */
+        size_t pinned = 0;
+        if (p->p_vmmap)
+        {
+            list_iterate(&p->p_vmmap->vmm_list, vma, vmarea_t, vma_plink)
+            {
+                if (vma->vma_flags & MAP_PINNED)
+                {
+                    pinned += vma->vma_end - vma->vma_start;
+                }
+            }
+        }
+        off += snprintf(buf + off, size - off, "%d %s %lu %lu\n", p->p_pid,
+                        p->p_name, p->p_resident, pinned);
+    }
+    spinlock_unlock(&proc_list_lock);
+    return off;
+}
+
 /*==========
  * Functions
  *=========*/
@@ -183,14 +268,26 @@ proc_t *proc_lookup(pid_t pid)
  * 
  * Be sure to free resources appropriately if proc_create() fails midway!
  */
-proc_t *proc_create(const char *name)
+/* How _proc_create should set up the new process's address space. */
+#define PROC_CREATE_CLONE 0 /* COW clone of the parent's (fork) */
+#define PROC_CREATE_VFORK 1 /* borrow the parent's (vfork) */
+#define PROC_CREATE_SPAWN 2 /* fresh empty vmmap (spawn) */
+
+static proc_t *_proc_create(const char *name, long mode)
 {
     if (strlen(name) > PROC_NAME_LEN) {
         return NULL;
     }
     pid_t pid = _proc_getid();
+    if (pid < 0) {
+        return NULL;
+    }
     proc_t* proc = (proc_t*) slab_obj_alloc(proc_allocator);
     if (proc == NULL) {
+        spinlock_lock(&proc_list_lock);
+        pid_bitmap[(size_t)pid / (8 * sizeof(unsigned long))] &=
+            ~(1UL << ((size_t)pid % (8 * sizeof(unsigned long))));
+        spinlock_unlock(&proc_list_lock);
         return NULL;
     }
     pml4_t* page = pt_create();
@@ -204,35 +301,95 @@ proc_t *proc_create(const char *name)
     }
     proc->p_pml4 = page;
     proc->p_state = PROC_RUNNING;
+    proc->p_resident = 0;
+    proc->p_utime_tsc = 0;
+    proc->p_stime_tsc = 0;
+    proc->p_cutime_tsc = 0;
+    proc->p_cstime_tsc = 0;
     proc->p_pproc = curproc;
     list_init(&proc->p_children);
     list_init(&proc->p_threads);
     list_link_init(&proc->p_list_link);
     list_link_init(&proc->p_child_link);
+    list_init(&proc->p_zombies);
+    list_link_init(&proc->p_zombie_link);
+    sched_queue_init(&proc->p_zombie_wait);
+    proc->p_wait_specific = 0;
     sched_queue_init(&proc->p_wait);
     list_insert_head(&curproc->p_children, &proc->p_child_link);
-    sched_queue_init(&proc->p_wait);
-    vmmap_t* map_clone = vmmap_clone(curproc->p_vmmap);
-    map_clone->vmm_proc = proc;
-    proc->p_vmmap = map_clone;
+    if (mode == PROC_CREATE_VFORK) {
+        // borrow the parent's address space; nothing to clone, and the
+        // parent stays blocked until we give it back (proc_vfork_done)
+        proc->p_vmmap = curproc->p_vmmap;
+        proc->p_vforked = 1;
+    } else if (mode == PROC_CREATE_SPAWN) {
+        // the process is about to exec onto a fresh vmmap anyway (spawn),
+        // so don't waste time cloning one it will never look at
+        vmmap_t* map = vmmap_create();
+        map->vmm_proc = proc;
+        proc->p_vmmap = map;
+        proc->p_vforked = 0;
+    } else {
+        vmmap_t* map_clone = vmmap_clone(curproc->p_vmmap);
+        map_clone->vmm_proc = proc;
+        proc->p_vmmap = map_clone;
+        proc->p_vforked = 0;
+    }
     spinlock_lock(&proc_list_lock);
     list_insert_head(&proc_list, &proc->p_list_link);
+    list_link_init(&proc->p_hash_link);
+    list_insert_head(&proc_hash[PROC_HASH(pid)], &proc->p_hash_link);
     proc->p_cwd = curproc->p_cwd;
     proc->p_brk = curproc->p_brk;
     proc->p_start_brk = curproc->p_start_brk;
     if (proc->p_cwd) {
         vref(curproc->p_cwd);
     }
-    for (int i = 0; i < NFILES; i++) {
-        proc->p_files[i] = curproc->p_files[i];
-        if (proc->p_files[i]) {
-            fref(proc->p_files[i]);
-        }
-    }
+    // share the parent's descriptor table instead of copying it; it gets
+    // copied lazily if either side modifies it (see fdtable_unshare)
+    proc->p_fdtable = fdtable_clone(curproc->p_fdtable);
+    proc->p_files = proc->p_fdtable->fdt_files;
     spinlock_unlock(&proc_list_lock);
     return proc;
 }
 
+proc_t *proc_create(const char *name)
+{
+    return _proc_create(name, PROC_CREATE_CLONE);
+}
+
+proc_t *proc_create_vfork(const char *name)
+{
+    return _proc_create(name, PROC_CREATE_VFORK);
+}
+
+proc_t *proc_create_spawn(const char *name)
+{
+    return _proc_create(name, PROC_CREATE_SPAWN);
+}
+
+/*
+ * A vforked process is done with the parent's address space (it is about
+ * to exec onto a fresh vmmap, or to exit). Move back onto our own page
+ * tables first - the parent may tear the borrowed space down the moment
+ * it wakes - then drop the borrowed pointer and wake the parent, which is
+ * sleeping on its p_wait in do_vfork().
+ */
+void proc_vfork_done()
+{
+    KASSERT(curproc->p_vforked);
+    proc_t *parent = curproc->p_pproc;
+
+    curthr->kt_ctx.c_pml4 = curproc->p_pml4;
+    pt_set(curproc->p_pml4);
+    curproc->p_vmmap = NULL;
+
+    spinlock_lock(&parent->p_children_lock);
+    curproc->p_vforked = 0;
+    sched_broadcast_on(&parent->p_wait);
+    spinlock_unlock(&parent->p_children_lock);
+}
+
 /*
  * Helper for proc_thread_exiting() that cleans up resources from the current
  * process in preparation for its destruction (which occurs later via proc_destroy()). 
@@ -253,12 +410,22 @@ proc_t *proc_create(const char *name)
 void proc_cleanup(long status)
 {
     curproc->p_state = PROC_DEAD;
+    if (curproc->p_vforked) {
+        // exiting without ever calling exec; give the borrowed address
+        // space back and unblock the parent
+        proc_vfork_done();
+    }
+    /* drain async I/O before the file table and address space go away */
+    aio_proc_cleanup(curproc);
     for (int fd = 0; fd < NFILES; fd++)
     {
         do_close(fd);
     }
     vput(&curproc->p_cwd);
-    vmmap_destroy(&curproc->p_vmmap);
+    /* The vmmap (and the page tables) are torn down later by the reaper
+     * thread, via proc_destroy() -> _proc_reclaim(); doing it here would
+     * put the heavyweight reclamation on the exit path. The init process
+     * is special - nobody waits on it - but it only exits at shutdown. */
     if (curproc->p_pid == PID_INIT) {
         if (!list_empty(&curproc->p_children)) {
             // clean up orphaned processes in the event that init process must shut down
@@ -268,11 +435,24 @@ void proc_cleanup(long status)
         }
         initproc_finish();
     } else {
+        /* Hold our own lock so no child exits onto p_zombies mid-move
+         * (the exit path re-checks p_pproc under the lock it takes),
+         * and init's so we can link into its lists safely. */
+        spinlock_lock(&curproc->p_children_lock);
+        spinlock_lock(&proc_initproc->p_children_lock);
         list_iterate(&curproc->p_children, child, proc_t, p_child_link) {
             list_remove(&child->p_child_link);
             list_insert_head(&proc_initproc->p_children, &child->p_child_link);
             child->p_pproc = proc_initproc;
+            if (list_link_is_linked(&child->p_zombie_link)) {
+                // already dead and unreaped; hand it to init's queue
+                list_remove(&child->p_zombie_link);
+                list_insert_tail(&proc_initproc->p_zombies,
+                                 &child->p_zombie_link);
+            }
         }
+        spinlock_unlock(&proc_initproc->p_children_lock);
+        spinlock_unlock(&curproc->p_children_lock);
     }
 }
 
@@ -291,10 +471,54 @@ void proc_cleanup(long status)
  */
 void proc_thread_exiting(void *retval)
 {
-    proc_cleanup((long)retval);
+    /* Close the thread's open accounting interval and fold its CPU time
+     * into the process totals, where do_getrusage and do_waitpid can
+     * still see it after the kthread is destroyed. */
+    sched_acct_mark(0);
+    curproc->p_utime_tsc += curthr->kt_utime_tsc;
+    curproc->p_stime_tsc += curthr->kt_stime_tsc;
+    curthr->kt_utime_tsc = 0;
+    curthr->kt_stime_tsc = 0;
+    /* With thr_create a process can have several live threads; only the
+     * last one to exit tears the process down. An earlier thr_exit just
+     * retires its own thread (its kthread is destroyed with the rest in
+     * proc_destroy()). */
+    long last = 1;
+    list_iterate(&curproc->p_threads, thr, kthread_t, kt_plink) {
+        if (thr != curthr && thr->kt_state != KT_EXITED) {
+            last = 0;
+        }
+    }
+    if (last) {
+        proc_cleanup((long)retval);
+    }
     //curthr->kt_retval = retval;
     curthr->kt_state = KT_EXITED;
-    sched_broadcast_on(&curproc->p_pproc->p_wait);
+    if (last) {
+        /* Push ourselves onto the parent's completion queue. The parent
+         * may be reparenting us to init right now (it is exiting too),
+         * so lock our parent-of-record and re-check that it still is. */
+        proc_t *parent;
+        for (;;) {
+            parent = curproc->p_pproc;
+            spinlock_lock(&parent->p_children_lock);
+            if (parent == curproc->p_pproc) {
+                break;
+            }
+            spinlock_unlock(&parent->p_children_lock);
+        }
+        list_insert_tail(&parent->p_zombies, &curproc->p_zombie_link);
+        long specific = parent->p_wait_specific;
+        spinlock_unlock(&parent->p_children_lock);
+        /* One exit means one reapable child, so one waiter is enough -
+         * unless someone is waiting on a specific pid, in which case
+         * only a broadcast is sure to reach the right thread. */
+        if (specific) {
+            sched_broadcast_on(&parent->p_zombie_wait);
+        } else {
+            sched_wakeup_on(&parent->p_zombie_wait, NULL);
+        }
+    }
     sched_switch(0, 0);
 }
 
@@ -345,6 +569,9 @@ void proc_destroy(proc_t *proc)
 {
     spinlock_lock(&proc_list_lock);
     list_remove(&proc->p_list_link);
+    list_remove(&proc->p_hash_link);
+    pid_bitmap[(size_t)proc->p_pid / (8 * sizeof(unsigned long))] &=
+        ~(1UL << ((size_t)proc->p_pid % (8 * sizeof(unsigned long))));
     spinlock_unlock(&proc_list_lock);
 
     list_iterate(&proc->p_threads, thr, kthread_t, kt_plink)
@@ -353,23 +580,37 @@ void proc_destroy(proc_t *proc)
     }
 
 #ifdef __VFS__
-    for (int fd = 0; fd < NFILES; fd++)
-    {
-        if (proc->p_files[fd])
-            fput(proc->p_files + fd);
-    }
+    fdtable_put(&proc->p_fdtable);
+    proc->p_files = NULL;
     if (proc->p_cwd)
     {
         vput(&proc->p_cwd);
     }
 #endif
 
-#ifdef __VM__
+    dbg(DBG_THR, "destroying P%d\n", proc->p_pid);
+
+    if (proc_reaper_ready)
+    {
+        spinlock_lock(&proc_reaper_lock);
+        list_insert_tail(&proc_reaper_list, &proc->p_list_link);
+        sched_broadcast_on(&proc_reaper_queue);
+        spinlock_unlock(&proc_reaper_lock);
+        return;
+    }
+    _proc_reclaim(proc);
+}
+
+/*
+ * The heavyweight part of process teardown: tearing down the address
+ * space and page tables and freeing the descriptor. Runs on the reaper
+ * thread once it is up, or synchronously from proc_destroy() during
+ * boot.
+ */
+static void _proc_reclaim(proc_t *proc)
+{
     if (proc->p_vmmap)
         vmmap_destroy(&proc->p_vmmap);
-#endif
-
-    dbg(DBG_THR, "destroying P%d\n", proc->p_pid);
 
     KASSERT(proc->p_pml4);
     pt_destroy(proc->p_pml4);
@@ -377,6 +618,40 @@ void proc_destroy(proc_t *proc)
     slab_obj_free(proc_allocator, proc);
 }
 
+static void *proc_reaper_run(long arg1, void *arg2)
+{
+    dbg(DBG_PROC, "reaper: running\n");
+    for (;;)
+    {
+        spinlock_lock(&proc_reaper_lock);
+        while (list_empty(&proc_reaper_list))
+        {
+            /* sched_sleep_on releases proc_reaper_lock once we're queued */
+            sched_sleep_on(&proc_reaper_queue, &proc_reaper_lock);
+            spinlock_lock(&proc_reaper_lock);
+        }
+        proc_t *proc = list_head(&proc_reaper_list, proc_t, p_list_link);
+        list_remove(&proc->p_list_link);
+        spinlock_unlock(&proc_reaper_lock);
+
+        _proc_reclaim(proc);
+    }
+    return NULL;
+}
+
+void proc_reaper_start()
+{
+    sched_queue_init(&proc_reaper_queue);
+
+    proc_t *proc = proc_create("reaper");
+    KASSERT(proc && "couldn't create the reaper daemon");
+    kthread_t *thr = kthread_create(proc, proc_reaper_run, 0, NULL);
+    KASSERT(thr && "couldn't create the reaper daemon's thread");
+
+    proc_reaper_ready = 1;
+    sched_make_runnable(thr);
+}
+
 /*=============
  * System calls
  *============*/
@@ -404,49 +679,98 @@ void proc_destroy(proc_t *proc)
  * If waiting on any child (-1), do_waitpid can return when *any* child has exited,
  * it does not have to return the one that exited earliest.
  */
+/* Fold a dead child's CPU totals (its own plus its reaped children's)
+ * into ours before it is destroyed; getrusage(RUSAGE_CHILDREN) reports
+ * only children that have been waited for. */
+static void _proc_collect_rusage(proc_t *child) {
+    curproc->p_cutime_tsc += child->p_utime_tsc + child->p_cutime_tsc;
+    curproc->p_cstime_tsc += child->p_stime_tsc + child->p_cstime_tsc;
+}
+
 pid_t do_waitpid(pid_t pid, int *status, int options) {
     if (pid == 0 || pid < -1 || options) {
         return -ENOTSUP;
     }
     spinlock_lock(&curproc->p_children_lock);
-    if (pid == -1 && list_empty(&curproc->p_children)) {
+    if (pid == -1) {
+        if (list_empty(&curproc->p_children)) {
+            spinlock_unlock(&curproc->p_children_lock);
+            return -ECHILD;
+        }
+        /* Reap the oldest entry on the completion queue; exited children
+         * link themselves there (see proc_thread_exiting), so there is
+         * no scan of p_children no matter how many children there are. */
+        while (list_empty(&curproc->p_zombies)) {
+            sched_sleep_on(&curproc->p_zombie_wait,
+                           &curproc->p_children_lock);
+            spinlock_lock(&curproc->p_children_lock);
+        }
+        proc_t *child = list_head(&curproc->p_zombies, proc_t, p_zombie_link);
+        list_remove(&child->p_zombie_link);
+        list_remove(&child->p_child_link);
+        _proc_collect_rusage(child);
+        pid_t child_pid = child->p_pid;
+        if (status) {
+            *status = (int)child->p_status;
+        }
         spinlock_unlock(&curproc->p_children_lock);
-        return -ECHILD;
-    }
-    if (pid > 0) {
-        list_iterate(&curproc->p_children, ch, proc_t, p_child_link) {
-            if (ch->p_pid == pid) {
-                if (ch->p_state == PROC_DEAD) {
-                    *status = ch->p_status;
-                    proc_destroy(ch);
-                } else {
-                    while (ch->p_state != PROC_DEAD) {
-                        sched_sleep_on(&curproc->p_wait, &curproc->p_children_lock);
-                    }
-                    *status = ch->p_status;
-                    pid_t child_pid = ch->p_pid;
-                    list_remove(&ch->p_child_link);
-                    proc_destroy(ch);
-                    return child_pid;
-                }
-            }
+        proc_destroy(child);
+        return child_pid;
+    }
+    /* Waiting on a specific pid still scans for the child once; what it
+     * waits for is the child's appearance on the completion queue (the
+     * push is what makes the exit visible under our lock). */
+    list_iterate(&curproc->p_children, ch, proc_t, p_child_link) {
+        if (ch->p_pid != pid) {
+            continue;
         }
-        return -ECHILD;
-    } else if (pid == -1) {
-        while (1) {
-            list_iterate(&curproc->p_children, child, proc_t, p_child_link) {
-                if (child->p_state == PROC_DEAD) {
-                    *status = child->p_status;
-                    pid_t child_pid = child->p_pid;
-                    list_remove(&child->p_child_link);
-                    proc_destroy(child);
-                    return child_pid;
-                }
-            }
-            sched_sleep_on(&curproc->p_wait, &curproc->p_children_lock);
+        /* Make exits broadcast while we sleep: a wake-one could go to a
+         * waiter that wants a different child. */
+        curproc->p_wait_specific++;
+        while (!list_link_is_linked(&ch->p_zombie_link)) {
+            sched_sleep_on(&curproc->p_zombie_wait,
+                           &curproc->p_children_lock);
+            spinlock_lock(&curproc->p_children_lock);
+        }
+        curproc->p_wait_specific--;
+        list_remove(&ch->p_zombie_link);
+        list_remove(&ch->p_child_link);
+        _proc_collect_rusage(ch);
+        if (status) {
+            *status = (int)ch->p_status;
         }
+        spinlock_unlock(&curproc->p_children_lock);
+        proc_destroy(ch);
+        return pid;
     }
-    return -ENOTSUP;
+    spinlock_unlock(&curproc->p_children_lock);
+    return -ECHILD;
+}
+
+long do_getrusage(int who, uint64_t *utime, uint64_t *stime)
+{
+    if (who == RUSAGE_SELF)
+    {
+        /* Bring the calling thread's open interval up to date first. */
+        sched_acct_mark(0);
+        uint64_t u = curproc->p_utime_tsc;
+        uint64_t s = curproc->p_stime_tsc;
+        list_iterate(&curproc->p_threads, thr, kthread_t, kt_plink)
+        {
+            u += thr->kt_utime_tsc;
+            s += thr->kt_stime_tsc;
+        }
+        *utime = u;
+        *stime = s;
+        return 0;
+    }
+    if (who == RUSAGE_CHILDREN)
+    {
+        *utime = curproc->p_cutime_tsc;
+        *stime = curproc->p_cstime_tsc;
+        return 0;
+    }
+    return -EINVAL;
 }
 
 /*
@@ -500,6 +824,16 @@ size_t proc_info(const void *arg, char *buf, size_t osize)
     iprintf(&buf, &size, "status:       %ld\n", p->p_status);
     iprintf(&buf, &size, "state:        %i\n", p->p_state);
 
+    uint64_t utime = p->p_utime_tsc;
+    uint64_t stime = p->p_stime_tsc;
+    list_iterate((list_t *)&p->p_threads, thr, kthread_t, kt_plink)
+    {
+        utime += thr->kt_utime_tsc;
+        stime += thr->kt_stime_tsc;
+    }
+    iprintf(&buf, &size, "utime cycles: %lu\n", utime);
+    iprintf(&buf, &size, "stime cycles: %lu\n", stime);
+
 #ifdef __VFS__
 #ifdef __GETCWD__
     if (NULL != p->p_cwd)
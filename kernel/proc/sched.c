@@ -5,9 +5,16 @@
 #include "fs/vfs.h"
 #include "globals.h"
 #include "main/apic.h"
+#include "main/cpuid.h"
 #include "main/inits.h"
+#include "mm/page.h"
+#include "proc/fpu.h"
 #include "types.h"
 #include "util/debug.h"
+#include "util/printf.h"
+#include "util/reclaim.h"
+#include "util/timer.h"
+#include "util/trace.h"
 #include <util/time.h>
 
 /*==========
@@ -15,9 +22,71 @@
  *=========*/
 
 /*
- * The run queue of threads waiting to be run.
+ * The run queue of threads waiting to be run: a small multi-level queue,
+ * one FIFO per priority level. Selection scans from level 0 (highest) down,
+ * except that every SCHED_STARVE_PICKS picks the scan runs bottom-up so a
+ * steady stream of boosted sleepers cannot starve CPU-bound threads.
  */
-static ktqueue_t kt_runq CORE_SPECIFIC_DATA;
+static ktqueue_t kt_runq[SCHED_NUM_PRIOS] CORE_SPECIFIC_DATA_REMOTE;
+
+/*
+ * Count of threads picked off the run queue, for the anti-starvation scan.
+ */
+static uint64_t kt_picks CORE_SPECIFIC_DATA;
+
+#define SCHED_STARVE_PICKS 16
+
+static int sched_deadline_prio(kthread_t *thr);
+
+/*
+ * Count of context switches into a thread on this core, exported through
+ * the stats devices (see drivers/statdev.c).
+ */
+static uint64_t kt_switches CORE_SPECIFIC_DATA_REMOTE;
+
+/*
+ * Scheduler latency instrumentation: per-core log2-bucket histograms, in
+ * TSC cycles, of run-queue wait (enqueue to dispatch) and of the time
+ * core_switch() spends choosing the next thread. One rdtsc and a bucket
+ * increment per event, so the histograms stay enabled in production;
+ * exported through the stats devices (see sched_latency_info).
+ */
+#define SCHED_LAT_BUCKETS 32
+
+static uint64_t kt_wait_hist[SCHED_LAT_BUCKETS] CORE_SPECIFIC_DATA_REMOTE;
+static uint64_t kt_switch_hist[SCHED_LAT_BUCKETS] CORE_SPECIFIC_DATA_REMOTE;
+
+static inline uint64_t sched_tsc()
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void sched_hist_record(uint64_t *hist, uint64_t cycles)
+{
+    long bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    if (bucket >= SCHED_LAT_BUCKETS)
+    {
+        bucket = SCHED_LAT_BUCKETS - 1;
+    }
+    hist[bucket]++;
+}
+
+/*
+ * Idle governor state: a core about to halt in core_switch()'s idle loop
+ * records itself here, and sched_core_wake() sends a targeted wakeup IPI to
+ * one such core when a thread becomes runnable. Cores that are busy are
+ * never interrupted, and a halted core is claimed (cleared) before the IPI
+ * is sent so concurrent wakeups kick different cores.
+ */
+static volatile uint8_t kt_core_halted[MAX_LAPICS];
+
+/*
+ * Emitted just before each context switch; arguments are the pid being
+ * switched to and this core's running switch count.
+ */
+TRACEPOINT(sched_switch);
 
 /*
  * Helper tracking most recent thread context before a context_switch().
@@ -111,6 +180,38 @@ static kthread_t *ktqueue_dequeue(ktqueue_t *queue)
     return thr;
 }
 
+/*
+ * Removes and returns the oldest thread in queue whose affinity mask
+ * allows core, or NULL if there is none. Used by work stealing and the
+ * balance daemon, which must not migrate a pinned thread; local dequeues
+ * can take the head unconditionally because enqueueing already respects
+ * affinity.
+ *
+ * queue must be locked
+ */
+static kthread_t *ktqueue_dequeue_affine(ktqueue_t *queue, long core)
+{
+    list_assert_sanity(&queue->tq_list);
+
+    /* Dequeues take from l_prev, so scan in that direction to preserve
+     * the queue's FIFO order among eligible threads. */
+    for (list_link_t *link = queue->tq_list.l_prev; link != &queue->tq_list;
+         link = link->l_prev)
+    {
+        kthread_t *thr = list_item(link, kthread_t, kt_qlink);
+        list_prefetch(list_item(link->l_prev, kthread_t, kt_qlink));
+        if (thr->kt_affinity & (1UL << core))
+        {
+            list_remove(link);
+            thr->kt_wchan = NULL;
+            queue->tq_size--;
+            list_assert_sanity(&queue->tq_list);
+            return thr;
+        }
+    }
+    return NULL;
+}
+
 /*
  * Removes thr from queue
  *
@@ -139,12 +240,48 @@ inline long sched_queue_empty(ktqueue_t *queue) { return queue->tq_size == 0; }
  * Functions
  *=========*/
 
+static long sched_wake_ipi_handler(regs_t *regs)
+{
+    /* Nothing to do here: the interrupt itself breaks the target out of
+     * hlt, and the idle loop rescans its run queues (and its siblings',
+     * via load_balance()) as soon as it resumes. */
+    return 0;
+}
+
+/*
+ * Wakes one halted core allowed by mask, if there is one, so a freshly
+ * runnable thread can be stolen immediately instead of sitting until the
+ * target's next timer tick. Cores halt rarely and wakeups are frequent, so
+ * the common case is a scan that sends nothing.
+ */
+static void sched_core_wake(uint64_t mask)
+{
+    for (long i = 0; i <= apic_max_id(); i++)
+    {
+        if (i == curcore.kc_id || !(mask & (1UL << i)) || !kt_core_halted[i])
+        {
+            continue;
+        }
+        if (__sync_lock_test_and_set(&kt_core_halted[i], 0))
+        {
+            apic_send_ipi((uint8_t)i, DESTINATION_MODE_FIXED,
+                          INTR_SCHED_WAKE);
+            return;
+        }
+    }
+}
+
 /*
  * Initializes the run queue.
  */
 void sched_init(void)
 {
-    sched_queue_init(GET_CSD(curcore.kc_id, ktqueue_t, kt_runq));
+    ktqueue_t *runq = GET_CSD(curcore.kc_id, ktqueue_t, kt_runq);
+    for (int prio = 0; prio < SCHED_NUM_PRIOS; prio++)
+    {
+        sched_queue_init(&runq[prio]);
+    }
+    intr_register(INTR_SCHED_WAKE, sched_wake_ipi_handler);
 }
 
 /*
@@ -243,8 +380,27 @@ void sched_yield()
     spinlock_lock(&curthr->kt_lock);
     KASSERT(curthr->kt_state == KT_ON_CPU);
     curthr->kt_state = KT_RUNNABLE;
-    spinlock_lock(&kt_runq.tq_lock);
-    sched_switch(&kt_runq, &curthr->kt_lock);
+    /* Yielding (voluntarily or via preemption) means the thread used up its
+     * turn on the CPU, so it decays one priority level. It earns level 0
+     * back the next time it wakes from a sleep (see sched_wakeup_on). Only
+     * the thread's own priority decays; a donation from a mutex waiter
+     * (kt_inherit_prio) still holds the effective priority up. */
+    if (curthr->kt_dl_period)
+    {
+        /* Deadline-class threads do not decay; their level tracks the
+         * budget left in the period (see sched_set_deadline). */
+        curthr->kt_base_prio = sched_deadline_prio(curthr);
+    }
+    else if (curthr->kt_base_prio < SCHED_NUM_PRIOS - 1)
+    {
+        curthr->kt_base_prio++;
+    }
+    curthr->kt_prio = curthr->kt_base_prio < curthr->kt_inherit_prio
+                          ? curthr->kt_base_prio
+                          : curthr->kt_inherit_prio;
+    ktqueue_t *runq = &kt_runq[curthr->kt_prio];
+    spinlock_lock(&runq->tq_lock);
+    sched_switch(runq, &curthr->kt_lock);
 }
 
 /*
@@ -263,11 +419,32 @@ void sched_make_runnable(kthread_t *thr)
     uint8_t current_ipl = intr_getipl();
     intr_setipl(IPL_HIGH);
     spinlock_lock(&thr->kt_lock);
-    spinlock_lock(&kt_runq.tq_lock);
+    ktqueue_t *runq;
+    if (thr->kt_affinity & (1UL << curcore.kc_id))
+    {
+        runq = &kt_runq[thr->kt_prio];
+    }
+    else
+    {
+        /* This core is excluded by the thread's affinity mask; hand the
+         * thread directly to the first core the mask allows. */
+        long target = 0;
+        while (target <= apic_max_id() &&
+               !(thr->kt_affinity & (1UL << target)))
+        {
+            target++;
+        }
+        KASSERT(target <= apic_max_id() &&
+                "affinity mask excludes every online core");
+        runq = GET_CSD(target, ktqueue_t, kt_runq) + thr->kt_prio;
+    }
+    spinlock_lock(&runq->tq_lock);
     thr->kt_state = KT_RUNNABLE;
-    ktqueue_enqueue(&kt_runq, thr);
+    thr->kt_queued_tsc = sched_tsc();
+    ktqueue_enqueue(runq, thr);
     spinlock_unlock(&thr->kt_lock);
-    spinlock_unlock(&kt_runq.tq_lock);
+    spinlock_unlock(&runq->tq_lock);
+    sched_core_wake(thr->kt_affinity);
     intr_setipl(current_ipl);
 }
 
@@ -297,6 +474,67 @@ void sched_sleep_on(ktqueue_t *q, spinlock_t *lock)
     intr_setipl(current_ipl);
 }
 
+/*
+ * Timer callback for sched_sleep_on_timeout: if the thread is still asleep,
+ * pull it off its wait queue, mark the sleep as timed out, and make it
+ * runnable. Runs from the timer firing path, hence the IPL dance.
+ */
+static void _sched_sleep_timeout(uint64_t data)
+{
+    kthread_t *thr = (kthread_t *)data;
+    uint8_t current_ipl = intr_getipl();
+    intr_setipl(IPL_HIGH);
+    spinlock_lock(&thr->kt_lock);
+    ktqueue_t *q = thr->kt_wchan;
+    if (q && (thr->kt_state == KT_SLEEP ||
+              thr->kt_state == KT_SLEEP_CANCELLABLE))
+    {
+        spinlock_lock(&q->tq_lock);
+        ktqueue_remove(q, thr);
+        spinlock_unlock(&q->tq_lock);
+        thr->kt_timed_out = 1;
+        spinlock_unlock(&thr->kt_lock);
+        sched_make_runnable(thr);
+    }
+    else
+    {
+        spinlock_unlock(&thr->kt_lock);
+    }
+    intr_setipl(current_ipl);
+}
+
+/*
+ * Like sched_sleep_on, but arms a timer before going to sleep so that the
+ * thread wakes after at most ticks timer ticks even if the event never
+ * arrives. As with sched_sleep_on, the lock is released and NOT reacquired;
+ * callers must re-lock and recheck their condition, and on -ETIMEDOUT the
+ * event may still have happened concurrently.
+ */
+long sched_sleep_on_timeout(ktqueue_t *q, spinlock_t *lock, uint64_t ticks)
+{
+    KASSERT(q != NULL);
+    KASSERT(lock != NULL);
+
+    timer_t timer;
+    timer_init(&timer);
+    timer.function = _sched_sleep_timeout;
+    timer.data = (uint64_t)curthr;
+    timer.expires = jiffies + ticks;
+
+    uint8_t current_ipl = intr_getipl();
+    intr_setipl(IPL_HIGH);
+    spinlock_lock(&curthr->kt_lock);
+    curthr->kt_timed_out = 0;
+    curthr->kt_state = KT_SLEEP;
+    timer_add(&timer);
+    sched_switch(q, lock);
+    intr_setipl(current_ipl);
+
+    /* Disarm before the timer goes out of scope; a no-op if it fired. */
+    timer_del(&timer);
+    return curthr->kt_timed_out ? -ETIMEDOUT : 0;
+}
+
 /*
  * Wakes up a thread on the given queue by taking it off the queue and 
  * making it runnable. If given an empty queue, do nothing.
@@ -319,6 +557,15 @@ void sched_wakeup_on(ktqueue_t *q, kthread_t **ktp)
     if (thread == NULL) {
         return;
     }
+    /* The thread slept voluntarily waiting on an event (I/O, a mutex), so
+     * treat it as interactive and boost it to the top run queue level.
+     * Deadline-class threads earn their level from remaining budget, not
+     * from having slept (see sched_set_deadline). */
+    thread->kt_base_prio =
+        thread->kt_dl_period ? sched_deadline_prio(thread) : 0;
+    thread->kt_prio = thread->kt_base_prio < thread->kt_inherit_prio
+                          ? thread->kt_base_prio
+                          : thread->kt_inherit_prio;
     sched_make_runnable(thread);
 }
 
@@ -331,41 +578,325 @@ void sched_broadcast_on(ktqueue_t *q)
     spinlock_lock(&q->tq_lock);
     kthread_t* thread;
     while ((thread = ktqueue_dequeue(q)) != NULL) {
+        /* Boost woken sleepers, as in sched_wakeup_on. */
+        thread->kt_base_prio =
+            thread->kt_dl_period ? sched_deadline_prio(thread) : 0;
+        thread->kt_prio = thread->kt_base_prio < thread->kt_inherit_prio
+                              ? thread->kt_base_prio
+                              : thread->kt_inherit_prio;
         sched_make_runnable(thread);
     }
     spinlock_unlock(&q->tq_lock);
 }
 
+/*
+ * Moves up to nmove sleeping threads (oldest first) from one queue to
+ * another without waking them; they simply continue their sleep on the
+ * destination and wake whenever it is next woken. Relative order among
+ * the moved threads is preserved, and existing waiters on the
+ * destination stay ahead of them. This is how a waker can hand surplus
+ * waiters to the queue they would block on next (e.g. FUTEX_REQUEUE)
+ * instead of waking them all to race and re-block.
+ */
+size_t sched_requeue_on(ktqueue_t *from, ktqueue_t *to, size_t nmove)
+{
+    KASSERT(from != to);
+    /* Both queue locks are needed; take them in address order so two
+     * requeues in opposite directions cannot deadlock. */
+    spinlock_t *first = from < to ? &from->tq_lock : &to->tq_lock;
+    spinlock_t *second = from < to ? &to->tq_lock : &from->tq_lock;
+    spinlock_lock(first);
+    spinlock_lock(second);
+    size_t moved = 0;
+    while (moved < nmove)
+    {
+        kthread_t *thread = ktqueue_dequeue(from);
+        if (!thread)
+        {
+            break;
+        }
+        ktqueue_enqueue(to, thread);
+        moved++;
+    }
+    spinlock_unlock(second);
+    spinlock_unlock(first);
+    return moved;
+}
+
+/*
+ * Priority-inheritance hook for kmutex: raises thr's effective priority
+ * to at least prio (numerically lower is higher) on behalf of a waiter.
+ * If the thread is sitting on a run queue at a lower level, it is
+ * re-enqueued at the boosted level so the donation takes effect before
+ * its next dispatch; a sleeping or on-CPU thread just carries the new
+ * priority to its next enqueue.
+ */
+void sched_priority_donate(kthread_t *thr, int prio)
+{
+    KASSERT(prio >= 0 && prio < SCHED_NUM_PRIOS);
+    uint8_t current_ipl = intr_getipl();
+    intr_setipl(IPL_HIGH);
+    spinlock_lock(&thr->kt_lock);
+    if (prio < thr->kt_inherit_prio)
+    {
+        thr->kt_inherit_prio = prio;
+    }
+    int effective = thr->kt_base_prio < thr->kt_inherit_prio
+                        ? thr->kt_base_prio
+                        : thr->kt_inherit_prio;
+    if (effective < thr->kt_prio)
+    {
+        thr->kt_prio = effective;
+        if (thr->kt_state == KT_RUNNABLE && thr->kt_wchan)
+        {
+            /* Pull the thread off its current run queue level and requeue
+             * it at the boosted one (the same removal dance as the sleep
+             * timeout callback). */
+            ktqueue_t *q = thr->kt_wchan;
+            spinlock_lock(&q->tq_lock);
+            ktqueue_remove(q, thr);
+            spinlock_unlock(&q->tq_lock);
+            spinlock_unlock(&thr->kt_lock);
+            sched_make_runnable(thr);
+            intr_setipl(current_ipl);
+            return;
+        }
+    }
+    spinlock_unlock(&thr->kt_lock);
+    intr_setipl(current_ipl);
+}
+
+/*
+ * Replaces thr's donated priority outright (SCHED_NUM_PRIOS clears the
+ * donation) and recomputes the effective priority, which may lower it.
+ * kmutex_unlock uses this when the donations tied to a released mutex
+ * lapse; the caller is the running thread itself, so no queue fixup is
+ * needed - the new priority simply governs its next enqueue.
+ */
+void sched_priority_set_inherited(kthread_t *thr, int prio)
+{
+    KASSERT(prio >= 0 && prio <= SCHED_NUM_PRIOS);
+    spinlock_lock(&thr->kt_lock);
+    thr->kt_inherit_prio = prio;
+    thr->kt_prio =
+        thr->kt_base_prio < prio ? thr->kt_base_prio : prio;
+    spinlock_unlock(&thr->kt_lock);
+}
+
+/*
+ * Rolls thr's deadline period forward if it has lapsed and returns the
+ * base priority its budget currently earns: the top level while budget
+ * remains in the period, the bottom level once it is spent. A priority
+ * donation (kt_inherit_prio) still holds the effective priority up for
+ * an exhausted thread, so it cannot stall foreground threads by holding
+ * a mutex into the low-priority part of its period.
+ */
+static int sched_deadline_prio(kthread_t *thr)
+{
+    if (jiffies - thr->kt_dl_start >= thr->kt_dl_period)
+    {
+        thr->kt_dl_start = jiffies;
+        thr->kt_dl_left = thr->kt_dl_budget;
+    }
+    return thr->kt_dl_left ? 0 : SCHED_NUM_PRIOS - 1;
+}
+
+/*
+ * Places thr in the deadline/budget class: it runs at the top priority
+ * for up to budget ticks out of every period ticks and at the bottom
+ * priority for the rest. The class replaces the decay/boost rules for
+ * the thread, so a service thread neither earns extra share by waking
+ * often nor loses its share to the yield decay - its throughput follows
+ * the (budget, period) grant alone, which makes background maintenance
+ * steady instead of feast-or-famine.
+ */
+void sched_set_deadline(kthread_t *thr, uint64_t budget, uint64_t period)
+{
+    KASSERT(budget && period && budget <= period);
+    spinlock_lock(&thr->kt_lock);
+    thr->kt_dl_budget = budget;
+    thr->kt_dl_period = period;
+    thr->kt_dl_left = budget;
+    thr->kt_dl_start = jiffies;
+    /* A fresh grant starts with budget available. */
+    thr->kt_base_prio = 0;
+    if (thr->kt_prio > 0)
+    {
+        thr->kt_prio = 0;
+    }
+    spinlock_unlock(&thr->kt_lock);
+}
+
+/*
+ * Charges one timer tick against the running thread's deadline budget.
+ * Consumption is tick-sampled rather than cycle-exact, which is plenty
+ * for the background-service threads the class is meant for; the new
+ * level takes effect at the thread's next enqueue.
+ */
+void sched_deadline_tick()
+{
+    if (curthr && curthr->kt_dl_period && sched_deadline_prio(curthr) == 0)
+    {
+        curthr->kt_dl_left--;
+    }
+}
+
 /*===============
  * Functions: SMP
  *==============*/
 
+#ifdef __SMP__
 /*
- * A sad, but functional, attempt at load balancing when a core is idle
+ * Distance from this core to a potential steal victim: zero for an SMT
+ * sibling (its threads are already warm in our caches), otherwise the
+ * SLIT distance between the two cores' memory nodes (10 == same node;
+ * see page_node_distance). The SMT shift - how many low APIC-id bits
+ * name the thread within a physical core - comes from cpuid's extended
+ * topology leaf, probed lazily once; the probe is idempotent, so the
+ * unsynchronized write is harmless if cores race to it.
+ */
+static long kt_smt_shift = -1;
+
+static long sched_core_distance(long core)
+{
+    if (kt_smt_shift < 0)
+    {
+        uint32_t eax, ebx, ecx, edx;
+        long shift = 0;
+        cpuid(0, &eax, &ebx, &ecx, &edx);
+        if (eax >= 0xb)
+        {
+            cpuid_count(0xb, 0, &eax, &ebx, &ecx, &edx);
+            /* sub-leaf 0 describes the SMT level (type 1 in ecx); a
+             * logical-processor count of one means no hyperthreading,
+             * and every core is its own sibling group */
+            if (((ecx >> 8) & 0xff) == 1 && (ebx & 0xffff) > 1)
+            {
+                shift = eax & 0x1f;
+            }
+        }
+        kt_smt_shift = shift;
+    }
+    if (kt_smt_shift &&
+        (core >> kt_smt_shift) == (curcore.kc_id >> kt_smt_shift))
+    {
+        return 0;
+    }
+    return page_node_distance(page_node_of_core(curcore.kc_id),
+                              page_node_of_core(core));
+}
+#endif
+
+/*
+ * Steal a runnable thread from the closest backlogged sibling run queue -
+ * nearest by sched_core_distance, ties broken by load - or return NULL
+ * if every sibling is also out of work. Stealing from an SMT sibling is
+ * nearly free while a cross-node steal drags the thread's cache and
+ * memory footprint with it, so distance outranks load.
+ *
+ * Victim selection reads each queue's tq_size without its lock; the sizes
+ * are only a hint for picking the victim, and only the chosen victim's
+ * queue is locked for the actual dequeue. If the victim's queue drained
+ * between the read and the lock, we just come up empty-handed and the
+ * caller idles as before.
  */
-#define LOAD_BALANCING_IDLE_THRESHOLD 4096
 static inline kthread_t *load_balance()
 {
 #ifdef __SMP__
-    dbg(DBG_CORE, "been idle for a while; attempting to steal thread\n");
-    for (long i = 0; i < apic_max_id(); i++)
+    long victim = -1;
+    size_t victim_load = 0;
+    long victim_dist = 0;
+    for (long i = 0; i <= apic_max_id(); i++)
     {
         if (i == curcore.kc_id)
         {
             continue;
         }
-        spinlock_lock(&GET_CSD(i, ktqueue_t, kt_runq)->tq_lock);
-        kthread_t *thr = ktqueue_dequeue(GET_CSD(i, ktqueue_t, kt_runq));
-        spinlock_unlock(&GET_CSD(i, ktqueue_t, kt_runq)->tq_lock);
-        if (thr)
-            return thr;
+        ktqueue_t *sibling_runq = GET_CSD(i, ktqueue_t, kt_runq);
+        size_t load = 0;
+        for (int prio = 0; prio < SCHED_NUM_PRIOS; prio++)
+        {
+            load += sibling_runq[prio].tq_size;
+        }
+        if (!load)
+        {
+            continue;
+        }
+        long dist = sched_core_distance(i);
+        if (victim < 0 || dist < victim_dist ||
+            (dist == victim_dist && load > victim_load))
+        {
+            victim = i;
+            victim_load = load;
+            victim_dist = dist;
+        }
     }
-    return NULL;
+    if (victim < 0)
+    {
+        return NULL;
+    }
+
+    ktqueue_t *victim_runq = GET_CSD(victim, ktqueue_t, kt_runq);
+    kthread_t *thr = NULL;
+    for (int prio = 0; prio < SCHED_NUM_PRIOS && !thr; prio++)
+    {
+        spinlock_lock(&victim_runq[prio].tq_lock);
+        thr = ktqueue_dequeue_affine(&victim_runq[prio], curcore.kc_id);
+        spinlock_unlock(&victim_runq[prio].tq_lock);
+    }
+    if (thr)
+    {
+        dbg(DBG_CORE, "stole thread from C%ld (load %lu, distance %ld)\n",
+            victim, victim_load, victim_dist);
+    }
+    return thr;
 #endif
 
     return NULL;
 }
 
+/*
+ * Move one runnable thread from core from's run queue to core to's,
+ * respecting affinity masks. The lowest-priority eligible thread moves
+ * first: long-running CPU-bound threads decay to the bottom queues, and
+ * those are exactly the ones worth rebalancing, while latency-sensitive
+ * threads near the top stay where they are. Returns 1 if a thread was
+ * migrated, 0 if nothing queued on from may run on to.
+ *
+ * Stealing (load_balance) only runs when a core is about to idle; this
+ * is the primitive behind the balance daemon (see proc/balanced.c),
+ * which handles persistent imbalance between cores that never idle.
+ */
+long sched_migrate_one(long from, long to)
+{
+#ifdef __SMP__
+    ktqueue_t *from_runq = GET_CSD(from, ktqueue_t, kt_runq);
+    ktqueue_t *to_runq = GET_CSD(to, ktqueue_t, kt_runq);
+    uint8_t current_ipl = intr_getipl();
+    intr_setipl(IPL_HIGH);
+    for (int prio = SCHED_NUM_PRIOS - 1; prio >= 0; prio--)
+    {
+        spinlock_lock(&from_runq[prio].tq_lock);
+        kthread_t *thr = ktqueue_dequeue_affine(&from_runq[prio], to);
+        spinlock_unlock(&from_runq[prio].tq_lock);
+        if (!thr)
+        {
+            continue;
+        }
+        /* The thread stays KT_RUNNABLE and keeps kt_queued_tsc - it has
+         * been waiting the whole time; only the queue changes. */
+        spinlock_lock(&to_runq[prio].tq_lock);
+        ktqueue_enqueue(&to_runq[prio], thr);
+        spinlock_unlock(&to_runq[prio].tq_lock);
+        sched_core_wake(1UL << to);
+        intr_setipl(current_ipl);
+        return 1;
+    }
+    intr_setipl(current_ipl);
+#endif
+    return 0;
+}
+
 /*
  * The meat of our SMP-system.
  *
@@ -374,14 +905,49 @@ static inline kthread_t *load_balance()
  *  2) set curproc to idleproc, and curthr to NULL
  *  3) try to get the next thread to run
  *     a) try to use your own runq (kt_runq), which is core-specific data
- *     b) if, using core_uptime(), at least LOAD_BALANCING_IDLE_THRESHOLD have
- * passed, then call load_balance() to try to get the next thread to run c) if
+ *     b) otherwise call load_balance() to steal a thread from the busiest
+ * sibling run queue c) if
  * neither (a) nor (b) work, the core is idle. Wait for an interrupt using
  * intr_wait(). Note that you will need to re-disable interrupts after returning
  * from intr_wait(). 4) ensure the context's PML4 for the selected thread is
  * correctly setup with curcore's core-specific data. Use kt_recent_core and
  * map_in_core_specific_data. 5) set curthr and curproc 6) context_switch out
  */
+/*
+ * Close out thr's current accounting interval at time now, charging it
+ * to user or system per kt_in_user. The zero check skips threads that
+ * have never been dispatched (and the stamp is re-established at the
+ * next dispatch), so queued time is never billed.
+ */
+static void sched_acct_charge(kthread_t *thr, uint64_t now)
+{
+    if (thr->kt_acct_tsc && now > thr->kt_acct_tsc)
+    {
+        uint64_t delta = now - thr->kt_acct_tsc;
+        if (thr->kt_in_user)
+        {
+            thr->kt_utime_tsc += delta;
+        }
+        else
+        {
+            thr->kt_stime_tsc += delta;
+        }
+    }
+    thr->kt_acct_tsc = 0;
+}
+
+void sched_acct_mark(long in_user)
+{
+    if (!curthr)
+    {
+        return;
+    }
+    uint64_t now = sched_tsc();
+    sched_acct_charge(curthr, now);
+    curthr->kt_acct_tsc = now;
+    curthr->kt_in_user = in_user;
+}
+
 void core_switch()
 {
     while (1)
@@ -389,8 +955,13 @@ void core_switch()
         KASSERT(!intr_enabled());
         KASSERT(!curthr || curthr->kt_state != KT_ON_CPU);
 
+        uint64_t switch_start = sched_tsc();
+
         if (curcore.kc_queue)
         {
+            /* A yielding or preempted thread re-enters the queue here, so
+             * stamp it like sched_make_runnable does. */
+            curthr->kt_queued_tsc = switch_start;
             ktqueue_enqueue(curcore.kc_queue, curthr);
             spinlock_unlock(&curcore.kc_queue->tq_lock);
         }
@@ -398,28 +969,56 @@ void core_switch()
         {
             spinlock_unlock(curcore.kc_lock);
         }
+        if (curthr)
+        {
+            /* Close out the departing thread's accounting interval; it
+             * gets a fresh stamp at its next dispatch. */
+            sched_acct_charge(curthr, switch_start);
+            /* Checkpoint the outgoing thread's FPU registers if it owns
+             * them; integer-only threads make this a no-op. */
+            fpu_switch_away(curthr);
+        }
+
+        /* The outgoing thread has left the CPU, so this is a quiescent
+         * state: retire an epoch of deferred frees (see util/reclaim.c). */
+        reclaim_quiesce();
 
         curproc = &idleproc;
         curthr = NULL;
 
         kthread_t *next_thread = NULL;
 
-        size_t idle_start = core_uptime();
         while (1)
         {
-            spinlock_lock(&kt_runq.tq_lock);
-            next_thread = ktqueue_dequeue(&kt_runq);
-            spinlock_unlock(&kt_runq.tq_lock);
+            /* Scan the priority levels top-down, except that every
+             * SCHED_STARVE_PICKS picks we scan bottom-up so low-priority
+             * threads still make progress under interactive load. */
+            long reverse = (++kt_picks % SCHED_STARVE_PICKS) == 0;
+            for (int i = 0; i < SCHED_NUM_PRIOS && !next_thread; i++)
+            {
+                int prio = reverse ? SCHED_NUM_PRIOS - 1 - i : i;
+                spinlock_lock(&kt_runq[prio].tq_lock);
+                next_thread = ktqueue_dequeue(&kt_runq[prio]);
+                spinlock_unlock(&kt_runq[prio].tq_lock);
+            }
 
-            if (!next_thread &&
-                core_uptime() - idle_start >= LOAD_BALANCING_IDLE_THRESHOLD)
+            /* Rather than idling while a sibling has a backlog, steal from
+             * the busiest sibling run queue right away. */
+            if (!next_thread)
                 next_thread = load_balance();
 
             if (next_thread)
                 break;
 
+            /* Advertise that this core is halting, so wakeups on other
+             * cores send it a targeted IPI rather than leaving the new
+             * work to sit until this core's next timer tick. */
+            kt_core_halted[curcore.kc_id] = 1;
             intr_wait();
             intr_disable();
+            kt_core_halted[curcore.kc_id] = 0;
+            /* Don't bill the halt to the switch-duration histogram. */
+            switch_start = sched_tsc();
         }
 
         KASSERT(next_thread->kt_state == KT_RUNNABLE);
@@ -440,6 +1039,108 @@ void core_switch()
         curthr = next_thread;
         curthr->kt_state = KT_ON_CPU;
         curproc = curthr->kt_proc;
+        time_slice_reset();
+        /* A deferral owed from a previous slice lapses with the fresh
+         * dispatch; the thread starts a full slice anyway. */
+        curthr->kt_defer_pending = 0;
+        uint64_t now = sched_tsc();
+        if (curthr->kt_queued_tsc && now > curthr->kt_queued_tsc)
+        {
+            sched_hist_record(kt_wait_hist, now - curthr->kt_queued_tsc);
+        }
+        curthr->kt_queued_tsc = 0;
+        /* Open the dispatched thread's accounting interval; kt_in_user
+         * keeps whatever mode the thread was last marked in. */
+        curthr->kt_acct_tsc = now;
+        sched_hist_record(kt_switch_hist, now - switch_start);
+        kt_switches++;
+        TRACE(sched_switch, curproc->p_pid, kt_switches);
+        /* Arm the lazy-FPU trap unless curthr already owns this core's
+         * FPU registers; see proc/fpu.c. */
+        fpu_switch_to();
         context_switch(&curcore.kc_ctx, &curthr->kt_ctx);
     }
 }
+
+/*
+ * Stats accessors (see drivers/statdev.c). Both read a remote core's
+ * core-specific data without locking - the values are monotonic or
+ * advisory, so a torn snapshot is acceptable for monitoring.
+ */
+size_t sched_runq_depth(long core)
+{
+    ktqueue_t *runq = GET_CSD(core, ktqueue_t, kt_runq);
+    size_t depth = 0;
+    for (int prio = 0; prio < SCHED_NUM_PRIOS; prio++)
+    {
+        depth += runq[prio].tq_size;
+    }
+    return depth;
+}
+
+uint64_t sched_context_switches(long core)
+{
+    return *GET_CSD(core, uint64_t, kt_switches);
+}
+
+/*
+ * Returns whether thr is executing on a core right now. kt_state is the
+ * cheap first-pass filter; the owning core's published curthr (a remote
+ * CSD read) is the authoritative answer. Adaptive spinners (kmutex,
+ * pipes) key their spin-or-sleep decision off this: spinning for an
+ * on-CPU holder saves two context switches, while spinning for a
+ * descheduled one under oversubscription just burns the holder's chance
+ * to run. Like the stats accessors above, this is an unlocked snapshot -
+ * a stale answer costs at most one wasted spin iteration.
+ */
+long sched_thread_on_cpu(kthread_t *thr)
+{
+    if (thr->kt_state != KT_ON_CPU)
+    {
+        return 0;
+    }
+    size_t core = thr->kt_recent_core;
+    if (core > (size_t)apic_max_id())
+    {
+        /* Never dispatched yet. */
+        return 0;
+    }
+    return *GET_CSD(core, kthread_t *, curthr) == thr;
+}
+
+/*
+ * Formats the latency histograms for every core: one "bucket:count" pair
+ * per nonzero log2 bucket (bucket b covers [2^b, 2^(b+1)) TSC cycles) for
+ * run-queue wait and switch duration, plus the involuntary preemption
+ * counts kept by the timer tick (see util/time.c).
+ */
+size_t sched_latency_info(char *buf, size_t size)
+{
+    size_t off = 0;
+    for (long core = 0; core <= apic_max_id(); core++)
+    {
+        uint64_t *wait = GET_CSD(core, uint64_t, kt_wait_hist);
+        uint64_t *dur = GET_CSD(core, uint64_t, kt_switch_hist);
+        off += snprintf(buf + off, size - off, "C%ld wait", core);
+        for (long b = 0; b < SCHED_LAT_BUCKETS; b++)
+        {
+            if (wait[b])
+            {
+                off += snprintf(buf + off, size - off, " %ld:%lu", b, wait[b]);
+            }
+        }
+        off += snprintf(buf + off, size - off, "\nC%ld switch", core);
+        for (long b = 0; b < SCHED_LAT_BUCKETS; b++)
+        {
+            if (dur[b])
+            {
+                off += snprintf(buf + off, size - off, " %ld:%lu", b, dur[b]);
+            }
+        }
+        off += snprintf(buf + off, size - off,
+                        "\nC%ld preempt kernel %lu user %lu\n", core,
+                        *GET_CSD(core, uint64_t, kernel_preempted_count),
+                        *GET_CSD(core, uint64_t, user_preempted_count));
+    }
+    return off;
+}
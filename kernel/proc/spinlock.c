@@ -1,7 +1,56 @@
 #include "globals.h"
 #include "main/apic.h"
 
-void spinlock_init(spinlock_t *lock) { lock->s_locked = 0; }
+void spinlock_init(spinlock_t *lock)
+{
+    lock->s_locked = 0;
+    lock->s_mcs = 0;
+    lock->s_tail = NULL;
+    lock->s_owner = NULL;
+}
+
+void spinlock_init_mcs(spinlock_t *lock)
+{
+    spinlock_init(lock);
+    lock->s_mcs = 1;
+}
+
+#ifdef __SMP__
+/*
+ * Pool of MCS queue nodes. A core needs one node per MCS lock it holds or
+ * waits on at once; spinlocks nest only a few levels deep, so a small
+ * per-core pool suffices. Nodes are handed out and returned with a per-core
+ * used bitmap - preemption is disabled for the whole hold, so only this
+ * core's interrupt handlers can race us, and the IPL rules for spinlocks
+ * already forbid taking the same lock from both contexts.
+ */
+#define MCS_POOL_SIZE 8
+
+static mcs_node_t mcs_pool[MAX_LAPICS][MCS_POOL_SIZE];
+static unsigned long mcs_pool_used[MAX_LAPICS];
+
+static mcs_node_t *mcs_node_alloc(void)
+{
+    unsigned long *used = &mcs_pool_used[curcore.kc_id];
+    for (long i = 0; i < MCS_POOL_SIZE; i++)
+    {
+        unsigned long bit = 1UL << i;
+        if (!(*used & bit))
+        {
+            *used |= bit;
+            return &mcs_pool[curcore.kc_id][i];
+        }
+    }
+    panic("out of MCS spinlock nodes (MCS locks nested too deep)");
+}
+
+static void mcs_node_free(mcs_node_t *node)
+{
+    long i = node - mcs_pool[curcore.kc_id];
+    KASSERT(i >= 0 && i < MCS_POOL_SIZE);
+    mcs_pool_used[curcore.kc_id] &= ~(1UL << i);
+}
+#endif
 
 inline void spinlock_lock(spinlock_t *lock)
 {
@@ -13,6 +62,34 @@ inline void spinlock_lock(spinlock_t *lock)
     preemption_disable();
     KASSERT(lock->s_locked <= MAX_LAPICS && "using invalid spinlock");
     KASSERT(lock->s_locked != curcore.kc_id + 1 && "double-locking spinlock");
+#if LOCK_PROFILING
+    const void *lp_site = __builtin_return_address(0);
+    uint64_t lp_wait_start = lockprof_ticks();
+#endif
+    if (lock->s_mcs)
+    {
+        /* Queued path: join the tail of the waiter queue and spin only on
+         * our own node, so handoff is FIFO and the lock cacheline is not
+         * ping-ponged between every waiter. */
+        mcs_node_t *node = mcs_node_alloc();
+        node->mn_next = NULL;
+        node->mn_locked = 1;
+        mcs_node_t *prev = __sync_lock_test_and_set(&lock->s_tail, node);
+        if (prev)
+        {
+            prev->mn_next = node;
+            while (node->mn_locked)
+            {
+                __asm__("pause;");
+            }
+        }
+        lock->s_owner = node;
+        lock->s_locked = curcore.kc_id + 1;
+#if LOCK_PROFILING
+        lockprof_locked(&lock->s_lp, lp_site, lp_wait_start);
+#endif
+        return;
+    }
     while (
         !__sync_bool_compare_and_swap(&lock->s_locked, 0, curcore.kc_id + 1))
     {
@@ -24,6 +101,9 @@ inline void spinlock_lock(spinlock_t *lock)
             __asm__("pause;");
         }
     }
+#if LOCK_PROFILING
+    lockprof_locked(&lock->s_lp, lp_site, lp_wait_start);
+#endif
 #endif
 }
 
@@ -32,6 +112,36 @@ inline void spinlock_unlock(spinlock_t *lock)
 #ifdef __SMP__
     __sync_synchronize(); // Put a memory barrier before setting the locked
                           // flag
+#if LOCK_PROFILING
+    lockprof_unlocked(&lock->s_lp);
+#endif
+    if (lock->s_mcs)
+    {
+        mcs_node_t *node = lock->s_owner;
+        KASSERT(node && "unlocking an MCS spinlock we don't hold");
+        lock->s_owner = NULL;
+        lock->s_locked = 0;
+        if (!node->mn_next)
+        {
+            /* No visible successor; try to swing the tail back to empty.
+             * If that fails, a new waiter is mid-enqueue - wait for it to
+             * link itself in so we can hand off. */
+            if (__sync_bool_compare_and_swap(&lock->s_tail, node, NULL))
+            {
+                mcs_node_free(node);
+                preemption_enable();
+                return;
+            }
+            while (!node->mn_next)
+            {
+                __asm__("pause;");
+            }
+        }
+        node->mn_next->mn_locked = 0;
+        mcs_node_free(node);
+        preemption_enable();
+        return;
+    }
     lock->s_locked = 0;
     preemption_enable();
 #endif
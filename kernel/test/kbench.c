@@ -0,0 +1,448 @@
+#include "errno.h"
+#include "globals.h"
+
+#include "test/kbench.h"
+#include "test/kshell/io.h"
+#include "test/kshell/kshell.h"
+
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/slab.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#ifdef __VM__
+#include "mm/mobj.h"
+#include "mm/pframe.h"
+#include "vm/anon.h"
+#endif
+
+#ifdef __VFS__
+#include "fs/fcntl.h"
+#include "fs/file.h"
+#include "fs/lseek.h"
+#include "fs/open.h"
+#include "fs/vfs.h"
+#include "fs/vfs_syscall.h"
+#endif
+
+/*
+ * Microbenchmarks for the kernel's hot primitives, runnable from kshell
+ * ("kbench"). Each benchmark takes KBENCH_SAMPLES timed samples and
+ * reports the median, p99 and max in TSC cycles, so performance changes
+ * can land with before/after numbers.
+ */
+#define KBENCH_SAMPLES 128
+
+static inline uint64_t kb_ticks()
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/*
+ * Headless capture for benchmark-mode boots (see kbench_headless): while
+ * kb_capture is set, kb_printf appends to kb_out instead of writing to
+ * the kshell tty, and kb_report emits one CSV record per benchmark
+ * rather than the human-readable columns.
+ */
+static long kb_capture;
+static char kb_out[2048];
+static size_t kb_out_len;
+
+static void kb_printf(kshell_t *ksh, const char *fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (kb_capture)
+    {
+        size_t len = strnlen(buf, sizeof(buf));
+        if (kb_out_len + len < sizeof(kb_out))
+        {
+            memcpy(kb_out + kb_out_len, buf, len);
+            kb_out_len += len;
+        }
+    }
+    else
+    {
+        kprintf(ksh, "%s", buf);
+    }
+}
+
+/* Insertion sort; the sample arrays are small and the kernel has no qsort. */
+static void kb_sort(uint64_t *samples, size_t n)
+{
+    for (size_t i = 1; i < n; i++)
+    {
+        uint64_t key = samples[i];
+        size_t j = i;
+        while (j > 0 && samples[j - 1] > key)
+        {
+            samples[j] = samples[j - 1];
+            j--;
+        }
+        samples[j] = key;
+    }
+}
+
+static void kb_report(kshell_t *ksh, const char *name, uint64_t *samples,
+                      size_t n)
+{
+    kb_sort(samples, n);
+    if (kb_capture)
+    {
+        kb_printf(ksh, "%s,%lu,%lu,%lu\n", name, samples[n / 2],
+                  samples[(n * 99) / 100], samples[n - 1]);
+    }
+    else
+    {
+        kb_printf(ksh, "%-24s median %10lu  p99 %10lu  max %10lu\n", name,
+                  samples[n / 2], samples[(n * 99) / 100], samples[n - 1]);
+    }
+}
+
+static void kb_slab(kshell_t *ksh)
+{
+    /* Created once and reused across runs: slab_allocator_destroy() does
+     * not unlink the allocator from the global list, so destroying it
+     * here would leave that list dangling. */
+    static slab_allocator_t *kb_allocator = NULL;
+
+    uint64_t samples[KBENCH_SAMPLES];
+    if (!kb_allocator)
+    {
+        kb_allocator = slab_allocator_create("kbench", 256);
+    }
+    if (!kb_allocator)
+    {
+        kb_printf(ksh, "kbench: couldn't create slab allocator, skipping\n");
+        return;
+    }
+
+    /* Warm up so the first sample doesn't just measure slab growth. */
+    void *obj = slab_obj_alloc(kb_allocator);
+    slab_obj_free(kb_allocator, obj);
+
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        obj = slab_obj_alloc(kb_allocator);
+        slab_obj_free(kb_allocator, obj);
+        samples[i] = kb_ticks() - start;
+    }
+    kb_report(ksh, "slab_obj_alloc+free", samples, KBENCH_SAMPLES);
+}
+
+static void kb_page(kshell_t *ksh)
+{
+    uint64_t samples[KBENCH_SAMPLES];
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        void *pages = page_alloc_n(4);
+        if (!pages)
+        {
+            kb_printf(ksh, "kbench: out of pages, skipping\n");
+            return;
+        }
+        page_free_n(pages, 4);
+        samples[i] = kb_ticks() - start;
+    }
+    kb_report(ksh, "page_alloc_n(4)+free", samples, KBENCH_SAMPLES);
+}
+
+static void kb_string(kshell_t *ksh)
+{
+    uint64_t samples[KBENCH_SAMPLES];
+    char *src = page_alloc_n(4);
+    char *dst = page_alloc_n(4);
+    if (!src || !dst)
+    {
+        if (src)
+        {
+            page_free_n(src, 4);
+        }
+        kb_printf(ksh, "kbench: out of pages, skipping\n");
+        return;
+    }
+
+    memset(src, 'x', 4 * PAGE_SIZE);
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        memcpy(dst, src, 4 * PAGE_SIZE);
+        samples[i] = kb_ticks() - start;
+    }
+    kb_report(ksh, "memcpy 16K", samples, KBENCH_SAMPLES);
+
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        memset(dst, 0, 4 * PAGE_SIZE);
+        samples[i] = kb_ticks() - start;
+    }
+    kb_report(ksh, "memset 16K", samples, KBENCH_SAMPLES);
+
+    src[4 * PAGE_SIZE - 1] = '\0';
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        size_t len = strlen(src);
+        samples[i] = kb_ticks() - start;
+        KASSERT(len == 4 * PAGE_SIZE - 1);
+    }
+    kb_report(ksh, "strlen 16K", samples, KBENCH_SAMPLES);
+
+    page_free_n(src, 4);
+    page_free_n(dst, 4);
+}
+
+static void kb_sched(kshell_t *ksh)
+{
+    /* With no other runnable thread, sched_yield() enqueues us and
+     * core_switch() immediately picks us back up - a full round trip
+     * through the scheduler. */
+    uint64_t samples[KBENCH_SAMPLES];
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        sched_yield();
+        samples[i] = kb_ticks() - start;
+    }
+    kb_report(ksh, "sched_switch roundtrip", samples, KBENCH_SAMPLES);
+}
+
+#ifdef __VM__
+static void kb_mobj(kshell_t *ksh)
+{
+    uint64_t samples[KBENCH_SAMPLES];
+    mobj_t *mo = anon_create(); /* returns locked */
+    if (!mo)
+    {
+        kb_printf(ksh, "kbench: couldn't create anon object, skipping\n");
+        return;
+    }
+
+    pframe_t *pf;
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        long ret = mobj_get_pframe(mo, i, 1, &pf);
+        samples[i] = kb_ticks() - start;
+        if (ret)
+        {
+            kb_printf(ksh, "kbench: get_pframe failed (%ld), skipping\n", ret);
+            mobj_put_locked(&mo);
+            return;
+        }
+        pframe_release(&pf);
+    }
+    kb_report(ksh, "mobj_get_pframe miss", samples, KBENCH_SAMPLES);
+
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        long ret = mobj_get_pframe(mo, 0, 1, &pf);
+        samples[i] = kb_ticks() - start;
+        KASSERT(!ret);
+        pframe_release(&pf);
+    }
+    kb_report(ksh, "mobj_get_pframe hit", samples, KBENCH_SAMPLES);
+
+    mobj_put_locked(&mo);
+}
+#endif
+
+#ifdef __VFS__
+/*
+ * Echo loop for the pipe ping-pong: read a byte, write it back, until
+ * the parent sends a zero byte. The child shares the parent's file
+ * descriptors (same scheme as test/pipes.c), so the parent ends the
+ * benchmark with a sentinel rather than by closing the write end.
+ */
+static void *kb_pipe_echo(long arg1, void *arg2)
+{
+    int rfd = (int)arg1;
+    int wfd = (int)(long)arg2;
+    char byte = 0;
+    while (do_read(rfd, &byte, 1) == 1 && byte)
+    {
+        do_write(wfd, &byte, 1);
+    }
+    return NULL;
+}
+
+static void kb_pipe(kshell_t *ksh)
+{
+    uint64_t samples[KBENCH_SAMPLES];
+    int to_child[2];
+    int to_parent[2];
+    if (do_pipe(to_child) < 0 || do_pipe(to_parent) < 0)
+    {
+        kb_printf(ksh, "kbench: couldn't create pipes, skipping\n");
+        return;
+    }
+
+    /* proc_create shares our descriptor table, pipe ends included. */
+    proc_t *proc = proc_create("kbench_echo");
+    kthread_t *thread = kthread_create(proc, kb_pipe_echo, to_child[0],
+                                       (void *)(long)to_parent[1]);
+    sched_make_runnable(thread);
+
+    char byte = 1;
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = kb_ticks();
+        do_write(to_child[1], &byte, 1);
+        do_read(to_parent[0], &byte, 1);
+        samples[i] = kb_ticks() - start;
+    }
+
+    byte = 0;
+    do_write(to_child[1], &byte, 1);
+    do_waitpid(proc->p_pid, NULL, 0);
+
+    do_close(to_child[0]);
+    do_close(to_child[1]);
+    do_close(to_parent[0]);
+    do_close(to_parent[1]);
+
+    kb_report(ksh, "pipe ping-pong", samples, KBENCH_SAMPLES);
+}
+#endif
+
+#ifdef __S5FS__
+#define KB_FILE "/kbench.dat"
+#define KB_FILE_PAGES 16
+
+static void kb_s5fs(kshell_t *ksh)
+{
+    uint64_t samples[KBENCH_SAMPLES];
+    int fd = (int)do_open(KB_FILE, O_CREAT | O_RDWR);
+    if (fd < 0)
+    {
+        kb_printf(ksh, "kbench: couldn't create " KB_FILE ", skipping\n");
+        return;
+    }
+
+    char *buf = page_alloc();
+    if (!buf)
+    {
+        do_close(fd);
+        do_unlink(KB_FILE);
+        kb_printf(ksh, "kbench: out of pages, skipping\n");
+        return;
+    }
+    memset(buf, 0x5a, PAGE_SIZE);
+    for (size_t i = 0; i < KB_FILE_PAGES; i++)
+    {
+        do_write(fd, buf, PAGE_SIZE);
+    }
+
+    do_lseek(fd, 0, SEEK_SET);
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        if (i % KB_FILE_PAGES == 0)
+        {
+            do_lseek(fd, 0, SEEK_SET);
+        }
+        uint64_t start = kb_ticks();
+        do_read(fd, buf, PAGE_SIZE);
+        samples[i] = kb_ticks() - start;
+    }
+    kb_report(ksh, "s5fs seq read 4K", samples, KBENCH_SAMPLES);
+
+    uint64_t lcg = kb_ticks() | 1;
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        lcg = lcg * 6364136223846793005UL + 1442695040888963407UL;
+        off_t block = (off_t)((lcg >> 33) % KB_FILE_PAGES);
+        do_lseek(fd, block * (off_t)PAGE_SIZE, SEEK_SET);
+        uint64_t start = kb_ticks();
+        do_read(fd, buf, PAGE_SIZE);
+        samples[i] = kb_ticks() - start;
+    }
+    kb_report(ksh, "s5fs rand read 4K", samples, KBENCH_SAMPLES);
+
+    page_free(buf);
+    do_close(fd);
+    do_unlink(KB_FILE);
+}
+#endif
+
+long kbench_main(long arg1, void *arg2)
+{
+    kshell_t *ksh = (kshell_t *)arg2;
+    if (kb_capture)
+    {
+        /* A '#' comment line keeps the CSV records trivially parseable. */
+        kb_printf(ksh, "# kbench %d samples, TSC cycles\n", KBENCH_SAMPLES);
+    }
+    else
+    {
+        kb_printf(ksh,
+                  "kbench: %d samples per benchmark, times in TSC cycles\n",
+                  KBENCH_SAMPLES);
+    }
+
+    kb_slab(ksh);
+    kb_page(ksh);
+    kb_string(ksh);
+    kb_sched(ksh);
+#ifdef __VM__
+    kb_mobj(ksh);
+#endif
+#ifdef __VFS__
+    kb_pipe(ksh);
+#endif
+#ifdef __S5FS__
+    kb_s5fs(ksh);
+#endif
+    return 0;
+}
+
+#ifdef __VFS__
+#define KB_OUT_FILE "/kbench.out"
+
+/*
+ * Headless run for benchmark-mode boots (__BENCHMODE__; see Config.mk):
+ * runs the full suite with output captured instead of printed, leaves
+ * one CSV record per benchmark in KB_OUT_FILE on the root file system,
+ * and syncs. The tooling in python/ can then pull the numbers off the
+ * disk image after the VM exits and diff medians across commits.
+ */
+long kbench_headless()
+{
+    kb_out_len = 0;
+    kb_capture = 1;
+    kbench_main(0, NULL);
+    kb_capture = 0;
+
+    long fd = do_open(KB_OUT_FILE, O_CREAT | O_TRUNC | O_WRONLY);
+    if (fd < 0)
+    {
+        dbg(DBG_ERROR, "kbench: couldn't create " KB_OUT_FILE " (%ld)\n", fd);
+        return fd;
+    }
+    long ret = do_write((int)fd, kb_out, kb_out_len);
+    do_close((int)fd);
+    if (ret < 0 || (size_t)ret != kb_out_len)
+    {
+        dbg(DBG_ERROR, "kbench: short write to " KB_OUT_FILE " (%ld)\n", ret);
+        return ret < 0 ? ret : -EIO;
+    }
+    /* The VM powers off right after; make sure the results hit the disk. */
+    do_sync();
+    return 0;
+}
+#endif
@@ -13,8 +13,19 @@
 
 #include "test/kshell/io.h"
 
+#include "drivers/disk/sata.h"
+
+#include "mm/page.h"
+#include "mm/pagetable.h"
+
+#include "proc/lockprof.h"
+#include "proc/proc.h"
+
+#include "util/crashdump.h"
 #include "util/debug.h"
+#include "util/profile.h"
 #include "util/string.h"
+#include "util/trace.h"
 
 list_t kshell_commands_list = LIST_INITIALIZER(kshell_commands_list);
 
@@ -57,6 +68,288 @@ long kshell_halt(kshell_t *ksh, size_t argc, char **argv)
     return 0;
 }
 
+#if LOCK_PROFILING
+
+long kshell_lockstat(kshell_t *ksh, size_t argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "reset"))
+    {
+        lockprof_reset();
+        kprintf(ksh, "lock statistics reset\n");
+        return 0;
+    }
+
+    char *buf = page_alloc();
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+    lockprof_info(buf, PAGE_SIZE);
+    kprintf(ksh, "%s", buf);
+    page_free(buf);
+    return 0;
+}
+
+#endif
+
+#ifndef NDEBUG
+
+#define KSH_DBGLOG_PAGES 4
+
+long kshell_dbglog(kshell_t *ksh, size_t argc, char **argv)
+{
+    uint64_t modes = DBG_ALL;
+    if (argc > 1)
+    {
+        modes = dbg_mode_lookup(argv[1]);
+        if (!modes)
+        {
+            kprintf(ksh, "Unknown debug mode: \"%s\"\n", argv[1]);
+            return 0;
+        }
+    }
+
+    char *buf = page_alloc_n(KSH_DBGLOG_PAGES);
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+    if (!dbg_ring_info(modes, buf, KSH_DBGLOG_PAGES * PAGE_SIZE))
+    {
+        kprintf(ksh, "no retained debug records\n");
+    }
+    else
+    {
+        kprintf(ksh, "%s", buf);
+    }
+    page_free_n(buf, KSH_DBGLOG_PAGES);
+    return 0;
+}
+
+#endif
+
+#define KSH_TRACE_PAGES 16
+
+long kshell_trace(kshell_t *ksh, size_t argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "on"))
+    {
+        trace_enabled = 1;
+        kprintf(ksh, "tracing enabled\n");
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "off"))
+    {
+        trace_enabled = 0;
+        kprintf(ksh, "tracing disabled\n");
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "reset"))
+    {
+        if (trace_enabled)
+        {
+            kprintf(ksh, "disable tracing before resetting\n");
+            return 0;
+        }
+        trace_reset();
+        kprintf(ksh, "trace buffers reset\n");
+        return 0;
+    }
+
+    char *buf = page_alloc_n(KSH_TRACE_PAGES);
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+    if (argc > 1 && !strcmp(argv[1], "points"))
+    {
+        trace_points_info(NULL, buf, KSH_TRACE_PAGES * PAGE_SIZE);
+    }
+    else
+    {
+        trace_records_info(NULL, buf, KSH_TRACE_PAGES * PAGE_SIZE);
+    }
+    kprintf(ksh, "%s", buf);
+    page_free_n(buf, KSH_TRACE_PAGES);
+    return 0;
+}
+
+long kshell_profile(kshell_t *ksh, size_t argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "on"))
+    {
+        profile_enabled = 1;
+        kprintf(ksh, "profiling enabled\n");
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "off"))
+    {
+        profile_enabled = 0;
+        kprintf(ksh, "profiling disabled\n");
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "reset"))
+    {
+        if (profile_enabled)
+        {
+            kprintf(ksh, "disable profiling before resetting\n");
+            return 0;
+        }
+        profile_reset();
+        kprintf(ksh, "profile samples reset\n");
+        return 0;
+    }
+
+    char *buf = page_alloc();
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+    profile_info(NULL, buf, PAGE_SIZE);
+    kprintf(ksh, "%s", buf);
+    page_free(buf);
+    return 0;
+}
+
+#define KSH_CRASHDUMP_PAGES 16
+
+long kshell_crashdump(kshell_t *ksh, size_t argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "clear"))
+    {
+        long ret = crashdump_clear();
+        kprintf(ksh, ret ? "couldn't clear the crash dump (%ld)\n"
+                         : "crash dump cleared\n",
+                ret);
+        return 0;
+    }
+
+    char *buf = page_alloc_n(KSH_CRASHDUMP_PAGES);
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+    if (!crashdump_info(buf, KSH_CRASHDUMP_PAGES * PAGE_SIZE))
+    {
+        kprintf(ksh, "no crash dump recorded\n");
+    }
+    else
+    {
+        kprintf(ksh, "%s", buf);
+    }
+    page_free_n(buf, KSH_CRASHDUMP_PAGES);
+    return 0;
+}
+
+/* Parses a non-negative decimal PID; returns -1 on malformed input. */
+static long ksh_parse_pid(const char *s)
+{
+    long val = 0;
+    if (!*s)
+    {
+        return -1;
+    }
+    for (; *s; s++)
+    {
+        if (*s < '0' || *s > '9')
+        {
+            return -1;
+        }
+        val = val * 10 + (*s - '0');
+    }
+    return val;
+}
+
+static void ksh_ptstat_print(kshell_t *ksh, proc_t *proc, pt_stats_t *stats)
+{
+    kprintf(ksh, "PID %d (%s):\n", proc->p_pid, proc->p_name);
+    kprintf(ksh, "  pages:  4K %lu  2MB %lu  1GB %lu\n", stats->ps_pages_4k,
+            stats->ps_pages_2mb, stats->ps_pages_1gb);
+    kprintf(ksh, "  tables: pdp %lu  pd %lu  pt %lu  empty %lu\n",
+            stats->ps_tables_pdp, stats->ps_tables_pd, stats->ps_tables_pt,
+            stats->ps_tables_empty);
+    kprintf(ksh, "  leaves: user %lu  write %lu  accessed %lu  dirty %lu\n",
+            stats->ps_leaf_user, stats->ps_leaf_write,
+            stats->ps_leaf_accessed, stats->ps_leaf_dirty);
+}
+
+static void ksh_ptstat_diff(kshell_t *ksh, const char *name, size_t a,
+                            size_t b)
+{
+    if (a != b)
+    {
+        kprintf(ksh, "  %-12s %8lu -> %8lu  (%ld)\n", name, a, b,
+                (long)(b - a));
+    }
+}
+
+long kshell_ptstat(kshell_t *ksh, size_t argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        kprintf(ksh, "Usage: ptstat <pid> [pid]\n");
+        return 0;
+    }
+
+    pt_stats_t stats[2];
+    proc_t *procs[2];
+    for (size_t i = 1; i < argc; i++)
+    {
+        long pid = ksh_parse_pid(argv[i]);
+        proc_t *proc = pid < 0 ? NULL : proc_lookup((pid_t)pid);
+        if (!proc)
+        {
+            kprintf(ksh, "ptstat: no such process: %s\n", argv[i]);
+            return 0;
+        }
+        procs[i - 1] = proc;
+        pt_mapping_stats(proc->p_pml4, &stats[i - 1]);
+        ksh_ptstat_print(ksh, proc, &stats[i - 1]);
+    }
+
+    if (argc == 3)
+    {
+        kprintf(ksh, "diff PID %d -> PID %d (changed fields only):\n",
+                procs[0]->p_pid, procs[1]->p_pid);
+        ksh_ptstat_diff(ksh, "4K pages", stats[0].ps_pages_4k,
+                        stats[1].ps_pages_4k);
+        ksh_ptstat_diff(ksh, "2MB pages", stats[0].ps_pages_2mb,
+                        stats[1].ps_pages_2mb);
+        ksh_ptstat_diff(ksh, "1GB pages", stats[0].ps_pages_1gb,
+                        stats[1].ps_pages_1gb);
+        ksh_ptstat_diff(ksh, "pdp tables", stats[0].ps_tables_pdp,
+                        stats[1].ps_tables_pdp);
+        ksh_ptstat_diff(ksh, "pd tables", stats[0].ps_tables_pd,
+                        stats[1].ps_tables_pd);
+        ksh_ptstat_diff(ksh, "pt tables", stats[0].ps_tables_pt,
+                        stats[1].ps_tables_pt);
+        ksh_ptstat_diff(ksh, "empty tables", stats[0].ps_tables_empty,
+                        stats[1].ps_tables_empty);
+        ksh_ptstat_diff(ksh, "user", stats[0].ps_leaf_user,
+                        stats[1].ps_leaf_user);
+        ksh_ptstat_diff(ksh, "write", stats[0].ps_leaf_write,
+                        stats[1].ps_leaf_write);
+        ksh_ptstat_diff(ksh, "accessed", stats[0].ps_leaf_accessed,
+                        stats[1].ps_leaf_accessed);
+        ksh_ptstat_diff(ksh, "dirty", stats[0].ps_leaf_dirty,
+                        stats[1].ps_leaf_dirty);
+    }
+    return 0;
+}
+
+long kshell_disklat(kshell_t *ksh, size_t argc, char **argv)
+{
+    char *buf = page_alloc();
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+    sata_latency_info(buf, PAGE_SIZE);
+    kprintf(ksh, "%s", buf);
+    page_free(buf);
+    return 0;
+}
+
 long kshell_echo(kshell_t *ksh, size_t argc, char **argv)
 {
     if (argc == 1)
@@ -402,3 +695,10 @@ long kshell_s5fstest(kshell_t *ksh, size_t argc, char **argv)
 }
 
 #endif
+
+long kbench_main(long, void *);
+
+long kshell_kbench(kshell_t *ksh, size_t argc, char **argv)
+{
+    return kbench_main(1, ksh);
+}
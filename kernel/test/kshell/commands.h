@@ -1,5 +1,7 @@
 #pragma once
 
+#include "config.h"
+
 #include "test/kshell/kshell.h"
 
 #define KSHELL_CMD(name) \
@@ -30,3 +32,26 @@ KSHELL_CMD(vfs_test);
 #ifdef __S5FS__
 KSHELL_CMD(s5fstest);
 #endif
+
+#if LOCK_PROFILING
+KSHELL_CMD(lockstat);
+#endif
+
+#ifndef NDEBUG
+KSHELL_CMD(dbglog);
+#endif
+
+KSHELL_CMD(trace);
+
+KSHELL_CMD(profile);
+
+KSHELL_CMD(disklat);
+
+KSHELL_CMD(ptstat);
+
+KSHELL_CMD(crashdump);
+
+KSHELL_CMD(kbench);
+
+/* Implemented in kshell.c, next to the job table it reports on. */
+KSHELL_CMD(jobs);
@@ -16,11 +16,15 @@
 
 #include "mm/kmalloc.h"
 
+#include "globals.h"
+#include "proc/kthread.h"
 #include "proc/proc.h"
+#include "proc/sched.h"
 
 #ifdef __VFS__
 
 #include "fs/fcntl.h"
+#include "fs/file.h"
 #include "fs/open.h"
 #include "fs/vfs_syscall.h"
 
@@ -31,6 +35,190 @@
 #include "util/debug.h"
 #include "util/string.h"
 
+#include <ctype.h>
+#include <errno.h>
+
+/*
+ * Background job support. A trailing '&' runs a command in its own
+ * process, so long operations (disk tests, benchmark runs) don't freeze
+ * the console and a benchmark can overlap with monitoring commands.
+ * Finished jobs are reaped and announced just before each prompt, and
+ * the 'jobs' command lists whatever is still outstanding.
+ */
+#define KSH_MAX_JOBS 8
+#define KSH_JOB_LINE_LEN 64
+
+typedef struct kshell_job
+{
+    long jb_id;            /* user-visible job number */
+    pid_t jb_pid;          /* process running the command */
+    long jb_active;        /* slot holds a not-yet-reaped job */
+    volatile long jb_done; /* set by the job thread just before it exits */
+    kshell_t jb_ksh;       /* private copy; output goes to the terminal */
+    kshell_command_t *jb_cmd;
+    size_t jb_argc;
+    char *jb_argv[KSH_MAX_ARGS];
+    char *jb_buf;                   /* heap copy of the argument strings */
+    char jb_line[KSH_JOB_LINE_LEN]; /* command line, for listings */
+} kshell_job_t;
+
+static kshell_job_t kshell_job_table[KSH_MAX_JOBS];
+static long kshell_job_next_id = 1;
+
+static void *kshell_job_run(long arg1, void *arg2)
+{
+    kshell_job_t *job = arg2;
+
+    long retval =
+        job->jb_cmd->kc_cmd_func(&job->jb_ksh, job->jb_argc, job->jb_argv);
+    if (retval < 0)
+    {
+        kprintf(&job->jb_ksh, "kshell: [%ld] %s failed with %ld\n", job->jb_id,
+                job->jb_line, retval);
+    }
+    job->jb_done = 1;
+    return NULL;
+}
+
+/**
+ * Runs a command as a background job in its own process.
+ *
+ * @param ksh the kshell the command was typed into
+ * @param cmd the command to run
+ * @param buf the shell's line buffer, already null-separated into
+ * arguments by kshell_get_args (so argv can be rebased onto a copy)
+ * @param args the argument vector pointing into buf
+ * @param argc the number of arguments
+ * @return 0 on success and <0 on error
+ */
+static long kshell_job_spawn(kshell_t *ksh, kshell_command_t *cmd, char *buf,
+                             char **args, size_t argc)
+{
+    kshell_job_t *job = NULL;
+    for (size_t i = 0; i < KSH_MAX_JOBS; i++)
+    {
+        if (!kshell_job_table[i].jb_active)
+        {
+            job = kshell_job_table + i;
+            break;
+        }
+    }
+    if (!job)
+    {
+        kprintf(ksh, "kshell: Too many background jobs\n");
+        return -EAGAIN;
+    }
+
+    job->jb_buf = kmalloc(KSH_BUF_SIZE + 1);
+    if (!job->jb_buf)
+    {
+        kprintf(ksh, "kshell: Not enough memory for background job\n");
+        return -ENOMEM;
+    }
+
+    /* args[] points into the caller's stack buffer; copy the whole
+     * null-separated argument block and rebase the pointers onto it. */
+    memcpy(job->jb_buf, buf, KSH_BUF_SIZE + 1);
+    job->jb_argc = argc;
+    for (size_t i = 0; i < argc; i++)
+    {
+        job->jb_argv[i] = job->jb_buf + (args[i] - buf);
+    }
+
+    /* Rebuild a printable command line for 'jobs' and the done message. */
+    size_t len = 0;
+    job->jb_line[0] = '\0';
+    for (size_t i = 0; i < argc; i++)
+    {
+        int n = snprintf(job->jb_line + len, KSH_JOB_LINE_LEN - len,
+                         i ? " %s" : "%s", args[i]);
+        if (n < 0 || (size_t)n >= KSH_JOB_LINE_LEN - len)
+        {
+            break;
+        }
+        len += (size_t)n;
+    }
+
+    /* The job writes through its own copy of the kshell, so the parent's
+     * redirection bookkeeping can't pull the descriptor out from under
+     * it. Background output always goes to the terminal. */
+    job->jb_ksh = *ksh;
+#ifdef __VFS__
+    job->jb_ksh.ksh_in_fd = job->jb_ksh.ksh_out_fd = ksh->ksh_fd;
+#endif
+
+    proc_t *proc = proc_create("kshell_job");
+    KASSERT(NULL != proc);
+    /* proc_create shares our descriptor table, so the job already sees
+     * the terminal's descriptor. */
+    kthread_t *thr = kthread_create(proc, kshell_job_run, 0, job);
+    KASSERT(NULL != thr);
+
+    job->jb_cmd = cmd;
+    job->jb_pid = proc->p_pid;
+    job->jb_done = 0;
+    job->jb_id = kshell_job_next_id++;
+    job->jb_active = 1;
+
+    kprintf(ksh, "[%ld] %d\n", job->jb_id, proc->p_pid);
+    sched_make_runnable(thr);
+    return 0;
+}
+
+/**
+ * Reaps background jobs, announcing each one reaped. With wait_all set,
+ * blocks until every outstanding job has finished (used at shell exit,
+ * since jobs hold references to the shell's terminal); otherwise only
+ * jobs that have already finished are reaped.
+ *
+ * Must be called from the shell's own process, as the jobs are its
+ * children.
+ *
+ * @param ksh the kshell
+ * @param wait_all whether to wait for still-running jobs
+ */
+static void kshell_reap_jobs(kshell_t *ksh, long wait_all)
+{
+    for (size_t i = 0; i < KSH_MAX_JOBS; i++)
+    {
+        kshell_job_t *job = kshell_job_table + i;
+        if (!job->jb_active || (!wait_all && !job->jb_done))
+        {
+            continue;
+        }
+
+        int status;
+        do_waitpid(job->jb_pid, &status, 0);
+        kprintf(ksh, "[%ld] Done    %s\n", job->jb_id, job->jb_line);
+
+        kfree(job->jb_buf);
+        job->jb_buf = NULL;
+        job->jb_active = 0;
+    }
+}
+
+long kshell_jobs(kshell_t *ksh, size_t argc, char **argv)
+{
+    long found = 0;
+    for (size_t i = 0; i < KSH_MAX_JOBS; i++)
+    {
+        kshell_job_t *job = kshell_job_table + i;
+        if (!job->jb_active)
+        {
+            continue;
+        }
+        kprintf(ksh, "[%ld] %s %s (pid %d)\n", job->jb_id,
+                job->jb_done ? "Done   " : "Running", job->jb_line,
+                job->jb_pid);
+        found = 1;
+    }
+    if (!found)
+    {
+        kprintf(ksh, "No background jobs\n");
+    }
+    return 0;
+}
+
 void *kshell_proc_run(long tty, void *arg2)
 {
     // Create kernel shell on given TTY
@@ -42,6 +230,9 @@ void *kshell_proc_run(long tty, void *arg2)
 
     while (kshell_execute_next(kshell) > 0)
         ;
+    /* Don't tear down the shell while background jobs still reference
+     * its terminal. */
+    kshell_reap_jobs(kshell, 1);
     kshell_destroy(kshell);
     return NULL;
 }
@@ -70,6 +261,45 @@ void kshell_init()
     kshell_add_command("s5fstest", kshell_s5fstest, "runs S5FS tests");
 #endif
 
+#if LOCK_PROFILING
+    kshell_add_command("lockstat", kshell_lockstat,
+                       "show lock contention statistics (lockstat reset "
+                       "to clear)");
+#endif
+
+#ifndef NDEBUG
+    kshell_add_command("dbglog", kshell_dbglog,
+                       "dump buffered debug records (dbglog [mode] to "
+                       "filter)");
+#endif
+
+    kshell_add_command("kbench", kshell_kbench,
+                       "runs in-kernel microbenchmarks");
+
+    kshell_add_command("trace", kshell_trace,
+                       "event tracing (trace on|off|reset|points, or no "
+                       "argument to dump records)");
+
+    kshell_add_command("profile", kshell_profile,
+                       "statistical profiler (profile on|off|reset, or no "
+                       "argument for the report)");
+
+    kshell_add_command("disklat", kshell_disklat,
+                       "disk command latency report: queue wait vs device "
+                       "time");
+
+    kshell_add_command("ptstat", kshell_ptstat,
+                       "page table mapping census (ptstat <pid> [pid] "
+                       "to diff two processes)");
+
+    kshell_add_command("crashdump", kshell_crashdump,
+                       "show the crash dump from the last panic "
+                       "(crashdump clear to discard it)");
+
+    kshell_add_command("jobs", kshell_jobs,
+                       "list background jobs (append '&' to a command to "
+                       "run it in the background)");
+
     kshell_add_command("halt", kshell_halt, "halts the systems");
     kshell_add_command("exit", kshell_exit, "exits the shell");
 }
@@ -429,6 +659,10 @@ long kshell_execute_next(kshell_t *ksh)
 
     KASSERT(NULL != ksh);
 
+    /* Announce and reap any background jobs that finished since the
+     * last prompt. */
+    kshell_reap_jobs(ksh, 0);
+
     kprintf(ksh, "%s ", kshell_prompt);
 
     if ((nbytes = kshell_read(ksh, buf, KSH_BUF_SIZE)) <= 0)
@@ -450,6 +684,19 @@ long kshell_execute_next(kshell_t *ksh)
         buf[nbytes] = '\0';
     }
 
+    /* A trailing '&' runs the command as a background job. */
+    long background = 0;
+    long end = nbytes - 1;
+    while (end >= 0 && isspace(buf[end]))
+    {
+        end--;
+    }
+    if (end >= 0 && buf[end] == '&')
+    {
+        background = 1;
+        buf[end] = '\0';
+    }
+
     /* Even though we can't redirect I/O to files before VFS, we
      * still want to scrub out any reference to redirection before
      * passing the line off to kshell_get_args */
@@ -486,6 +733,10 @@ long kshell_execute_next(kshell_t *ksh)
     {
         kprintf(ksh, "kshell: %s not a valid command\n", args[0]);
     }
+    else if (background)
+    {
+        kshell_job_spawn(ksh, cmd, buf, args, argc);
+    }
     else
     {
         if ((retval = cmd->kc_cmd_func(ksh, argc, args)) < 0)
@@ -16,21 +16,13 @@
 static kthread_t *make_proc_and_thread(char *name, kthread_func_t func,
                                        int arg1, void *arg2)
 {
+    /* proc_create shares our descriptor table, so the pipe's descriptors
+     * are already visible to the new process. */
     proc_t *proc = proc_create(name);
     if (!proc)
     {
         return NULL;
     }
-
-    int i;
-    for (i = 0; i < NFILES; ++i)
-    {
-        proc->p_files[i] = curproc->p_files[i];
-        if (proc->p_files[i])
-        {
-            fref(proc->p_files[i]);
-        }
-    }
     return kthread_create(proc, func, arg1, arg2);
 }
 
@@ -24,22 +24,29 @@ static void get_file_name(char *buf, size_t sz, long fileno)
     snprintf(buf, sz, "file%ld", fileno);
 }
 
-// Write to a fail forever until it is either filled up or we get an error.
-static long write_until_fail(int fd)
+// With double indirect blocks the maximum file is far bigger than the
+// disk, so tests that used to fill a file to S5_MAX_FILE_SIZE fill to
+// this instead: well into the double-indirect range, but well within the
+// disk.
+#define TEST_FILL_SIZE \
+    ((size_t)(S5_NDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS + 128) * S5_BLOCK_SIZE)
+
+// Write to a file until it reaches limit bytes or we get an error.
+static long write_until_fail(int fd, size_t limit)
 {
     size_t total_written = 0;
     char buf[BIG_BUFSIZE] = {42};
-    while (total_written < S5_MAX_FILE_SIZE)
+    while (total_written < limit)
     {
-        long res = do_write(fd, buf, BIG_BUFSIZE);
+        long res = do_write(fd, buf, MIN(BIG_BUFSIZE, limit - total_written));
         if (res < 0)
         {
             return res;
         }
         total_written += res;
     }
-    KASSERT(total_written == S5_MAX_FILE_SIZE);
-    KASSERT(do_lseek(fd, 0, SEEK_END) == S5_MAX_FILE_SIZE);
+    KASSERT(total_written == limit);
+    KASSERT((size_t)do_lseek(fd, 0, SEEK_END) == limit);
 
     return 0;
 }
@@ -132,39 +139,41 @@ static void test_filling_file()
     int fd = (int)do_open("hugefile", O_RDWR | O_CREAT);
     KASSERT(fd >= 0);
 
-    res = write_until_fail(fd);
+    res = write_until_fail(fd, TEST_FILL_SIZE);
     test_assert(res == 0, "Did not write to entire file");
 
-    // make sure all other writes are unsuccessful/dont complete
+    // make sure a write at the (now huge) maximum file size still fails
     char buf[BIG_BUFSIZE] = {0};
+    test_assert(do_lseek(fd, S5_MAX_FILE_SIZE, SEEK_SET) == S5_MAX_FILE_SIZE,
+                "couldnt seek to max file size");
     res = do_write(fd, buf, sizeof(buf));
-    test_assert(res < 0, "Able to write although the file is full");
+    test_assert(res < 0, "Able to write past the maximum file size");
     test_assert(res == -EFBIG || res == -EINVAL, "Wrong error code");
 
     test_assert(do_close(fd) == 0, "couldnt close hugefile");
     test_assert(do_unlink("hugefile") == 0, "couldnt unlink hugefile");
 }
 
-// Fill up the disk. Apparently to do this, we should need to fill up one
-// entire file, then start to fill up another. We should eventually get
-// the ENOSPC error
+// Fill up the disk. A single file can now outgrow the disk, so writing
+// one file towards the maximum file size must eventually hit ENOSPC, and
+// unlinking it must give all the blocks back.
 static void test_running_out_of_blocks()
 {
     long res = 0;
 
     int fd1 = (int)do_open("fullfile", O_RDWR | O_CREAT);
 
-    res = write_until_fail(fd1);
-    test_assert(res == 0, "Ran out of space quicker than we expected");
+    res = write_until_fail(fd1, S5_MAX_FILE_SIZE);
+    test_assert(res == -ENOSPC, "Did not get nospc error");
     test_assert(do_close(fd1) == 0, "could not close");
+    test_assert(do_unlink("fullfile") == 0, "couldnt do_unlink file");
 
+    // the freed blocks should be usable again
     int fd2 = (int)do_open("partiallyfullfile", O_RDWR | O_CREAT);
-    res = write_until_fail(fd2);
-    test_assert(res == -ENOSPC, "Did not get nospc error");
+    res = write_until_fail(fd2, TEST_FILL_SIZE);
+    test_assert(res == 0, "blocks were not freed by unlink");
 
     test_assert(do_close(fd2) == 0, "could not close");
-
-    test_assert(do_unlink("fullfile") == 0, "couldnt do_unlink file");
     test_assert(do_unlink("partiallyfullfile") == 0, "couldnt do_unlink file");
 }
 
@@ -59,9 +59,8 @@ long test_vmmap() {
         ssize_t start = vmmap_find_range(map, num_pages_per_vmarea, VMMAP_DIR_HILO);
         test_assert(start + num_pages_per_vmarea == prev_start, "Incorrect return value from vmmap_find_range");
         
-        vmarea_t *vma = kmalloc(sizeof(vmarea_t));
+        vmarea_t *vma = vmarea_alloc();
         KASSERT(vma && "Unable to alloc the vmarea");
-        memset(vma, 0, sizeof(vmarea_t));
 
         vma->vma_start = start;
         vma->vma_end = start + num_pages_per_vmarea;
@@ -80,8 +79,8 @@ long test_vmmap() {
     // section start --> HP - (num_vmareas * num_pages_per_vmarea) 
     
     list_iterate(&map->vmm_list, vma, vmarea_t, vma_plink) {
-        list_remove(&vma->vma_plink); 
-        kfree(vma);
+        /* vmarea_free also drops the area from the map's index tree. */
+        vmarea_free(vma);
     }
     ssize_t start = vmmap_find_range(map, 16, VMMAP_DIR_LOHI);
     test_assert(start == ADDR_TO_PN(USER_MEM_LOW), "Range is wonky on the lohi portion");
@@ -0,0 +1,276 @@
+#include "errno.h"
+#include "globals.h"
+
+#include "drivers/blockdev.h"
+#include "drivers/dev.h"
+#include "drivers/disk/sata.h"
+
+#include "main/apic.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/slab.h"
+
+#include "proc/lockprof.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#include "util/crashdump.h"
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+#include "util/time.h"
+#include "util/trace.h"
+
+/* See util/crashdump.h for the overall scheme. */
+
+#define CRASHDUMP_MAGIC "weenix crashdump v1"
+#define CRASHDUMP_SIZE (CRASHDUMP_BLOCKS * SATA_BLOCK_SIZE)
+
+/* How much of the panicking context's stack goes into the dump. */
+#define CRASHDUMP_STACK_BYTES 2048
+
+static blockdev_t *crashdump_bdev;
+
+/* Nonzero once a dump is underway, so a KASSERT firing inside one of the
+ * formatters below cannot recurse back in. */
+static long crashdump_active;
+
+/*
+ * The dump is formatted in place here and then streamed out block by
+ * block. Static rather than stack or heap storage because the panic path
+ * can assume nothing about either; page alignment makes each block one
+ * physically contiguous page, which the polled write path requires.
+ */
+static char crashdump_buf[CRASHDUMP_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+void crashdump_init()
+{
+    blockdev_t *bdev = blockdev_lookup(MKDEVID(DISK_MAJOR, SWAP_DISK_MINOR));
+    if (!bdev)
+    {
+        dbg(DBG_CORE, "crashdump: no disk %d attached; panics will not be "
+                      "dumped\n",
+            SWAP_DISK_MINOR);
+        return;
+    }
+    crashdump_bdev = bdev;
+    dbg(DBG_CORE, "crashdump: %d blocks reserved at block %d of disk %d\n",
+        CRASHDUMP_BLOCKS, CRASHDUMP_FIRST_BLOCK, SWAP_DISK_MINOR);
+}
+
+/* Appends to crashdump_buf at off, returning the new offset; clamps at
+ * the end of the buffer (the tail of the dump is simply truncated). */
+static size_t crashdump_append(size_t off, const char *fmt, ...)
+{
+    if (off >= CRASHDUMP_SIZE - 1)
+    {
+        return CRASHDUMP_SIZE - 1;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(crashdump_buf + off, CRASHDUMP_SIZE - off, fmt, args);
+    va_end(args);
+
+    off += (size_t)len;
+    return off < CRASHDUMP_SIZE - 1 ? off : CRASHDUMP_SIZE - 1;
+}
+
+/* Appends the output of one of the repo's *_info formatters. */
+static size_t crashdump_append_info(size_t off, size_t (*func)(char *, size_t))
+{
+    if (off >= CRASHDUMP_SIZE - 1)
+    {
+        return off;
+    }
+    return off + func(crashdump_buf + off, CRASHDUMP_SIZE - off);
+}
+
+void crashdump_save(const char *file, int line, const char *func,
+                    const char *msg)
+{
+    if (!crashdump_bdev || crashdump_active++)
+    {
+        /* No reserved region, or a panic fired inside the dump itself. */
+        return;
+    }
+
+    uint64_t rsp, rbp;
+    __asm__ volatile("movq %%rsp, %0" : "=r"(rsp));
+    __asm__ volatile("movq %%rbp, %0" : "=r"(rbp));
+
+    memset(crashdump_buf, 0, CRASHDUMP_SIZE);
+    size_t off = crashdump_append(0, CRASHDUMP_MAGIC "\n");
+    off = crashdump_append(off, "jiffies %lu core C%ld pid %ld\n", jiffies,
+                           curcore.kc_id, curproc ? curproc->p_pid : -1L);
+    off = crashdump_append(off, "panic at %s:%d %s(): %s\n", file, line, func,
+                           msg);
+
+    off = crashdump_append(off,
+                           "\n== registers (panicking core) ==\n"
+                           "rsp 0x%lx rbp 0x%lx\n",
+                           rsp, rbp);
+
+    /* Raw stack of the panicking context, innermost frames first. Only
+     * this core's stack is reachable: there is no cross-core
+     * stop-and-capture machinery, and the other cores keep running while
+     * we dump. */
+    if (curthr && curthr->kt_kstack &&
+        rsp >= (uintptr_t)curthr->kt_kstack &&
+        rsp < (uintptr_t)curthr->kt_kstack + DEFAULT_STACK_SIZE)
+    {
+        uintptr_t start = rsp & ~7UL;
+        uintptr_t end = MIN((uintptr_t)curthr->kt_kstack + DEFAULT_STACK_SIZE,
+                            start + CRASHDUMP_STACK_BYTES);
+        off = crashdump_append(off, "\n== stack [0x%lx, 0x%lx) ==\n", start,
+                               end);
+        for (uintptr_t p = start; p < end; p += 8 * 4)
+        {
+            off = crashdump_append(off, "0x%lx:", p);
+            for (uintptr_t q = p; q < p + 8 * 4 && q + 8 <= end; q += 8)
+            {
+                off = crashdump_append(off, " %016lx", *(uint64_t *)q);
+            }
+            off = crashdump_append(off, "\n");
+        }
+    }
+
+    off = crashdump_append(off, "\n== queues ==\nsata depth %lu\n",
+                           sata_queue_depth());
+    for (long core = 0; core <= apic_max_id(); core++)
+    {
+        off = crashdump_append(off, "C%ld runq %lu ctxsw %lu\n", core,
+                               sched_runq_depth(core),
+                               sched_context_switches(core));
+    }
+
+    off = crashdump_append(off, "\n== memory ==\nfree pages %lu\n",
+                           page_free_count());
+    off = crashdump_append(off, "\n== slab ==\n");
+    off = crashdump_append_info(off, slab_allocators_info);
+    off = crashdump_append(off, "\n== kmalloc ==\n");
+    off = crashdump_append_info(off, kmalloc_info);
+
+#if LOCK_PROFILING
+    off = crashdump_append(off, "\n== locks ==\n");
+    off = crashdump_append_info(off, lockprof_info);
+#endif
+
+#ifndef NDEBUG
+    /* dbg_panic has already flushed the rings, but the records are
+     * retained after draining; this is the context leading up to the
+     * crash. */
+    off = crashdump_append(off, "\n== debug log ==\n");
+    if (off < CRASHDUMP_SIZE - 1)
+    {
+        off += dbg_ring_info(DBG_ALL, crashdump_buf + off,
+                             CRASHDUMP_SIZE - off);
+    }
+#endif
+
+    off = crashdump_append(off, "\n== tracepoints ==\n");
+    if (off < CRASHDUMP_SIZE - 1)
+    {
+        off += trace_points_info(NULL, crashdump_buf + off,
+                                 CRASHDUMP_SIZE - off);
+    }
+    off = crashdump_append(off, "\n== trace records ==\n");
+    if (off < CRASHDUMP_SIZE - 1)
+    {
+        off += trace_records_info(NULL, crashdump_buf + off,
+                                  CRASHDUMP_SIZE - off);
+    }
+
+    /* Stream out only the blocks the dump actually reached, plus the
+     * terminating NUL that marks its end for the read-back side. */
+    size_t nblocks = (off + SATA_BLOCK_SIZE) / SATA_BLOCK_SIZE;
+    if (nblocks > CRASHDUMP_BLOCKS)
+    {
+        nblocks = CRASHDUMP_BLOCKS;
+    }
+    long err = 0;
+    for (size_t b = 0; !err && b < nblocks; b++)
+    {
+        err = sata_write_poll(crashdump_bdev,
+                              crashdump_buf + b * SATA_BLOCK_SIZE,
+                              (blocknum_t)(CRASHDUMP_FIRST_BLOCK + b));
+    }
+    if (err)
+    {
+        dbg_print("crashdump: polled write failed (%ld)\n", err);
+    }
+    else
+    {
+        dbg_print("crashdump: %lu bytes in blocks [%d, %lu) of disk %d\n",
+                  off, CRASHDUMP_FIRST_BLOCK, CRASHDUMP_FIRST_BLOCK + nblocks,
+                  SWAP_DISK_MINOR);
+    }
+}
+
+size_t crashdump_info(char *buf, size_t size)
+{
+    KASSERT(0 < size);
+
+    size_t osize = size;
+    buf[0] = '\0';
+    if (!crashdump_bdev)
+    {
+        return 0;
+    }
+
+    char *scratch = page_alloc();
+    if (!scratch)
+    {
+        return 0;
+    }
+
+    for (size_t b = 0; b < CRASHDUMP_BLOCKS && size > 1; b++)
+    {
+        if (crashdump_bdev->bd_ops->read_block(
+                crashdump_bdev, scratch, (blocknum_t)(CRASHDUMP_FIRST_BLOCK + b),
+                1))
+        {
+            break;
+        }
+        if (!b && strncmp(scratch, CRASHDUMP_MAGIC, strlen(CRASHDUMP_MAGIC)))
+        {
+            /* No (or a cleared) dump. */
+            break;
+        }
+        size_t len = strnlen(scratch, SATA_BLOCK_SIZE);
+        long last = len < SATA_BLOCK_SIZE; /* the NUL ends the dump */
+        if (len > size - 1)
+        {
+            len = size - 1;
+        }
+        memcpy(buf, scratch, len);
+        buf += len;
+        size -= len;
+        if (last)
+        {
+            break;
+        }
+    }
+    *buf = '\0';
+    page_free(scratch);
+    return osize - size;
+}
+
+long crashdump_clear()
+{
+    if (!crashdump_bdev)
+    {
+        return -ENODEV;
+    }
+    char *scratch = page_alloc();
+    if (!scratch)
+    {
+        return -ENOMEM;
+    }
+    memset(scratch, 0, PAGE_SIZE);
+    long ret = crashdump_bdev->bd_ops->write_block(
+        crashdump_bdev, scratch, CRASHDUMP_FIRST_BLOCK, 1);
+    page_free(scratch);
+    return ret;
+}
@@ -1,7 +1,12 @@
 #include "main/apic.h"
 #include "main/io.h"
+#include "util/crashdump.h"
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
 #include "util/printf.h"
 #include "util/string.h"
+#include "util/time.h"
 
 /*
  * Debug message behavior.
@@ -109,6 +114,435 @@ void dbg_printinfo(dbg_infofunc_t func, const void *data)
     dbg_puts(buf);
 }
 
+#ifndef NDEBUG
+/*
+ * Ring-buffered debug logging.
+ *
+ * Pushing every dbg() through the polled serial port inline costs
+ * milliseconds per line and serializes every core behind debug_lock, so
+ * enabling debug modes completely changes the timing of whatever is being
+ * debugged. Instead dbg() stores a fixed-size record in a per-core ring
+ * and a low-priority thread drains the rings to the serial port. Writers
+ * reserve a slot with an atomic increment of dr_head and publish it by
+ * storing the slot's sequence number last, so the drain side can tell a
+ * half-written (or since-overwritten) record from a complete one without
+ * taking any lock. Records stay in the ring after they are drained, which
+ * is what the kshell 'dbglog' command dumps.
+ *
+ * Records are binary: the hot path stores the format-string pointer (a
+ * literal in kernel rodata, so it never goes away) and one raw word per
+ * argument, and the format string is only expanded when the record is
+ * drained or dumped. That keeps an enabled log site down to a few stores
+ * instead of a trip through the generic formatter. The one thing that
+ * must be done eagerly is copying %s arguments into the record, since the
+ * pointed-to buffer may be reused long before drain time; formats the
+ * capturer cannot defer (see dbg_ring_capture) fall back to formatting in
+ * place.
+ */
+#define DBG_RING_ENTRIES 128
+#define DBG_RING_ARGS 6
+#define DBG_RING_TEXT 104
+#define DBG_RING_DRAIN_TICKS 10
+
+typedef struct dbg_ring_entry
+{
+    uint64_t de_seq; /* sequence + 1, stored once the record is complete */
+    uint64_t de_jiffies;
+    uint64_t de_mode;
+    const char *de_fmt;  /* format literal to expand lazily, or NULL when
+                          * de_text already holds the formatted body */
+    const char *de_file; /* NULL to omit the file:line func() prefix */
+    const char *de_func;
+    int de_line;
+    pid_t de_pid;
+    uint64_t de_args[DBG_RING_ARGS]; /* one word per conversion */
+    char de_text[DBG_RING_TEXT];     /* %s spill area (each arg word is its
+                                      * offset + 1), or the fallback body */
+} dbg_ring_entry_t;
+
+typedef struct dbg_ring
+{
+    dbg_ring_entry_t dr_entries[DBG_RING_ENTRIES];
+    volatile uint64_t dr_head; /* next sequence number to reserve */
+    uint64_t dr_tail;          /* next sequence number to drain */
+    uint64_t dr_dropped;       /* records overwritten before draining */
+} dbg_ring_t;
+
+static dbg_ring_t dbg_rings[MAX_LAPICS];
+static long dbg_ring_enabled = 0;
+static spinlock_t dbg_ring_lock = SPINLOCK_INITIALIZER(dbg_ring_lock);
+static ktqueue_t dbg_ring_queue;
+
+/*
+ * Captures fmt's arguments as raw words in entry. Varargs are passed in
+ * full 64-bit slots on x86-64, so one word round-trips any integer
+ * conversion regardless of length modifier; %s arguments are copied into
+ * the spill area instead, because the pointed-to storage may be reused
+ * long before the record is formatted. Returns 0 when the record cannot
+ * be deferred - too many arguments, a string too big for the spill space,
+ * or a conversion (%n, dynamic *-widths) that must see the real va_list -
+ * in which case the caller formats eagerly.
+ */
+static long dbg_ring_capture(dbg_ring_entry_t *entry, const char *fmt,
+                             va_list args)
+{
+    long nargs = 0;
+    size_t spill = 0;
+    for (const char *p = fmt; *p; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        p++;
+        while (*p && strchr("-+ #0123456789.hlLzZ", *p))
+        {
+            p++;
+        }
+        switch (*p)
+        {
+        case '%':
+            break;
+        case 's':
+        {
+            if (nargs == DBG_RING_ARGS)
+            {
+                return 0;
+            }
+            const char *s = va_arg(args, const char *);
+            if (!s)
+            {
+                /* A zero arg word formats as NULL (vsnprintf prints
+                 * <NULL> for it, just as it would have at log time). */
+                entry->de_args[nargs++] = 0;
+                break;
+            }
+            size_t len = strnlen(s, DBG_RING_TEXT);
+            if (spill + len + 1 > DBG_RING_TEXT)
+            {
+                return 0;
+            }
+            memcpy(entry->de_text + spill, s, len);
+            entry->de_text[spill + len] = '\0';
+            entry->de_args[nargs++] = spill + 1;
+            spill += len + 1;
+            break;
+        }
+        case 'c':
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        case 'p':
+            if (nargs == DBG_RING_ARGS)
+            {
+                return 0;
+            }
+            entry->de_args[nargs++] = va_arg(args, uint64_t);
+            break;
+        default:
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Expands a record into buf: the C<core> P<pid> and file:line func()
+ * prefix, then the deferred format expansion (or the preformatted body,
+ * for fallback records). Each conversion directive is copied out and
+ * re-run through snprintf against its captured word, which reproduces
+ * the call the log site would have made. Returns the length written;
+ * buf is always terminated.
+ */
+static size_t dbg_ring_format(dbg_ring_entry_t *entry, long core, char *buf,
+                              size_t size)
+{
+    size_t len = (size_t)snprintf(buf, size, "C%ld P%ld ", core,
+                                  (long)entry->de_pid);
+    if (len < size && entry->de_file)
+    {
+        len += (size_t)snprintf(buf + len, size - len, "%s:%d %s(): ",
+                                entry->de_file, entry->de_line,
+                                entry->de_func);
+    }
+    if (!entry->de_fmt)
+    {
+        if (len < size)
+        {
+            len += (size_t)snprintf(buf + len, size - len, "%s",
+                                    entry->de_text);
+        }
+    }
+    else
+    {
+        long arg = 0;
+        char dir[32];
+        const char *p = entry->de_fmt;
+        while (*p && len + 1 < size)
+        {
+            if (*p != '%')
+            {
+                buf[len++] = *p++;
+                continue;
+            }
+            size_t dlen = 0;
+            dir[dlen++] = *p++;
+            while (*p && dlen < sizeof(dir) - 2 &&
+                   strchr("-+ #0123456789.hlLzZ", *p))
+            {
+                dir[dlen++] = *p++;
+            }
+            if (!*p)
+            {
+                break;
+            }
+            char conv = *p++;
+            if (conv == '%')
+            {
+                buf[len++] = '%';
+                continue;
+            }
+            dir[dlen++] = conv;
+            dir[dlen] = '\0';
+            uint64_t word = arg < DBG_RING_ARGS ? entry->de_args[arg++] : 0;
+            if (conv == 's')
+            {
+                /* The word is a spill offset + 1; clamp it so a torn
+                 * record cannot send us outside the entry. */
+                const char *s = NULL;
+                if (word && word <= DBG_RING_TEXT)
+                {
+                    s = entry->de_text + word - 1;
+                }
+                len += (size_t)snprintf(buf + len, size - len, dir, s);
+            }
+            else
+            {
+                len += (size_t)snprintf(buf + len, size - len, dir, word);
+            }
+        }
+    }
+    if (len >= size)
+    {
+        len = size - 1;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+void dbg_log(uint64_t mode, const char *file, int line, const char *func,
+             const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+
+    if (!dbg_ring_enabled)
+    {
+        /* Before the drain thread exists (or after a panic has disabled
+         * the rings) emit synchronously, exactly as dbg() used to. */
+        char buf[BUFFER_SIZE];
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+
+        DEBUG_ENTER
+        dbg_print("%s", dbg_color(mode));
+        dbg_print("C%ld P%ld ", curcore.kc_id, curproc ? curproc->p_pid : -1L);
+        if (file)
+        {
+            dbg_print("%s:%d %s(): ", file, line, func);
+        }
+        dbg_puts(buf);
+        dbg_print("%s", _NORMAL_);
+        DEBUG_EXIT
+        return;
+    }
+
+    dbg_ring_t *ring = &dbg_rings[curcore.kc_id];
+    uint64_t seq = __sync_fetch_and_add(&ring->dr_head, 1);
+    dbg_ring_entry_t *entry = &ring->dr_entries[seq % DBG_RING_ENTRIES];
+
+    /* Invalidate the slot before touching it so the drain side never
+     * mistakes a half-written record for the one it replaced. */
+    entry->de_seq = 0;
+    __sync_synchronize();
+
+    entry->de_jiffies = jiffies;
+    entry->de_mode = mode;
+    entry->de_file = file;
+    entry->de_line = line;
+    entry->de_func = func;
+    entry->de_pid = curproc ? curproc->p_pid : -1;
+
+    /* The fast path is a few stores: the format pointer and one word per
+     * argument. Expansion happens at drain/dump time in dbg_ring_format.
+     * Capture consumes a copy of the va_list so that the fallback still
+     * sees the arguments from the start. */
+    va_list cap;
+    va_copy(cap, args);
+    long captured = dbg_ring_capture(entry, fmt, cap);
+    va_end(cap);
+    if (captured)
+    {
+        entry->de_fmt = fmt;
+    }
+    else
+    {
+        entry->de_fmt = NULL;
+        vsnprintf(entry->de_text, DBG_RING_TEXT, fmt, args);
+        entry->de_text[DBG_RING_TEXT - 1] = '\0';
+    }
+    va_end(args);
+
+    /* Publish: the record is valid once its sequence number appears. */
+    __sync_synchronize();
+    entry->de_seq = seq + 1;
+}
+
+static void dbg_ring_drain(dbg_ring_t *ring)
+{
+    uint64_t head = ring->dr_head;
+
+    if (head > ring->dr_tail + DBG_RING_ENTRIES)
+    {
+        /* The writers lapped us; the oldest records are already gone. */
+        ring->dr_dropped += head - ring->dr_tail - DBG_RING_ENTRIES;
+        ring->dr_tail = head - DBG_RING_ENTRIES;
+    }
+
+    if (ring->dr_dropped)
+    {
+        DEBUG_ENTER
+        dbg_print("dbg: dropped %lu buffered records\n", ring->dr_dropped);
+        DEBUG_EXIT
+        ring->dr_dropped = 0;
+    }
+
+    while (ring->dr_tail != head)
+    {
+        uint64_t idx = ring->dr_tail % DBG_RING_ENTRIES;
+        dbg_ring_entry_t entry = ring->dr_entries[idx];
+        __sync_synchronize();
+        /* Re-check the live slot after the copy: records now carry
+         * pointers, so a torn copy must be discarded, not printed. */
+        if (entry.de_seq != ring->dr_tail + 1 ||
+            ring->dr_entries[idx].de_seq != ring->dr_tail + 1)
+        {
+            /* Half-written, or overwritten between the head sample and the
+             * copy above; either way pick it up on the next pass. */
+            break;
+        }
+        entry.de_text[DBG_RING_TEXT - 1] = '\0';
+
+        char text[BUFFER_SIZE];
+        dbg_ring_format(&entry, ring - dbg_rings, text, sizeof(text));
+
+        DEBUG_ENTER
+        dbg_print("%s[%lu] ", dbg_color(entry.de_mode), entry.de_jiffies);
+        dbg_puts(text);
+        dbg_print("%s", _NORMAL_);
+        DEBUG_EXIT
+
+        ring->dr_tail++;
+    }
+}
+
+static void *dbg_ring_run(long arg1, void *arg2)
+{
+    for (;;)
+    {
+        for (long i = 0; i < MAX_LAPICS; i++)
+        {
+            dbg_ring_drain(&dbg_rings[i]);
+        }
+        spinlock_lock(&dbg_ring_lock);
+        /* releases dbg_ring_lock once we are on the queue */
+        sched_sleep_on_timeout(&dbg_ring_queue, &dbg_ring_lock,
+                               DBG_RING_DRAIN_TICKS);
+    }
+    return NULL;
+}
+
+void dbg_ring_start()
+{
+    sched_queue_init(&dbg_ring_queue);
+
+    proc_t *proc = proc_create("dbg_ring");
+    KASSERT(proc && "couldn't create the debug ring drain process");
+    kthread_t *thr = kthread_create(proc, dbg_ring_run, 0, NULL);
+    KASSERT(thr && "couldn't create the debug ring drain thread");
+
+    dbg_ring_enabled = 1;
+    sched_make_runnable(thr);
+}
+
+void dbg_ring_flush()
+{
+    /* Back to synchronous emission from here on; anything still buffered
+     * goes out now. The panic path uses this so that the buffered context
+     * leading up to a crash appears before the panic message itself. */
+    dbg_ring_enabled = 0;
+    for (long i = 0; i < MAX_LAPICS; i++)
+    {
+        dbg_ring_drain(&dbg_rings[i]);
+    }
+}
+
+uint64_t dbg_mode_lookup(const char *name)
+{
+    dbg_mode_t *mode;
+    for (mode = dbg_tab; mode->d_name != NULL; mode++)
+    {
+        if (strcmp(name, mode->d_name) == 0)
+        {
+            return mode->d_mode;
+        }
+    }
+    return 0;
+}
+
+size_t dbg_ring_info(uint64_t modes, char *buf, size_t size)
+{
+    KASSERT(0 < size);
+
+    size_t osize = size;
+    buf[0] = '\0';
+
+    for (long i = 0; i < MAX_LAPICS; i++)
+    {
+        dbg_ring_t *ring = &dbg_rings[i];
+        uint64_t head = ring->dr_head;
+        uint64_t seq = head > DBG_RING_ENTRIES ? head - DBG_RING_ENTRIES : 0;
+        for (; seq != head; seq++)
+        {
+            dbg_ring_entry_t entry = ring->dr_entries[seq % DBG_RING_ENTRIES];
+            __sync_synchronize();
+            if (entry.de_seq != seq + 1 ||
+                ring->dr_entries[seq % DBG_RING_ENTRIES].de_seq != seq + 1 ||
+                !(entry.de_mode & modes))
+            {
+                continue;
+            }
+            entry.de_text[DBG_RING_TEXT - 1] = '\0';
+
+            char text[BUFFER_SIZE];
+            dbg_ring_format(&entry, i, text, sizeof(text));
+            int len = snprintf(buf, size, "[%lu] %s", entry.de_jiffies, text);
+            if (len >= (int)size)
+            {
+                /* Out of space; report what fit. */
+                return osize - size;
+            }
+            buf += len;
+            size -= (size_t)len;
+        }
+    }
+    return osize - size;
+}
+#endif
+
 #ifndef NDEBUG
 /**
  * searches for <code>name</code> in the list of known
@@ -227,6 +661,12 @@ noreturn void dbg_panic(const char *file, int line, const char *func,
     va_list args;
     va_start(args, fmt);
 
+#ifndef NDEBUG
+    /* Get any buffered records out (and go synchronous) before the panic
+     * message so the context leading up to the crash is not lost. */
+    dbg_ring_flush();
+#endif
+
     DEBUG_ENTER
     dbg_print("C%ld P%ld panic in %s:%u %s(): ", curcore.kc_id,
               curproc ? curproc->p_pid : -1L, file, line, func);
@@ -237,5 +677,9 @@ noreturn void dbg_panic(const char *file, int line, const char *func,
 
     va_end(args);
 
+    /* Best-effort capture of the performance-relevant state for
+     * post-mortem analysis (see util/crashdump.c). */
+    crashdump_save(file, line, func, buf);
+
     dbg_panic_halt();
 }
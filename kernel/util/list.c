@@ -16,11 +16,13 @@ inline long list_link_is_linked(const list_link_t *link)
 
 inline long list_empty(const list_t *list) { return list->l_next == list; }
 
+#if KASSERT_LEVEL >= 2 && !defined(NDEBUG)
 inline void list_assert_sanity(const list_t *list)
 {
     KASSERT(list->l_next && list->l_next->l_prev && list->l_prev &&
             list->l_prev->l_next);
 }
+#endif
 
 inline void list_insert_before(list_link_t *link, list_link_t *to_insert)
 {
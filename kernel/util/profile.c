@@ -0,0 +1,203 @@
+#include "globals.h"
+#include "kernel.h"
+#include "main/apic.h"
+#include "mm/kmalloc.h"
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/profile.h"
+#include "util/string.h"
+
+/* See util/profile.h for the overall scheme. */
+
+/* Slots in each core's sample hash; must be a power of two. */
+#define PROF_SLOTS 2048
+#define PROF_SLOT_BITS 11
+
+/* Functions to show in the report. */
+#define PROF_REPORT_LINES 40
+
+typedef struct prof_slot
+{
+    uintptr_t pf_rip;
+    uint64_t pf_count;
+} prof_slot_t;
+
+typedef struct prof_buf
+{
+    prof_slot_t pb_slots[PROF_SLOTS];
+    uint64_t pb_user;    /* samples that interrupted user mode */
+    uint64_t pb_dropped; /* samples lost to a full hash */
+    uint64_t pb_total;
+} prof_buf_t;
+
+static prof_buf_t prof_bufs[MAX_LAPICS];
+
+long profile_enabled = 0;
+
+void profile_sample(regs_t *regs)
+{
+    prof_buf_t *pb = &prof_bufs[curcore.kc_id];
+    pb->pb_total++;
+
+    if (regs->r_cs & 0x3)
+    {
+        /* User time is lumped together; this profiler only attributes
+         * cycles spent inside the kernel. */
+        pb->pb_user++;
+        return;
+    }
+
+    /* Fibonacci hash with linear probing. This runs in interrupt context,
+     * so it must not allocate or block; a full hash just drops samples. */
+    uintptr_t rip = regs->r_rip;
+    size_t slot = (rip * 11400714819323198485UL) >> (64 - PROF_SLOT_BITS);
+    for (size_t i = 0; i < PROF_SLOTS; i++)
+    {
+        prof_slot_t *s = &pb->pb_slots[(slot + i) & (PROF_SLOTS - 1)];
+        if (s->pf_rip == rip)
+        {
+            s->pf_count++;
+            return;
+        }
+        if (!s->pf_rip)
+        {
+            s->pf_rip = rip;
+            s->pf_count = 1;
+            return;
+        }
+    }
+    pb->pb_dropped++;
+}
+
+void profile_reset()
+{
+    KASSERT(!profile_enabled);
+    memset(prof_bufs, 0, sizeof(prof_bufs));
+}
+
+/*
+ * Returns the index of the symbol covering rip, or -1 if the table is
+ * missing or rip precedes it. nm -n emits the table sorted by address, so
+ * this is a binary search for the greatest ps_addr <= rip.
+ */
+static long profile_symbol(uintptr_t rip)
+{
+    const profsym_t *syms = (const profsym_t *)&kernel_start_profsyms;
+    long nsyms =
+        ((const profsym_t *)&kernel_end_profsyms) - syms;
+
+    long lo = 0;
+    long hi = nsyms - 1;
+    long best = -1;
+    while (lo <= hi)
+    {
+        long mid = (lo + hi) / 2;
+        if (syms[mid].ps_addr <= rip)
+        {
+            best = mid;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return best;
+}
+
+size_t profile_info(const void *data, char *buf, size_t size)
+{
+    KASSERT(NULL == data);
+    KASSERT(0 < size);
+
+    size_t osize = size;
+    buf[0] = '\0';
+
+    const profsym_t *syms = (const profsym_t *)&kernel_start_profsyms;
+    long nsyms = ((const profsym_t *)&kernel_end_profsyms) - syms;
+    if (!nsyms)
+    {
+        return (size_t)snprintf(buf, size, "no symbol table embedded\n");
+    }
+
+    uint64_t *counts = kmalloc((size_t)nsyms * sizeof(uint64_t));
+    if (!counts)
+    {
+        return (size_t)snprintf(buf, size, "out of memory\n");
+    }
+    memset(counts, 0, (size_t)nsyms * sizeof(uint64_t));
+
+    uint64_t total = 0;
+    uint64_t user = 0;
+    uint64_t dropped = 0;
+    uint64_t kernel = 0;
+    uint64_t unknown = 0;
+    for (long i = 0; i < MAX_LAPICS; i++)
+    {
+        prof_buf_t *pb = &prof_bufs[i];
+        total += pb->pb_total;
+        user += pb->pb_user;
+        dropped += pb->pb_dropped;
+        for (size_t s = 0; s < PROF_SLOTS; s++)
+        {
+            if (!pb->pb_slots[s].pf_rip)
+            {
+                continue;
+            }
+            long sym = profile_symbol(pb->pb_slots[s].pf_rip);
+            if (sym < 0)
+            {
+                unknown += pb->pb_slots[s].pf_count;
+            }
+            else
+            {
+                counts[sym] += pb->pb_slots[s].pf_count;
+            }
+            kernel += pb->pb_slots[s].pf_count;
+        }
+    }
+
+    int len = snprintf(buf, size,
+                       "%lu samples (%lu kernel, %lu user, %lu unmapped, "
+                       "%lu dropped)\n",
+                       total, kernel, user, unknown, dropped);
+    if (len >= (int)size)
+    {
+        kfree(counts);
+        return osize - size;
+    }
+    buf += len;
+    size -= (size_t)len;
+
+    /* Repeatedly pull out the hottest remaining function. The table is a
+     * couple thousand entries, so a linear scan per line is plenty fast
+     * for a report. */
+    for (long line = 0; line < PROF_REPORT_LINES && kernel; line++)
+    {
+        long best = -1;
+        for (long sym = 0; sym < nsyms; sym++)
+        {
+            if (counts[sym] && (best < 0 || counts[sym] > counts[best]))
+            {
+                best = sym;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        len = snprintf(buf, size, "%8lu %3lu.%lu%% %s\n", counts[best],
+                       counts[best] * 1000 / kernel / 10,
+                       counts[best] * 1000 / kernel % 10, syms[best].ps_name);
+        if (len >= (int)size)
+        {
+            break;
+        }
+        buf += len;
+        size -= (size_t)len;
+        counts[best] = 0;
+    }
+
+    kfree(counts);
+    return osize - size;
+}
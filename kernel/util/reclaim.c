@@ -0,0 +1,57 @@
+/*
+ * Epoch-based deferred reclamation (quiescent-state based).
+ *
+ * Lock-free readers in this kernel run between blocking points: with
+ * kernel preemption off and a single CPU, a reader that loads a pointer
+ * out of a lock-free structure is done with it before the next context
+ * switch. A writer that unlinks a node therefore cannot free it on the
+ * spot -- the thread it raced with may still be dereferencing it -- but
+ * once the scheduler has run, no reference taken before the unlink can
+ * survive.
+ *
+ * core_switch() is that quiescence point; it calls reclaim_quiesce()
+ * every time a thread leaves the CPU. Deferred nodes wait in the current
+ * epoch's list and are freed when the epoch is retired; two lists rotate
+ * so a node is never freed by the same switch that saw it deferred.
+ *
+ * No locking is needed here: reclaim_defer runs in thread context (never
+ * from an interrupt handler) and reclaim_quiesce runs in the switch path,
+ * so the two never interleave mid-update. A multi-core build would need
+ * per-core quiescence counting before an epoch could retire; the
+ * interface would stay the same, only the grace-period test changes.
+ */
+#include "util/reclaim.h"
+#include "util/debug.h"
+
+static list_t reclaim_epochs[2] = {LIST_INITIALIZER(reclaim_epochs[0]),
+                                   LIST_INITIALIZER(reclaim_epochs[1])};
+static size_t reclaim_cur = 0;
+
+/*
+ * Hand a node to the reclaimer. free_fn runs once every thread that might
+ * have seen the node has passed through the scheduler; the caller must
+ * already have unlinked the node, so no new readers can find it.
+ */
+void reclaim_defer(reclaim_node_t *node, void (*free_fn)(reclaim_node_t *))
+{
+    KASSERT(free_fn);
+    node->rn_free = free_fn;
+    list_link_init(&node->rn_link);
+    list_insert_tail(&reclaim_epochs[reclaim_cur], &node->rn_link);
+}
+
+/*
+ * Declare a quiescent state: everything deferred before the previous
+ * switch has now survived a full grace period and can be freed. Called
+ * from core_switch() with interrupts disabled.
+ */
+void reclaim_quiesce(void)
+{
+    size_t retired = reclaim_cur ^ 1;
+    list_iterate(&reclaim_epochs[retired], node, reclaim_node_t, rn_link)
+    {
+        list_remove(&node->rn_link);
+        node->rn_free(node);
+    }
+    reclaim_cur = retired;
+}
@@ -1,5 +1,6 @@
 #include "ctype.h"
 #include "errno.h"
+#include "types.h"
 
 int memcmp(const void *cs, const void *ct, size_t count)
 {
@@ -25,28 +26,44 @@ int memcmp(const void *cs, const void *ct, size_t count)
 
 void *memcpy(void *dest, const void *src, size_t count)
 {
-    /* Move %ecx bytes from %esi to %edi */
+    const void *s = src;
+    void *d = dest;
+    size_t qwords = count >> 3;
+    size_t rem = count & 7;
+    /* Move the bulk as 8-byte words, then the remainder as bytes;
+     * movsq/movsb leave %rsi and %rdi pointing past what they copied */
     __asm__ volatile(
         "cld\n\t" /* Make sure direction is forwards */
         "rep\n\t"
+        "movsq\n\t"
+        "movq %[rem], %%rcx\n\t"
+        "rep\n\t"
         "movsb"
-        : /* No output */
-        : "S"(src), "D"(dest), "c"(count)
-        : "cc" /* We overwrite condition codes - i.e., flags */
+        : "+S"(s), "+D"(d), "+c"(qwords)
+        : [rem] "r"(rem)
+        : "cc", "memory" /* We overwrite condition codes - i.e., flags */
     );
     return dest;
 }
 
 void *memset(void *s, int c, size_t count)
 {
-    /* Fill %ecx bytes at %edi with %eax (actually %al) */
+    void *d = s;
+    /* Replicate the fill byte into all eight lanes for stosq; stosb
+     * below only looks at %al, which holds the same byte */
+    uint64_t fill = (uint8_t)c * 0x0101010101010101UL;
+    size_t qwords = count >> 3;
+    size_t rem = count & 7;
     __asm__ volatile(
         "cld\n\t" /* Make sure direction is forwards */
         "rep\n\t"
+        "stosq\n\t"
+        "movq %[rem], %%rcx\n\t"
+        "rep\n\t"
         "stosb"
-        : /* No output */
-        : "a"(c), "D"(s), "c"(count)
-        : "cc" /* Overwrite flags */
+        : "+D"(d), "+c"(qwords)
+        : "a"(fill), [rem] "r"(rem)
+        : "cc", "memory" /* Overwrite flags */
     );
     return s;
 }
@@ -131,9 +148,28 @@ char *strcat(char *dest, const char *src)
 
 size_t strlen(const char *s)
 {
-    const char *sc;
+    const char *sc = s;
+
+    /* Walk up to an 8-byte boundary one byte at a time. */
+    while ((uintptr_t)sc & 7)
+    {
+        if (*sc == '\0')
+        {
+            return sc - s;
+        }
+        sc++;
+    }
+
+    /* Scan a word at a time: (w - 0x01...) & ~w & 0x80... is nonzero
+     * exactly when some byte of w is zero. Reading the whole aligned
+     * word is safe - it cannot cross a page boundary. */
+    const uint64_t *w = (const uint64_t *)sc;
+    while (!((*w - 0x0101010101010101UL) & ~*w & 0x8080808080808080UL))
+    {
+        w++;
+    }
 
-    for (sc = s; *sc != '\0'; ++sc)
+    for (sc = (const char *)w; *sc != '\0'; ++sc)
     {
         /* nothing */}
         return sc - s;
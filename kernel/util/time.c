@@ -3,7 +3,9 @@
 #include "main/apic.h"
 #include "proc/sched.h"
 #include "util/printf.h"
+#include "util/profile.h"
 #include "util/timer.h"
+#include "vm/timepage.h"
 #include <drivers/screen.h>
 
 #define TIME_APIC_TICK_FREQUENCY 16
@@ -12,16 +14,61 @@
 
 volatile uint64_t jiffies;
 uint64_t timer_tickcount CORE_SPECIFIC_DATA;
-uint64_t kernel_preempted_count CORE_SPECIFIC_DATA;
-uint64_t user_preempted_count CORE_SPECIFIC_DATA;
+uint64_t kernel_preempted_count CORE_SPECIFIC_DATA_REMOTE;
+uint64_t user_preempted_count CORE_SPECIFIC_DATA_REMOTE;
 uint64_t not_preempted_count CORE_SPECIFIC_DATA;
 uint64_t idle_count CORE_SPECIFIC_DATA;
 
+/*
+ * Adaptive preemption quantum, in timer ticks. The hardware tick rate
+ * stays fixed (jiffies and every timer depend on it); what adapts is how
+ * many ticks a thread runs before the tick handler preempts it, chosen
+ * from this core's run-queue depth. A thread alone on its core gets the
+ * long slice - preempting it would only switch back to itself - while a
+ * deep queue preempts every tick to keep latency down.
+ */
+#define TIME_SLICE_MAX_TICKS 16 /* nothing else runnable on this core */
+#define TIME_SLICE_TICKS 4      /* lightly contended */
+#define TIME_SLICE_MIN_TICKS 1  /* deeply queued */
+
+/* Grace window granted past slice expiry while the thread holds a hot
+ * mutex (see kmutex_mark_hot); bounded so a misbehaving holder cannot
+ * monopolize the core. */
+#define TIME_SLICE_DEFER_TICKS 2
+
+static uint64_t time_slice_ticks CORE_SPECIFIC_DATA;
+static uint64_t time_slice_defer CORE_SPECIFIC_DATA;
+
+void time_slice_reset()
+{
+    time_slice_ticks = 0;
+    time_slice_defer = 0;
+}
+
+static uint64_t _time_slice_length()
+{
+    size_t depth = sched_runq_depth(curcore.kc_id);
+    if (depth == 0)
+    {
+        return TIME_SLICE_MAX_TICKS;
+    }
+    if (depth < 4)
+    {
+        return TIME_SLICE_TICKS;
+    }
+    return TIME_SLICE_MIN_TICKS;
+}
+
 // (freq / 16) interrupts per millisecond
 static long timer_tick_handler(regs_t *regs)
 {
     timer_tickcount++;
 
+    if (profile_enabled)
+    {
+        profile_sample(regs);
+    }
+
 #ifdef __VGABUF__
     if (timer_tickcount % 128 == 0)
         screen_flush();
@@ -30,10 +77,45 @@ static long timer_tick_handler(regs_t *regs)
     if (curcore.kc_id == 0)
     {
         jiffies = timer_tickcount;
+        timepage_tick(timer_tickcount, MICROSECONDS_PER_APIC_TICK);
         __timers_fire();
     }
 
+    /* Charge the running thread's deadline budget, if it is in the
+     * class (see sched_set_deadline). */
+    sched_deadline_tick();
+
 #ifdef __KPREEMPT__ // if (preemption_enabled()) {
+    if (!curthr)
+    {
+        idle_count++;
+        return 0;
+    }
+    /* Let the thread keep the CPU until its slice (sized by run-queue
+     * depth; see _time_slice_length) is used up. The counter is reset at
+     * every dispatch (see core_switch), and the length is re-evaluated
+     * every tick, so a fresh arrival on the queue shortens the slice
+     * immediately. */
+    if (++time_slice_ticks < _time_slice_length())
+    {
+        not_preempted_count++;
+        return 0;
+    }
+    /* Lock-hold preemption deferral: switching out a thread that holds a
+     * hot mutex (the root directory's lock; see kmutex_mark_hot) would
+     * convoy every lookup system-wide behind the sleeping holder, so
+     * give it a short grace window to finish the critical section. The
+     * holder pays the slice back by yielding at the release. */
+    if (curthr->kt_hot_locks && time_slice_defer < TIME_SLICE_DEFER_TICKS)
+    {
+        time_slice_defer++;
+        time_slice_ticks--;
+        curthr->kt_defer_pending = 1;
+        not_preempted_count++;
+        return 0;
+    }
+    time_slice_ticks = 0;
+    time_slice_defer = 0;
     (regs->r_cs & 0x3) ? user_preempted_count++ : kernel_preempted_count++;
     apic_eoi();
     if (regs->r_cs & 0x3 && curthr->kt_cancelled)
@@ -178,6 +260,11 @@ static void do_wakeup(uint64_t arg)
     spinlock_unlock(&thr->kt_lock);
 }
 
+uint64_t time_usec_to_ticks(uint64_t usec)
+{
+    return usec / MICROSECONDS_PER_APIC_TICK;
+}
+
 long do_usleep(useconds_t usec)
 {
     ktqueue_t waitq;
@@ -187,7 +274,7 @@ long do_usleep(useconds_t usec)
     timer_init(&timer);
     timer.function = do_wakeup;
     timer.data = (uint64_t)curthr;
-    timer.expires = jiffies + (usec / MICROSECONDS_PER_APIC_TICK);
+    timer.expires = jiffies + time_usec_to_ticks(usec);
 
     spinlock_lock(&curthr->kt_lock);
     timer_add(&timer);
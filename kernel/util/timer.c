@@ -1,59 +1,150 @@
 #include "util/timer.h"
+#include "globals.h"
+#include "main/apic.h"
+#include "main/smp.h"
 #include "proc/spinlock.h"
 #include "util/time.h"
 
+/*
+ * Armed timers live in a hashed timer wheel: bucket (tick & mask) holds
+ * every timer due at a tick congruent to that slot, so a firing pass only
+ * scans the buckets for the ticks that have elapsed since the previous
+ * pass, making it O(expired + slot collisions) rather than O(armed).
+ *
+ * To keep timer_add/timer_mod from serializing every core on one lock,
+ * each core first parks newly armed timers in a core-local insertion
+ * buffer under its own lock; the firing core drains all of the buffers
+ * into the wheel at the start of each pass. A timer's core field records
+ * which buffer (if any) currently holds it, so timer_del knows which lock
+ * covers the timer.
+ */
+#define TIMER_WHEEL_BUCKETS 64
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_BUCKETS - 1)
+
+typedef struct timer_buffer
+{
+    long tb_enabled;
+    spinlock_t tb_lock;
+    list_t tb_timers;
+} timer_buffer_t;
+
+static timer_buffer_t timer_buffer CORE_SPECIFIC_DATA_REMOTE;
+
 static timer_t *timer_running = NULL;
-static uint64_t timer_next_expiry = -1;
-static list_t timers_primary = LIST_INITIALIZER(timers_primary);
-static list_t timers_secondary = LIST_INITIALIZER(timers_secondary);
+static list_t timer_wheel[TIMER_WHEEL_BUCKETS];
+static list_t timer_fire_list = LIST_INITIALIZER(timer_fire_list);
+/* number of timers in the wheel and on the fire list */
+static size_t timer_wheel_count = 0;
+static uint64_t timer_last_tick = 0;
 static spinlock_t timers_spinlock = SPINLOCK_INITIALIZER(timers_spinlock);
-static int timers_firing = 0;
+
+void timers_init()
+{
+    for (size_t i = 0; i < TIMER_WHEEL_BUCKETS; i++)
+    {
+        list_init(&timer_wheel[i]);
+    }
+}
+
+void timers_enable()
+{
+    spinlock_init(&timer_buffer.tb_lock);
+    list_init(&timer_buffer.tb_timers);
+    timer_buffer.tb_enabled = 1;
+}
 
 void timer_init(timer_t *timer)
 {
     timer->expires = -1;
+    timer->core = TIMER_CORE_NONE;
     list_link_init(&timer->link);
 }
 
 void timer_add(timer_t *timer) { timer_mod(timer, timer->expires); }
 
+/* Unlink the timer from whatever list it is on; the caller must hold the
+ * lock covering the timer (see timer->core). */
 int __timer_del(timer_t *timer)
 {
     int ret = 0;
     if (list_link_is_linked(&timer->link))
     {
         list_remove(&timer->link);
+        if (timer->core == TIMER_CORE_NONE)
+        {
+            timer_wheel_count--;
+        }
         ret = 1;
     }
     return ret;
 }
 
+/*
+ * Lock whichever list currently holds the timer and unlink it. The timer
+ * can migrate from an insertion buffer to the wheel between the snapshot
+ * of timer->core and taking the lock, so recheck and retry.
+ */
 int timer_del(timer_t *timer)
 {
-    spinlock_lock(&timers_spinlock);
-    int ret = __timer_del(timer);
-    spinlock_unlock(&timers_spinlock);
-
-    return ret;
+    for (;;)
+    {
+        long core = timer->core;
+        if (core == TIMER_CORE_NONE)
+        {
+            spinlock_lock(&timers_spinlock);
+            if (timer->core == TIMER_CORE_NONE)
+            {
+                int ret = __timer_del(timer);
+                spinlock_unlock(&timers_spinlock);
+                return ret;
+            }
+            spinlock_unlock(&timers_spinlock);
+        }
+        else
+        {
+            timer_buffer_t *tb = GET_CSD(core, timer_buffer_t, timer_buffer);
+            spinlock_lock(&tb->tb_lock);
+            if (timer->core == core)
+            {
+                int ret = __timer_del(timer);
+                timer->core = TIMER_CORE_NONE;
+                spinlock_unlock(&tb->tb_lock);
+                return ret;
+            }
+            spinlock_unlock(&tb->tb_lock);
+        }
+    }
 }
 
+/* Hang the timer on the wheel; timers_spinlock must be held. Timers whose
+ * expiry has already passed go in the next tick's bucket. */
 void __timer_add(timer_t *timer)
 {
     KASSERT(!list_link_is_linked(&timer->link));
-    list_t *list = timers_firing ? &timers_secondary : &timers_primary;
-    list_insert_head(list, &timer->link);
+    uint64_t tick = MAX(timer->expires, timer_last_tick + 1);
+    list_insert_head(&timer_wheel[tick & TIMER_WHEEL_MASK], &timer->link);
+    timer->core = TIMER_CORE_NONE;
+    timer_wheel_count++;
 }
 
 int timer_mod(timer_t *timer, int expires)
 {
-    spinlock_lock(&timers_spinlock);
-
+    int ret = timer_del(timer);
     timer->expires = expires;
-    int ret = __timer_del(timer);
-    __timer_add(timer);
-    timer_next_expiry = MIN(timer_next_expiry, timer->expires);
-
-    spinlock_unlock(&timers_spinlock);
+    if (timer_buffer.tb_enabled)
+    {
+        spinlock_lock(&timer_buffer.tb_lock);
+        list_insert_head(&timer_buffer.tb_timers, &timer->link);
+        timer->core = curcore.kc_id;
+        spinlock_unlock(&timer_buffer.tb_lock);
+    }
+    else
+    {
+        /* Early boot, before this core's buffer is set up. */
+        spinlock_lock(&timers_spinlock);
+        __timer_add(timer);
+        spinlock_unlock(&timers_spinlock);
+    }
     return ret;
 }
 
@@ -68,24 +159,42 @@ int timer_pending(timer_t *timer)
 int timer_del_sync(timer_t *timer)
 {
     /* Not great performance wise... */
-    spinlock_lock(&timers_spinlock);
-    while (timer_running == timer)
+    for (;;)
     {
-        spinlock_unlock(&timers_spinlock);
-        sched_yield();
+        long core = timer->core;
+        if (core != TIMER_CORE_NONE)
+        {
+            /* Parked in an insertion buffer, so it cannot be running. */
+            timer_buffer_t *tb = GET_CSD(core, timer_buffer_t, timer_buffer);
+            spinlock_lock(&tb->tb_lock);
+            if (timer->core == core)
+            {
+                int ret = __timer_del(timer);
+                timer->core = TIMER_CORE_NONE;
+                spinlock_unlock(&tb->tb_lock);
+                return ret;
+            }
+            spinlock_unlock(&tb->tb_lock);
+            continue;
+        }
         spinlock_lock(&timers_spinlock);
+        if (timer->core != TIMER_CORE_NONE)
+        {
+            spinlock_unlock(&timers_spinlock);
+            continue;
+        }
+        if (timer_running == timer)
+        {
+            spinlock_unlock(&timers_spinlock);
+            sched_yield();
+            continue;
+        }
+        int ret = __timer_del(timer);
+        spinlock_unlock(&timers_spinlock);
+        return ret;
     }
-
-    int ret = __timer_del(timer);
-    spinlock_unlock(&timers_spinlock);
-
-    return ret;
 }
 
-/* Note: using a linked-list rather than some priority is terribly inefficient
- * Also this implementation is just bad. Sorry.
- */
-int ready = 0;
 void __timers_fire()
 {
     if (curthr && !preemption_enabled())
@@ -94,44 +203,69 @@ void __timers_fire()
     }
 
     spinlock_lock(&timers_spinlock);
-    timers_firing = 1;
 
-    //dbg(DBG_PRINT, "next expiry: %d\n", timer_next_expiry);
-    if (jiffies < timer_next_expiry)
+    /* Drain every core's insertion buffer into the wheel. */
+    for (long i = 0; i <= apic_max_id(); i++)
+    {
+        timer_buffer_t *tb = GET_CSD(i, timer_buffer_t, timer_buffer);
+        if (!tb->tb_enabled)
+        {
+            continue;
+        }
+        spinlock_lock(&tb->tb_lock);
+        list_iterate(&tb->tb_timers, timer, timer_t, link)
+        {
+            list_remove(&timer->link);
+            __timer_add(timer);
+        }
+        spinlock_unlock(&tb->tb_lock);
+    }
+
+    uint64_t now = jiffies;
+    if (!timer_wheel_count)
     {
-        timers_firing = 0;
+        timer_last_tick = now;
         spinlock_unlock(&timers_spinlock);
         return;
     }
 
-    uint64_t min_expiry = 0;
-
-    list_iterate(&timers_primary, timer, timer_t, link)
+    /* Collect expired timers from the buckets for the elapsed ticks. Each
+     * slot repeats every TIMER_WHEEL_BUCKETS ticks, so a span longer than
+     * that covers every bucket once. */
+    uint64_t start = timer_last_tick + 1;
+    if (now >= start)
     {
-        if (jiffies >= timer->expires)
+        if (now - start >= TIMER_WHEEL_BUCKETS)
         {
-            list_remove(&timer->link);
-            timer_running = timer;
-            spinlock_unlock(&timers_spinlock);
-            timer->function(timer->data);
-            spinlock_lock(&timers_spinlock);
-            timer_running = NULL;
+            start = now - TIMER_WHEEL_BUCKETS + 1;
         }
-        else
+        for (uint64_t tick = start; tick <= now; tick++)
         {
-            min_expiry = MIN(min_expiry, timer->expires);
+            list_iterate(&timer_wheel[tick & TIMER_WHEEL_MASK], timer, timer_t,
+                         link)
+            {
+                if (timer->expires <= now)
+                {
+                    list_remove(&timer->link);
+                    list_insert_tail(&timer_fire_list, &timer->link);
+                }
+            }
         }
+        timer_last_tick = now;
     }
 
-    /* migrate from the backup list to the primary list */
-    list_iterate(&timers_secondary, timer, timer_t, link)
+    /* Fire them one at a time, dropping the lock around the callback so it
+     * can arm or delete timers itself. */
+    while (!list_empty(&timer_fire_list))
     {
-        min_expiry = MIN(min_expiry, timer->expires);
-        list_remove(&timer->link);
-        list_insert_head(&timers_primary, &timer->link);
+        timer_t *timer = list_head(&timer_fire_list, timer_t, link);
+        __timer_del(timer);
+        timer_running = timer;
+        spinlock_unlock(&timers_spinlock);
+        timer->function(timer->data);
+        spinlock_lock(&timers_spinlock);
+        timer_running = NULL;
     }
 
-    timer_next_expiry = min_expiry;
-    timers_firing = 0;
     spinlock_unlock(&timers_spinlock);
 }
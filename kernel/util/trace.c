@@ -0,0 +1,124 @@
+#include "globals.h"
+#include "main/apic.h"
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+#include "util/trace.h"
+
+/*
+ * See util/trace.h for the overall scheme. The rings use the same lock-free
+ * protocol as the debug log rings in util/debug.c: a writer reserves a slot
+ * with an atomic increment of the head, fills it in, and publishes it by
+ * storing the slot's sequence number last, so readers can tell a complete
+ * record from a half-written or overwritten one without taking a lock.
+ * Unlike the debug rings nothing drains these; old records are simply
+ * overwritten, and extraction reads whatever window is still retained.
+ */
+
+#define TRACE_RING_ENTRIES 512
+
+typedef struct trace_ring
+{
+    trace_record_t tr_records[TRACE_RING_ENTRIES];
+    volatile uint64_t tr_head; /* next sequence number to reserve */
+} trace_ring_t;
+
+static trace_ring_t trace_rings[MAX_LAPICS];
+
+long trace_enabled = 0;
+
+static inline uint64_t trace_ticks()
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void trace_emit(trace_point_t *tp, uint64_t arg0, uint64_t arg1)
+{
+    trace_ring_t *ring = &trace_rings[curcore.kc_id];
+    uint64_t seq = __sync_fetch_and_add(&ring->tr_head, 1);
+    trace_record_t *rec = &ring->tr_records[seq % TRACE_RING_ENTRIES];
+
+    /* Invalidate the slot before touching it so a reader never mistakes a
+     * half-written record for the one it replaced. */
+    rec->tr_seq = 0;
+    __sync_synchronize();
+
+    rec->tr_tsc = trace_ticks();
+    rec->tr_point = tp;
+    rec->tr_arg0 = arg0;
+    rec->tr_arg1 = arg1;
+    __sync_fetch_and_add(&tp->tp_hits, 1);
+
+    __sync_synchronize();
+    rec->tr_seq = seq + 1;
+}
+
+void trace_reset()
+{
+    KASSERT(!trace_enabled);
+    memset(trace_rings, 0, sizeof(trace_rings));
+    for (trace_point_t *tp = (trace_point_t *)&kernel_start_tracepoint;
+         tp < (trace_point_t *)&kernel_end_tracepoint; tp++)
+    {
+        tp->tp_hits = 0;
+    }
+}
+
+size_t trace_points_info(const void *data, char *buf, size_t size)
+{
+    KASSERT(NULL == data);
+    KASSERT(0 < size);
+
+    size_t osize = size;
+    buf[0] = '\0';
+
+    for (trace_point_t *tp = (trace_point_t *)&kernel_start_tracepoint;
+         tp < (trace_point_t *)&kernel_end_tracepoint; tp++)
+    {
+        int len = snprintf(buf, size, "%-24s %lu\n", tp->tp_name, tp->tp_hits);
+        if (len >= (int)size)
+        {
+            break;
+        }
+        buf += len;
+        size -= (size_t)len;
+    }
+    return osize - size;
+}
+
+size_t trace_records_info(const void *data, char *buf, size_t size)
+{
+    KASSERT(NULL == data);
+    KASSERT(0 < size);
+
+    size_t osize = size;
+    buf[0] = '\0';
+
+    for (long i = 0; i < MAX_LAPICS; i++)
+    {
+        trace_ring_t *ring = &trace_rings[i];
+        uint64_t head = ring->tr_head;
+        uint64_t seq = head > TRACE_RING_ENTRIES ? head - TRACE_RING_ENTRIES : 0;
+        for (; seq != head; seq++)
+        {
+            trace_record_t *rec = &ring->tr_records[seq % TRACE_RING_ENTRIES];
+            if (rec->tr_seq != seq + 1)
+            {
+                continue;
+            }
+            int len =
+                snprintf(buf, size, "C%ld %lu %s 0x%lx 0x%lx\n", i, rec->tr_tsc,
+                         rec->tr_point->tp_name, rec->tr_arg0, rec->tr_arg1);
+            if (len >= (int)size)
+            {
+                /* Out of space; report what fit. */
+                return osize - size;
+            }
+            buf += len;
+            size -= (size_t)len;
+        }
+    }
+    return osize - size;
+}
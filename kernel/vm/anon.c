@@ -1,34 +1,59 @@
 #include "mm/mobj.h"
 #include "mm/page.h"
+#include "mm/pagemerged.h"
+#include "mm/pagezerod.h"
 #include "mm/pframe.h"
 #include "mm/slab.h"
+#include "mm/swap.h"
+#include "mm/swapcomp.h"
 
 #include "util/debug.h"
 #include "util/string.h"
 
 /* for debugging/verification purposes */
-int anon_count = 0; 
+int anon_count = 0;
 
 static slab_allocator_t *anon_allocator;
 
+/*
+ * The system-wide zero frame. Read faults on pages of an anonymous object
+ * that have never been written all resolve to this one frame, so sparse
+ * heaps cost no physical memory until they are actually written. It is
+ * never attached to any mobj (so the pageout daemon ignores it) and is
+ * only ever mapped read-only; the first write fault goes through the
+ * forwrite path, which allocates a real private frame.
+ */
+static pframe_t *anon_zero_frame;
+
+static long anon_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
+                            pframe_t **pfp);
+
 static long anon_fill_pframe(mobj_t *o, pframe_t *pf);
 
 static long anon_flush_pframe(mobj_t *o, pframe_t *pf);
 
 static void anon_destructor(mobj_t *o);
 
-static mobj_ops_t anon_mobj_ops = {.get_pframe = NULL,
+static mobj_ops_t anon_mobj_ops = {.get_pframe = anon_get_pframe,
                                    .fill_pframe = anon_fill_pframe,
                                    .flush_pframe = anon_flush_pframe,
                                    .destructor = anon_destructor};
 
 /*
- * Initialize anon_allocator using the slab allocator.
+ * Initialize anon_allocator using the slab allocator, and set up the
+ * shared zero frame.
  */
 void anon_init()
 {
     anon_allocator = slab_allocator_create("anon", sizeof(mobj_t));
     KASSERT(anon_allocator);
+
+    anon_zero_frame = pframe_create();
+    KASSERT(anon_zero_frame && "couldn't create the zero frame");
+    anon_zero_frame->pf_addr = page_alloc();
+    KASSERT(anon_zero_frame->pf_addr && "couldn't allocate the zero page");
+    ppage_set_owner(anon_zero_frame->pf_addr, anon_zero_frame);
+    memset(anon_zero_frame->pf_addr, 0, PAGE_SIZE);
 }
 
 /*
@@ -39,16 +64,87 @@ mobj_t *anon_create()
 {
     mobj_t* anon = slab_obj_alloc(anon_allocator);
     mobj_init(anon, MOBJ_ANON, &anon_mobj_ops);
+    anon->mo_swappable = 1;
     mobj_lock(anon);
     return anon;
 }
 
-/* 
+/*
+ * For a write, fall through to mobj_default_get_pframe to materialize a
+ * private frame. For a read, return the resident frame if one exists;
+ * otherwise hand back the shared zero frame, deferring the allocation to
+ * the first write fault (see handle_pagefault, which maps read faults
+ * read-only).
+ */
+static long anon_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
+                            pframe_t **pfp)
+{
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    if (forwrite)
+    {
+        return mobj_default_get_pframe(o, pagenum, forwrite, pfp);
+    }
+    mobj_find_pframe(o, pagenum, pfp);
+    if (*pfp)
+    {
+        if (!(*pfp)->pf_addr)
+        {
+            if ((*pfp)->pf_merge)
+            {
+                /* Deduplicated: serve the shared frame directly, just
+                 * like the zero frame - it gets mapped read-only, and
+                 * the first write fault materializes a private copy. */
+                pframe_t *shared = pagemerged_shared_frame((*pfp)->pf_merge);
+                pframe_release(pfp);
+                *pfp = shared;
+                return 0;
+            }
+            /* Swapped out; the default path refinds the placeholder and
+             * fills it back in through anon_fill_pframe. */
+            pframe_release(pfp);
+            return mobj_default_get_pframe(o, pagenum, forwrite, pfp);
+        }
+        return 0;
+    }
+    kmutex_lock(&anon_zero_frame->pf_mutex);
+    *pfp = anon_zero_frame;
+    return 0;
+}
+
+/*
  * This function is not complicated -- think about what the pframe should look
- * like for an anonymous object 
+ * like for an anonymous object
  */
 static long anon_fill_pframe(mobj_t *o, pframe_t *pf)
 {
+    /* A frame with a pooled compressed copy or a swap slot was paged
+     * out; its contents come from that copy, not the zero page. Likewise
+     * a deduplicated frame's contents come from its shared frame. */
+    if (pf->pf_comp)
+    {
+        return swapcomp_in(pf);
+    }
+    if (pf->pf_swap_slot)
+    {
+        return swap_in(pf);
+    }
+    if (pf->pf_merge)
+    {
+        return pagemerged_copy_in(pf);
+    }
+    /* If the pre-zero daemon has a page ready, swap it in for the one our
+     * caller just allocated: a pointer exchange instead of the memset,
+     * whenever the system has had any idle time to spend (see
+     * mm/pagezerod.c). */
+    void *zeroed = pagezerod_claim();
+    if (zeroed)
+    {
+        ppage_set_owner(pf->pf_addr, NULL);
+        page_free(pf->pf_addr);
+        pf->pf_addr = zeroed;
+        ppage_set_owner(pf->pf_addr, pf);
+        return 0;
+    }
     memset(pf->pf_addr, 0, PAGE_SIZE);
     return 0;
 }
@@ -133,6 +133,7 @@ long do_brk(void *addr, void **ret)
                 return -ENOMEM;
             }
             heap->vma_end = endpage;
+            vmmap_area_resized(heap);
             curproc->p_brk = addr;
             if (ret) {
                 *ret = curproc->p_brk;
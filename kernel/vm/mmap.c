@@ -6,6 +6,8 @@
 #include "globals.h"
 #include "mm/mm.h"
 #include "mm/mman.h"
+#include "mm/mobj.h"
+#include "mm/pframe.h"
 #include "mm/tlb.h"
 #include "util/debug.h"
 
@@ -183,4 +185,90 @@ long do_munmap(void *addr, size_t len)
     KASSERT(lopage != endpage); // Your math is bad
     long status = vmmap_remove(curproc->p_vmmap, lopage, endpage - lopage);
     return status;
+}
+
+/*
+ * This function implements an mlock(2)-style syscall: fault in every page
+ * of [addr, addr + len) up front and mark the vmareas it touches as
+ * pinned, so a latency-critical process can never lose the region to a
+ * page fault or to the pageout daemon mid-request.
+ *
+ * Pinning is tracked at vmarea granularity (the whole area is flagged,
+ * not just the requested pages). The eviction exemption itself rides on
+ * pf_mapped, the flag the pageout daemon's victim scan already refuses
+ * to touch; populating the range sets it on every frame.
+ *
+ * Return 0 on success, or:
+ *  - EINVAL: addr is not page aligned, len is 0, or the range is outside
+ *    the user address space
+ *  - ENOMEM: part of the range is unmapped, or a page couldn't be
+ *    brought in
+ */
+long do_mlock(void *addr, size_t len)
+{
+    if (!PAGE_ALIGNED(addr) || len == 0) {
+        return -EINVAL;
+    }
+    if ((uintptr_t) addr < USER_MEM_LOW || len > USER_MEM_HIGH ||
+        (uintptr_t) addr + len > USER_MEM_HIGH) {
+        return -EINVAL;
+    }
+    size_t lopage = ADDR_TO_PN(addr);
+    size_t endpage = ADDR_TO_PN(PAGE_ALIGN_UP((uintptr_t) addr + len));
+    size_t pn = lopage;
+    while (pn < endpage) {
+        vmarea_t* area = vmmap_lookup(curproc->p_vmmap, pn);
+        if (!area) {
+            return -ENOMEM;
+        }
+        size_t stop = MIN(endpage, area->vma_end);
+        for (; pn < stop; pn++) {
+            pframe_t* pf = NULL;
+            mobj_lock(area->vma_obj);
+            long ret = mobj_get_pframe(area->vma_obj,
+                                       area->vma_off + pn - area->vma_start,
+                                       (area->vma_prot & PROT_WRITE) != 0,
+                                       &pf);
+            mobj_unlock(area->vma_obj);
+            if (ret) {
+                return -ENOMEM;
+            }
+            pf->pf_mapped = 1;
+            pframe_release(&pf);
+        }
+        area->vma_flags |= MAP_PINNED;
+    }
+    return 0;
+}
+
+/*
+ * Undo do_mlock: clear the pinned flag on every vmarea overlapping the
+ * range. Frames that are already resident stay resident (they are still
+ * mapped); only the guarantee for pages the kernel has yet to see lapses.
+ *
+ * Return 0 on success, or -EINVAL for the same cases as do_mlock.
+ */
+long do_munlock(void *addr, size_t len)
+{
+    if (!PAGE_ALIGNED(addr) || len == 0) {
+        return -EINVAL;
+    }
+    if ((uintptr_t) addr < USER_MEM_LOW || len > USER_MEM_HIGH ||
+        (uintptr_t) addr + len > USER_MEM_HIGH) {
+        return -EINVAL;
+    }
+    size_t pn = ADDR_TO_PN(addr);
+    size_t endpage = ADDR_TO_PN(PAGE_ALIGN_UP((uintptr_t) addr + len));
+    while (pn < endpage) {
+        vmarea_t* area = vmmap_lookup(curproc->p_vmmap, pn);
+        if (!area) {
+            /* Nothing mapped here; skip to the next page and keep
+             * unpinning whatever the rest of the range covers. */
+            pn++;
+            continue;
+        }
+        area->vma_flags &= ~MAP_PINNED;
+        pn = area->vma_end;
+    }
+    return 0;
 }
\ No newline at end of file
@@ -8,6 +8,14 @@
 #include "mm/tlb.h"
 #include "types.h"
 #include "util/debug.h"
+#include "util/trace.h"
+
+/*
+ * Fault entry and exit sites; exit is only reached on success (error paths
+ * exit the process), so pairing the two gives fault service latency.
+ */
+TRACEPOINT(pagefault_entry);
+TRACEPOINT(pagefault_exit);
 
 /*
  * Respond to a user mode pagefault by setting up the desired page.
@@ -49,6 +57,7 @@ void handle_pagefault(uintptr_t vaddr, uintptr_t cause)
 {
     dbg(DBG_VM, "vaddr = 0x%p (0x%p), cause = %lu\n", (void *)vaddr,
         PAGE_ALIGN_DOWN(vaddr), cause);
+    TRACE(pagefault_entry, vaddr, cause);
     size_t page = ADDR_TO_PN(vaddr);
     if (vaddr < USER_MEM_LOW) {
         do_exit(EFAULT);
@@ -74,6 +83,37 @@ void handle_pagefault(uintptr_t vaddr, uintptr_t cause)
     if (cause & FAULT_WRITE) {
         forwrite = 1;
     }
+    /* Another of this process's threads may be mid-fork: vmmap_clone marks
+     * the map copy-pending while it snapshots it, and a write serviced in
+     * that window would land in an object the child is about to share.
+     * Wait the clone out before touching vma_obj; read faults cannot
+     * diverge the two maps and are not held up. */
+    while (forwrite && curproc->p_vmmap->vmm_clone_pending) {
+        sched_yield();
+    }
+    if (!forwrite) {
+        /* Fast path for read faults on pages that are already resident and
+         * mapped elsewhere (e.g. a soft-unmapped PTE after fork): look the
+         * frame up through the mobj's hash index under its spinlock alone,
+         * skipping the mobj and pframe mutexes entirely. A miss (or a
+         * frame that isn't safely reusable, see mobj_fast_lookup_mapped)
+         * just falls through to the locked path below. */
+        void* addr = mobj_fast_lookup_mapped(
+            lookup->vma_obj, lookup->vma_off + page - lookup->vma_start);
+        if (addr) {
+            uintptr_t paddr = pt_virt_to_phys((uintptr_t)addr);
+            if (!pt_map(curproc->p_pml4, paddr,
+                        (uintptr_t)PAGE_ALIGN_DOWN(vaddr),
+                        PT_PRESENT | PT_USER | PT_WRITE,
+                        PT_PRESENT | PT_USER)) {
+                tlb_flush((uintptr_t)PAGE_ALIGN_DOWN(vaddr));
+                TRACE(pagefault_exit, vaddr, cause);
+                return;
+            }
+            /* pt_map could not get a table page; the locked path will
+             * produce the proper error handling. */
+        }
+    }
     pframe_t* pfp;
     mobj_lock(lookup->vma_obj);
     long status = mobj_get_pframe(lookup->vma_obj, lookup->vma_off + page - lookup->vma_start, forwrite, &pfp);
@@ -82,6 +122,9 @@ void handle_pagefault(uintptr_t vaddr, uintptr_t cause)
         do_exit(EFAULT);
     }
     uintptr_t paddr = pt_virt_to_phys((uintptr_t) pfp->pf_addr);
+    /* Pin the frame against pageout; with no reverse mappings, a frame that
+     * has made it into a page table can never be reclaimed. */
+    pfp->pf_mapped = 1;
     pframe_release(&pfp);
     uint32_t ptflags = PT_PRESENT | PT_USER;
     if (cause & FAULT_WRITE) {
@@ -92,4 +135,9 @@ void handle_pagefault(uintptr_t vaddr, uintptr_t cause)
         do_exit(EFAULT);
     }
     tlb_flush((uintptr_t) PAGE_ALIGN_DOWN(vaddr));
+    /* A served fault is evidence of use; every few faults, check whether
+     * this spot's 2MB window has become fully resident and can be
+     * collapsed into a single huge mapping. */
+    vmmap_try_promote_huge(lookup, page);
+    TRACE(pagefault_exit, vaddr, cause);
 }
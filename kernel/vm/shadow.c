@@ -1,12 +1,24 @@
 #include "vm/shadow.h"
 #include "mm/page.h"
+#include "mm/pagemerged.h"
 #include "mm/pframe.h"
 #include "mm/slab.h"
+#include "mm/swap.h"
+#include "mm/swapcomp.h"
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
 #include "util/debug.h"
 #include "util/string.h"
 
 #define SHADOW_SINGLETON_THRESHOLD 5
 
+/* Chains deeper than this are queued for the flattening daemon when they
+ * grow (see shadow_create), which bounds the walk in shadow_get_pframe
+ * even under fork-bomb-like workloads. */
+#define SHADOW_FLATTEN_THRESHOLD 8
+
 typedef struct mobj_shadow
 {
     // the mobj parts of this shadow object
@@ -19,12 +31,81 @@ typedef struct mobj_shadow
     // this should NEVER be a shadow object (i.e. it should have some type other
     // than MOBJ_SHADOW)
     mobj_t *bottom_mobj;
+    // number of shadow objects in the chain rooted at this object,
+    // including itself; maintained by shadow_create and shadow_collapse
+    size_t depth;
+    // link on the flattening daemon's work list; a queued object holds an
+    // extra reference so it cannot be destroyed while waiting
+    list_link_t flatten_link;
 } mobj_shadow_t;
 
 #define MOBJ_TO_SO(o) CONTAINER_OF(o, mobj_shadow_t, mobj)
 
 static slab_allocator_t *shadow_allocator;
 
+static list_t shadowd_list = LIST_INITIALIZER(shadowd_list);
+static spinlock_t shadowd_lock = SPINLOCK_INITIALIZER(shadowd_lock);
+static ktqueue_t shadowd_queue;
+static long shadowd_ready = 0;
+
+/* Hand the given shadow object to the flattening daemon. Safe to call with
+ * any mutexes held; the daemon does the blocking work. */
+static void _shadowd_enqueue(mobj_shadow_t *so)
+{
+    if (!shadowd_ready)
+    {
+        return;
+    }
+    spinlock_lock(&shadowd_lock);
+    if (!list_link_is_linked(&so->flatten_link))
+    {
+        mobj_ref(&so->mobj);
+        list_insert_tail(&shadowd_list, &so->flatten_link);
+        sched_broadcast_on(&shadowd_queue);
+    }
+    spinlock_unlock(&shadowd_lock);
+}
+
+static void *shadowd_run(long arg1, void *arg2)
+{
+    dbg(DBG_PROC, "shadowd: running\n");
+    for (;;)
+    {
+        spinlock_lock(&shadowd_lock);
+        while (list_empty(&shadowd_list))
+        {
+            /* sched_sleep_on releases shadowd_lock once we're on the queue */
+            sched_sleep_on(&shadowd_queue, &shadowd_lock);
+            spinlock_lock(&shadowd_lock);
+        }
+        mobj_shadow_t *so =
+            list_head(&shadowd_list, mobj_shadow_t, flatten_link);
+        list_remove(&so->flatten_link);
+        spinlock_unlock(&shadowd_lock);
+
+        mobj_t *o = &so->mobj;
+        mobj_lock(o);
+        shadow_collapse(o);
+        dbg(DBG_VM, "shadowd: chain now %lu deep\n", so->depth);
+        mobj_unlock(o);
+        mobj_put(&o);
+    }
+    return NULL;
+}
+
+void shadowd_start()
+{
+    sched_queue_init(&shadowd_queue);
+
+    proc_t *proc = proc_create("shadowd");
+    KASSERT(proc && "couldn't create the shadow flattening daemon");
+    kthread_t *thr = kthread_create(proc, shadowd_run, 0, NULL);
+    KASSERT(thr && "couldn't create the shadow flattening daemon's thread");
+
+    shadowd_ready = 1;
+    sched_make_runnable(thr);
+}
+
 static long shadow_get_pframe(mobj_t *o, size_t pagenum, long forwrite,
                               pframe_t **pfp);
 static long shadow_fill_pframe(mobj_t *o, pframe_t *pf);
@@ -68,16 +149,23 @@ mobj_t *shadow_create(mobj_t *shadowed)
     if (shadowed->mo_type == MOBJ_SHADOW) {
         mobj_shadow_t* shadowed_shadow = MOBJ_TO_SO(shadowed);
         shadow->bottom_mobj = shadowed_shadow->bottom_mobj;
+        shadow->depth = shadowed_shadow->depth + 1;
     } else {
         shadow->bottom_mobj = shadowed;
+        shadow->depth = 1;
     }
     shadow->shadowed = shadowed;
+    list_link_init(&shadow->flatten_link);
     mobj_init(&shadow->mobj, MOBJ_SHADOW, &shadow_mobj_ops);
+    shadow->mobj.mo_swappable = 1;
     mobj_ref(shadow->shadowed);
     mobj_ref(shadow->bottom_mobj);
     mobj_lock(&shadow->mobj);
     KASSERT(shadow->bottom_mobj->mo_type != MOBJ_SHADOW);
     KASSERT(shadow->mobj.mo_refcount == 1);
+    if (shadow->depth > SHADOW_FLATTEN_THRESHOLD) {
+        _shadowd_enqueue(shadow);
+    }
     return &shadow->mobj;
 }
 
@@ -97,33 +185,51 @@ mobj_t *shadow_create(mobj_t *shadowed)
  */
 void shadow_collapse(mobj_t *o)
 {
-    mobj_shadow_t* shadow = MOBJ_TO_SO(o);
-    mobj_t* current = shadow->shadowed;
-    while (current != NULL && shadow->shadowed->mo_type == MOBJ_SHADOW) {
-        // shadow = MOBJ_TO_SO(current); // Maybe uncomment this, but I don't think so
-        if (shadow->shadowed->mo_refcount == 1) {
-            mobj_lock(shadow->shadowed);
-            list_iterate(&shadow->shadowed->mo_pframes, frame, pframe_t, pf_link) {
-                pframe_t* found = NULL;
-                mobj_lock(current);
-                mobj_find_pframe(current, frame->pf_pagenum, &found);
-                mobj_unlock(current);
-                if (!found) {
-                    list_remove(&frame->pf_link);
-                    list_insert_tail(&current->mo_pframes, &frame->pf_link);
-                } else {
-                    pframe_release(&found);
-                }
+    KASSERT(o->mo_type == MOBJ_SHADOW);
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    /* Walk the chain from o toward the bottom. Any shadow link whose only
+     * reference is the one held by the link above it can be merged upward:
+     * migrate its pframes into that link and splice it out of the chain. */
+    mobj_t* current = o;
+    while (MOBJ_TO_SO(current)->shadowed->mo_type == MOBJ_SHADOW) {
+        mobj_shadow_t* cur_so = MOBJ_TO_SO(current);
+        mobj_t* victim = cur_so->shadowed;
+        if (victim->mo_refcount != 1) {
+            /* Still shared with a sibling chain; try further down. */
+            current = victim;
+            continue;
+        }
+        if (current != o) {
+            mobj_lock(current);
+        }
+        mobj_lock(victim);
+        list_iterate(&victim->mo_pframes, frame, pframe_t, pf_link) {
+            pframe_t* found = NULL;
+            mobj_find_pframe(current, frame->pf_pagenum, &found);
+            if (!found) {
+                mobj_detach_pframe(victim, frame);
+                mobj_attach_pframe(current, frame);
+            } else {
+                pframe_release(&found);
             }
-            mobj_shadow_t* sub_shadow = MOBJ_TO_SO(shadow->shadowed);
-            mobj_t* pointer_to_removed = &sub_shadow->mobj;
-            shadow->shadowed = sub_shadow->shadowed;
-            KASSERT(pointer_to_removed->mo_refcount);
-            mobj_put_locked(&pointer_to_removed);
-        } else {
-            current = shadow->shadowed;
-        }  
+        }
+        cur_so->shadowed = MOBJ_TO_SO(victim)->shadowed;
+        /* Take our own reference on the new shadowed object before the
+         * victim's destructor puts the one the victim held. */
+        mobj_ref(cur_so->shadowed);
+        if (current != o) {
+            mobj_unlock(current);
+        }
+        KASSERT(victim->mo_refcount == 1);
+        mobj_put_locked(&victim);
+    }
+    /* The chain may have shortened; refresh o's cached depth. */
+    size_t depth = 1;
+    for (mobj_t* iter = MOBJ_TO_SO(o)->shadowed; iter->mo_type == MOBJ_SHADOW;
+         iter = MOBJ_TO_SO(iter)->shadowed) {
+        depth++;
     }
+    MOBJ_TO_SO(o)->depth = depth;
 }
 
 /*
@@ -165,6 +271,22 @@ static long shadow_get_pframe(mobj_t *o, size_t pagenum, long forwrite,
     } else {
         mobj_find_pframe(o, pagenum, pfp);
         if (*pfp) {
+            if (!(*pfp)->pf_addr && (*pfp)->pf_merge) {
+                /* Deduplicated: serve the shared frame directly, zero-
+                 * frame style; it gets mapped read-only, and the first
+                 * write fault materializes a private copy. */
+                pframe_t* shared = pagemerged_shared_frame((*pfp)->pf_merge);
+                pframe_release(pfp);
+                *pfp = shared;
+                return 0;
+            }
+            /* The copy may be swapped out (pf_addr == NULL); read it
+             * back in before handing it to the caller. */
+            long status = mobj_materialize_pframe(o, *pfp);
+            if (status) {
+                pframe_release(pfp);
+                return status;
+            }
             KASSERT(kmutex_owns_mutex(&o->mo_mutex));
             return 0;
         }
@@ -172,11 +294,25 @@ static long shadow_get_pframe(mobj_t *o, size_t pagenum, long forwrite,
         while (current != NULL && current->mo_type == MOBJ_SHADOW) {
             mobj_lock(current);
             mobj_find_pframe(current, pagenum, pfp);
-            mobj_unlock(current);
             if (*pfp) {
+                if (!(*pfp)->pf_addr && (*pfp)->pf_merge) {
+                    pframe_t* shared =
+                        pagemerged_shared_frame((*pfp)->pf_merge);
+                    pframe_release(pfp);
+                    mobj_unlock(current);
+                    *pfp = shared;
+                    return 0;
+                }
+                long status = mobj_materialize_pframe(current, *pfp);
+                mobj_unlock(current);
+                if (status) {
+                    pframe_release(pfp);
+                    return status;
+                }
                 KASSERT(kmutex_owns_mutex(&o->mo_mutex));
                 return 0;
             }
+            mobj_unlock(current);
             shadow = MOBJ_TO_SO(current);
             KASSERT(shadow->shadowed != current);
             current = shadow->shadowed;
@@ -216,16 +352,45 @@ static long shadow_fill_pframe(mobj_t *o, pframe_t *pf)
     mobj_t* current = shadow->shadowed;
     pframe_t* found;
     KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    /* A frame with a pooled compressed copy or a swap slot is this
+     * object's own copy, paged out; it comes back from that copy, not
+     * from the chain. The same goes for a deduplicated frame and its
+     * shared frame. */
+    if (pf->pf_comp) {
+        return swapcomp_in(pf);
+    }
+    if (pf->pf_swap_slot) {
+        return swap_in(pf);
+    }
+    if (pf->pf_merge) {
+        return pagemerged_copy_in(pf);
+    }
     while (current != NULL && current->mo_type == MOBJ_SHADOW) {
         mobj_lock(current);
         mobj_find_pframe(current, pf->pf_pagenum, &found);
-        mobj_unlock(current);
         if (found) {
+            if (!found->pf_addr && found->pf_merge) {
+                /* A deduplicated copy can be read straight out of its
+                 * shared frame; no need to materialize it. */
+                pagemerged_copy_from(found->pf_merge, pf->pf_addr);
+                mobj_unlock(current);
+                pframe_release(&found);
+                KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+                return 0;
+            }
+            /* The chain's copy may itself be swapped out. */
+            long status = mobj_materialize_pframe(current, found);
+            mobj_unlock(current);
+            if (status) {
+                pframe_release(&found);
+                return status;
+            }
             memcpy(pf->pf_addr, found->pf_addr, PAGE_SIZE);
             pframe_release(&found);
             KASSERT(kmutex_owns_mutex(&o->mo_mutex));
             return 0;
         }
+        mobj_unlock(current);
         shadow = MOBJ_TO_SO(current);
         current = shadow->shadowed;
     }
@@ -240,6 +405,66 @@ static long shadow_fill_pframe(mobj_t *o, pframe_t *pf)
     return status;
 }
 
+/*
+ * Check whether pf, a resident private copy belonging to the shadow object
+ * o, is byte-for-byte identical to the copy the chain below o would supply
+ * anyway. This happens after heavy fork/COW activity when the write that
+ * triggered the copy restored the same bytes (checkpoint-and-restore being
+ * the classic offender): the private page then pins memory that serving
+ * the ancestor's copy would not. Returns 1 if the copy is redundant and
+ * can simply be dropped - shadow_get_pframe falls through the chain when
+ * an object has no frame, so a dropped copy reverts to the ancestor
+ * mapping - and 0 otherwise.
+ *
+ * Conservative on anything that would cost I/O: if the nearest ancestor
+ * copy is neither resident nor deduplicated, the comparison is skipped
+ * and the frame kept. The compare itself is a single early-exit pass;
+ * without a cached signature to reject against (pagemerged only hashes
+ * its own pool), a separate checksum pass would read both pages in full
+ * before memcmp did the same work again.
+ *
+ * o and pf must both be locked, and pf must not be mapped anywhere - the
+ * caller is about to free the frame, and any page tables still pointing
+ * at it would go stale.
+ */
+long shadow_pframe_redundant(mobj_t *o, pframe_t *pf)
+{
+    KASSERT(o->mo_type == MOBJ_SHADOW);
+    KASSERT(kmutex_owns_mutex(&o->mo_mutex));
+    KASSERT(kmutex_owns_mutex(&pf->pf_mutex));
+    KASSERT(!pf->pf_mapped);
+    if (!pf->pf_addr || pf->pf_merge || pf->pf_swap_slot || pf->pf_comp) {
+        return 0;
+    }
+    mobj_t* current = MOBJ_TO_SO(o)->shadowed;
+    while (current != NULL) {
+        pframe_t* found = NULL;
+        mobj_lock(current);
+        mobj_find_pframe(current, pf->pf_pagenum, &found);
+        if (found) {
+            long same = 0;
+            if (found->pf_addr) {
+                same = !memcmp(pf->pf_addr, found->pf_addr, PAGE_SIZE);
+            } else if (found->pf_merge) {
+                /* A deduplicated ancestor copy can be compared straight
+                 * against its shared frame. */
+                pframe_t* shared = pagemerged_shared_frame(found->pf_merge);
+                same = !memcmp(pf->pf_addr, shared->pf_addr, PAGE_SIZE);
+                pframe_release(&shared);
+            }
+            pframe_release(&found);
+            mobj_unlock(current);
+            return same;
+        }
+        mobj_unlock(current);
+        if (current->mo_type != MOBJ_SHADOW) {
+            break;
+        }
+        current = MOBJ_TO_SO(current)->shadowed;
+    }
+    return 0;
+}
+
 /*
  * Flush a shadow object's pframe to disk.
  *
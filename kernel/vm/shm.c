@@ -0,0 +1,169 @@
+#include "vm/shm.h"
+
+#include "errno.h"
+#include "globals.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/mobj.h"
+#include "mm/tlb.h"
+
+#include "vm/anon.h"
+#include "vm/vmmap.h"
+
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+/*
+ * The registry of named shared-memory objects. Each live entry holds one
+ * reference on its anonymous mobj; every mapping made through do_shmat()
+ * holds another (taken by vmmap_map_mobj and dropped on munmap / address
+ * space teardown), so removing an entry never pulls memory out from
+ * under a process that still has it mapped.
+ */
+typedef struct shm_object
+{
+    char shm_name[SHM_NAME_LEN];
+    mobj_t *shm_obj;
+    size_t shm_npages;
+    long shm_in_use;
+} shm_object_t;
+
+static shm_object_t shm_table[SHM_MAX_OBJECTS];
+static spinlock_t shm_lock = SPINLOCK_INITIALIZER(shm_lock);
+
+long do_shmget(const char *name, size_t size)
+{
+    if (!name[0] || !size)
+    {
+        return -EINVAL;
+    }
+    if (strlen(name) >= SHM_NAME_LEN)
+    {
+        return -ENAMETOOLONG;
+    }
+    size_t npages = ADDR_TO_PN(PAGE_ALIGN_UP(size));
+
+    /* Create the object before taking the table lock (the slab layer has
+     * its own locking); if the name turns out to exist we just drop it. */
+    mobj_t *obj = anon_create();
+    if (!obj)
+    {
+        return -ENOMEM;
+    }
+    mobj_unlock(obj);
+
+    spinlock_lock(&shm_lock);
+    long free_id = -1;
+    for (long id = 0; id < SHM_MAX_OBJECTS; id++)
+    {
+        shm_object_t *shm = shm_table + id;
+        if (!shm->shm_in_use)
+        {
+            if (free_id < 0)
+            {
+                free_id = id;
+            }
+            continue;
+        }
+        if (!strcmp(shm->shm_name, name))
+        {
+            spinlock_unlock(&shm_lock);
+            mobj_put(&obj);
+            /* the object must be at least as big as the caller expects */
+            return npages <= shm->shm_npages ? id : -EINVAL;
+        }
+    }
+    if (free_id < 0)
+    {
+        spinlock_unlock(&shm_lock);
+        mobj_put(&obj);
+        return -ENOSPC;
+    }
+
+    shm_object_t *shm = shm_table + free_id;
+    strncpy(shm->shm_name, name, SHM_NAME_LEN);
+    shm->shm_obj = obj;
+    shm->shm_npages = npages;
+    shm->shm_in_use = 1;
+    spinlock_unlock(&shm_lock);
+
+    dbg(DBG_VM, "shmget: created \"%s\" (%lu pages) as id %ld\n", name,
+        npages, free_id);
+    return free_id;
+}
+
+long do_shmat(long id, void *addr, int prot, void **ret)
+{
+    if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    {
+        return -EINVAL;
+    }
+
+    int flags = MAP_ANON | MAP_SHARED;
+    size_t lopage = 0;
+    if (addr)
+    {
+        if (!PAGE_ALIGNED(addr) || (uintptr_t)addr < USER_MEM_LOW ||
+            (uintptr_t)addr >= USER_MEM_HIGH)
+        {
+            return -EINVAL;
+        }
+        lopage = ADDR_TO_PN(addr);
+        flags |= MAP_FIXED;
+    }
+
+    spinlock_lock(&shm_lock);
+    if (id < 0 || id >= SHM_MAX_OBJECTS || !shm_table[id].shm_in_use)
+    {
+        spinlock_unlock(&shm_lock);
+        return -EINVAL;
+    }
+    /* hold our own reference across the mapping so a concurrent shmrm
+     * cannot drop the last one mid-map */
+    mobj_t *obj = shm_table[id].shm_obj;
+    size_t npages = shm_table[id].shm_npages;
+    mobj_ref(obj);
+    spinlock_unlock(&shm_lock);
+
+    vmarea_t *new_vma = NULL;
+    long status = vmmap_map_mobj(curproc->p_vmmap, obj, lopage, npages, prot,
+                                 flags, 0, VMMAP_DIR_HILO, &new_vma);
+    mobj_put(&obj);
+    if (status < 0)
+    {
+        return status;
+    }
+
+    tlb_flush_range((uintptr_t)PN_TO_ADDR(new_vma->vma_start),
+                    (new_vma->vma_end - new_vma->vma_start) * PAGE_SIZE);
+    if (ret)
+    {
+        *ret = PN_TO_ADDR(new_vma->vma_start);
+    }
+    dbg(DBG_VM, "shmat: id %ld mapped at 0x%p by P%d\n", id,
+        PN_TO_ADDR(new_vma->vma_start), curproc->p_pid);
+    return 0;
+}
+
+long do_shmrm(long id)
+{
+    spinlock_lock(&shm_lock);
+    if (id < 0 || id >= SHM_MAX_OBJECTS || !shm_table[id].shm_in_use)
+    {
+        spinlock_unlock(&shm_lock);
+        return -EINVAL;
+    }
+    mobj_t *obj = shm_table[id].shm_obj;
+    shm_table[id].shm_obj = NULL;
+    shm_table[id].shm_in_use = 0;
+    spinlock_unlock(&shm_lock);
+
+    /* existing mappings keep their own references; the memory is freed
+     * when the last of them is unmapped */
+    mobj_put(&obj);
+    dbg(DBG_VM, "shmrm: removed id %ld\n", id);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * vDSO-style shared time page.
+ *
+ * Reading the time from userland used to cost a full syscall round trip,
+ * which is far too slow for high-frequency timestamping. Instead, one
+ * permanent frame is shared read-only with every process: _elf64_load
+ * maps it at the fixed address TIMEPAGE_ADDR in each new address space,
+ * and the timer interrupt republishes the tick count (and the rdtsc
+ * reading taken at the tick) into it under a seqlock. A userland helper
+ * reads the page and interpolates between ticks with rdtsc - zero
+ * syscalls for time (see user/lib/libc/timepage.c).
+ *
+ * The frame is served the way the zero frame is (see anon_get_pframe):
+ * it is never attached to any mobj, so the pageout daemon ignores it,
+ * and the one mapping it gets is always read-only, so its contents are
+ * only ever written from the tick handler.
+ */
+
+#include "globals.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/mobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+#include "util/time.h"
+
+#include "vm/timepage.h"
+#include "vm/vmmap.h"
+
+static mobj_t timepage_mobj;
+static pframe_t *timepage_frame;
+
+/* The kernel's view of the page; NULL until timepage_init has run, and
+ * the tick handler may fire before then. */
+static time_page_t *timepage = NULL;
+
+/*
+ * Serve the one shared frame, zero-frame style: it is only ever mapped
+ * read-only, so a write fault can never ask for it.
+ */
+static long timepage_get_pframe(mobj_t *o, uint64_t pagenum, long forwrite,
+                                pframe_t **pfp)
+{
+    KASSERT(!forwrite && "the time page is only ever mapped read-only");
+    KASSERT(pagenum == 0);
+    kmutex_lock(&timepage_frame->pf_mutex);
+    *pfp = timepage_frame;
+    return 0;
+}
+
+static mobj_ops_t timepage_mobj_ops = {.get_pframe = timepage_get_pframe,
+                                       .fill_pframe = NULL,
+                                       .flush_pframe = NULL,
+                                       .destructor = NULL};
+
+/*
+ * Set up the shared mobj and its frame. The mobj keeps its initial
+ * reference forever (each mapping takes its own via vmmap_map_mobj), so
+ * the destructor never runs.
+ */
+void timepage_init()
+{
+    mobj_init(&timepage_mobj, MOBJ_ANON, &timepage_mobj_ops);
+
+    timepage_frame = pframe_create();
+    KASSERT(timepage_frame && "couldn't create the time page frame");
+    timepage_frame->pf_addr = page_alloc();
+    KASSERT(timepage_frame->pf_addr && "couldn't allocate the time page");
+    ppage_set_owner(timepage_frame->pf_addr, timepage_frame);
+    memset(timepage_frame->pf_addr, 0, PAGE_SIZE);
+    /* It will be mapped into every process; mark it so from the start. */
+    timepage_frame->pf_mapped = 1;
+
+    timepage = timepage_frame->pf_addr;
+    timepage->tp_boot_sec = (uint64_t)do_time();
+}
+
+/*
+ * Publish a new tick. Seqlock write side: readers retry while tp_seq is
+ * odd or changed under them. x86 keeps the stores in program order; the
+ * compiler barriers keep the compiler from reordering them too.
+ */
+void timepage_tick(uint64_t ticks, uint64_t tick_usec)
+{
+    if (!timepage)
+    {
+        return;
+    }
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    uint64_t tsc = ((uint64_t)hi << 32) | lo;
+
+    time_page_t *tp = timepage;
+    tp->tp_seq++;
+    __asm__ volatile("" ::: "memory");
+    if (tp->tp_tsc_at_tick)
+    {
+        tp->tp_tsc_per_tick = tsc - tp->tp_tsc_at_tick;
+    }
+    tp->tp_tsc_at_tick = tsc;
+    tp->tp_ticks = ticks;
+    tp->tp_tick_usec = tick_usec;
+    __asm__ volatile("" ::: "memory");
+    tp->tp_seq++;
+}
+
+long timepage_map(vmmap_t *map)
+{
+    return vmmap_map_mobj(map, &timepage_mobj, ADDR_TO_PN(TIMEPAGE_ADDR), 1,
+                          PROT_READ, MAP_SHARED | MAP_FIXED, 0, 0, NULL);
+}
@@ -21,6 +21,215 @@
 static slab_allocator_t *vmmap_allocator;
 static slab_allocator_t *vmarea_allocator;
 
+/*
+ * The vmarea index tree: an AVL tree over a map's vmareas keyed by
+ * vma_start, augmented with the largest free gap in each subtree (see
+ * vmtree_node_t). The vmm_list still holds the areas in order and is used
+ * for iteration; the tree serves vmmap_lookup and vmmap_find_range, which
+ * are on the page fault path and used to be O(n) in the number of areas.
+ */
+
+#define VMTREE_HEIGHT(vma) ((vma) ? (vma)->vma_tnode.vtn_height : 0)
+#define VMTREE_MAXGAP(vma) ((vma) ? (vma)->vma_tnode.vtn_maxgap : 0)
+
+/* Recomputes the cached height and max-gap of vma from its children. */
+static void _vmtree_fix(vmarea_t *vma)
+{
+    vmarea_t *l = vma->vma_tnode.vtn_left;
+    vmarea_t *r = vma->vma_tnode.vtn_right;
+    vma->vma_tnode.vtn_height = 1 + MAX(VMTREE_HEIGHT(l), VMTREE_HEIGHT(r));
+    vma->vma_tnode.vtn_maxgap =
+        MAX(vma->vma_tnode.vtn_gap, MAX(VMTREE_MAXGAP(l), VMTREE_MAXGAP(r)));
+}
+
+static void _vmtree_replace_child(vmmap_t *map, vmarea_t *parent,
+                                  vmarea_t *old_child, vmarea_t *new_child)
+{
+    if (!parent)
+    {
+        map->vmm_tree = new_child;
+    }
+    else if (parent->vma_tnode.vtn_left == old_child)
+    {
+        parent->vma_tnode.vtn_left = new_child;
+    }
+    else
+    {
+        KASSERT(parent->vma_tnode.vtn_right == old_child);
+        parent->vma_tnode.vtn_right = new_child;
+    }
+    if (new_child)
+    {
+        new_child->vma_tnode.vtn_parent = parent;
+    }
+}
+
+static void _vmtree_rotate_left(vmmap_t *map, vmarea_t *vma)
+{
+    vmarea_t *r = vma->vma_tnode.vtn_right;
+    _vmtree_replace_child(map, vma->vma_tnode.vtn_parent, vma, r);
+    vma->vma_tnode.vtn_right = r->vma_tnode.vtn_left;
+    if (vma->vma_tnode.vtn_right)
+    {
+        vma->vma_tnode.vtn_right->vma_tnode.vtn_parent = vma;
+    }
+    r->vma_tnode.vtn_left = vma;
+    vma->vma_tnode.vtn_parent = r;
+    _vmtree_fix(vma);
+    _vmtree_fix(r);
+}
+
+static void _vmtree_rotate_right(vmmap_t *map, vmarea_t *vma)
+{
+    vmarea_t *l = vma->vma_tnode.vtn_left;
+    _vmtree_replace_child(map, vma->vma_tnode.vtn_parent, vma, l);
+    vma->vma_tnode.vtn_left = l->vma_tnode.vtn_right;
+    if (vma->vma_tnode.vtn_left)
+    {
+        vma->vma_tnode.vtn_left->vma_tnode.vtn_parent = vma;
+    }
+    l->vma_tnode.vtn_right = vma;
+    vma->vma_tnode.vtn_parent = l;
+    _vmtree_fix(vma);
+    _vmtree_fix(l);
+}
+
+/* Walks from vma to the root, refreshing the augmented fields and
+ * restoring the AVL balance invariant along the way. */
+static void _vmtree_rebalance(vmmap_t *map, vmarea_t *vma)
+{
+    while (vma)
+    {
+        vmarea_t *parent = vma->vma_tnode.vtn_parent;
+        _vmtree_fix(vma);
+        long balance = (long)VMTREE_HEIGHT(vma->vma_tnode.vtn_left) -
+                       (long)VMTREE_HEIGHT(vma->vma_tnode.vtn_right);
+        if (balance > 1)
+        {
+            vmarea_t *l = vma->vma_tnode.vtn_left;
+            if (VMTREE_HEIGHT(l->vma_tnode.vtn_right) >
+                VMTREE_HEIGHT(l->vma_tnode.vtn_left))
+            {
+                _vmtree_rotate_left(map, l);
+            }
+            _vmtree_rotate_right(map, vma);
+        }
+        else if (balance < -1)
+        {
+            vmarea_t *r = vma->vma_tnode.vtn_right;
+            if (VMTREE_HEIGHT(r->vma_tnode.vtn_left) >
+                VMTREE_HEIGHT(r->vma_tnode.vtn_right))
+            {
+                _vmtree_rotate_right(map, r);
+            }
+            _vmtree_rotate_left(map, vma);
+        }
+        vma = parent;
+    }
+}
+
+static void _vmtree_insert(vmmap_t *map, vmarea_t *vma)
+{
+    vma->vma_tnode.vtn_parent = NULL;
+    vma->vma_tnode.vtn_left = NULL;
+    vma->vma_tnode.vtn_right = NULL;
+    vma->vma_tnode.vtn_height = 1;
+    vma->vma_tnode.vtn_gap = 0;
+    vma->vma_tnode.vtn_maxgap = 0;
+
+    vmarea_t *parent = NULL;
+    vmarea_t **where = &map->vmm_tree;
+    while (*where)
+    {
+        parent = *where;
+        if (vma->vma_start < parent->vma_start)
+        {
+            where = &parent->vma_tnode.vtn_left;
+        }
+        else
+        {
+            where = &parent->vma_tnode.vtn_right;
+        }
+    }
+    *where = vma;
+    vma->vma_tnode.vtn_parent = parent;
+    _vmtree_rebalance(map, parent);
+}
+
+static void _vmtree_remove(vmmap_t *map, vmarea_t *vma)
+{
+    vmarea_t *fixup;
+    if (vma->vma_tnode.vtn_left && vma->vma_tnode.vtn_right)
+    {
+        /* Two children: detach vma's in-order successor and graft it into
+         * vma's position. */
+        vmarea_t *succ = vma->vma_tnode.vtn_right;
+        while (succ->vma_tnode.vtn_left)
+        {
+            succ = succ->vma_tnode.vtn_left;
+        }
+        fixup = (succ->vma_tnode.vtn_parent == vma) ? succ
+                                                    : succ->vma_tnode.vtn_parent;
+        _vmtree_replace_child(map, succ->vma_tnode.vtn_parent, succ,
+                              succ->vma_tnode.vtn_right);
+        succ->vma_tnode.vtn_left = vma->vma_tnode.vtn_left;
+        if (succ->vma_tnode.vtn_left)
+        {
+            succ->vma_tnode.vtn_left->vma_tnode.vtn_parent = succ;
+        }
+        succ->vma_tnode.vtn_right = vma->vma_tnode.vtn_right;
+        if (succ->vma_tnode.vtn_right)
+        {
+            succ->vma_tnode.vtn_right->vma_tnode.vtn_parent = succ;
+        }
+        _vmtree_replace_child(map, vma->vma_tnode.vtn_parent, vma, succ);
+    }
+    else
+    {
+        vmarea_t *child = vma->vma_tnode.vtn_left ? vma->vma_tnode.vtn_left
+                                                  : vma->vma_tnode.vtn_right;
+        fixup = vma->vma_tnode.vtn_parent;
+        _vmtree_replace_child(map, vma->vma_tnode.vtn_parent, vma, child);
+    }
+    _vmtree_rebalance(map, fixup);
+
+    vma->vma_tnode.vtn_parent = NULL;
+    vma->vma_tnode.vtn_left = NULL;
+    vma->vma_tnode.vtn_right = NULL;
+    vma->vma_tnode.vtn_height = 0;
+    vma->vma_tnode.vtn_gap = 0;
+    vma->vma_tnode.vtn_maxgap = 0;
+}
+
+static long _vmtree_contains(vmmap_t *map, vmarea_t *vma)
+{
+    return vma->vma_tnode.vtn_parent != NULL || map->vmm_tree == vma;
+}
+
+/* The number of free pages between vma and its predecessor on the list
+ * (or USER_MEM_LOW if it is the first area). */
+static size_t _vmtree_gap_below(vmarea_t *vma)
+{
+    size_t prev_end = ADDR_TO_PN(USER_MEM_LOW);
+    if (vma->vma_plink.l_prev != &vma->vma_vmmap->vmm_list)
+    {
+        vmarea_t *prev = list_prev(vma, vmarea_t, vma_plink);
+        prev_end = prev->vma_end;
+    }
+    return vma->vma_start > prev_end ? vma->vma_start - prev_end : 0;
+}
+
+/* Recomputes vma's cached gap and propagates the new max-gap to the root.
+ * Never changes the tree's shape, so no rebalancing is needed. */
+static void _vmtree_update_gap(vmarea_t *vma)
+{
+    vma->vma_tnode.vtn_gap = _vmtree_gap_below(vma);
+    for (vmarea_t *n = vma; n; n = n->vma_tnode.vtn_parent)
+    {
+        _vmtree_fix(n);
+    }
+}
+
 void vmmap_init(void)
 {
     vmmap_allocator = slab_allocator_create("vmmap", sizeof(vmmap_t));
@@ -42,9 +251,11 @@ vmarea_t *vmarea_alloc(void)
     area->vma_off = 0;
     area->vma_prot = 0;
     area->vma_flags = 0;
+    area->vma_faults = 0;
     area->vma_vmmap = NULL;
     area->vma_obj = NULL;
     list_link_init(&area->vma_plink);
+    memset(&area->vma_tnode, 0, sizeof(area->vma_tnode));
     return area;
 }
 
@@ -54,8 +265,17 @@ vmarea_t *vmarea_alloc(void)
  */
 void vmarea_free(vmarea_t *vma)
 {
+    vmmap_t *map = vma->vma_vmmap;
+    if (map && _vmtree_contains(map, vma)) {
+        _vmtree_remove(map, vma);
+    }
     if (list_link_is_linked(&vma->vma_plink)) {
+        list_link_t *next = vma->vma_plink.l_next;
         list_remove(&vma->vma_plink);
+        /* The successor's gap just grew to swallow this area's range. */
+        if (map && next != &map->vmm_list) {
+            _vmtree_update_gap(list_item(next, vmarea_t, vma_plink));
+        }
     }
     if (vma->vma_obj) {
         KASSERT(vma->vma_obj->mo_refcount);
@@ -74,7 +294,9 @@ vmmap_t *vmmap_create(void)
         return NULL;
     }
     list_init(&vmmap->vmm_list);
+    vmmap->vmm_tree = NULL;
     vmmap->vmm_proc = curproc;
+    vmmap->vmm_clone_pending = 0;
     return vmmap;
 }
 
@@ -99,13 +321,36 @@ void vmmap_destroy(vmmap_t **mapp)
  */
 void vmmap_insert(vmmap_t *map, vmarea_t *new_vma)
 {
+    list_link_t *before = &map->vmm_list;
     list_iterate(&map->vmm_list, area, vmarea_t, vma_plink) {
         if (area->vma_end >= new_vma->vma_start) {
-            list_insert_before(&area->vma_plink, &new_vma->vma_plink);
-            return;
+            before = &area->vma_plink;
+            break;
         }
     }
-    list_insert_tail(&map->vmm_list, &new_vma->vma_plink);
+    list_insert_before(before, &new_vma->vma_plink);
+    new_vma->vma_vmmap = map;
+    _vmtree_insert(map, new_vma);
+    _vmtree_update_gap(new_vma);
+    /* The successor's gap shrank to end at the new area. */
+    if (new_vma->vma_plink.l_next != &map->vmm_list) {
+        _vmtree_update_gap(list_next(new_vma, vmarea_t, vma_plink));
+    }
+}
+
+/*
+ * Refresh the gaps cached in the index tree after a vmarea's bounds have
+ * been changed in place: the area's own gap (its start may have moved) and
+ * its successor's (its end may have moved).
+ */
+void vmmap_area_resized(vmarea_t *vma)
+{
+    vmmap_t *map = vma->vma_vmmap;
+    KASSERT(map && _vmtree_contains(map, vma));
+    _vmtree_update_gap(vma);
+    if (vma->vma_plink.l_next != &map->vmm_list) {
+        _vmtree_update_gap(list_next(vma, vmarea_t, vma_plink));
+    }
 }
 
 /*
@@ -126,40 +371,53 @@ ssize_t vmmap_find_range(vmmap_t *map, size_t npages, int dir)
     KASSERT(dir == VMMAP_DIR_HILO || dir == VMMAP_DIR_LOHI);
     size_t user_start_page = ADDR_TO_PN(USER_MEM_LOW);
     size_t user_end_page = ADDR_TO_PN(USER_MEM_HIGH);
-    if (dir == VMMAP_DIR_LOHI) {
-        size_t count = 0;
-        size_t start = 0;
-        for (size_t i = user_start_page; i < user_end_page; i++) {
-            vmarea_t* lookup = vmmap_lookup(map, i);
-            if (!lookup) {
-                if (count == 0) {
-                    start = i;
-                }
-                count += 1;
-            } else {
-                count = 0;
-                start = 0;
-            }
-            if (count == npages) {
-                KASSERT(start >= user_start_page);
-                return start;
-            }
+    if (list_empty(&map->vmm_list)) {
+        if (user_end_page - user_start_page < npages) {
+            return -1;
         }
+        return dir == VMMAP_DIR_LOHI ? (ssize_t)user_start_page
+                                     : (ssize_t)(user_end_page - npages);
     }
+    /* Every gap except the one above the last area is cached in the index
+     * tree, so a fitting gap can be found by descending on vtn_maxgap. */
+    vmarea_t *last = list_tail(&map->vmm_list, vmarea_t, vma_plink);
+    size_t tail_gap =
+        user_end_page > last->vma_end ? user_end_page - last->vma_end : 0;
     if (dir == VMMAP_DIR_HILO) {
-        size_t count = 0;
-        for (size_t i = user_end_page - 1; i >= user_start_page; i--) {
-            vmarea_t* lookup = vmmap_lookup(map, i);
-            if (!lookup) {
-                count += 1;
+        if (tail_gap >= npages) {
+            return (ssize_t)(user_end_page - npages);
+        }
+        vmarea_t *area = map->vmm_tree;
+        if (VMTREE_MAXGAP(area) < npages) {
+            return -1;
+        }
+        while (area) {
+            if (VMTREE_MAXGAP(area->vma_tnode.vtn_right) >= npages) {
+                area = area->vma_tnode.vtn_right;
+            } else if (area->vma_tnode.vtn_gap >= npages) {
+                return (ssize_t)(area->vma_start - npages);
             } else {
-                count = 0;
+                area = area->vma_tnode.vtn_left;
             }
-            if (count == npages) {
-                KASSERT(i >= user_start_page);
-                return i;
+        }
+    }
+    if (dir == VMMAP_DIR_LOHI) {
+        vmarea_t *area = map->vmm_tree;
+        if (VMTREE_MAXGAP(area) >= npages) {
+            while (area) {
+                if (VMTREE_MAXGAP(area->vma_tnode.vtn_left) >= npages) {
+                    area = area->vma_tnode.vtn_left;
+                } else if (area->vma_tnode.vtn_gap >= npages) {
+                    return (ssize_t)(area->vma_start -
+                                     area->vma_tnode.vtn_gap);
+                } else {
+                    area = area->vma_tnode.vtn_right;
+                }
             }
         }
+        if (tail_gap >= npages) {
+            return (ssize_t)last->vma_end;
+        }
     }
     return -1;
 }
@@ -170,11 +428,21 @@ ssize_t vmmap_find_range(vmmap_t *map, size_t npages, int dir)
  */
 vmarea_t *vmmap_lookup(vmmap_t *map, size_t vfn)
 {
-    list_iterate(&map->vmm_list, area, vmarea_t, vma_plink) {
-        if (area->vma_start <= vfn && area->vma_end > vfn) {
-            return area;
+    /* Find the area with the greatest vma_start <= vfn, then check that
+     * its range actually covers vfn. */
+    vmarea_t *area = map->vmm_tree;
+    vmarea_t *best = NULL;
+    while (area) {
+        if (vfn < area->vma_start) {
+            area = area->vma_tnode.vtn_left;
+        } else {
+            best = area;
+            area = area->vma_tnode.vtn_right;
         }
     }
+    if (best && best->vma_start <= vfn && best->vma_end > vfn) {
+        return best;
+    }
     return NULL;
 }
 
@@ -218,10 +486,18 @@ vmmap_t *vmmap_clone(vmmap_t *map)
     if (!new_map) {
         return NULL;
     }
+    // While the clone runs, the map is copy-pending: write faults from the
+    // process's other threads wait (a write serviced mid-clone would land
+    // in an object the child is about to share), but read faults cannot
+    // diverge the two maps and proceed for the whole clone. Fork latency
+    // therefore no longer holds up the parent's read fault traffic, which
+    // is the bulk of it for a large process.
+    map->vmm_clone_pending = 1;
     list_iterate(&map->vmm_list, area, vmarea_t, vma_plink) {
         int old_refcount = area->vma_obj->mo_refcount;
         vmarea_t* new_area = vmarea_alloc();
         if (!new_area) {
+            map->vmm_clone_pending = 0;
             vmmap_destroy(&new_map);
             return NULL;
         }
@@ -230,18 +506,22 @@ vmmap_t *vmmap_clone(vmmap_t *map)
         new_area->vma_off = area->vma_off;
         new_area->vma_flags = area->vma_flags;
         new_area->vma_prot = area->vma_prot;
-        if (!(area->vma_flags & MAP_SHARED)) {
+        // read-only private areas can't diverge between parent and child,
+        // so share the object directly instead of stacking shadows
+        if (!(area->vma_flags & MAP_SHARED) && (area->vma_prot & PROT_WRITE)) {
             mobj_lock(area->vma_obj);
             mobj_t* new_shadow = shadow_create(area->vma_obj);
             mobj_unlock(area->vma_obj);
             mobj_unlock(new_shadow);
             if (!new_shadow) {
+                map->vmm_clone_pending = 0;
                 vmmap_destroy(&new_map);
                 return NULL;
             }
             mobj_t* old_shadow = shadow_create(area->vma_obj);
             mobj_unlock(old_shadow);
             if (!old_shadow) {
+                map->vmm_clone_pending = 0;
                 vmmap_destroy(&new_map);
                 return NULL;
             }
@@ -255,6 +535,7 @@ vmmap_t *vmmap_clone(vmmap_t *map)
         }
         vmmap_insert(new_map, new_area);
     }
+    map->vmm_clone_pending = 0;
     return new_map;
 }
 
@@ -337,9 +618,12 @@ long vmmap_map(vmmap_t *map, vnode_t *file, size_t lopage, size_t npages,
 
     new_area->vma_obj = mobj;
     
-    // set up shadow object if needed
+    // set up shadow object if needed; a private mapping that can never be
+    // written (mprotect is NYI, so vma_prot never changes) needs no shadow -
+    // faults are served straight from the underlying object, which lets
+    // repeated execs of the same binary share warm text pages
     mobj_t* shadow = NULL;
-    if (flags & MAP_PRIVATE) {
+    if ((flags & MAP_PRIVATE) && (prot & PROT_WRITE)) {
         shadow = shadow_create(mobj);
         new_area->vma_obj = shadow;
         KASSERT(mobj->mo_refcount);
@@ -376,6 +660,74 @@ long vmmap_map(vmmap_t *map, vnode_t *file, size_t lopage, size_t npages,
     return 0;
 }
 
+/*
+ * Like vmmap_map(), but the memory object already exists (a shared memory
+ * object from vm/shm.c, typically mapped by several vmmaps at once).
+ * Takes a reference on mobj for the new mapping. MAP_SHARED maps the
+ * object directly, so every process sees every write; a writable
+ * MAP_PRIVATE mapping gets its own shadow object on top, same as
+ * vmmap_map().
+ */
+long vmmap_map_mobj(vmmap_t *map, mobj_t *mobj, size_t lopage, size_t npages,
+                    int prot, int flags, off_t off, int dir,
+                    vmarea_t **new_vma)
+{
+    size_t start = lopage;
+    if (!lopage) {
+        start = vmmap_find_range(map, npages, dir);
+        if (!start) {
+            return -ENOMEM;
+        }
+    }
+    vmarea_t* new_area = vmarea_alloc();
+    if (!new_area) {
+        return -ENOMEM;
+    }
+    new_area->vma_end = start + npages;
+    new_area->vma_off = ADDR_TO_PN((char *) PN_TO_ADDR(start) + off) - start;
+    new_area->vma_flags = flags;
+    new_area->vma_prot = prot;
+    new_area->vma_vmmap = map;
+    new_area->vma_start = start;
+
+    mobj_ref(mobj);
+    new_area->vma_obj = mobj;
+
+    mobj_t* shadow = NULL;
+    if ((flags & MAP_PRIVATE) && (prot & PROT_WRITE)) {
+        shadow = shadow_create(mobj);
+        new_area->vma_obj = shadow;
+        KASSERT(mobj->mo_refcount);
+        mobj_put(&mobj);
+        if (!shadow) {
+            vmarea_free(new_area);
+            return -ENOMEM;
+        }
+        mobj_unlock(shadow);
+    }
+
+    if ((flags & MAP_FIXED) && (lopage)) {
+        long status = vmmap_remove(map, lopage, npages);
+        if (status < 0) {
+            vmarea_free(new_area);
+            if (shadow) {
+                KASSERT(shadow->mo_refcount);
+                mobj_put(&shadow);
+            } else {
+                mobj_t* put = new_area->vma_obj;
+                KASSERT(put->mo_refcount);
+                mobj_put(&put);
+            }
+            return status;
+        }
+    }
+    vmmap_insert(map, new_area);
+    if (new_vma) {
+        *new_vma = new_area;
+    }
+    return 0;
+}
+
 /*
  * Iterate over the mapping's vmm_list and make sure that the specified range
  * is completely empty. You will have to handle the following cases:
@@ -405,7 +757,8 @@ long vmmap_map(vmmap_t *map, vnode_t *file, size_t lopage, size_t npages,
  * 
  * Hints:
  *  - Whenever you shorten/remove any mappings, be sure to call pt_unmap_range()
- *    tlb_flush_range() to clean your pagetables and TLB.
+ *    and collect the range into the TLB shootdown, which is committed once
+ *    after the loop to clean the pagetables and every core's TLB.
  */
 long vmmap_remove(vmmap_t *map, size_t lopage, size_t npages)
 {
@@ -413,18 +766,24 @@ long vmmap_remove(vmmap_t *map, size_t lopage, size_t npages)
     size_t endpage = lopage + npages;
     uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(lopage);
     uintptr_t vmax = (uintptr_t) PN_TO_ADDR(endpage);
+    tlb_shootdown_t ts;
+    tlb_shootdown_begin(&ts, map->vmm_proc->p_pml4);
     list_iterate(&map->vmm_list, area, vmarea_t, vma_plink) {
         if (area->vma_start >= lopage && area->vma_end > endpage && endpage > area->vma_start) {
             size_t old_start = area->vma_start;
             area->vma_start = endpage;
             area->vma_off += area->vma_start - old_start;
+            vmmap_area_resized(area);
             KASSERT(vmax > vaddr);
             KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(vmax));
             pt_unmap_range(map->vmm_proc->p_pml4, vaddr, vmax);
-            tlb_flush_range(vaddr, vmax - vaddr);
+            tlb_shootdown_add(&ts, vaddr, npages);
         } else if (area->vma_start < lopage && area->vma_end > endpage) {
             vmarea_t* new_area = vmarea_alloc();
             if (!new_area) {
+                /* Earlier iterations may already have unmapped ranges;
+                 * their stale translations must still be shot down. */
+                tlb_shootdown_commit(&ts);
                 return -ENOMEM;
             }
             new_area->vma_start = endpage;
@@ -440,26 +799,126 @@ long vmmap_remove(vmmap_t *map, size_t lopage, size_t npages)
             KASSERT(vmax > vaddr);
             KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(vmax));
             pt_unmap_range(map->vmm_proc->p_pml4, vaddr, vmax);
-            tlb_flush_range(vaddr, vmax - vaddr);
+            tlb_shootdown_add(&ts, vaddr, npages);
         } else if (area->vma_start < lopage && area->vma_end > lopage && area->vma_end <= endpage) {
             size_t old_end = area->vma_end;
             area->vma_end = lopage;
+            vmmap_area_resized(area);
             KASSERT(vmax > vaddr);
             KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(vmax));
             pt_unmap_range(map->vmm_proc->p_pml4, vaddr, vmax);
-            tlb_flush_range(vaddr, vmax - vaddr);
+            tlb_shootdown_add(&ts, vaddr, npages);
         } else if (area->vma_start >= lopage && area->vma_end <= endpage) {
-            list_remove(&area->vma_plink);
+            /* vmarea_free unlinks the area from the list and the index
+             * tree, and updates the successor's gap. */
             vmarea_free(area);
             KASSERT(vmax > vaddr);
             KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(vmax));
             pt_unmap_range(map->vmm_proc->p_pml4, vaddr, vmax);
-            tlb_flush_range(vaddr, vmax - vaddr);
+            tlb_shootdown_add(&ts, vaddr, npages);
         }
     }
+    tlb_shootdown_commit(&ts);
     return 0;
 }
 
+/*
+ * How many served faults a vmarea absorbs between huge-page promotion
+ * checks, so the residency scan below doesn't run on every fault.
+ */
+#define VMMAP_HUGE_PROMOTE_INTERVAL 64
+
+/*
+ * If the 2MB-aligned window containing vfn has every one of its 512 pages
+ * resident, migrate their data into one physically contiguous run and
+ * collapse the window into a single 2MB PDE (see pt_promote_2mb), cutting
+ * the window's TLB footprint from 512 entries to one.
+ *
+ * Only fully private, never-shared anonymous areas qualify: with a single
+ * reference on the mobj, every PTE pointing at these frames lives in this
+ * process's own page tables, so swapping the frames' backing pages cannot
+ * leave another address space pointing at freed memory. Forked areas sit
+ * behind shadow objects (MOBJ_SHADOW) and are excluded by the type check.
+ */
+void vmmap_try_promote_huge(vmarea_t *vma, size_t vfn)
+{
+    if (!USE_2MB_PAGES) {
+        return;
+    }
+    if (++vma->vma_faults % VMMAP_HUGE_PROMOTE_INTERVAL) {
+        return;
+    }
+    mobj_t *o = vma->vma_obj;
+    if (o->mo_type != MOBJ_ANON || o->mo_refcount != 1) {
+        return;
+    }
+    if (!(vma->vma_prot & PROT_WRITE)) {
+        return;
+    }
+    size_t window = vfn - (vfn % PT_ENTRY_COUNT);
+    if (window < vma->vma_start || window + PT_ENTRY_COUNT > vma->vma_end) {
+        return;
+    }
+    mobj_lock(o);
+    if ((size_t) o->mo_resident < PT_ENTRY_COUNT) {
+        mobj_unlock(o);
+        return;
+    }
+    /* First pass: bail unless every page of the window is resident. */
+    for (size_t i = 0; i < PT_ENTRY_COUNT; i++) {
+        pframe_t* pf = NULL;
+        mobj_find_pframe(o, vma->vma_off + window + i - vma->vma_start, &pf);
+        if (!pf) {
+            mobj_unlock(o);
+            return;
+        }
+        long loaded = pf->pf_addr != NULL;
+        pframe_release(&pf);
+        if (!loaded) {
+            mobj_unlock(o);
+            return;
+        }
+    }
+    char *run = page_alloc_n(PT_ENTRY_COUNT);
+    if (!run) {
+        mobj_unlock(o);
+        return;
+    }
+    /* Second pass: migrate each frame's data into the run; nothing can
+     * fail from here on. The stale 4K PTEs keep pointing at the freed
+     * pages until pt_promote_2mb replaces them below, which is safe
+     * because the only thread that could touch them is the one running
+     * this code. */
+    for (size_t i = 0; i < PT_ENTRY_COUNT; i++) {
+        pframe_t* pf = NULL;
+        mobj_find_pframe(o, vma->vma_off + window + i - vma->vma_start, &pf);
+        KASSERT(pf && pf->pf_addr);
+        void *newaddr = run + i * PAGE_SIZE;
+        memcpy(newaddr, pf->pf_addr, PAGE_SIZE);
+        ppage_set_owner(pf->pf_addr, NULL);
+        page_free(pf->pf_addr);
+        pf->pf_addr = newaddr;
+        ppage_set_owner(newaddr, pf);
+        /* The whole window is mapped from here on; pin every frame. */
+        pf->pf_mapped = 1;
+        pframe_release(&pf);
+    }
+    mobj_unlock(o);
+
+    uintptr_t vstart = (uintptr_t) PN_TO_ADDR(window);
+    if (pt_promote_2mb(curproc->p_pml4, (uintptr_t) run - PHYS_OFFSET, vstart,
+                       PT_PRESENT | PT_USER | PT_WRITE,
+                       PT_PRESENT | PT_USER | PT_WRITE)) {
+        /* Could not build the intermediate levels; the frames are still
+         * valid, so later faults simply map 4K pages out of the run. */
+        tlb_flush_range(vstart, PT_ENTRY_COUNT);
+        return;
+    }
+    tlb_flush_range(vstart, PT_ENTRY_COUNT);
+    dbg(DBG_VM, "promoted [0x%p, 0x%p) to a 2MB mapping\n", (void *) vstart,
+        (void *) (vstart + PAGE_SIZE_2MB));
+}
+
 /*
  * Returns 1 if the given address space has no mappings for the given range,
  * 0 otherwise.
@@ -498,29 +957,35 @@ long vmmap_is_range_empty(vmmap_t *map, size_t startvfn, size_t npages)
  */
 long vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count)
 {
-    size_t start_page = ADDR_TO_PN(vaddr);
-    size_t starting_offset = PAGE_OFFSET(vaddr);
-    size_t end_page = ADDR_TO_PN((char *) vaddr + count);
     size_t bytes_read = 0;
     const char* position = vaddr;
-    for (size_t i = start_page; i <= end_page; i++) {
-        vmarea_t* area = vmmap_lookup(map, i);
+    /* Resolve each vmarea-contiguous run once (one lookup, one mobj lock)
+     * and copy all of its pages before moving on; this sits under every
+     * copy_from_user, so the per-page lookups add up fast. */
+    while (bytes_read < count) {
+        vmarea_t* area = vmmap_lookup(map, ADDR_TO_PN(position));
         KASSERT(area != NULL);
-        size_t to_read = MIN(PAGE_SIZE - PAGE_OFFSET(position), count - bytes_read);
-        pframe_t* pframe;
+        size_t run = MIN(count - bytes_read,
+                         (size_t) ((char *) PN_TO_ADDR(area->vma_end) - position));
         mobj_lock(area->vma_obj);
-        long status = mobj_get_pframe(area->vma_obj, i - area->vma_start + area->vma_off, 0, &pframe);
-        mobj_unlock(area->vma_obj);
-        if (status < 0) {
-            return status;
-        }
-        memcpy((char *) buf + bytes_read, (char *) pframe->pf_addr + PAGE_OFFSET(position), to_read);
-        bytes_read += to_read;
-        position = position + to_read;
-        pframe_release(&pframe);
-        if (bytes_read == count) {
-            return 0;
+        while (run > 0) {
+            size_t to_read = MIN(PAGE_SIZE - PAGE_OFFSET(position), run);
+            pframe_t* pframe;
+            long status = mobj_get_pframe(
+                area->vma_obj,
+                ADDR_TO_PN(position) - area->vma_start + area->vma_off, 0,
+                &pframe);
+            if (status < 0) {
+                mobj_unlock(area->vma_obj);
+                return status;
+            }
+            memcpy((char *) buf + bytes_read, (char *) pframe->pf_addr + PAGE_OFFSET(position), to_read);
+            pframe_release(&pframe);
+            bytes_read += to_read;
+            position = position + to_read;
+            run -= to_read;
         }
+        mobj_unlock(area->vma_obj);
     }
     KASSERT(bytes_read == count);
     return 0;
@@ -544,30 +1009,35 @@ long vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count)
  */
 long vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count)
 {
-    size_t start_page = ADDR_TO_PN(vaddr);
-    size_t starting_offset = PAGE_OFFSET(vaddr);
-    size_t end_page = ADDR_TO_PN((char *) vaddr + count);
     size_t bytes_written = 0;
     const char* position = vaddr;
-    for (size_t i = start_page; i <= end_page; i++) {
-        vmarea_t* area = vmmap_lookup(map, i);
+    /* Same run batching as vmmap_read: one lookup and one mobj lock per
+     * vmarea-contiguous run rather than per page. */
+    while (bytes_written < count) {
+        vmarea_t* area = vmmap_lookup(map, ADDR_TO_PN(position));
         KASSERT(area != NULL);
-        size_t to_write = MIN(PAGE_SIZE - PAGE_OFFSET(position), count - bytes_written);
-        pframe_t* pframe;
+        size_t run = MIN(count - bytes_written,
+                         (size_t) ((char *) PN_TO_ADDR(area->vma_end) - position));
         mobj_lock(area->vma_obj);
-        long status = mobj_get_pframe(area->vma_obj, i - area->vma_start + area->vma_off, 1, &pframe);
-        mobj_unlock(area->vma_obj);
-        if (status < 0) {
-            return status;
-        }
-        memcpy((char *) pframe->pf_addr + PAGE_OFFSET(position), (char *) buf + bytes_written, to_write);
-        bytes_written += to_write;
-        position = position + to_write;
-        pframe->pf_dirty = 1;
-        pframe_release(&pframe);
-        if (bytes_written == count) {
-            return 0;
+        while (run > 0) {
+            size_t to_write = MIN(PAGE_SIZE - PAGE_OFFSET(position), run);
+            pframe_t* pframe;
+            long status = mobj_get_pframe(
+                area->vma_obj,
+                ADDR_TO_PN(position) - area->vma_start + area->vma_off, 1,
+                &pframe);
+            if (status < 0) {
+                mobj_unlock(area->vma_obj);
+                return status;
+            }
+            memcpy((char *) pframe->pf_addr + PAGE_OFFSET(position), (char *) buf + bytes_written, to_write);
+            pframe->pf_dirty = 1;
+            pframe_release(&pframe);
+            bytes_written += to_write;
+            position = position + to_write;
+            run -= to_write;
         }
+        mobj_unlock(area->vma_obj);
     }
     KASSERT(bytes_written == count);
     return 0;
@@ -3,19 +3,36 @@ import math
 import struct
 
 S5_MAGIC = 0x727f
-S5_CURRENT_VERSION = 3
+# version 5 appended the access-time field to the inode
+S5_CURRENT_VERSION = 5
 S5_BLOCK_SIZE = 4096
 
 S5_NBLKS_PER_FNODE = 30
-S5_NDIRECT_BLOCKS = 28
-S5_MAX_FILE_BLOCKS = S5_NDIRECT_BLOCKS + math.floor(S5_BLOCK_SIZE / 4)
+S5_NDIRECT_BLOCKS = 26
+S5_NIDIRECT_BLOCKS = int(math.floor(S5_BLOCK_SIZE / 4))
+# fsmaker itself only reads and writes the direct and single-indirect
+# ranges; the double-indirect range is kernel-only
+S5_MAX_FILE_BLOCKS = S5_NDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS * S5_NIDIRECT_BLOCKS
+S5_FSMAKER_FILE_BLOCKS = S5_NDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS
 S5_MAX_FILE_SIZE = S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE
 
+# journal geometry: the kernel's record layout is compiled for a 64-block
+# region, so a premade journal must reserve at least that many blocks (it
+# only ever uses the first 64); the magics match s5fs_journal.c
+S5_JOURNAL_BLOCKS = 64
+S5_JOURNAL_DESC_MAGIC = 0x6a53355f
+S5_JOURNAL_COMMIT_MAGIC = 0x6a5335c1
+
 S5_NAME_LEN = 28
 S5_DIRENT_SIZE = S5_NAME_LEN + 4
 
-S5_INODE_SIZE = 16 + S5_NDIRECT_BLOCKS * 4
-S5_INODES_PER_BLOCK = S5_BLOCK_SIZE / S5_INODE_SIZE
+S5_IFLAG_EXTENTS = 0x1
+S5_EXTENT_SIZE = 12
+S5_INODE_EXTENTS = int(S5_NDIRECT_BLOCKS * 4 / S5_EXTENT_SIZE)
+
+# 12-byte header, direct blocks, indirect, dindirect, flags, atime
+S5_INODE_SIZE = 28 + S5_NDIRECT_BLOCKS * 4
+S5_INODES_PER_BLOCK = int(S5_BLOCK_SIZE / S5_INODE_SIZE)
 
 S5_TYPE_FREE = 0x0
 S5_TYPE_DATA = 0x1
@@ -61,11 +78,16 @@ class Block:
             raise S5fsException("cannot write to {0}, exceeds block size of {1}".format(offset + len(data), S5_BLOCK_SIZE))
         self._simdisk._simfile.seek(int(self._offset + offset))
         res = self._simdisk._simfile.write(data)
+        self._simdisk._written.add(self._blockno)
 
     def zero(self):
+        # a freshly formatted image is one big hole, so zeroing a block
+        # nothing has written to yet would only densify the sparse output
+        if (self._simdisk.is_hole(self._blockno)):
+            return
         self._simdisk._simfile.seek(self._offset)
-        for i in xrange(S5_BLOCK_SIZE):
-            self._simdisk._simfile.write('\0')
+        self._simdisk._simfile.write('\0' * S5_BLOCK_SIZE)
+        self._simdisk._written.add(self._blockno)
 
     def free(self):
         if (self._simdisk.get_nfree() < S5_NBLKS_PER_FNODE - 1):
@@ -157,6 +179,30 @@ class Inode:
         self._simfile.seek(int(self._offset + 12 + 4 * S5_NDIRECT_BLOCKS))
         self._simfile.write(struct.pack("I", val))
 
+    def get_dindirect_blockno(self):
+        self._simfile.seek(int(self._offset + 16 + 4 * S5_NDIRECT_BLOCKS))
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_dindirect_blockno(self, val):
+        self._simfile.seek(int(self._offset + 16 + 4 * S5_NDIRECT_BLOCKS))
+        self._simfile.write(struct.pack("I", val))
+
+    def get_flags(self):
+        self._simfile.seek(int(self._offset + 20 + 4 * S5_NDIRECT_BLOCKS))
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def is_extent_mapped(self):
+        return (self.get_flags() & S5_IFLAG_EXTENTS) != 0
+
+    # the direct block area of an extent-mapped inode holds
+    # (file block, disk block, length) runs instead of block pointers
+    def get_extent(self, index):
+        if (index < S5_INODE_EXTENTS):
+            self._simfile.seek(int(self._offset + 12 + index * S5_EXTENT_SIZE))
+            return struct.unpack("III", self._simfile.read(S5_EXTENT_SIZE))
+        else:
+            raise S5fsException("extent index {0} greater than max {1}".format(index, S5_INODE_EXTENTS))
+
     def get_type_str(self, short=False):
         t = self.get_type()
         name = "INV" if short else "INVALID"
@@ -187,14 +233,23 @@ class Inode:
             elif (self.get_type() == S5_TYPE_DIR):
                 res += " ({0} dirents)".format(self.get_size() / S5_DIRENT_SIZE)
             res += "\n"
-            res += "direct blocks ({0}):\n".format(S5_NDIRECT_BLOCKS)
-            for i in xrange(S5_NDIRECT_BLOCKS):
-                res += " {0:5}".format(self.get_direct_blockno(i))
-                if ((i + 1) % 4 == 0):
+            if (self.is_extent_mapped()):
+                res += "extents ({0}, as file block -> disk block x length):\n".format(S5_INODE_EXTENTS)
+                for i in xrange(S5_INODE_EXTENTS):
+                    (fblock, dblock, nblocks) = self.get_extent(i)
+                    if (nblocks != 0):
+                        res += "  {0} -> {1} x {2}\n".format(fblock, dblock, nblocks)
+                res += "extent overflow block: {0}\n".format(self.get_indirect_blockno())
+            else:
+                res += "direct blocks ({0}):\n".format(S5_NDIRECT_BLOCKS)
+                for i in xrange(S5_NDIRECT_BLOCKS):
+                    res += " {0:5}".format(self.get_direct_blockno(i))
+                    if ((i + 1) % 4 == 0):
+                        res += "\n"
+                if (res[-1] != "\n"):
                     res += "\n"
-            if (res[-1] != "\n"):
-                res += "\n"
-            res += "indirect block: {0}\n".format(self.get_indirect_blockno())
+                res += "indirect block: {0}\n".format(self.get_indirect_blockno())
+                res += "dindirect block: {0}\n".format(self.get_dindirect_blockno())
         elif (self.get_type() == S5_TYPE_FREE):
             res += "next free: {0}\n".format(self.get_next_free())
         res = res[:-1]
@@ -205,6 +260,8 @@ class Inode:
             size = self.get_size()
         if (self.get_type() not in set([ S5_TYPE_DATA, S5_TYPE_DIR ])):
             raise S5fsException("cannot read from inode of type " + self.get_type_str())
+        if (self.is_extent_mapped()):
+            raise S5fsException("inode {0} is extent-mapped; fsmaker only handles block-mapped files".format(self._number))
         size = min(size, min(S5_MAX_FILE_SIZE, self.get_size()) - offset)
         res = ""
         while (size > 0):
@@ -214,6 +271,8 @@ class Inode:
             if (blockno < S5_NDIRECT_BLOCKS):
                 blockno = self.get_direct_blockno(blockno)
             else:
+                if (blockno >= S5_FSMAKER_FILE_BLOCKS):
+                    raise S5fsException("fsmaker cannot read the double-indirect range (block {0})".format(blockno))
                 if (self.get_indirect_blockno() == 0):
                     blockno = 0
                 else:
@@ -232,9 +291,13 @@ class Inode:
     def write(self, offset, data):
         if (self.get_type() not in set([ S5_TYPE_DATA, S5_TYPE_DIR ])):
             raise S5fsException("cannot write to inode of type " + self.get_type_str())
+        if (self.is_extent_mapped()):
+            raise S5fsException("inode {0} is extent-mapped; fsmaker only handles block-mapped files".format(self._number))
         if (offset + len(data) > S5_MAX_FILE_SIZE):
             raise S5fsException("cannot write up to byte {0}, max file size is {1}".format(offset + len(data), S5_MAX_FILE_SIZE))
         remaining = len(data)
+        written = 0
+        indirect = None
         while (remaining > 0):
             blockloc = math.floor(offset / S5_BLOCK_SIZE)
             blockoff = offset % S5_BLOCK_SIZE
@@ -242,28 +305,33 @@ class Inode:
             if (blockloc < S5_NDIRECT_BLOCKS):
                 blockno = self.get_direct_blockno(blockloc)
             else:
+                if (blockloc >= S5_FSMAKER_FILE_BLOCKS):
+                    raise S5fsException("fsmaker cannot write the double-indirect range (block {0})".format(blockloc))
                 if (self.get_indirect_blockno() == 0):
                     indirect = self._simdisk.alloc_block()
                     indirect.zero()
                     self.set_indirect_blockno(indirect.get_blockno())
                     blockno = 0
                 else:
-                    indirect = self._simdisk.get_block(self.get_indirect_blockno())
+                    # a file has one indirect block; read it once per call,
+                    # not once per 4K of data
+                    if (indirect == None):
+                        indirect = self._simdisk.get_block(self.get_indirect_blockno())
                     blockno = struct.unpack("I", indirect.read((blockloc - S5_NDIRECT_BLOCKS) * 4, 4))[0]
             if (blockno == 0):
                 block = self._simdisk.alloc_block()
-                block.zero()
+                if (ammount != S5_BLOCK_SIZE):
+                    # partial write; the rest of the block must read back
+                    # as zeros (a full-block write needs no pre-zeroing)
+                    block.zero()
                 if (blockloc < S5_NDIRECT_BLOCKS):
                     self.set_direct_blockno(blockloc, block.get_blockno())
                 else:
-                    indirect = self._simdisk.get_block(self.get_indirect_blockno())
                     indirect.write((blockloc - S5_NDIRECT_BLOCKS) * 4, struct.pack("I", block.get_blockno()))
             else:
                 block = self._simdisk.get_block(blockno)
-            if (remaining == ammount):
-                block.write(blockoff, data[-remaining:])
-            else:
-                block.write(blockoff, data[-remaining:-remaining+ammount])
+            block.write(blockoff, data[written:written + ammount])
+            written += ammount
             remaining -= ammount
             offset += ammount
         if (offset > self.get_size()):
@@ -472,6 +540,14 @@ class Simdisk:
 
     def __init__(self, simfile):
         self._simfile = simfile
+        # sparse-output bookkeeping: on an image this process formatted,
+        # every block outside this set is still a hole in the output file
+        # (see Block.zero)
+        self._fresh = False
+        self._written = set()
+
+    def is_hole(self, blockno):
+        return self._fresh and blockno not in self._written
 
     def get_magic(self):
         self._simfile.seek(0)
@@ -539,10 +615,39 @@ class Simdisk:
         self._simfile.seek(20 + 4 * S5_NBLKS_PER_FNODE)
         self._simfile.write(struct.pack("I", val))
 
+    def get_journal_block(self):
+        self._simfile.seek(24 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_journal_block(self, val):
+        self._simfile.seek(24 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_journal_size(self):
+        self._simfile.seek(28 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_journal_size(self, val):
+        self._simfile.seek(28 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_extents(self):
+        self._simfile.seek(32 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_extents(self, val):
+        self._simfile.seek(32 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
     def get_super_block_summary(self):
         res = ""
         res += "magic:      0x{0:04x} ({1})\n".format(self.get_magic(), "VALID" if self.get_magic() == S5_MAGIC else "INVALID")
         res += "version:    0x{0:04x}{1}\n".format(self.get_version(), "" if self.get_version() == S5_CURRENT_VERSION else " (INVALID)")
+        res += "extents:    {0}\n".format("enabled" if self.get_extents() else "disabled")
+        if (self.get_journal_block()):
+            res += "journal:    blocks {0}..{1}\n".format(self.get_journal_block(), self.get_journal_block() + self.get_journal_size() - 1)
+        else:
+            res += "journal:    none (kernel will carve one at mount)\n"
         res += "num inodes: {0}\n".format(self.get_num_inodes())
         res += "free inode: {0}{1}\n".format(self.get_free_inode(), "" if self.get_free_inode() < self.get_num_inodes() else " (INVALID)")
         res += "root inode: {0}{1}\n".format(self.get_root_inode(), "" if self.get_root_inode() < self.get_num_inodes() else " (INVALID)")
@@ -556,21 +661,39 @@ class Simdisk:
         res += "  last free block: {0}\n".format(self.get_last_free_block())
         return res
 
-    def format(self, inodes, size):
+    def format(self, inodes, size, extents=False, journal=S5_JOURNAL_BLOCKS, journal_pos=0.5):
         if (inodes < 1):
             raise S5fsException("cannot format disk with {0} inodes, must have at least one".format(inodes))
         if (size % S5_BLOCK_SIZE != 0):
             raise S5fsException("cannot format disk to size {0} which is not a multiple of the block size {1}".format(size, S5_BLOCK_SIZE))
+        if (journal != 0 and journal < S5_JOURNAL_BLOCKS):
+            raise S5fsException("journal must be 0 or at least {0} blocks, the kernel's transaction layout needs that much room".format(S5_JOURNAL_BLOCKS))
+        if (journal_pos < 0.0 or journal_pos > 1.0):
+            raise S5fsException("journal position {0} must be a disk fraction between 0 and 1".format(journal_pos))
         blocks = int(size / S5_BLOCK_SIZE)
         iblocks = int(math.floor((inodes - 1) / S5_INODES_PER_BLOCK) + 1)
         if (iblocks + 1 >= blocks):
             raise S5fsException("cannot format disk of size {0} with {1} inodes, the inodes require at least {2} bytes of space".format(size, inodes, (1 + iblocks) * S5_BLOCK_SIZE))
+
+        # place the journal as a contiguous run centered on journal_pos
+        # (mid-disk by default, to halve the worst-case seek between a
+        # journal append and the in-place write it covers); on a disk too
+        # small to spare the run, leave it to the kernel, which carves one
+        # out of the free blocks at first mount if it can
+        jstart = 0
+        if (journal and iblocks + 1 + journal < blocks):
+            jstart = max(iblocks + 1, min(int(blocks * journal_pos), blocks - journal))
+        # produce a full-size sparse image: regions nothing writes to stay
+        # holes instead of being filled with explicit zero blocks
+        self._simfile.seek(0)
         self._simfile.truncate()
-        self._simfile.seek(size)
-        self._simfile.write("")
+        self._simfile.truncate(size)
+        self._fresh = True
+        self._written = set()
 
         self.set_magic(S5_MAGIC)
         self.set_version(S5_CURRENT_VERSION)
+        self.set_extents(1 if extents else 0)
         self.set_num_inodes(inodes)
         for i in xrange(inodes):
             inode = self.get_inode(i)
@@ -583,6 +706,9 @@ class Simdisk:
         self.set_last_free_block(0xffffffff)
         i = 0
         for num in xrange(iblocks+1, blocks):
+            if (jstart and num >= jstart and num < jstart + journal):
+                # reserved for the journal; not on the free list
+                continue
             if (i == S5_NBLKS_PER_FNODE - 1):
                 block = self.get_block(num)
                 for j in xrange(S5_NBLKS_PER_FNODE - 1):
@@ -595,6 +721,17 @@ class Simdisk:
                 i += 1
         self.set_nfree(i)
 
+        self.set_journal_block(jstart)
+        self.set_journal_size(journal if jstart else 0)
+        if (jstart):
+            # an empty committed transaction (sequence 0, no blocks), so the
+            # kernel's recovery pass adopts the region instead of discarding
+            # it as garbage and carving a new one
+            desc = self.get_block(jstart)
+            desc.write(0, struct.pack("III", S5_JOURNAL_DESC_MAGIC, 0, 0))
+            commit = self.get_block(jstart + 1)
+            commit.write(0, struct.pack("III", S5_JOURNAL_COMMIT_MAGIC, 0, 0))
+
         root = self.alloc_inode()
         for i in xrange(S5_NDIRECT_BLOCKS):
             root.set_direct_blockno(i, 0)
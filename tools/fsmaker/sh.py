@@ -70,6 +70,12 @@ class FsmakerShell(cmd.Cmd):
                                       help="number of inodes to put on the disk, this must be specified and be compatible with the size of the disk (there must be enough space for the inodes)")
         self._parse_format.add_option("-d", "--directory", action="store", type="str", default=None,
                                       help="initializes the disk with the contents of the specified directory")
+        self._parse_format.add_option("-e", "--extents", action="store_true", default=False,
+                                      help="enable the extent option: regular files created by the kernel map their data in (start, length) runs instead of per-block pointers")
+        self._parse_format.add_option("-j", "--journal", action="store", type="int", default=api.S5_JOURNAL_BLOCKS,
+                                      help="blocks to reserve for the kernel's metadata journal, 0 to reserve none (the kernel then carves a region at first mount), default {0}".format(api.S5_JOURNAL_BLOCKS))
+        self._parse_format.add_option("--journal-pos", action="store", type="float", default=0.5, dest="journal_pos",
+                                      help="where to place the journal, as a fraction of the disk, default 0.5 (mid-disk, minimizing the seek between journal appends and the writes they cover)")
 
     def open(self, path, create=False):
         if (path.startswith("/")):
@@ -545,15 +551,19 @@ class FsmakerShell(cmd.Cmd):
     def complete_mkdir(self, text, line, begin, end):
         return self.filepath_completion(text, line, begin, end)
 
+    # stream in large, block-aligned chunks so big files cost one buffered
+    # read and a sequential run of full-block writes per chunk
+    GETFILE_CHUNK = api.S5_BLOCK_SIZE * 512
+
     def getfile(self, source, dest):
         dest.truncate()
-        
+
         loc = 0
-        data = source.read(20000)
+        data = source.read(self.GETFILE_CHUNK)
         while (len(data) != 0):
             dest.write(loc, data)
             loc += len(data)
-            data = source.read(20000)
+            data = source.read(self.GETFILE_CHUNK)
         source.close()
 
     def do_getfile(self, args):
@@ -648,7 +658,8 @@ class FsmakerShell(cmd.Cmd):
                 size = options.size
             else:
                 size = options.blocks * api.S5_BLOCK_SIZE
-            self._simdisk.format(options.inodes, size)
+            self._simdisk.format(options.inodes, size, extents=options.extents,
+                                 journal=options.journal, journal_pos=options.journal_pos)
 
         if (options.directory):
             q = Queue.Queue()
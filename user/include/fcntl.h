@@ -16,3 +16,12 @@
 #define O_CREAT 0x100  /* Create file if non-existent. */
 #define O_TRUNC 0x200  /* Truncate to zero length. */
 #define O_APPEND 0x400 /* Append to file. */
+#define O_DIRECT 0x800    /* Bypass the block cache for file I/O. */
+#define O_NONBLOCK 0x1000 /* Fail reads/writes with EAGAIN instead of blocking. */
+
+/* Access-pattern advice for fadvise(). */
+#define FADV_NORMAL 0     /* Default readahead heuristics. */
+#define FADV_SEQUENTIAL 1 /* Expect sequential reads; prefetch eagerly. */
+#define FADV_RANDOM 2     /* Expect random reads; never prefetch. */
+#define FADV_WILLNEED 3   /* Populate the cache with the file now. */
+#define FADV_DONTNEED 4   /* Release the file's cached pages. */
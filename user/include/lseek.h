@@ -3,3 +3,9 @@
 #define SEEK_SET 0
 #define SEEK_CUR 1
 #define SEEK_END 2
+
+/* Seek to the first data byte / first hole at or after the given offset
+ * (see lseek). Filesystems without sparseness information treat the whole
+ * file as data with an implicit hole at its end. */
+#define SEEK_DATA 3
+#define SEEK_HOLE 4
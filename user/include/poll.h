@@ -0,0 +1,27 @@
+#pragma once
+
+/* Poll event bits and the pollfd structure; must match the kernel's
+ * fs/poll.h. */
+
+typedef unsigned long nfds_t;
+
+struct pollfd
+{
+    int fd;        /* file descriptor, or negative to ignore the entry */
+    short events;  /* requested events (POLLIN / POLLOUT) */
+    short revents; /* returned events */
+};
+
+#define POLLIN 0x1    /* reading would not block */
+#define POLLOUT 0x4   /* writing would not block */
+#define POLLERR 0x8   /* error condition (e.g. pipe with no readers) */
+#define POLLHUP 0x10  /* hung up (e.g. pipe with no writers) */
+#define POLLNVAL 0x20 /* fd is not open */
+
+/* Cap on nfds for one call. */
+#define POLL_MAX_NFDS 512
+
+/* Wait up to timeout milliseconds (0 = return immediately, negative =
+ * wait forever) for one of the given descriptors to become ready.
+ * Returns the number of ready entries, 0 on timeout, or -1 with errno. */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout);
@@ -5,8 +5,12 @@
 #include "stddef.h"
 #include "sys/types.h"
 
-/* Output not buffered */
-#define __IONBF 1
+/* Stream buffering disciplines (see setvbuf) */
+#define __IONBF 1 /* unbuffered: every write goes straight to the fd   */
+#define __IOLBF 2 /* line buffered: flush on newline or when full      */
+#define __IOFBF 3 /* fully buffered: flush only when the buffer fills  */
+
+#define BUFSIZ 8192
 
 #ifndef EOF
 #define EOF (-1)
@@ -16,12 +20,13 @@
 #define NULL 0
 #endif
 
-/* For now, just store a file descriptor */
+/* For now, just a file descriptor plus an output buffer */
 typedef struct
 {
     int fd;
+    int mode; /* one of __IONBF, __IOLBF, __IOFBF */
     int offset;
-    char buffer[8192];
+    char buffer[BUFSIZ];
 } FILE;
 typedef off_t fpos_t;
 extern FILE *stdin;
@@ -40,6 +45,13 @@ int sprintf(char *buf, const char *fmt, ...)
 
 int fflush(FILE *stream);
 
+int setvbuf(FILE *stream, char *buf, int mode, size_t size);
+
+void setbuf(FILE *stream, char *buf);
+
+/* Internal: push 'len' bytes through the stream's buffering discipline. */
+void __libc_stream_write(FILE *stream, const char *buf, size_t len);
+
 int vprintf(const char *fmt, va_list args)
     __attribute__((__format__(printf, 1, 0))) __attribute__((__nonnull__(1)));
 
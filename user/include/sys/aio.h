@@ -0,0 +1,56 @@
+#pragma once
+
+#include "sys/types.h"
+
+/* Asynchronous file I/O. aio_setup() creates the calling process's aio
+ * context and returns the address of its completion ring (one page,
+ * mapped shared), or (void *)-1 on error. aio_submit() queues up to
+ * AIO_MAX_SUBMIT operations and returns how many were accepted (or
+ * -errno if the first was rejected); each finished operation posts an
+ * aio_event echoing the iocb's cookie. aio_wait() blocks until at least
+ * min events are readable and returns the number available.
+ *
+ * Consume events by reading ar_events[ar_head % ar_nr] while ar_head !=
+ * ar_tail, then incrementing ar_head. Buffers must stay mapped until
+ * their completion arrives.
+ *
+ * The structure layouts are shared with the kernel (see the kernel's
+ * fs/aio.h) and must not change independently.
+ */
+
+#define AIO_READ 0
+#define AIO_WRITE 1
+#define AIO_FSYNC 2
+
+#define AIO_MAX_SUBMIT 32
+
+typedef struct aio_iocb
+{
+    int aio_fd;
+    int aio_op;
+    long aio_id; /* opaque cookie echoed in the completion */
+    void *aio_buf;
+    size_t aio_count;
+    size_t aio_offset;
+} aio_iocb_t;
+
+typedef struct aio_event
+{
+    long ae_id;
+    ssize_t ae_result; /* bytes transferred or -errno */
+} aio_event_t;
+
+typedef struct aio_ring
+{
+    volatile unsigned long ar_head; /* consumer index (yours to advance) */
+    volatile unsigned long ar_tail; /* producer index (kernel's) */
+    unsigned long ar_nr;            /* number of event slots */
+    unsigned long ar_pad;
+    aio_event_t ar_events[];
+} aio_ring_t;
+
+void *aio_setup(void);
+
+long aio_submit(aio_iocb_t *iocbs, size_t nr);
+
+long aio_wait(long min);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "sys/types.h"
+
+/* Named shared-memory objects. shmget() returns the id of the object
+ * called name, creating it with room for size bytes if needed; shmat()
+ * maps it (MAP_SHARED) and returns the address, or (void *)-1 on error;
+ * shmrm() removes the name - the memory lives until the last mapping is
+ * unmapped. Detach with munmap(). */
+
+#define SHM_NAME_LEN 32
+
+long shmget(const char *name, size_t size);
+
+void *shmat(long id, void *addr, int prot);
+
+long shmrm(long id);
@@ -49,3 +49,15 @@ typedef void (*test_fail_func_t)(const char *file, int line, const char *name,
 
 int _test_assert(int val, const char *file, int line, const char *name,
                  const char *fmt, ...);
+
+#ifndef __KERNEL__
+
+/* Returns the current TSC tick count, for test_bench-style timing. */
+uint64_t test_tsc(void);
+
+/* Runs fn(arg) iters times and prints the total and per-iteration cycle
+ * counts under the given name; returns the per-iteration count. */
+uint64_t test_bench(const char *name, size_t iters, void (*fn)(void *arg),
+                    void *arg);
+
+#endif
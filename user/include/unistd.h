@@ -17,17 +17,28 @@ struct dirent;
 
 /* User exec-related */
 int fork(void);
+int vfork(void);
 
 int execl(const char *filename, const char *arg, ...);  /* NYI */
 int execle(const char *filename, const char *arg, ...); /* NYI */
 int execv(const char *filename, char *const argv[]);    /* NYI */
 int execve(const char *filename, char *const argv[], char *const envp[]);
 
+/* Creates a new process running filename, as fork + execve would, but
+ * without ever duplicating this process's address space. Returns the
+ * child's pid. */
+pid_t spawn(const char *filename, char *const argv[], char *const envp[]);
+
 /* Kern-related */
 pid_t wait(int *status);
 
 pid_t waitpid(pid_t pid, int *status, int options);
 
+/* Creates another thread in this process, starting in entry(arg); a
+ * stack is mapped automatically when stack is NULL. entry must not
+ * return - it should call thr_exit(). */
+int thr_create(void (*entry)(void *), void *stack, void *arg);
+
 void thr_exit(int status);
 
 int thr_errno(void);
@@ -53,6 +64,34 @@ ssize_t read(int fd, void *buf, size_t count);
 
 ssize_t write(int fd, const void *buf, size_t count);
 
+struct iovec;
+
+ssize_t readv(int fd, const struct iovec *iov, size_t iovcnt);
+
+ssize_t writev(int fd, const struct iovec *iov, size_t iovcnt);
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+int fsync(int fd);
+
+int fdatasync(int fd);
+
+ssize_t sendfile(int out_fd, int in_fd, size_t count);
+
+int fadvise(int fd, int advice);
+
+/* Runs an array of syscall descriptors (see struct batch_call in
+ * weenix/syscall.h) in one kernel crossing; results land in the array. */
+struct batch_call;
+long syscall_batch(struct batch_call *calls, size_t ncalls);
+
+/* Futex-style wait/wake on a user word (ops in weenix/syscall.h);
+ * wait blocks while *addr == val, wake releases up to val waiters. */
+long futex(void *addr, int op, int val);
+long futex_requeue(void *addr, int nwake, void *addr2);
+
 off_t lseek(int fd, off_t offset, int whence);
 
 int dup(int fd);
@@ -67,6 +106,12 @@ int unlink(const char *path);
 
 int link(const char *oldpath, const char *newpath);
 
+int symlink(const char *target, const char *path);
+
+/* Reports CPU time consumed in TSC cycles, split into user and system
+ * time; who is RUSAGE_SELF or RUSAGE_CHILDREN (see weenix/syscall.h). */
+int getrusage(int who, uint64_t *utime, uint64_t *stime);
+
 int rename(const char *oldpath, const char *newpath);
 
 int chdir(const char *path);
@@ -82,6 +127,11 @@ void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
 
 int munmap(void *addr, size_t len);
 
+/* Faults the range in up front and pins it against pageout. */
+int mlock(void *addr, size_t len);
+
+int munlock(void *addr, size_t len);
+
 int brk(void *addr);
 
 void *sbrk(intptr_t incr);
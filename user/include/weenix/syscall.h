@@ -42,7 +42,7 @@
 #define SYS_munmap 26
 #define SYS_rename 27 /* NYI */
 #define SYS_uname 28
-#define SYS_thr_create 29 /* NYI */
+#define SYS_thr_create 29
 #define SYS_thr_cancel 30
 #define SYS_thr_exit 31
 #define SYS_sched_yield 32
@@ -60,6 +60,29 @@
 #define SYS_stat 47
 #define SYS_time 48
 #define SYS_usleep 49
+#define SYS_readv 50
+#define SYS_writev 51
+#define SYS_pread 52
+#define SYS_pwrite 53
+#define SYS_fsync 54
+#define SYS_fdatasync 55
+#define SYS_sendfile 56
+#define SYS_fadvise 57
+#define SYS_vfork 58
+#define SYS_batch 59
+#define SYS_shmget 60
+#define SYS_shmat 61
+#define SYS_shmrm 62
+#define SYS_futex 63
+#define SYS_poll 64
+#define SYS_mlock 65
+#define SYS_munlock 66
+#define SYS_symlink 67
+#define SYS_getrusage 68
+#define SYS_aio_setup 69
+#define SYS_aio_submit 70
+#define SYS_aio_wait 71
+#define SYS_spawn 72
 
 /*
  * ... what does the scouter say about his syscall?
@@ -128,6 +151,129 @@ typedef struct write_args
     size_t nbytes;
 } write_args_t;
 
+/* Maximum number of iovec entries accepted by readv/writev. */
+#define IOV_MAX 16
+
+typedef struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+} iovec_t;
+
+typedef struct readv_args
+{
+    int fd;
+    struct iovec *iov;
+    size_t iovcnt;
+} readv_args_t;
+
+typedef struct writev_args
+{
+    int fd;
+    struct iovec *iov;
+    size_t iovcnt;
+} writev_args_t;
+
+typedef struct sendfile_args
+{
+    int out_fd;
+    int in_fd;
+    size_t count;
+} sendfile_args_t;
+
+typedef struct fadvise_args
+{
+    int fd;
+    int advice;
+} fadvise_args_t;
+
+typedef struct pread_args
+{
+    int fd;
+    void *buf;
+    size_t nbytes;
+    off_t offset;
+} pread_args_t;
+
+typedef struct pwrite_args
+{
+    int fd;
+    void *buf;
+    size_t nbytes;
+    off_t offset;
+} pwrite_args_t;
+
+/* One entry in a SYS_batch request: the syscall number and argument word
+ * exactly as they would be passed to a lone trap, with the return value
+ * and errno of the call written back in place. */
+typedef struct batch_call
+{
+    size_t bc_sysnum;
+    uintptr_t bc_arg;
+    long bc_ret;
+    long bc_errno;
+} batch_call_t;
+
+typedef struct batch_args
+{
+    struct batch_call *ba_calls;
+    size_t ba_ncalls;
+} batch_args_t;
+
+#define BATCH_MAX_CALLS 64
+
+typedef struct shmget_args
+{
+    argstr_t name;
+    size_t size;
+} shmget_args_t;
+
+typedef struct shmat_args
+{
+    long id;
+    void *addr;
+    int prot;
+} shmat_args_t;
+
+/* ops for futex(); see the kernel's proc/futex.h */
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_REQUEUE 2
+
+typedef struct futex_args
+{
+    void *addr;
+    int op;
+    int val;
+    void *addr2; /* FUTEX_REQUEUE only: where leftover waiters move */
+} futex_args_t;
+
+typedef struct poll_args
+{
+    void *fds; /* struct pollfd array, see fs/poll.h */
+    unsigned long nfds;
+    int timeout; /* milliseconds; 0 = no wait, negative = wait forever */
+} poll_args_t;
+
+typedef struct aio_submit_args
+{
+    void *iocbs; /* aio_iocb_t array, see sys/aio.h */
+    size_t nr;   /* at most AIO_MAX_SUBMIT */
+} aio_submit_args_t;
+
+typedef struct mlock_args
+{
+    void *addr;
+    size_t len;
+} mlock_args_t;
+
+typedef struct thr_create_args
+{
+    void *tca_entry; /* function the new thread starts in; must not return */
+    void *tca_stack; /* initial stack pointer, or NULL to have one mapped */
+    void *tca_arg;   /* passed to entry as its only argument */
+} thr_create_args_t;
+
 typedef struct mkdir_args
 {
     argstr_t path;
@@ -140,6 +286,23 @@ typedef struct link_args
     argstr_t from;
 } link_args_t;
 
+typedef struct symlink_args
+{
+    argstr_t target;
+    argstr_t linkpath;
+} symlink_args_t;
+
+/* Values for rusage_args.ru_who (mirroring proc/proc.h). */
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN (-1)
+
+typedef struct rusage_args
+{
+    int ru_who;        /* RUSAGE_SELF or RUSAGE_CHILDREN */
+    uint64_t ru_utime; /* out: user CPU time, TSC cycles */
+    uint64_t ru_stime; /* out: system CPU time, TSC cycles */
+} rusage_args_t;
+
 typedef struct execve_args
 {
     argstr_t filename;
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "sys/types.h"
+
+/*
+ * The shared time page: one read-only page the kernel maps into every
+ * process at TIMEPAGE_ADDR, republished from the timer interrupt under
+ * a seqlock (tp_seq is odd while an update is in flight). Reading it
+ * costs no syscall; see timepage_now_usec in lib/libc/timepage.c.
+ *
+ * The layout is ABI shared with the kernel
+ * (kernel/include/vm/timepage.h); keep the two in sync.
+ */
+typedef struct time_page
+{
+    uint64_t tp_seq;          /* odd while an update is in flight */
+    uint64_t tp_ticks;        /* timer ticks since boot */
+    uint64_t tp_tick_usec;    /* microseconds per tick */
+    uint64_t tp_tsc_at_tick;  /* rdtsc when tp_ticks was written */
+    uint64_t tp_tsc_per_tick; /* rdtsc delta across the last tick */
+    uint64_t tp_boot_sec;     /* wall-clock (Unix) seconds at boot */
+} time_page_t;
+
+/* Fixed virtual address the kernel maps the page at: the top page of
+ * user memory. */
+#define TIMEPAGE_ADDR 0x7ffffffff000UL
+
+/* Microseconds since boot, interpolated below tick granularity with
+ * rdtsc. No syscall. */
+uint64_t timepage_now_usec(void);
+
+/* Wall-clock (Unix) seconds, like time(NULL) but without the syscall. */
+time_t timepage_time(void);
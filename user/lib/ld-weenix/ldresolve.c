@@ -10,6 +10,8 @@
  *  Desc: Modified for x86-64
  */
 
+#include "stdio.h"
+#include "stdlib.h"
 #include "string.h"
 
 #include "ldresolve.h"
@@ -114,6 +116,13 @@ Elf64_Addr _rtresolve(module_t *mod, Elf64_Word reloff)
     int sym = ELF64_R_SYM(rel->r_info);
     const char *name = mod->dynstr + mod->dynsym[sym].st_name;
     ldsym_t symbol = _ldresolve(mod, name, -1, 0, 0);
+    if (!symbol)
+    {
+        /* A lazily bound call to a symbol nothing defines; without this
+         * check the trampoline would "return" to address 0. */
+        fprintf(stderr, "ld.so.1: panic - unresolved symbol \"%s\"\n", name);
+        exit(LD_ERR_EXIT);
+    }
     *(Elf64_Addr *)(mod->base + rel->r_offset) = (Elf64_Addr)symbol;
     return (Elf64_Addr)symbol;
 }
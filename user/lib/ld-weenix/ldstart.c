@@ -159,6 +159,9 @@ static module_t *_ldlinkobj(module_t *info, const char *baseaddr,
         case DT_BIND_NOW:
             _ldenv.ld_bind_now = 1;
             break;
+        case DT_RELACOUNT:
+            info->nrelative = curdyn->d_un.d_val;
+            break;
         case DT_RELENT:
         case DT_RELAENT:
             d_relocent = curdyn->d_un.d_val;
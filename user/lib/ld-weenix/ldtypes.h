@@ -50,6 +50,7 @@ typedef struct module
     Elf64_Rela *reloc;    /* normal relocations           */
 
     size_t nreloc;    /* number of relocation entries */
+    size_t nrelative; /* leading R_X86_64_RELATIVE run (DT_RELACOUNT) */
     size_t npltreloc; /* number of relocation entries */
 
     struct module *next;  /* the next module in the chain */
@@ -1,11 +1,108 @@
 #include "stdio.h"
+#include "string.h"
+#include "unistd.h"
 
+/* stdout is line buffered because it usually talks to the console; a
+ * program that redirects its output to a regular file can switch to
+ * full buffering with setvbuf(stdout, NULL, __IOFBF, 0) to batch whole
+ * buffers through single write calls. stderr is unbuffered so that
+ * diagnostics appear even if the process dies before a flush. */
 static FILE stdstreams[3] = {
-    {.fd = 0, .offset = 0},
-    {.fd = 1, .offset = 0},
-    {.fd = 2, .offset = 0},
+    {.fd = 0, .mode = __IONBF, .offset = 0},
+    {.fd = 1, .mode = __IOLBF, .offset = 0},
+    {.fd = 2, .mode = __IONBF, .offset = 0},
 };
 
 FILE *stdin = &stdstreams[0];
 FILE *stdout = &stdstreams[1];
 FILE *stderr = &stdstreams[2];
+
+static void __do_fflush(FILE *stream)
+{
+    if (!stream)
+    {
+        return;
+    }
+
+    if (stream->offset > 0)
+    {
+        write(stream->fd, stream->buffer, stream->offset);
+        stream->offset = 0;
+    }
+}
+
+int fflush(FILE *stream)
+{
+    if (!stream)
+    {
+        __do_fflush(stdin);
+        __do_fflush(stdout);
+        __do_fflush(stderr);
+    }
+    else
+    {
+        __do_fflush(stream);
+    }
+
+    return 0;
+}
+
+/* The buffer argument is accepted for source compatibility but ignored;
+ * every stream uses its built-in BUFSIZ buffer. */
+int setvbuf(FILE *stream, char *buf, int mode, size_t size)
+{
+    if (mode != __IONBF && mode != __IOLBF && mode != __IOFBF)
+    {
+        return -1;
+    }
+
+    __do_fflush(stream);
+    stream->mode = mode;
+    return 0;
+}
+
+void setbuf(FILE *stream, char *buf)
+{
+    setvbuf(stream, buf, buf ? __IOFBF : __IONBF, BUFSIZ);
+}
+
+/* Append 'len' bytes to the stream's buffer, flushing according to its
+ * buffering discipline. All of the formatted output routines funnel
+ * through here, so a chatty program costs one write syscall per filled
+ * buffer (or per line on the console) instead of one per printf. */
+void __libc_stream_write(FILE *stream, const char *buf, size_t len)
+{
+    if (stream->mode == __IONBF)
+    {
+        __do_fflush(stream);
+        write(stream->fd, buf, len);
+        return;
+    }
+
+    int flush_line = 0;
+    if (stream->mode == __IOLBF && memchr(buf, '\n', len))
+    {
+        flush_line = 1;
+    }
+
+    while (len > 0)
+    {
+        size_t space = sizeof(stream->buffer) - stream->offset;
+        size_t chunk = (len < space) ? len : space;
+
+        memcpy(stream->buffer + stream->offset, buf, chunk);
+        stream->offset += chunk;
+        buf += chunk;
+        len -= chunk;
+
+        if (stream->offset == sizeof(stream->buffer))
+        {
+            __do_fflush(stream);
+        }
+    }
+
+    if (flush_line)
+    {
+        __do_fflush(stream);
+    }
+}
@@ -8,6 +8,9 @@
 #include "weenix/trap.h"
 
 #include "dirent.h"
+#include "poll.h"
+#include "sys/aio.h"
+#include "sys/shm.h"
 
 static void *__curbrk = NULL;
 #define MAX_EXIT_HANDLERS 32
@@ -71,6 +74,8 @@ int brk(void *addr)
 
 pid_t fork(void) { return (pid_t)trap(SYS_fork, 0); }
 
+pid_t vfork(void) { return (pid_t)trap(SYS_vfork, 0); }
+
 int atexit(void (*func)(void))
 {
     if (atexit_handlers < MAX_EXIT_HANDLERS)
@@ -124,6 +129,17 @@ pid_t waitpid(pid_t pid, int *status, int options)
     return (int)trap(SYS_waitpid, (uintptr_t)&args);
 }
 
+int thr_create(void (*entry)(void *), void *stack, void *arg)
+{
+    thr_create_args_t args;
+
+    args.tca_entry = (void *)entry;
+    args.tca_stack = stack;
+    args.tca_arg = arg;
+
+    return (int)trap(SYS_thr_create, (uintptr_t)&args);
+}
+
 void thr_exit(int status) { trap(SYS_thr_exit, (ssize_t)status); }
 
 pid_t getpid(void) { return (int)trap(SYS_getpid, 0); }
@@ -154,6 +170,99 @@ int munmap(void *addr, size_t len)
     return (int)trap(SYS_munmap, (uintptr_t)&args);
 }
 
+int mlock(void *addr, size_t len)
+{
+    mlock_args_t args;
+
+    args.addr = addr;
+    args.len = len;
+
+    return (int)trap(SYS_mlock, (uintptr_t)&args);
+}
+
+int munlock(void *addr, size_t len)
+{
+    mlock_args_t args;
+
+    args.addr = addr;
+    args.len = len;
+
+    return (int)trap(SYS_munlock, (uintptr_t)&args);
+}
+
+long shmget(const char *name, size_t size)
+{
+    shmget_args_t args;
+
+    args.name.as_str = name;
+    args.name.as_len = strlen(name);
+    args.size = size;
+
+    return trap(SYS_shmget, (uintptr_t)&args);
+}
+
+void *shmat(long id, void *addr, int prot)
+{
+    shmat_args_t args;
+
+    args.id = id;
+    args.addr = addr;
+    args.prot = prot;
+
+    return (void *)trap(SYS_shmat, (uintptr_t)&args);
+}
+
+long shmrm(long id) { return trap(SYS_shmrm, (uintptr_t)id); }
+
+long futex(void *addr, int op, int val)
+{
+    futex_args_t args;
+
+    args.addr = addr;
+    args.op = op;
+    args.val = val;
+    args.addr2 = NULL;
+
+    return trap(SYS_futex, (uintptr_t)&args);
+}
+
+long futex_requeue(void *addr, int nwake, void *addr2)
+{
+    futex_args_t args;
+
+    args.addr = addr;
+    args.op = FUTEX_REQUEUE;
+    args.val = nwake;
+    args.addr2 = addr2;
+
+    return trap(SYS_futex, (uintptr_t)&args);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    poll_args_t args;
+
+    args.fds = fds;
+    args.nfds = nfds;
+    args.timeout = timeout;
+
+    return (int)trap(SYS_poll, (uintptr_t)&args);
+}
+
+void *aio_setup(void) { return (void *)trap(SYS_aio_setup, (uintptr_t)NULL); }
+
+long aio_submit(aio_iocb_t *iocbs, size_t nr)
+{
+    aio_submit_args_t args;
+
+    args.iocbs = iocbs;
+    args.nr = nr;
+
+    return trap(SYS_aio_submit, (uintptr_t)&args);
+}
+
+long aio_wait(long min) { return trap(SYS_aio_wait, (uintptr_t)min); }
+
 int debug(const char *str)
 {
     argstr_t argstr;
@@ -209,6 +318,87 @@ ssize_t write(int fd, const void *buf, size_t nbytes)
     return trap(SYS_write, (uintptr_t)&args);
 }
 
+ssize_t readv(int fd, const struct iovec *iov, size_t iovcnt)
+{
+    readv_args_t args;
+
+    args.fd = fd;
+    args.iov = (struct iovec *)iov;
+    args.iovcnt = iovcnt;
+
+    return trap(SYS_readv, (uintptr_t)&args);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, size_t iovcnt)
+{
+    writev_args_t args;
+
+    args.fd = fd;
+    args.iov = (struct iovec *)iov;
+    args.iovcnt = iovcnt;
+
+    return trap(SYS_writev, (uintptr_t)&args);
+}
+
+ssize_t pread(int fd, void *buf, size_t nbytes, off_t offset)
+{
+    pread_args_t args;
+
+    args.fd = fd;
+    args.buf = buf;
+    args.nbytes = nbytes;
+    args.offset = offset;
+
+    return trap(SYS_pread, (uintptr_t)&args);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t nbytes, off_t offset)
+{
+    pwrite_args_t args;
+
+    args.fd = fd;
+    args.buf = (void *)buf;
+    args.nbytes = nbytes;
+    args.offset = offset;
+
+    return trap(SYS_pwrite, (uintptr_t)&args);
+}
+
+long syscall_batch(struct batch_call *calls, size_t ncalls)
+{
+    batch_args_t args;
+
+    args.ba_calls = calls;
+    args.ba_ncalls = ncalls;
+
+    return trap(SYS_batch, (uintptr_t)&args);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, size_t count)
+{
+    sendfile_args_t args;
+
+    args.out_fd = out_fd;
+    args.in_fd = in_fd;
+    args.count = count;
+
+    return trap(SYS_sendfile, (uintptr_t)&args);
+}
+
+int fadvise(int fd, int advice)
+{
+    fadvise_args_t args;
+
+    args.fd = fd;
+    args.advice = advice;
+
+    return (int)trap(SYS_fadvise, (uintptr_t)&args);
+}
+
+int fsync(int fd) { return (int)trap(SYS_fsync, (ssize_t)fd); }
+
+int fdatasync(int fd) { return (int)trap(SYS_fdatasync, (ssize_t)fd); }
+
 int close(int fd) { return (int)trap(SYS_close, (ssize_t)fd); }
 
 int dup(int fd) { return (int)trap(SYS_dup, (ssize_t)fd); }
@@ -262,6 +452,41 @@ int link(const char *from, const char *to)
     return (int)trap(SYS_link, (uintptr_t)&args);
 }
 
+int getrusage(int who, uint64_t *utime, uint64_t *stime)
+{
+    rusage_args_t args;
+
+    args.ru_who = who;
+    args.ru_utime = 0;
+    args.ru_stime = 0;
+
+    int ret = (int)trap(SYS_getrusage, (uintptr_t)&args);
+    if (ret == 0)
+    {
+        if (utime)
+        {
+            *utime = args.ru_utime;
+        }
+        if (stime)
+        {
+            *stime = args.ru_stime;
+        }
+    }
+    return ret;
+}
+
+int symlink(const char *target, const char *path)
+{
+    symlink_args_t args;
+
+    args.target.as_len = strlen(target);
+    args.target.as_str = target;
+    args.linkpath.as_len = strlen(path);
+    args.linkpath.as_str = path;
+
+    return (int)trap(SYS_symlink, (uintptr_t)&args);
+}
+
 int rename(const char *oldpath, const char *newpath)
 {
     rename_args_t args;
@@ -325,6 +550,48 @@ int execve(const char *filename, char *const argv[], char *const envp[])
     return (int)trap(SYS_execve, (uintptr_t)&args);
 }
 
+pid_t spawn(const char *filename, char *const argv[], char *const envp[])
+{
+    execve_args_t args;
+
+    size_t i;
+
+    args.filename.as_len = strlen(filename);
+    args.filename.as_str = filename;
+
+    /* Build argv vector */
+    for (i = 0; argv[i] != NULL; i++)
+        ;
+    args.argv.av_len = i;
+    args.argv.av_vec = malloc((args.argv.av_len + 1) * sizeof(argstr_t));
+    for (i = 0; argv[i] != NULL; i++)
+    {
+        args.argv.av_vec[i].as_len = strlen(argv[i]);
+        args.argv.av_vec[i].as_str = argv[i];
+    }
+    args.argv.av_vec[i].as_len = 0;
+    args.argv.av_vec[i].as_str = NULL;
+
+    /* Build envp vector */
+    for (i = 0; envp[i] != NULL; i++)
+        ;
+    args.envp.av_len = i;
+    args.envp.av_vec = malloc((args.envp.av_len + 1) * sizeof(argstr_t));
+    for (i = 0; envp[i] != NULL; i++)
+    {
+        args.envp.av_vec[i].as_len = strlen(envp[i]);
+        args.envp.av_vec[i].as_str = envp[i];
+    }
+    args.envp.av_vec[i].as_len = 0;
+    args.envp.av_vec[i].as_str = NULL;
+
+    /* Unlike execve we keep running afterwards, so clean up */
+    pid_t pid = (pid_t)trap(SYS_spawn, (uintptr_t)&args);
+    free(args.argv.av_vec);
+    free(args.envp.av_vec);
+    return pid;
+}
+
 void thr_set_errno(int n) { trap(SYS_set_errno, (ssize_t)n); }
 
 int thr_errno(void) { return (int)trap(SYS_errno, 0); }
@@ -0,0 +1,51 @@
+#include <weenix/timepage.h>
+
+/*
+ * Syscall-free time, read from the shared page the kernel maps at
+ * TIMEPAGE_ADDR (see kernel/vm/timepage.c). The page holds the timer
+ * tick count and the rdtsc reading taken at that tick, published under
+ * a seqlock; we snapshot the fields, then interpolate the time since
+ * the tick from our own rdtsc.
+ */
+
+static uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t timepage_now_usec(void)
+{
+    volatile time_page_t *tp = (volatile time_page_t *)TIMEPAGE_ADDR;
+    uint64_t seq, ticks, tick_usec, tsc_at, tsc_per;
+    do
+    {
+        seq = tp->tp_seq;
+        __asm__ volatile("" ::: "memory");
+        ticks = tp->tp_ticks;
+        tick_usec = tp->tp_tick_usec;
+        tsc_at = tp->tp_tsc_at_tick;
+        tsc_per = tp->tp_tsc_per_tick;
+        __asm__ volatile("" ::: "memory");
+    } while ((seq & 1) || tp->tp_seq != seq);
+
+    uint64_t frac = 0;
+    if (tsc_per)
+    {
+        frac = (rdtsc() - tsc_at) * tick_usec / tsc_per;
+        /* Never run past the next tick: a late or stalled tick handler
+         * must not make time jump ahead and then backwards. */
+        if (frac > tick_usec)
+        {
+            frac = tick_usec;
+        }
+    }
+    return ticks * tick_usec + frac;
+}
+
+time_t timepage_time(void)
+{
+    volatile time_page_t *tp = (volatile time_page_t *)TIMEPAGE_ADDR;
+    return (time_t)(tp->tp_boot_sec + timepage_now_usec() / 1000000);
+}
@@ -200,3 +200,26 @@ int _test_assert(int val, const char *file, int line, const char *name,
     va_end(args);
     return val;
 }
+
+uint64_t test_tsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t test_bench(const char *name, size_t iters, void (*fn)(void *arg),
+                    void *arg)
+{
+    uint64_t start = test_tsc();
+    for (size_t i = 0; i < iters; i++)
+    {
+        fn(arg);
+    }
+    uint64_t cycles = test_tsc() - start;
+    uint64_t per = iters ? cycles / iters : 0;
+
+    printf("%s: %lu iterations, %lu cycles (%lu cycles/iteration)\n", name,
+           iters, cycles, per);
+    return per;
+}
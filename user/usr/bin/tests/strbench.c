@@ -0,0 +1,105 @@
+/*
+ * Correctness checks and benchmarks for the optimized memcpy/memset in
+ * lib/libc/string.c. The correctness pass walks sizes across all the
+ * implementation's regimes (byte tail, word loop, SSE2 loop, rep movsb)
+ * at misaligned offsets and compares against byte-at-a-time references;
+ * the benchmark pass reports cycles per call at representative sizes via
+ * the libtest test_bench harness.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <test/test.h>
+
+#define BUF_SIZE 65536
+
+static char src_buf[BUF_SIZE + 64];
+static char dst_buf[BUF_SIZE + 64];
+
+static const size_t check_sizes[] = {0,  1,  3,   7,   8,   9,    15,   16,
+                                     17, 31, 63,  64,  100, 255,  256,  257,
+                                     511, 1000, 4096, 10000};
+
+static void check_memcpy(size_t size, size_t soff, size_t doff)
+{
+    char *src = src_buf + soff;
+    char *dst = dst_buf + doff;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        src[i] = (char)(i * 7 + 3);
+    }
+    memset(dst_buf, 0, sizeof(dst_buf));
+
+    test_assert(memcpy(dst, src, size) == dst, "memcpy return value");
+
+    int ok = 1;
+    for (size_t i = 0; i < size && ok; i++)
+    {
+        ok = dst[i] == src[i];
+    }
+    /* The canary bytes around the destination must be untouched. */
+    ok = ok && (doff == 0 || dst[-1] == 0) && dst[size] == 0;
+    test_assert(ok, "memcpy of %lu bytes at offsets +%lu/+%lu", size, soff,
+                doff);
+}
+
+static void check_memset(size_t size, size_t doff)
+{
+    char *dst = dst_buf + doff;
+
+    memset(dst_buf, 0, sizeof(dst_buf));
+    test_assert(memset(dst, 0xa5, size) == dst, "memset return value");
+
+    int ok = 1;
+    for (size_t i = 0; i < size && ok; i++)
+    {
+        ok = dst[i] == (char)0xa5;
+    }
+    ok = ok && (doff == 0 || dst[-1] == 0) && dst[size] == 0;
+    test_assert(ok, "memset of %lu bytes at offset +%lu", size, doff);
+}
+
+static size_t bench_size;
+
+static void bench_memcpy(void *arg)
+{
+    memcpy(dst_buf, src_buf, bench_size);
+}
+
+static void bench_memset(void *arg)
+{
+    memset(dst_buf, 0, bench_size);
+}
+
+int main(int argc, char **argv)
+{
+    test_init();
+
+    for (size_t i = 0; i < sizeof(check_sizes) / sizeof(check_sizes[0]); i++)
+    {
+        for (size_t off = 0; off < 3; off++)
+        {
+            check_memcpy(check_sizes[i], off, 0);
+            check_memcpy(check_sizes[i], 0, off);
+            check_memcpy(check_sizes[i], off, off + 1);
+            check_memset(check_sizes[i], off);
+        }
+    }
+
+    static const size_t bench_sizes[] = {16, 64, 256, 4096, BUF_SIZE};
+    char name[64];
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+    {
+        bench_size = bench_sizes[i];
+        snprintf(name, sizeof(name), "memcpy %lu", bench_size);
+        test_bench(name, 10000, bench_memcpy, NULL);
+        snprintf(name, sizeof(name), "memset %lu", bench_size);
+        test_bench(name, 10000, bench_memset, NULL);
+    }
+
+    test_fini();
+    return 0;
+}